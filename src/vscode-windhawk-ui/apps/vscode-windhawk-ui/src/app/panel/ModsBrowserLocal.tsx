@@ -22,6 +22,7 @@ import {
   useSetNewModConfig,
   useUpdateInstalledModsDetails,
   useUpdateModRating,
+  useUpdateMods,
 } from '../webviewIPC';
 import {
   ModConfig,
@@ -373,6 +374,29 @@ function ModsBrowserLocal({ ContentWrapper }: Props) {
     )
   );
 
+  const { updateMods, updateModsPending } = useUpdateMods(
+    useCallback(
+      (data) => {
+        if (installedMods) {
+          setInstalledMods(
+            produce(installedMods, (draft) => {
+              for (const { modId, installedModDetails } of data.results) {
+                if (installedModDetails) {
+                  const { metadata, config } = installedModDetails;
+                  draft[modId] = draft[modId] || {};
+                  draft[modId].metadata = metadata;
+                  draft[modId].config = config;
+                  draft[modId].updateAvailable = false;
+                }
+              }
+            })
+          );
+        }
+      },
+      [installedMods]
+    )
+  );
+
   const { compileMod, compileModPending } = useCompileMod(
     useCallback(
       (data) => {
@@ -478,7 +502,11 @@ function ModsBrowserLocal({ ContentWrapper }: Props) {
   };
 
   // Block all navigation when modal is open
-  const modalIsOpen = installModPending || compileModPending || confirmModalOpen;
+  const modalIsOpen =
+    installModPending ||
+    updateModsPending ||
+    compileModPending ||
+    confirmModalOpen;
 
   useBlocker(({ currentLocation, nextLocation }) => {
     return modalIsOpen && currentLocation.pathname !== nextLocation.pathname;
@@ -489,6 +517,9 @@ function ModsBrowserLocal({ ContentWrapper }: Props) {
   }
 
   const noInstalledMods = Object.keys(installedMods).length === 0;
+  const modsWithUpdates = Object.entries(installedMods).filter(
+    ([modId, mod]) => mod.updateAvailable && !modId.startsWith('local@')
+  );
   const noFilteredResults = installedModsFilteredAndSorted.length === 0 && !noInstalledMods;
 
   return (
@@ -499,6 +530,23 @@ function ModsBrowserLocal({ ContentWrapper }: Props) {
             <h2>
               <SectionIcon icon={faHdd} /> {t('home.installedMods.title')}
             </h2>
+            {modsWithUpdates.length > 1 && (
+              <Button
+                type="primary"
+                onClick={() =>
+                  updateMods({
+                    mods: modsWithUpdates.map(([modId, mod]) => ({
+                      modId,
+                      disabled: mod.config?.disabled,
+                    })),
+                  })
+                }
+              >
+                {t('home.installedMods.updateAll', {
+                  count: modsWithUpdates.length,
+                })}
+              </Button>
+            )}
           </SectionHeader>
           {!noInstalledMods && (
             <SearchFilterContainer>
@@ -985,7 +1033,7 @@ function ModsBrowserLocal({ ContentWrapper }: Props) {
           )}
         </ContentWrapper>
       )}
-      {(installModPending || compileModPending) && (
+      {(installModPending || updateModsPending || compileModPending) && (
         <Modal open={true} closable={false} footer={null}>
           <ProgressSpin
             size="large"
@@ -994,7 +1042,9 @@ function ModsBrowserLocal({ ContentWrapper }: Props) {
                 ? installModContext?.updating
                   ? t('general.updating')
                   : t('general.installing')
-                : compileModPending
+                : updateModsPending
+                  ? t('general.updating')
+                  : compileModPending
                   ? t('general.compiling')
                   : ''
             }
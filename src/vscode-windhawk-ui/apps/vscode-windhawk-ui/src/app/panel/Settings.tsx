@@ -234,6 +234,23 @@ function Settings() {
             }}
           />
         </List.Item>
+        <List.Item>
+          <SettingsListItemMeta
+            title={t('settings.sendModPerformanceStats.title')}
+            description={t('settings.sendModPerformanceStats.description')}
+          />
+          <Switch
+            checked={appSettings.sendModPerformanceStats}
+            disabled={appSettings.disableUpdateCheck}
+            onChange={(checked) => {
+              updateAppSettings({
+                appSettings: {
+                  sendModPerformanceStats: checked,
+                },
+              });
+            }}
+          />
+        </List.Item>
         <List.Item>
           <SettingsListItemMeta
             title={t('settings.devMode.title')}
@@ -296,6 +313,43 @@ function Settings() {
                 }}
               />
             </List.Item>
+            <List.Item>
+              <SettingsListItemMeta
+                title={t('settings.optimizeCompiledModsForSize.title')}
+                description={t(
+                  'settings.optimizeCompiledModsForSize.description'
+                )}
+              />
+              <Switch
+                checked={appSettings.optimizeCompiledModsForSize}
+                onChange={(checked) => {
+                  updateAppSettings({
+                    appSettings: {
+                      optimizeCompiledModsForSize: checked,
+                    },
+                  });
+                }}
+              />
+            </List.Item>
+            {/* Only the non-portable version has a service. */}
+            {appSettings.disableRunUIScheduledTask !== null && (
+              <List.Item>
+                <SettingsListItemMeta
+                  title={t('settings.launchTrayOnDemand.title')}
+                  description={t('settings.launchTrayOnDemand.description')}
+                />
+                <Switch
+                  checked={appSettings.launchTrayOnDemand}
+                  onChange={(checked) => {
+                    updateAppSettings({
+                      appSettings: {
+                        launchTrayOnDemand: checked,
+                      },
+                    });
+                  }}
+                />
+              </List.Item>
+            )}
             {appSettings.disableRunUIScheduledTask !== null && (
               <List.Item>
                 <SettingsListItemMeta
@@ -18,11 +18,14 @@ export const mockSettings = !useMockData
   : {
     language: 'en',
     disableUpdateCheck: false,
+    sendModPerformanceStats: false,
     disableRunUIScheduledTask: false,
     devModeOptOut: false,
     devModeUsedAtLeastOnce: false,
     hideTrayIcon: false,
+    launchTrayOnDemand: false,
     alwaysCompileModsLocally: false,
+    optimizeCompiledModsForSize: false,
     dontAutoShowToolkit: false,
     modTasksDialogDelay: 2000,
     safeMode: false,
@@ -53,7 +53,9 @@ import {
   UpdateModConfigData,
   UpdateModConfigReplyData,
   UpdateModRatingData,
-  UpdateModRatingReplyData
+  UpdateModRatingReplyData,
+  UpdateModsData,
+  UpdateModsReplyData
 } from './webviewIPCMessages';
 
 // Message types:
@@ -263,6 +265,21 @@ export function useInstallMod<TContext extends Record<string, unknown>>(
   };
 }
 
+export function useUpdateMods<TContext extends Record<string, unknown>>(
+  handler: (data: UpdateModsReplyData, context?: TContext) => void
+) {
+  const result = usePostMessageWithReplyWithHandler<
+    UpdateModsData,
+    UpdateModsReplyData,
+    TContext
+  >('updateMods', handler);
+  return {
+    updateMods: result.postMessage,
+    updateModsPending: result.pending,
+    updateModsContext: result.context,
+  };
+}
+
 export function useCompileMod<TContext extends Record<string, unknown>>(
   handler: (data: CompileModReplyData, context?: TContext) => void
 ) {
@@ -70,11 +70,14 @@ export type ModConfig = {
 export type AppSettings = {
   language: string;
   disableUpdateCheck: boolean;
+  sendModPerformanceStats: boolean;
   disableRunUIScheduledTask: boolean | null;
   devModeOptOut: boolean;
   devModeUsedAtLeastOnce: boolean;
   hideTrayIcon: boolean;
+  launchTrayOnDemand: boolean;
   alwaysCompileModsLocally: boolean;
+  optimizeCompiledModsForSize: boolean;
   dontAutoShowToolkit: boolean;
   modTasksDialogDelay: number;
   safeMode: boolean;
@@ -98,12 +101,14 @@ export type ModMetadata = Partial<{
   compilerOptions: string;
   license: string;
   donateUrl: string;
+  atomicReconfigure: string;
   name: string;
   description: string;
   author: string;
   include: string[];
   exclude: string[];
   architecture: string[];
+  loadWithModule: string[];
 }>;
 
 export type RepositoryDetails = {
@@ -177,6 +182,17 @@ export type InstallModReplyData = {
   } | null;
 };
 
+export type UpdateModsData = {
+  mods: {
+    modId: string;
+    disabled?: boolean;
+  }[];
+};
+
+export type UpdateModsReplyData = {
+  results: InstallModReplyData[];
+};
+
 export type CompileModData = {
   modId: string;
   disabled?: boolean;
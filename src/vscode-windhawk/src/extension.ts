@@ -1,5 +1,6 @@
 import * as fs from 'fs';
 import fetch from 'node-fetch';
+import * as os from 'os';
 import * as path from 'path';
 import * as semver from 'semver';
 import * as vscode from 'vscode';
@@ -13,6 +14,7 @@ import EditorWorkspaceUtils from './utils/editorWorkspaceUtils';
 import { ModConfigUtils, ModConfigUtilsNonPortable, ModConfigUtilsPortable } from './utils/modConfigUtils';
 import ModFilesUtils from './utils/modFilesUtils';
 import ModSourceUtils from './utils/modSourceUtils';
+import SymbolHookUtils, { extractSymbolModuleNames } from './utils/symbolHookUtils';
 import TrayProgramUtils from './utils/trayProgramUtils';
 import { UpdateUtils } from './utils/updateUtils';
 import UserProfileUtils, { UserProfile } from './utils/userProfileUtils';
@@ -48,14 +50,24 @@ import {
 	UpdateAppSettingsData,
 	UpdateInstalledModsDetailsData,
 	UpdateModConfigData,
-	UpdateModRatingData
+	UpdateModRatingData,
+	UpdateModsData,
+	UpdateModsReplyData
 } from './webviewIPCMessages';
 
+type ModInstallBuild = {
+	metadata: ModMetadata,
+	initialSettings: Record<string, string | number> | null,
+	previousInitialSettings?: Record<string, string | number>,
+	targetDllName: string
+};
+
 type AppUtils = {
 	modSource: ModSourceUtils,
 	modConfig: ModConfigUtils,
 	modFiles: ModFilesUtils,
 	compiler: CompilerUtils,
+	symbolHook: SymbolHookUtils,
 	editorWorkspace: EditorWorkspaceUtils,
 	trayProgram: TrayProgramUtils,
 	userProfile: UserProfileUtils,
@@ -63,6 +75,10 @@ type AppUtils = {
 	update: UpdateUtils
 };
 
+// Mod sources and precompiled mod binaries are fetched with at most this many
+// requests at a time when updating several mods.
+const modUpdateFetchConcurrency = 8;
+
 // Set to a local folder to use a dev environment.
 // Set to null to use the 'webview' folder.
 const baseDebugReactUiPath: string | null = config.debug.reactProjectBuildPath;
@@ -83,13 +99,17 @@ export function activate(context: vscode.ExtensionContext) {
 	try {
 		i18n.init(context.extensionPath);
 
-		windhawkLogOutput = new WindhawkLogOutput(path.join(context.extensionPath, 'files', 'DbgViewMini.exe'));
 		windhawkCompilerOutput = vscode.window.createOutputChannel('Windhawk Compiler');
 
 		const arm64Enabled = process.env.WINDHAWK_ARM64_ENABLED === '1';
 
 		const paths = storagePaths.getStoragePaths();
 		const { appRootPath, appDataPath, enginePath, compilerPath } = paths.fsPaths;
+
+		windhawkLogOutput = new WindhawkLogOutput(
+			path.join(context.extensionPath, 'files', 'DbgViewMini.exe'),
+			path.join(appRootPath, 'windhawk.exe')
+		);
 		const utils: AppUtils = {
 			modSource: new ModSourceUtils(appDataPath),
 			modConfig: paths.portable
@@ -97,6 +117,7 @@ export function activate(context: vscode.ExtensionContext) {
 				: new ModConfigUtilsNonPortable(paths.regKey, paths.regSubKey, appDataPath),
 			modFiles: new ModFilesUtils(appDataPath, arm64Enabled, currentWindhawkVersion),
 			compiler: new CompilerUtils(compilerPath, enginePath, appDataPath, arm64Enabled),
+			symbolHook: new SymbolHookUtils(appDataPath),
 			editorWorkspace: new EditorWorkspaceUtils(),
 			trayProgram: new TrayProgramUtils(appRootPath),
 			userProfile: new UserProfileUtils(appDataPath),
@@ -122,6 +143,7 @@ export function activate(context: vscode.ExtensionContext) {
 
 		const onEnterEditorMode = (modId: string, modWasModified = false) => {
 			sidebarWebviewViewProvider.setEditedMod(modId, modWasModified);
+			utils.compiler.warmUp();
 		};
 
 		const onAppSettingsUpdated = () => {
@@ -146,6 +168,7 @@ export function activate(context: vscode.ExtensionContext) {
 		utils.editorWorkspace.restoreEditorMode().then(({ modId, modWasModified }) => {
 			if (modId) {
 				sidebarWebviewViewProvider.setEditedMod(modId, !!modWasModified);
+				utils.compiler.warmUp();
 			}
 		}).catch(e => reportException(e));
 
@@ -572,23 +595,9 @@ class WindhawkPanel {
 		getRepositoryModSourceData: async message => {
 			const data: GetRepositoryModSourceDataData = message.data;
 
-			// Construct URL: if version is provided, use versioned path,
-			// otherwise use latest.
-			const url = data.version
-				? `${config.urls.modsFolder}${data.modId}/${data.version}.wh.cpp`
-				: `${config.urls.modsFolder}${data.modId}.wh.cpp`;
-
 			let source: string | null = null;
 			try {
-				const response = await fetch(url);
-				if (!response.ok) {
-					throw Error('Server error: ' + (response.statusText || response.status));
-				}
-
-				source = await response.text();
-
-				// Make sure the source code has CRLF newlines.
-				source = source.replace(/\r\n|\r|\n/g, '\r\n');
+				source = await fetchRepositoryModSource(data.modId, data.version);
 			} catch (e) {
 				reportException(e);
 			}
@@ -732,96 +741,117 @@ class WindhawkPanel {
 				windhawkCompilerOutput?.clear();
 				windhawkCompilerOutput?.hide();
 
-				const modId = data.modId;
-				const modSource = data.modSource;
-				const disabled = !!data.disabled;
+				const build = await this._buildModForInstall(data.modId, data.modSource);
 
-				const metadata = this._utils.modSource.extractMetadata(modSource, this._language);
-				if (!metadata.id) {
-					throw new Error('Mod id must be specified in the source code');
-				} else if (metadata.id !== modId) {
-					throw new Error('Mod id specified in the source code doesn\'t match');
+				const userProfile = this._utils.userProfile.read();
+				installedModDetails = this._commitModInstall(
+					data.modId,
+					data.modSource,
+					!!data.disabled,
+					build,
+					userProfile
+				);
+				userProfile.write();
+			} catch (e) {
+				reportCompilerException(e, true);
+			}
+
+			webviewIPC.installModReply(this._panel.webview, message.messageId, {
+				modId: data.modId,
+				installedModDetails
+			});
+		},
+		updateMods: async message => {
+			const data: UpdateModsData = message.data;
+			const mods = data.mods;
+
+			windhawkCompilerOutput?.clear();
+			windhawkCompilerOutput?.hide();
+
+			// The sources are fetched and the mods are built concurrently,
+			// and only then all configs are written, one right after another.
+			// The engines wait for a moment after a config change before
+			// reloading, so that they reload once for the whole batch instead
+			// of once per mod.
+			const sources = await mapSettledWithConcurrency(
+				mods,
+				modUpdateFetchConcurrency,
+				mod => fetchRepositoryModSource(mod.modId)
+			);
+
+			// Each local compilation already compiles its targets in
+			// parallel.
+			const buildConcurrency = this._alwaysCompileModsLocally
+				? Math.max(1, Math.floor(os.cpus().length / 3))
+				: modUpdateFetchConcurrency;
+			const builds = await mapSettledWithConcurrency(
+				mods.map((mod, i) => ({ mod, source: sources[i] })),
+				buildConcurrency,
+				async ({ mod, source }) => {
+					if (source.status === 'rejected') {
+						throw source.reason;
+					}
+
+					return this._buildModForInstall(mod.modId, source.value);
 				}
+			);
 
-				const initialSettings = this._utils.modSource.extractInitialSettingsForEngine(modSource);
+			const results: UpdateModsReplyData['results'] = [];
+			const failedModIds: string[] = [];
+			let userProfile: UserProfile | null = null;
+			try {
+				userProfile = this._utils.userProfile.read();
+			} catch (e) {
+				reportException(e);
+			}
 
-				let previousInitialSettings: Record<string, string | number> | undefined;
+			for (const [i, mod] of mods.entries()) {
+				const source = sources[i];
+				const build = builds[i];
+
+				let installedModDetails: InstallModReplyData['installedModDetails'] = null;
 				try {
-					const prev = this._utils.modSource.extractInitialSettingsForEngine(
-						this._utils.modSource.getSource(modId)
-					);
-					if (prev) {
-						previousInitialSettings = prev;
+					if (build.status === 'rejected') {
+						throw build.reason;
 					}
-				} catch (e) {
-					if (e.code !== 'ENOENT') {
-						console.error('Failed to extract previous initial settings for engine:', e);
+
+					if (!userProfile || source.status === 'rejected') {
+						throw new Error('Failed to update the mod');
 					}
-				}
 
-				let targetDllName: string;
-				if (this._alwaysCompileModsLocally) {
-					const result = await this._utils.compiler.compileMod(
-						modId,
-						metadata.version || '',
-						metadata.include || [],
-						modSource,
-						metadata.architecture || [],
-						metadata.compilerOptions
-					);
-					targetDllName = result.targetDllName;
-				} else {
-					const result = await this._utils.modFiles.downloadPrecompiledMod(
-						modId,
-						metadata.version || '',
-						metadata.architecture || [],
-						config.urls.modsFolder
+					installedModDetails = this._commitModInstall(
+						mod.modId,
+						source.value,
+						!!mod.disabled,
+						build.value,
+						userProfile
 					);
-					targetDllName = result.targetDllName;
+				} catch (e) {
+					windhawkCompilerOutput?.append(`${mod.modId}:\n`);
+					reportCompilerException(e);
+					failedModIds.push(mod.modId);
 				}
 
-				this._utils.modConfig.setModConfig(modId, {
-					libraryFileName: targetDllName,
-					disabled,
-					// loggingEnabled: false,
-					// debugLoggingEnabled: false,
-					include: metadata.include || [],
-					exclude: metadata.exclude || [],
-					// includeCustom: [],
-					// excludeCustom: [],
-					// includeExcludeCustomOnly: false,
-					// patternsMatchCriticalSystemProcesses: false,
-					architecture: metadata.architecture || [],
-					version: metadata.version || ''
-				}, {
-					initialSettings: initialSettings || {},
-					previousInitialSettings
+				results.push({
+					modId: mod.modId,
+					installedModDetails
 				});
+			}
 
-				this._utils.modSource.setSource(modId, modSource);
-
-				this._utils.modFiles.deleteOldModFiles(modId, metadata.architecture || [], targetDllName);
-
-				const userProfile = this._utils.userProfile.read();
-				userProfile.setModVersion(modId, metadata.version || '');
-				userProfile.write();
-
-				const modConfig = this._utils.modConfig.getModConfig(modId);
-				if (!modConfig) {
-					throw new Error('Failed to query installed mod details');
-				}
-
-				installedModDetails = {
-					metadata,
-					config: modConfig
-				};
+			try {
+				userProfile?.write();
 			} catch (e) {
-				reportCompilerException(e, true);
+				reportException(e);
 			}
 
-			webviewIPC.installModReply(this._panel.webview, message.messageId, {
-				modId: data.modId,
-				installedModDetails
+			if (failedModIds.length > 0) {
+				vscode.window.showErrorMessage(
+					`Failed to update ${failedModIds.length} of ${mods.length} mods: ${failedModIds.join(', ')}`
+				);
+			}
+
+			webviewIPC.updateModsReply(this._panel.webview, message.messageId, {
+				results
 			});
 		},
 		compileMod: async message => {
@@ -850,7 +880,9 @@ class WindhawkPanel {
 					metadata.include || [],
 					modSource,
 					metadata.architecture || [],
-					metadata.compilerOptions
+					metadata.compilerOptions,
+					undefined,
+					this._utils.appSettings.getAppSettings().optimizeCompiledModsForSize
 				);
 
 				this._utils.modConfig.setModConfig(modId, {
@@ -865,6 +897,9 @@ class WindhawkPanel {
 					// includeExcludeCustomOnly: false,
 					// patternsMatchCriticalSystemProcesses: false,
 					architecture: metadata.architecture || [],
+					loadWithModule: metadata.loadWithModule || [],
+					atomicReconfigure: metadata.atomicReconfigure === 'true',
+					symbolModules: extractSymbolModuleNames(modSource),
 					version: metadata.version || ''
 				});
 
@@ -1176,6 +1211,113 @@ class WindhawkPanel {
 		this._handleMessageMap[command](rest);
 	}
 
+	// Validates the source and builds the mod binaries, without changing the
+	// installed mod.
+	private async _buildModForInstall(modId: string, modSource: string): Promise<ModInstallBuild> {
+		const metadata = this._utils.modSource.extractMetadata(modSource, this._language);
+		if (!metadata.id) {
+			throw new Error('Mod id must be specified in the source code');
+		} else if (metadata.id !== modId) {
+			throw new Error('Mod id specified in the source code doesn\'t match');
+		}
+
+		const initialSettings = this._utils.modSource.extractInitialSettingsForEngine(modSource);
+
+		let previousInitialSettings: Record<string, string | number> | undefined;
+		try {
+			const prev = this._utils.modSource.extractInitialSettingsForEngine(
+				this._utils.modSource.getSource(modId)
+			);
+			if (prev) {
+				previousInitialSettings = prev;
+			}
+		} catch (e) {
+			if (e.code !== 'ENOENT') {
+				console.error('Failed to extract previous initial settings for engine:', e);
+			}
+		}
+
+		let targetDllName: string;
+		if (this._alwaysCompileModsLocally) {
+			const result = await this._utils.compiler.compileMod(
+				modId,
+				metadata.version || '',
+				metadata.include || [],
+				modSource,
+				metadata.architecture || [],
+				metadata.compilerOptions,
+				undefined,
+				this._utils.appSettings.getAppSettings().optimizeCompiledModsForSize
+			);
+			targetDllName = result.targetDllName;
+		} else {
+			const result = await this._utils.modFiles.downloadPrecompiledMod(
+				modId,
+				metadata.version || '',
+				metadata.architecture || [],
+				config.urls.modsFolder
+			);
+			targetDllName = result.targetDllName;
+		}
+
+		return {
+			metadata,
+			initialSettings,
+			previousInitialSettings,
+			targetDllName
+		};
+	}
+
+	// Writes the config and the source of a mod which was built with
+	// _buildModForInstall. The user profile isn't written, so that it can be
+	// written once for several mods.
+	private _commitModInstall(
+		modId: string,
+		modSource: string,
+		disabled: boolean,
+		build: ModInstallBuild,
+		userProfile: UserProfile
+	) {
+		const { metadata, initialSettings, previousInitialSettings, targetDllName } = build;
+
+		this._utils.modConfig.setModConfig(modId, {
+			libraryFileName: targetDllName,
+			disabled,
+			// loggingEnabled: false,
+			// debugLoggingEnabled: false,
+			include: metadata.include || [],
+			exclude: metadata.exclude || [],
+			// includeCustom: [],
+			// excludeCustom: [],
+			// includeExcludeCustomOnly: false,
+			// patternsMatchCriticalSystemProcesses: false,
+			architecture: metadata.architecture || [],
+			loadWithModule: metadata.loadWithModule || [],
+			atomicReconfigure: metadata.atomicReconfigure === 'true',
+			symbolModules: extractSymbolModuleNames(modSource),
+			version: metadata.version || ''
+		}, {
+			initialSettings: initialSettings || {},
+			previousInitialSettings
+		});
+
+		this._utils.modSource.setSource(modId, modSource);
+
+		this._utils.modFiles.deleteOldModFiles(modId, metadata.architecture || [], targetDllName);
+
+		userProfile.setModVersion(modId, metadata.version || '');
+
+		const modConfig = this._utils.modConfig.getModConfig(modId);
+		if (!modConfig) {
+			throw new Error('Failed to query installed mod details');
+		}
+
+		return {
+			metadata,
+			config: modConfig
+		};
+	}
+
 	private async _fetchRepositoryMods(language: string) {
 		const version = currentWindhawkVersion?.version || 'unknown';
 		const userAgent = `Windhawk/${version}${this._portable ? ' (portable)' : ''}`;
@@ -1501,6 +1643,11 @@ class WindhawkViewProvider implements vscode.WebviewViewProvider {
 					}
 				}
 
+				const previousDllName = this._utils.modConfig.getModConfig(localOldModId)?.libraryFileName;
+				const previousSizes = previousDllName
+					? this._utils.compiler.getCompiledModFileSizes(previousDllName)
+					: {};
+
 				const { targetDllName } = await this._utils.compiler.compileMod(
 					localModId,
 					metadata.version || '',
@@ -1508,9 +1655,25 @@ class WindhawkViewProvider implements vscode.WebviewViewProvider {
 					modSource,
 					metadata.architecture || [],
 					metadata.compilerOptions,
-					this._utils.editorWorkspace.getWorkspaceFolder()
+					this._utils.editorWorkspace.getWorkspaceFolder(),
+					this._utils.appSettings.getAppSettings().optimizeCompiledModsForSize
 				);
 
+				windhawkCompilerOutput?.append(formatCompiledModSizes(
+					this._utils.compiler.getCompiledModFileSizes(targetDllName),
+					previousSizes
+				));
+
+				// Catch typos in symbol names before the mod runs, instead of
+				// after a full enumeration of the symbols of the target module.
+				const symbolHookWarnings = this._utils.symbolHook.findUnresolvedSymbolHooks(modSource);
+				if (symbolHookWarnings.length > 0) {
+					windhawkCompilerOutput?.append(symbolHookWarnings.map(warning => `Warning: ${warning}\n`).join(''));
+					vscode.window.showWarningMessage(
+						`Windhawk: ${symbolHookWarnings.length} symbol hook(s) might not be found, see the compiler output for details`
+					);
+				}
+
 				if (modId !== oldModId) {
 					this._utils.modConfig.changeModId(localOldModId, localModId);
 				}
@@ -1527,6 +1690,9 @@ class WindhawkViewProvider implements vscode.WebviewViewProvider {
 					// includeExcludeCustomOnly: false,
 					// patternsMatchCriticalSystemProcesses: false,
 					architecture: metadata.architecture || [],
+					loadWithModule: metadata.loadWithModule || [],
+					atomicReconfigure: metadata.atomicReconfigure === 'true',
+					symbolModules: extractSymbolModuleNames(modSource),
 					version: metadata.version || ''
 				}, {
 					initialSettings: initialSettings || {},
@@ -1549,7 +1715,7 @@ class WindhawkViewProvider implements vscode.WebviewViewProvider {
 				this._utils.modFiles.deleteOldModFiles(localModId, metadata.architecture || [], targetDllName);
 
 				if (data.loggingEnabled) {
-					windhawkLogOutput?.createOrShow(true);
+					windhawkLogOutput?.createOrShow(true, localModId);
 				} else {
 					windhawkCompilerOutput?.hide();
 				}
@@ -1608,7 +1774,7 @@ class WindhawkViewProvider implements vscode.WebviewViewProvider {
 		},
 		showLogOutput: message => {
 			try {
-				windhawkLogOutput?.createOrShow();
+				windhawkLogOutput?.createOrShow(false, this._editedModId && 'local@' + this._editedModId);
 			} catch (e) {
 				reportException(e);
 			}
@@ -1654,11 +1820,80 @@ class WindhawkViewProvider implements vscode.WebviewViewProvider {
 	}
 }
 
+// If a version is specified, the source of that version is fetched, otherwise
+// the source of the latest version.
+async function fetchRepositoryModSource(modId: string, version?: string) {
+	const url = version
+		? `${config.urls.modsFolder}${modId}/${version}.wh.cpp`
+		: `${config.urls.modsFolder}${modId}.wh.cpp`;
+
+	const response = await fetch(url);
+	if (!response.ok) {
+		throw Error('Server error: ' + (response.statusText || response.status));
+	}
+
+	const source = await response.text();
+
+	// Make sure the source code has CRLF newlines.
+	return source.replace(/\r\n|\r|\n/g, '\r\n');
+}
+
+type SettledResult<R> =
+	| { status: 'fulfilled'; value: R }
+	| { status: 'rejected'; reason: any };
+
+// Like Promise.allSettled, but runs at most `limit` tasks at a time. The
+// results are in the order of the items.
+async function mapSettledWithConcurrency<T, R>(
+	items: T[],
+	limit: number,
+	task: (item: T) => Promise<R>
+) {
+	const results: SettledResult<R>[] = new Array(items.length);
+	let nextIndex = 0;
+
+	const worker = async () => {
+		while (nextIndex < items.length) {
+			const index = nextIndex++;
+			try {
+				results[index] = { status: 'fulfilled', value: await task(items[index]) };
+			} catch (e) {
+				results[index] = { status: 'rejected', reason: e };
+			}
+		}
+	};
+
+	const workers: Promise<void>[] = [];
+	for (let i = 0; i < Math.min(limit, items.length); i++) {
+		workers.push(worker());
+	}
+
+	await Promise.all(workers);
+	return results;
+}
+
 function reportException(e: any) {
 	console.error(e);
 	vscode.window.showErrorMessage(e.message);
 }
 
+function formatCompiledModSizes(sizes: Record<string, number>, previousSizes: Record<string, number>) {
+	const formatSize = (size: number) => (size / 1024).toFixed(1) + ' KB';
+
+	let report = '';
+	for (const [subfolder, size] of Object.entries(sizes)) {
+		report += `Compiled mod size (${subfolder}): ${formatSize(size)}`;
+		const previousSize = previousSizes[subfolder];
+		if (previousSize !== undefined) {
+			const change = size - previousSize;
+			report += `, previously ${formatSize(previousSize)} (${change >= 0 ? '+' : '-'}${formatSize(Math.abs(change))})`;
+		}
+		report += '\n';
+	}
+
+	return report;
+}
+
 function reportCompilerException(e: any, treatCompilationErrorAsException = false) {
 	if (e instanceof CompilerKilled) {
 		windhawkCompilerOutput?.append(e.message + '\n');
@@ -3,30 +3,53 @@ import * as vscode from 'vscode';
 
 export class WindhawkLogOutput {
 	private _logOutputProcessPath: string;
+	private _appProgramPath: string;
 	private _logOutputChannel?: vscode.OutputChannel;
 	private _logOutputProcess?: child_process.ChildProcessWithoutNullStreams;
+	private _logOutputModId?: string;
 	private _incompleteStdoutBuffer: Buffer = Buffer.alloc(0);
 	private _incompleteStderrBuffer: Buffer = Buffer.alloc(0);
 
-	constructor(logOutputProcessPath: string) {
+	constructor(logOutputProcessPath: string, appProgramPath: string) {
 		this._logOutputProcessPath = logOutputProcessPath;
+		this._appProgramPath = appProgramPath;
 	}
 
-	public createOrShow(preserveFocus?: boolean) {
+	// If modId is set, only the lines of that mod are shown. They're filtered
+	// by Windhawk, which reads them from its log ring, so that the lines of
+	// other mods and processes don't reach the extension at all. Otherwise,
+	// all debug output lines of Windhawk are shown.
+	public createOrShow(preserveFocus?: boolean, modId?: string) {
 		if (!this._logOutputChannel) {
 			this._logOutputChannel = vscode.window.createOutputChannel('Windhawk Log');
 		}
 		this._logOutputChannel.show(preserveFocus);
 
+		if (this._logOutputProcess && this._logOutputModId !== modId) {
+			this._logOutputProcess.kill();
+			this._logOutputProcess = undefined;
+		}
+
 		if (!this._logOutputProcess) {
-			const args = [
-				'--pattern',
-				'[WH] *',
-				'--no-buffering',
-			];
-			const ps = child_process.spawn(this._logOutputProcessPath, args);
+			let ps: child_process.ChildProcessWithoutNullStreams;
+			if (modId) {
+				const args = [
+					'-log-output',
+					'-mod',
+					modId,
+				];
+				ps = child_process.spawn(this._appProgramPath, args);
+			} else {
+				const args = [
+					'--pattern',
+					'[WH] *',
+					'--no-buffering',
+				];
+				ps = child_process.spawn(this._logOutputProcessPath, args);
+			}
 
 			this._logOutputProcess = ps;
+			this._logOutputModId = modId;
 
 			ps.stdout.on('data', data => {
 				const dataWithIncompleteBuffer = Buffer.concat([this._incompleteStdoutBuffer, data]);
@@ -48,14 +71,16 @@ export class WindhawkLogOutput {
 
 			ps.on('error', err => {
 				//console.log('Oh no, the error: ' + err);
-				this._logOutputProcess = undefined;
+				if (this._logOutputProcess === ps) {
+					this._logOutputProcess = undefined;
+				}
 				gotError = true;
 				vscode.window.showErrorMessage(err.message);
 			});
 
 			ps.on('close', code => {
 				//console.log(`ps process exited with code ${code}`);
-				if (!gotError) {
+				if (!gotError && this._logOutputProcess === ps) {
 					this._logOutputProcess = undefined;
 				}
 			});
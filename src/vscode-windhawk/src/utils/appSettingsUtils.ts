@@ -21,11 +21,14 @@ type FieldDescriptor = {
 const APP_SETTINGS_FIELDS = [
 	{ name: 'language', storageName: 'Language', type: 'string', location: 'app', defaultValue: 'en' },
 	{ name: 'disableUpdateCheck', storageName: 'DisableUpdateCheck', type: 'boolean', location: 'app' },
+	{ name: 'sendModPerformanceStats', storageName: 'SendModPerformanceStats', type: 'boolean', location: 'app' },
 	{ name: 'disableRunUIScheduledTask', storageName: 'DisableRunUIScheduledTask', type: 'boolean-nullable', location: 'app', nonPortableOnly: true },
 	{ name: 'devModeOptOut', storageName: 'DevModeOptOut', type: 'boolean', location: 'app' },
 	{ name: 'devModeUsedAtLeastOnce', storageName: 'DevModeUsedAtLeastOnce', type: 'boolean', location: 'app' },
 	{ name: 'hideTrayIcon', storageName: 'HideTrayIcon', type: 'boolean', location: 'app' },
+	{ name: 'launchTrayOnDemand', storageName: 'LaunchTrayOnDemand', type: 'boolean', location: 'app' },
 	{ name: 'alwaysCompileModsLocally', storageName: 'AlwaysCompileModsLocally', type: 'boolean', location: 'app' },
+	{ name: 'optimizeCompiledModsForSize', storageName: 'OptimizeCompiledModsForSize', type: 'boolean', location: 'app' },
 	{ name: 'dontAutoShowToolkit', storageName: 'DontAutoShowToolkit', type: 'boolean', location: 'app' },
 	{ name: 'modTasksDialogDelay', storageName: 'ModTasksDialogDelay', type: 'number', location: 'app', defaultValue: 2000 },
 	{ name: 'safeMode', storageName: 'SafeMode', type: 'boolean', location: 'app' },
@@ -344,6 +347,7 @@ class AppSettingsUtilsBase implements AppSettingsUtils {
 	public shouldRestartApp(appSettings: Partial<AppSettings>): boolean {
 		return appSettings.safeMode !== undefined ||
 			appSettings.loggingVerbosity !== undefined ||
+			appSettings.launchTrayOnDemand !== undefined ||
 			(appSettings.engine !== undefined && Object.keys(appSettings.engine).length > 0);
 	}
 
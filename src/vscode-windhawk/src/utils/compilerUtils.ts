@@ -1,5 +1,7 @@
 import * as child_process from 'child_process';
+import * as crypto from 'crypto';
 import * as fs from 'fs';
+import * as os from 'os';
 import * as path from 'path';
 import * as vscode from 'vscode';
 
@@ -43,6 +45,52 @@ export class CompilerError extends Error {
 	}
 }
 
+// Bump when the way the cache key is computed changes.
+const buildCacheVersion = 3;
+// The least recently used builds of each target are removed beyond that.
+const buildCacheMaxEntries = 100;
+
+// Each mod is linked at a fixed base address in the range of its architecture,
+// in a slot chosen by its id, instead of being randomized by ASLR. As long as
+// the address is free, the mod is loaded without relocations, and its code
+// pages are shared by all processes it's loaded into, instead of each process
+// getting private copies of the relocated pages. The ranges avoid the default
+// base addresses of executables and DLLs, and the addresses of system DLLs.
+const imageBaseRanges: Record<CompilationTarget, { start: number; slotSize: number; slots: number }> = {
+	'i686-w64-mingw32': { start: 0x60000000, slotSize: 0x200000, slots: 128 },
+	'x86_64-w64-mingw32': { start: 0x200000000, slotSize: 0x1000000, slots: 4096 },
+	'aarch64-w64-mingw32': { start: 0x200000000, slotSize: 0x1000000, slots: 4096 },
+};
+
+// Selected with `--windhawk-preset=<name>` in the compiler options of a mod, or
+// globally with the optimizeCompiledModsForSize setting. The flags are added
+// before the compiler options of the mod, which can override them.
+const compilePresets = {
+	default: [],
+	// Mods are loaded into many processes, so every page of code counts.
+	size: [
+		'-flto=thin',
+		'-ffunction-sections',
+		'-fdata-sections',
+		'-Wl,--gc-sections',
+		'-s',
+	],
+} satisfies Record<string, string[]>;
+
+type CompilePreset = keyof typeof compilePresets;
+
+// Used when the mod workspace has no precompiled header of its own. Shared by
+// all mods, so it can only contain headers which don't depend on the mod.
+const defaultPchHeader = [
+	'#include <windows.h>',
+	'#include <commctrl.h>',
+	'#include "windhawk_api.h"',
+	'#if __has_include(<winrt/base.h>)',
+	'#include <winrt/base.h>',
+	'#endif',
+	'',
+].join('\n');
+
 export class CompilerKilled extends Error {
 	constructor() {
 		super('Compilation was aborted');
@@ -54,9 +102,14 @@ export default class CompilerUtils {
 	private enginePath: string;
 	private engineModsPath: string;
 	private arm64Enabled: boolean;
+	// Whether the compiler has the ARM64EC target, which is needed to build
+	// ARM64X binaries.
+	private arm64xSupported: boolean;
 	private supportedCompilationTargets: CompilationTarget[];
 	private activeProcesses: Set<child_process.ChildProcess> = new Set();
 	private canceledProcesses: Set<child_process.ChildProcess> = new Set();
+	// Keyed by the path of the precompiled header which is being built.
+	private defaultPchBuilds: Map<string, Promise<string | undefined>> = new Map();
 
 	public constructor(compilerPath: string, enginePath: string, appDataPath: string, arm64Enabled: boolean) {
 		this.compilerPath = compilerPath;
@@ -73,9 +126,22 @@ export default class CompilerUtils {
 			this.supportedCompilationTargets.push('aarch64-w64-mingw32');
 		}
 
+		this.arm64xSupported = arm64Enabled &&
+			fs.existsSync(path.join(this.compilerPath, 'arm64ec-w64-mingw32'));
+
+		// The libs only change with the compiler, which is identified the same
+		// way as for the build cache.
+		let compilerStamp: string | undefined = undefined;
+		try {
+			const stat = fs.statSync(path.join(this.compilerPath, 'bin', 'clang++.exe'));
+			compilerStamp = `${stat.size}:${stat.mtimeMs}`;
+		} catch (e) {
+			// Copied unconditionally.
+		}
+
 		for (const target of this.supportedCompilationTargets) {
 			try {
-				this.copyCompilerLibs(target);
+				this.syncCompilerLibs(target, compilerStamp);
 			} catch (e: unknown) {
 				const message = e instanceof Error ? e.message : String(e);
 				vscode.window.showErrorMessage(`Failed to copy compiler libs for target ${target}: ${message}`);
@@ -156,43 +222,223 @@ export default class CompilerUtils {
 		return targets;
 	}
 
+	private buildCacheKey(
+		target: CompilationTarget,
+		modId: string,
+		modVersion: string,
+		modSourceCode: string,
+		compilerOptionsArray: string[],
+		pchHeaderPath: string | undefined
+	) {
+		// Files are identified by their size and modification time, which
+		// change when the compiler or the engine is updated.
+		const fileStamp = (filePath: string) => {
+			const stat = fs.statSync(filePath);
+			return `${stat.size}:${stat.mtimeMs}`;
+		};
+
+		const subfolder = this.subfolderFromCompilationTarget(target);
+		const keyData = JSON.stringify({
+			version: buildCacheVersion,
+			target,
+			modId,
+			modVersion,
+			modSourceCode,
+			compilerOptionsArray,
+			pch: pchHeaderPath ? fileStamp(pchHeaderPath) : null,
+			compiler: fileStamp(path.join(this.compilerPath, 'bin', 'clang++.exe')),
+			engineLib: fileStamp(path.join(this.enginePath, subfolder, 'windhawk.lib')),
+		});
+
+		return crypto.createHash('sha256').update(keyData).digest('hex');
+	}
+
+	private buildCachePath(target: CompilationTarget, cacheKey: string) {
+		const subfolder = this.subfolderFromCompilationTarget(target);
+		return path.join(this.engineModsPath, 'cache', subfolder, cacheKey + '.dll');
+	}
+
+	private restoreFromBuildCache(target: CompilationTarget, cacheKey: string, targetDllName: string) {
+		const cachedDllPath = this.buildCachePath(target, cacheKey);
+		const compiledModDllPath = path.join(this.engineModsPath, this.subfolderFromCompilationTarget(target), targetDllName);
+
+		try {
+			// A copy, since the compiled mod might be locked while it's
+			// loaded.
+			fs.copyFileSync(cachedDllPath, compiledModDllPath);
+		} catch (e: any) {
+			if (e.code !== 'ENOENT') {
+				console.error('Failed to restore cached build:', e);
+			}
+			return false;
+		}
+
+		try {
+			const now = new Date();
+			fs.utimesSync(cachedDllPath, now, now);
+		} catch (e) {
+			// Only affects the eviction order.
+		}
+
+		return true;
+	}
+
+	private storeInBuildCache(target: CompilationTarget, cacheKey: string, targetDllName: string) {
+		const cachedDllPath = this.buildCachePath(target, cacheKey);
+		const compiledModDllPath = path.join(this.engineModsPath, this.subfolderFromCompilationTarget(target), targetDllName);
+		const cacheDir = path.dirname(cachedDllPath);
+
+		try {
+			fs.mkdirSync(cacheDir, { recursive: true });
+
+			// Copy and rename, so that a partially written file is never
+			// used.
+			const tempPath = cachedDllPath + '.' + randomIntFromInterval(100000, 999999) + '.tmp';
+			fs.copyFileSync(compiledModDllPath, tempPath);
+			fs.renameSync(tempPath, cachedDllPath);
+
+			const entries = fs.readdirSync(cacheDir)
+				.filter(filename => filename.endsWith('.dll'))
+				.map(filename => {
+					const entryPath = path.join(cacheDir, filename);
+					return { entryPath, mtimeMs: fs.statSync(entryPath).mtimeMs };
+				})
+				.sort((a, b) => b.mtimeMs - a.mtimeMs);
+
+			for (const { entryPath } of entries.slice(buildCacheMaxEntries)) {
+				fs.unlinkSync(entryPath);
+			}
+		} catch (e) {
+			console.error('Failed to store build in cache:', e);
+		}
+	}
+
+	private canUseDefaultPrecompiledHeaders(modId: string, modVersion: string, extraArgs: string[]) {
+		// The precompiled header must be built with the same flags as the
+		// mod, only flags which don't affect it are allowed: libraries,
+		// warnings, and the code generation flags of the presets.
+		const presetFlags: string[] = Object.values(compilePresets).flat();
+		return this.windowsVersionFlagsForMod(modId, modVersion).length > 0 &&
+			this.backwardCompatibilityFlagsForMod(modId, modVersion).length === 0 &&
+			extraArgs.every(arg => /^-[lLW]/.test(arg) || presetFlags.includes(arg));
+	}
+
+	private defaultPrecompiledHeadersPath(target: CompilationTarget) {
+		// The headers ship with the compiler and the engine, so the
+		// precompiled header is rebuilt when either of them is updated.
+		const fileStamp = (filePath: string) => {
+			const stat = fs.statSync(filePath);
+			return `${stat.size}:${stat.mtimeMs}`;
+		};
+
+		const subfolder = this.subfolderFromCompilationTarget(target);
+		const keyData = JSON.stringify({
+			version: buildCacheVersion,
+			target,
+			header: defaultPchHeader,
+			compiler: fileStamp(path.join(this.compilerPath, 'bin', 'clang++.exe')),
+			engineLib: fileStamp(path.join(this.enginePath, subfolder, 'windhawk.lib')),
+		});
+		const key = crypto.createHash('sha256').update(keyData).digest('hex').slice(0, 16);
+
+		return path.join(this.engineModsPath, 'cache', subfolder, `default_${key}.pch`);
+	}
+
+	// Returns undefined if the precompiled header isn't available, in which
+	// case the mod is compiled without it. Built on first use, then reused by
+	// all mods.
+	private async getDefaultPrecompiledHeaders(target: CompilationTarget) {
+		let pchPath: string;
+		try {
+			pchPath = this.defaultPrecompiledHeadersPath(target);
+		} catch (e) {
+			console.error('Failed to get the default precompiled headers path:', e);
+			return undefined;
+		}
+
+		if (fs.existsSync(pchPath)) {
+			return pchPath;
+		}
+
+		let build = this.defaultPchBuilds.get(pchPath);
+		if (!build) {
+			build = this.makeDefaultPrecompiledHeaders(target, pchPath);
+			this.defaultPchBuilds.set(pchPath, build);
+
+			const removeBuild = () => {
+				this.defaultPchBuilds.delete(pchPath);
+			};
+			build.then(removeBuild, removeBuild);
+		}
+
+		return await build;
+	}
+
+	private async makeDefaultPrecompiledHeaders(target: CompilationTarget, pchPath: string) {
+		try {
+			const cacheDir = path.dirname(pchPath);
+			fs.mkdirSync(cacheDir, { recursive: true });
+
+			const pchHeaderPath = path.join(cacheDir, 'windhawk_default_pch.h');
+			if (!fs.existsSync(pchHeaderPath) ||
+				fs.readFileSync(pchHeaderPath, 'utf8') !== defaultPchHeader) {
+				fs.writeFileSync(pchHeaderPath, defaultPchHeader);
+			}
+
+			// Build and rename, so that a partially written file is never
+			// used.
+			const tempPchPath = pchPath + '.' + randomIntFromInterval(100000, 999999) + '.tmp';
+			const { exitCode, stdout, stderr } = await this.makePrecompiledHeaders(
+				pchHeaderPath,
+				tempPchPath,
+				target,
+				undefined,
+				undefined,
+				[]
+			);
+			if (exitCode !== 0) {
+				console.log(`Default precompiled headers failed for target ${target}:\n${stdout}${stderr}`);
+				try {
+					fs.unlinkSync(tempPchPath);
+				} catch (e) {
+					// Ignore if file doesn't exist.
+				}
+				return undefined;
+			}
+
+			fs.renameSync(tempPchPath, pchPath);
+
+			// Remove the ones which were built for previous versions.
+			for (const filename of fs.readdirSync(cacheDir)) {
+				const filePath = path.join(cacheDir, filename);
+				if (filename.startsWith('default_') && filePath !== pchPath) {
+					try {
+						fs.unlinkSync(filePath);
+					} catch (e) {
+						// Ignore errors (file may be in use).
+					}
+				}
+			}
+
+			return pchPath;
+		} catch (e) {
+			if (e instanceof CompilerKilled) {
+				throw e;
+			}
+
+			console.error(`Failed to build default precompiled headers for target ${target}:`, e);
+			return undefined;
+		}
+	}
+
 	private doesCompiledModExist(fileName: string, target: CompilationTarget) {
 		const compiledModPath = path.join(this.engineModsPath, this.subfolderFromCompilationTarget(target), fileName);
 		return fs.existsSync(compiledModPath);
 	}
 
-	private async makePrecompiledHeaders(
-		pchHeaderPath: string,
-		targetPchPath: string,
-		target: CompilationTarget,
-		modId: string,
-		modVersion: string,
-		extraArgs: string[],
-	): Promise<CompilationResult> {
+	// Runs clang++ with the source code, if any, as its standard input.
+	private runCompiler(args: string[], input?: string): Promise<CompilationResult> {
 		const clangPath = path.join(this.compilerPath, 'bin', 'clang++.exe');
-
-		const args = [
-			'-std=c++23',
-			'-O2',
-			'-DUNICODE',
-			'-D_UNICODE',
-			'-DWINVER=0x0A00',
-			'-D_WIN32_WINNT=0x0A00',
-			'-D_WIN32_IE=0x0A00',
-			'-DNTDDI_VERSION=0x0A000008',
-			'-D__USE_MINGW_ANSI_STDIO=0',
-			'-DWH_MOD',
-			'-DWH_MOD_ID=L"' + modId.replace(/"/g, '\\"') + '"',
-			'-DWH_MOD_VERSION=L"' + modVersion.replace(/"/g, '\\"') + '"',
-			'-x',
-			'c++-header',
-			pchHeaderPath,
-			'-target',
-			target,
-			'-o',
-			targetPchPath,
-			...extraArgs.filter(arg => arg.startsWith('-D'))
-		];
 		const ps = child_process.spawn(clangPath, args, {
 			cwd: this.compilerPath
 		});
@@ -210,6 +456,11 @@ export default class CompilerUtils {
 			stderrBuffers.push(data);
 		});
 
+		if (input !== undefined) {
+			ps.stdin.write(input);
+		}
+		ps.stdin.end();
+
 		return new Promise((resolve, reject) => {
 			ps.on('error', err => {
 				this.activeProcesses.delete(ps);
@@ -232,24 +483,60 @@ export default class CompilerUtils {
 		});
 	}
 
-	private async compileModInternal(
-		modSourceCode: string,
-		targetDllName: string,
+	private async makePrecompiledHeaders(
+		pchHeaderPath: string,
+		targetPchPath: string,
 		target: CompilationTarget,
-		modId: string,
-		modVersion: string,
+		modId: string | undefined,
+		modVersion: string | undefined,
 		extraArgs: string[],
-		pchPath?: string
 	): Promise<CompilationResult> {
-		const clangPath = path.join(this.compilerPath, 'bin', 'clang++.exe');
+		// The mod id and version aren't used by the headers, and are omitted
+		// for the default precompiled header, which is shared by all mods.
+		const modDefines = modId !== undefined && modVersion !== undefined ? [
+			'-DWH_MOD_ID=L"' + modId.replace(/"/g, '\\"') + '"',
+			'-DWH_MOD_VERSION=L"' + modVersion.replace(/"/g, '\\"') + '"',
+		] : [];
 
-		const subfolder = this.subfolderFromCompilationTarget(target);
-		const engineLibPath = path.join(this.enginePath, subfolder, 'windhawk.lib');
-		const compiledModDllPath = path.join(this.engineModsPath, subfolder, targetDllName);
+		const args = [
+			'-std=c++23',
+			'-O2',
+			'-DUNICODE',
+			'-D_UNICODE',
+			'-DWINVER=0x0A00',
+			'-D_WIN32_WINNT=0x0A00',
+			'-D_WIN32_IE=0x0A00',
+			'-DNTDDI_VERSION=0x0A000008',
+			'-D__USE_MINGW_ANSI_STDIO=0',
+			'-DWH_MOD',
+			// Precompiled headers are only used with explicit exports.
+			'-DWH_MOD_EXPLICIT_EXPORTS',
+			...modDefines,
+			'-x',
+			'c++-header',
+			pchHeaderPath,
+			'-target',
+			target,
+			'-o',
+			targetPchPath,
+			...extraArgs.filter(arg => arg.startsWith('-D'))
+		];
+		return this.runCompiler(args);
+	}
 
-		fs.mkdirSync(path.dirname(compiledModDllPath), { recursive: true });
+	private imageBaseFlagsForMod(modId: string, target: CompilationTarget) {
+		const { start, slotSize, slots } = imageBaseRanges[target];
+		const hash = crypto.createHash('sha256').update(modId).digest();
+		const slot = hash.readUInt32LE(0) % slots;
+		const imageBase = start + slot * slotSize;
+		return [
+			`-Wl,--image-base=0x${imageBase.toString(16)}`,
+			'-Wl,--disable-dynamicbase',
+		];
+	}
 
-		const windowsVersionFlags = [
+	private windowsVersionFlagsForMod(modId: string, modVersion: string) {
+		return [
 			'classic-taskdlg-fix\n1.1.0',
 		].includes(`${modId}\n${modVersion}`) ? [] : [
 			'-DWINVER=0x0A00',
@@ -257,7 +544,9 @@ export default class CompilerUtils {
 			'-D_WIN32_IE=0x0A00',
 			'-DNTDDI_VERSION=0x0A000008',
 		];
+	}
 
+	private backwardCompatibilityFlagsForMod(modId: string, modVersion: string) {
 		const backwardCompatibilityFlags: string[] = [];
 
 		if ([
@@ -286,6 +575,28 @@ export default class CompilerUtils {
 			backwardCompatibilityFlags.push('-include', 'vector');
 		}
 
+		return backwardCompatibilityFlags;
+	}
+
+	private async compileModInternal(
+		modSourceCode: string,
+		targetDllName: string,
+		target: CompilationTarget,
+		modId: string,
+		modVersion: string,
+		extraArgs: string[],
+		explicitExports: boolean,
+		pchPath?: string
+	): Promise<CompilationResult> {
+		const subfolder = this.subfolderFromCompilationTarget(target);
+		const engineLibPath = path.join(this.enginePath, subfolder, 'windhawk.lib');
+		const compiledModDllPath = path.join(this.engineModsPath, subfolder, targetDllName);
+
+		fs.mkdirSync(path.dirname(compiledModDllPath), { recursive: true });
+
+		const windowsVersionFlags = this.windowsVersionFlagsForMod(modId, modVersion);
+		const backwardCompatibilityFlags = this.backwardCompatibilityFlagsForMod(modId, modVersion);
+
 		const args = [
 			'-std=c++23',
 			'-O2',
@@ -305,53 +616,39 @@ export default class CompilerUtils {
 			'windhawk_api.h',
 			'-target',
 			target,
-			'-Wl,--export-all-symbols',
+			...(explicitExports ? ['-DWH_MOD_EXPLICIT_EXPORTS'] : ['-Wl,--export-all-symbols']),
 			'-o',
 			compiledModDllPath,
 			...(pchPath ? ['-include-pch', pchPath] : []),
+			...this.imageBaseFlagsForMod(modId, target),
 			...extraArgs,
 			...backwardCompatibilityFlags,
 		];
-		const ps = child_process.spawn(clangPath, args, {
-			cwd: this.compilerPath
-		});
-
-		this.activeProcesses.add(ps);
-
-		const stdoutBuffers: Buffer[] = [];
-		const stderrBuffers: Buffer[] = [];
-
-		ps.stdout.on('data', data => {
-			stdoutBuffers.push(data);
-		});
-
-		ps.stderr.on('data', data => {
-			stderrBuffers.push(data);
-		});
-
-		ps.stdin.write(modSourceCode);
-		ps.stdin.end();
+		return this.runCompiler(args, modSourceCode);
+	}
 
-		return new Promise((resolve, reject) => {
-			ps.on('error', err => {
-				this.activeProcesses.delete(ps);
-				this.canceledProcesses.delete(ps);
-				reject(err);
-			});
+	// Copies the libs only if they weren't copied from the same compiler yet, as
+	// recorded in a stamp file next to them. The stamp is only written after
+	// all of the libs were copied, so an interrupted copy is retried.
+	private syncCompilerLibs(target: CompilationTarget, compilerStamp: string | undefined) {
+		const targetModsDir = path.join(this.engineModsPath, this.subfolderFromCompilationTarget(target));
+		const stampPath = path.join(targetModsDir, 'compiler-libs.stamp');
 
-			ps.on('close', code => {
-				this.activeProcesses.delete(ps);
-				const wasCanceled = this.canceledProcesses.delete(ps);
-				if (wasCanceled) {
-					reject(new CompilerKilled());
+		if (compilerStamp !== undefined) {
+			try {
+				if (fs.readFileSync(stampPath, 'utf8') === compilerStamp) {
 					return;
 				}
+			} catch (e) {
+				// No stamp yet.
+			}
+		}
 
-				const stdout = Buffer.concat(stdoutBuffers).toString('utf8');
-				const stderr = Buffer.concat(stderrBuffers).toString('utf8');
-				resolve({ exitCode: code, stdout, stderr });
-			});
-		});
+		this.copyCompilerLibs(target);
+
+		if (compilerStamp !== undefined) {
+			fs.writeFileSync(stampPath, compilerStamp);
+		}
 	}
 
 	private copyCompilerLibs(target: CompilationTarget) {
@@ -415,6 +712,271 @@ export default class CompilerUtils {
 		}
 	}
 
+	// Compiles the mod into a single ARM64X binary, with ARM64 code for native
+	// processes and ARM64EC code for emulated x86-64 processes, instead of
+	// compiling it for each of them. The binary is hard linked into both
+	// folders, so that it's stored once, and its pages are shared by all of
+	// the processes it's loaded into. The two halves are compiled separately
+	// and linked together.
+	private async compileModArm64X(
+		targetDllName: string,
+		modId: string,
+		modVersion: string,
+		modSourceCode: string,
+		compilerOptionsArray: string[]
+	) {
+		const nativeTarget: CompilationTarget = 'aarch64-w64-mingw32';
+		const emulatedTarget: CompilationTarget = 'x86_64-w64-mingw32';
+		const nativeDllPath = path.join(this.engineModsPath, this.subfolderFromCompilationTarget(nativeTarget), targetDllName);
+		const emulatedDllPath = path.join(this.engineModsPath, this.subfolderFromCompilationTarget(emulatedTarget), targetDllName);
+
+		let cacheKey: string | undefined = undefined;
+		try {
+			cacheKey = this.buildCacheKey(
+				nativeTarget,
+				modId,
+				modVersion,
+				modSourceCode,
+				[...compilerOptionsArray, '--windhawk-arm64x'],
+				undefined
+			);
+		} catch (e) {
+			console.error('Failed to compute build cache key:', e);
+		}
+
+		const linkToEmulatedFolder = () => {
+			fs.mkdirSync(path.dirname(emulatedDllPath), { recursive: true });
+			try {
+				fs.linkSync(nativeDllPath, emulatedDllPath);
+			} catch (e) {
+				// E.g. if hard links aren't supported by the file system.
+				fs.copyFileSync(nativeDllPath, emulatedDllPath);
+			}
+		};
+
+		if (cacheKey && this.restoreFromBuildCache(nativeTarget, cacheKey, targetDllName)) {
+			console.log('Using cached build for ARM64X');
+			linkToEmulatedFolder();
+			return;
+		}
+
+		const explicitExports = !definesLocalSymbolHookHelpers(modSourceCode);
+
+		const objectsDir = fs.mkdtempSync(path.join(os.tmpdir(), 'windhawk-arm64x-'));
+		try {
+			const halves = [
+				{ target: 'aarch64-w64-mingw32', objectPath: path.join(objectsDir, 'arm64.o') },
+				{ target: 'arm64ec-w64-mingw32', objectPath: path.join(objectsDir, 'arm64ec.o') },
+			];
+
+			const results = await Promise.all(halves.map(({ target, objectPath }) => this.runCompiler([
+				'-std=c++23',
+				'-O2',
+				'-DUNICODE',
+				'-D_UNICODE',
+				...this.windowsVersionFlagsForMod(modId, modVersion),
+				'-D__USE_MINGW_ANSI_STDIO=0',
+				'-DWH_MOD',
+				'-DWH_MOD_ID=L"' + modId.replace(/"/g, '\\"') + '"',
+				'-DWH_MOD_VERSION=L"' + modVersion.replace(/"/g, '\\"') + '"',
+				...(explicitExports ? ['-DWH_MOD_EXPLICIT_EXPORTS'] : []),
+				'-x',
+				'c++',
+				'-',
+				'-include',
+				'windhawk_api.h',
+				'-target',
+				target,
+				'-c',
+				'-o',
+				objectPath,
+				...compilerOptionsArray.filter(arg => !/^-(l|L|Wl,)/.test(arg)),
+				...this.backwardCompatibilityFlagsForMod(modId, modVersion),
+			], modSourceCode)));
+
+			for (const { exitCode, stdout, stderr } of results) {
+				if (exitCode !== 0) {
+					throw new CompilerError(nativeTarget, exitCode, stdout, stderr);
+				}
+			}
+
+			fs.mkdirSync(path.dirname(nativeDllPath), { recursive: true });
+
+			// Each half imports the engine of its architecture.
+			const { exitCode, stdout, stderr } = await this.runCompiler([
+				'-shared',
+				'-target',
+				nativeTarget,
+				'-Wl,-m,arm64xpe',
+				...halves.map(({ objectPath }) => objectPath),
+				path.join(this.enginePath, this.subfolderFromCompilationTarget(nativeTarget), 'windhawk.lib'),
+				path.join(this.enginePath, this.subfolderFromCompilationTarget(emulatedTarget), 'windhawk.lib'),
+				...(explicitExports ? [] : ['-Wl,--export-all-symbols']),
+				'-o',
+				nativeDllPath,
+				...this.imageBaseFlagsForMod(modId, nativeTarget),
+				...compilerOptionsArray,
+			]);
+			if (exitCode !== 0) {
+				throw new CompilerError(nativeTarget, exitCode, stdout, stderr);
+			}
+
+			if (stderr) {
+				console.log(`Linker stderr for ARM64X:\n${stderr}`);
+			}
+		} finally {
+			fs.rmSync(objectsDir, { recursive: true, force: true });
+		}
+
+		linkToEmulatedFolder();
+
+		if (cacheKey) {
+			this.storeInBuildCache(nativeTarget, cacheKey, targetDllName);
+		}
+	}
+
+	private async compileModForTarget(
+		target: CompilationTarget,
+		targetDllName: string,
+		modId: string,
+		modVersion: string,
+		modSourceCode: string,
+		compilerOptionsArray: string[],
+		precompiledHeadersFolder?: string
+	) {
+		let pchHeaderPath: string | undefined = undefined;
+		if (precompiledHeadersFolder) {
+			pchHeaderPath = path.join(precompiledHeadersFolder, 'windhawk_pch.h');
+			if (!fs.existsSync(pchHeaderPath)) {
+				pchHeaderPath = undefined;
+			}
+		}
+
+		let cacheKey: string | undefined = undefined;
+		try {
+			cacheKey = this.buildCacheKey(
+				target,
+				modId,
+				modVersion,
+				modSourceCode,
+				compilerOptionsArray,
+				pchHeaderPath
+			);
+		} catch (e) {
+			console.error('Failed to compute build cache key:', e);
+		}
+
+		if (cacheKey && this.restoreFromBuildCache(target, cacheKey, targetDllName)) {
+			console.log(`Using cached build for target ${target}`);
+			return;
+		}
+
+		let pchPath: string | undefined = undefined;
+		if (pchHeaderPath) {
+			pchPath = path.join(path.dirname(pchHeaderPath), `windhawk_t_${target}.pch`);
+			if (!fs.existsSync(pchPath) ||
+				fs.statSync(pchPath).mtimeMs < fs.statSync(pchHeaderPath).mtimeMs) {
+				const { exitCode, stdout, stderr } = await this.makePrecompiledHeaders(
+					pchHeaderPath,
+					pchPath,
+					target,
+					modId,
+					modVersion,
+					compilerOptionsArray
+				);
+				if (exitCode !== 0) {
+					throw new CompilerError(
+						target,
+						exitCode,
+						stdout,
+						stderr
+					);
+				}
+
+				if (stdout) {
+					console.log(`Precompiled headers stdout for target ${target}:\n${stdout}`);
+				}
+				if (stderr) {
+					console.log(`Precompiled headers stderr for target ${target}:\n${stderr}`);
+				}
+			}
+		}
+
+		// Mods which define their own symbol hooking helpers are patched by
+		// the shims of the engine, which finds the helpers by their exported
+		// names.
+		let explicitExports = !definesLocalSymbolHookHelpers(modSourceCode);
+
+		let usingDefaultPch = false;
+		if (!pchPath && explicitExports &&
+			this.canUseDefaultPrecompiledHeaders(modId, modVersion, compilerOptionsArray)) {
+			pchPath = await this.getDefaultPrecompiledHeaders(target);
+			usingDefaultPch = !!pchPath;
+		}
+
+		const compile = (withExplicitExports: boolean, withPchPath?: string) => this.compileModInternal(
+			modSourceCode,
+			targetDllName,
+			target,
+			modId,
+			modVersion,
+			compilerOptionsArray,
+			withExplicitExports,
+			withPchPath
+		);
+
+		let result = await compile(explicitExports, pchPath);
+		if (result.exitCode !== 0 && usingDefaultPch && pchPath) {
+			// The default precompiled header might conflict with the mod, e.g.
+			// if the mod declares something which is also declared by one of
+			// the headers, or it might be outdated. Compile without it, so that
+			// the errors, if any, are the mod's own.
+			if (result.stderr.includes('has been modified since the precompiled header')) {
+				try {
+					fs.unlinkSync(pchPath);
+				} catch (e) {
+					// Ignore errors (file may be in use).
+				}
+			}
+
+			console.log(`Compiling without default precompiled headers for target ${target}`);
+			pchPath = undefined;
+			result = await compile(explicitExports);
+		}
+
+		if (result.exitCode !== 0 && explicitExports && /\bWh_Mod\w+/.test(result.stderr)) {
+			// The mod might define a callback with a signature which differs
+			// from the declaration that's needed to export it, e.g.
+			// `bool Wh_ModInit()`. Compile it as before, with all symbols
+			// exported, and without the precompiled header which has the
+			// declarations.
+			console.log(`Compiling with all symbols exported for target ${target}`);
+			explicitExports = false;
+			result = await compile(explicitExports);
+		}
+
+		const { exitCode, stdout, stderr } = result;
+		if (exitCode !== 0) {
+			throw new CompilerError(
+				target,
+				exitCode,
+				stdout,
+				stderr
+			);
+		}
+
+		if (stdout) {
+			console.log(`Compiler stdout for target ${target}:\n${stdout}`);
+		}
+		if (stderr) {
+			console.log(`Compiler stderr for target ${target}:\n${stderr}`);
+		}
+
+		if (cacheKey) {
+			this.storeInBuildCache(target, cacheKey, targetDllName);
+		}
+	}
+
 	public async compileMod(
 		modId: string,
 		modVersion: string,
@@ -422,7 +984,8 @@ export default class CompilerUtils {
 		modSourceCode: string,
 		architectures: string[],
 		compilerOptions: string | undefined,
-		precompiledHeadersFolder?: string
+		precompiledHeadersFolder?: string,
+		optimizeForSize = false
 	) {
 		let targetDllName: string;
 		for (; ;) {
@@ -437,64 +1000,81 @@ export default class CompilerUtils {
 			compilerOptionsArray = splitargs(compilerOptions);
 		}
 
-		for (const target of this.compilationTargetsFromArchitecture(architectures, modTargets)) {
-			let pchPath: string | undefined = undefined;
-			if (precompiledHeadersFolder) {
-				const pchHeaderPath = path.join(precompiledHeadersFolder, 'windhawk_pch.h');
-				if (fs.existsSync(pchHeaderPath)) {
-					pchPath = path.join(precompiledHeadersFolder, `windhawk_t_${target}.pch`);
-					if (!fs.existsSync(pchPath) ||
-						fs.statSync(pchPath).mtimeMs < fs.statSync(pchHeaderPath).mtimeMs) {
-						const { exitCode, stdout, stderr } = await this.makePrecompiledHeaders(
-							pchHeaderPath,
-							pchPath,
-							target,
-							modId,
-							modVersion,
-							compilerOptionsArray
-						);
-						if (exitCode !== 0) {
-							throw new CompilerError(
-								target,
-								exitCode,
-								stdout,
-								stderr
-							);
-						}
+		let preset: CompilePreset = optimizeForSize ? 'size' : 'default';
+		let arm64x = false;
+		compilerOptionsArray = compilerOptionsArray.filter(arg => {
+			if (arg === '--windhawk-arm64x') {
+				arm64x = true;
+				return false;
+			}
 
-						if (stdout) {
-							console.log(`Precompiled headers stdout for target ${target}:\n${stdout}`);
-						}
-						if (stderr) {
-							console.log(`Precompiled headers stderr for target ${target}:\n${stderr}`);
-						}
-					}
+			const match = arg.match(/^--windhawk-preset=(.*)$/);
+			if (!match) {
+				return true;
+			}
+
+			if (!Object.prototype.hasOwnProperty.call(compilePresets, match[1])) {
+				throw new Error(`Unknown compiler preset: ${match[1]}`);
+			}
+
+			preset = match[1] as CompilePreset;
+			return false;
+		});
+
+		compilerOptionsArray = [...compilePresets[preset], ...compilerOptionsArray];
+
+		// A target might be listed more than once, e.g. for both x86-64 and
+		// amd64, and must not be compiled concurrently with itself.
+		// Comment blocks don't affect the compiled code, so a change in them
+		// doesn't affect the build cache key either.
+		modSourceCode = blankModCommentBlocks(modSourceCode);
+
+		let targets = [...new Set(this.compilationTargetsFromArchitecture(architectures, modTargets))];
+
+		// With `--windhawk-arm64x`, a mod which is compiled for both native
+		// ARM64 and emulated x86-64 processes gets a single ARM64X binary for
+		// both, if the compiler supports it. If that fails, the mod is compiled
+		// for each of them as usual.
+		if (arm64x && this.arm64xSupported &&
+			targets.includes('aarch64-w64-mingw32') && targets.includes('x86_64-w64-mingw32')) {
+			try {
+				await this.compileModArm64X(
+					targetDllName,
+					modId,
+					modVersion,
+					modSourceCode,
+					compilerOptionsArray
+				);
+				targets = targets.filter(target =>
+					target !== 'aarch64-w64-mingw32' && target !== 'x86_64-w64-mingw32');
+			} catch (e) {
+				if (e instanceof CompilerKilled) {
+					throw e;
 				}
+
+				console.log('Compiling as ARM64X failed, compiling for each architecture:', e);
 			}
+		}
 
-			const { exitCode, stdout, stderr } = await this.compileModInternal(
-				modSourceCode,
-				targetDllName,
+		// The targets are independent, compile them concurrently. Wait for
+		// all of them before reporting the first failure in the target order,
+		// so that no compiler process is left running.
+		const concurrency = Math.max(1, os.cpus().length);
+		const results = await allSettledWithConcurrency(targets, concurrency, target =>
+			this.compileModForTarget(
 				target,
+				targetDllName,
 				modId,
 				modVersion,
+				modSourceCode,
 				compilerOptionsArray,
-				pchPath
-			);
-			if (exitCode !== 0) {
-				throw new CompilerError(
-					target,
-					exitCode,
-					stdout,
-					stderr
-				);
-			}
+				precompiledHeadersFolder
+			)
+		);
 
-			if (stdout) {
-				console.log(`Compiler stdout for target ${target}:\n${stdout}`);
-			}
-			if (stderr) {
-				console.log(`Compiler stderr for target ${target}:\n${stderr}`);
+		for (const result of results) {
+			if (result?.status === 'rejected') {
+				throw result.reason;
 			}
 		}
 
@@ -503,6 +1083,37 @@ export default class CompilerUtils {
 		};
 	}
 
+	// Returns the size in bytes of the compiled mod for each architecture
+	// subfolder in which it exists.
+	public getCompiledModFileSizes(dllName: string) {
+		const sizes: Record<string, number> = {};
+
+		for (const target of this.supportedCompilationTargets) {
+			const subfolder = this.subfolderFromCompilationTarget(target);
+			try {
+				sizes[subfolder] = fs.statSync(path.join(this.engineModsPath, subfolder, dllName)).size;
+			} catch (e) {
+				// Ignore if file doesn't exist.
+			}
+		}
+
+		return sizes;
+	}
+
+	// Builds the default precompiled headers of all targets in the
+	// background, so that they're ready by the time the mod which is being
+	// edited is compiled. Parsing the headers is most of the time it takes to
+	// compile a typical mod.
+	public warmUp() {
+		for (const target of this.supportedCompilationTargets) {
+			this.getDefaultPrecompiledHeaders(target).catch(e => {
+				if (!(e instanceof CompilerKilled)) {
+					console.error(`Failed to warm up the compiler for target ${target}:`, e);
+				}
+			});
+		}
+	}
+
 	public cancelCompilation() {
 		for (const process of this.activeProcesses) {
 			this.canceledProcesses.add(process);
@@ -528,6 +1139,66 @@ function randomIntFromInterval(min: number, max: number) {
 	return Math.floor(Math.random() * (max - min + 1) + min);
 }
 
+// Replaces the metadata, readme and settings blocks with empty lines. The line
+// count is kept, so that compiler messages and __LINE__ are unaffected.
+function blankModCommentBlocks(modSource: string) {
+	const blockRegexes = [
+		/^\/\/[ \t]+==WindhawkMod==[ \t]*$[\s\S]+?^\/\/[ \t]+==\/WindhawkMod==[ \t]*$/m,
+		/^\/\/[ \t]+==WindhawkModReadme==[ \t]*$\s*\/\*[\s\S]+?\*\/\s*^\/\/[ \t]+==\/WindhawkModReadme==[ \t]*$/m,
+		/^\/\/[ \t]+==WindhawkModSettings==[ \t]*$\s*\/\*[\s\S]+?\*\/\s*^\/\/[ \t]+==\/WindhawkModSettings==[ \t]*$/m,
+	];
+
+	for (const regex of blockRegexes) {
+		modSource = modSource.replace(regex, block => block.replace(/[^\r\n]/g, ''));
+	}
+
+	return modSource;
+}
+
+// Older mods might define their own copy of the symbol hooking helpers, with
+// the structs of older Windhawk versions.
+function definesLocalSymbolHookHelpers(modSource: string) {
+	return /\b(?:HookSymbols|HookSymbolsWithOnlineCacheFallback|CmwfHookSymbols)\s*\([^;{)]*\)\s*\{/.test(modSource);
+}
+
+type SettledResult<R> =
+	| { status: 'fulfilled'; value: R }
+	| { status: 'rejected'; reason: unknown };
+
+// Like Promise.allSettled, but runs at most `limit` tasks at a time, in
+// order. The results are in the order of the items. Once a task fails, no new
+// tasks are started, and the results of the items which weren't started are
+// left undefined.
+async function allSettledWithConcurrency<T, R>(
+	items: T[],
+	limit: number,
+	task: (item: T) => Promise<R>
+) {
+	const results: (SettledResult<R> | undefined)[] = new Array(items.length);
+	let nextIndex = 0;
+	let failed = false;
+
+	const worker = async () => {
+		while (!failed && nextIndex < items.length) {
+			const index = nextIndex++;
+			try {
+				results[index] = { status: 'fulfilled', value: await task(items[index]) };
+			} catch (e: unknown) {
+				results[index] = { status: 'rejected', reason: e };
+				failed = true;
+			}
+		}
+	};
+
+	const workers: Promise<void>[] = [];
+	for (let i = 0; i < Math.min(limit, items.length); i++) {
+		workers.push(worker());
+	}
+
+	await Promise.all(workers);
+	return results;
+}
+
 // https://github.com/elgs/splitargs
 function splitargs(input: string, sep?: RegExp, keepQuotes?: boolean) {
 	const separator = sep || /\s/g;
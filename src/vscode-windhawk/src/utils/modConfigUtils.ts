@@ -31,6 +31,9 @@ const CONFIG_FIELDS = [
 	{ name: 'includeExcludeCustomOnly', storageName: 'IncludeExcludeCustomOnly', type: 'boolean' },
 	{ name: 'patternsMatchCriticalSystemProcesses', storageName: 'PatternsMatchCriticalSystemProcesses', type: 'boolean' },
 	{ name: 'architecture', storageName: 'Architecture', type: 'string-array' },
+	{ name: 'loadWithModule', storageName: 'LoadWithModule', type: 'string-array' },
+	{ name: 'atomicReconfigure', storageName: 'AtomicReconfigure', type: 'boolean' },
+	{ name: 'symbolModules', storageName: 'SymbolModules', type: 'string-array' },
 	{ name: 'version', storageName: 'Version', type: 'string' }
 ] as const satisfies readonly FieldDescriptor[];
 
@@ -53,13 +56,19 @@ type StorageFieldName = typeof CONFIG_FIELDS[number]['storageName'];
 interface ModStorageBackend {
 	// Config operations
 	readAllConfigFields(modId: string): Partial<Record<StorageFieldName, string | number>> | null;
-	writeAllConfigFields(modId: string, fields: Partial<Record<StorageFieldName, string | number>>): void;
+	// If settings are given, they replace the current settings, and
+	// SettingsChangeTime is updated together with the fields, so that the
+	// engine sees a single change.
+	writeAllConfigFields(
+		modId: string,
+		fields: Partial<Record<StorageFieldName, string | number>>,
+		settings?: Record<string, string | number>
+	): void;
 	writeConfigField(modId: string, field: StorageFieldName, value: string | number): void;
 	configExists(modId: string): boolean;
 
 	// Settings operations
 	readAllSettings(modId: string): Record<string, string | number>;
-	writeAllSettings(modId: string, settings: Record<string, string | number>): void;
 
 	// Lifecycle operations
 	deleteConfig(modId: string): void;
@@ -106,7 +115,12 @@ class ModConfigCodec {
 		return config as ModConfig;
 	}
 
-	static serialize(backend: ModStorageBackend, modId: string, config: Partial<ModConfig>): void {
+	static serialize(
+		backend: ModStorageBackend,
+		modId: string,
+		config: Partial<ModConfig>,
+		settings?: Record<string, string | number>
+	): void {
 		const fieldsToWrite: Partial<Record<StorageFieldName, string | number>> = {};
 
 		for (const field of CONFIG_FIELDS) {
@@ -133,7 +147,7 @@ class ModConfigCodec {
 		}
 
 		// Batch write all fields at once for performance
-		backend.writeAllConfigFields(modId, fieldsToWrite);
+		backend.writeAllConfigFields(modId, fieldsToWrite, settings);
 	}
 }
 
@@ -178,11 +192,17 @@ function getModStoragePath(engineModsWritablePath: string, modId: string) {
 }
 
 function deleteModStoragePath(engineModsWritablePath: string, modId: string): void {
-	const modStoragePath = getModStoragePath(engineModsWritablePath, modId);
-	try {
-		fs.rmSync(modStoragePath, { recursive: true, force: true });
-	} catch (e) {
-		// Ignore errors.
+	// The URL cache of the mod is kept by the engine next to its storage.
+	const paths = [
+		getModStoragePath(engineModsWritablePath, modId),
+		path.join(engineModsWritablePath, 'url-cache', modId),
+	];
+	for (const modPath of paths) {
+		try {
+			fs.rmSync(modPath, { recursive: true, force: true });
+		} catch (e) {
+			// Ignore errors.
+		}
 	}
 }
 
@@ -228,7 +248,11 @@ class IniStorageBackend implements ModStorageBackend {
 		return result;
 	}
 
-	writeAllConfigFields(modId: string, fields: Partial<Record<StorageFieldName, string | number>>): void {
+	writeAllConfigFields(
+		modId: string,
+		fields: Partial<Record<StorageFieldName, string | number>>,
+		settings?: Record<string, string | number>
+	): void {
 		const modIniPath = this.getModIniPath(modId);
 		const modConfig = ini.fromFileOrDefault(modIniPath);
 
@@ -237,6 +261,16 @@ class IniStorageBackend implements ModStorageBackend {
 			modConfig.Mod[field] = value.toString();
 		}
 
+		if (settings) {
+			const settingsSection: Record<string, string> = {};
+			for (const [k, v] of Object.entries(settings)) {
+				settingsSection[k] = v.toString();
+			}
+
+			modConfig.Settings = settingsSection;
+			modConfig.Mod.SettingsChangeTime = getSettingsChangeTime().toString();
+		}
+
 		fs.mkdirSync(path.dirname(modIniPath), { recursive: true });
 		ini.toFile(modIniPath, modConfig);
 	}
@@ -257,23 +291,6 @@ class IniStorageBackend implements ModStorageBackend {
 		return modConfig.Settings || {};
 	}
 
-	writeAllSettings(modId: string, settings: Record<string, string | number>): void {
-		const modIniPath = this.getModIniPath(modId);
-		const modConfig = ini.fromFileOrDefault(modIniPath);
-
-		const settingsSection: Record<string, string> = {};
-		for (const [k, v] of Object.entries(settings)) {
-			settingsSection[k] = v.toString();
-		}
-
-		modConfig.Settings = settingsSection;
-		modConfig.Mod = modConfig.Mod || {};
-		modConfig.Mod.SettingsChangeTime = getSettingsChangeTime().toString();
-
-		fs.mkdirSync(path.dirname(modIniPath), { recursive: true });
-		ini.toFile(modIniPath, modConfig);
-	}
-
 	deleteConfig(modId: string): void {
 		const modIniPath = this.getModIniPath(modId);
 		try {
@@ -394,11 +411,21 @@ class RegistryStorageBackend implements ModStorageBackend {
 		}
 	}
 
-	writeAllConfigFields(modId: string, fields: Partial<Record<StorageFieldName, string | number>>): void {
+	writeAllConfigFields(
+		modId: string,
+		fields: Partial<Record<StorageFieldName, string | number>>,
+		settings?: Record<string, string | number>
+	): void {
+		const valuesToWrite: Record<string, string | number> = { ...fields };
+		if (settings) {
+			this.replaceSettings(modId, settings);
+			valuesToWrite['SettingsChangeTime'] = getSettingsChangeTime();
+		}
+
 		const key = reg.createKey(this.regKey, this.regSubKey + '\\' + modId,
 			reg.Access.SET_VALUE | reg.Access.WOW64_64KEY);
 		try {
-			for (const [field, value] of Object.entries(fields)) {
+			for (const [field, value] of Object.entries(valuesToWrite)) {
 				if (typeof value === 'number') {
 					reg.setValueDWORD(key, field, value);
 				} else {
@@ -456,31 +483,53 @@ class RegistryStorageBackend implements ModStorageBackend {
 		return settings;
 	}
 
-	writeAllSettings(modId: string, settings: Record<string, string | number>): void {
-		const settingsKey = reg.createKey(this.regKey, this.regSubKey + '\\' + modId + '\\Settings',
+	// The settings are written to a staging key, which then replaces the
+	// Settings key, so that the values don't change one by one while a mod
+	// might be reading them.
+	private replaceSettings(modId: string, settings: Record<string, string | number>): void {
+		const modSubKey = this.regSubKey + '\\' + modId;
+
+		const stagingKey = reg.createKey(this.regKey, modSubKey + '\\SettingsStaging',
 			reg.Access.QUERY_VALUE | reg.Access.SET_VALUE | reg.Access.DELETE | reg.Access.ENUMERATE_SUB_KEYS | reg.Access.WOW64_64KEY);
 		try {
-			reg.deleteTree(settingsKey, null);
+			// Left from an interrupted write, if any.
+			reg.deleteTree(stagingKey, null);
 
 			for (const [name, value] of Object.entries(settings)) {
 				if (typeof value === 'number') {
 					// Add [...] `>>> 0` for a 32-bit unsigned integer result.
 					const valueUnsigned = value >>> 0;
-					reg.setValueDWORD(settingsKey, name, valueUnsigned);
+					reg.setValueDWORD(stagingKey, name, valueUnsigned);
 				} else {
-					reg.setValueSZ(settingsKey, name, value);
+					reg.setValueSZ(stagingKey, name, value);
 				}
 			}
 		} finally {
-			reg.closeKey(settingsKey);
+			reg.closeKey(stagingKey);
+		}
+
+		const settingsKey = reg.openKey(this.regKey, modSubKey + '\\Settings',
+			reg.Access.QUERY_VALUE | reg.Access.SET_VALUE | reg.Access.DELETE | reg.Access.ENUMERATE_SUB_KEYS | reg.Access.WOW64_64KEY);
+		if (settingsKey) {
+			try {
+				if (reg.deleteTree(settingsKey, null)) {
+					reg.deleteKey(settingsKey, '');
+				}
+			} finally {
+				reg.closeKey(settingsKey);
+			}
+		}
+
+		const stagingKeyToRename = reg.openKey(this.regKey, modSubKey + '\\SettingsStaging',
+			reg.Access.WRITE | reg.Access.WOW64_64KEY);
+		if (!stagingKeyToRename) {
+			throw new Error('Failed to open the staging settings key');
 		}
 
-		const modKey = reg.createKey(this.regKey, this.regSubKey + '\\' + modId,
-			reg.Access.SET_VALUE | reg.Access.WOW64_64KEY);
 		try {
-			reg.setValueDWORD(modKey, 'SettingsChangeTime', getSettingsChangeTime());
+			reg.renameKey(stagingKeyToRename, null, 'Settings');
 		} finally {
-			reg.closeKey(modKey);
+			reg.closeKey(stagingKeyToRename);
 		}
 	}
 
@@ -555,12 +604,27 @@ export interface ModConfigUtils {
 class ModConfigUtilsBase implements ModConfigUtils {
 	protected backend: ModStorageBackend;
 
+	// The config of the installed mods, read from the storage once and then
+	// kept up to date by the writes done with this object, since the extension
+	// is the only writer of the mods config. Only the mod which is written is
+	// read again. Null until it's first needed.
+	private installedConfig: Record<string, ModConfig> | null = null;
+
 	protected constructor(backend: ModStorageBackend) {
 		this.backend = backend;
 	}
 
 	public getConfigOfInstalled() {
-		return this.backend.getConfigOfInstalled();
+		if (!this.installedConfig) {
+			this.installedConfig = this.backend.getConfigOfInstalled();
+		}
+
+		const result: Record<string, ModConfig> = {};
+		for (const [modId, config] of Object.entries(this.installedConfig)) {
+			result[modId] = copyModConfig(config);
+		}
+
+		return result;
 	}
 
 	public doesConfigExist(modId: string) {
@@ -568,17 +632,23 @@ class ModConfigUtilsBase implements ModConfigUtils {
 	}
 
 	public getModConfig(modId: string) {
+		if (this.installedConfig) {
+			const config = this.installedConfig[modId];
+			return config ? copyModConfig(config) : null;
+		}
+
 		return ModConfigCodec.parse(this.backend, modId);
 	}
 
 	public setModConfig(modId: string, config: Partial<ModConfig>, settingsConfig?: ModSettingsConfig) {
 		const configExisted = this.backend.configExists(modId);
 
-		ModConfigCodec.serialize(this.backend, modId, config);
-
+		// Written together with the config, so that installing or updating a
+		// mod is a single change for the engine.
+		let settingsToWrite: ModSettings | undefined;
 		if (settingsConfig) {
 			if (!settingsConfig.previousInitialSettings && !configExisted) {
-				this.backend.writeAllSettings(modId, settingsConfig.initialSettings);
+				settingsToWrite = settingsConfig.initialSettings;
 			} else {
 				const { mergedSettings, existingSettingsChanged } =
 					mergeModSettings({
@@ -586,10 +656,13 @@ class ModConfigUtilsBase implements ModConfigUtils {
 						...this.backend.readAllSettings(modId)
 					}, settingsConfig.initialSettings);
 				if (existingSettingsChanged) {
-					this.backend.writeAllSettings(modId, mergedSettings);
+					settingsToWrite = mergedSettings;
 				}
 			}
 		}
+
+		ModConfigCodec.serialize(this.backend, modId, config, settingsToWrite);
+		this.refreshInstalledConfig(modId);
 	}
 
 	public getModSettings(modId: string) {
@@ -597,24 +670,62 @@ class ModConfigUtilsBase implements ModConfigUtils {
 	}
 
 	public setModSettings(modId: string, settings: ModSettings) {
-		this.backend.writeAllSettings(modId, settings);
+		this.backend.writeAllConfigFields(modId, {}, settings);
 	}
 
 	public enableMod(modId: string, enable: boolean) {
 		this.backend.writeConfigField(modId, 'Disabled', enable ? 0 : 1);
+		this.refreshInstalledConfig(modId);
 	}
 
 	public enableLogging(modId: string, enable: boolean) {
 		this.backend.writeConfigField(modId, 'LoggingEnabled', enable ? 1 : 0);
+		this.refreshInstalledConfig(modId);
 	}
 
 	public deleteMod(modId: string) {
 		this.backend.deleteConfig(modId);
+		this.refreshInstalledConfig(modId);
 	}
 
 	public changeModId(modIdFrom: string, modIdTo: string) {
 		this.backend.renameConfig(modIdFrom, modIdTo);
+		this.refreshInstalledConfig(modIdFrom);
+		this.refreshInstalledConfig(modIdTo);
 	}
+
+	private refreshInstalledConfig(modId: string) {
+		if (!this.installedConfig) {
+			return;
+		}
+
+		let config: ModConfig | null;
+		try {
+			config = ModConfigCodec.parse(this.backend, modId);
+		} catch (e) {
+			// The write succeeded, read everything again next time.
+			this.installedConfig = null;
+			return;
+		}
+
+		if (config) {
+			this.installedConfig[modId] = config;
+		} else {
+			delete this.installedConfig[modId];
+		}
+	}
+}
+
+// The cached config is never handed out as is, so that callers can't change it.
+function copyModConfig(config: ModConfig): ModConfig {
+	const copy: Record<string, unknown> = { ...config };
+	for (const field of CONFIG_FIELDS) {
+		if (field.type === 'string-array') {
+			copy[field.name] = [...config[field.name]];
+		}
+	}
+
+	return copy as ModConfig;
 }
 
 export class ModConfigUtilsPortable extends ModConfigUtilsBase {
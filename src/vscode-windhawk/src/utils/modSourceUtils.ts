@@ -14,6 +14,7 @@ const modMetadataParams = {
 		'compilerOptions',
 		'license',
 		'donateUrl',
+		'atomicReconfigure',
 	],
 	singleValueLocalizable: [
 		'name',
@@ -24,6 +25,7 @@ const modMetadataParams = {
 		'include',
 		'exclude',
 		'architecture',
+		'loadWithModule',
 	],
 } as const;
 
@@ -158,6 +160,18 @@ export default class ModSourceUtils {
 			}
 		}
 
+		for (const moduleName of metadata.loadWithModule || []) {
+			if (moduleName.match(/[\\/:*?"<>|]/)) {
+				throw new Error(`Mod loadWithModule must be a module file name without a path: ${moduleName}`);
+			}
+		}
+
+		if (metadata.atomicReconfigure !== undefined &&
+			metadata.atomicReconfigure !== 'true' &&
+			metadata.atomicReconfigure !== 'false') {
+			throw new Error(`Mod atomicReconfigure must be true or false: ${metadata.atomicReconfigure}`);
+		}
+
 		const supportedArchitecture = [
 			'x86',
 			'x86-64',
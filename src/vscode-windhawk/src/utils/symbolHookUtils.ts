@@ -0,0 +1,449 @@
+import * as fs from 'fs';
+import * as path from 'path';
+
+type SymbolHook = {
+	// Alternative names, the hook is resolved by the first one found.
+	names: string[];
+	optional: boolean;
+};
+
+type SymbolHookTable = {
+	name: string;
+	hooks: SymbolHook[];
+};
+
+// A 64-bit hash, as two 32-bit halves.
+type NameHash = {
+	hi: number;
+	lo: number;
+};
+
+// Must match the format written by SymbolIndex in the engine.
+const symbolIndexMagic = 0x49534857; // "WHSI"
+const symbolIndexVersion = 2;
+const symbolIndexFlagHasUndecorated = 0x01;
+const symbolIndexHeaderSize = 24;
+const symbolIndexEntrySize = 16;
+
+const maxSymbolModuleNames = 16;
+
+// FNV-1a over the UTF-16 code units of the name, with the length mixed in, the
+// same as SymbolIndex::HashName in the engine. The multiplication by the
+// prime, 2^40 + 0x1b3, is split so that no intermediate result exceeds 2^53.
+export function hashSymbolName(name: string): NameHash {
+	let hi = 0xcbf29ce4;
+	let lo = 0x84222325;
+
+	const multiply = () => {
+		const loProduct = lo * 0x1b3;
+		const carry = Math.floor(loProduct / 0x100000000);
+		hi = (hi * 0x1b3 + carry + ((lo << 8) >>> 0)) >>> 0;
+		lo = loProduct >>> 0;
+	};
+
+	for (let i = 0; i < name.length; i++) {
+		lo = (lo ^ name.charCodeAt(i)) >>> 0;
+		multiply();
+	}
+
+	lo = (lo ^ name.length) >>> 0;
+	multiply();
+
+	return { hi, lo };
+}
+
+// Returns the length of the string or character literal, or of the comment,
+// which starts at the given position, or 0 if there's none. Sets `value` to
+// the contents of a wide string literal, or to null if it contains escape
+// sequences which aren't supported.
+function scanLiteralOrComment(
+	source: string,
+	pos: number,
+	out: { value?: string | null }
+): number {
+	out.value = undefined;
+
+	if (source.startsWith('//', pos)) {
+		const end = source.indexOf('\n', pos);
+		return (end === -1 ? source.length : end) - pos;
+	}
+
+	if (source.startsWith('/*', pos)) {
+		const end = source.indexOf('*/', pos + 2);
+		return (end === -1 ? source.length : end + 2) - pos;
+	}
+
+	// A quote or a prefix which follows an identifier character isn't the
+	// start of a literal, e.g. a digit separator.
+	if (pos > 0 && /\w/.test(source[pos - 1])) {
+		return 0;
+	}
+
+	const rawMatch = /^(L|u8|u|U)?R"([^()\\\s]{0,16})\(/.exec(source.slice(pos, pos + 24));
+	if (rawMatch) {
+		const terminator = ')' + rawMatch[2] + '"';
+		const contentStart = pos + rawMatch[0].length;
+		const end = source.indexOf(terminator, contentStart);
+		if (end === -1) {
+			return source.length - pos;
+		}
+
+		if (rawMatch[1] === 'L') {
+			out.value = source.slice(contentStart, end);
+		}
+
+		return end + terminator.length - pos;
+	}
+
+	const quoteMatch = /^(L|u8|u|U)?(["'])/.exec(source.slice(pos, pos + 3));
+	if (quoteMatch) {
+		const quote = quoteMatch[2];
+		let value: string | null = '';
+		let i = pos + quoteMatch[0].length;
+		for (; i < source.length && source[i] !== quote && source[i] !== '\n'; i++) {
+			if (source[i] === '\\') {
+				i++;
+				const escaped: Record<string, string> = {
+					'\\': '\\',
+					'"': '"',
+					'\'': '\'',
+					'?': '?',
+					'n': '\n',
+					't': '\t',
+				};
+				if (value !== null && source[i] in escaped) {
+					value += escaped[source[i]];
+				} else {
+					value = null;
+				}
+			} else if (value !== null) {
+				value += source[i];
+			}
+		}
+
+		if (quote === '"' && quoteMatch[1] === 'L') {
+			out.value = value;
+		}
+
+		return i + 1 - pos;
+	}
+
+	return 0;
+}
+
+// Replaces comments with spaces, keeping the positions of everything else.
+function blankComments(source: string) {
+	let result = '';
+	let pos = 0;
+	const literal: { value?: string | null } = {};
+	while (pos < source.length) {
+		const length = scanLiteralOrComment(source, pos, literal);
+		if (length === 0) {
+			result += source[pos];
+			pos++;
+			continue;
+		}
+
+		const text = source.slice(pos, pos + length);
+		result += text.startsWith('/') ? text.replace(/[^\n]/g, ' ') : text;
+		pos += length;
+	}
+
+	return result;
+}
+
+// Extracts the symbol hook tables, i.e. the `WindhawkUtils::SYMBOL_HOOK` array
+// definitions, and the names of their symbols. Only literal names can be
+// extracted, hooks with any other names are skipped.
+export function extractSymbolHookTables(modSource: string): SymbolHookTable[] {
+	const tables: SymbolHookTable[] = [];
+
+	const searchSource = blankComments(modSource);
+	const tableRegex = /\b(?:WH_)?SYMBOL_HOOK\s+(\w+)\s*\[\s*\w*\s*\]\s*=\s*\{/g;
+	let tableMatch: RegExpExecArray | null;
+	while ((tableMatch = tableRegex.exec(searchSource))) {
+		const table: SymbolHookTable = { name: tableMatch[1], hooks: [] };
+
+		let depth = 1;
+		let hook: SymbolHook | null = null;
+		let hookValid = true;
+		let lastHookToken = '';
+		// Adjacent literals are concatenated.
+		let pendingName: string | null = null;
+		const literal: { value?: string | null } = {};
+
+		const flushPendingName = () => {
+			if (hook && pendingName !== null) {
+				hook.names.push(pendingName);
+			}
+			pendingName = null;
+		};
+
+		let pos = tableRegex.lastIndex;
+		while (pos < modSource.length && depth > 0) {
+			const literalLength = scanLiteralOrComment(modSource, pos, literal);
+			if (literalLength > 0) {
+				if (literal.value === null) {
+					hookValid = false;
+				} else if (literal.value !== undefined) {
+					pendingName = (pendingName ?? '') + literal.value;
+				}
+
+				pos += literalLength;
+				continue;
+			}
+
+			const c = modSource[pos];
+			if (/\s/.test(c)) {
+				pos++;
+				continue;
+			}
+
+			// Skip preprocessor directives, both branches of a conditional are
+			// extracted.
+			if (c === '#' && /(?:^|\n)[ \t]*$/.test(modSource.slice(Math.max(0, pos - 256), pos))) {
+				const end = modSource.indexOf('\n', pos);
+				pos = end === -1 ? modSource.length : end;
+				continue;
+			}
+
+			flushPendingName();
+
+			if (c === '{') {
+				depth++;
+				if (depth === 2) {
+					hook = { names: [], optional: false };
+					hookValid = true;
+					lastHookToken = '';
+				}
+			} else if (c === '}') {
+				if (depth === 2 && hook) {
+					hook.optional = lastHookToken === 'true';
+					if (hookValid && hook.names.length > 0) {
+						table.hooks.push(hook);
+					}
+					hook = null;
+				}
+				depth--;
+			} else if (depth === 2) {
+				const tokenMatch = /^\w+/.exec(modSource.slice(pos, pos + 64));
+				if (tokenMatch) {
+					lastHookToken = tokenMatch[0];
+					pos += tokenMatch[0].length;
+					continue;
+				}
+
+				if (c !== ',') {
+					lastHookToken = c;
+				}
+			}
+
+			pos++;
+		}
+
+		tableRegex.lastIndex = pos;
+
+		if (table.hooks.length > 0) {
+			tables.push(table);
+		}
+	}
+
+	return tables;
+}
+
+// Extracts the names of the modules which the mod is expected to resolve
+// symbols in, so that the service can prefetch their symbols before the mod
+// first loads. Mods get the module handles for their symbol hooks from
+// literal module names, e.g. `LoadLibraryEx(L"twinui.pcshell.dll", ...)`, so
+// the wide string literals which are module file names are taken. Mods
+// without symbol hook tables have none. Extra names only cost a prefetch of
+// a module which might not be needed.
+export function extractSymbolModuleNames(modSource: string): string[] {
+	if (extractSymbolHookTables(modSource).length === 0) {
+		return [];
+	}
+
+	const moduleNames = new Set<string>();
+
+	const literal: { value?: string | null } = {};
+	let pos = 0;
+	while (pos < modSource.length && moduleNames.size < maxSymbolModuleNames) {
+		const literalLength = scanLiteralOrComment(modSource, pos, literal);
+		if (literalLength === 0) {
+			pos++;
+			continue;
+		}
+
+		if (literal.value && /^[\w.-]+\.(?:dll|exe)$/i.test(literal.value)) {
+			moduleNames.add(literal.value.toLowerCase());
+		}
+
+		pos += literalLength;
+	}
+
+	return [...moduleNames];
+}
+
+class SymbolIndexFile {
+	private fd: number;
+	private tables: { offset: number; count: number }[] = [];
+
+	private constructor(fd: number) {
+		this.fd = fd;
+	}
+
+	public static open(filePath: string): SymbolIndexFile | null {
+		let fd: number;
+		try {
+			fd = fs.openSync(filePath, 'r');
+		} catch (e) {
+			return null;
+		}
+
+		const index = new SymbolIndexFile(fd);
+		try {
+			const header = Buffer.alloc(symbolIndexHeaderSize);
+			if (fs.readSync(fd, header, 0, header.length, 0) !== header.length ||
+				header.readUInt32LE(0) !== symbolIndexMagic ||
+				header.readUInt32LE(4) !== symbolIndexVersion) {
+				index.close();
+				return null;
+			}
+
+			const flags = header.readUInt32LE(8);
+			const decoratedCount = header.readUInt32LE(12);
+			const undecoratedCount = header.readUInt32LE(16);
+			// Followed by the address table and the names, which aren't used here.
+			const minSize = symbolIndexHeaderSize +
+				(decoratedCount + undecoratedCount) * symbolIndexEntrySize;
+			if (fs.fstatSync(fd).size < minSize) {
+				index.close();
+				return null;
+			}
+
+			index.tables.push({ offset: symbolIndexHeaderSize, count: decoratedCount });
+			if (flags & symbolIndexFlagHasUndecorated) {
+				index.tables.push({
+					offset: symbolIndexHeaderSize + decoratedCount * symbolIndexEntrySize,
+					count: undecoratedCount,
+				});
+			}
+		} catch (e) {
+			index.close();
+			return null;
+		}
+
+		return index;
+	}
+
+	// Returns null if the index has no table which could contain the name,
+	// which happens for undecorated names if the index only has the decorated
+	// table.
+	public contains(name: string): boolean | null {
+		const canBeDecorated = name.startsWith('?');
+		if (!canBeDecorated && this.tables.length < 2) {
+			return null;
+		}
+
+		const hash = hashSymbolName(name);
+		return this.tables.some(table => this.tableContains(table, hash));
+	}
+
+	public close() {
+		fs.closeSync(this.fd);
+	}
+
+	private tableContains(table: { offset: number; count: number }, hash: NameHash) {
+		const entry = Buffer.alloc(8);
+		let low = 0;
+		let high = table.count;
+		while (low < high) {
+			const mid = Math.floor((low + high) / 2);
+			fs.readSync(this.fd, entry, 0, entry.length, table.offset + mid * symbolIndexEntrySize);
+			const entryHi = entry.readUInt32LE(4);
+			const entryLo = entry.readUInt32LE(0);
+			if (entryHi === hash.hi && entryLo === hash.lo) {
+				return true;
+			}
+
+			if (entryHi < hash.hi || (entryHi === hash.hi && entryLo < hash.lo)) {
+				low = mid + 1;
+			} else {
+				high = mid;
+			}
+		}
+
+		return false;
+	}
+}
+
+export default class SymbolHookUtils {
+	private symbolIndexPath: string;
+
+	public constructor(appDataPath: string) {
+		this.symbolIndexPath = path.join(appDataPath, 'Engine', 'Symbols', 'windhawk-symbol-index');
+	}
+
+	/**
+	 * Checks the symbol hook tables of the mod against the symbol indexes
+	 * which the engine built on this computer, and returns a warning for each
+	 * required hook which won't be resolved. A table is checked against the
+	 * index in which most of its hooks are found, which is assumed to be of
+	 * its target module. Tables for which no index has any of the hooks, e.g.
+	 * because the mod didn't run yet, aren't checked.
+	 */
+	public findUnresolvedSymbolHooks(modSource: string): string[] {
+		const tables = extractSymbolHookTables(modSource);
+		if (tables.length === 0) {
+			return [];
+		}
+
+		let indexFileNames: string[];
+		try {
+			indexFileNames = fs.readdirSync(this.symbolIndexPath).filter(name => name.endsWith('.idx'));
+		} catch (e) {
+			return [];
+		}
+
+		const indexes: SymbolIndexFile[] = [];
+		for (const indexFileName of indexFileNames) {
+			const index = SymbolIndexFile.open(path.join(this.symbolIndexPath, indexFileName));
+			if (index) {
+				indexes.push(index);
+			}
+		}
+
+		const warnings: string[] = [];
+
+		try {
+			for (const table of tables) {
+				let bestResolved: boolean[] | null = null;
+				let bestResolvedCount = 0;
+				for (const index of indexes) {
+					const resolved = table.hooks.map(hook => hook.names.some(name => index.contains(name)));
+					const resolvedCount = resolved.filter(x => x).length;
+					if (resolvedCount > bestResolvedCount) {
+						bestResolved = resolved;
+						bestResolvedCount = resolvedCount;
+					}
+				}
+
+				if (!bestResolved) {
+					continue;
+				}
+
+				table.hooks.forEach((hook, i) => {
+					if (!bestResolved?.[i] && !hook.optional) {
+						warnings.push(`${table.name}: symbol might not be found: ${hook.names.join(' | ')}`);
+					}
+				});
+			}
+		} finally {
+			for (const index of indexes) {
+				index.close();
+			}
+		}
+
+		return warnings;
+	}
+}
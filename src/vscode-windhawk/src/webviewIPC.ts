@@ -30,7 +30,8 @@ import {
   UpdateInstalledModsDetailsData,
   UpdateInstallingEventData,
   UpdateModConfigReplyData,
-  UpdateModRatingReplyData
+  UpdateModRatingReplyData,
+  UpdateModsReplyData
 } from './webviewIPCMessages';
 
 // Message types:
@@ -348,6 +349,21 @@ export function installModReply(
   webview.postMessage(msg);
 }
 
+export function updateModsReply(
+  webview: vscode.Webview | undefined,
+  messageId: number,
+  data: UpdateModsReplyData
+) {
+  if (!webview) return;
+  const msg: Reply = {
+    type: 'reply',
+    command: 'updateMods',
+    messageId,
+    data,
+  };
+  webview.postMessage(msg);
+}
+
 export function compileModReply(
   webview: vscode.Webview | undefined,
   messageId: number,
@@ -1,17 +1,26 @@
 #include "stdafx.h"
 
 #include "functions.h"
+#include "log_file_decoder.h"
+#include "log_ring_reader.h"
 #include "logger.h"
 #include "main_window.h"
+#include "perf_stats_export.h"
+#include "process_job.h"
 #include "resource.h"
 #include "service.h"
+#include "service_common.h"
 #include "storage_manager.h"
+#include "targeting_dry_run.h"
 #include "ui_control.h"
+#include "update_package.h"
 
 CAppModule _Module;
 
 namespace {
 
+constexpr DWORD kLogOutputPollIntervalMs = 100;
+
 enum class Action {
     kDefault,
     kService,
@@ -27,6 +36,13 @@ enum class Action {
     kExit,
     kRestart,
     kRestartBg,
+    kApplyUpdate,
+    kPauseMods,
+    kResumeMods,
+    kDecodeLogFile,
+    kLogOutput,
+    kExportPerfStats,
+    kTargetingDryRun,
 };
 
 void Initialize();
@@ -38,17 +54,27 @@ void NotifyAppSettingsChanged();
 void ExitApp(bool wait, DWORD timeout);
 void RestartApp(DWORD timeout, bool trayOnly);
 void RestartAppBg(DWORD timeout);
+void ApplyUpdate(DWORD timeout);
 void EnableSafeMode();
+void SetModsPaused(bool paused);
+void RunLogOutput(DWORD processId, PCWSTR modName);
+void ExportPerfStats(PCWSTR outputPath);
+void ExportTargetingDryRun(PCWSTR outputPath);
+void WriteOutput(PCWSTR outputPath, const std::string& data);
+DWORD GetSessionManagerProcessId();
+std::vector<DWORD> GetProcessIdsFromSnapshot(bool windhawkBgOnly);
 void WaitForRunningProcessesToTerminate(DWORD timeout,
                                         bool windhawkBgOnly = false);
 void RunAsNewProcess(PCWSTR parameters);
 bool RunAsAdmin(PCWSTR parameters);
 bool PostCommandToPortableRunningDaemon(
-    CMainWindow::PortableAppCommand command);
+    CMainWindow::PortableAppCommand command,
+    LPARAM lParam = 0);
 void SetNamedEventForAllSessions(PCWSTR eventNamePrefix);
 bool SetNamedEvent(PCWSTR eventName);
 bool DoesParamExist(PCWSTR param);
 int GetIntParam(PCWSTR param);
+PCWSTR GetStringParam(PCWSTR param);
 
 }  // namespace
 
@@ -99,12 +125,27 @@ int WINAPI wWinMain(_In_ HINSTANCE hInstance,
         action = Action::kRestart;
     } else if (DoesParamExist(L"-restart-bg")) {
         action = Action::kRestartBg;
+    } else if (DoesParamExist(L"-apply-update")) {
+        action = Action::kApplyUpdate;
+    } else if (DoesParamExist(L"-pause-mods")) {
+        action = Action::kPauseMods;
+    } else if (DoesParamExist(L"-resume-mods")) {
+        action = Action::kResumeMods;
+    } else if (DoesParamExist(L"-decode-log-file")) {
+        action = Action::kDecodeLogFile;
+    } else if (DoesParamExist(L"-log-output")) {
+        action = Action::kLogOutput;
+    } else if (DoesParamExist(L"-export-perf-stats")) {
+        action = Action::kExportPerfStats;
+    } else if (DoesParamExist(L"-targeting-dry-run")) {
+        action = Action::kTargetingDryRun;
     }
 
     HRESULT hr = S_OK;
 
     try {
         Initialize();
+        ProcessJob::AssignCurrentProcess();
         Run(action);
     } catch (const std::exception& e) {
         switch (action) {
@@ -229,6 +270,59 @@ void Run(Action action) {
             break;
         }
 
+        case Action::kApplyUpdate: {
+            VERBOSE("Applying the staged update");
+            DWORD timeout = GetIntParam(L"-timeout");
+            if (timeout == 0) {
+                timeout = INFINITE;
+            }
+
+            ApplyUpdate(timeout);
+            break;
+        }
+
+        case Action::kPauseMods:
+            VERBOSE("Pausing mods");
+            SetModsPaused(true);
+            break;
+
+        case Action::kResumeMods:
+            VERBOSE("Resuming mods");
+            SetModsPaused(false);
+            break;
+
+        case Action::kDecodeLogFile: {
+            VERBOSE("Decoding log file");
+            PCWSTR inputPath = GetStringParam(L"-decode-log-file");
+            THROW_HR_IF_NULL(E_INVALIDARG, inputPath);
+
+            std::filesystem::path outputPath;
+            if (PCWSTR outputParam = GetStringParam(L"-output")) {
+                outputPath = outputParam;
+            } else {
+                outputPath = inputPath;
+                outputPath.replace_extension(L".txt");
+            }
+
+            LogFileDecoder::Decode(inputPath, outputPath);
+            break;
+        }
+
+        case Action::kLogOutput:
+            VERBOSE("Writing log output");
+            RunLogOutput(GetIntParam(L"-pid"), GetStringParam(L"-mod"));
+            break;
+
+        case Action::kExportPerfStats:
+            VERBOSE("Exporting performance stats");
+            ExportPerfStats(GetStringParam(L"-output"));
+            break;
+
+        case Action::kTargetingDryRun:
+            VERBOSE("Evaluating the mod targeting of the running processes");
+            ExportTargetingDryRun(GetStringParam(L"-output"));
+            break;
+
         default:
             VERBOSE("Running Windhawk daemon");
             RunDaemon();
@@ -314,7 +408,7 @@ void RunDaemon() {
     CMessageLoopAlwaysRunOnIdle loop;
     _Module.AddMessageLoop(&loop);
 
-    CMainWindow wnd(trayOnly, portable);
+    CMainWindow wnd(trayOnly, portable, DoesParamExist(L"-show-toolkit"));
     wnd.Create(nullptr);
     // wnd.ShowWindow(SW_SHOW);
 
@@ -326,8 +420,17 @@ void RunDaemon() {
 void CheckForUpdates() {
     bool portable = StorageManager::GetInstance().IsPortable();
 
+    // Windhawk doesn't have to be running for the update check, only for the
+    // mod performance report.
+    DWORD sessionManagerProcessId = 0;
+    try {
+        sessionManagerProcessId = GetSessionManagerProcessId();
+    } catch (const std::exception& e) {
+        VERBOSE(L"Not sending the mod performance report: %S", e.what());
+    }
+
     UpdateChecker m_updateChecker(portable ? UpdateChecker::kFlagPortable : 0,
-                                  nullptr);
+                                  sessionManagerProcessId, nullptr);
     UpdateChecker::Result result = m_updateChecker.HandleResponse();
     THROW_IF_FAILED(result.hrError);
 
@@ -369,9 +472,10 @@ void RestartApp(DWORD timeout, bool trayOnly) {
 
     if (portable) {
         PostCommandToPortableRunningDaemon(
-            CMainWindow::PortableAppCommand::kExit);
+            CMainWindow::PortableAppCommand::kExit,
+            CMainWindow::kExitForRestart);
     } else {
-        Service::Stop(false);
+        Service::StopForRestart();
     }
 
     WaitForRunningProcessesToTerminate(timeout);
@@ -399,9 +503,10 @@ void RestartAppBg(DWORD timeout) {
 
     if (portable) {
         PostCommandToPortableRunningDaemon(
-            CMainWindow::PortableAppCommand::kExit);
+            CMainWindow::PortableAppCommand::kExit,
+            CMainWindow::kExitForRestart);
     } else {
-        Service::Stop(false);
+        Service::StopForRestart();
     }
 
     WaitForRunningProcessesToTerminate(timeout, /*windhawkBgOnly=*/true);
@@ -417,12 +522,202 @@ void RestartAppBg(DWORD timeout) {
     }
 }
 
+void ApplyUpdate(DWORD timeout) {
+    bool portable = StorageManager::GetInstance().IsPortable();
+
+    if (portable) {
+        PostCommandToPortableRunningDaemon(
+            CMainWindow::PortableAppCommand::kExit);
+    } else {
+        Service::Stop(false);
+    }
+
+    WaitForRunningProcessesToTerminate(timeout);
+
+    // The app is started again even if the update failed, in which case the
+    // staged files are kept for the next attempt.
+    try {
+        UpdatePackage::Apply();
+    } catch (const std::exception& e) {
+        LOG(L"Applying the update failed: %S", e.what());
+    }
+
+    if (portable) {
+        RunAsNewProcess(L"-tray-only");
+    } else {
+        Service::Start();
+    }
+}
+
 void EnableSafeMode() {
     StorageManager::GetInstance()
         .GetAppConfig(L"Settings", true)
         ->SetInt(L"SafeMode", 1);
 }
 
+void SetModsPaused(bool paused) {
+    if (StorageManager::GetInstance().IsPortable()) {
+        PostCommandToPortableRunningDaemon(
+            paused ? CMainWindow::PortableAppCommand::kPauseMods
+                   : CMainWindow::PortableAppCommand::kResumeMods);
+        return;
+    }
+
+    SetNamedEvent(paused ? ServiceCommon::kPauseModsEventName
+                         : ServiceCommon::kResumeModsEventName);
+}
+
+// Writes the matching log lines to the standard output as UTF-8 until the
+// session manager exits or the output is closed. Used by the mod editor, so
+// that it only gets the lines of the mod which is being edited.
+void RunLogOutput(DWORD processId, PCWSTR modName) {
+    HANDLE output = GetStdHandle(STD_OUTPUT_HANDLE);
+    THROW_LAST_ERROR_IF(!output || output == INVALID_HANDLE_VALUE);
+
+    DWORD sessionManagerProcessId = GetSessionManagerProcessId();
+
+    // Might fail for the service, in which case the output only stops once
+    // it's closed.
+    wil::unique_process_handle sessionManagerProcess(
+        OpenProcess(SYNCHRONIZE, FALSE, sessionManagerProcessId));
+
+    LogRingReader reader(sessionManagerProcessId, processId, modName);
+
+    while (true) {
+        if (sessionManagerProcess) {
+            if (WaitForSingleObject(sessionManagerProcess.get(),
+                                    kLogOutputPollIntervalMs) !=
+                WAIT_TIMEOUT) {
+                break;
+            }
+        } else {
+            Sleep(kLogOutputPollIntervalMs);
+        }
+
+        ULONGLONG lostCount;
+        auto lines = reader.Read(&lostCount);
+
+        std::wstring text;
+        if (lostCount > 0) {
+            text += L"[WH] " + std::to_wstring(lostCount) +
+                    L" log lines were lost\n";
+        }
+
+        for (const auto& line : lines) {
+            text += L"[" + std::to_wstring(line.processId) + L"] ";
+            text += line.text;
+        }
+
+        if (text.empty()) {
+            continue;
+        }
+
+        CW2A textUtf8(text.c_str(), CP_UTF8);
+        DWORD written;
+        if (!WriteFile(output, textUtf8.m_psz,
+                       static_cast<DWORD>(strlen(textUtf8.m_psz)), &written,
+                       nullptr)) {
+            // The reader closed the output.
+            break;
+        }
+    }
+}
+
+// Writes the performance stats of the current session as JSON to the output
+// file, or to the standard output if there's none, so that they can be
+// collected by scripts.
+void ExportPerfStats(PCWSTR outputPath) {
+    WriteOutput(outputPath,
+                PerfStatsExport::GetJson(GetSessionManagerProcessId()));
+}
+
+void ExportTargetingDryRun(PCWSTR outputPath) {
+    // The targeting doesn't depend on the session manager, only the load
+    // times do.
+    DWORD sessionManagerProcessId = 0;
+    try {
+        sessionManagerProcessId = GetSessionManagerProcessId();
+    } catch (const std::exception& e) {
+        VERBOSE(L"Not reading the load times: %S", e.what());
+    }
+
+    WriteOutput(outputPath, TargetingDryRun::GetJson(sessionManagerProcessId));
+}
+
+// Writes to the output file if specified, or to the standard output otherwise.
+void WriteOutput(PCWSTR outputPath, const std::string& data) {
+    if (outputPath) {
+        std::ofstream output(outputPath, std::ios::binary);
+        if (!output || !output.write(data.data(), data.size())) {
+            throw std::runtime_error("Failed to write the output file");
+        }
+
+        return;
+    }
+
+    HANDLE output = GetStdHandle(STD_OUTPUT_HANDLE);
+    THROW_LAST_ERROR_IF(!output || output == INVALID_HANDLE_VALUE);
+
+    DWORD written;
+    THROW_IF_WIN32_BOOL_FALSE(WriteFile(output, data.data(),
+                                        static_cast<DWORD>(data.size()),
+                                        &written, nullptr));
+}
+
+DWORD GetSessionManagerProcessId() {
+    if (StorageManager::GetInstance().IsPortable()) {
+        CWindow hDaemonWnd(FindWindow(L"WindhawkDaemon", nullptr));
+        if (!hDaemonWnd) {
+            throw std::runtime_error("Windhawk isn't running");
+        }
+
+        return hDaemonWnd.GetWindowProcessID();
+    }
+
+    wil::unique_handle fileMapping(OpenFileMapping(
+        FILE_MAP_READ, FALSE, ServiceCommon::kInfoFileMappingName));
+    THROW_LAST_ERROR_IF(!fileMapping);
+
+    wil::unique_mapview_ptr<ServiceCommon::ServiceInfo> fileMappingView(
+        reinterpret_cast<ServiceCommon::ServiceInfo*>(
+            MapViewOfFile(fileMapping.get(), FILE_MAP_READ, 0, 0,
+                          sizeof(ServiceCommon::ServiceInfo))));
+    THROW_LAST_ERROR_IF(!fileMappingView);
+
+    return fileMappingView->processId;
+}
+
+std::vector<DWORD> GetProcessIdsFromSnapshot(bool windhawkBgOnly) {
+    std::vector<DWORD> processIds;
+
+    wil::unique_tool_help_snapshot snapshot(
+        CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0));
+    THROW_LAST_ERROR_IF(!snapshot);
+
+    PROCESSENTRY32 pe;
+    pe.dwSize = sizeof(PROCESSENTRY32);
+    THROW_IF_WIN32_BOOL_FALSE(Process32First(snapshot.get(), &pe));
+
+    do {
+        if (pe.th32ProcessID == 0) {
+            // Skipping System Idle Process.
+            continue;
+        }
+
+        // Checked again with the full path, but this way, most processes
+        // don't have to be opened.
+        if (windhawkBgOnly && _wcsicmp(pe.szExeFile, L"windhawk.exe") != 0) {
+            continue;
+        }
+
+        processIds.push_back(pe.th32ProcessID);
+    } while (Process32Next(snapshot.get(), &pe));
+
+    THROW_LAST_ERROR_IF(GetLastError() != ERROR_NO_MORE_FILES);
+
+    return processIds;
+}
+
 void WaitForRunningProcessesToTerminate(DWORD timeout, bool windhawkBgOnly) {
     DWORD startTickCount = GetTickCount();
 
@@ -441,69 +736,73 @@ void WaitForRunningProcessesToTerminate(DWORD timeout, bool windhawkBgOnly) {
         wil::unique_process_handle handles[MAXIMUM_WAIT_OBJECTS];
         DWORD handlesCount = 0;
 
-        wil::unique_tool_help_snapshot snapshot(
-            CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0));
-        THROW_LAST_ERROR_IF(!snapshot);
+        // Usually, only the processes of the job have to be checked. Walking
+        // all processes is only needed if the job doesn't exist, e.g. if the
+        // running processes are of an older version.
+        std::vector<DWORD> processIds;
+        if (auto jobProcessIds = ProcessJob::GetProcessIds()) {
+            processIds = std::move(*jobProcessIds);
+        } else {
+            processIds = GetProcessIdsFromSnapshot(windhawkBgOnly);
+        }
 
-        PROCESSENTRY32 pe;
-        pe.dwSize = sizeof(PROCESSENTRY32);
-        THROW_IF_WIN32_BOOL_FALSE(Process32First(snapshot.get(), &pe));
+        bool allProcessesChecked = true;
 
-        do {
-            if (pe.th32ProcessID == 0) {
-                // Skipping System Idle Process.
-                continue;
+        for (DWORD processId : processIds) {
+            if (handlesCount == _countof(handles)) {
+                allProcessesChecked = false;
+                break;
             }
 
-            if (pe.th32ProcessID == GetCurrentProcessId()) {
+            if (processId == GetCurrentProcessId()) {
                 // Skipping current process.
                 continue;
             }
 
+            wil::unique_process_handle process(
+                OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION | SYNCHRONIZE,
+                            FALSE, processId));
+            if (!process) {
+                VERBOSE(L"OpenProcess for %u failed with error %u", processId,
+                        GetLastError());
+                continue;
+            }
+
+            std::wstring fullProcessImageName;
+            hr = wil::QueryFullProcessImageName<std::wstring>(
+                process.get(), 0, fullProcessImageName);
+            if (FAILED(hr)) {
+                VERBOSE(
+                    L"QueryFullProcessImageName for %u failed with error "
+                    L"0x%08X",
+                    processId, hr);
+                continue;
+            }
+
+            // Is path inside folder:
+            // https://stackoverflow.com/a/40441240
+            if (fullProcessImageName.rfind(folderPath, 0) != 0) {
+                continue;
+            }
+
+            auto fileName =
+                std::filesystem::path(fullProcessImageName).filename();
             if (windhawkBgOnly) {
-                if (_wcsicmp(pe.szExeFile, L"windhawk.exe") != 0) {
+                if (_wcsicmp(fileName.c_str(), L"windhawk.exe") != 0) {
                     continue;
                 }
             } else {
-                if (_wcsicmp(pe.szExeFile, L"uninstall.exe") == 0) {
+                if (_wcsicmp(fileName.c_str(), L"uninstall.exe") == 0) {
                     // Skipping uninstaller, which may be running but is not
                     // part of the app.
                     continue;
                 }
             }
 
-            wil::unique_process_handle process(
-                OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION | SYNCHRONIZE,
-                            FALSE, pe.th32ProcessID));
-            if (process) {
-                std::wstring fullProcessImageName;
-                hr = wil::QueryFullProcessImageName<std::wstring>(
-                    process.get(), 0, fullProcessImageName);
-                if (SUCCEEDED(hr)) {
-                    // Is path inside folder:
-                    // https://stackoverflow.com/a/40441240
-                    if (fullProcessImageName.rfind(folderPath, 0) == 0) {
-                        VERBOSE(L"Waiting for %u (%s)", pe.th32ProcessID,
-                                pe.szExeFile);
-                        handlesRawArray[handlesCount] = process.get();
-                        handles[handlesCount] = std::move(process);
-                        handlesCount++;
-                    }
-                } else {
-                    VERBOSE(
-                        L"QueryFullProcessImageName for %u (%s) failed with "
-                        L"error 0x%08X",
-                        pe.th32ProcessID, pe.szExeFile, hr);
-                }
-            } else {
-                VERBOSE(L"OpenProcess for %u (%s) failed with error %u",
-                        pe.th32ProcessID, pe.szExeFile, GetLastError());
-            }
-        } while (handlesCount < _countof(handles) &&
-                 Process32Next(snapshot.get(), &pe));
-
-        if (handlesCount < _countof(handles)) {
-            THROW_LAST_ERROR_IF(GetLastError() != ERROR_NO_MORE_FILES);
+            VERBOSE(L"Waiting for %u (%s)", processId, fileName.c_str());
+            handlesRawArray[handlesCount] = process.get();
+            handles[handlesCount] = std::move(process);
+            handlesCount++;
         }
 
         if (handlesCount > 0) {
@@ -529,7 +828,7 @@ void WaitForRunningProcessesToTerminate(DWORD timeout, bool windhawkBgOnly) {
             }
         }
 
-        if (handlesCount < _countof(handles)) {
+        if (allProcessesChecked) {
             break;
         }
     }
@@ -565,7 +864,8 @@ bool RunAsAdmin(PCWSTR parameters) {
 }
 
 bool PostCommandToPortableRunningDaemon(
-    CMainWindow::PortableAppCommand command) {
+    CMainWindow::PortableAppCommand command,
+    LPARAM lParam) {
     CWindow hDaemonWnd(FindWindow(L"WindhawkDaemon", nullptr));
     if (!hDaemonWnd) {
         return false;
@@ -574,7 +874,7 @@ bool PostCommandToPortableRunningDaemon(
     ::AllowSetForegroundWindow(hDaemonWnd.GetWindowProcessID());
 
     THROW_IF_WIN32_BOOL_FALSE(hDaemonWnd.PostMessage(
-        CMainWindow::UWM_PORTABLE_APP_COMMAND, (WPARAM)command));
+        CMainWindow::UWM_PORTABLE_APP_COMMAND, (WPARAM)command, lParam));
 
     return true;
 }
@@ -636,4 +936,14 @@ int GetIntParam(PCWSTR param) {
     return 0;
 }
 
+PCWSTR GetStringParam(PCWSTR param) {
+    for (int i = 1; i < __argc - 1; i++) {
+        if (_wcsicmp(__wargv[i], param) == 0) {
+            return __wargv[i + 1];
+        }
+    }
+
+    return nullptr;
+}
+
 }  // namespace
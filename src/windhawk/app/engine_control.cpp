@@ -4,6 +4,14 @@
 
 #include "storage_manager.h"
 
+namespace {
+
+// How long the shutdown waits for the sessions of each stage to end. The
+// engine bounds the unload wait of each process to fit within it.
+constexpr DWORD kShutdownStageTimeout = 5000;
+
+}  // namespace
+
 EngineControl::EngineControl() {
     auto engineLibraryPath =
         StorageManager::GetInstance().GetEnginePath() / L"windhawk.dll";
@@ -25,20 +33,110 @@ EngineControl::EngineControl() {
                            "GlobalHookSessionHandleNewProcesses"));
     THROW_LAST_ERROR_IF_NULL(pGlobalHookSessionHandleNewProcesses);
 
+    pGlobalHookSessionReloadSettings =
+        reinterpret_cast<GLOBAL_HOOK_SESSION_RELOAD_SETTINGS>(GetProcAddress(
+            engineModule.get(), "GlobalHookSessionReloadSettings"));
+    THROW_LAST_ERROR_IF_NULL(pGlobalHookSessionReloadSettings);
+
+    pGlobalHookSessionSetModsPaused =
+        reinterpret_cast<GLOBAL_HOOK_SESSION_SET_MODS_PAUSED>(GetProcAddress(
+            engineModule.get(), "GlobalHookSessionSetModsPaused"));
+    THROW_LAST_ERROR_IF_NULL(pGlobalHookSessionSetModsPaused);
+
+    pGlobalHookSessionShutdown =
+        reinterpret_cast<GLOBAL_HOOK_SESSION_SHUTDOWN>(
+            GetProcAddress(engineModule.get(), "GlobalHookSessionShutdown"));
+    THROW_LAST_ERROR_IF_NULL(pGlobalHookSessionShutdown);
+
     pGlobalHookSessionEnd = reinterpret_cast<GLOBAL_HOOK_SESSION_END>(
         GetProcAddress(engineModule.get(), "GlobalHookSessionEnd"));
     THROW_LAST_ERROR_IF_NULL(pGlobalHookSessionEnd);
 
+    pSymbolPrefetchStart = reinterpret_cast<SYMBOL_PREFETCH_START>(
+        GetProcAddress(engineModule.get(), "SymbolPrefetchStart"));
+    THROW_LAST_ERROR_IF_NULL(pSymbolPrefetchStart);
+
+    pSymbolPrefetchRun = reinterpret_cast<SYMBOL_PREFETCH_RUN>(
+        GetProcAddress(engineModule.get(), "SymbolPrefetchRun"));
+    THROW_LAST_ERROR_IF_NULL(pSymbolPrefetchRun);
+
+    pSymbolPrefetchGetModsChangeEvent =
+        reinterpret_cast<SYMBOL_PREFETCH_GET_MODS_CHANGE_EVENT>(GetProcAddress(
+            engineModule.get(), "SymbolPrefetchGetModsChangeEvent"));
+    THROW_LAST_ERROR_IF_NULL(pSymbolPrefetchGetModsChangeEvent);
+
+    pSymbolPrefetchContinueMonitoring =
+        reinterpret_cast<SYMBOL_PREFETCH_CONTINUE_MONITORING>(GetProcAddress(
+            engineModule.get(), "SymbolPrefetchContinueMonitoring"));
+    THROW_LAST_ERROR_IF_NULL(pSymbolPrefetchContinueMonitoring);
+
+    pSymbolPrefetchEnd = reinterpret_cast<SYMBOL_PREFETCH_END>(
+        GetProcAddress(engineModule.get(), "SymbolPrefetchEnd"));
+    THROW_LAST_ERROR_IF_NULL(pSymbolPrefetchEnd);
+
+    pSymbolBrokerRun = reinterpret_cast<SYMBOL_BROKER_RUN>(
+        GetProcAddress(engineModule.get(), "SymbolBrokerRun"));
+    THROW_LAST_ERROR_IF_NULL(pSymbolBrokerRun);
+
     hGlobalHookSession = pGlobalHookSessionStart();
     if (!hGlobalHookSession) {
         throw std::runtime_error("Failed to start the global hooking session");
     }
+
+    // Symbol prefetching is optional, failing to start it isn't fatal.
+    hSymbolPrefetchSession = pSymbolPrefetchStart();
 }
 
 EngineControl::~EngineControl() {
+    if (hSymbolPrefetchSession) {
+        pSymbolPrefetchEnd(hSymbolPrefetchSession);
+    }
+
     pGlobalHookSessionEnd(hGlobalHookSession);
 }
 
-BOOL EngineControl::HandleNewProcesses() {
-    return pGlobalHookSessionHandleNewProcesses(hGlobalHookSession);
+BOOL EngineControl::HandleNewProcesses(int* injectedCount) {
+    return pGlobalHookSessionHandleNewProcesses(hGlobalHookSession,
+                                                injectedCount);
+}
+
+BOOL EngineControl::ReloadSettings() {
+    return pGlobalHookSessionReloadSettings(hGlobalHookSession);
+}
+
+BOOL EngineControl::SetModsPaused(bool paused) {
+    return pGlobalHookSessionSetModsPaused(hGlobalHookSession, paused);
+}
+
+BOOL EngineControl::Shutdown() {
+    return pGlobalHookSessionShutdown(hGlobalHookSession,
+                                      kShutdownStageTimeout);
+}
+
+BOOL EngineControl::PrefetchSymbols(HANDLE hStopEvent) {
+    if (!hSymbolPrefetchSession) {
+        return FALSE;
+    }
+
+    return pSymbolPrefetchRun(hSymbolPrefetchSession, hStopEvent);
+}
+
+HANDLE EngineControl::GetSymbolPrefetchModsChangeEvent() {
+    if (!hSymbolPrefetchSession) {
+        return nullptr;
+    }
+
+    return pSymbolPrefetchGetModsChangeEvent(hSymbolPrefetchSession);
+}
+
+BOOL EngineControl::ContinueSymbolPrefetchMonitoring() {
+    if (!hSymbolPrefetchSession) {
+        return FALSE;
+    }
+
+    return pSymbolPrefetchContinueMonitoring(hSymbolPrefetchSession);
+}
+
+BOOL EngineControl::RunSymbolBroker(HANDLE hStopEvent) {
+    return pSymbolBrokerRun(hStopEvent);
 }
@@ -10,17 +10,69 @@ class EngineControl {
     EngineControl& operator=(const EngineControl&) = delete;
     EngineControl& operator=(EngineControl&&) = delete;
 
-    BOOL HandleNewProcesses();
+    // If injectedCount isn't null, it's set to the number of new processes
+    // which were injected.
+    BOOL HandleNewProcesses(int* injectedCount = nullptr);
+
+    // Applies the settings which running engines can pick up without a
+    // restart.
+    BOOL ReloadSettings();
+
+    // Disables or enables the hooks of the mods in all processes, without
+    // unloading the mods.
+    BOOL SetModsPaused(bool paused);
+
+    // Unloads the mods of all processes right away, the shell processes last.
+    // Without it, the sessions wait for a while after the app exits, so that
+    // a new instance can take them over, which is what a restart needs. Blocks
+    // until done or until a timeout per stage.
+    BOOL Shutdown();
+
+    // Blocks until done or until the stop event is signaled. Must not be called
+    // concurrently from several threads.
+    BOOL PrefetchSymbols(HANDLE hStopEvent);
+
+    // Signaled when the mod configs change. Returns nullptr if the changes
+    // aren't monitored. ContinueSymbolPrefetchMonitoring must be called after
+    // each change, on the thread which calls PrefetchSymbols.
+    HANDLE GetSymbolPrefetchModsChangeEvent();
+    BOOL ContinueSymbolPrefetchMonitoring();
+
+    // Serves symbol requests from target processes until the stop event is
+    // signaled.
+    BOOL RunSymbolBroker(HANDLE hStopEvent);
 
    private:
     using GLOBAL_HOOK_SESSION_START = HANDLE (*)();
-    using GLOBAL_HOOK_SESSION_HANDLE_NEW_PROCESSES = BOOL (*)(HANDLE hSession);
+    using GLOBAL_HOOK_SESSION_HANDLE_NEW_PROCESSES =
+        BOOL (*)(HANDLE hSession, int* pInjectedCount);
+    using GLOBAL_HOOK_SESSION_RELOAD_SETTINGS = BOOL (*)(HANDLE hSession);
+    using GLOBAL_HOOK_SESSION_SET_MODS_PAUSED = BOOL (*)(HANDLE hSession,
+                                                          BOOL paused);
+    using GLOBAL_HOOK_SESSION_SHUTDOWN = BOOL (*)(HANDLE hSession,
+                                                  DWORD stageTimeout);
     using GLOBAL_HOOK_SESSION_END = BOOL (*)(HANDLE hSession);
+    using SYMBOL_PREFETCH_START = HANDLE (*)();
+    using SYMBOL_PREFETCH_RUN = BOOL (*)(HANDLE hSession, HANDLE hStopEvent);
+    using SYMBOL_PREFETCH_GET_MODS_CHANGE_EVENT = HANDLE (*)(HANDLE hSession);
+    using SYMBOL_PREFETCH_CONTINUE_MONITORING = BOOL (*)(HANDLE hSession);
+    using SYMBOL_PREFETCH_END = BOOL (*)(HANDLE hSession);
+    using SYMBOL_BROKER_RUN = BOOL (*)(HANDLE hStopEvent);
 
     wil::unique_hmodule engineModule;
     GLOBAL_HOOK_SESSION_START pGlobalHookSessionStart;
     GLOBAL_HOOK_SESSION_HANDLE_NEW_PROCESSES
         pGlobalHookSessionHandleNewProcesses;
+    GLOBAL_HOOK_SESSION_RELOAD_SETTINGS pGlobalHookSessionReloadSettings;
+    GLOBAL_HOOK_SESSION_SET_MODS_PAUSED pGlobalHookSessionSetModsPaused;
+    GLOBAL_HOOK_SESSION_SHUTDOWN pGlobalHookSessionShutdown;
     GLOBAL_HOOK_SESSION_END pGlobalHookSessionEnd;
     HANDLE hGlobalHookSession;
+    SYMBOL_PREFETCH_START pSymbolPrefetchStart;
+    SYMBOL_PREFETCH_RUN pSymbolPrefetchRun;
+    SYMBOL_PREFETCH_GET_MODS_CHANGE_EVENT pSymbolPrefetchGetModsChangeEvent;
+    SYMBOL_PREFETCH_CONTINUE_MONITORING pSymbolPrefetchContinueMonitoring;
+    SYMBOL_PREFETCH_END pSymbolPrefetchEnd;
+    HANDLE hSymbolPrefetchSession;
+    SYMBOL_BROKER_RUN pSymbolBrokerRun;
 };
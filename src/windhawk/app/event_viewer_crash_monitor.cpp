@@ -8,27 +8,49 @@
 // https://learn.microsoft.com/en-us/windows/win32/wes/subscribing-to-events#push-subscriptions
 // https://learn.microsoft.com/en-us/windows/win32/wes/rendering-events
 
+namespace {
+
+// The index of the AppPath property in the user data of the event.
+constexpr DWORD kAppPathPropertyIndex = 10;
+
+std::wstring MakeQuery(std::wstring_view targetAppPath) {
+    std::wstring query =
+        L"Event/System[Level=2] and Event/System[EventID=1000]";
+
+    // String comparisons of the event log service are case-insensitive. The
+    // path is also compared when the event is rendered, so it can be left
+    // out of the query if it can't be quoted.
+    if (targetAppPath.find(L'\'') == targetAppPath.npos) {
+        query += L" and Event/EventData[Data[@Name='AppPath']='";
+        query += targetAppPath;
+        query += L"']";
+    }
+
+    return query;
+}
+
+}  // namespace
+
 EventViewerCrashMonitor::EventViewerCrashMonitor(
     std::wstring_view targetAppPath)
     : m_targetAppPath(targetAppPath) {
-    // Get a handle to an event object that the subscription will signal when
-    // events become available that match your query criteria.
-    m_event.reset(CreateEvent(nullptr, TRUE, TRUE, nullptr));
+    m_event.reset(CreateEvent(nullptr, TRUE, FALSE, nullptr));
     THROW_LAST_ERROR_IF_NULL(m_event);
 
+    // Identify the components of the event that you want to render. In this
+    // case, render the user section of the event.
+    m_renderContext.reset(
+        EvtCreateRenderContext(0, nullptr, EvtRenderContextUser));
+    THROW_LAST_ERROR_IF_NULL(m_renderContext);
+
     PCWSTR pwsPath = L"Application";
-    PCWSTR pwsQuery = L"Event/System[Level=2] and Event/System[EventID=1000]";
+    std::wstring query = MakeQuery(m_targetAppPath);
 
     // Subscribe to events.
-    m_subscription.reset(EvtSubscribe(nullptr, m_event.get(), pwsPath, pwsQuery,
-                                      nullptr, nullptr, nullptr,
+    m_subscription.reset(EvtSubscribe(nullptr, nullptr, pwsPath, query.c_str(),
+                                      nullptr, this, SubscriptionCallback,
                                       EvtSubscribeToFutureEvents));
     THROW_LAST_ERROR_IF_NULL(m_subscription);
-
-    LCMapStringEx(
-        LOCALE_NAME_USER_DEFAULT, LCMAP_UPPERCASE, &m_targetAppPath[0],
-        wil::safe_cast<int>(m_targetAppPath.length()), &m_targetAppPath[0],
-        wil::safe_cast<int>(m_targetAppPath.length()), nullptr, nullptr, 0);
 }
 
 HANDLE EventViewerCrashMonitor::GetEventHandle() const {
@@ -36,39 +58,44 @@ HANDLE EventViewerCrashMonitor::GetEventHandle() const {
 }
 
 int EventViewerCrashMonitor::GetAmountOfNewEvents() {
-    int count = 0;
-
-    while (true) {
-        // Get a block of events from the result set.
-        wil::unique_evt_handle eventHandle;
-        DWORD dwReturned;
-        if (!EvtNext(m_subscription.get(), 1, &eventHandle, INFINITE, 0,
-                     &dwReturned)) {
-            THROW_LAST_ERROR_IF(GetLastError() != ERROR_NO_MORE_ITEMS);
+    // Reset before taking the count, so that a crash which is counted in the
+    // meantime signals the event again.
+    ResetEvent(m_event.get());
+
+    return m_newEventCount.exchange(0);
+}
+
+// static
+DWORD WINAPI EventViewerCrashMonitor::SubscriptionCallback(
+    EVT_SUBSCRIBE_NOTIFY_ACTION action,
+    PVOID userContext,
+    EVT_HANDLE eventHandle) {
+    auto* monitor = static_cast<EventViewerCrashMonitor*>(userContext);
+
+    switch (action) {
+        case EvtSubscribeActionError:
+            // The event handle is the error code in this case.
+            LOG(L"Subscription error %u",
+                static_cast<DWORD>(reinterpret_cast<UINT_PTR>(eventHandle)));
             break;
-        }
 
-        try {
-            if (DoesEventMatch(eventHandle.get())) {
-                count++;
+        case EvtSubscribeActionDeliver:
+            try {
+                if (monitor->DoesEventMatch(eventHandle)) {
+                    monitor->m_newEventCount++;
+                    SetEvent(monitor->m_event.get());
+                }
+            } catch (const std::exception& e) {
+                LOG(L"%S", e.what());
             }
-        } catch (const std::exception& e) {
-            LOG(L"%S", e.what());
-        }
+            break;
     }
 
-    ResetEvent(m_event.get());
-
-    return count;
+    // The return value is ignored.
+    return ERROR_SUCCESS;
 }
 
 bool EventViewerCrashMonitor::DoesEventMatch(EVT_HANDLE eventHandle) {
-    // Identify the components of the event that you want to render. In this
-    // case, render the user section of the event.
-    wil::unique_evt_handle context(
-        EvtCreateRenderContext(0, nullptr, EvtRenderContextUser));
-    THROW_LAST_ERROR_IF_NULL(context);
-
     // When you render the user data or system section of the event, you must
     // specify the EvtRenderEventValues flag. The function returns an array of
     // variant values for each element in the user data or system section of the
@@ -76,42 +103,40 @@ bool EventViewerCrashMonitor::DoesEventMatch(EVT_HANDLE eventHandle) {
     // order as the elements are defined in the event. For system data, the
     // values are returned in the order defined in the EVT_SYSTEM_PROPERTY_ID
     // enumeration.
-    DWORD dwBufferSize = 0;
+    //
+    // The buffer is kept between events, so that it's usually large enough.
     DWORD dwBufferUsed = 0;
     DWORD dwPropertyCount = 0;
 
-    if (EvtRender(context.get(), eventHandle, EvtRenderEventValues,
-                  dwBufferSize, nullptr, &dwBufferUsed, &dwPropertyCount)) {
-        throw std::logic_error("Unexpected result from EvtRender");
-    }
-
-    THROW_LAST_ERROR_IF(GetLastError() != ERROR_INSUFFICIENT_BUFFER);
+    if (!EvtRender(m_renderContext.get(), eventHandle, EvtRenderEventValues,
+                   static_cast<DWORD>(m_renderBuffer.size()),
+                   m_renderBuffer.data(), &dwBufferUsed, &dwPropertyCount)) {
+        THROW_LAST_ERROR_IF(GetLastError() != ERROR_INSUFFICIENT_BUFFER);
 
-    dwBufferSize = dwBufferUsed;
-    auto renderedValuesBuffer = std::make_unique<BYTE[]>(dwBufferSize);
-    THROW_IF_WIN32_BOOL_FALSE(EvtRender(
-        context.get(), eventHandle, EvtRenderEventValues, dwBufferSize,
-        renderedValuesBuffer.get(), &dwBufferUsed, &dwPropertyCount));
+        m_renderBuffer.resize(dwBufferUsed);
+        THROW_IF_WIN32_BOOL_FALSE(EvtRender(
+            m_renderContext.get(), eventHandle, EvtRenderEventValues,
+            static_cast<DWORD>(m_renderBuffer.size()), m_renderBuffer.data(),
+            &dwBufferUsed, &dwPropertyCount));
+    }
 
-    if (dwPropertyCount < 11) {
+    if (dwPropertyCount <= kAppPathPropertyIndex) {
         LOG(L"Not enough property values (%u)", dwPropertyCount);
         return false;
     }
 
     auto renderedValues =
-        reinterpret_cast<const EVT_VARIANT*>(renderedValuesBuffer.get());
+        reinterpret_cast<const EVT_VARIANT*>(m_renderBuffer.data());
 
-    if (renderedValues[10].Type != EvtVarTypeString) {
-        LOG(L"Unexpected property value type (%u)", renderedValues[10].Type);
+    const EVT_VARIANT& appPath = renderedValues[kAppPathPropertyIndex];
+    if (appPath.Type != EvtVarTypeString) {
+        LOG(L"Unexpected property value type (%u)", appPath.Type);
         return false;
     }
 
-    std::wstring appPath{renderedValues[10].StringVal};
-    LCMapStringEx(LOCALE_NAME_USER_DEFAULT, LCMAP_UPPERCASE, &appPath[0],
-                  wil::safe_cast<int>(appPath.length()), &appPath[0],
-                  wil::safe_cast<int>(appPath.length()), nullptr, nullptr, 0);
-
-    if (appPath != m_targetAppPath) {
+    if (CompareStringOrdinal(appPath.StringVal, -1, m_targetAppPath.c_str(),
+                             wil::safe_cast<int>(m_targetAppPath.length()),
+                             TRUE) != CSTR_EQUAL) {
         return false;
     }
 
@@ -1,18 +1,35 @@
 #pragma once
 
+// Counts the crashes of the target app which are reported to the Application
+// event log. The events are narrowed down by the event log service with the
+// subscription query, and the remaining ones are checked by the callback of a
+// push subscription, which runs on a thread of the event log API, so that the
+// thread which waits for the event handle doesn't render events.
 class EventViewerCrashMonitor {
    public:
     EventViewerCrashMonitor(std::wstring_view targetAppPath);
 
+    // Signaled when new crashes were counted.
     HANDLE GetEventHandle() const;
     int GetAmountOfNewEvents();
 
    private:
+    static DWORD WINAPI
+    SubscriptionCallback(EVT_SUBSCRIBE_NOTIFY_ACTION action,
+                         PVOID userContext,
+                         EVT_HANDLE eventHandle);
     bool DoesEventMatch(EVT_HANDLE eventHandle);
 
     std::wstring m_targetAppPath;
     wil::unique_event m_event;
-    wil::unique_evt_handle m_subscription;
+    std::atomic<int> m_newEventCount = 0;
+    // Only used by the callback, the callbacks of a subscription don't run
+    // concurrently.
+    wil::unique_evt_handle m_renderContext;
+    std::vector<BYTE> m_renderBuffer;
     DWORD m_lastProcessId = 0;
     DWORD64 m_lastProcessCreationTime = 0;
+    // Declared last, so that the callbacks are done before the rest is
+    // destroyed.
+    wil::unique_evt_handle m_subscription;
 };
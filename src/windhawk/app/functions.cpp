@@ -111,6 +111,69 @@ NTSTATUS NtPowerInformation(_In_ POWER_INFORMATION_LEVEL InformationLevel,
                                OutputBuffer, OutputBufferLength);
 }
 
+// https://github.com/winsiderss/systeminformer/blob/044957137e1d7200431926130ea7cd6bf9d8a11f/phnt/include/ntexapi.h
+typedef struct _MY_SYSTEM_THREAD_INFORMATION {
+    LARGE_INTEGER KernelTime;
+    LARGE_INTEGER UserTime;
+    LARGE_INTEGER CreateTime;
+    ULONG WaitTime;
+    PVOID StartAddress;
+    HANDLE ClientId[2];
+    LONG Priority;
+    LONG BasePriority;
+    ULONG ContextSwitches;
+    ULONG ThreadState;
+    ULONG WaitReason;
+} MY_SYSTEM_THREAD_INFORMATION;
+
+// Followed by an array of MY_SYSTEM_THREAD_INFORMATION.
+typedef struct _MY_SYSTEM_PROCESS_INFORMATION {
+    ULONG NextEntryOffset;
+    ULONG NumberOfThreads;
+    LARGE_INTEGER WorkingSetPrivateSize;
+    ULONG HardFaultCount;
+    ULONG NumberOfThreadsHighWatermark;
+    ULONGLONG CycleTime;
+    LARGE_INTEGER CreateTime;
+    LARGE_INTEGER UserTime;
+    LARGE_INTEGER KernelTime;
+    UNICODE_STRING ImageName;
+    LONG BasePriority;
+    HANDLE UniqueProcessId;
+    HANDLE InheritedFromUniqueProcessId;
+    ULONG HandleCount;
+    ULONG SessionId;
+    ULONG_PTR UniqueProcessKey;
+    SIZE_T PeakVirtualSize;
+    SIZE_T VirtualSize;
+    ULONG PageFaultCount;
+    SIZE_T PeakWorkingSetSize;
+    SIZE_T WorkingSetSize;
+    SIZE_T QuotaPeakPagedPoolUsage;
+    SIZE_T QuotaPagedPoolUsage;
+    SIZE_T QuotaPeakNonPagedPoolUsage;
+    SIZE_T QuotaNonPagedPoolUsage;
+    SIZE_T PagefileUsage;
+    SIZE_T PeakPagefileUsage;
+    SIZE_T PrivatePageCount;
+    LARGE_INTEGER ReadOperationCount;
+    LARGE_INTEGER WriteOperationCount;
+    LARGE_INTEGER OtherOperationCount;
+    LARGE_INTEGER ReadTransferCount;
+    LARGE_INTEGER WriteTransferCount;
+    LARGE_INTEGER OtherTransferCount;
+} MY_SYSTEM_PROCESS_INFORMATION;
+
+constexpr ULONG MY_SystemProcessInformation = 5;
+constexpr NTSTATUS MY_STATUS_INFO_LENGTH_MISMATCH = 0xC0000004;
+constexpr ULONG MY_ThreadStateWaiting = 5;
+constexpr ULONG MY_WaitReasonSuspended = 5;
+
+bool IsThreadSuspended(const MY_SYSTEM_THREAD_INFORMATION& thread) {
+    return thread.ThreadState == MY_ThreadStateWaiting &&
+           thread.WaitReason == MY_WaitReasonSuspended;
+}
+
 }  // namespace
 
 // SetPrivilege enables/disables process token privilege.
@@ -238,35 +301,35 @@ std::wstring ReplaceAll(std::wstring_view source,
                         std::wstring_view from,
                         std::wstring_view to,
                         bool ignoreCase) {
-    auto findString = [ignoreCase](std::wstring_view haystack,
-                                   std::wstring_view needle,
-                                   size_t pos) -> size_t {
-        if (!ignoreCase) {
-            return haystack.find(needle, pos);
-        }
-
-        auto it = std::search(
-            haystack.begin() + pos, haystack.end(), needle.begin(),
-            needle.end(), [](WCHAR ch1, WCHAR ch2) {
-                LCMapStringEx(LOCALE_NAME_USER_DEFAULT, LCMAP_UPPERCASE, &ch1,
-                              1, &ch1, 1, nullptr, nullptr, 0);
-                LCMapStringEx(LOCALE_NAME_USER_DEFAULT, LCMAP_UPPERCASE, &ch2,
-                              1, &ch2, 1, nullptr, nullptr, 0);
-                return ch1 == ch2;
-            });
-        if (it == haystack.end()) {
-            return haystack.npos;
-        }
+    // For a case-insensitive search, the strings are uppercased once, and the
+    // positions found in the uppercased source are used for the original one,
+    // since LCMAP_UPPERCASE maps each character to a single character.
+    std::wstring sourceUpper;
+    std::wstring fromUpper;
+    std::wstring_view haystack = source;
+    std::wstring_view needle = from;
+    if (ignoreCase) {
+        auto toUpper = [](std::wstring_view str) {
+            std::wstring result(str);
+            LCMapStringEx(LOCALE_NAME_USER_DEFAULT, LCMAP_UPPERCASE, &result[0],
+                          wil::safe_cast<int>(result.length()), &result[0],
+                          wil::safe_cast<int>(result.length()), nullptr,
+                          nullptr, 0);
+            return result;
+        };
 
-        return std::distance(haystack.begin(), it);
-    };
+        sourceUpper = toUpper(source);
+        fromUpper = toUpper(from);
+        haystack = sourceUpper;
+        needle = fromUpper;
+    }
 
     std::wstring newString;
 
     size_t lastPos = 0;
     size_t findPos;
 
-    while ((findPos = findString(source, from, lastPos)) != source.npos) {
+    while ((findPos = haystack.find(needle, lastPos)) != haystack.npos) {
         newString.append(source, lastPos, findPos - lastPos);
         newString += to;
         lastPos = findPos + from.length();
@@ -347,64 +410,66 @@ HRESULT SetThreadDescriptionIfAvailable(HANDLE hThread,
     return pSetThreadDescription(hThread, lpThreadDescription);
 }
 
-bool IsProcessFrozen(HANDLE hProcess) {
-    // https://github.com/winsiderss/systeminformer/blob/044957137e1d7200431926130ea7cd6bf9d8a11f/phnt/include/ntpsapi.h#L303-L334
-    typedef struct _PROCESS_BASIC_INFORMATION {
-        NTSTATUS ExitStatus;
-        /*PPEB*/ LPVOID PebBaseAddress;
-        ULONG_PTR AffinityMask;
-        /*KPRIORITY*/ LONG BasePriority;
-        HANDLE UniqueProcessId;
-        HANDLE InheritedFromUniqueProcessId;
-    } PROCESS_BASIC_INFORMATION, *PPROCESS_BASIC_INFORMATION;
-
-    typedef struct _PROCESS_EXTENDED_BASIC_INFORMATION {
-        SIZE_T Size;  // set to sizeof structure on input
-        PROCESS_BASIC_INFORMATION BasicInfo;
-        union {
-            ULONG Flags;
-            struct {
-                ULONG IsProtectedProcess : 1;
-                ULONG IsWow64Process : 1;
-                ULONG IsProcessDeleting : 1;
-                ULONG IsCrossSessionCreate : 1;
-                ULONG IsFrozen : 1;
-                ULONG IsBackground : 1;
-                ULONG IsStronglyNamed : 1;
-                ULONG IsSecureProcess : 1;
-                ULONG IsSubsystemProcess : 1;
-                ULONG SpareBits : 23;
-            };
-        };
-    } PROCESS_EXTENDED_BASIC_INFORMATION, *PPROCESS_EXTENDED_BASIC_INFORMATION;
-
-    using NtQueryInformationProcess_t = NTSTATUS(WINAPI*)(
-        _In_ HANDLE ProcessHandle,
-        _In_ /*PROCESSINFOCLASS*/ DWORD ProcessInformationClass,
-        _Out_writes_bytes_(ProcessInformationLength) PVOID ProcessInformation,
-        _In_ ULONG ProcessInformationLength, _Out_opt_ PULONG ReturnLength);
-    static NtQueryInformationProcess_t pNtQueryInformationProcess = []() {
-        HMODULE hNtdll = LoadLibrary(L"ntdll.dll");
+std::vector<DWORD> GetFrozenProcessIds() {
+    using NtQuerySystemInformation_t = NTSTATUS(WINAPI*)(
+        _In_ ULONG SystemInformationClass, _Out_ PVOID SystemInformation,
+        _In_ ULONG SystemInformationLength, _Out_opt_ PULONG ReturnLength);
+    static NtQuerySystemInformation_t pNtQuerySystemInformation = []() {
+        HMODULE hNtdll = GetModuleHandle(L"ntdll.dll");
         if (hNtdll) {
-            return (NtQueryInformationProcess_t)GetProcAddress(
-                hNtdll, "NtQueryInformationProcess");
+            return (NtQuerySystemInformation_t)GetProcAddress(
+                hNtdll, "NtQuerySystemInformation");
         }
 
-        return (NtQueryInformationProcess_t) nullptr;
+        return (NtQuerySystemInformation_t) nullptr;
     }();
 
-    if (!pNtQueryInformationProcess) {
-        return false;
+    if (!pNtQuerySystemInformation) {
+        throw std::runtime_error("NtQuerySystemInformation not found");
+    }
+
+    std::vector<BYTE> buffer(0x40000);
+    while (true) {
+        ULONG returnLength = 0;
+        NTSTATUS status = pNtQuerySystemInformation(
+            MY_SystemProcessInformation, buffer.data(),
+            static_cast<ULONG>(buffer.size()), &returnLength);
+        if (status != MY_STATUS_INFO_LENGTH_MISMATCH) {
+            THROW_IF_NTSTATUS_FAILED(status);
+            break;
+        }
+
+        // Leave room for processes created in the meantime.
+        buffer.resize(std::max(buffer.size() * 2,
+                               static_cast<size_t>(returnLength) + 0x10000));
     }
 
-    PROCESS_EXTENDED_BASIC_INFORMATION pebi;
-    if (0 <= pNtQueryInformationProcess(hProcess, /*ProcessBasicInformation*/ 0,
-                                        &pebi, sizeof(pebi), 0) &&
-        pebi.Size >= sizeof(pebi)) {
-        return pebi.IsFrozen != 0;
+    std::vector<DWORD> processIds;
+
+    for (size_t offset = 0;;) {
+        auto* entry = reinterpret_cast<const MY_SYSTEM_PROCESS_INFORMATION*>(
+            buffer.data() + offset);
+        auto* threads =
+            reinterpret_cast<const MY_SYSTEM_THREAD_INFORMATION*>(entry + 1);
+
+        bool allThreadsSuspended =
+            entry->NumberOfThreads > 0 &&
+            std::all_of(threads, threads + entry->NumberOfThreads,
+                        IsThreadSuspended);
+        if (allThreadsSuspended) {
+            processIds.push_back(static_cast<DWORD>(
+                reinterpret_cast<ULONG_PTR>(entry->UniqueProcessId)));
+        }
+
+        if (!entry->NextEntryOffset) {
+            break;
+        }
+
+        offset += entry->NextEntryOffset;
     }
 
-    return false;
+    std::sort(processIds.begin(), processIds.end());
+    return processIds;
 }
 
 void GetNtVersionNumbers(ULONG* pNtMajorVersion,
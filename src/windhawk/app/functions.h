@@ -21,9 +21,9 @@ int GetSystemMetricsForWindow(HWND hWnd, int nIndex);
 HRESULT SetThreadDescriptionIfAvailable(HANDLE hThread,
                                         PCWSTR lpThreadDescription);
 
-// Returns true for suspended UWP processes.
-// https://stackoverflow.com/a/50173965
-bool IsProcessFrozen(HANDLE hProcess);
+// Returns the sorted IDs of the processes whose threads are all suspended,
+// such as suspended UWP processes, with a single system call.
+std::vector<DWORD> GetFrozenProcessIds();
 
 void GetNtVersionNumbers(ULONG* pNtMajorVersion,
                          ULONG* pNtMinorVersion,
@@ -0,0 +1,83 @@
+#include "stdafx.h"
+
+#include "log_file_decoder.h"
+#include "log_file_format.h"
+
+namespace {
+
+// Much longer than any line which is written, a longer length means that the
+// file is corrupted.
+constexpr DWORD kMaxTextLength = 64 * 1024;
+
+std::string FormatRecordPrefix(const LogFileFormat::RecordHeader& header) {
+    FILETIME fileTime = wil::filetime::from_int64(header.timestamp);
+    FILETIME localFileTime;
+    SYSTEMTIME time{};
+    if (FileTimeToLocalFileTime(&fileTime, &localFileTime)) {
+        FileTimeToSystemTime(&localFileTime, &time);
+    }
+
+    char prefix[64];
+    sprintf_s(prefix, "%04u-%02u-%02u %02u:%02u:%02u.%03u %5u %5u ",
+              time.wYear, time.wMonth, time.wDay, time.wHour, time.wMinute,
+              time.wSecond, time.wMilliseconds, header.processId,
+              header.threadId);
+    return prefix;
+}
+
+}  // namespace
+
+namespace LogFileDecoder {
+
+void Decode(const std::filesystem::path& inputPath,
+            const std::filesystem::path& outputPath) {
+    std::ifstream input(inputPath, std::ios::binary);
+    if (!input) {
+        throw std::runtime_error("Failed to open the log file");
+    }
+
+    LogFileFormat::FileHeader fileHeader;
+    if (!input.read(reinterpret_cast<char*>(&fileHeader),
+                    sizeof(fileHeader)) ||
+        fileHeader.magic != LogFileFormat::kMagic) {
+        throw std::runtime_error("Not a log file");
+    }
+
+    if (fileHeader.version != LogFileFormat::kVersion) {
+        throw std::runtime_error("Unsupported log file version");
+    }
+
+    std::ofstream output(outputPath, std::ios::binary);
+    if (!output) {
+        throw std::runtime_error("Failed to create the output file");
+    }
+
+    LogFileFormat::RecordHeader header;
+    std::wstring text;
+    while (input.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        if (header.textLength > kMaxTextLength) {
+            throw std::runtime_error("The log file is corrupted");
+        }
+
+        text.resize(header.textLength);
+        if (!input.read(reinterpret_cast<char*>(text.data()),
+                        text.size() * sizeof(WCHAR))) {
+            break;
+        }
+
+        // The lines usually end with a newline, but not always.
+        while (!text.empty() &&
+               (text.back() == L'\n' || text.back() == L'\r')) {
+            text.pop_back();
+        }
+
+        output << FormatRecordPrefix(header)
+               << CW2A(text.c_str(), CP_UTF8).m_psz << '\n';
+    }
+
+    if (!output) {
+        throw std::runtime_error("Failed to write the output file");
+    }
+}
+
+}  // namespace LogFileDecoder
@@ -0,0 +1,11 @@
+#pragma once
+
+// Converts a log file which was written by the session manager, see
+// LogFileFormat, to UTF-8 text with a line for each record, prefixed with its
+// local time, process id and thread id. An incomplete last record is ignored.
+namespace LogFileDecoder {
+
+void Decode(const std::filesystem::path& inputPath,
+            const std::filesystem::path& outputPath);
+
+}  // namespace LogFileDecoder
@@ -0,0 +1,68 @@
+#include "stdafx.h"
+
+#include "log_ring_reader.h"
+
+#include "storage_manager.h"
+
+LogRingReader::LogRingReader(DWORD sessionManagerProcessId,
+                             DWORD processId,
+                             PCWSTR modName) {
+    auto engineLibraryPath =
+        StorageManager::GetInstance().GetEnginePath() / L"windhawk.dll";
+
+    engineModule.reset(LoadLibrary(engineLibraryPath.c_str()));
+    THROW_LAST_ERROR_IF_NULL(engineModule);
+
+    auto pLogRingReaderOpen = reinterpret_cast<LOG_RING_READER_OPEN>(
+        GetProcAddress(engineModule.get(), "LogRingReaderOpen"));
+    THROW_LAST_ERROR_IF_NULL(pLogRingReaderOpen);
+
+    pLogRingReaderRead = reinterpret_cast<LOG_RING_READER_READ>(
+        GetProcAddress(engineModule.get(), "LogRingReaderRead"));
+    THROW_LAST_ERROR_IF_NULL(pLogRingReaderRead);
+
+    pLogRingReaderClose = reinterpret_cast<LOG_RING_READER_CLOSE>(
+        GetProcAddress(engineModule.get(), "LogRingReaderClose"));
+    THROW_LAST_ERROR_IF_NULL(pLogRingReaderClose);
+
+    hReader = pLogRingReaderOpen(sessionManagerProcessId, processId, modName);
+    if (!hReader) {
+        throw std::runtime_error("Failed to open the log ring");
+    }
+}
+
+LogRingReader::~LogRingReader() {
+    pLogRingReaderClose(hReader);
+}
+
+std::vector<LogRingReader::Line> LogRingReader::Read(ULONGLONG* lostCount) {
+    struct ReadContext {
+        std::vector<Line> lines;
+        bool failed = false;
+    };
+
+    ReadContext readContext;
+
+    // Exceptions must not propagate through the engine library.
+    auto callback = [](void* context, ULONGLONG timestamp, DWORD processId,
+                       DWORD threadId, PCWSTR text) {
+        auto* readContext = static_cast<ReadContext*>(context);
+        try {
+            readContext->lines.push_back({
+                .timestamp = timestamp,
+                .processId = processId,
+                .threadId = threadId,
+                .text = text,
+            });
+        } catch (const std::exception&) {
+            readContext->failed = true;
+        }
+    };
+
+    if (!pLogRingReaderRead(hReader, callback, &readContext, lostCount) ||
+        readContext.failed) {
+        throw std::runtime_error("Failed to read the log ring");
+    }
+
+    return std::move(readContext.lines);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+// Reads the log lines which the engines append to the log ring of the session
+// manager, using the engine library. Lines which don't match the filter are
+// skipped by the engine before being formatted.
+class LogRingReader {
+   public:
+    struct Line {
+        // As a FILETIME value.
+        ULONGLONG timestamp;
+        DWORD processId;
+        DWORD threadId;
+        std::wstring text;
+    };
+
+    // A zero process ID matches all processes, and an empty mod name matches
+    // all lines, including the lines of the engine.
+    LogRingReader(DWORD sessionManagerProcessId,
+                  DWORD processId,
+                  PCWSTR modName);
+    ~LogRingReader();
+
+    LogRingReader(const LogRingReader&) = delete;
+    LogRingReader(LogRingReader&&) = delete;
+    LogRingReader& operator=(const LogRingReader&) = delete;
+    LogRingReader& operator=(LogRingReader&&) = delete;
+
+    // Returns the lines which were appended since the last call, or since
+    // construction. lostCount is set to the number of lines which were lost
+    // since the reader fell behind.
+    std::vector<Line> Read(ULONGLONG* lostCount);
+
+   private:
+    using LOG_RING_READ_CALLBACK = void (*)(void* context,
+                                            ULONGLONG timestamp,
+                                            DWORD processId,
+                                            DWORD threadId,
+                                            PCWSTR text);
+    using LOG_RING_READER_OPEN = HANDLE (*)(DWORD dwSessionManagerProcessId,
+                                            DWORD dwProcessId,
+                                            PCWSTR pszModName);
+    using LOG_RING_READER_READ = BOOL (*)(HANDLE hReader,
+                                          LOG_RING_READ_CALLBACK callback,
+                                          void* context,
+                                          ULONGLONG* pLostCount);
+    using LOG_RING_READER_CLOSE = BOOL (*)(HANDLE hReader);
+
+    wil::unique_hmodule engineModule;
+    LOG_RING_READER_READ pLogRingReaderRead;
+    LOG_RING_READER_CLOSE pLogRingReaderClose;
+    HANDLE hReader;
+};
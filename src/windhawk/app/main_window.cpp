@@ -10,11 +10,25 @@
 
 namespace {
 
-constexpr auto kHandleNewProcessInterval = 1000;       // 1sec
-constexpr auto kUpdateInitialDelay = 1000 * 10;        // 10sec
-constexpr auto kUpdateInterval = 1000 * 60 * 60 * 24;  // 24h
-constexpr auto kUpdateRetryTime = 1000 * 60 * 60;      // 1h
-constexpr auto kModTasksDlgInitialDelay = 1000;        // 1sec
+constexpr auto kUpdateInitialDelay = 1000 * 10;           // 10sec
+constexpr auto kUpdateOverdueJitter = 1000 * 60 * 10;     // 10min
+constexpr auto kUpdateInterval = 1000 * 60 * 60 * 24;     // 24h
+constexpr auto kUpdateIntervalJitter = 1000 * 60 * 60;    // 1h
+constexpr auto kUpdateRetryTime = 1000 * 60 * 60;         // 1h
+constexpr auto kUpdateMaxRetryTime = 1000 * 60 * 60 * 8;  // 8h
+constexpr auto kModTasksDlgInitialDelay = 1000;           // 1sec
+constexpr auto kUIPrewarmDelay = 1000 * 60 * 2;           // 2min
+
+// Spreads the update checks of different machines over time, so that they
+// don't reach the server together, e.g. after a network outage.
+UINT AddUpdateJitter(ULONGLONG delay, UINT maxJitter) {
+    static std::mt19937 generator{std::random_device{}()};
+    std::uniform_int_distribution<UINT> distribution(0, maxJitter);
+
+    return static_cast<UINT>(
+        std::min(delay + distribution(generator),
+                 static_cast<ULONGLONG>(kUpdateInterval + maxJitter)));
+}
 
 ULONGLONG GetTaskbarProcessCreationTime() {
     HWND currentTaskbarWindow = FindWindow(L"Shell_TrayWnd", nullptr);
@@ -48,9 +62,10 @@ ULONGLONG GetTaskbarProcessCreationTime() {
 
 }  // namespace
 
-CMainWindow::CMainWindow(bool trayOnly, bool portable)
+CMainWindow::CMainWindow(bool trayOnly, bool portable, bool showToolkit)
     : m_trayOnly(trayOnly),
       m_portable(portable),
+      m_showToolkit(showToolkit),
       m_taskbarCreatedMsg(RegisterWindowMessage(L"TaskbarCreated")) {}
 
 BOOL CMainWindow::PreTranslateMessage(MSG* pMsg) {
@@ -70,138 +85,17 @@ BOOL CMainWindow::PreTranslateMessage(MSG* pMsg) {
 }
 
 BOOL CMainWindow::OnIdle() {
-    enum {
-        kServiceMutex,
-        kAppSettingsChanged,
-        kNewUpdatesFound,
-        kModTasksChanged,
-        kModStatusesChanged,
-        kExplorerCrashed,
-        kMaxHandles,
-    };
-
-    HANDLE handleArray[kMaxHandles];
-    int handleTypes[kMaxHandles];
-    DWORD handleCount = 0;
+    UpdateHandleWaits();
 
+    // The service mutex is waited for here rather than with a threadpool wait,
+    // since a mutex is owned by the thread which waits for it.
     if (m_serviceMutex) {
-        handleArray[handleCount] = m_serviceMutex.get();
-        handleTypes[handleCount] = kServiceMutex;
-        handleCount++;
-    }
-
-    if (m_appSettingsChangedEvent) {
-        handleArray[handleCount] = m_appSettingsChangedEvent.get();
-        handleTypes[handleCount] = kAppSettingsChanged;
-        handleCount++;
-    }
-
-    if (m_newUpdatesFoundEvent) {
-        handleArray[handleCount] = m_newUpdatesFoundEvent.get();
-        handleTypes[handleCount] = kNewUpdatesFound;
-        handleCount++;
-    }
-
-    if (m_modTasksChangeNotification) {
-        handleArray[handleCount] = m_modTasksChangeNotification->GetHandle();
-        handleTypes[handleCount] = kModTasksChanged;
-        handleCount++;
-    }
-
-    if (m_modStatusesChangeNotification) {
-        handleArray[handleCount] = m_modStatusesChangeNotification->GetHandle();
-        handleTypes[handleCount] = kModStatusesChanged;
-        handleCount++;
-    }
-
-    if (m_explorerCrashMonitor) {
-        handleArray[handleCount] = m_explorerCrashMonitor->GetEventHandle();
-        handleTypes[handleCount] = kExplorerCrashed;
-        handleCount++;
-    }
-
-    if (handleCount > 0) {
-        DWORD nWaitResult =
-            MsgWaitForMultipleObjectsEx(handleCount, handleArray, INFINITE,
-                                        QS_ALLINPUT, MWMO_INPUTAVAILABLE);
-
-        if (nWaitResult >= WAIT_OBJECT_0 &&
-            nWaitResult < WAIT_OBJECT_0 + handleCount) {
-            switch (handleTypes[nWaitResult - WAIT_OBJECT_0]) {
-                case kServiceMutex:
-                    ::ReleaseMutex(m_serviceMutex.get());
-                    Exit();
-                    break;
-
-                case kAppSettingsChanged:
-                    LoadSettings();
-                    break;
-
-                case kNewUpdatesFound:
-                    if (!m_disableUpdateCheck) {
-                        NotifyAboutAvailableUpdates(
-                            UserProfile::GetUpdateStatus(), true);
-                    }
-                    break;
-
-                case kModTasksChanged:
-                    if (m_modTasksDlg) {
-                        m_modTasksDlg->DataChanged();
-
-                        try {
-                            m_modTasksChangeNotification->ContinueMonitoring();
-                        } catch (const std::exception& e) {
-                            LOG(L"Tasks ContinueMonitoring failed: %S",
-                                e.what());
-                            m_modTasksChangeNotification.reset();
-                        }
-                    } else {
-                        // In the common case, there's a short-lived event, such
-                        // as mod initialization, that is cleared right away.
-                        // Wait a bit before creating a dialog, and only create
-                        // it if events still exist.
-                        m_modTasksChangeNotification.reset();
-                        SetTimer(Timer::kModTasksDlgCreate,
-                                 kModTasksDlgInitialDelay);
-                    }
-                    break;
-
-                case kModStatusesChanged:
-                    if (m_modStatusesDlg) {
-                        m_modStatusesDlg->DataChanged();
-                    }
-
-                    try {
-                        m_modStatusesChangeNotification->ContinueMonitoring();
-                    } catch (const std::exception& e) {
-                        LOG(L"Statuses ContinueMonitoring failed: %S",
-                            e.what());
-                        m_modStatusesChangeNotification.reset();
-                    }
-                    break;
-
-                case kExplorerCrashed: {
-                    int explorerCrashCount = 0;
-                    try {
-                        explorerCrashCount =
-                            m_explorerCrashMonitor->GetAmountOfNewEvents();
-                    } catch (const std::exception& e) {
-                        LOG(L"Explorer crash monitor failed: %S", e.what());
-                        m_explorerCrashMonitor.reset();
-                        break;
-                    }
-
-                    if (explorerCrashCount > 0) {
-                        try {
-                            HandleExplorerCrash(explorerCrashCount);
-                        } catch (const std::exception& e) {
-                            LOG(L"Explorer crash handling failed: %S",
-                                e.what());
-                        }
-                    }
-                    break;
-                }
-            }
+        HANDLE serviceMutex = m_serviceMutex.get();
+        DWORD nWaitResult = MsgWaitForMultipleObjectsEx(
+            1, &serviceMutex, INFINITE, QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+        if (nWaitResult == WAIT_OBJECT_0) {
+            ::ReleaseMutex(m_serviceMutex.get());
+            Exit();
         }
     } else {
         // Just wait for a message to avoid running an infinite loop.
@@ -237,7 +131,8 @@ int CMainWindow::OnCreate(LPCREATESTRUCT lpCreateStruct) {
     LoadSettings();
 
     try {
-        m_modTasksChangeNotification.emplace(L"mod-task");
+        m_modTasksChangeNotification.emplace(
+            m_serviceInfo.processId, ModStatusReader::Kind::kTask);
     } catch (const std::exception& e) {
         LOG(L"Tasks ChangeNotification failed: %S", e.what());
     }
@@ -255,6 +150,10 @@ int CMainWindow::OnCreate(LPCREATESTRUCT lpCreateStruct) {
         RunUI();
     }
 
+    if (m_showToolkit) {
+        ShowToolkitDialog(/*triggeredBySystemInstability=*/true);
+    }
+
     return 0;
 }
 
@@ -268,6 +167,12 @@ void CMainWindow::OnDestroy() {
         m_trayIcon->Remove();
     }
 
+    m_updateDownloader.reset();
+
+    for (auto& wait : m_handleWaits) {
+        wait.reset();
+    }
+
     // Unregister message filtering and idle updates.
     CMessageLoop* pLoop = _Module.GetMessageLoop();
     ATLASSERT(pLoop != NULL);
@@ -289,11 +194,7 @@ void CMainWindow::OnHotKey(int nHotKeyID, UINT uModifiers, UINT uVirtKey) {
 void CMainWindow::OnTimer(UINT_PTR nIDEvent) {
     switch (static_cast<Timer>(nIDEvent)) {
         case Timer::kHandleNewProcesses:
-            if (m_engineControl) {
-                m_engineControl->HandleNewProcesses();
-            }
-
-            SetTimer(Timer::kHandleNewProcesses, kHandleNewProcessInterval);
+            ScanForNewProcesses();
             break;
 
         case Timer::kUpdateCheck:
@@ -302,10 +203,25 @@ void CMainWindow::OnTimer(UINT_PTR nIDEvent) {
             try {
                 m_updateChecker = std::make_unique<UpdateChecker>(
                     m_portable ? UpdateChecker::kFlagPortable : 0,
+                    m_serviceInfo.processId,
                     [this] { PostMessage(UWM_UPDATE_CHECKED); });
             } catch (const std::exception& e) {
                 LOG(L"UpdateChecker failed: %S", e.what());
-                SetTimer(Timer::kUpdateCheck, kUpdateRetryTime);
+                SetTimer(Timer::kUpdateCheck, GetUpdateRetryDelay(0));
+            }
+            break;
+
+        case Timer::kPrewarmUI:
+            KillTimer(Timer::kPrewarmUI);
+
+            try {
+                if (m_prewarmUI && !m_uiPrewarmed &&
+                    UIControl::GetOpenUIWindows().empty()) {
+                    UIControl::PrewarmUIFiles();
+                    m_uiPrewarmed = true;
+                }
+            } catch (const std::exception& e) {
+                LOG(L"%S", e.what());
             }
             break;
 
@@ -313,17 +229,15 @@ void CMainWindow::OnTimer(UINT_PTR nIDEvent) {
             KillTimer(Timer::kModTasksDlgCreate);
 
             try {
-                m_modTasksChangeNotification.emplace(L"mod-task");
+                m_modTasksChangeNotification.emplace(
+                    m_serviceInfo.processId, ModStatusReader::Kind::kTask);
 
-                if (!CTaskManagerDlg::IsDataSourceEmpty(
-                        CTaskManagerDlg::DataSource::kModTask)) {
+                if (!m_modTasksChangeNotification->Read().empty()) {
                     m_modTasksDlg.emplace(CTaskManagerDlg::DialogOptions{
                         .dataSource = CTaskManagerDlg::DataSource::kModTask,
                         .autonomousMode = true,
                         .autonomousModeShowDelay = m_modTasksDlgDelay,
                         .sessionManagerProcessId = m_serviceInfo.processId,
-                        .sessionManagerProcessCreationTime =
-                            m_serviceInfo.processCreationTime,
                         .runButtonCallback = [this](HWND hWnd) { RunUI(hWnd); },
                         .finalMessageCallback =
                             [this](HWND hWnd) { m_modTasksDlg.reset(); }});
@@ -369,13 +283,22 @@ LRESULT CMainWindow::OnPortableAppCommand(UINT uMsg,
         return 0;
     }
 
-    switch ((PortableAppCommand)wParam) {
+    auto command = (PortableAppCommand)wParam;
+    switch (command) {
         case PortableAppCommand::kRunUI:
             RunUI();
             break;
 
         case PortableAppCommand::kExit:
-            Exit();
+            Exit(/*forRestart=*/lParam == kExitForRestart);
+            break;
+
+        case PortableAppCommand::kPauseMods:
+        case PortableAppCommand::kResumeMods:
+            if (m_engineControl) {
+                m_engineControl->SetModsPaused(
+                    command == PortableAppCommand::kPauseMods);
+            }
             break;
     }
 
@@ -387,8 +310,10 @@ LRESULT CMainWindow::OnTrayIcon(UINT uMsg, WPARAM wParam, LPARAM lParam) {
         kNone,
         kOpenUI,
         kOpenUpdatePage,
+        kApplyUpdate,
         kModTaskManager,
         kToolkit,
+        kInjectionStats,
         kExit,
     };
 
@@ -409,6 +334,9 @@ LRESULT CMainWindow::OnTrayIcon(UINT uMsg, WPARAM wParam, LPARAM lParam) {
             (std::wstring(Functions::LoadStrFromRsrc(IDS_TRAY_TOOLKIT)) +
              (m_disableToolkitHotkey ? L"" : L"\tCtrl+Win+W"))
                 .c_str());
+        menu.AppendMenu(
+            MF_STRING, static_cast<UINT_PTR>(Action::kInjectionStats),
+            Functions::LoadStrFromRsrc(IDS_TRAY_INJECTION_STATS));
         menu.AppendMenu(MF_SEPARATOR);
         menu.AppendMenu(MF_STRING, static_cast<UINT_PTR>(Action::kExit),
                         Functions::LoadStrFromRsrc(IDS_TRAY_EXIT));
@@ -431,7 +359,8 @@ LRESULT CMainWindow::OnTrayIcon(UINT uMsg, WPARAM wParam, LPARAM lParam) {
 
         case AppTrayIcon::TrayAction::kBalloon:
             if (m_lastUpdateStatus && m_lastUpdateStatus->appUpdateAvailable) {
-                action = Action::kOpenUpdatePage;
+                action = UpdatePackage::IsReady() ? Action::kApplyUpdate
+                                                  : Action::kOpenUpdatePage;
             } else {
                 action = Action::kOpenUI;
             }
@@ -452,6 +381,10 @@ LRESULT CMainWindow::OnTrayIcon(UINT uMsg, WPARAM wParam, LPARAM lParam) {
             OpenUpdatePage();
             break;
 
+        case Action::kApplyUpdate:
+            ApplyUpdate();
+            break;
+
         case Action::kModTaskManager:
             ShowLoadedModsDialog();
             break;
@@ -460,6 +393,10 @@ LRESULT CMainWindow::OnTrayIcon(UINT uMsg, WPARAM wParam, LPARAM lParam) {
             ShowToolkitDialog();
             break;
 
+        case Action::kInjectionStats:
+            ShowInjectionStats();
+            break;
+
         case Action::kExit:
             if (m_portable) {
                 Exit();
@@ -490,9 +427,129 @@ LRESULT CMainWindow::OnUpdateChecked(UINT uMsg, WPARAM wParam, LPARAM lParam) {
 
         SetLastUpdateTime();
 
-        SetTimer(Timer::kUpdateCheck, kUpdateInterval);
+        m_updateCheckFailureCount = 0;
+        SetTimer(Timer::kUpdateCheck,
+                 AddUpdateJitter(kUpdateInterval, kUpdateIntervalJitter));
     } else {
-        SetTimer(Timer::kUpdateCheck, kUpdateRetryTime);
+        SetTimer(Timer::kUpdateCheck, GetUpdateRetryDelay(result.retryAfterMs));
+    }
+
+    return 0;
+}
+
+LRESULT CMainWindow::OnUpdateDownloaded(UINT uMsg,
+                                        WPARAM wParam,
+                                        LPARAM lParam) {
+    m_updateDownloader.reset();
+
+    bool ready = wParam != 0;
+    if (ready && m_lastUpdateStatus && m_lastUpdateStatus->appUpdateAvailable) {
+        m_trayIcon->ShowNotificationMessage(
+            Functions::LoadStrFromRsrc(IDS_NOTIFICATION_UPDATE_READY));
+    }
+
+    return 0;
+}
+
+LRESULT CMainWindow::OnHandleSignaled(UINT uMsg, WPARAM wParam, LPARAM lParam) {
+    auto handleWait = static_cast<HandleWait>(wParam);
+
+    // The message might have been posted before the wait was replaced or
+    // removed.
+    auto& wait = m_handleWaits[static_cast<size_t>(handleWait)];
+    if (!wait || wait->GetHandle() != GetHandleWaitSource(handleWait)) {
+        return 0;
+    }
+
+    switch (handleWait) {
+        case HandleWait::kAppSettingsChanged:
+            LoadSettings();
+            break;
+
+        case HandleWait::kNewUpdatesFound:
+            if (!m_disableUpdateCheck) {
+                NotifyAboutAvailableUpdates(UserProfile::GetUpdateStatus(),
+                                            true);
+            }
+            break;
+
+        case HandleWait::kModTasksChanged:
+            if (m_modTasksDlg) {
+                m_modTasksDlg->DataChanged();
+
+                try {
+                    m_modTasksChangeNotification->ContinueMonitoring();
+                } catch (const std::exception& e) {
+                    LOG(L"Tasks ContinueMonitoring failed: %S", e.what());
+                    RemoveHandleWait(HandleWait::kModTasksChanged);
+                    m_modTasksChangeNotification.reset();
+                }
+            } else {
+                // In the common case, there's a short-lived event, such
+                // as mod initialization, that is cleared right away.
+                // Wait a bit before creating a dialog, and only create
+                // it if events still exist.
+                RemoveHandleWait(HandleWait::kModTasksChanged);
+                m_modTasksChangeNotification.reset();
+                SetTimer(Timer::kModTasksDlgCreate, kModTasksDlgInitialDelay);
+            }
+            break;
+
+        case HandleWait::kModStatusesChanged:
+            if (m_modStatusesDlg) {
+                m_modStatusesDlg->DataChanged();
+            }
+
+            try {
+                m_modStatusesChangeNotification->ContinueMonitoring();
+            } catch (const std::exception& e) {
+                LOG(L"Statuses ContinueMonitoring failed: %S", e.what());
+                RemoveHandleWait(HandleWait::kModStatusesChanged);
+                m_modStatusesChangeNotification.reset();
+            }
+            break;
+
+        case HandleWait::kExplorerCrashed: {
+            int explorerCrashCount = 0;
+            try {
+                explorerCrashCount =
+                    m_explorerCrashMonitor->GetAmountOfNewEvents();
+            } catch (const std::exception& e) {
+                LOG(L"Explorer crash monitor failed: %S", e.what());
+                RemoveHandleWait(HandleWait::kExplorerCrashed);
+                m_explorerCrashMonitor.reset();
+                break;
+            }
+
+            if (explorerCrashCount > 0) {
+                try {
+                    HandleExplorerCrash(explorerCrashCount);
+                } catch (const std::exception& e) {
+                    LOG(L"Explorer crash handling failed: %S", e.what());
+                }
+            }
+            break;
+        }
+
+        case HandleWait::kCrashLoopDetected:
+            try {
+                m_crashLoopNotification->ContinueMonitoring();
+                HandleCrashLoopDetected();
+            } catch (const std::exception& e) {
+                LOG(L"Crash loop handling failed: %S", e.what());
+                RemoveHandleWait(HandleWait::kCrashLoopDetected);
+                m_crashLoopNotification.reset();
+            }
+            break;
+
+        case HandleWait::kNewProcessStarted:
+            ScanForNewProcesses();
+            break;
+    }
+
+    // The handlers might have replaced or removed the source.
+    if (wait && wait->GetHandle() == GetHandleWaitSource(handleWait)) {
+        wait->Rearm();
     }
 
     return 0;
@@ -528,6 +585,70 @@ BOOL CMainWindow::KillTimer(Timer nIDEvent) {
     return CWindowImpl::KillTimer(static_cast<UINT_PTR>(nIDEvent));
 }
 
+HANDLE CMainWindow::GetHandleWaitSource(HandleWait handleWait) {
+    switch (handleWait) {
+        case HandleWait::kAppSettingsChanged:
+            return m_appSettingsChangedEvent.get();
+
+        case HandleWait::kNewUpdatesFound:
+            return m_newUpdatesFoundEvent.get();
+
+        case HandleWait::kModTasksChanged:
+            return m_modTasksChangeNotification
+                       ? m_modTasksChangeNotification->GetHandle()
+                       : nullptr;
+
+        case HandleWait::kModStatusesChanged:
+            return m_modStatusesChangeNotification
+                       ? m_modStatusesChangeNotification->GetHandle()
+                       : nullptr;
+
+        case HandleWait::kExplorerCrashed:
+            return m_explorerCrashMonitor
+                       ? m_explorerCrashMonitor->GetEventHandle()
+                       : nullptr;
+
+        case HandleWait::kCrashLoopDetected:
+            return m_crashLoopNotification
+                       ? m_crashLoopNotification->GetHandle()
+                       : nullptr;
+
+        case HandleWait::kNewProcessStarted:
+            return m_processStartMonitor
+                       ? m_processStartMonitor->GetEventHandle()
+                       : nullptr;
+
+        case HandleWait::kCount:
+            break;
+    }
+
+    return nullptr;
+}
+
+void CMainWindow::RemoveHandleWait(HandleWait handleWait) {
+    m_handleWaits[static_cast<size_t>(handleWait)].reset();
+}
+
+void CMainWindow::UpdateHandleWaits() {
+    for (size_t i = 0; i < m_handleWaits.size(); i++) {
+        auto& wait = m_handleWaits[i];
+        HANDLE handle = GetHandleWaitSource(static_cast<HandleWait>(i));
+        if (wait && wait->GetHandle() == handle) {
+            continue;
+        }
+
+        wait.reset();
+
+        if (handle) {
+            try {
+                wait.emplace(handle, m_hWnd, UWM_HANDLE_SIGNALED, i);
+            } catch (const std::exception& e) {
+                LOG(L"Waiting for handle %zu failed: %S", i, e.what());
+            }
+        }
+    }
+}
+
 void CMainWindow::InitForPortableVersion() {
     auto settings =
         StorageManager::GetInstance().GetAppConfig(L"Settings", false);
@@ -535,9 +656,18 @@ void CMainWindow::InitForPortableVersion() {
     if (!settings->GetInt(L"SafeMode").value_or(0)) {
         m_engineControl.emplace();
         m_engineControl->HandleNewProcesses();
+
+        // Polling is kept as a fallback, e.g. if the monitor isn't available
+        // without administrator rights.
+        try {
+            m_processStartMonitor.emplace();
+        } catch (const std::exception& e) {
+            VERBOSE(L"Process start monitor isn't available: %S", e.what());
+        }
     }
 
-    SetTimer(Timer::kHandleNewProcesses, kHandleNewProcessInterval);
+    m_scanScheduler.emplace(m_processStartMonitor.has_value());
+    SetTimer(Timer::kHandleNewProcesses, m_scanScheduler->GetInterval());
 
     m_appSettingsChangedEvent.reset(Functions::CreateEventForMediumIntegrity(
         L"WindhawkAppSettingsChangedEvent-daemon"));
@@ -599,6 +729,18 @@ void CMainWindow::InitForNonPortableVersion() {
     }
 }
 
+void CMainWindow::ScanForNewProcesses() {
+    if (m_engineControl) {
+        int injectedCount = 0;
+        m_engineControl->HandleNewProcesses(&injectedCount);
+        m_scanScheduler->OnScanDone(injectedCount);
+    }
+
+    // Also restarts the timer after a scan which was triggered by the process
+    // start monitor, since it makes the next poll unnecessary for a while.
+    SetTimer(Timer::kHandleNewProcesses, m_scanScheduler->GetInterval());
+}
+
 void CMainWindow::LoadSettings() {
     LANGID languageId;
     bool hideTrayIcon;
@@ -607,6 +749,7 @@ void CMainWindow::LoadSettings() {
     bool dontAutoShowToolkit;
     bool disableToolkitHotkey;
     int modTasksDlgDelay;
+    bool prewarmUI;
 
     try {
         auto settings =
@@ -637,6 +780,8 @@ void CMainWindow::LoadSettings() {
         modTasksDlgDelay =
             settings->GetInt(L"ModTasksDialogDelay")
                 .value_or(CTaskManagerDlg::kAutonomousModeShowDelayDefault);
+
+        prewarmUI = settings->GetInt(L"PrewarmUI").value_or(0);
     } catch (const std::exception& e) {
         ::MessageBoxA(nullptr, e.what(), "Could not load settings",
                       MB_ICONERROR);
@@ -709,12 +854,25 @@ void CMainWindow::LoadSettings() {
                 auto explorerPath = wil::GetWindowsDirectory<std::wstring>() +
                                     L"\\explorer.exe";
 
+                RemoveHandleWait(HandleWait::kExplorerCrashed);
                 m_explorerCrashMonitor.emplace(explorerPath);
             } catch (const std::exception& e) {
                 LOG(L"%S", e.what());
             }
+
+            try {
+                RemoveHandleWait(HandleWait::kCrashLoopDetected);
+                m_crashLoopNotification.emplace(
+                    m_serviceInfo.processId, ModStatusReader::Kind::kCrashLoop);
+            } catch (const std::exception& e) {
+                LOG(L"Crash loop ChangeNotification failed: %S", e.what());
+            }
         } else {
+            RemoveHandleWait(HandleWait::kExplorerCrashed);
             m_explorerCrashMonitor.reset();
+
+            RemoveHandleWait(HandleWait::kCrashLoopDetected);
+            m_crashLoopNotification.reset();
         }
 
         m_dontAutoShowToolkit = dontAutoShowToolkit;
@@ -723,6 +881,24 @@ void CMainWindow::LoadSettings() {
     m_disableToolkitHotkey = disableToolkitHotkey;
 
     m_modTasksDlgDelay = modTasksDlgDelay;
+
+    // The UI files are read once, a while after the tray starts, when the
+    // system is usually idle.
+    if (prewarmUI != m_prewarmUI) {
+        if (prewarmUI && !m_uiPrewarmed) {
+            SetTimer(Timer::kPrewarmUI, kUIPrewarmDelay);
+        } else {
+            KillTimer(Timer::kPrewarmUI);
+        }
+
+        m_prewarmUI = prewarmUI;
+    }
+
+    // The engine reads its settings by itself, for example the logging
+    // verbosity, which is then applied by the running engines.
+    if (m_engineControl) {
+        m_engineControl->ReloadSettings();
+    }
 }
 
 void CMainWindow::NotifyAboutAvailableUpdates(
@@ -736,13 +912,23 @@ void CMainWindow::NotifyAboutAvailableUpdates(
     }
 
     MarkAppUpdateAvailable(m_lastUpdateStatus->appUpdateAvailable);
+
+    if (m_lastUpdateStatus->appUpdateAvailable) {
+        StartUpdateDownload();
+    }
 }
 
-void CMainWindow::Exit() {
+void CMainWindow::Exit(bool forRestart) {
     CloseUI();
 
     if (m_portable) {
         KillTimer(Timer::kHandleNewProcesses);
+        RemoveHandleWait(HandleWait::kNewProcessStarted);
+        m_processStartMonitor.reset();
+
+        if (m_engineControl && !forRestart) {
+            m_engineControl->Shutdown();
+        }
     }
 
     if (m_updateChecker) {
@@ -969,20 +1155,45 @@ UINT CMainWindow::GetNextUpdateDelay(ULONGLONG lastUpdateCheck) {
     ULONGLONG now = wil::filetime::convert_100ns_to_msec(
         wil::filetime::to_int64(wil::filetime::get_system_time()));
 
-    ULONGLONG nextUpdateDelay = kUpdateInitialDelay;
     ULONGLONG nextUpdateTime = lastUpdateCheck + kUpdateInterval;
-    if (nextUpdateTime > now) {
-        nextUpdateDelay = nextUpdateTime - now;
-        if (nextUpdateDelay < kUpdateInitialDelay) {
-            nextUpdateDelay = kUpdateInitialDelay;
-        } else if (nextUpdateDelay > kUpdateInterval) {
-            nextUpdateDelay = kUpdateInterval;
-        }
+    if (nextUpdateTime <= now + kUpdateInitialDelay) {
+        // Overdue, e.g. after the machine was off. Many machines are started
+        // at the same time, so the check isn't done right away.
+        return AddUpdateJitter(kUpdateInitialDelay, kUpdateOverdueJitter);
+    }
+
+    ULONGLONG nextUpdateDelay = nextUpdateTime - now;
+    if (nextUpdateDelay > kUpdateInterval) {
+        nextUpdateDelay = kUpdateInterval;
     }
 
     return static_cast<UINT>(nextUpdateDelay);
 }
 
+UINT CMainWindow::GetUpdateRetryDelay(ULONGLONG retryAfterMs) {
+    // Back off exponentially while the checks keep failing.
+    ULONGLONG retryDelay = kUpdateRetryTime;
+    for (int i = 0; i < m_updateCheckFailureCount &&
+                    retryDelay < kUpdateMaxRetryTime;
+         i++) {
+        retryDelay *= 2;
+    }
+
+    retryDelay =
+        std::min(retryDelay, static_cast<ULONGLONG>(kUpdateMaxRetryTime));
+
+    m_updateCheckFailureCount++;
+
+    // Honor the delay which the server asked for, while still checking at
+    // least once per update interval.
+    if (retryAfterMs > retryDelay) {
+        retryDelay =
+            std::min(retryAfterMs, static_cast<ULONGLONG>(kUpdateInterval));
+    }
+
+    return AddUpdateJitter(retryDelay, kUpdateRetryTime);
+}
+
 void CMainWindow::SetLastUpdateTime() {
     ULONGLONG now = wil::filetime::convert_100ns_to_msec(
         wil::filetime::to_int64(wil::filetime::get_system_time()));
@@ -1018,6 +1229,32 @@ void CMainWindow::OpenUpdatePage() {
     }
 }
 
+void CMainWindow::StartUpdateDownload() {
+    if (m_updateDownloader || !UpdatePackage::IsDownloadPending()) {
+        return;
+    }
+
+    try {
+        m_updateDownloader = std::make_unique<UpdatePackage::Downloader>(
+            [this](bool ready) { PostMessage(UWM_UPDATE_DOWNLOADED, ready); });
+    } catch (const std::exception& e) {
+        LOG(L"Starting the update download failed: %S", e.what());
+    }
+}
+
+void CMainWindow::ApplyUpdate() {
+    auto modulePath = wil::GetModuleFileName<std::wstring>();
+
+    // Replacing the installed files requires elevation in the non-portable
+    // version.
+    if ((int)(UINT_PTR)ShellExecute(m_hWnd, m_portable ? nullptr : L"runas",
+                                    modulePath.c_str(), L"-apply-update",
+                                    nullptr, SW_SHOWNORMAL) <= 32 &&
+        GetLastError() != ERROR_CANCELLED) {
+        OpenUpdatePage();
+    }
+}
+
 void CMainWindow::ShowLoadedModsDialog() {
     if (m_modStatusesDlg) {
         ::SetForegroundWindow(*m_modStatusesDlg);
@@ -1027,11 +1264,11 @@ void CMainWindow::ShowLoadedModsDialog() {
     m_modStatusesDlg.emplace(CTaskManagerDlg::DialogOptions{
         .dataSource = CTaskManagerDlg::DataSource::kModStatus,
         .sessionManagerProcessId = m_serviceInfo.processId,
-        .sessionManagerProcessCreationTime = m_serviceInfo.processCreationTime,
         .runButtonCallback = [this](HWND hWnd) { RunUI(hWnd); },
         .finalMessageCallback =
             [this](HWND hWnd) {
                 m_modStatusesDlg.reset();
+                RemoveHandleWait(HandleWait::kModStatusesChanged);
                 m_modStatusesChangeNotification.reset();
             }});
 
@@ -1043,12 +1280,49 @@ void CMainWindow::ShowLoadedModsDialog() {
     m_modStatusesDlg->ShowWindow(SW_SHOWNORMAL);
 
     try {
-        m_modStatusesChangeNotification.emplace(L"mod-status");
+        m_modStatusesChangeNotification.emplace(
+            m_serviceInfo.processId, ModStatusReader::Kind::kStatus);
     } catch (const std::exception& e) {
         LOG(L"Statuses ChangeNotification failed: %S", e.what());
     }
 }
 
+void CMainWindow::ShowInjectionStats() {
+    using INJECTION_STATS_GET_REPORT =
+        BOOL (*)(DWORD dwSessionManagerProcessId, PWSTR pszReport,
+                 SIZE_T cchReport);
+
+    WCHAR szReport[4096];
+    bool reportAvailable = false;
+
+    try {
+        auto engineLibraryPath =
+            StorageManager::GetInstance().GetEnginePath() / L"windhawk.dll";
+
+        wil::unique_hmodule engineModule(
+            LoadLibrary(engineLibraryPath.c_str()));
+        THROW_LAST_ERROR_IF_NULL(engineModule);
+
+        auto pInjectionStatsGetReport =
+            reinterpret_cast<INJECTION_STATS_GET_REPORT>(GetProcAddress(
+                engineModule.get(), "InjectionStatsGetReport"));
+        THROW_LAST_ERROR_IF_NULL(pInjectionStatsGetReport);
+
+        reportAvailable = pInjectionStatsGetReport(
+            m_serviceInfo.processId, szReport, ARRAYSIZE(szReport));
+    } catch (const std::exception& e) {
+        LOG(L"Getting injection stats failed: %S", e.what());
+    }
+
+    ::MessageBox(
+        m_hWnd,
+        reportAvailable
+            ? szReport
+            : Functions::LoadStrFromRsrc(IDS_INJECTION_STATS_UNAVAILABLE),
+        Functions::LoadStrFromRsrc(IDS_INJECTION_STATS_TITLE),
+        reportAvailable ? MB_ICONINFORMATION : MB_ICONWARNING);
+}
+
 void CMainWindow::ShowToolkitDialog(bool triggeredBySystemInstability) {
     if (m_toolkitDlg) {
         ::SetForegroundWindow(*m_toolkitDlg);
@@ -1157,3 +1431,24 @@ void CMainWindow::HandleExplorerCrash(int explorerCrashCount) {
 
     m_explorerLastTerminatedTickCount = currentTickCount;
 }
+
+void CMainWindow::HandleCrashLoopDetected() {
+    bool newCrashLoop = false;
+    ULONGLONG lastHandledTime = m_crashLoopLastHandledTime;
+
+    for (const auto& item : m_crashLoopNotification->Read()) {
+        if (item.creationTime > lastHandledTime) {
+            LOG(L"Mods aren't loaded in %s (%u) after repeated crashes",
+                item.value.c_str(), item.processId);
+            m_crashLoopLastHandledTime =
+                std::max(m_crashLoopLastHandledTime, item.creationTime);
+            newCrashLoop = true;
+        }
+    }
+
+    // No need to wait for the crashes to be reported in the event log, the
+    // engine already stopped loading mods in the process.
+    if (newCrashLoop && !m_toolkitDlg) {
+        ShowToolkitDialog(/*triggeredBySystemInstability=*/true);
+    }
+}
@@ -2,13 +2,18 @@
 
 #include "engine_control.h"
 #include "event_viewer_crash_monitor.h"
+#include "mod_status_reader.h"
+#include "process_start_monitor.h"
+#include "scan_scheduler.h"
 #include "service_common.h"
 #include "storage_manager.h"
 #include "task_manager_dlg.h"
 #include "toolkit_dlg.h"
 #include "tray_icon.h"
 #include "update_checker.h"
+#include "update_package.h"
 #include "userprofile.h"
+#include "window_message_wait.h"
 
 class CMainWindow : public CWindowImpl<CMainWindow, CWindow, CNullTraits>,
                     public CMessageFilter,
@@ -21,20 +26,45 @@ class CMainWindow : public CWindowImpl<CMainWindow, CWindow, CNullTraits>,
         UWM_PORTABLE_APP_COMMAND = WM_APP,
         UWM_TRAYICON,
         UWM_UPDATE_CHECKED,
+        UWM_UPDATE_DOWNLOADED,
+        UWM_HANDLE_SIGNALED,
     };
 
     enum class PortableAppCommand {
         kRunUI = 1,
+        // With kExitForRestart as the lParam, the running sessions are left
+        // for the new instance to take over instead of being shut down. Older
+        // versions ignore the lParam and exit as usual.
         kExit,
+        kPauseMods,
+        kResumeMods,
     };
 
-    CMainWindow(bool trayOnly, bool portable);
+    static constexpr LPARAM kExitForRestart = 1;
+
+    // If showToolkit is set, the toolkit is shown right away, which is used
+    // by the service to handle crashes in sessions without a running tray.
+    CMainWindow(bool trayOnly, bool portable, bool showToolkit = false);
 
    private:
     enum class Timer {
         kHandleNewProcesses = 1,
         kUpdateCheck,
         kModTasksDlgCreate,
+        kPrewarmUI,
+    };
+
+    // Handles which are waited for with a threadpool wait, which posts
+    // UWM_HANDLE_SIGNALED with the value as WPARAM.
+    enum class HandleWait {
+        kAppSettingsChanged,
+        kNewUpdatesFound,
+        kModTasksChanged,
+        kModStatusesChanged,
+        kExplorerCrashed,
+        kCrashLoopDetected,
+        kNewProcessStarted,
+        kCount,
     };
 
     enum class Hotkey {
@@ -53,6 +83,8 @@ class CMainWindow : public CWindowImpl<CMainWindow, CWindow, CNullTraits>,
         MESSAGE_HANDLER_EX(UWM_PORTABLE_APP_COMMAND, OnPortableAppCommand)
         MESSAGE_HANDLER_EX(UWM_TRAYICON, OnTrayIcon)
         MESSAGE_HANDLER_EX(UWM_UPDATE_CHECKED, OnUpdateChecked)
+        MESSAGE_HANDLER_EX(UWM_UPDATE_DOWNLOADED, OnUpdateDownloaded)
+        MESSAGE_HANDLER_EX(UWM_HANDLE_SIGNALED, OnHandleSignaled)
         MESSAGE_HANDLER_EX(m_taskbarCreatedMsg, OnTaskbarCreated)
     END_MSG_MAP()
 
@@ -64,18 +96,30 @@ class CMainWindow : public CWindowImpl<CMainWindow, CWindow, CNullTraits>,
     LRESULT OnPortableAppCommand(UINT uMsg, WPARAM wParam, LPARAM lParam);
     LRESULT OnTrayIcon(UINT uMsg, WPARAM wParam, LPARAM lParam);
     LRESULT OnUpdateChecked(UINT uMsg, WPARAM wParam, LPARAM lParam);
+    LRESULT OnUpdateDownloaded(UINT uMsg, WPARAM wParam, LPARAM lParam);
+    LRESULT OnHandleSignaled(UINT uMsg, WPARAM wParam, LPARAM lParam);
     LRESULT OnTaskbarCreated(UINT uMsg, WPARAM wParam, LPARAM lParam);
 
     UINT_PTR SetTimer(Timer nIDEvent,
                       UINT nElapse,
                       TIMERPROC lpfnTimer = nullptr);
     BOOL KillTimer(Timer nIDEvent);
+    HANDLE GetHandleWaitSource(HandleWait handleWait);
+    // Must be called before the source of the wait is destroyed, since the
+    // handle must stay valid while it's waited for.
+    void RemoveHandleWait(HandleWait handleWait);
+    // Creates, replaces or removes the waits to match the current handles.
+    void UpdateHandleWaits();
     void InitForPortableVersion();
     void InitForNonPortableVersion();
+    // Handles new processes, and schedules the next scan.
+    void ScanForNewProcesses();
     void LoadSettings();
     void NotifyAboutAvailableUpdates(UserProfile::UpdateStatus updateStatus,
                                      bool alwaysShowUpdateNotification = false);
-    void Exit();
+    // Unless forRestart is set, the sessions of all processes are shut down
+    // first, see EngineControl::Shutdown.
+    void Exit(bool forRestart = false);
     void StopService(HWND hWnd = nullptr);
     void RunUI(HWND hWnd = nullptr);
     void CloseUI();
@@ -83,16 +127,23 @@ class CMainWindow : public CWindowImpl<CMainWindow, CWindow, CNullTraits>,
                                        int modUpdatesAvailable);
     void MarkAppUpdateAvailable(bool appUpdateAvailable);
     UINT GetNextUpdateDelay(ULONGLONG lastUpdateCheck);
+    // Also counts the failure for the exponential backoff.
+    UINT GetUpdateRetryDelay(ULONGLONG retryAfterMs);
     void SetLastUpdateTime();
     void ResetLastUpdateTime();
     void OpenUpdatePage();
+    void StartUpdateDownload();
+    void ApplyUpdate();
     void ShowLoadedModsDialog();
+    void ShowInjectionStats();
     void ShowToolkitDialog(bool triggeredBySystemInstability = false);
     void SwitchToSafeMode();
     void HandleExplorerCrash(int explorerCrashCount);
+    void HandleCrashLoopDetected();
 
     bool m_trayOnly;
     bool m_portable;
+    bool m_showToolkit;
     UINT m_taskbarCreatedMsg;
     wil::unique_mutex_nothrow m_serviceMutex;
     wil::unique_event_nothrow m_appSettingsChangedEvent;
@@ -100,10 +151,15 @@ class CMainWindow : public CWindowImpl<CMainWindow, CWindow, CNullTraits>,
     std::optional<AppTrayIcon> m_trayIcon;
     ServiceCommon::ServiceInfo m_serviceInfo{};
     std::optional<EngineControl> m_engineControl;
+    std::optional<ProcessStartMonitor> m_processStartMonitor;
+    std::optional<ScanScheduler> m_scanScheduler;
     std::unique_ptr<UpdateChecker> m_updateChecker;
+    int m_updateCheckFailureCount = 0;
     bool m_exitWhenUpdateCheckDone = false;
     std::optional<UserProfile::UpdateStatus> m_lastUpdateStatus;
+    std::unique_ptr<UpdatePackage::Downloader> m_updateDownloader;
     bool m_toolkitHotkeyRegistered = false;
+    bool m_uiPrewarmed = false;
 
     // Settings.
     LANGID m_languageId = 0;
@@ -112,18 +168,17 @@ class CMainWindow : public CWindowImpl<CMainWindow, CWindow, CNullTraits>,
     bool m_checkForUpdates = false;  // portable version only
     bool m_dontAutoShowToolkit = true;
     bool m_disableToolkitHotkey = false;
+    bool m_prewarmUI = false;
     int m_modTasksDlgDelay = CTaskManagerDlg::kAutonomousModeShowDelayDefault;
 
     // Shown automatically when mods are doing tasks such as initializing or
     // loading symbols.
     std::optional<CTaskManagerDlg> m_modTasksDlg;
-    std::optional<StorageManager::ModMetadataChangeNotification>
-        m_modTasksChangeNotification;
+    std::optional<ModStatusReader> m_modTasksChangeNotification;
 
     // Opened by the user.
     std::optional<CTaskManagerDlg> m_modStatusesDlg;
-    std::optional<StorageManager::ModMetadataChangeNotification>
-        m_modStatusesChangeNotification;
+    std::optional<ModStatusReader> m_modStatusesChangeNotification;
 
     // Opened from the tray icon, with a hotkey, or when explorer isn't running.
     std::optional<CToolkitDlg> m_toolkitDlg;
@@ -133,4 +188,15 @@ class CMainWindow : public CWindowImpl<CMainWindow, CWindow, CNullTraits>,
     constexpr static UINT kExplorerSecondCrashMaxPeriod = 1000 * 60;
     std::optional<EventViewerCrashMonitor> m_explorerCrashMonitor;
     ULONGLONG m_explorerLastTerminatedTickCount = 0;
+
+    // Crash loops of any process, detected by the engine right after the
+    // crashes. Records are only handled once, by their creation time.
+    std::optional<ModStatusReader> m_crashLoopNotification;
+    ULONGLONG m_crashLoopLastHandledTime = 0;
+
+    // Declared last, so that the callbacks are done before the rest is
+    // destroyed.
+    std::array<std::optional<WindowMessageWait>,
+               static_cast<size_t>(HandleWait::kCount)>
+        m_handleWaits;
 };
@@ -0,0 +1,143 @@
+#include "stdafx.h"
+
+#include "mod_performance_report.h"
+
+#include "logger.h"
+#include "mod_status_reader.h"
+#include "storage_manager.h"
+
+using json = nlohmann::ordered_json;
+
+namespace {
+
+struct ModSamples {
+    std::vector<double> totalMs;
+    std::vector<double> initMs;
+    std::vector<double> explorerTotalMs;
+    std::vector<double> cpuUsagePercent;
+};
+
+// The same percentiles as of the exported performance stats.
+json GetPercentilesJson(std::vector<double>& values) {
+    std::sort(values.begin(), values.end());
+    auto percentile = [&values](size_t p) {
+        return values[(values.size() - 1) * p / 100];
+    };
+
+    return {
+        {"count", values.size()},
+        {"p50", percentile(50)},
+        {"p90", percentile(90)},
+        {"max", values.back()},
+    };
+}
+
+// The load times are formatted by ModLoadTimes of the engine, e.g.
+// "12.3 ms: load 1.0, init 10.1, ...", with the total first.
+void AddLoadTimeSamples(ModSamples& samples,
+                        const ModStatusReader::Item& item) {
+    samples.totalMs.push_back(wcstod(item.value.c_str(), nullptr));
+
+    if (_wcsicmp(item.processName.c_str(), L"explorer.exe") == 0) {
+        samples.explorerTotalMs.push_back(samples.totalMs.back());
+    }
+
+    size_t initPos = item.value.find(L"init ");
+    if (initPos != item.value.npos) {
+        samples.initMs.push_back(
+            wcstod(item.value.c_str() + initPos + wcslen(L"init "), nullptr));
+    }
+}
+
+}  // namespace
+
+namespace ModPerformanceReport {
+
+bool IsEnabled() {
+    auto settings =
+        StorageManager::GetInstance().GetAppConfig(L"Settings", false);
+    return settings->GetInt(L"SendModPerformanceStats").value_or(0);
+}
+
+std::string AddToPostedData(const std::string& postedData,
+                            DWORD sessionManagerProcessId) {
+    json postedJson = json::parse(postedData);
+
+    // Only the mods which the server already knows about from the update
+    // check are reported, with the versions which are posted with it.
+    auto mods = postedJson.find("mods");
+    if (mods == postedJson.end() || !mods->is_object()) {
+        return postedData;
+    }
+
+    std::map<std::string, ModSamples> samplesByModId;
+
+    try {
+        ModStatusReader loadTimesReader(sessionManagerProcessId,
+                                        ModStatusReader::Kind::kLoadTimes);
+        for (const auto& item : loadTimesReader.Read()) {
+            if (!item.value.empty()) {
+                std::string modId(CW2A(item.modName.c_str(), CP_UTF8));
+                AddLoadTimeSamples(samplesByModId[modId], item);
+            }
+        }
+
+        ModStatusReader cpuUsageReader(sessionManagerProcessId,
+                                       ModStatusReader::Kind::kCpuUsage);
+        for (const auto& item : cpuUsageReader.Read()) {
+            if (!item.value.empty()) {
+                std::string modId(CW2A(item.modName.c_str(), CP_UTF8));
+                samplesByModId[modId].cpuUsagePercent.push_back(
+                    wcstod(item.value.c_str(), nullptr));
+            }
+        }
+    } catch (const std::exception& e) {
+        LOG(L"Reading the mod performance failed: %S", e.what());
+        return postedData;
+    }
+
+    auto report = json::object();
+    for (auto& [modId, samples] : samplesByModId) {
+        if (modId.starts_with("local@")) {
+            continue;
+        }
+
+        auto mod = mods->find(modId);
+        if (mod == mods->end() || !mod->is_object()) {
+            continue;
+        }
+
+        auto version = mod->find("version");
+        if (version == mod->end() || !version->is_string()) {
+            continue;
+        }
+
+        auto& modReport = report[modId];
+        modReport["version"] = *version;
+
+        std::pair<const char*, std::vector<double>*> fields[] = {
+            {"totalMs", &samples.totalMs},
+            {"initMs", &samples.initMs},
+            {"explorerTotalMs", &samples.explorerTotalMs},
+            {"cpuUsagePercent", &samples.cpuUsagePercent},
+        };
+        for (auto& [name, values] : fields) {
+            if (!values->empty()) {
+                modReport[name] = GetPercentilesJson(*values);
+            }
+        }
+    }
+
+    if (report.empty()) {
+        return postedData;
+    }
+
+    postedJson["modPerformance"] = {
+        {"version", 1},
+        {"mods", std::move(report)},
+    };
+
+    return postedJson.dump(2);
+}
+
+}  // namespace ModPerformanceReport
@@ -0,0 +1,20 @@
+#pragma once
+
+// An opt-in report of the performance of the installed mods, sent with the
+// update check, so that the mod repository can tell which mods slow down
+// processes, e.g. the start of explorer, on many machines. Only percentiles
+// per mod version are sent, aggregated over all the processes in which the
+// mod is loaded, with explorer counted separately. No process names, local
+// mods or mods which aren't part of the update check are included.
+namespace ModPerformanceReport {
+
+// Whether the user opted in with the SendModPerformanceStats app setting.
+bool IsEnabled();
+
+// Adds the report to the UTF-8 JSON posted with the update check, and returns
+// the result. If the engines of the session can't be read, the posted data is
+// returned as is.
+std::string AddToPostedData(const std::string& postedData,
+                            DWORD sessionManagerProcessId);
+
+}  // namespace ModPerformanceReport
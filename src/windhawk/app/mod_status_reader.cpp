@@ -0,0 +1,89 @@
+#include "stdafx.h"
+
+#include "mod_status_reader.h"
+
+#include "storage_manager.h"
+
+ModStatusReader::ModStatusReader(DWORD sessionManagerProcessId, Kind kind) {
+    auto engineLibraryPath =
+        StorageManager::GetInstance().GetEnginePath() / L"windhawk.dll";
+
+    engineModule.reset(LoadLibrary(engineLibraryPath.c_str()));
+    THROW_LAST_ERROR_IF_NULL(engineModule);
+
+    auto pModStatusReaderOpen = reinterpret_cast<MOD_STATUS_READER_OPEN>(
+        GetProcAddress(engineModule.get(), "ModStatusReaderOpen"));
+    THROW_LAST_ERROR_IF_NULL(pModStatusReaderOpen);
+
+    pModStatusReaderGetChangeEvent =
+        reinterpret_cast<MOD_STATUS_READER_GET_CHANGE_EVENT>(GetProcAddress(
+            engineModule.get(), "ModStatusReaderGetChangeEvent"));
+    THROW_LAST_ERROR_IF_NULL(pModStatusReaderGetChangeEvent);
+
+    pModStatusReaderContinueMonitoring =
+        reinterpret_cast<MOD_STATUS_READER_CONTINUE_MONITORING>(GetProcAddress(
+            engineModule.get(), "ModStatusReaderContinueMonitoring"));
+    THROW_LAST_ERROR_IF_NULL(pModStatusReaderContinueMonitoring);
+
+    pModStatusReaderRead = reinterpret_cast<MOD_STATUS_READER_READ>(
+        GetProcAddress(engineModule.get(), "ModStatusReaderRead"));
+    THROW_LAST_ERROR_IF_NULL(pModStatusReaderRead);
+
+    pModStatusReaderClose = reinterpret_cast<MOD_STATUS_READER_CLOSE>(
+        GetProcAddress(engineModule.get(), "ModStatusReaderClose"));
+    THROW_LAST_ERROR_IF_NULL(pModStatusReaderClose);
+
+    hReader = pModStatusReaderOpen(sessionManagerProcessId,
+                                   static_cast<DWORD>(kind));
+    if (!hReader) {
+        throw std::runtime_error("Failed to open the mod status table");
+    }
+}
+
+ModStatusReader::~ModStatusReader() {
+    pModStatusReaderClose(hReader);
+}
+
+HANDLE ModStatusReader::GetHandle() {
+    return pModStatusReaderGetChangeEvent(hReader);
+}
+
+void ModStatusReader::ContinueMonitoring() {
+    pModStatusReaderContinueMonitoring(hReader);
+}
+
+std::vector<ModStatusReader::Item> ModStatusReader::Read() {
+    struct ReadContext {
+        std::vector<Item> items;
+        bool failed = false;
+    };
+
+    ReadContext readContext;
+
+    // Exceptions must not propagate through the engine library.
+    auto callback = [](void* context, ULONG id, ULONG version,
+                       DWORD processId, ULONGLONG creationTime,
+                       PCWSTR modName, PCWSTR processName, PCWSTR value) {
+        auto* readContext = static_cast<ReadContext*>(context);
+        try {
+            readContext->items.push_back({
+                .id = id,
+                .version = version,
+                .processId = processId,
+                .creationTime = creationTime,
+                .modName = modName,
+                .processName = processName,
+                .value = value,
+            });
+        } catch (const std::exception&) {
+            readContext->failed = true;
+        }
+    };
+
+    if (!pModStatusReaderRead(hReader, callback, &readContext) ||
+        readContext.failed) {
+        throw std::runtime_error("Failed to read the mod status table");
+    }
+
+    return std::move(readContext.items);
+}
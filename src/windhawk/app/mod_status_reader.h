@@ -0,0 +1,69 @@
+#pragma once
+
+// Reads the mod statuses or the mod tasks which the engines publish in the
+// shared memory of the session manager, using the engine library.
+class ModStatusReader {
+   public:
+    // Must match ModStatusTable::Kind of the engine.
+    enum class Kind {
+        kStatus,
+        kTask,
+        kHookCallStats,
+        kEngineMetrics,
+        kLoadTimes,
+        kCpuUsage,
+        kCrashLoop,
+    };
+
+    struct Item {
+        // Stays the same while the record is used by the same mod instance.
+        ULONG id;
+        // Changes whenever the record is written.
+        ULONG version;
+        DWORD processId;
+        ULONGLONG creationTime;
+        std::wstring modName;
+        std::wstring processName;
+        std::wstring value;
+    };
+
+    ModStatusReader(DWORD sessionManagerProcessId, Kind kind);
+    ~ModStatusReader();
+
+    ModStatusReader(const ModStatusReader&) = delete;
+    ModStatusReader(ModStatusReader&&) = delete;
+    ModStatusReader& operator=(const ModStatusReader&) = delete;
+    ModStatusReader& operator=(ModStatusReader&&) = delete;
+
+    // Signaled when the data changed since the last ContinueMonitoring call,
+    // or since construction.
+    HANDLE GetHandle();
+    void ContinueMonitoring();
+
+    std::vector<Item> Read();
+
+   private:
+    using MOD_STATUS_READ_CALLBACK = void (*)(void* context,
+                                              ULONG id,
+                                              ULONG version,
+                                              DWORD processId,
+                                              ULONGLONG creationTime,
+                                              PCWSTR modName,
+                                              PCWSTR processName,
+                                              PCWSTR value);
+    using MOD_STATUS_READER_OPEN = HANDLE (*)(DWORD dwSessionManagerProcessId,
+                                              DWORD dwKind);
+    using MOD_STATUS_READER_GET_CHANGE_EVENT = HANDLE (*)(HANDLE hReader);
+    using MOD_STATUS_READER_CONTINUE_MONITORING = BOOL (*)(HANDLE hReader);
+    using MOD_STATUS_READER_READ = BOOL (*)(HANDLE hReader,
+                                            MOD_STATUS_READ_CALLBACK callback,
+                                            void* context);
+    using MOD_STATUS_READER_CLOSE = BOOL (*)(HANDLE hReader);
+
+    wil::unique_hmodule engineModule;
+    MOD_STATUS_READER_GET_CHANGE_EVENT pModStatusReaderGetChangeEvent;
+    MOD_STATUS_READER_CONTINUE_MONITORING pModStatusReaderContinueMonitoring;
+    MOD_STATUS_READER_READ pModStatusReaderRead;
+    MOD_STATUS_READER_CLOSE pModStatusReaderClose;
+    HANDLE hReader;
+};
@@ -0,0 +1,98 @@
+#include "stdafx.h"
+
+#include "perf_stats_export.h"
+
+#include "mod_status_reader.h"
+#include "storage_manager.h"
+
+using json = nlohmann::ordered_json;
+
+namespace {
+
+// Much longer than the report of the engine.
+constexpr size_t kInjectionReportMaxLength = 64 * 1024;
+
+std::wstring GetInjectionStatsJson(DWORD sessionManagerProcessId) {
+    using INJECTION_STATS_GET_JSON_REPORT =
+        BOOL (*)(DWORD dwSessionManagerProcessId, PWSTR pszReport,
+                 SIZE_T cchReport);
+
+    auto engineLibraryPath =
+        StorageManager::GetInstance().GetEnginePath() / L"windhawk.dll";
+
+    wil::unique_hmodule engineModule(LoadLibrary(engineLibraryPath.c_str()));
+    THROW_LAST_ERROR_IF_NULL(engineModule);
+
+    auto pInjectionStatsGetJsonReport =
+        reinterpret_cast<INJECTION_STATS_GET_JSON_REPORT>(GetProcAddress(
+            engineModule.get(), "InjectionStatsGetJsonReport"));
+    THROW_LAST_ERROR_IF_NULL(pInjectionStatsGetJsonReport);
+
+    auto report = std::make_unique<WCHAR[]>(kInjectionReportMaxLength);
+    if (!pInjectionStatsGetJsonReport(sessionManagerProcessId, report.get(),
+                                      kInjectionReportMaxLength)) {
+        throw std::runtime_error("Getting the injection stats failed");
+    }
+
+    return report.get();
+}
+
+// The values of each mod, aggregated over all processes and instances. Only
+// the leading number of each value is used, e.g. the milliseconds of a load
+// time or the recent percentage of the CPU usage.
+json GetModValuesJson(DWORD sessionManagerProcessId,
+                      ModStatusReader::Kind kind) {
+    ModStatusReader reader(sessionManagerProcessId, kind);
+
+    std::map<std::string, std::vector<double>> valuesByModName;
+    for (const auto& item : reader.Read()) {
+        if (item.value.empty()) {
+            continue;
+        }
+
+        valuesByModName[std::string(CW2A(item.modName.c_str(), CP_UTF8))]
+            .push_back(wcstod(item.value.c_str(), nullptr));
+    }
+
+    auto result = json::object();
+    for (auto& [modName, values] : valuesByModName) {
+        std::sort(values.begin(), values.end());
+        auto percentile = [&values](size_t p) {
+            return values[(values.size() - 1) * p / 100];
+        };
+
+        result[modName] = {
+            {"count", values.size()},
+            {"p50", percentile(50)},
+            {"p90", percentile(90)},
+            {"max", values.back()},
+        };
+    }
+
+    return result;
+}
+
+}  // namespace
+
+namespace PerfStatsExport {
+
+std::string GetJson(DWORD sessionManagerProcessId) {
+    std::wstring injectionStats =
+        GetInjectionStatsJson(sessionManagerProcessId);
+
+    json result = {
+        {"version", 1},
+        {"injection",
+         json::parse(std::string(CW2A(injectionStats.c_str(), CP_UTF8)))},
+        {"modLoadTimesMs",
+         GetModValuesJson(sessionManagerProcessId,
+                          ModStatusReader::Kind::kLoadTimes)},
+        {"modCpuUsagePercent",
+         GetModValuesJson(sessionManagerProcessId,
+                          ModStatusReader::Kind::kCpuUsage)},
+    };
+
+    return result.dump(2) + "\n";
+}
+
+}  // namespace PerfStatsExport
@@ -0,0 +1,13 @@
+#pragma once
+
+// Exports the performance stats which the engines publish for the current
+// session as a single JSON object: the injection stats, and the load times and
+// the CPU usage of each mod, aggregated over the processes in which the mod is
+// loaded. The names are stable, so that exports of different versions can be
+// compared by tools, e.g. to track regressions.
+namespace PerfStatsExport {
+
+// Returns UTF-8 JSON.
+std::string GetJson(DWORD sessionManagerProcessId);
+
+}  // namespace PerfStatsExport
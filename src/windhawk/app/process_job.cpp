@@ -0,0 +1,129 @@
+#include "stdafx.h"
+
+#include "process_job.h"
+
+#include "logger.h"
+
+namespace {
+
+// Creating a global object requires administrator rights, so without them,
+// the global job is only used if it exists already, e.g. if it was created by
+// the service.
+constexpr WCHAR kGlobalJobName[] = L"Global\\WindhawkProcessJob";
+constexpr WCHAR kLocalJobName[] = L"Local\\WindhawkProcessJob";
+
+wil::unique_handle CreateOrOpenJob(PCWSTR name) {
+    // Allow only JOB_OBJECT_ASSIGN_PROCESS (0x0001), JOB_OBJECT_QUERY
+    // (0x0004) and SYNCHRONIZE (0x00100000), only for medium integrity.
+    PCWSTR pszStringSecurityDescriptor =
+        L"D:(A;;0x00100005;;;WD)S:(ML;;NW;;;ME)";
+
+    wil::unique_hlocal secDesc;
+    THROW_IF_WIN32_BOOL_FALSE(
+        ConvertStringSecurityDescriptorToSecurityDescriptor(
+            pszStringSecurityDescriptor, SDDL_REVISION_1, &secDesc, nullptr));
+
+    SECURITY_ATTRIBUTES secAttr = {sizeof(SECURITY_ATTRIBUTES)};
+    secAttr.lpSecurityDescriptor = secDesc.get();
+    secAttr.bInheritHandle = FALSE;
+
+    wil::unique_handle job(CreateJobObject(&secAttr, name));
+    if (job) {
+        if (GetLastError() != ERROR_ALREADY_EXISTS) {
+            // Processes which explicitly ask to break away from the job, e.g.
+            // ones which set up a job of their own, are allowed to.
+            JOBOBJECT_EXTENDED_LIMIT_INFORMATION limitInformation{};
+            limitInformation.BasicLimitInformation.LimitFlags =
+                JOB_OBJECT_LIMIT_BREAKAWAY_OK;
+            THROW_IF_WIN32_BOOL_FALSE(SetInformationJobObject(
+                job.get(), JobObjectExtendedLimitInformation,
+                &limitInformation, sizeof(limitInformation)));
+        }
+
+        return job;
+    }
+
+    // Created by a process with other rights, only the allowed access can be
+    // requested.
+    job.reset(OpenJobObject(JOB_OBJECT_ASSIGN_PROCESS | JOB_OBJECT_QUERY,
+                            FALSE, name));
+    return job;
+}
+
+void AppendProcessIds(HANDLE job, std::vector<DWORD>& processIds) {
+    std::vector<BYTE> buffer(sizeof(JOBOBJECT_BASIC_PROCESS_ID_LIST) +
+                             64 * sizeof(ULONG_PTR));
+    while (true) {
+        auto* list =
+            reinterpret_cast<JOBOBJECT_BASIC_PROCESS_ID_LIST*>(buffer.data());
+        if (QueryInformationJobObject(job, JobObjectBasicProcessIdList, list,
+                                      static_cast<DWORD>(buffer.size()),
+                                      nullptr)) {
+            for (DWORD i = 0; i < list->NumberOfProcessIdsInList; i++) {
+                processIds.push_back(
+                    static_cast<DWORD>(list->ProcessIdList[i]));
+            }
+
+            return;
+        }
+
+        THROW_LAST_ERROR_IF(GetLastError() != ERROR_MORE_DATA);
+
+        // Leave room for processes assigned in the meantime.
+        buffer.resize(sizeof(JOBOBJECT_BASIC_PROCESS_ID_LIST) +
+                      list->NumberOfAssignedProcesses * 2 * sizeof(ULONG_PTR));
+    }
+}
+
+}  // namespace
+
+namespace ProcessJob {
+
+void AssignCurrentProcess() noexcept {
+    try {
+        wil::unique_handle job = CreateOrOpenJob(kGlobalJobName);
+        if (!job) {
+            job = CreateOrOpenJob(kLocalJobName);
+        }
+
+        THROW_LAST_ERROR_IF(!job);
+
+        BOOL inJob;
+        THROW_IF_WIN32_BOOL_FALSE(
+            IsProcessInJob(GetCurrentProcess(), job.get(), &inJob));
+        if (inJob) {
+            // Inherited from the process which started the current process.
+            return;
+        }
+
+        // The job is kept alive by the processes which are assigned to it,
+        // the handle isn't needed afterwards.
+        THROW_IF_WIN32_BOOL_FALSE(
+            AssignProcessToJobObject(job.get(), GetCurrentProcess()));
+    } catch (const std::exception& e) {
+        LOG(L"Assigning the process job failed: %S", e.what());
+    }
+}
+
+std::optional<std::vector<DWORD>> GetProcessIds() {
+    std::vector<DWORD> processIds;
+    bool jobFound = false;
+
+    for (PCWSTR jobName : {kGlobalJobName, kLocalJobName}) {
+        wil::unique_handle job(OpenJobObject(JOB_OBJECT_QUERY, FALSE, jobName));
+        if (!job) {
+            continue;
+        }
+
+        jobFound = true;
+        AppendProcessIds(job.get(), processIds);
+    }
+
+    if (!jobFound) {
+        return std::nullopt;
+    }
+
+    return processIds;
+}
+
+}  // namespace ProcessJob
@@ -0,0 +1,18 @@
+#pragma once
+
+// A job object which the running Windhawk processes are assigned to, so that
+// they can be found without walking all processes of the system. Each
+// windhawk.exe process assigns itself on startup, and the processes which it
+// starts, such as the UI and the compiler which the UI starts, inherit the
+// job. The job exists as long as any process is assigned to it.
+namespace ProcessJob {
+
+// Failing to assign the process isn't fatal, it's only logged.
+void AssignCurrentProcess() noexcept;
+
+// Returns the IDs of the processes which are assigned to the job, or nullopt
+// if the job doesn't exist, e.g. if an older version is running, in which
+// case the processes should be found another way.
+std::optional<std::vector<DWORD>> GetProcessIds();
+
+}  // namespace ProcessJob
@@ -0,0 +1,154 @@
+#include "stdafx.h"
+
+#include "process_start_monitor.h"
+
+#include "logger.h"
+
+// Only defined for Windows 8 and newer targets.
+#ifndef EVENT_TRACE_USE_MS_FLUSH_TIMER
+#define EVENT_TRACE_USE_MS_FLUSH_TIMER 0x00000010
+#endif
+
+namespace {
+
+constexpr WCHAR kSessionName[] = L"WindhawkProcessStartMonitor";
+
+// Microsoft-Windows-Kernel-Process.
+// {22FB2CD6-0E7B-422B-A0C7-2FAD1FD0E716}
+constexpr GUID kKernelProcessProviderGuid = {
+    0x22fb2cd6,
+    0x0e7b,
+    0x422b,
+    {0xa0, 0xc7, 0x2f, 0xad, 0x1f, 0xd0, 0xe7, 0x16}};
+
+// WINEVENT_KEYWORD_PROCESS of the provider.
+constexpr ULONGLONG kKernelProcessKeywordProcess = 0x10;
+
+// ProcessStart event of the provider.
+constexpr USHORT kProcessStartEventId = 1;
+
+// Events are delivered once a buffer is flushed. The events are small and rare,
+// so a short flush interval costs very little.
+constexpr ULONG kFlushTimerMs = 10;
+
+struct SessionProperties {
+    EVENT_TRACE_PROPERTIES properties;
+    WCHAR loggerName[ARRAYSIZE(kSessionName)];
+};
+
+SessionProperties MakeSessionProperties() {
+    SessionProperties sessionProperties{};
+    auto& properties = sessionProperties.properties;
+    properties.Wnode.BufferSize = sizeof(sessionProperties);
+    properties.Wnode.Flags = WNODE_FLAG_TRACED_GUID;
+    properties.Wnode.ClientContext = 1;  // QueryPerformanceCounter
+    properties.LogFileMode =
+        EVENT_TRACE_REAL_TIME_MODE | EVENT_TRACE_USE_MS_FLUSH_TIMER;
+    properties.FlushTimer = kFlushTimerMs;
+    properties.LoggerNameOffset = offsetof(SessionProperties, loggerName);
+    return sessionProperties;
+}
+
+}  // namespace
+
+ProcessStartMonitor::ProcessStartMonitor() {
+    if (!IsWindows8OrGreater()) {
+        throw std::runtime_error("Windows 8 or newer is required");
+    }
+
+    m_event.reset(CreateEvent(nullptr, FALSE, FALSE, nullptr));
+    THROW_LAST_ERROR_IF_NULL(m_event);
+
+    auto sessionProperties = MakeSessionProperties();
+    ULONG error = StartTrace(&m_sessionHandle, kSessionName,
+                             &sessionProperties.properties);
+    if (error == ERROR_ALREADY_EXISTS) {
+        // ETW sessions outlive their process, so this is most likely a session
+        // left over by an instance which didn't exit cleanly.
+        VERBOSE(L"Stopping an existing process start monitor session");
+
+        sessionProperties = MakeSessionProperties();
+        ControlTrace(0, kSessionName, &sessionProperties.properties,
+                     EVENT_TRACE_CONTROL_STOP);
+
+        sessionProperties = MakeSessionProperties();
+        error = StartTrace(&m_sessionHandle, kSessionName,
+                           &sessionProperties.properties);
+    }
+    THROW_IF_WIN32_ERROR(error);
+
+    auto stopOnError = wil::scope_exit([this] { Stop(); });
+
+    THROW_IF_WIN32_ERROR(EnableTraceEx2(
+        m_sessionHandle, &kKernelProcessProviderGuid,
+        EVENT_CONTROL_CODE_ENABLE_PROVIDER, TRACE_LEVEL_INFORMATION,
+        kKernelProcessKeywordProcess, 0, 0, nullptr));
+
+    EVENT_TRACE_LOGFILE logFile{};
+    logFile.LoggerName = const_cast<PWSTR>(kSessionName);
+    logFile.ProcessTraceMode =
+        PROCESS_TRACE_MODE_REAL_TIME | PROCESS_TRACE_MODE_EVENT_RECORD;
+    logFile.EventRecordCallback = EventRecordCallback;
+    logFile.Context = this;
+
+    m_traceHandle = OpenTrace(&logFile);
+    THROW_LAST_ERROR_IF(m_traceHandle == INVALID_PROCESSTRACE_HANDLE);
+
+    m_traceThread.reset(
+        CreateThread(nullptr, 0, TraceThreadProc, this, 0, nullptr));
+    THROW_LAST_ERROR_IF_NULL(m_traceThread);
+
+    stopOnError.release();
+}
+
+ProcessStartMonitor::~ProcessStartMonitor() {
+    Stop();
+}
+
+HANDLE ProcessStartMonitor::GetEventHandle() const {
+    return m_event.get();
+}
+
+// static
+void WINAPI ProcessStartMonitor::EventRecordCallback(
+    PEVENT_RECORD eventRecord) {
+    if (eventRecord->EventHeader.EventDescriptor.Id != kProcessStartEventId) {
+        return;
+    }
+
+    auto* monitor = static_cast<ProcessStartMonitor*>(eventRecord->UserContext);
+    monitor->m_event.SetEvent();
+}
+
+// static
+DWORD WINAPI ProcessStartMonitor::TraceThreadProc(LPVOID lpParameter) {
+    auto* monitor = static_cast<ProcessStartMonitor*>(lpParameter);
+
+    // Returns once the trace is closed.
+    ULONG error = ProcessTrace(&monitor->m_traceHandle, 1, nullptr, nullptr);
+    if (error != ERROR_SUCCESS && error != ERROR_CANCELLED) {
+        LOG(L"ProcessTrace failed with error %u", error);
+    }
+
+    return 0;
+}
+
+void ProcessStartMonitor::Stop() {
+    if (m_traceHandle != INVALID_PROCESSTRACE_HANDLE) {
+        CloseTrace(m_traceHandle);
+    }
+
+    if (m_sessionHandle) {
+        auto sessionProperties = MakeSessionProperties();
+        ControlTrace(m_sessionHandle, nullptr, &sessionProperties.properties,
+                     EVENT_TRACE_CONTROL_STOP);
+        m_sessionHandle = 0;
+    }
+
+    if (m_traceThread) {
+        WaitForSingleObject(m_traceThread.get(), INFINITE);
+        m_traceThread.reset();
+    }
+
+    m_traceHandle = INVALID_PROCESSTRACE_HANDLE;
+}
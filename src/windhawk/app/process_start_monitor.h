@@ -0,0 +1,30 @@
+#pragma once
+
+// Signals an event as soon as a new process is created, using a real-time ETW
+// session with the kernel process provider. This lets new processes be handled
+// within milliseconds instead of waiting for the next poll. Starting the
+// session requires administrator rights and Windows 8 or newer (for a flush
+// timer shorter than a second), so polling is still needed as a fallback.
+class ProcessStartMonitor {
+   public:
+    ProcessStartMonitor();
+    ~ProcessStartMonitor();
+
+    ProcessStartMonitor(const ProcessStartMonitor&) = delete;
+    ProcessStartMonitor(ProcessStartMonitor&&) = delete;
+    ProcessStartMonitor& operator=(const ProcessStartMonitor&) = delete;
+    ProcessStartMonitor& operator=(ProcessStartMonitor&&) = delete;
+
+    // An auto-reset event, signaled when one or more processes were created.
+    HANDLE GetEventHandle() const;
+
+   private:
+    static void WINAPI EventRecordCallback(PEVENT_RECORD eventRecord);
+    static DWORD WINAPI TraceThreadProc(LPVOID lpParameter);
+    void Stop();
+
+    wil::unique_event m_event;
+    TRACEHANDLE m_sessionHandle = 0;
+    TRACEHANDLE m_traceHandle = INVALID_PROCESSTRACE_HANDLE;
+    wil::unique_handle m_traceThread;
+};
@@ -48,6 +48,12 @@
 #define IDS_SAFE_MODE_TEXT              0x126
 #define IDS_SAFE_MODE_DETECTED_TITLE    0x130
 #define IDS_SAFE_MODE_DETECTED_TEXT     0x131
+#define IDS_TRAY_INJECTION_STATS        0x140
+#define IDS_INJECTION_STATS_TITLE       0x141
+#define IDS_INJECTION_STATS_UNAVAILABLE 0x142
+#define IDS_TASKDLG_COLUMN_LOAD_TIME    0x143
+#define IDS_TASKDLG_COLUMN_CPU          0x144
+#define IDS_NOTIFICATION_UPDATE_READY   0x145
 #define IDC_TASK_LIST                   1001
 #define IDC_TOOLKIT_EXPLANATION         1002
 #define IDC_TOOLKIT_LOADED_MODS         1003
@@ -59,7 +65,7 @@
 // 
 #ifdef APSTUDIO_INVOKED
 #ifndef APSTUDIO_READONLY_SYMBOLS
-#define _APS_NEXT_RESOURCE_VALUE        0x132
+#define _APS_NEXT_RESOURCE_VALUE        0x145
 #define _APS_NEXT_COMMAND_VALUE         32775
 #define _APS_NEXT_CONTROL_VALUE         1007
 #define _APS_NEXT_SYMED_VALUE           101
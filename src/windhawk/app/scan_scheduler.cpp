@@ -0,0 +1,18 @@
+#include "stdafx.h"
+
+#include "scan_scheduler.h"
+
+ScanScheduler::ScanScheduler(bool eventDriven)
+    : m_maxInterval(eventDriven ? kMaxEventDrivenIntervalMs : kMaxIntervalMs) {}
+
+DWORD ScanScheduler::GetInterval() const {
+    return m_interval;
+}
+
+void ScanScheduler::OnScanDone(int injectedCount) {
+    if (injectedCount > 0) {
+        m_interval = kMinIntervalMs;
+    } else {
+        m_interval = std::min(m_interval * 2, m_maxInterval);
+    }
+}
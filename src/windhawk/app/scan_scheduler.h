@@ -0,0 +1,24 @@
+#pragma once
+
+// Decides how long to wait before the next scan for new processes. After each
+// scan which didn't inject into any new process, the interval is doubled up
+// to a maximum, and it's reset to the minimum once a scan injects again, so
+// that an idle machine isn't woken up every second while a burst of new
+// processes is still handled quickly. If new processes are also reported by
+// an event, see ProcessStartMonitor, the scans are only a fallback and the
+// maximum is much higher.
+class ScanScheduler {
+   public:
+    explicit ScanScheduler(bool eventDriven);
+
+    DWORD GetInterval() const;
+    void OnScanDone(int injectedCount);
+
+   private:
+    static constexpr DWORD kMinIntervalMs = 1000;
+    static constexpr DWORD kMaxIntervalMs = 4000;
+    static constexpr DWORD kMaxEventDrivenIntervalMs = 30000;
+
+    DWORD m_maxInterval;
+    DWORD m_interval = kMinIntervalMs;
+};
@@ -3,8 +3,12 @@
 #include "service.h"
 
 #include "engine_control.h"
+#include "event_viewer_crash_monitor.h"
 #include "functions.h"
 #include "logger.h"
+#include "mod_status_reader.h"
+#include "process_start_monitor.h"
+#include "scan_scheduler.h"
 #include "service_common.h"
 #include "storage_manager.h"
 #include "version.h"
@@ -114,6 +118,83 @@ void CreateProcessOnAllSessions(const WCHAR* pszPath, WCHAR* pszCommandLine) {
     }
 }
 
+// Explorer is restarted right after it crashes, so the sessions in which it
+// crashed are the ones with an explorer process which started recently.
+std::vector<DWORD> GetSessionsWithRecentlyStartedExplorer(DWORD maxAge) {
+    WTS_PROCESS_INFO* processInfo;
+    DWORD dwCount;
+
+    THROW_IF_WIN32_BOOL_FALSE(WTSEnumerateProcesses(
+        WTS_CURRENT_SERVER_HANDLE, 0, 1, &processInfo, &dwCount));
+    wil::unique_wtsmem_ptr<WTS_PROCESS_INFO> scopedProcessInfo(processInfo);
+
+    ULONGLONG currentTime =
+        wil::filetime::to_int64(wil::filetime::get_system_time());
+
+    std::vector<DWORD> sessionIds;
+
+    for (DWORD i = 0; i < dwCount; i++) {
+        if (!processInfo[i].pProcessName ||
+            _wcsicmp(processInfo[i].pProcessName, L"explorer.exe") != 0) {
+            continue;
+        }
+
+        wil::unique_process_handle process(
+            OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE,
+                        processInfo[i].ProcessId));
+        if (!process) {
+            continue;
+        }
+
+        FILETIME creationTime, exitTime, kernelTime, userTime;
+        if (!GetProcessTimes(process.get(), &creationTime, &exitTime,
+                             &kernelTime, &userTime)) {
+            continue;
+        }
+
+        ULONGLONG msSinceCreationTime = wil::filetime::convert_100ns_to_msec(
+            currentTime - wil::filetime::to_int64(creationTime));
+        if (msSinceCreationTime <= maxAge &&
+            std::find(sessionIds.begin(), sessionIds.end(),
+                      processInfo[i].SessionId) == sessionIds.end()) {
+            sessionIds.push_back(processInfo[i].SessionId);
+        }
+    }
+
+    return sessionIds;
+}
+
+// Starts the tray in the sessions, which shows the toolkit right away. In a
+// session in which the tray is already running, the new instance exits, and
+// the running one shows the toolkit by itself.
+void ShowToolkitInSessions(const std::vector<DWORD>& sessionIds) {
+    if (sessionIds.empty()) {
+        return;
+    }
+
+    auto settings =
+        StorageManager::GetInstance().GetAppConfig(L"Settings", false);
+    if (settings->GetInt(L"DontAutoShowToolkit").value_or(0)) {
+        return;
+    }
+
+    auto modulePath = wil::GetModuleFileName<std::wstring>();
+
+    for (DWORD sessionId : sessionIds) {
+        VERBOSE(L"Showing the toolkit in session %u", sessionId);
+
+        try {
+            auto commandLine =
+                L"\"" + modulePath + L"\" -tray-only -show-toolkit";
+            CreateProcessOnSessionId(sessionId, modulePath.c_str(),
+                                     commandLine.data());
+        } catch (const std::exception& e) {
+            LOG(L"Showing the toolkit in session %u failed: %S", sessionId,
+                e.what());
+        }
+    }
+}
+
 }  // namespace
 
 class ServiceInstance {
@@ -133,6 +214,13 @@ class ServiceInstance {
     DWORD SvcCtrlHandlerEx(DWORD dwControl,
                            DWORD dwEventType,
                            LPVOID lpEventData);
+    void StartSymbolThreads();
+    void StopSymbolThreads();
+    static DWORD WINAPI SymbolPrefetchThreadProc(LPVOID lpParameter);
+    static DWORD WINAPI SymbolBrokerThreadProc(LPVOID lpParameter);
+    void StartCrashMonitorThread();
+    void StopCrashMonitorThread();
+    static DWORD WINAPI CrashMonitorThreadProc(LPVOID lpParameter);
 
     SERVICE_STATUS_HANDLE m_svcStatusHandle{};
     DWORD m_dwCheckPoint = 1;
@@ -143,7 +231,26 @@ class ServiceInstance {
     wil::unique_event m_svcScanForProcessesEvent;
     wil::unique_event m_svcEmergencyStopEvent;
     wil::unique_event m_svcSafeModeStopEvent;
+    wil::unique_event m_svcPauseModsEvent;
+    wil::unique_event m_svcResumeModsEvent;
+    wil::unique_hpowernotify m_svcDisplayStateNotify;
+    std::atomic<bool> m_connectedStandby = false;
     std::optional<EngineControl> m_engineControl;
+    std::optional<ProcessStartMonitor> m_processStartMonitor;
+    wil::unique_event m_symbolThreadsStopEvent;
+    wil::unique_handle m_symbolPrefetchThread;
+    wil::unique_handle m_symbolBrokerThread;
+    // If set, the tray isn't started in each user session. It's started when
+    // the user runs Windhawk, and by the crash monitor of the service, which
+    // replaces the crash monitoring of the trays, in the sessions in which a
+    // crash happened. Saves a resident process per session on hosts with
+    // many sessions.
+    bool m_launchTrayOnDemand = false;
+    // Set by kControlStopForRestart, the sessions aren't shut down when the
+    // service stops.
+    std::atomic<bool> m_stopForRestart = false;
+    wil::unique_event m_crashMonitorStopEvent;
+    wil::unique_handle m_crashMonitorThread;
 };
 
 //
@@ -241,12 +348,43 @@ VOID ServiceInstance::SvcInit(DWORD dwArgc, LPTSTR* lpszArgv) {
     m_svcSafeModeStopEvent.reset(Functions::CreateEventForMediumIntegrity(
         ServiceCommon::kSafeModeStopEventName, TRUE));
 
+    m_svcPauseModsEvent.reset(Functions::CreateEventForMediumIntegrity(
+        ServiceCommon::kPauseModsEventName, FALSE));
+
+    m_svcResumeModsEvent.reset(Functions::CreateEventForMediumIntegrity(
+        ServiceCommon::kResumeModsEventName, FALSE));
+
+    // On systems which support connected standby, the system enters it when
+    // the display turns off. The display state isn't used on other systems,
+    // where the display might be off while the machine is in use, e.g. a
+    // server with remote sessions.
+    SYSTEM_POWER_CAPABILITIES powerCapabilities{};
+    if (GetPwrCapabilities(&powerCapabilities) && powerCapabilities.AoAc) {
+        m_svcDisplayStateNotify.reset(RegisterPowerSettingNotification(
+            m_svcStatusHandle, &GUID_CONSOLE_DISPLAY_STATE,
+            DEVICE_NOTIFY_SERVICE_HANDLE));
+        if (!m_svcDisplayStateNotify) {
+            LOG(L"RegisterPowerSettingNotification failed with error %u",
+                GetLastError());
+        }
+    }
+
     auto settings =
         StorageManager::GetInstance().GetAppConfig(L"Settings", false);
 
+    m_launchTrayOnDemand =
+        settings->GetInt(L"LaunchTrayOnDemand").value_or(0);
+
     if (!settings->GetInt(L"SafeMode").value_or(0)) {
         m_engineControl.emplace();
         m_engineControl->HandleNewProcesses();
+
+        // Polling is kept as a fallback, see SvcRun.
+        try {
+            m_processStartMonitor.emplace();
+        } catch (const std::exception& e) {
+            LOG(L"Process start monitor isn't available: %S", e.what());
+        }
     }
 }
 
@@ -257,26 +395,54 @@ VOID ServiceInstance::SvcInit(DWORD dwArgc, LPTSTR* lpszArgv) {
 VOID ServiceInstance::SvcRun(DWORD dwArgc, LPTSTR* lpszArgv) {
     // TO_DO: Perform work until service stops.
 
-    try {
-        auto modulePath = wil::GetModuleFileName<std::wstring>();
-        auto commandLine = L"\"" + modulePath + L"\" -tray-only";
-        CreateProcessOnAllSessions(modulePath.c_str(), commandLine.data());
-    } catch (const std::exception& e) {
-        LOG(L"CreateProcessOnAllSessions failed: %S", e.what());
+    if (m_launchTrayOnDemand) {
+        StartCrashMonitorThread();
+    } else {
+        try {
+            auto modulePath = wil::GetModuleFileName<std::wstring>();
+            auto commandLine = L"\"" + modulePath + L"\" -tray-only";
+            CreateProcessOnAllSessions(modulePath.c_str(), commandLine.data());
+        } catch (const std::exception& e) {
+            LOG(L"CreateProcessOnAllSessions failed: %S", e.what());
+        }
     }
 
+    auto crashMonitorThreadCleanup =
+        wil::scope_exit([this] { StopCrashMonitorThread(); });
+
+    StartSymbolThreads();
+    auto symbolThreadsCleanup =
+        wil::scope_exit([this] { StopSymbolThreads(); });
+
+    auto processStartMonitorCleanup =
+        wil::scope_exit([this] { m_processStartMonitor.reset(); });
+
+    // The process start monitor event must be last, since it's optional.
     HANDLE events[] = {
         m_svcStopEvent.get(),
         m_svcScanForProcessesEvent.get(),
         m_svcEmergencyStopEvent.get(),
         m_svcSafeModeStopEvent.get(),
+        m_svcPauseModsEvent.get(),
+        m_svcResumeModsEvent.get(),
+        m_processStartMonitor ? m_processStartMonitor->GetEventHandle()
+                              : nullptr,
     };
+    DWORD eventsCount = m_processStartMonitor ? ARRAYSIZE(events)
+                                              : ARRAYSIZE(events) - 1;
+
+    ScanScheduler scanScheduler(m_processStartMonitor.has_value());
 
     while (true) {
         bool keepLooping = false;
 
-        DWORD dwWaitResult = WaitForMultipleObjectsEx(ARRAYSIZE(events), events,
-                                                      FALSE, 1000, FALSE);
+        // Nothing is polled in connected standby, processes which are
+        // reported by the process start monitor are still handled.
+        DWORD timeout =
+            m_connectedStandby ? INFINITE : scanScheduler.GetInterval();
+
+        DWORD dwWaitResult = WaitForMultipleObjectsEx(eventsCount, events,
+                                                      FALSE, timeout, FALSE);
         switch (dwWaitResult) {
             case WAIT_FAILED:
                 THROW_LAST_ERROR();
@@ -313,17 +479,41 @@ VOID ServiceInstance::SvcRun(DWORD dwArgc, LPTSTR* lpszArgv) {
                 break;
             }
 
+            case WAIT_OBJECT_0 + 4:
+            case WAIT_OBJECT_0 + 5: {
+                bool paused = dwWaitResult == WAIT_OBJECT_0 + 4;
+                LOG(L"Received %s mods event", paused ? L"pause" : L"resume");
+
+                if (m_engineControl) {
+                    m_engineControl->SetModsPaused(paused);
+                }
+
+                keepLooping = true;
+                break;
+            }
+
+            case WAIT_OBJECT_0 + 6:
+                // A new process was started, no logging since it's frequent.
+                keepLooping = true;
+                break;
+
             default:
                 LOG(L"Received unknown event %u", dwWaitResult);
                 break;
         }
 
         if (!keepLooping) {
+            if (m_engineControl && !m_stopForRestart) {
+                m_engineControl->Shutdown();
+            }
+
             break;
         }
 
         if (m_engineControl) {
-            m_engineControl->HandleNewProcesses();
+            int injectedCount = 0;
+            m_engineControl->HandleNewProcesses(&injectedCount);
+            scanScheduler.OnScanDone(injectedCount);
         }
     }
 }
@@ -355,7 +545,8 @@ VOID ServiceInstance::ReportSvcStatus(DWORD dwCurrentState,
     SvcStatus.dwWin32ExitCode = dwWin32ExitCode;
     SvcStatus.dwWaitHint = dwWaitHint;
 
-    SvcStatus.dwControlsAccepted = SERVICE_ACCEPT_SESSIONCHANGE;
+    SvcStatus.dwControlsAccepted =
+        SERVICE_ACCEPT_SESSIONCHANGE | SERVICE_ACCEPT_POWEREVENT;
     if (dwCurrentState != SERVICE_START_PENDING)
         SvcStatus.dwControlsAccepted |= SERVICE_ACCEPT_STOP;
 
@@ -389,6 +580,10 @@ DWORD ServiceInstance::SvcCtrlHandlerEx(DWORD dwControl,
     // Handle the requested control code.
 
     switch (dwControl) {
+        case ServiceCommon::kControlStopForRestart:
+            VERBOSE("Handling kControlStopForRestart");
+            m_stopForRestart = true;
+            [[fallthrough]];
         case SERVICE_CONTROL_STOP:
             VERBOSE("Handling SERVICE_CONTROL_STOP");
 
@@ -402,6 +597,11 @@ DWORD ServiceInstance::SvcCtrlHandlerEx(DWORD dwControl,
             if (dwEventType == WTS_SESSION_LOGON) {
                 VERBOSE("Handling WTS_SESSION_LOGON");
 
+                // A logon starts many processes in the new session, scan
+                // right away instead of waiting for a poll which might be
+                // backed off on an idle host.
+                SetEvent(m_svcScanForProcessesEvent.get());
+
                 try {
                     auto sessionNotification =
                         reinterpret_cast<const WTSSESSION_NOTIFICATION*>(
@@ -415,7 +615,7 @@ DWORD ServiceInstance::SvcCtrlHandlerEx(DWORD dwControl,
                         &pszUserName, &dwUserNameLen));
                     wil::unique_wtsmem_ptr<WCHAR> scopedUserName(pszUserName);
 
-                    if (*pszUserName != L'\0') {
+                    if (*pszUserName != L'\0' && !m_launchTrayOnDemand) {
                         auto modulePath =
                             wil::GetModuleFileName<std::wstring>();
                         auto commandLine =
@@ -430,6 +630,29 @@ DWORD ServiceInstance::SvcCtrlHandlerEx(DWORD dwControl,
             }
             return NO_ERROR;
 
+        case SERVICE_CONTROL_POWEREVENT:
+            if (dwEventType == PBT_POWERSETTINGCHANGE) {
+                auto setting =
+                    reinterpret_cast<const POWERBROADCAST_SETTING*>(
+                        lpEventData);
+                if (IsEqualGUID(setting->PowerSetting,
+                                GUID_CONSOLE_DISPLAY_STATE) &&
+                    setting->DataLength == sizeof(DWORD)) {
+                    // The display state is off (0), on (1) or dimmed (2).
+                    bool connectedStandby =
+                        *reinterpret_cast<const DWORD*>(setting->Data) == 0;
+                    if (m_connectedStandby.exchange(connectedStandby) !=
+                        connectedStandby) {
+                        VERBOSE(L"Connected standby: %d", connectedStandby);
+
+                        // Wake up the service loop to apply the change, and
+                        // to scan right away when leaving connected standby.
+                        SetEvent(m_svcScanForProcessesEvent.get());
+                    }
+                }
+            }
+            return NO_ERROR;
+
         case SERVICE_CONTROL_INTERROGATE:
             return NO_ERROR;
 
@@ -438,6 +661,269 @@ DWORD ServiceInstance::SvcCtrlHandlerEx(DWORD dwControl,
     }
 }
 
+void ServiceInstance::StartSymbolThreads() {
+    if (!m_engineControl) {
+        return;
+    }
+
+    try {
+        m_symbolThreadsStopEvent.reset(
+            CreateEvent(nullptr, TRUE, FALSE, nullptr));
+        THROW_LAST_ERROR_IF_NULL(m_symbolThreadsStopEvent);
+
+        m_symbolPrefetchThread.reset(CreateThread(
+            nullptr, 0, SymbolPrefetchThreadProc, this, 0, nullptr));
+        THROW_LAST_ERROR_IF_NULL(m_symbolPrefetchThread);
+
+        m_symbolBrokerThread.reset(CreateThread(
+            nullptr, 0, SymbolBrokerThreadProc, this, 0, nullptr));
+        THROW_LAST_ERROR_IF_NULL(m_symbolBrokerThread);
+    } catch (const std::exception& e) {
+        LOG(L"Starting the symbol threads failed: %S", e.what());
+    }
+}
+
+void ServiceInstance::StopSymbolThreads() {
+    if (!m_symbolThreadsStopEvent) {
+        return;
+    }
+
+    VERBOSE(L"Stopping the symbol threads");
+
+    m_symbolThreadsStopEvent.SetEvent();
+
+    for (auto* thread : {&m_symbolPrefetchThread, &m_symbolBrokerThread}) {
+        if (*thread) {
+            WaitForSingleObject(thread->get(), INFINITE);
+            thread->reset();
+        }
+    }
+}
+
+// static
+DWORD WINAPI ServiceInstance::SymbolPrefetchThreadProc(LPVOID lpParameter) {
+    auto serviceInstance = reinterpret_cast<ServiceInstance*>(lpParameter);
+
+    // Give the system and the mods time to start up first, since they need the
+    // disk and the network the most right after boot, which is also when
+    // updated modules are first loaded.
+    constexpr DWORD kInitialDelay = 2 * 60 * 1000;
+
+    // Modules are rarely updated while the system is running, and a run in
+    // which all symbols are already available is cheap.
+    constexpr DWORD kInterval = 60 * 60 * 1000;
+
+    // Use a low CPU, I/O and memory priority, so that symbol downloads and
+    // indexing don't compete with the user's work.
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+
+    // After a mod is installed or updated, prefetch the symbols of its target
+    // modules right away instead of at the next periodic run. The delay lets
+    // the rest of the install, which writes several values, complete first.
+    constexpr DWORD kModsChangeDelay = 10 * 1000;
+
+    HANDLE stopEvent = serviceInstance->m_symbolThreadsStopEvent.get();
+    HANDLE modsChangeEvent =
+        serviceInstance->m_engineControl->GetSymbolPrefetchModsChangeEvent();
+
+    DWORD delay = kInitialDelay;
+    while (true) {
+        // Changes during the initial delay are covered by the first run.
+        HANDLE waitHandles[] = {stopEvent, modsChangeEvent};
+        DWORD waitHandleCount =
+            modsChangeEvent && delay != kInitialDelay ? 2 : 1;
+        DWORD waitResult = WaitForMultipleObjects(waitHandleCount, waitHandles,
+                                                  FALSE, delay);
+        if (waitResult == WAIT_OBJECT_0 + 1) {
+            if (WaitForSingleObject(stopEvent, kModsChangeDelay) !=
+                WAIT_TIMEOUT) {
+                break;
+            }
+
+            // Re-armed before the run, so that changes made during the run
+            // trigger another one.
+            serviceInstance->m_engineControl
+                ->ContinueSymbolPrefetchMonitoring();
+        } else if (waitResult != WAIT_TIMEOUT) {
+            break;
+        }
+
+        serviceInstance->m_engineControl->PrefetchSymbols(stopEvent);
+        delay = kInterval;
+    }
+
+    return 0;
+}
+
+// static
+DWORD WINAPI ServiceInstance::SymbolBrokerThreadProc(LPVOID lpParameter) {
+    auto serviceInstance = reinterpret_cast<ServiceInstance*>(lpParameter);
+
+    // Target processes wait for the requests, so unlike prefetching, they're
+    // handled with a normal priority.
+    serviceInstance->m_engineControl->RunSymbolBroker(
+        serviceInstance->m_symbolThreadsStopEvent.get());
+
+    return 0;
+}
+
+void ServiceInstance::StartCrashMonitorThread() {
+    // Without the engine, no mods are loaded and there's nothing to monitor.
+    if (!m_engineControl) {
+        return;
+    }
+
+    try {
+        m_crashMonitorStopEvent.reset(
+            CreateEvent(nullptr, TRUE, FALSE, nullptr));
+        THROW_LAST_ERROR_IF_NULL(m_crashMonitorStopEvent);
+
+        m_crashMonitorThread.reset(CreateThread(
+            nullptr, 0, CrashMonitorThreadProc, this, 0, nullptr));
+        THROW_LAST_ERROR_IF_NULL(m_crashMonitorThread);
+    } catch (const std::exception& e) {
+        LOG(L"Starting the crash monitor thread failed: %S", e.what());
+    }
+}
+
+void ServiceInstance::StopCrashMonitorThread() {
+    if (!m_crashMonitorThread) {
+        return;
+    }
+
+    VERBOSE(L"Stopping the crash monitor thread");
+
+    m_crashMonitorStopEvent.SetEvent();
+    WaitForSingleObject(m_crashMonitorThread.get(), INFINITE);
+    m_crashMonitorThread.reset();
+}
+
+// static
+DWORD WINAPI ServiceInstance::CrashMonitorThreadProc(LPVOID lpParameter) {
+    auto serviceInstance = reinterpret_cast<ServiceInstance*>(lpParameter);
+
+    // The same as in CMainWindow, which monitors the crashes if the tray is
+    // running.
+    constexpr DWORD kExplorerSecondCrashMaxPeriod = 1000 * 60;
+
+    // Explorer is usually restarted within a few seconds after it crashes.
+    constexpr DWORD kExplorerRestartDelay = 5000;
+
+    HANDLE stopEvent = serviceInstance->m_crashMonitorStopEvent.get();
+
+    std::optional<EventViewerCrashMonitor> explorerCrashMonitor;
+    try {
+        explorerCrashMonitor.emplace(wil::GetWindowsDirectory<std::wstring>() +
+                                     L"\\explorer.exe");
+    } catch (const std::exception& e) {
+        LOG(L"Explorer crash monitor failed: %S", e.what());
+    }
+
+    std::optional<ModStatusReader> crashLoopNotification;
+    try {
+        crashLoopNotification.emplace(GetCurrentProcessId(),
+                                      ModStatusReader::Kind::kCrashLoop);
+    } catch (const std::exception& e) {
+        LOG(L"Crash loop ChangeNotification failed: %S", e.what());
+    }
+
+    ULONGLONG explorerLastTerminatedTickCount = 0;
+    ULONGLONG crashLoopLastHandledTime = 0;
+
+    while (explorerCrashMonitor || crashLoopNotification) {
+        HANDLE explorerCrashedEvent =
+            explorerCrashMonitor ? explorerCrashMonitor->GetEventHandle()
+                                 : nullptr;
+        HANDLE crashLoopDetectedEvent =
+            crashLoopNotification ? crashLoopNotification->GetHandle()
+                                  : nullptr;
+
+        HANDLE events[3];
+        DWORD eventsCount = 0;
+        events[eventsCount++] = stopEvent;
+        for (HANDLE event : {explorerCrashedEvent, crashLoopDetectedEvent}) {
+            if (event) {
+                events[eventsCount++] = event;
+            }
+        }
+
+        DWORD dwWaitResult =
+            WaitForMultipleObjects(eventsCount, events, FALSE, INFINITE);
+        if (dwWaitResult == WAIT_FAILED) {
+            LOG(L"WaitForMultipleObjects failed: %u", GetLastError());
+            break;
+        }
+
+        if (dwWaitResult == WAIT_OBJECT_0) {
+            break;
+        }
+
+        HANDLE signaledEvent = events[dwWaitResult - WAIT_OBJECT_0];
+        std::vector<DWORD> sessionIds;
+
+        try {
+            if (signaledEvent == explorerCrashedEvent) {
+                int explorerCrashCount =
+                    explorerCrashMonitor->GetAmountOfNewEvents();
+                VERBOSE(L"Detected %d explorer crashes", explorerCrashCount);
+
+                ULONGLONG currentTickCount = GetTickCount64();
+                if (explorerCrashCount >= 2 ||
+                    currentTickCount - explorerLastTerminatedTickCount <=
+                        kExplorerSecondCrashMaxPeriod) {
+                    if (WaitForSingleObject(stopEvent, kExplorerRestartDelay) ==
+                        WAIT_OBJECT_0) {
+                        break;
+                    }
+
+                    sessionIds = GetSessionsWithRecentlyStartedExplorer(
+                        kExplorerSecondCrashMaxPeriod);
+                }
+
+                explorerLastTerminatedTickCount = currentTickCount;
+            } else {
+                crashLoopNotification->ContinueMonitoring();
+
+                ULONGLONG lastHandledTime = crashLoopLastHandledTime;
+                for (const auto& item : crashLoopNotification->Read()) {
+                    if (item.creationTime <= lastHandledTime) {
+                        continue;
+                    }
+
+                    LOG(L"Mods aren't loaded in %s (%u) after repeated "
+                        L"crashes",
+                        item.value.c_str(), item.processId);
+                    crashLoopLastHandledTime =
+                        std::max(crashLoopLastHandledTime, item.creationTime);
+
+                    DWORD sessionId;
+                    if (ProcessIdToSessionId(item.processId, &sessionId) &&
+                        std::find(sessionIds.begin(), sessionIds.end(),
+                                  sessionId) == sessionIds.end()) {
+                        sessionIds.push_back(sessionId);
+                    }
+                }
+            }
+        } catch (const std::exception& e) {
+            LOG(L"Crash handling failed: %S", e.what());
+            if (signaledEvent == explorerCrashedEvent) {
+                explorerCrashMonitor.reset();
+            } else {
+                crashLoopNotification.reset();
+            }
+            continue;
+        }
+
+        try {
+            ShowToolkitInSessions(sessionIds);
+        } catch (const std::exception& e) {
+            LOG(L"Showing the toolkit failed: %S", e.what());
+        }
+    }
+
+    return 0;
+}
+
 VOID WINAPI SvcMain(DWORD dwArgc, LPTSTR* lpszArgv) {
     try {
         ServiceInstance serviceInstance;
@@ -604,4 +1090,35 @@ void Stop(bool disableAutoStart) {
     }
 }
 
+void StopForRestart() {
+    wil::unique_schandle scManager(
+        OpenSCManager(nullptr,  // local computer
+                      nullptr,  // ServicesActive database
+                      0));
+    THROW_LAST_ERROR_IF_NULL(scManager);
+
+    wil::unique_schandle service(
+        OpenService(scManager.get(), ServiceCommon::kName,
+                    SERVICE_STOP | SERVICE_USER_DEFINED_CONTROL));
+    THROW_LAST_ERROR_IF_NULL(service);
+
+    SERVICE_STATUS serviceStatus;
+    if (ControlService(service.get(), ServiceCommon::kControlStopForRestart,
+                       &serviceStatus)) {
+        return;
+    }
+
+    DWORD error = GetLastError();
+    if (error == ERROR_SERVICE_NOT_ACTIVE) {
+        return;
+    }
+
+    // E.g. an older version of the service, which doesn't handle the control
+    // code, the sessions are then shut down as usual.
+    VERBOSE(L"kControlStopForRestart failed with error %u", error);
+    if (!ControlService(service.get(), SERVICE_CONTROL_STOP, &serviceStatus)) {
+        THROW_LAST_ERROR_IF(GetLastError() != ERROR_SERVICE_NOT_ACTIVE);
+    }
+}
+
 }  // namespace Service
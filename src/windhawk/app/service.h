@@ -6,5 +6,8 @@ void Run();
 bool IsRunning(bool waitIfStarting);
 void Start();
 void Stop(bool disableAutoStart);
+// Stops the service without shutting down the running sessions, which the
+// service takes over once it's started again.
+void StopForRestart();
 
 }  // namespace Service
@@ -18,6 +18,18 @@ static inline constexpr WCHAR kEmergencyStopEventName[] =
 static inline constexpr WCHAR kSafeModeStopEventName[] =
     L"Global\\WindhawkServiceSafeModeStopEvent";
 
+// Disable or enable the hooks of all mods without unloading them.
+static inline constexpr WCHAR kPauseModsEventName[] =
+    L"Global\\WindhawkServicePauseModsEvent";
+
+static inline constexpr WCHAR kResumeModsEventName[] =
+    L"Global\\WindhawkServiceResumeModsEvent";
+
+// A user-defined service control code, which stops the service like
+// SERVICE_CONTROL_STOP, but leaves the running sessions for the next instance
+// of the service to take over, instead of shutting them down.
+static inline constexpr DWORD kControlStopForRestart = 128;
+
 struct ServiceInfo {
     DWORD version;
     DWORD processId;
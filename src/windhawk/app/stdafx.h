@@ -38,14 +38,19 @@ extern CAppModule _Module;
 //////////////////////////////////////////////////////////////////////////
 // Windows
 
+#include <bcrypt.h>
 #include <comutil.h>
+#include <evntcons.h>
+#include <evntrace.h>
 #include <intsafe.h>
 #include <objbase.h>
+#include <powrprof.h>
 #include <sddl.h>
 #include <shobjidl.h>
 #include <taskschd.h>
 #include <tlhelp32.h>
 #include <userenv.h>
+#include <versionhelpers.h>
 #include <winevt.h>
 #include <winhttp.h>
 #include <wtsapi32.h>
@@ -62,7 +67,9 @@ extern CAppModule _Module;
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <random>
 #include <ranges>
+#include <span>
 #include <string>
 #include <variant>
 
@@ -0,0 +1,232 @@
+#include "stdafx.h"
+
+#include "targeting_dry_run.h"
+
+#include "mod_status_reader.h"
+#include "storage_manager.h"
+
+using json = nlohmann::ordered_json;
+
+namespace {
+
+// Much longer than the names of all installed mods.
+constexpr size_t kModNamesMaxLength = 64 * 1024;
+
+struct ModCounts {
+    // Processes in which the mod would be loaded.
+    size_t processes = 0;
+    // Processes which the mod targets, but which the engine isn't injected
+    // into due to the app settings.
+    size_t excludedProcesses = 0;
+    // The amount of processes by file name, of the processes in which the mod
+    // would be loaded.
+    std::map<std::wstring, size_t> processNames;
+};
+
+class EngineDryRun {
+   public:
+    EngineDryRun() {
+        auto engineLibraryPath =
+            StorageManager::GetInstance().GetEnginePath() / L"windhawk.dll";
+
+        m_engineModule.reset(LoadLibrary(engineLibraryPath.c_str()));
+        THROW_LAST_ERROR_IF_NULL(m_engineModule);
+
+        auto pTargetingDryRunOpen = reinterpret_cast<TARGETING_DRY_RUN_OPEN>(
+            GetProcAddress(m_engineModule.get(), "TargetingDryRunOpen"));
+        THROW_LAST_ERROR_IF_NULL(pTargetingDryRunOpen);
+
+        m_pTargetingDryRunEvaluate =
+            reinterpret_cast<TARGETING_DRY_RUN_EVALUATE>(GetProcAddress(
+                m_engineModule.get(), "TargetingDryRunEvaluate"));
+        THROW_LAST_ERROR_IF_NULL(m_pTargetingDryRunEvaluate);
+
+        m_pTargetingDryRunClose = reinterpret_cast<TARGETING_DRY_RUN_CLOSE>(
+            GetProcAddress(m_engineModule.get(), "TargetingDryRunClose"));
+        THROW_LAST_ERROR_IF_NULL(m_pTargetingDryRunClose);
+
+        m_dryRun = pTargetingDryRunOpen();
+        if (!m_dryRun) {
+            throw std::runtime_error("Reading the mod targets failed");
+        }
+    }
+
+    ~EngineDryRun() { m_pTargetingDryRunClose(m_dryRun); }
+
+    EngineDryRun(const EngineDryRun&) = delete;
+    EngineDryRun& operator=(const EngineDryRun&) = delete;
+
+    // Returns false if the process couldn't be evaluated, e.g. if it exited.
+    bool Evaluate(HANDLE process, bool* excluded, std::wstring* modNames) {
+        auto buffer = std::make_unique<WCHAR[]>(kModNamesMaxLength);
+        BOOL excludedResult;
+        if (!m_pTargetingDryRunEvaluate(m_dryRun, process, &excludedResult,
+                                        buffer.get(), kModNamesMaxLength)) {
+            return false;
+        }
+
+        *excluded = !!excludedResult;
+        *modNames = buffer.get();
+        return true;
+    }
+
+   private:
+    using TARGETING_DRY_RUN_OPEN = HANDLE (*)();
+    using TARGETING_DRY_RUN_EVALUATE = BOOL (*)(HANDLE hDryRun,
+                                                HANDLE hProcess,
+                                                BOOL* pbExcluded,
+                                                PWSTR pszModNames,
+                                                SIZE_T cchModNames);
+    using TARGETING_DRY_RUN_CLOSE = BOOL (*)(HANDLE hDryRun);
+
+    wil::unique_hmodule m_engineModule;
+    TARGETING_DRY_RUN_EVALUATE m_pTargetingDryRunEvaluate;
+    TARGETING_DRY_RUN_CLOSE m_pTargetingDryRunClose;
+    HANDLE m_dryRun;
+};
+
+// The total load time of each instance of each mod, the leading number of
+// the published value.
+std::map<std::wstring, std::vector<double>> GetLoadTimesByModName(
+    DWORD sessionManagerProcessId) {
+    std::map<std::wstring, std::vector<double>> loadTimesByModName;
+
+    ModStatusReader reader(sessionManagerProcessId,
+                           ModStatusReader::Kind::kLoadTimes);
+    for (const auto& item : reader.Read()) {
+        if (item.value.empty()) {
+            continue;
+        }
+
+        loadTimesByModName[item.modName].push_back(
+            wcstod(item.value.c_str(), nullptr));
+    }
+
+    for (auto& [modName, values] : loadTimesByModName) {
+        std::sort(values.begin(), values.end());
+    }
+
+    return loadTimesByModName;
+}
+
+std::string ToUtf8(const std::wstring& str) {
+    return std::string(CW2A(str.c_str(), CP_UTF8));
+}
+
+}  // namespace
+
+namespace TargetingDryRun {
+
+std::string GetJson(DWORD sessionManagerProcessId) {
+    EngineDryRun engineDryRun;
+
+    size_t evaluatedProcesses = 0;
+    size_t inaccessibleProcesses = 0;
+    size_t excludedProcesses = 0;
+    size_t targetedProcesses = 0;
+    std::map<std::wstring, ModCounts> countsByModName;
+
+    wil::unique_handle snapshot(
+        CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0));
+    THROW_LAST_ERROR_IF(!snapshot || snapshot.get() == INVALID_HANDLE_VALUE);
+
+    DWORD currentProcessId = GetCurrentProcessId();
+
+    PROCESSENTRY32 entry = {sizeof(PROCESSENTRY32)};
+    for (BOOL hasEntry = Process32First(snapshot.get(), &entry); hasEntry;
+         hasEntry = Process32Next(snapshot.get(), &entry)) {
+        // The idle and system processes, and the current process.
+        if (entry.th32ProcessID <= 4 ||
+            entry.th32ProcessID == currentProcessId) {
+            continue;
+        }
+
+        wil::unique_process_handle process(OpenProcess(
+            PROCESS_QUERY_LIMITED_INFORMATION, FALSE, entry.th32ProcessID));
+        bool excluded;
+        std::wstring modNames;
+        if (!process ||
+            !engineDryRun.Evaluate(process.get(), &excluded, &modNames)) {
+            inaccessibleProcesses++;
+            continue;
+        }
+
+        evaluatedProcesses++;
+        if (excluded) {
+            excludedProcesses++;
+        } else if (!modNames.empty()) {
+            targetedProcesses++;
+        }
+
+        for (size_t start = 0; start < modNames.length();) {
+            size_t end = modNames.find(L'|', start);
+            if (end == modNames.npos) {
+                end = modNames.length();
+            }
+
+            auto& counts = countsByModName[modNames.substr(start, end - start)];
+            if (excluded) {
+                counts.excludedProcesses++;
+            } else {
+                counts.processes++;
+                counts.processNames[entry.szExeFile]++;
+            }
+
+            start = end + 1;
+        }
+    }
+
+    std::map<std::wstring, std::vector<double>> loadTimesByModName;
+    if (sessionManagerProcessId) {
+        try {
+            loadTimesByModName = GetLoadTimesByModName(sessionManagerProcessId);
+        } catch (const std::exception& e) {
+            LOG(L"Reading the load times failed: %S", e.what());
+        }
+    }
+
+    auto mods = json::object();
+    for (const auto& [modName, counts] : countsByModName) {
+        json mod = {
+            {"processes", counts.processes},
+            {"excludedProcesses", counts.excludedProcesses},
+            {"processNames", json::object()},
+        };
+
+        for (const auto& [processName, count] : counts.processNames) {
+            mod["processNames"][ToUtf8(processName)] = count;
+        }
+
+        // Measured in the processes in which the mod is loaded now. The
+        // estimate is for loading the mod into all of its processes once.
+        auto it = loadTimesByModName.find(modName);
+        if (it != loadTimesByModName.end()) {
+            const auto& values = it->second;
+            double p50 = values[(values.size() - 1) / 2];
+            mod["loadTimeMs"] = {
+                {"measuredInstances", values.size()},
+                {"p50", p50},
+                {"max", values.back()},
+                {"estimatedTotal", p50 * counts.processes},
+            };
+        }
+
+        mods[ToUtf8(modName)] = std::move(mod);
+    }
+
+    json result = {
+        {"version", 1},
+        {"processes",
+         {
+             {"evaluated", evaluatedProcesses},
+             {"inaccessible", inaccessibleProcesses},
+             {"excluded", excludedProcesses},
+             {"targeted", targetedProcesses},
+         }},
+        {"mods", std::move(mods)},
+    };
+
+    return result.dump(2) + "\n";
+}
+
+}  // namespace TargetingDryRun
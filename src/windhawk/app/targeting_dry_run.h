@@ -0,0 +1,15 @@
+#pragma once
+
+// Reports which running processes each enabled mod would be loaded into, as a
+// single JSON object, without injecting into them. The targeting is evaluated
+// by the engine library with the same checks as the session manager, and the
+// load times which the engines publish are used to estimate the cost of
+// loading each mod into all of its processes. The names are stable, so that
+// the output can be consumed by tools.
+namespace TargetingDryRun {
+
+// If the session manager isn't running, sessionManagerProcessId is zero and
+// the load times are omitted. Returns UTF-8 JSON.
+std::string GetJson(DWORD sessionManagerProcessId);
+
+}  // namespace TargetingDryRun
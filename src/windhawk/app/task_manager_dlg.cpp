@@ -4,7 +4,6 @@
 
 #include "functions.h"
 #include "logger.h"
-#include "storage_manager.h"
 
 namespace {
 
@@ -13,15 +12,57 @@ constexpr auto kRefreshListOnDataChangeDelay = 200;
 
 constexpr auto kUpdateProcessesStatusInterval = 1000;
 
-struct ListItemData {
-    std::wstring filePath;
-    std::wstring processName;
-    DWORD processId = 0;
-    ULONGLONG creationTime = 0;
-    bool isFrozen = false;
-    wil::unique_process_handle executionRequiredRequestProcess;
-    wil::unique_handle executionRequiredRequest;
-};
+// Engine metrics records have no mod name.
+constexpr WCHAR kEngineMetricsModName[] = L"Windhawk";
+
+constexpr int kLoadTimeColumn = 3;
+constexpr int kCpuUsageColumn = 4;
+
+std::wstring MakeModInstanceKey(DWORD processId, const std::wstring& modName) {
+    return std::to_wstring(processId) + L'|' + modName;
+}
+
+// Values of records which are shown alongside the status records of the same
+// mod instances, by MakeModInstanceKey.
+using ValuesByModInstance = std::unordered_map<std::wstring, std::wstring>;
+
+ValuesByModInstance ReadValuesByModInstance(
+    std::optional<ModStatusReader>& reader) {
+    ValuesByModInstance values;
+    if (reader) {
+        reader->ContinueMonitoring();
+        for (auto& item : reader->Read()) {
+            values.try_emplace(MakeModInstanceKey(item.processId, item.modName),
+                               std::move(item.value));
+        }
+    }
+
+    return values;
+}
+
+// The values start with a number, which is used for sorting. Returns whether
+// the value changed.
+bool UpdateNumericValue(const ValuesByModInstance& values,
+                        const std::wstring& key,
+                        std::wstring* value,
+                        double* number) {
+    std::wstring newValue;
+    if (auto it = values.find(key); it != values.end()) {
+        newValue = it->second;
+    }
+
+    if (newValue == *value) {
+        return false;
+    }
+
+    *number = wcstod(newValue.c_str(), nullptr);
+    *value = std::move(newValue);
+    return true;
+}
+
+int CompareNumbers(double a, double b) {
+    return a < b ? -1 : a > b ? 1 : 0;
+}
 
 bool CanShowDialog() {
     QUERY_USER_NOTIFICATION_STATE pquns;
@@ -41,36 +82,6 @@ bool CanShowDialog() {
     return true;
 }
 
-std::wstring GetMetadataContent(PCWSTR filePath, FILETIME* pCreationTime) {
-    wil::unique_hfile file(
-        CreateFile(filePath, GENERIC_READ,
-                   FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
-                   nullptr, OPEN_EXISTING, 0, nullptr));
-    THROW_LAST_ERROR_IF(!file);
-
-    LARGE_INTEGER fileSizeLarge;
-    THROW_IF_WIN32_BOOL_FALSE(GetFileSizeEx(file.get(), &fileSizeLarge));
-
-    DWORD fileSize = 0;
-    if (fileSizeLarge.QuadPart <= DWORD_MAX ||
-        (fileSizeLarge.QuadPart % sizeof(WCHAR)) == 0) {
-        fileSize = static_cast<DWORD>(fileSizeLarge.QuadPart);
-    }
-
-    std::wstring fileContents(fileSize / sizeof(WCHAR), L'\0');
-
-    DWORD numberOfBytesRead;
-    THROW_IF_WIN32_BOOL_FALSE(ReadFile(file.get(), fileContents.data(),
-                                       fileSize, &numberOfBytesRead, nullptr));
-
-    if (pCreationTime) {
-        THROW_IF_WIN32_BOOL_FALSE(
-            GetFileTime(file.get(), pCreationTime, nullptr, nullptr));
-    }
-
-    return fileContents;
-}
-
 std::wstring LocalizeStatus(PCWSTR status) {
     static const std::unordered_map<std::wstring_view, UINT> translation = {
         {L"Pending...", IDS_TASKDLG_STATUS_PENDING},
@@ -103,49 +114,24 @@ std::wstring LocalizeStatus(PCWSTR status) {
     return status;
 }
 
-bool IsProcessFrozen(DWORD processId) {
-    wil::unique_process_handle process(
-        OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, processId));
-    if (!process) {
-        return false;
+// A single snapshot for all items, there can be thousands of them.
+std::vector<DWORD> GetFrozenProcessIds() {
+    try {
+        return Functions::GetFrozenProcessIds();
+    } catch (const std::exception& e) {
+        LOG(L"Getting the frozen processes failed: %S", e.what());
+        return {};
     }
+}
 
-    return Functions::IsProcessFrozen(process.get());
+bool IsProcessFrozen(const std::vector<DWORD>& frozenProcessIds,
+                     DWORD processId) {
+    return std::binary_search(frozenProcessIds.begin(), frozenProcessIds.end(),
+                              processId);
 }
 
 }  // namespace
 
-// static
-bool CTaskManagerDlg::IsDataSourceEmpty(DataSource dataSource) {
-    PCWSTR metadataCategory = nullptr;
-    switch (dataSource) {
-        case DataSource::kModStatus:
-            metadataCategory = L"mod-status";
-            break;
-
-        case DataSource::kModTask:
-            metadataCategory = L"mod-task";
-            break;
-    }
-
-    auto metadataPath =
-        StorageManager::GetInstance().GetModMetadataPath(metadataCategory);
-
-    if (!std::filesystem::exists(metadataPath)) {
-        return true;
-    }
-
-    for (const auto& p : std::filesystem::directory_iterator(metadataPath)) {
-        if (!p.is_regular_file()) {
-            continue;
-        }
-
-        return false;
-    }
-
-    return true;
-}
-
 CTaskManagerDlg::CTaskManagerDlg(DialogOptions dialogOptions)
     : m_dialogOptions(std::move(dialogOptions)) {}
 
@@ -175,13 +161,15 @@ void CTaskManagerDlg::LoadLanguageStrings() {
         IDS_TASKDLG_COLUMN_MOD,
         IDS_TASKDLG_COLUMN_PROCESS,
         IDS_TASKDLG_COLUMN_PID,
+        IDS_TASKDLG_COLUMN_LOAD_TIME,
+        IDS_TASKDLG_COLUMN_CPU,
         IDS_TASKDLG_COLUMN_STATUS,
     };
 
     for (int i = 0; i < ARRAYSIZE(columnStringIds); i++) {
         LVCOLUMN column = {LVCF_TEXT};
         column.pszText = (PWSTR)Functions::LoadStrFromRsrc(columnStringIds[i]);
-        m_taskListSort.SetColumn(i, &column);
+        m_taskList.SetColumn(i, &column);
     }
 
     bool languageRightToLeft =
@@ -263,10 +251,7 @@ void CTaskManagerDlg::OnDestroy() {
         KillTimer(Timer::kShowDlg);
     }
 
-    int count = m_taskListSort.GetItemCount();
-    for (int i = 0; i < count; i++) {
-        delete reinterpret_cast<ListItemData*>(m_taskListSort.GetItemData(i));
-    }
+    m_taskItems.clear();
 
     // From GDI handle checks, not all icons are freed automatically.
     ::DestroyIcon(SetIcon(nullptr, TRUE));
@@ -277,6 +262,17 @@ void CTaskManagerDlg::OnTimer(UINT_PTR nIDEvent) {
     switch ((Timer)nIDEvent) {
         case Timer::kUpdateProcessesStatus:
             UpdateTaskListProcessesStatus();
+
+            // The change notifications of these records aren't monitored by
+            // the main window, poll them instead.
+            for (auto* reader : {&m_engineMetricsReader, &m_loadTimesReader,
+                                 &m_cpuUsageReader}) {
+                if (*reader && WaitForSingleObject((*reader)->GetHandle(),
+                                                   0) == WAIT_OBJECT_0) {
+                    DataChanged();
+                    break;
+                }
+            }
             break;
 
         case Timer::kRefreshList:
@@ -319,13 +315,98 @@ void CTaskManagerDlg::OnCancel(UINT uNotifyCode, int nID, CWindow wndCtl) {
 LRESULT CTaskManagerDlg::OnListRightClick(LPNMHDR pnmh) {
     // LPNMITEMACTIVATE pnmItemActivate = (LPNMITEMACTIVATE)pnmh;
 
-    // if (m_taskListSort.GetItemCount() == 0) {
+    // if (m_taskItems.empty()) {
     //     return 1;
     // }
 
     return 1;
 }
 
+LRESULT CTaskManagerDlg::OnListGetDispInfo(LPNMHDR pnmh) {
+    auto* pDispInfo = reinterpret_cast<NMLVDISPINFO*>(pnmh);
+    LVITEM& item = pDispInfo->item;
+
+    if (!(item.mask & LVIF_TEXT) || item.iItem < 0 ||
+        static_cast<size_t>(item.iItem) >= m_taskItems.size()) {
+        return 0;
+    }
+
+    const auto& taskItem = *m_taskItems[item.iItem];
+
+    std::wstring textBuffer;
+    PCWSTR text = L"";
+    switch (item.iSubItem) {
+        case 0:
+            text = taskItem.modName.c_str();
+            break;
+
+        case 1:
+            textBuffer = taskItem.processName;
+            if (taskItem.isFrozen) {
+                textBuffer += L' ';
+                textBuffer +=
+                    Functions::LoadStrFromRsrc(IDS_TASKDLG_PROCESS_SUSPENDED);
+            }
+            text = textBuffer.c_str();
+            break;
+
+        case 2:
+            textBuffer = std::to_wstring(taskItem.processId);
+            text = textBuffer.c_str();
+            break;
+
+        case kLoadTimeColumn:
+            text = taskItem.loadTime.c_str();
+            break;
+
+        case kCpuUsageColumn:
+            text = taskItem.cpuUsage.c_str();
+            break;
+
+        case 5:
+            text = taskItem.status.c_str();
+            break;
+    }
+
+    wcsncpy_s(item.pszText, item.cchTextMax, text, _TRUNCATE);
+    return 0;
+}
+
+LRESULT CTaskManagerDlg::OnListColumnClick(LPNMHDR pnmh) {
+    auto* pnmListView = reinterpret_cast<NMLISTVIEW*>(pnmh);
+
+    if (pnmListView->iSubItem == m_sortColumn) {
+        m_sortDescending = !m_sortDescending;
+    } else {
+        m_sortColumn = pnmListView->iSubItem;
+        // The slowest and busiest mods are the interesting ones.
+        m_sortDescending = m_sortColumn == kLoadTimeColumn ||
+                           m_sortColumn == kCpuUsageColumn;
+    }
+
+    UpdateSortArrow();
+
+    std::optional<ULONG> selectedRecordId;
+    int selectedIndex = m_taskList.GetSelectedIndex();
+    if (selectedIndex != -1) {
+        selectedRecordId = m_taskItems[selectedIndex]->recordId;
+        m_taskList.SetItemState(selectedIndex, 0,
+                                LVIS_SELECTED | LVIS_FOCUSED);
+    }
+
+    SortTaskItems();
+
+    for (size_t i = 0; i < m_taskItems.size(); i++) {
+        if (m_taskItems[i]->recordId == selectedRecordId) {
+            m_taskList.SelectItem(static_cast<int>(i));
+            break;
+        }
+    }
+
+    m_taskList.Invalidate(FALSE);
+    return 0;
+}
+
 void CTaskManagerDlg::OnFinalMessage(HWND hWnd) {
     if (m_dialogOptions.finalMessageCallback) {
         m_dialogOptions.finalMessageCallback(m_hWnd);
@@ -378,41 +459,34 @@ void CTaskManagerDlg::PlaceWindowAtTrayArea() {
 }
 
 void CTaskManagerDlg::InitTaskList() {
-    CListViewCtrl list(GetDlgItem(IDC_TASK_LIST));
-
-    m_taskListSort.SubclassWindow(list);
+    m_taskList.Attach(GetDlgItem(IDC_TASK_LIST));
 
-    list.SetExtendedListViewStyle(LVS_EX_HEADERDRAGDROP | LVS_EX_FULLROWSELECT |
-                                  LVS_EX_LABELTIP | LVS_EX_DOUBLEBUFFER);
-    ::SetWindowTheme(list, L"Explorer", nullptr);
+    m_taskList.SetExtendedListViewStyle(
+        LVS_EX_HEADERDRAGDROP | LVS_EX_FULLROWSELECT | LVS_EX_LABELTIP |
+        LVS_EX_DOUBLEBUFFER);
+    ::SetWindowTheme(m_taskList, L"Explorer", nullptr);
 
     UINT windowDpi = Functions::GetDpiForWindowWithFallback(m_hWnd);
 
-    // Sort PIDs as decimals, signed 128-bit (16-byte) values representing
-    // 96-bit (12-byte) integer numbers:
-    // https://learn.microsoft.com/en-us/dotnet/visual-basic/language-reference/data-types/decimal-data-type
-    // A bit of an overkill, but LVCOLSORT_LONG is signed 32-bit while PIDs are
-    // unsigned 32-bit, so it doesn't fit. And a custom type isn't worth the
-    // effort.
     struct {
         PCWSTR name;
         int width;
-        WORD sort;
     } columns[] = {
-        {L"Mod", 160, LVCOLSORT_TEXT},
-        {L"Process", 80, LVCOLSORT_TEXT},
-        {L"PID", 60, LVCOLSORT_DECIMAL},
-        {L"Status", LVSCW_AUTOSIZE_USEHEADER, LVCOLSORT_TEXT},
+        {L"Mod", 160},
+        {L"Process", 80},
+        {L"PID", 60},
+        {L"Load time", 120},
+        {L"CPU", 100},
+        {L"Status", LVSCW_AUTOSIZE_USEHEADER},
     };
 
     for (int i = 0; i < ARRAYSIZE(columns); i++) {
-        list.InsertColumn(i, columns[i].name);
+        m_taskList.InsertColumn(i, columns[i].name);
         int width = columns[i].width;
         if (width > 0) {
             width = MulDiv(width, windowDpi, 96);
         }
-        list.SetColumnWidth(i, width);
-        m_taskListSort.SetColumnSortType(i, columns[i].sort);
+        m_taskList.SetColumnWidth(i, width);
     }
 
     // Reduce the width of the last column so that a horizontal scrollbar won't
@@ -420,163 +494,196 @@ void CTaskManagerDlg::InitTaskList() {
     int lastColumn = ARRAYSIZE(columns) - 1;
     int scrollbarWidth =
         Functions::GetSystemMetricsForDpiWithFallback(SM_CXVSCROLL, windowDpi);
-    list.SetColumnWidth(
-        lastColumn, std::max(list.GetColumnWidth(lastColumn) - scrollbarWidth,
-                             scrollbarWidth));
+    m_taskList.SetColumnWidth(
+        lastColumn,
+        std::max(m_taskList.GetColumnWidth(lastColumn) - scrollbarWidth,
+                 scrollbarWidth));
 
-    m_taskListSort.SetSortColumn(0);
+    UpdateSortArrow();
 
     // Fix tooltip not always on top.
     if (GetExStyle() & WS_EX_TOPMOST) {
-        list.GetToolTips().SetWindowPos(
+        m_taskList.GetToolTips().SetWindowPos(
             HWND_TOPMOST, 0, 0, 0, 0, SWP_NOSIZE | SWP_NOMOVE | SWP_NOACTIVATE);
     }
 }
 
 void CTaskManagerDlg::LoadTaskList() {
-    m_taskListSort.SetRedraw(FALSE);
+    if (!m_modStatusReader) {
+        ModStatusReader::Kind kind = ModStatusReader::Kind::kStatus;
+        switch (m_dialogOptions.dataSource) {
+            case DataSource::kModStatus:
+                kind = ModStatusReader::Kind::kStatus;
+                break;
+
+            case DataSource::kModTask:
+                kind = ModStatusReader::Kind::kTask;
+                break;
+        }
 
-    auto redrawWhenDone = wil::scope_exit([this] {
-        m_taskListSort.SetRedraw(TRUE);
-        m_taskListSort.RedrawWindow(
-            nullptr, nullptr,
-            RDW_ERASE | RDW_FRAME | RDW_INVALIDATE | RDW_ALLCHILDREN);
-    });
+        m_modStatusReader.emplace(m_dialogOptions.sessionManagerProcessId,
+                                  kind);
+    }
 
-    PCWSTR metadataCategory = nullptr;
-    switch (m_dialogOptions.dataSource) {
-        case DataSource::kModStatus:
-            metadataCategory = L"mod-status";
-            break;
+    if (!m_engineMetricsReaderOpened &&
+        m_dialogOptions.dataSource == DataSource::kModStatus &&
+        !m_dialogOptions.autonomousMode) {
+        m_engineMetricsReaderOpened = true;
+        try {
+            m_engineMetricsReader.emplace(
+                m_dialogOptions.sessionManagerProcessId,
+                ModStatusReader::Kind::kEngineMetrics);
+        } catch (const std::exception& e) {
+            LOG(L"Opening the engine metrics failed: %S", e.what());
+        }
 
-        case DataSource::kModTask:
-            metadataCategory = L"mod-task";
-            break;
+        try {
+            m_loadTimesReader.emplace(m_dialogOptions.sessionManagerProcessId,
+                                      ModStatusReader::Kind::kLoadTimes);
+        } catch (const std::exception& e) {
+            LOG(L"Opening the mod load times failed: %S", e.what());
+        }
+
+        try {
+            m_cpuUsageReader.emplace(m_dialogOptions.sessionManagerProcessId,
+                                     ModStatusReader::Kind::kCpuUsage);
+        } catch (const std::exception& e) {
+            LOG(L"Opening the mod CPU usage failed: %S", e.what());
+        }
     }
 
-    auto metadataPath =
-        StorageManager::GetInstance().GetModMetadataPath(metadataCategory);
+    auto items = m_modStatusReader->Read();
+
+    auto loadTimes = ReadValuesByModInstance(m_loadTimesReader);
+    auto cpuUsages = ReadValuesByModInstance(m_cpuUsageReader);
 
-    int firstItemIndex = m_taskListSort.GetItemCount();
-    int itemIndex = firstItemIndex;
+    if (m_engineMetricsReader) {
+        m_engineMetricsReader->ContinueMonitoring();
+        auto metricsItems = m_engineMetricsReader->Read();
+        items.insert(items.end(), std::make_move_iterator(metricsItems.begin()),
+                     std::make_move_iterator(metricsItems.end()));
+    }
 
-    int selectedIndex = m_taskListSort.GetSelectedIndex();
+    // Only apply the differences, so that refreshing is cheap when few of
+    // many items change.
+    std::unordered_map<ULONG, const ModStatusReader::Item*> itemsById;
+    for (const auto& item : items) {
+        itemsById.try_emplace(item.id, &item);
+    }
+
+    int selectedIndex = m_taskList.GetSelectedIndex();
     bool isSelectionVisible = selectedIndex == -1
                                   ? false
-                                  : m_taskListSort.IsItemVisible(selectedIndex);
-    std::wstring selectedFilePath =
-        selectedIndex == -1 ? std::wstring()
-                            : reinterpret_cast<ListItemData*>(
-                                  m_taskListSort.GetItemData(selectedIndex))
-                                  ->filePath;
-
-    if (std::filesystem::exists(metadataPath)) {
-        for (const auto& p :
-             std::filesystem::directory_iterator(metadataPath)) {
-            if (!p.is_regular_file()) {
-                continue;
-            }
+                                  : m_taskList.IsItemVisible(selectedIndex);
+    std::optional<ULONG> selectedRecordId;
+    if (selectedIndex != -1) {
+        selectedRecordId = m_taskItems[selectedIndex]->recordId;
+    }
 
-            try {
-                if (!LoadTaskItemFromMetadataFile(p.path(), itemIndex)) {
-                    VERBOSE(L"Didn't load %s", p.path().c_str());
-                    continue;
-                }
+    bool changed = false;
 
-                if (selectedFilePath == p.path()) {
-                    // Like SelectItem, but without EnsureVisible.
-                    if (m_taskListSort.SetItemState(
-                            itemIndex, LVIS_SELECTED | LVIS_FOCUSED,
-                            LVIS_SELECTED | LVIS_FOCUSED)) {
-                        m_taskListSort.SetSelectionMark(itemIndex);
-                    }
-                }
+    std::optional<std::vector<DWORD>> frozenProcessIds;
+    auto createTaskItem = [this, &frozenProcessIds](
+                              const ModStatusReader::Item& item) {
+        if (!frozenProcessIds) {
+            frozenProcessIds = GetFrozenProcessIds();
+        }
+
+        return CreateTaskItem(item, *frozenProcessIds);
+    };
+
+    for (auto& taskItem : m_taskItems) {
+        auto it = itemsById.find(taskItem->recordId);
+        if (it == itemsById.end()) {
+            taskItem.reset();
+            changed = true;
+            continue;
+        }
 
-                itemIndex++;
-            } catch (const std::exception& e) {
-                LOG(L"Error handling %s: %S", p.path().c_str(), e.what());
+        const auto& item = *it->second;
+        if (item.version != taskItem->recordVersion) {
+            if (item.processId == taskItem->processId &&
+                item.creationTime == taskItem->creationTime) {
+                taskItem->recordVersion = item.version;
+                taskItem->status = LocalizeStatus(item.value.c_str());
+            } else {
+                // The record was reused by another mod instance.
+                taskItem = createTaskItem(item);
             }
+
+            changed = true;
         }
+
+        itemsById.erase(it);
     }
 
-    // Remove old items only after adding new items to preserve the scroll
-    // position.
-    for (int i = 0; i < firstItemIndex; i++) {
-        delete reinterpret_cast<ListItemData*>(m_taskListSort.GetItemData(0));
-        m_taskListSort.DeleteItem(0);
+    std::erase(m_taskItems, nullptr);
+
+    for (const auto& item : items) {
+        if (itemsById.erase(item.id)) {
+            m_taskItems.push_back(createTaskItem(item));
+            changed = true;
+        }
     }
 
-    m_taskListSort.DoSortItems(m_taskListSort.GetSortColumn(),
-                               m_taskListSort.IsSortDescending());
+    // Load times and CPU usage are separate records, which change
+    // independently.
+    for (auto& taskItem : m_taskItems) {
+        std::wstring key =
+            MakeModInstanceKey(taskItem->processId, taskItem->modName);
+        if (UpdateNumericValue(loadTimes, key, &taskItem->loadTime,
+                               &taskItem->loadTimeMs)) {
+            changed = true;
+        }
 
-    if (isSelectionVisible) {
-        int newSelectedIndex = m_taskListSort.GetSelectedIndex();
-        if (newSelectedIndex != -1) {
-            m_taskListSort.EnsureVisible(newSelectedIndex, FALSE);
+        if (UpdateNumericValue(cpuUsages, key, &taskItem->cpuUsage,
+                               &taskItem->cpuUsagePercent)) {
+            changed = true;
         }
     }
-}
 
-bool CTaskManagerDlg::LoadTaskItemFromMetadataFile(
-    const std::filesystem::path& filePath,
-    int itemIndex) {
-    auto filenameParts =
-        Functions::SplitString(filePath.filename().native(), L'_');
-    if (filenameParts.size() != 4) {
-        return false;
+    if (!changed) {
+        return;
     }
 
-    DWORD sessionManagerProcessId = std::stoul(filenameParts[0]);
-    ULONGLONG sessionManagerProcessCreationTime = std::stoull(filenameParts[1]);
-    if (sessionManagerProcessId != m_dialogOptions.sessionManagerProcessId ||
-        sessionManagerProcessCreationTime !=
-            m_dialogOptions.sessionManagerProcessCreationTime) {
-        // Probably a stale file, try to remove.
-        std::error_code ec;
-        std::filesystem::remove(filePath, ec);
-        return false;
+    SortTaskItems();
+
+    if (selectedIndex != -1) {
+        m_taskList.SetItemState(selectedIndex, 0,
+                                LVIS_SELECTED | LVIS_FOCUSED);
     }
 
-    DWORD targetProcessId = std::stoul(filenameParts[2]);
+    m_taskList.SetItemCountEx(static_cast<int>(m_taskItems.size()),
+                              LVSICF_NOSCROLL);
 
-    auto& modName = filenameParts[3];
+    for (size_t i = 0; i < m_taskItems.size(); i++) {
+        if (m_taskItems[i]->recordId != selectedRecordId) {
+            continue;
+        }
 
-    FILETIME creationTime;
-    std::wstring metadata = GetMetadataContent(filePath.c_str(), &creationTime);
+        int newSelectedIndex = static_cast<int>(i);
 
-    PCWSTR processName = metadata.c_str();
-    PCWSTR status = L"";
+        // Like SelectItem, but without EnsureVisible.
+        if (m_taskList.SetItemState(newSelectedIndex,
+                                    LVIS_SELECTED | LVIS_FOCUSED,
+                                    LVIS_SELECTED | LVIS_FOCUSED)) {
+            m_taskList.SetSelectionMark(newSelectedIndex);
+        }
 
-    auto separator = metadata.find(L'|');
-    if (separator != metadata.npos) {
-        metadata[separator] = L'\0';
-        status = metadata.c_str() + separator + 1;
+        if (isSelectionVisible) {
+            m_taskList.EnsureVisible(newSelectedIndex, FALSE);
+        }
+
+        break;
     }
 
-    AddItemToList(itemIndex, filePath.c_str(), modName.c_str(), processName,
-                  targetProcessId, status, creationTime);
-    return true;
+    m_taskList.Invalidate(FALSE);
 }
 
-void CTaskManagerDlg::AddItemToList(int itemIndex,
-                                    PCWSTR filePath,
-                                    PCWSTR mod,
-                                    PCWSTR processName,
-                                    DWORD processId,
-                                    PCWSTR status,
-                                    FILETIME creationTime) {
-    std::wstring processNameFormatted = processName;
-    bool isFrozen = IsProcessFrozen(processId);
-    if (isFrozen) {
-        processNameFormatted += L' ';
-        processNameFormatted +=
-            Functions::LoadStrFromRsrc(IDS_TASKDLG_PROCESS_SUSPENDED);
-    }
-
-    m_taskListSort.AddItem(itemIndex, 0, mod);
-    m_taskListSort.AddItem(itemIndex, 1, processNameFormatted.c_str());
-    m_taskListSort.AddItem(itemIndex, 2, std::to_wstring(processId).c_str());
-    m_taskListSort.AddItem(itemIndex, 3, LocalizeStatus(status).c_str());
+std::unique_ptr<CTaskManagerDlg::TaskItem> CTaskManagerDlg::CreateTaskItem(
+    const ModStatusReader::Item& item,
+    const std::vector<DWORD>& frozenProcessIds) {
+    DWORD processId = item.processId;
 
     // The process handle must be kept alive while the request is active.
     // Otherwise, a BSOD might occur in Windows 10.
@@ -597,18 +704,81 @@ void CTaskManagerDlg::AddItemToList(int itemIndex,
         }
     }
 
-    auto* itemData = new ListItemData{
-        .filePath = filePath,
-        .processName = processName,
+    return std::make_unique<TaskItem>(TaskItem{
+        .recordId = item.id,
+        .recordVersion = item.version,
+        .modName = item.modName.empty() ? kEngineMetricsModName : item.modName,
+        .processName = item.processName,
         .processId = processId,
-        .creationTime = wil::filetime::to_int64(creationTime),
-        .isFrozen = isFrozen,
+        .status = LocalizeStatus(item.value.c_str()),
+        .creationTime = item.creationTime,
+        .isFrozen = IsProcessFrozen(frozenProcessIds, processId),
         .executionRequiredRequestProcess =
             std::move(executionRequiredRequestProcess),
         .executionRequiredRequest = std::move(executionRequiredRequest),
+    });
+}
+
+void CTaskManagerDlg::SortTaskItems() {
+    auto compare = [this](const std::unique_ptr<TaskItem>& a,
+                          const std::unique_ptr<TaskItem>& b) {
+        int result = 0;
+        switch (m_sortColumn) {
+            case 0:
+                result = lstrcmpi(a->modName.c_str(), b->modName.c_str());
+                break;
+
+            case 1:
+                result =
+                    lstrcmpi(a->processName.c_str(), b->processName.c_str());
+                break;
+
+            case 2:
+                result = a->processId < b->processId   ? -1
+                         : a->processId > b->processId ? 1
+                                                       : 0;
+                break;
+
+            case kLoadTimeColumn:
+                result = CompareNumbers(a->loadTimeMs, b->loadTimeMs);
+                break;
+
+            case kCpuUsageColumn:
+                result =
+                    CompareNumbers(a->cpuUsagePercent, b->cpuUsagePercent);
+                break;
+
+            case 5:
+                result = lstrcmpi(a->status.c_str(), b->status.c_str());
+                break;
+        }
+
+        if (result == 0) {
+            // Keep the order stable between refreshes.
+            return a->recordId < b->recordId;
+        }
+
+        return m_sortDescending ? result > 0 : result < 0;
     };
-    m_taskListSort.SetItemData(itemIndex,
-                               reinterpret_cast<DWORD_PTR>(itemData));
+
+    std::sort(m_taskItems.begin(), m_taskItems.end(), compare);
+}
+
+void CTaskManagerDlg::UpdateSortArrow() {
+    CHeaderCtrl header = m_taskList.GetHeader();
+
+    int count = header.GetItemCount();
+    for (int i = 0; i < count; i++) {
+        HDITEM headerItem = {HDI_FORMAT};
+        header.GetItem(i, &headerItem);
+
+        headerItem.fmt &= ~(HDF_SORTUP | HDF_SORTDOWN);
+        if (i == m_sortColumn) {
+            headerItem.fmt |= m_sortDescending ? HDF_SORTDOWN : HDF_SORTUP;
+        }
+
+        header.SetItem(i, &headerItem);
+    }
 }
 
 void CTaskManagerDlg::RefreshTaskList() {
@@ -629,28 +799,24 @@ void CTaskManagerDlg::RefreshTaskList() {
 }
 
 void CTaskManagerDlg::UpdateTaskListProcessesStatus() {
-    bool updated = false;
+    if (m_taskItems.empty()) {
+        return;
+    }
 
-    int itemCount = m_taskListSort.GetItemCount();
-    for (int i = 0; i < itemCount; i++) {
-        auto* itemData =
-            reinterpret_cast<ListItemData*>(m_taskListSort.GetItemData(i));
+    auto frozenProcessIds = GetFrozenProcessIds();
 
-        bool isFrozen = IsProcessFrozen(itemData->processId);
-        if (isFrozen == itemData->isFrozen) {
-            continue;
-        }
+    bool updated = false;
 
-        itemData->isFrozen = isFrozen;
+    for (size_t i = 0; i < m_taskItems.size(); i++) {
+        auto& taskItem = *m_taskItems[i];
 
-        std::wstring processNameFormatted = itemData->processName;
-        if (isFrozen) {
-            processNameFormatted += L' ';
-            processNameFormatted +=
-                Functions::LoadStrFromRsrc(IDS_TASKDLG_PROCESS_SUSPENDED);
+        bool isFrozen = IsProcessFrozen(frozenProcessIds, taskItem.processId);
+        if (isFrozen == taskItem.isFrozen) {
+            continue;
         }
 
-        m_taskListSort.SetItemText(i, 1, processNameFormatted.c_str());
+        taskItem.isFrozen = isFrozen;
+        m_taskList.RedrawItems(static_cast<int>(i), static_cast<int>(i));
 
         updated = true;
     }
@@ -665,21 +831,16 @@ void CTaskManagerDlg::UpdateDialogAfterListUpdate() {
         return;
     }
 
-    int itemCount = m_taskListSort.GetItemCount();
-    if (itemCount == 0) {
+    if (m_taskItems.empty()) {
         DestroyWindow();
         return;
     }
 
-    bool allProcessesAreFrozen = true;
-    for (int i = 0; i < itemCount; i++) {
-        auto* itemData =
-            reinterpret_cast<ListItemData*>(m_taskListSort.GetItemData(i));
-        if (!itemData->isFrozen) {
-            allProcessesAreFrozen = false;
-            break;
-        }
-    }
+    bool allProcessesAreFrozen = std::all_of(
+        m_taskItems.begin(), m_taskItems.end(),
+        [](const std::unique_ptr<TaskItem>& taskItem) {
+            return taskItem->isFrozen;
+        });
 
     if (allProcessesAreFrozen) {
         if (m_showDlgPending) {
@@ -698,10 +859,8 @@ void CTaskManagerDlg::UpdateDialogAfterListUpdate() {
         // will always be updated and the dialog will never be shown.
 
         ULONGLONG earliestCreationTime = ULONGLONG_MAX;
-        for (int i = 0; i < itemCount; i++) {
-            auto* itemData =
-                reinterpret_cast<ListItemData*>(m_taskListSort.GetItemData(i));
-            ULONGLONG creationTime = itemData->creationTime;
+        for (const auto& taskItem : m_taskItems) {
+            ULONGLONG creationTime = taskItem->creationTime;
             if (creationTime < earliestCreationTime) {
                 earliestCreationTime = creationTime;
             }
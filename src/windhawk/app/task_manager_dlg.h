@@ -1,5 +1,6 @@
 #pragma once
 
+#include "mod_status_reader.h"
 #include "resource.h"
 
 class CTaskManagerDlg : public CDialogImpl<CTaskManagerDlg>,
@@ -29,13 +30,10 @@ class CTaskManagerDlg : public CDialogImpl<CTaskManagerDlg>,
         bool autonomousMode = false;
         int autonomousModeShowDelay = kAutonomousModeShowDelayDefault;
         DWORD sessionManagerProcessId{};
-        ULONGLONG sessionManagerProcessCreationTime{};
         DlgCallback runButtonCallback;
         DlgCallback finalMessageCallback;
     };
 
-    static bool IsDataSourceEmpty(DataSource dataSource);
-
     CTaskManagerDlg(DialogOptions dialogOptions);
 
     void LoadLanguageStrings();
@@ -48,6 +46,24 @@ class CTaskManagerDlg : public CDialogImpl<CTaskManagerDlg>,
         kShowDlg,
     };
 
+    struct TaskItem {
+        ULONG recordId = 0;
+        ULONG recordVersion = 0;
+        std::wstring modName;
+        std::wstring processName;
+        DWORD processId = 0;
+        std::wstring status;
+        // Empty if the engine doesn't provide it.
+        std::wstring loadTime;
+        double loadTimeMs = 0;
+        std::wstring cpuUsage;
+        double cpuUsagePercent = 0;
+        ULONGLONG creationTime = 0;
+        bool isFrozen = false;
+        wil::unique_process_handle executionRequiredRequestProcess;
+        wil::unique_handle executionRequiredRequest;
+    };
+
     BEGIN_MSG_MAP_EX(CTaskManagerDlg)
         CHAIN_MSG_MAP(CDialogResize<CTaskManagerDlg>)
         MSG_WM_INITDIALOG(OnInitDialog)
@@ -57,6 +73,8 @@ class CTaskManagerDlg : public CDialogImpl<CTaskManagerDlg>,
         COMMAND_ID_HANDLER_EX(IDOK, OnOK)
         COMMAND_ID_HANDLER_EX(IDCANCEL, OnCancel)
         NOTIFY_HANDLER_EX(IDC_TASK_LIST, NM_RCLICK, OnListRightClick)
+        NOTIFY_HANDLER_EX(IDC_TASK_LIST, LVN_GETDISPINFO, OnListGetDispInfo)
+        NOTIFY_HANDLER_EX(IDC_TASK_LIST, LVN_COLUMNCLICK, OnListColumnClick)
     END_MSG_MAP()
 
     BOOL OnInitDialog(CWindow wndFocus, LPARAM lInitParam);
@@ -66,6 +84,8 @@ class CTaskManagerDlg : public CDialogImpl<CTaskManagerDlg>,
     void OnOK(UINT uNotifyCode, int nID, CWindow wndCtl);
     void OnCancel(UINT uNotifyCode, int nID, CWindow wndCtl);
     LRESULT OnListRightClick(LPNMHDR pnmh);
+    LRESULT OnListGetDispInfo(LPNMHDR pnmh);
+    LRESULT OnListColumnClick(LPNMHDR pnmh);
 
     void OnFinalMessage(HWND hWnd) override;
     UINT_PTR SetTimer(Timer nIDEvent,
@@ -76,21 +96,31 @@ class CTaskManagerDlg : public CDialogImpl<CTaskManagerDlg>,
     void PlaceWindowAtTrayArea();
     void InitTaskList();
     void LoadTaskList();
-    bool LoadTaskItemFromMetadataFile(const std::filesystem::path& filePath,
-                                      int itemIndex);
-    void AddItemToList(int itemIndex,
-                       PCWSTR filePath,
-                       PCWSTR mod,
-                       PCWSTR processName,
-                       DWORD processId,
-                       PCWSTR status,
-                       FILETIME creationTime);
+    std::unique_ptr<TaskItem> CreateTaskItem(
+        const ModStatusReader::Item& item,
+        const std::vector<DWORD>& frozenProcessIds);
+    void SortTaskItems();
+    void UpdateSortArrow();
     void RefreshTaskList();
     void UpdateTaskListProcessesStatus();
     void UpdateDialogAfterListUpdate();
 
     const DialogOptions m_dialogOptions;
-    CSortListViewCtrl m_taskListSort;
+    std::optional<ModStatusReader> m_modStatusReader;
+    // With the mod status data source, the engine metrics of each process are
+    // listed as well. Not set if the engine doesn't provide them.
+    std::optional<ModStatusReader> m_engineMetricsReader;
+    bool m_engineMetricsReaderOpened = false;
+    // Likewise, the load times and the CPU usage of the mods are shown for
+    // their records, see ModLoadTimes and ModCpuSampler of the engine.
+    std::optional<ModStatusReader> m_loadTimesReader;
+    std::optional<ModStatusReader> m_cpuUsageReader;
+    // The list is virtual (LVS_OWNERDATA), the items are kept here in the
+    // displayed order.
+    CListViewCtrl m_taskList;
+    std::vector<std::unique_ptr<TaskItem>> m_taskItems;
+    int m_sortColumn = 0;
+    bool m_sortDescending = false;
     bool m_refreshListOnDataChangePending = false;
     bool m_showDlgPending = false;
 };
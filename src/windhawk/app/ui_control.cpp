@@ -49,6 +49,14 @@ const json uiSettingsToMigrate = {
      "\\resources\\app\\extensions\\clangd\\clangd\\bin\\clangd.exe"},
 };
 
+// Reading more than this is unlikely to fit in the file cache anyway.
+constexpr ULONGLONG kPrewarmMaxSize = 512 * 1024 * 1024;
+constexpr DWORD kPrewarmReadBufferSize = 1024 * 1024;
+
+// The last write time of the settings file after it was last checked, so that
+// it's only parsed again if it was changed.
+std::optional<std::filesystem::file_time_type> g_checkedSettingsWriteTime;
+
 void MakeSureDirectoryExists(const std::filesystem::path& directory) {
     if (!std::filesystem::is_directory(directory)) {
         try {
@@ -70,6 +78,12 @@ void PrepareUISettings(const std::filesystem::path& uiDataPath) {
 
     settingsPath /= L"settings.json";
 
+    std::error_code ec;
+    auto settingsWriteTime = std::filesystem::last_write_time(settingsPath, ec);
+    if (!ec && g_checkedSettingsWriteTime == settingsWriteTime) {
+        return;
+    }
+
     json settingsJson;
 
     {
@@ -110,6 +124,73 @@ void PrepareUISettings(const std::filesystem::path& uiDataPath) {
             userProfileFile << std::setw(4) << settingsJson;
         }
     }
+
+    settingsWriteTime = std::filesystem::last_write_time(settingsPath, ec);
+    if (!ec) {
+        g_checkedSettingsWriteTime = settingsWriteTime;
+    } else {
+        g_checkedSettingsWriteTime.reset();
+    }
+}
+
+// Returns false if the size limit was reached.
+bool PrewarmFile(const std::filesystem::path& path,
+                 std::vector<BYTE>& buffer,
+                 ULONGLONG& remainingSize) {
+    wil::unique_hfile file(CreateFile(
+        path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+    if (!file) {
+        return true;
+    }
+
+    DWORD read;
+    while (ReadFile(file.get(), buffer.data(),
+                    static_cast<DWORD>(buffer.size()), &read, nullptr) &&
+           read > 0) {
+        if (read >= remainingSize) {
+            remainingSize = 0;
+            return false;
+        }
+
+        remainingSize -= read;
+    }
+
+    return true;
+}
+
+DWORD WINAPI PrewarmThreadProc(LPVOID lpParameter) {
+    // Low priority CPU and I/O, so that the reads don't compete with the
+    // user's work.
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+
+    try {
+        auto uiPath = StorageManager::GetInstance().GetUIPath();
+
+        std::vector<BYTE> buffer(kPrewarmReadBufferSize);
+        ULONGLONG remainingSize = kPrewarmMaxSize;
+
+        // The executable, its DLLs and resource packs are loaded first, then
+        // the scripts of the app.
+        for (const auto& entry : std::filesystem::directory_iterator(uiPath)) {
+            if (entry.is_regular_file() &&
+                !PrewarmFile(entry.path(), buffer, remainingSize)) {
+                return 0;
+            }
+        }
+
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(
+                 uiPath / L"resources" / L"app" / L"out")) {
+            if (entry.is_regular_file() &&
+                !PrewarmFile(entry.path(), buffer, remainingSize)) {
+                return 0;
+            }
+        }
+    } catch (const std::exception& e) {
+        LOG(L"Prewarming UI files failed: %S", e.what());
+    }
+
+    return 0;
 }
 
 BOOL IsArm64NativeMachine() {
@@ -350,6 +431,12 @@ void RunUIOrBringToFront(HWND hWnd, bool mustRunAsAdmin) {
     THROW_LAST_ERROR_IF(nResult <= 32 && GetLastError() != ERROR_CANCELLED);
 }
 
+void PrewarmUIFiles() {
+    wil::unique_handle thread(
+        CreateThread(nullptr, 0, PrewarmThreadProc, nullptr, 0, nullptr));
+    THROW_LAST_ERROR_IF_NULL(thread);
+}
+
 bool CloseUI() {
     auto windows = GetOpenUIWindows();
     bool succeeded = false;
@@ -8,5 +8,8 @@ std::vector<HWND> GetOpenUIWindows();
 bool BringUIToFront();
 void RunUIOrBringToFront(HWND hWnd, bool mustRunAsAdmin);
 bool CloseUI();
+// Reads the UI files in the background with a low priority, so that they're
+// in the file cache and the UI launches faster the next time it's opened.
+void PrewarmUIFiles();
 
 }  // namespace UIControl
@@ -3,13 +3,12 @@
 #include "update_checker.h"
 
 #include "logger.h"
+#include "mod_performance_report.h"
+#include "update_package.h"
 #include "version.h"
 
 namespace {
 
-constexpr auto* kUpdateCheckerUrl =
-    L"https://update.windhawk.net/versions.json";
-
 USHORT GetNativeMachineImpl() {
     using IsWow64Process2_t = BOOL(WINAPI*)(
         HANDLE hProcess, USHORT * pProcessMachine, USHORT * pNativeMachine);
@@ -53,12 +52,44 @@ USHORT GetNativeMachine() {
     return nativeMachine;
 }
 
-CWinHTTPSimpleOptions GetUpdateCheckerOptions(DWORD flags,
-                                              const void* postData,
-                                              size_t postDataSize) {
+std::wstring EncodeUrlQueryValue(PCWSTR value) {
+    CW2A valueUtf8(value, CP_UTF8);
+
+    std::wstring result;
+    for (PCSTR p = valueUtf8.m_psz; *p; p++) {
+        char c = *p;
+        if ((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') ||
+            (c >= 'a' && c <= 'z') || c == '-' || c == '.' || c == '_' ||
+            c == '~') {
+            result += static_cast<WCHAR>(c);
+        } else {
+            WCHAR encoded[4];
+            swprintf_s(encoded, L"%%%02X", static_cast<BYTE>(c));
+            result += encoded;
+        }
+    }
+
+    return result;
+}
+
+CWinHTTPSimpleOptions GetUpdateCheckerOptions(
+    DWORD flags,
+    const UserProfile::OnlineDataValidators& validators,
+    const void* postData,
+    size_t postDataSize) {
     CWinHTTPSimpleOptions options;
 
-    options.sURL = kUpdateCheckerUrl;
+    options.sURL = UpdateChecker::kUrl;
+
+    // Posted data includes the timestamp, a GET request passes it in the
+    // query.
+    if ((!postData || postDataSize == 0) && !validators.timestamp.empty()) {
+        options.sURL += L"?since=";
+        options.sURL += EncodeUrlQueryValue(validators.timestamp.c_str());
+    }
+
+    options.sIfNoneMatch = validators.eTag;
+    options.sIfModifiedSince = validators.lastModified;
 
     options.sUserAgent = L"Windhawk/" VER_FILE_VERSION_WSTR " (";
     options.sUserAgent += std::to_wstring(GetNativeMachine());
@@ -76,13 +107,62 @@ CWinHTTPSimpleOptions GetUpdateCheckerOptions(DWORD flags,
     return options;
 }
 
+// The header is either a number of seconds or an HTTP date.
+ULONGLONG GetRetryAfterMs(CWinHTTPSimple& httpSimple) {
+    std::wstring retryAfter =
+        httpSimple.QueryHeaderString(WINHTTP_QUERY_RETRY_AFTER);
+    if (retryAfter.empty()) {
+        return 0;
+    }
+
+    if (std::all_of(retryAfter.begin(), retryAfter.end(), iswdigit)) {
+        return std::wcstoull(retryAfter.c_str(), nullptr, 10) * 1000;
+    }
+
+    SYSTEMTIME retryTime;
+    FILETIME retryFileTime;
+    if (!WinHttpTimeToSystemTime(retryAfter.c_str(), &retryTime) ||
+        !SystemTimeToFileTime(&retryTime, &retryFileTime)) {
+        return 0;
+    }
+
+    INT64 retry = wil::filetime::to_int64(retryFileTime);
+    INT64 now = wil::filetime::to_int64(wil::filetime::get_system_time());
+    if (retry <= now) {
+        return 0;
+    }
+
+    return wil::filetime::convert_100ns_to_msec(retry - now);
+}
+
+std::string GetPostedData(DWORD sessionManagerProcessId) {
+    std::string postedData = UserProfile::GetLocalUpdatedContentAsString();
+    if (!sessionManagerProcessId) {
+        return postedData;
+    }
+
+    try {
+        if (ModPerformanceReport::IsEnabled()) {
+            return ModPerformanceReport::AddToPostedData(
+                postedData, sessionManagerProcessId);
+        }
+    } catch (const std::exception& e) {
+        LOG(L"Adding the mod performance report failed: %S", e.what());
+    }
+
+    return postedData;
+}
+
 }  // namespace
 
 UpdateChecker::UpdateChecker(DWORD flags,
+                             DWORD sessionManagerProcessId,
                              std::function<void()> onUpdateCheckDone)
     : m_flags(flags),
-      m_postedData(UserProfile::GetLocalUpdatedContentAsString()),
+      m_postedData(GetPostedData(sessionManagerProcessId)),
+      m_validators(UserProfile::GetOnlineDataValidators()),
       m_httpSimple(GetUpdateCheckerOptions(m_flags,
+                                           m_validators,
                                            m_postedData.data(),
                                            m_postedData.length()),
                    onUpdateCheckDone != nullptr),
@@ -98,7 +178,8 @@ UpdateChecker::UpdateChecker(DWORD flags,
         m_httpSimple.SendRequest(nullptr);
         if (ShouldRetryWithAGetRequest()) {
             m_httpSimpleGetRequest = std::make_unique<CWinHTTPSimple>(
-                GetUpdateCheckerOptions(m_flags, nullptr, 0), false);
+                GetUpdateCheckerOptions(m_flags, m_validators, nullptr, 0),
+                false);
             m_httpSimpleGetRequest->SendRequest(nullptr);
         }
     }
@@ -125,11 +206,37 @@ UpdateChecker::Result UpdateChecker::HandleResponse() {
     result.hrError = httpSimple.GetRequestResult();
     result.httpStatusCode = httpSimple.GetLastStatusCode();
 
-    if (SUCCEEDED(result.hrError)) {
+    if (FAILED(result.hrError)) {
+        result.retryAfterMs = GetRetryAfterMs(httpSimple);
+    } else {
         try {
-            const auto& response = httpSimple.GetResponse();
-            result.updateStatus = UserProfile::UpdateContentWithOnlineData(
-                reinterpret_cast<PCSTR>(response.data()), response.size());
+            if (httpSimple.IsNotModified()) {
+                result.updateStatus = UserProfile::UpdateContentNotModified();
+            } else {
+                UserProfile::OnlineDataValidators validators{
+                    .eTag = httpSimple.QueryHeaderString(WINHTTP_QUERY_ETAG),
+                    .lastModified = httpSimple.QueryHeaderString(
+                        WINHTTP_QUERY_LAST_MODIFIED),
+                };
+
+                const auto& response = httpSimple.GetResponse();
+                result.updateStatus = UserProfile::UpdateContentWithOnlineData(
+                    reinterpret_cast<PCSTR>(response.data()), response.size(),
+                    validators);
+
+                try {
+                    if (result.updateStatus.appUpdateAvailable) {
+                        UpdatePackage::SaveManifest(
+                            reinterpret_cast<PCSTR>(response.data()),
+                            response.size());
+                    } else {
+                        UpdatePackage::Discard();
+                    }
+                } catch (const std::exception& e) {
+                    LOG(L"Saving the update package list failed: %S",
+                        e.what());
+                }
+            }
         } catch (const std::exception& e) {
             LOG(L"Handling server response failed: %S", e.what());
             result.hrError = E_FAIL;
@@ -155,7 +262,8 @@ void UpdateChecker::OnRequestDone() {
         if (!m_aborted) {
             try {
                 m_httpSimpleGetRequest = std::make_unique<CWinHTTPSimple>(
-                    GetUpdateCheckerOptions(m_flags, nullptr, 0), true);
+                    GetUpdateCheckerOptions(m_flags, m_validators, nullptr, 0),
+                    true);
                 THROW_IF_FAILED(m_httpSimpleGetRequest->SendRequest(
                     [this] { m_onUpdateCheckDone(); }));
             } catch (const std::exception& e) {
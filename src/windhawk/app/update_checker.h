@@ -5,17 +5,26 @@
 
 class UpdateChecker {
    public:
+    static constexpr auto* kUrl = L"https://update.windhawk.net/versions.json";
+
     struct Result {
         HRESULT hrError;
         DWORD httpStatusCode;
         UserProfile::UpdateStatus updateStatus;
+        // The delay the server asked for with a Retry-After header, or zero
+        // if there was none.
+        ULONGLONG retryAfterMs;
     };
 
     enum {
         kFlagPortable = 1,
     };
 
-    UpdateChecker(DWORD flags, std::function<void()> onUpdateCheckDone);
+    // If the session manager process ID isn't zero, and the user opted in,
+    // the mod performance report of the session is sent with the request.
+    UpdateChecker(DWORD flags,
+                  DWORD sessionManagerProcessId,
+                  std::function<void()> onUpdateCheckDone);
     void Abort();
     Result HandleResponse();
 
@@ -26,6 +35,7 @@ class UpdateChecker {
     std::atomic<bool> m_aborted = false;
     DWORD m_flags = 0;
     std::string m_postedData;
+    UserProfile::OnlineDataValidators m_validators;
     CWinHTTPSimple m_httpSimple;
     std::unique_ptr<CWinHTTPSimple> m_httpSimpleGetRequest;
     std::mutex m_httpSimpleGetRequestMutex;
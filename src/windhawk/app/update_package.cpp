@@ -0,0 +1,621 @@
+#include "stdafx.h"
+
+#include "update_package.h"
+
+#include "logger.h"
+#include "storage_manager.h"
+#include "update_checker.h"
+#include "version.h"
+
+using json = nlohmann::json;
+
+namespace {
+
+constexpr auto* kUserAgent = L"Windhawk/" VER_FILE_VERSION_WSTR;
+
+// Appended to the installed file names while the files are replaced.
+constexpr auto* kNewFileSuffix = L".whnew";
+constexpr auto* kOldFileSuffix = L".whold";
+
+struct Delta {
+    std::string baseSha256;
+    std::wstring url;
+};
+
+struct File {
+    std::filesystem::path installedPath;
+    // Relative to the staged files folder.
+    std::filesystem::path stagedPath;
+    std::string sha256;
+    std::wstring url;
+    std::vector<Delta> deltas;
+};
+
+std::filesystem::path GetManifestPath() {
+    return StorageManager::GetInstance().GetUpdateStagingPath() /
+           L"manifest.json";
+}
+
+std::filesystem::path GetReadyMarkerPath() {
+    return StorageManager::GetInstance().GetUpdateStagingPath() / L"ready";
+}
+
+std::filesystem::path GetStagedFilesPath() {
+    return StorageManager::GetInstance().GetUpdateStagingPath() / L"files";
+}
+
+std::filesystem::path GetComponentPath(std::string_view component) {
+    auto& storageManager = StorageManager::GetInstance();
+
+    if (component == "app") {
+        std::filesystem::path modulePath =
+            wil::GetModuleFileName<std::wstring>();
+        return modulePath.parent_path();
+    }
+
+    if (component == "engine") {
+        return storageManager.GetEnginePath().parent_path();
+    }
+
+    if (component == "ui") {
+        return storageManager.GetUIPath();
+    }
+
+    if (component == "compiler") {
+        return storageManager.GetCompilerPath();
+    }
+
+    throw std::runtime_error("Unknown update package component");
+}
+
+// The path must stay inside the component folder.
+std::filesystem::path GetRelativePathValue(const json& value) {
+    std::filesystem::path path(
+        CA2W(value.get<std::string>().c_str(), CP_UTF8).m_psz);
+    if (path.empty() || path.has_root_name() || path.has_root_directory() ||
+        std::any_of(path.begin(), path.end(), [](const auto& element) {
+            return element == L"..";
+        })) {
+        throw std::runtime_error("Invalid update package file path");
+    }
+
+    return path;
+}
+
+std::string GetSha256Value(const json& value) {
+    auto sha256 = value.get<std::string>();
+    if (sha256.length() != 64 ||
+        !std::all_of(sha256.begin(), sha256.end(), [](char c) {
+            return isxdigit(static_cast<unsigned char>(c));
+        })) {
+        throw std::runtime_error("Invalid update package file hash");
+    }
+
+    for (char& c : sha256) {
+        c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    }
+
+    return sha256;
+}
+
+std::wstring GetUrlValue(const json& value) {
+    std::wstring url(CA2W(value.get<std::string>().c_str(), CP_UTF8).m_psz);
+    if (_wcsnicmp(url.c_str(), L"https://", sizeof("https://") - 1) != 0) {
+        throw std::runtime_error("Invalid update package file URL");
+    }
+
+    return url;
+}
+
+// The format of the app object in the online data:
+// "packages": [{
+//   "component": "app" | "engine" | "ui" | "compiler",
+//   "files": [{
+//     "path": <relative to the component folder>,
+//     "sha256": <hex>,
+//     "url": <full file>,
+//     "deltas": [{"baseSha256": <hex>, "url": <MSDelta patch>}]
+//   }]
+// }]
+// Files which aren't listed didn't change.
+std::vector<File> ParseManifest(const json& app) {
+    std::vector<File> files;
+
+    for (const auto& package : app.at("packages")) {
+        auto component = package.at("component").get<std::string>();
+        auto componentPath = GetComponentPath(component);
+
+        for (const auto& fileValue : package.at("files")) {
+            auto relativePath = GetRelativePathValue(fileValue.at("path"));
+
+            File file{
+                .installedPath = componentPath / relativePath,
+                .stagedPath =
+                    std::filesystem::path(CA2W(component.c_str()).m_psz) /
+                    relativePath,
+                .sha256 = GetSha256Value(fileValue.at("sha256")),
+                .url = GetUrlValue(fileValue.at("url")),
+            };
+
+            auto deltas = fileValue.find("deltas");
+            if (deltas != fileValue.end()) {
+                for (const auto& delta : *deltas) {
+                    file.deltas.push_back({
+                        .baseSha256 = GetSha256Value(delta.at("baseSha256")),
+                        .url = GetUrlValue(delta.at("url")),
+                    });
+                }
+            }
+
+            files.push_back(std::move(file));
+        }
+    }
+
+    return files;
+}
+
+// Returns a null value if there's no app object.
+json ParseAppData(PCSTR data, size_t length) {
+    // Only the app object is kept, the rest is skipped.
+    json parsed = json::parse(
+        data, data + length,
+        [](int depth, json::parse_event_t event, json& parsed) {
+            return depth != 1 || event != json::parse_event_t::key ||
+                   parsed.get<std::string>() == "app";
+        });
+
+    auto app = parsed.find("app");
+    if (app == parsed.end() || !app->is_object()) {
+        return json();
+    }
+
+    return std::move(*app);
+}
+
+// Returns a null value if there's no saved manifest.
+json ReadManifest() {
+    std::ifstream file(GetManifestPath());
+    if (!file) {
+        return json();
+    }
+
+    return json::parse(file);
+}
+
+// The saved manifest isn't trusted by the elevated process which applies the
+// update, since it's writable by the user.
+json FetchManifest() {
+    CWinHTTPSimpleOptions options;
+    options.sURL = UpdateChecker::kUrl;
+    options.sUserAgent = kUserAgent;
+
+    CWinHTTPSimple httpSimple(std::move(options));
+    httpSimple.SendRequest(nullptr);
+    THROW_IF_FAILED(httpSimple.GetRequestResult());
+
+    const auto& response = httpSimple.GetResponse();
+    return ParseAppData(reinterpret_cast<PCSTR>(response.data()),
+                        response.size());
+}
+
+// Returns an empty string if the file doesn't exist.
+std::string GetFileSha256(const std::filesystem::path& path) {
+    wil::unique_hfile file(CreateFile(
+        path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+    if (!file) {
+        DWORD error = GetLastError();
+        if (error == ERROR_FILE_NOT_FOUND || error == ERROR_PATH_NOT_FOUND) {
+            return std::string();
+        }
+
+        THROW_WIN32(error);
+    }
+
+    wil::unique_bcrypt_algorithm algorithm;
+    THROW_IF_NTSTATUS_FAILED(BCryptOpenAlgorithmProvider(
+        &algorithm, BCRYPT_SHA256_ALGORITHM, nullptr, 0));
+
+    wil::unique_bcrypt_hash hash;
+    THROW_IF_NTSTATUS_FAILED(BCryptCreateHash(algorithm.get(), &hash, nullptr,
+                                              0, nullptr, 0, 0));
+
+    std::vector<BYTE> buffer(64 * 1024);
+    while (true) {
+        DWORD read;
+        THROW_IF_WIN32_BOOL_FALSE(ReadFile(file.get(), buffer.data(),
+                                           static_cast<DWORD>(buffer.size()),
+                                           &read, nullptr));
+        if (read == 0) {
+            break;
+        }
+
+        THROW_IF_NTSTATUS_FAILED(
+            BCryptHashData(hash.get(), buffer.data(), read, 0));
+    }
+
+    BYTE digest[32];
+    THROW_IF_NTSTATUS_FAILED(
+        BCryptFinishHash(hash.get(), digest, sizeof(digest), 0));
+
+    std::string result;
+    for (BYTE b : digest) {
+        char hex[3];
+        sprintf_s(hex, "%02x", b);
+        result += hex;
+    }
+
+    return result;
+}
+
+void ApplyDelta(const std::filesystem::path& sourcePath,
+                const std::filesystem::path& deltaPath,
+                const std::filesystem::path& targetPath) {
+    using ApplyDeltaW_t = BOOL(WINAPI*)(INT64 ApplyFlags, LPCWSTR lpSourceName,
+                                        LPCWSTR lpDeltaName,
+                                        LPCWSTR lpTargetName);
+
+    // Loaded by full path, since it's not a known DLL.
+    std::filesystem::path msdeltaPath =
+        wil::GetSystemDirectoryW<std::wstring>();
+    msdeltaPath /= L"msdelta.dll";
+
+    wil::unique_hmodule msdeltaModule(LoadLibraryEx(
+        msdeltaPath.c_str(), nullptr, LOAD_WITH_ALTERED_SEARCH_PATH));
+    THROW_LAST_ERROR_IF_NULL(msdeltaModule);
+
+    auto pApplyDeltaW = reinterpret_cast<ApplyDeltaW_t>(
+        GetProcAddress(msdeltaModule.get(), "ApplyDeltaW"));
+    THROW_LAST_ERROR_IF_NULL(pApplyDeltaW);
+
+    THROW_IF_WIN32_BOOL_FALSE(pApplyDeltaW(/*DELTA_FLAG_NONE*/ 0,
+                                           sourcePath.c_str(),
+                                           deltaPath.c_str(),
+                                           targetPath.c_str()));
+}
+
+std::filesystem::path WithSuffix(const std::filesystem::path& path,
+                                 PCWSTR suffix) {
+    auto result = path;
+    result += suffix;
+    return result;
+}
+
+void RemoveOldFile(const std::filesystem::path& oldPath) {
+    // The file of a running executable can't be deleted, e.g. the app itself.
+    if (!DeleteFile(oldPath.c_str()) &&
+        !MoveFileEx(oldPath.c_str(), nullptr, MOVEFILE_DELAY_UNTIL_REBOOT)) {
+        LOG(L"Removing %s failed: %u", oldPath.c_str(), GetLastError());
+    }
+}
+
+}  // namespace
+
+namespace UpdatePackage {
+
+void SaveManifest(PCSTR onlineData, size_t onlineDataLength) {
+    json app = ParseAppData(onlineData, onlineDataLength);
+    if (app.is_null()) {
+        // A delta response without app changes.
+        return;
+    }
+
+    auto packages = app.find("packages");
+    if (packages == app.end()) {
+        Discard();
+        return;
+    }
+
+    try {
+        json savedApp = ReadManifest();
+        if (savedApp.is_object() && savedApp.contains("packages") &&
+            savedApp["packages"] == *packages) {
+            return;
+        }
+    } catch (const std::exception& e) {
+        LOG(L"Reading the saved update package list failed: %S", e.what());
+    }
+
+    // Validate before saving.
+    ParseManifest(app);
+
+    Discard();
+
+    std::filesystem::create_directories(
+        StorageManager::GetInstance().GetUpdateStagingPath());
+
+    std::ofstream file(GetManifestPath());
+    file << app.dump();
+    file.close();
+    if (!file) {
+        throw std::runtime_error("Writing the update package list failed");
+    }
+}
+
+void Discard() {
+    std::error_code ec;
+    std::filesystem::remove_all(
+        StorageManager::GetInstance().GetUpdateStagingPath(), ec);
+    if (ec) {
+        LOG(L"Removing the staged update failed: %S", ec.message().c_str());
+    }
+}
+
+bool IsDownloadPending() {
+    std::error_code ec;
+    return std::filesystem::exists(GetManifestPath(), ec) &&
+           !std::filesystem::exists(GetReadyMarkerPath(), ec);
+}
+
+bool IsReady() {
+    std::error_code ec;
+    return std::filesystem::exists(GetReadyMarkerPath(), ec);
+}
+
+void Apply() {
+    if (!IsReady()) {
+        throw std::runtime_error("No staged update");
+    }
+
+    json savedApp = ReadManifest();
+    json app = FetchManifest();
+    if (!app.contains("packages") || !savedApp.contains("packages") ||
+        app["packages"] != savedApp["packages"]) {
+        // Probably a newer version was published in the meantime. The next
+        // update check will stage it.
+        throw std::runtime_error("The staged update is outdated");
+    }
+
+    auto stagedFilesPath = GetStagedFilesPath();
+
+    std::vector<File> files;
+    for (auto& file : ParseManifest(app)) {
+        if (GetFileSha256(file.installedPath) != file.sha256) {
+            files.push_back(std::move(file));
+        }
+    }
+
+    // Copy over the staged files next to the installed ones first, and verify
+    // them there, where the user can't modify them.
+    std::vector<std::filesystem::path> newPaths;
+    try {
+        for (const auto& file : files) {
+            auto newPath = WithSuffix(file.installedPath, kNewFileSuffix);
+            std::filesystem::create_directories(newPath.parent_path());
+            auto stagedPath = stagedFilesPath / file.stagedPath;
+            THROW_IF_WIN32_BOOL_FALSE(
+                CopyFile(stagedPath.c_str(), newPath.c_str(), FALSE));
+            newPaths.push_back(newPath);
+
+            if (GetFileSha256(newPath) != file.sha256) {
+                Discard();
+                throw std::runtime_error("Staged update file hash mismatch");
+            }
+        }
+    } catch (...) {
+        for (const auto& newPath : newPaths) {
+            DeleteFile(newPath.c_str());
+        }
+
+        throw;
+    }
+
+    struct Replaced {
+        const File* file;
+        bool hadOldFile;
+    };
+
+    std::vector<Replaced> replaced;
+    try {
+        for (size_t i = 0; i < files.size(); i++) {
+            const auto& installedPath = files[i].installedPath;
+            auto oldPath = WithSuffix(installedPath, kOldFileSuffix);
+
+            // Files which are in use, such as the running executable, can be
+            // renamed but not overwritten.
+            bool hadOldFile = MoveFileEx(installedPath.c_str(), oldPath.c_str(),
+                                         MOVEFILE_REPLACE_EXISTING);
+            if (!hadOldFile && GetLastError() != ERROR_FILE_NOT_FOUND) {
+                THROW_LAST_ERROR();
+            }
+
+            if (!MoveFileEx(newPaths[i].c_str(), installedPath.c_str(), 0)) {
+                DWORD error = GetLastError();
+                if (hadOldFile) {
+                    MoveFileEx(oldPath.c_str(), installedPath.c_str(), 0);
+                }
+
+                THROW_WIN32(error);
+            }
+
+            replaced.push_back({&files[i], hadOldFile});
+        }
+    } catch (...) {
+        for (auto it = replaced.rbegin(); it != replaced.rend(); ++it) {
+            const auto& installedPath = it->file->installedPath;
+            if (it->hadOldFile) {
+                MoveFileEx(WithSuffix(installedPath, kOldFileSuffix).c_str(),
+                           installedPath.c_str(), MOVEFILE_REPLACE_EXISTING);
+            } else {
+                DeleteFile(installedPath.c_str());
+            }
+        }
+
+        for (const auto& newPath : newPaths) {
+            DeleteFile(newPath.c_str());
+        }
+
+        throw;
+    }
+
+    for (const auto& item : replaced) {
+        if (item.hadOldFile) {
+            RemoveOldFile(WithSuffix(item.file->installedPath, kOldFileSuffix));
+        }
+    }
+
+    LOG(L"Replaced %zu files with the update to version %S", files.size(),
+        app.value("version", "").c_str());
+
+    Discard();
+}
+
+Downloader::Downloader(std::function<void(bool ready)> onDone)
+    : m_onDone(std::move(onDone)) {
+    m_thread.reset(CreateThread(nullptr, 0, ThreadProc, this, 0, nullptr));
+    THROW_LAST_ERROR_IF_NULL(m_thread);
+}
+
+Downloader::~Downloader() {
+    Abort();
+    WaitForSingleObject(m_thread.get(), INFINITE);
+}
+
+void Downloader::Abort() {
+    m_aborted = true;
+
+    std::lock_guard<std::mutex> guard(m_currentRequestMutex);
+    if (m_currentRequest) {
+        m_currentRequest->Abort();
+    }
+}
+
+// static
+DWORD WINAPI Downloader::ThreadProc(void* parameter) {
+    // Low priority CPU and I/O, so that the download and the delta
+    // application don't compete with the user's work.
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+
+    static_cast<Downloader*>(parameter)->Run();
+    return 0;
+}
+
+void Downloader::Run() {
+    bool ready = false;
+
+    try {
+        json app = ReadManifest();
+        if (app.is_null()) {
+            throw std::runtime_error("No update package list");
+        }
+
+        auto stagedFilesPath = GetStagedFilesPath();
+        size_t deltaCount = 0;
+        size_t fullCount = 0;
+        ULONGLONG downloadedSize = 0;
+
+        for (const auto& file : ParseManifest(app)) {
+            if (m_aborted) {
+                return;
+            }
+
+            // Staged by an earlier run.
+            auto stagedPath = stagedFilesPath / file.stagedPath;
+            if (GetFileSha256(stagedPath) == file.sha256) {
+                continue;
+            }
+
+            // Unchanged.
+            auto installedSha256 = GetFileSha256(file.installedPath);
+            if (installedSha256 == file.sha256) {
+                continue;
+            }
+
+            std::filesystem::create_directories(stagedPath.parent_path());
+
+            bool staged = false;
+
+            auto delta = std::find_if(
+                file.deltas.begin(), file.deltas.end(),
+                [&installedSha256](const Delta& delta) {
+                    return delta.baseSha256 == installedSha256;
+                });
+            if (delta != file.deltas.end()) {
+                auto deltaPath = WithSuffix(stagedPath, L".delta");
+
+                try {
+                    DownloadFile(delta->url.c_str(), deltaPath);
+                    downloadedSize += std::filesystem::file_size(deltaPath);
+                    ApplyDelta(file.installedPath, deltaPath, stagedPath);
+                    staged = GetFileSha256(stagedPath) == file.sha256;
+                    if (!staged) {
+                        LOG(L"Delta result hash mismatch for %s",
+                            file.stagedPath.c_str());
+                    }
+                } catch (const std::exception& e) {
+                    if (m_aborted) {
+                        return;
+                    }
+
+                    LOG(L"Applying the delta for %s failed: %S",
+                        file.stagedPath.c_str(), e.what());
+                }
+
+                DeleteFile(deltaPath.c_str());
+            }
+
+            if (staged) {
+                deltaCount++;
+                continue;
+            }
+
+            DownloadFile(file.url.c_str(), stagedPath);
+            downloadedSize += std::filesystem::file_size(stagedPath);
+            if (GetFileSha256(stagedPath) != file.sha256) {
+                DeleteFile(stagedPath.c_str());
+                throw std::runtime_error("Update file hash mismatch");
+            }
+
+            fullCount++;
+        }
+
+        std::ofstream readyMarker(GetReadyMarkerPath());
+        readyMarker.close();
+        if (!readyMarker) {
+            throw std::runtime_error("Writing the ready marker failed");
+        }
+
+        VERBOSE(L"Staged the update: %zu deltas, %zu full files, %I64u bytes",
+                deltaCount, fullCount, downloadedSize);
+        ready = true;
+    } catch (const std::exception& e) {
+        if (m_aborted) {
+            return;
+        }
+
+        LOG(L"Downloading the update failed: %S", e.what());
+    }
+
+    if (!m_aborted) {
+        m_onDone(ready);
+    }
+}
+
+void Downloader::DownloadFile(PCWSTR url,
+                              const std::filesystem::path& targetPath) {
+    CWinHTTPSimpleOptions options;
+    options.sURL = url;
+    options.sUserAgent = kUserAgent;
+    options.sFileToDownloadInto = targetPath.native();
+
+    CWinHTTPSimple httpSimple(std::move(options));
+
+    {
+        std::lock_guard<std::mutex> guard(m_currentRequestMutex);
+        if (m_aborted) {
+            throw std::runtime_error("Aborted");
+        }
+
+        m_currentRequest = &httpSimple;
+    }
+
+    auto clearCurrentRequest = wil::scope_exit([this] {
+        std::lock_guard<std::mutex> guard(m_currentRequestMutex);
+        m_currentRequest = nullptr;
+    });
+
+    httpSimple.SendRequest(nullptr);
+    THROW_IF_FAILED(httpSimple.GetRequestResult());
+}
+
+}  // namespace UpdatePackage
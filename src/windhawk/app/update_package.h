@@ -0,0 +1,63 @@
+#pragma once
+
+#include "winhttpsimple.h"
+
+// Updates of the app as packages of changed files, which the update check
+// response can list for the new version, one package per component (the app
+// itself, the engine, the UI and the compiler). Each file comes with its
+// SHA-256 hash, and optionally with binary deltas (MSDelta) against the hashes
+// of previous versions of the file. Only files whose content differs from the
+// installed one are downloaded, as a delta if there's one for the installed
+// content, and in full otherwise. The files are staged in the app data folder
+// in the background, and replace the installed files when the app is
+// restarted with -apply-update.
+namespace UpdatePackage {
+
+// Saves the package list of the app update in the online data, replacing the
+// staged files if they were staged for another version. If the response has
+// no package list, the staged files are removed.
+void SaveManifest(PCSTR onlineData, size_t onlineDataLength);
+
+// Removes the staged files, e.g. after the app was updated with the installer.
+void Discard();
+
+// Whether there's a saved package list whose files aren't staged yet.
+bool IsDownloadPending();
+
+// Whether all files of the saved package list are staged and verified.
+bool IsReady();
+
+// Replaces the installed files with the staged ones, and removes the staged
+// files. Must be called elevated in the non-portable version, and while no
+// other process of the app is running. Since the staging folder is writable
+// by the user, the package list is requested again and each file is verified
+// after it's copied to the installation folder. The files are replaced with
+// renames, which are rolled back if one of them fails.
+void Apply();
+
+// Stages the files of the saved package list on a low priority thread.
+class Downloader {
+   public:
+    // The callback is called on the download thread when it's done, unless
+    // it was aborted.
+    explicit Downloader(std::function<void(bool ready)> onDone);
+    ~Downloader();
+
+    Downloader(const Downloader&) = delete;
+    Downloader& operator=(const Downloader&) = delete;
+
+    void Abort();
+
+   private:
+    static DWORD WINAPI ThreadProc(void* parameter);
+    void Run();
+    void DownloadFile(PCWSTR url, const std::filesystem::path& targetPath);
+
+    std::function<void(bool ready)> m_onDone;
+    std::atomic<bool> m_aborted = false;
+    CWinHTTPSimple* m_currentRequest = nullptr;
+    std::mutex m_currentRequestMutex;
+    wil::unique_handle m_thread;
+};
+
+}  // namespace UpdatePackage
@@ -41,14 +41,95 @@ std::string GetCurrentOSVersion() {
            "." + std::to_string(buildNumber);
 }
 
+// The fields which are needed to get the update status and to check whether
+// the local content is up to date.
+constexpr std::string_view kUpdateStatusKeyPaths[] = {
+    "id",
+    "os",
+    "app/version",
+    "app/latestVersion",
+    "mods/*/version",
+    "mods/*/latestVersion",
+    "updateCheck",
+};
+
+// The fields of the online data which are used, a mod can also be a version
+// string.
+constexpr std::string_view kOnlineDataKeyPaths[] = {
+    "app/version",
+    "mods/*/metadata/version",
+    "delta",
+    "timestamp",
+};
+
+// Returns whether the key path leads to one of the patterns, or is inside of
+// one of them. "*" in a pattern matches any key.
+bool KeyPathMatches(const std::vector<std::string>& keyPath,
+                    std::span<const std::string_view> patterns) {
+    for (std::string_view pattern : patterns) {
+        bool matches = true;
+        for (const auto& key : keyPath) {
+            if (pattern.empty()) {
+                // The key path is inside of the pattern.
+                break;
+            }
+
+            size_t separator = pattern.find('/');
+            std::string_view patternKey = pattern.substr(0, separator);
+            if (patternKey != "*" && patternKey != key) {
+                matches = false;
+                break;
+            }
+
+            pattern = separator == pattern.npos
+                          ? std::string_view()
+                          : pattern.substr(separator + 1);
+        }
+
+        if (matches) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Parses the data and only stores the values of the given key paths. The rest
+// of the values are skipped without being added to the result, which saves
+// most of the allocations for large documents.
+template <typename InputType>
+json ParseJsonKeyPaths(InputType&& input,
+                       std::span<const std::string_view> patterns) {
+    std::vector<std::string> keyPath;
+
+    return json::parse(
+        std::forward<InputType>(input),
+        [&keyPath, patterns](int depth, json::parse_event_t event,
+                             json& parsed) {
+            if (event != json::parse_event_t::key) {
+                return true;
+            }
+
+            keyPath.resize(depth - 1);
+            keyPath.push_back(parsed.get<std::string>());
+            return KeyPathMatches(keyPath, patterns);
+        });
+}
+
 json ReadUserProfileJsonFromFile(
-    const std::filesystem::path& userProfileJsonPath) {
+    const std::filesystem::path& userProfileJsonPath,
+    std::span<const std::string_view> keyPathPatterns = {}) {
     json userProfileJson;
 
     std::ifstream userProfileFile(userProfileJsonPath);
     if (userProfileFile) {
         try {
-            userProfileFile >> userProfileJson;
+            if (keyPathPatterns.empty()) {
+                userProfileFile >> userProfileJson;
+            } else {
+                userProfileJson =
+                    ParseJsonKeyPaths(userProfileFile, keyPathPatterns);
+            }
         } catch (const std::exception& e) {
             LOG(L"Parsing userprofile.json failed: %S", e.what());
         }
@@ -61,12 +142,80 @@ json ReadUserProfileJsonFromFile(
     return userProfileJson;
 }
 
-json GetLocalUpdatedContent() {
-    auto userProfileJsonPath =
-        StorageManager::GetInstance().GetUserProfileJsonPath();
+// Writes to a temporary file which then replaces the file, so that readers,
+// such as the UI, never see a partially written file.
+void WriteUserProfileJsonToFile(
+    const std::filesystem::path& userProfileJsonPath,
+    const json& userProfileJson) {
+    auto tempPath = userProfileJsonPath;
+    tempPath += L".tmp";
 
-    json userProfileJson = ReadUserProfileJsonFromFile(userProfileJsonPath);
+    bool written = false;
+    {
+        std::ofstream userProfileFile(tempPath);
+        if (userProfileFile) {
+            userProfileFile << std::setw(2) << userProfileJson;
+            userProfileFile.close();
+            written = !userProfileFile.fail();
+        }
+    }
+
+    if (!written ||
+        !MoveFileEx(tempPath.c_str(), userProfileJsonPath.c_str(),
+                    MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        LOG(L"Updating userprofile.json failed (%s)",
+            userProfileJsonPath.c_str());
+        DeleteFile(tempPath.c_str());
+    }
+}
+
+// The validators can only be used if the last update check was done by this
+// app version and the server was asked about all of the installed mods.
+bool AreOnlineDataValidatorsUsable(const json& userProfileJson,
+                                   const json& updateCheck) {
+    if (!updateCheck.is_object()) {
+        return false;
+    }
+
+    auto appVersion = updateCheck.find("appVersion");
+    if (appVersion == updateCheck.end() ||
+        *appVersion != VER_FILE_VERSION_STR) {
+        return false;
+    }
+
+    auto checkedMods = updateCheck.find("mods");
+    if (checkedMods == updateCheck.end() || !checkedMods->is_array()) {
+        return false;
+    }
 
+    auto mods = userProfileJson.find("mods");
+    if (mods == userProfileJson.end() || !mods->is_object()) {
+        return true;
+    }
+
+    for (const auto& [key, value] : mods->items()) {
+        if (std::find(checkedMods->begin(), checkedMods->end(), key) ==
+            checkedMods->end()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::wstring GetOnlineDataValidator(const json& updateCheck, PCSTR name) {
+    auto value = updateCheck.find(name);
+    if (value == updateCheck.end() || !value->is_string()) {
+        return std::wstring();
+    }
+
+    return std::wstring(
+        CA2W(value->get_ref<const std::string&>().c_str(), CP_UTF8).m_psz);
+}
+
+// Returns whether the content was changed. Only changes the fields of
+// kUpdateStatusKeyPaths.
+bool UpdateLocalContent(json& userProfileJson) {
     bool updatedData = false;
 
     // Update user id if necessary.
@@ -97,23 +246,35 @@ json GetLocalUpdatedContent() {
         updatedData = true;
     }
 
+    // Drop the validators of the last online data if they can't be used.
+    auto updateCheck = userProfileJson.find("updateCheck");
+    if (updateCheck != userProfileJson.end() &&
+        !AreOnlineDataValidatorsUsable(userProfileJson, *updateCheck)) {
+        userProfileJson.erase(updateCheck);
+        updatedData = true;
+    }
+
+    return updatedData;
+}
+
+json GetLocalUpdatedContent() {
+    auto userProfileJsonPath =
+        StorageManager::GetInstance().GetUserProfileJsonPath();
+
+    json userProfileJson = ReadUserProfileJsonFromFile(userProfileJsonPath);
+
     // Save data.
-    if (updatedData) {
-        std::ofstream userProfileFile(userProfileJsonPath);
-        if (userProfileFile) {
-            userProfileFile << std::setw(2) << userProfileJson;
-        } else {
-            LOG(L"Updating userprofile.json failed (%s)",
-                userProfileJsonPath.c_str());
-        }
+    if (UpdateLocalContent(userProfileJson)) {
+        WriteUserProfileJsonToFile(userProfileJsonPath, userProfileJson);
     }
 
     return userProfileJson;
 }
 
 // https://stackoverflow.com/a/54067471
-// Method to compare two version strings.
-bool version_less_than(std::string v1, std::string v2) {
+// Method to compare two version strings. The components are parsed in place,
+// without copying the strings.
+bool version_less_than(std::string_view v1, std::string_view v2) {
     size_t i = 0, j = 0;
     while (i < v1.length() || j < v2.length()) {
         int acc1 = 0, acc2 = 0;
@@ -140,20 +301,97 @@ bool version_less_than(std::string v1, std::string v2) {
     return false;
 }
 
+bool IsAppUpdateAvailable(const json& userProfileJson) {
+    auto app = userProfileJson.find("app");
+    if (app == userProfileJson.end() || !app->is_object()) {
+        return false;
+    }
+
+    auto version = app->find("version");
+    auto latestVersion = app->find("latestVersion");
+    return version != app->end() && latestVersion != app->end() &&
+           version->is_string() && latestVersion->is_string() &&
+           *latestVersion != "" &&
+           version_less_than(version->get_ref<const std::string&>(),
+                             latestVersion->get_ref<const std::string&>());
+}
+
+int CountModUpdatesAvailable(const json& userProfileJson) {
+    int count = 0;
+
+    auto mods = userProfileJson.find("mods");
+    if (mods != userProfileJson.end() && mods->is_object()) {
+        for (auto& [key, mod] : mods->items()) {
+            if (mod.is_object()) {
+                auto modVersion = mod.find("version");
+                auto latestModVersion = mod.find("latestVersion");
+                if (modVersion != mod.end() && latestModVersion != mod.end() &&
+                    modVersion->is_string() && latestModVersion->is_string() &&
+                    *latestModVersion != "" &&
+                    *modVersion != *latestModVersion) {
+                    count++;
+                }
+            }
+        }
+    }
+
+    return count;
+}
+
 }  // namespace
 
 namespace UserProfile {
 
 std::string GetLocalUpdatedContentAsString() {
-    return GetLocalUpdatedContent().dump(2);
+    json userProfileJson = GetLocalUpdatedContent();
+
+    // The server only needs the timestamp, to reply with a delta.
+    auto updateCheck = userProfileJson.find("updateCheck");
+    if (updateCheck != userProfileJson.end()) {
+        auto timestamp = updateCheck->find("timestamp");
+        json since = timestamp != updateCheck->end() ? *timestamp : json();
+        userProfileJson.erase(updateCheck);
+        if (since.is_string()) {
+            userProfileJson["since"] = std::move(since);
+        }
+    }
+
+    return userProfileJson.dump(2);
 }
 
-UpdateStatus UpdateContentWithOnlineData(PCSTR onlineData,
-                                         size_t onlineDataLength) {
+OnlineDataValidators GetOnlineDataValidators() {
+    auto userProfileJsonPath =
+        StorageManager::GetInstance().GetUserProfileJsonPath();
+
+    const json userProfileJson =
+        ReadUserProfileJsonFromFile(userProfileJsonPath, kUpdateStatusKeyPaths);
+
+    auto updateCheck = userProfileJson.find("updateCheck");
+    if (updateCheck == userProfileJson.end() ||
+        !AreOnlineDataValidatorsUsable(userProfileJson, *updateCheck)) {
+        return {};
+    }
+
+    return OnlineDataValidators{
+        .eTag = GetOnlineDataValidator(*updateCheck, "eTag"),
+        .lastModified = GetOnlineDataValidator(*updateCheck, "lastModified"),
+        .timestamp = GetOnlineDataValidator(*updateCheck, "timestamp"),
+    };
+}
+
+UpdateStatus UpdateContentWithOnlineData(
+    PCSTR onlineData,
+    size_t onlineDataLength,
+    const OnlineDataValidators& validators) {
     UpdateStatus updateStatus{};
 
-    const json onlineDataJson =
-        json::parse(onlineData, onlineData + onlineDataLength);
+    const json onlineDataJson = ParseJsonKeyPaths(
+        std::string_view(onlineData, onlineDataLength), kOnlineDataKeyPaths);
+
+    // A delta only lists the mods whose versions changed since the posted
+    // timestamp, the versions of the rest of the mods are kept.
+    auto delta = onlineDataJson.find("delta");
+    bool isDelta = delta != onlineDataJson.end() && *delta == true;
 
     auto userProfileJsonPath =
         StorageManager::GetInstance().GetUserProfileJsonPath();
@@ -189,7 +427,7 @@ UpdateStatus UpdateContentWithOnlineData(PCSTR onlineData,
         if (!onlineLatestVersion.empty()) {
             auto version = app.find("version");
             if (version != app.end() && version->is_string() &&
-                version_less_than(version->get<std::string>(),
+                version_less_than(version->get_ref<const std::string&>(),
                                   onlineLatestVersion)) {
                 updateStatus.appUpdateAvailable = true;
                 if (prevLatestVersion.empty() ||
@@ -249,57 +487,82 @@ UpdateStatus UpdateContentWithOnlineData(PCSTR onlineData,
         }
     }
 
+    if (isDelta) {
+        updateStatus.modUpdatesAvailable =
+            CountModUpdatesAvailable(userProfileJson);
+    }
+
+    // Keep the validators for the next update check. The timestamp is taken
+    // from the online data rather than from the argument.
+    json updateCheck = json::object();
+    if (!validators.eTag.empty()) {
+        updateCheck["eTag"] = CW2A(validators.eTag.c_str(), CP_UTF8).m_psz;
+    }
+
+    if (!validators.lastModified.empty()) {
+        updateCheck["lastModified"] =
+            CW2A(validators.lastModified.c_str(), CP_UTF8).m_psz;
+    }
+
+    auto timestamp = onlineDataJson.find("timestamp");
+    if (timestamp != onlineDataJson.end()) {
+        updateCheck["timestamp"] = timestamp->is_string()
+                                       ? timestamp->get<std::string>()
+                                       : timestamp->dump();
+    }
+
+    if (updateCheck.empty()) {
+        if (userProfileJson.erase("updateCheck")) {
+            updatedData = true;
+        }
+    } else {
+        updateCheck["appVersion"] = VER_FILE_VERSION_STR;
+
+        json checkedMods = json::array();
+        for (const auto& [key, value] : mods.items()) {
+            checkedMods.push_back(key);
+        }
+
+        updateCheck["mods"] = std::move(checkedMods);
+
+        auto& prevUpdateCheck = userProfileJson["updateCheck"];
+        if (prevUpdateCheck != updateCheck) {
+            prevUpdateCheck = std::move(updateCheck);
+            updatedData = true;
+        }
+    }
+
     // Save data.
     if (updatedData) {
-        std::ofstream userProfileFile(userProfileJsonPath);
-        if (userProfileFile) {
-            userProfileFile << std::setw(2) << userProfileJson;
-        } else {
-            LOG(L"Updating userprofile.json failed (%s)",
-                userProfileJsonPath.c_str());
-        }
+        WriteUserProfileJsonToFile(userProfileJsonPath, userProfileJson);
     }
 
     return updateStatus;
 }
 
+UpdateStatus UpdateContentNotModified() {
+    // Nothing changed since the last update check, so no new updates were
+    // found.
+    return GetUpdateStatus();
+}
+
 UpdateStatus GetUpdateStatus() {
     UpdateStatus updateStatus{};
 
-    const json userProfileJson = GetLocalUpdatedContent();
+    auto userProfileJsonPath =
+        StorageManager::GetInstance().GetUserProfileJsonPath();
 
-    // Check app update.
-    {
-        auto app = userProfileJson.find("app");
-        if (app != userProfileJson.end() && app->is_object()) {
-            auto version = app->find("version");
-            auto latestVersion = app->find("latestVersion");
-            if (version != app->end() && latestVersion != app->end() &&
-                version->is_string() && latestVersion->is_string() &&
-                *latestVersion != "" &&
-                version_less_than(version->get<std::string>(),
-                                  latestVersion->get<std::string>())) {
-                updateStatus.appUpdateAvailable = true;
-            }
-        }
+    // The needed fields are enough to tell whether the file has to be
+    // updated, which is rare, and only then it's read and written in full.
+    json userProfileJson =
+        ReadUserProfileJsonFromFile(userProfileJsonPath, kUpdateStatusKeyPaths);
+    if (UpdateLocalContent(userProfileJson)) {
+        userProfileJson = GetLocalUpdatedContent();
     }
 
-    // Check mod updates.
-    auto mods = userProfileJson.find("mods");
-    if (mods != userProfileJson.end() && mods->is_object()) {
-        for (auto& [key, mod] : mods->items()) {
-            if (mod.is_object()) {
-                auto modVersion = mod.find("version");
-                auto latestModVersion = mod.find("latestVersion");
-                if (modVersion != mod.end() && latestModVersion != mod.end() &&
-                    modVersion->is_string() && latestModVersion->is_string() &&
-                    *latestModVersion != "" &&
-                    *modVersion != *latestModVersion) {
-                    updateStatus.modUpdatesAvailable++;
-                }
-            }
-        }
-    }
+    updateStatus.appUpdateAvailable = IsAppUpdateAvailable(userProfileJson);
+    updateStatus.modUpdatesAvailable =
+        CountModUpdatesAvailable(userProfileJson);
 
     return updateStatus;
 }
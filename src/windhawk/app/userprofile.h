@@ -8,9 +8,26 @@ struct UpdateStatus {
     bool newUpdatesFound;
 };
 
+// The values of the last online data response, sent with the next update
+// check so that the server can reply that nothing changed, or reply with a
+// delta which only lists the mods whose versions changed since the timestamp.
+// Empty if there was no such response, or if mods were installed since then,
+// since the server never sent their versions.
+struct OnlineDataValidators {
+    std::wstring eTag;
+    std::wstring lastModified;
+    std::wstring timestamp;
+};
+
+// The posted content includes the timestamp of the validators.
 std::string GetLocalUpdatedContentAsString();
-UpdateStatus UpdateContentWithOnlineData(PCSTR onlineData,
-                                         size_t onlineDataLength);
+OnlineDataValidators GetOnlineDataValidators();
+UpdateStatus UpdateContentWithOnlineData(
+    PCSTR onlineData,
+    size_t onlineDataLength,
+    const OnlineDataValidators& validators);
+// For a response which tells that the online data wasn't modified.
+UpdateStatus UpdateContentNotModified();
 UpdateStatus GetUpdateStatus();
 
 }  // namespace UserProfile
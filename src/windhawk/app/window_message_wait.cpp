@@ -0,0 +1,32 @@
+#include "stdafx.h"
+
+#include "window_message_wait.h"
+
+WindowMessageWait::WindowMessageWait(HANDLE handle,
+                                     HWND hWnd,
+                                     UINT message,
+                                     WPARAM wParam)
+    : m_handle(handle), m_hWnd(hWnd), m_message(message), m_wParam(wParam) {
+    m_wait.reset(CreateThreadpoolWait(WaitCallback, this, nullptr));
+    THROW_LAST_ERROR_IF_NULL(m_wait);
+
+    Rearm();
+}
+
+HANDLE WindowMessageWait::GetHandle() const {
+    return m_handle;
+}
+
+void WindowMessageWait::Rearm() {
+    SetThreadpoolWait(m_wait.get(), m_handle, nullptr);
+}
+
+// static
+void CALLBACK WindowMessageWait::WaitCallback(PTP_CALLBACK_INSTANCE instance,
+                                              PVOID context,
+                                              PTP_WAIT wait,
+                                              TP_WAIT_RESULT waitResult) {
+    auto* messageWait = static_cast<WindowMessageWait*>(context);
+    ::PostMessage(messageWait->m_hWnd, messageWait->m_message,
+                  messageWait->m_wParam, 0);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+// Posts a message to a window when a handle is signaled, using a threadpool
+// wait, so that the thread of the window only has to process window messages.
+// The wait is done once: after handling the message, call Rearm to wait for
+// the next signal, so that a handle which stays signaled until it's handled
+// doesn't flood the window with messages.
+class WindowMessageWait {
+   public:
+    WindowMessageWait(HANDLE handle, HWND hWnd, UINT message, WPARAM wParam);
+
+    WindowMessageWait(const WindowMessageWait&) = delete;
+    WindowMessageWait& operator=(const WindowMessageWait&) = delete;
+
+    HANDLE GetHandle() const;
+    void Rearm();
+
+   private:
+    static void CALLBACK WaitCallback(PTP_CALLBACK_INSTANCE instance,
+                                      PVOID context,
+                                      PTP_WAIT wait,
+                                      TP_WAIT_RESULT waitResult);
+
+    HANDLE m_handle;
+    HWND m_hWnd;
+    UINT m_message;
+    WPARAM m_wParam;
+    // Declared last, so that the callbacks are done before the rest is
+    // destroyed.
+    wil::unique_threadpool_wait m_wait;
+};
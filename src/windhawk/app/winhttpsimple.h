@@ -18,6 +18,8 @@ struct CWinHTTPSimpleOptions
 	LPCVOID        lpRequest = NULL;               // The in memory data to send in the HTTP request
 	DWORD          dwRequestSize = 0;              // The size in bytes of lpRequest
 	double         dbLimit = 0;                    // For bandwidth throttling, The value in KB/Second to limit the connection to
+	std::wstring   sIfNoneMatch;                   // The ETag of a previous response, for a conditional request
+	std::wstring   sIfModifiedSince;               // The Last-Modified value of a previous response, for a conditional request
 
 	DWORD          dwAccessType = WINHTTP_ACCESS_TYPE_DEFAULT_PROXY;
 	                                               // WINHTTP_ACCESS_TYPE_XXX, proxy/direct connection type
@@ -88,6 +90,16 @@ class CWinHTTPSimple
 		}
 
 	protected:
+		HRESULT OnCheckStatusCode() override
+		{
+			// A conditional request which wasn't modified is a success with
+			// an empty response
+			if (m_dwStatusCode.value() == HTTP_STATUS_NOT_MODIFIED)
+				return S_OK;
+
+			return __super::OnCheckStatusCode();
+		}
+
 		virtual HRESULT OnCallback(_In_ HINTERNET hInternet, _In_ DWORD dwInternetStatus, _In_opt_ LPVOID lpvStatusInformation, _In_ DWORD dwStatusInformationLength)
 		{
 			// Let the base class do the real work
@@ -203,6 +215,18 @@ public:
 			nAcceptTypes ? ppszAcceptTypes.data() : WINHTTP_DEFAULT_ACCEPT_TYPES,
 			urlComponents.nScheme == INTERNET_SCHEME_HTTPS ? WINHTTP_FLAG_SECURE : 0);
 		ATLENSURE_SUCCEEDED(hr);
+
+		if (options.sIfNoneMatch.length())
+		{
+			hr = AddHeaders((L"If-None-Match: " + options.sIfNoneMatch).c_str(), static_cast<DWORD>(-1L), WINHTTP_ADDREQ_FLAG_ADD);
+			ATLENSURE_SUCCEEDED(hr);
+		}
+
+		if (options.sIfModifiedSince.length())
+		{
+			hr = AddHeaders((L"If-Modified-Since: " + options.sIfModifiedSince).c_str(), static_cast<DWORD>(-1L), WINHTTP_ADDREQ_FLAG_ADD);
+			ATLENSURE_SUCCEEDED(hr);
+		}
 	}
 
 	HRESULT AddHeaders(LPCWSTR pwszHeaders, DWORD dwHeadersLength, DWORD dwModifiers)
@@ -236,6 +260,28 @@ public:
 		return m_downloadRequest.QueryHeaders(dwInfoLevel, pwszName, lpBuffer, dwBufferLength, lpdwIndex);
 	}
 
+	// Returns an empty string if the response has no such header
+	std::wstring QueryHeaderString(DWORD dwInfoLevel)
+	{
+		DWORD dwBufferLength = 0;
+		HRESULT hr = QueryHeaders(dwInfoLevel, WINHTTP_HEADER_NAME_BY_INDEX, WINHTTP_NO_OUTPUT_BUFFER, dwBufferLength, WINHTTP_NO_HEADER_INDEX);
+		if (hr != ATL::AtlHresultFromWin32(ERROR_INSUFFICIENT_BUFFER))
+			return std::wstring();
+
+		std::wstring sValue(dwBufferLength / sizeof(WCHAR), L'\0');
+		hr = QueryHeaders(dwInfoLevel, WINHTTP_HEADER_NAME_BY_INDEX, sValue.data(), dwBufferLength, WINHTTP_NO_HEADER_INDEX);
+		if (FAILED(hr))
+			return std::wstring();
+
+		sValue.resize(dwBufferLength / sizeof(WCHAR));
+		return sValue;
+	}
+
+	bool IsNotModified()
+	{
+		return GetLastStatusCode() == HTTP_STATUS_NOT_MODIFIED;
+	}
+
 	HRESULT GetRequestResult()
 	{
 		return m_downloadRequest.GetHresult();
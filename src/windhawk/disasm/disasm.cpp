@@ -0,0 +1,133 @@
+// The disassemblers used by Wh_Disasm and Wh_DisasmRange, in a library which
+// the engine only loads on first use, since most processes never need them.
+// The context is allocated by the caller, so that the library is stateless
+// and the engine doesn't have to free anything when it unloads.
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <algorithm>
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <Zydis/Zydis.h>
+#elif defined(_M_ARM64)
+#include <binaryninja-arm64-disassembler/decompose_and_disassemble.h>
+#else
+#error "Unsupported architecture"
+#endif
+
+namespace {
+
+struct DisasmContext {
+#if defined(_M_IX86) || defined(_M_X64)
+    ZydisDecoder decoder;
+    ZydisFormatter formatter;
+#else
+    // The ARM64 disassembler has no state.
+    BYTE unused;
+#endif
+};
+
+}  // namespace
+
+BOOL APIENTRY DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved) {
+    return TRUE;
+}
+
+// Exported
+SIZE_T DisasmGetContextSize() {
+    return sizeof(DisasmContext);
+}
+
+// Exported
+BOOL DisasmInitContext(void* context) {
+#if defined(_M_IX86) || defined(_M_X64)
+    auto* disasmContext = static_cast<DisasmContext*>(context);
+
+#if defined(_M_IX86)
+    auto machineMode = ZYDIS_MACHINE_MODE_LEGACY_32;
+    auto stackWidth = ZYDIS_STACK_WIDTH_32;
+#else
+    auto machineMode = ZYDIS_MACHINE_MODE_LONG_64;
+    auto stackWidth = ZYDIS_STACK_WIDTH_64;
+#endif
+
+    if (!ZYAN_SUCCESS(ZydisDecoderInit(&disasmContext->decoder, machineMode,
+                                       stackWidth))) {
+        return FALSE;
+    }
+
+    if (!ZYAN_SUCCESS(ZydisFormatterInit(&disasmContext->formatter,
+                                         ZYDIS_FORMATTER_STYLE_INTEL))) {
+        return FALSE;
+    }
+#endif
+
+    return TRUE;
+}
+
+// Exported
+// Decodes a single instruction which is at most maxLength bytes long. Returns
+// zero on success, or an error code of the underlying disassembler. If text is
+// null, the instruction isn't formatted.
+UINT32 DisasmInstruction(void* context,
+                         const void* address,
+                         SIZE_T maxLength,
+                         SIZE_T* length,
+                         PSTR text,
+                         SIZE_T textSize) {
+#if defined(_M_ARM64)
+    if (maxLength < sizeof(DWORD)) {
+        return ERROR_INSUFFICIENT_BUFFER;
+    }
+
+    // Decoding and formatting are done in a single call.
+    char buffer[128];
+    int rc = aarch64_decompose_and_disassemble(
+        reinterpret_cast<ULONG_PTR>(address),
+        *reinterpret_cast<const DWORD*>(address), text ? text : buffer,
+        text ? textSize : sizeof(buffer));
+    if (rc) {
+        return static_cast<UINT32>(rc);
+    }
+
+    *length = sizeof(DWORD);
+    return 0;
+#else
+    auto* disasmContext = static_cast<DisasmContext*>(context);
+
+    ZydisDecoderContext decoderContext;
+    ZydisDecodedInstruction instruction;
+    ZyanStatus status = ZydisDecoderDecodeInstruction(
+        &disasmContext->decoder, &decoderContext, address,
+        std::min(maxLength, SIZE_T{ZYDIS_MAX_INSTRUCTION_LENGTH}),
+        &instruction);
+    if (!ZYAN_SUCCESS(status)) {
+        return status;
+    }
+
+    *length = instruction.length;
+
+    if (!text) {
+        return 0;
+    }
+
+    ZydisDecodedOperand operands[ZYDIS_MAX_OPERAND_COUNT];
+    status = ZydisDecoderDecodeOperands(&disasmContext->decoder,
+                                        &decoderContext, &instruction,
+                                        operands, instruction.operand_count);
+    if (!ZYAN_SUCCESS(status)) {
+        return status;
+    }
+
+    status = ZydisFormatterFormatInstruction(
+        &disasmContext->formatter, &instruction, operands,
+        instruction.operand_count_visible, text, textSize,
+        reinterpret_cast<ZyanU64>(address), nullptr);
+    if (!ZYAN_SUCCESS(status)) {
+        return status;
+    }
+
+    return 0;
+#endif
+}
@@ -1,8 +1,10 @@
 #include "stdafx.h"
 
 #include "all_processes_injector.h"
+#include "customization_session.h"
 #include "dll_inject.h"
 #include "functions.h"
+#include "injection_stats.h"
 #include "logger.h"
 #include "process_lists.h"
 #include "session_private_namespace.h"
@@ -13,8 +15,16 @@
 #define STATUS_NO_MORE_ENTRIES ((NTSTATUS)0x8000001AL)
 #endif
 
+#ifndef STATUS_INFO_LENGTH_MISMATCH
+#define STATUS_INFO_LENGTH_MISMATCH ((NTSTATUS)0xC0000004L)
+#endif
+
 namespace {
 
+// The default limit of processes which are handled in parallel. The work is
+// mostly cross-process calls, so more threads mostly contend in the kernel.
+constexpr DWORD kDefaultMaxInjectionConcurrency = 4;
+
 struct __declspec(align(16)) MY_CONTEXT_AMD64 {
     DWORD64 dummy1[6];
     DWORD ContextFlags;
@@ -49,6 +59,141 @@ struct __declspec(align(16)) MY_CONTEXT_AMD64 {
 
 #define MY_CONTEXT_AMD64_CONTROL 0x100001
 
+// The beginning of SYSTEM_PROCESS_INFORMATION, only the used fields.
+struct MY_SYSTEM_PROCESS_INFORMATION {
+    ULONG NextEntryOffset;
+    ULONG NumberOfThreads;
+    LARGE_INTEGER WorkingSetPrivateSize;
+    ULONG HardFaultCount;
+    ULONG NumberOfThreadsHighWatermark;
+    ULONGLONG CycleTime;
+    LARGE_INTEGER CreateTime;
+    LARGE_INTEGER UserTime;
+    LARGE_INTEGER KernelTime;
+    struct {
+        USHORT Length;
+        USHORT MaximumLength;
+        PWSTR Buffer;
+    } ImageName;
+    LONG BasePriority;
+    HANDLE UniqueProcessId;
+};
+
+constexpr ULONG MY_SystemProcessInformation = 5;
+
+// Returns the thread count of all processes with a single system call,
+// which is much cheaper than walking the threads of each process when
+// injecting into all of the processes at once.
+std::unordered_map<DWORD, AllProcessesInjector::ProcessSnapshotEntry>
+QueryProcessSnapshot() {
+    using NtQuerySystemInformation_t = NTSTATUS(NTAPI*)(
+        _In_ ULONG SystemInformationClass, _Out_ PVOID SystemInformation,
+        _In_ ULONG SystemInformationLength, _Out_opt_ PULONG ReturnLength);
+
+    GET_PROC_ADDRESS_ONCE(NtQuerySystemInformation_t,
+                          pNtQuerySystemInformation, L"ntdll.dll",
+                          "NtQuerySystemInformation");
+
+    if (!pNtQuerySystemInformation) {
+        throw std::runtime_error("NtQuerySystemInformation not found");
+    }
+
+    std::vector<BYTE> buffer(0x40000);
+    while (true) {
+        ULONG returnLength = 0;
+        NTSTATUS status = pNtQuerySystemInformation(
+            MY_SystemProcessInformation, buffer.data(),
+            wil::safe_cast<ULONG>(buffer.size()), &returnLength);
+        if (status != STATUS_INFO_LENGTH_MISMATCH) {
+            THROW_IF_NTSTATUS_FAILED(status);
+            break;
+        }
+
+        // Leave room for processes created in the meantime.
+        buffer.resize(std::max(buffer.size() * 2,
+                               static_cast<size_t>(returnLength) + 0x10000));
+    }
+
+    std::unordered_map<DWORD, AllProcessesInjector::ProcessSnapshotEntry>
+        snapshot;
+
+    for (size_t offset = 0;;) {
+        auto* entry = reinterpret_cast<const MY_SYSTEM_PROCESS_INFORMATION*>(
+            buffer.data() + offset);
+
+        DWORD processId = static_cast<DWORD>(
+            reinterpret_cast<ULONG_PTR>(entry->UniqueProcessId));
+        snapshot[processId] = {
+            .createTime = static_cast<ULONGLONG>(entry->CreateTime.QuadPart),
+            .threadCount = entry->NumberOfThreads,
+            .imageName = std::wstring(
+                entry->ImageName.Buffer,
+                entry->ImageName.Length / sizeof(WCHAR)),
+        };
+
+        if (!entry->NextEntryOffset) {
+            break;
+        }
+
+        offset += entry->NextEntryOffset;
+    }
+
+    return snapshot;
+}
+
+// Returns a pattern of the processes which should be injected into first when
+// injecting into all of the running processes: the shell processes, and the
+// processes which are included by name by enabled mods. It's only used for
+// ordering, so it doesn't have to be accurate, e.g. the mod exclusions and
+// architectures are ignored.
+std::wstring GetPriorityPattern() {
+    std::wstring pattern = ProcessLists::kShellProcesses;
+
+    StorageManager::GetInstance().EnumMods([&pattern](PCWSTR modName) {
+        try {
+            auto settings = StorageManager::GetInstance()
+                                .GetModConfig(modName, nullptr)
+                                ->ReadAll();
+            if (settings.GetInt(L"Disabled").value_or(0)) {
+                return;
+            }
+
+            auto addIncludePattern = [&pattern, &settings](PCWSTR name) {
+                auto include = settings.GetString(name).value_or(L"");
+                if (!include.empty()) {
+                    pattern += L'|';
+                    pattern += include;
+                }
+            };
+
+            if (!settings.GetInt(L"IncludeExcludeCustomOnly").value_or(0)) {
+                addIncludePattern(L"Include");
+            }
+
+            addIncludePattern(L"IncludeCustom");
+        } catch (const std::exception& e) {
+            LOG(L"Error reading the config of mod %s: %S", modName, e.what());
+        }
+    });
+
+    return pattern;
+}
+
+std::optional<ULONGLONG> GetProcessCreateTime(HANDLE hProcess) {
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetProcessTimes(hProcess, &creationTime, &exitTime, &kernelTime,
+                         &userTime)) {
+        return std::nullopt;
+    }
+
+    ULARGE_INTEGER createTime{
+        .LowPart = creationTime.dwLowDateTime,
+        .HighPart = creationTime.dwHighDateTime,
+    };
+
+    return createTime.QuadPart;
+}
+
 USHORT GetNativeMachineImpl() {
     using IsWow64Process2_t = BOOL(WINAPI*)(
         HANDLE hProcess, USHORT * pProcessMachine, USHORT * pNativeMachine);
@@ -97,6 +242,7 @@ USHORT GetNativeMachine() {
 // querying its initial instruction pointer. For details of why it's needed,
 // look for the mention of RtlUserThreadStart in
 // https://m417z.com/Implementing-Global-Injection-and-Hooking-in-Windows/.
+#if defined(_M_IX86) || defined(_M_ARM64)
 DWORD64 GetRtlUserThreadStart_x64OnArm64() {
     std::filesystem::path x64HelperPath =
         wil::GetModuleFileName<std::wstring>();
@@ -125,11 +271,17 @@ DWORD64 GetRtlUserThreadStart_x64OnArm64() {
     THROW_IF_NTSTATUS_FAILED(result);
 
     return context.Pc;
-#else
-#error "Unsupported architecture"
-#endif  // _M_IX86
+#elif defined(_M_ARM64)
+    CONTEXT context;
+    context.ContextFlags = CONTEXT_CONTROL;
+    THROW_IF_WIN32_BOOL_FALSE(GetThreadContext(process.hThread, &context));
+
+    return context.Pc;
+#endif
 }
+#endif  // defined(_M_IX86) || defined(_M_ARM64)
 
+#ifdef _M_IX86
 void GetThreadContext64(HANDLE thread, CONTEXT* context) {
     STATIC_INIT_ONCE_TRIVIAL(DWORD64, pNtGetContextThread, []() {
         auto ntdll = wow64pp::module_handle("ntdll.dll");
@@ -142,6 +294,7 @@ void GetThreadContext64(HANDLE thread, CONTEXT* context) {
     NTSTATUS result = static_cast<NTSTATUS>(result64);
     THROW_IF_NTSTATUS_FAILED(result);
 }
+#endif  // _M_IX86
 
 HANDLE CreateProcessInitAPCMutex(DWORD processId, BOOL initialOwner) {
     WCHAR szMutexName[SessionPrivateNamespace::kPrivateNamespaceMaxLen +
@@ -179,6 +332,48 @@ HANDLE OpenProcessInitAPCMutex(DWORD processId, DWORD desiredAccess) {
     return OpenMutex(desiredAccess, FALSE, szMutexName);
 }
 
+// Work items submitted to a thread pool, which are waited for on destruction.
+class InjectionBatch {
+   public:
+    explicit InjectionBatch(PTP_POOL pool) {
+        InitializeThreadpoolEnvironment(&m_environment);
+        SetThreadpoolCallbackPool(&m_environment, pool);
+
+        m_cleanupGroup.reset(CreateThreadpoolCleanupGroup());
+        if (m_cleanupGroup) {
+            SetThreadpoolCallbackCleanupGroup(&m_environment,
+                                              m_cleanupGroup.get(), nullptr);
+        }
+    }
+
+    ~InjectionBatch() {
+        if (m_cleanupGroup) {
+            CloseThreadpoolCleanupGroupMembers(m_cleanupGroup.get(), FALSE,
+                                               nullptr);
+        }
+
+        DestroyThreadpoolEnvironment(&m_environment);
+    }
+
+    InjectionBatch(const InjectionBatch&) = delete;
+    InjectionBatch(InjectionBatch&&) = delete;
+    InjectionBatch& operator=(const InjectionBatch&) = delete;
+    InjectionBatch& operator=(InjectionBatch&&) = delete;
+
+    bool IsValid() const { return !!m_cleanupGroup; }
+
+    bool Submit(PTP_SIMPLE_CALLBACK callback, PVOID context) {
+        return TrySubmitThreadpoolCallback(callback, context, &m_environment);
+    }
+
+   private:
+    TP_CALLBACK_ENVIRON m_environment;
+    wil::unique_any<PTP_CLEANUP_GROUP,
+                    decltype(&::CloseThreadpoolCleanupGroup),
+                    ::CloseThreadpoolCleanupGroup>
+        m_cleanupGroup;
+};
+
 }  // namespace
 
 AllProcessesInjector::AllProcessesInjector() {
@@ -207,47 +402,227 @@ AllProcessesInjector::AllProcessesInjector() {
                 GetRtlUserThreadStart_x64OnArm64();
         }
     }
+#elif defined(_M_X64) || defined(_M_ARM64)
+    // A native session manager injects into the WOW64 processes as well, the
+    // initial thread of which starts in the native ntdll too.
+    USHORT nativeMachine = GetNativeMachine();
+#if defined(_M_X64)
+    if (nativeMachine != IMAGE_FILE_MACHINE_AMD64) {
+        // Under emulation, only the emulated contexts of the threads are
+        // available. The ARM64 build is used on ARM64 instead.
+        throw std::runtime_error("Unsupported native architecture");
+    }
+#endif  // _M_X64
+
+    m_pRtlUserThreadStart = reinterpret_cast<DWORD64>(
+        GetProcAddress(hNtdll, "RtlUserThreadStart"));
+
+#if defined(_M_ARM64)
+    if (nativeMachine == IMAGE_FILE_MACHINE_ARM64) {
+        m_pRtlUserThreadStart_x64OnArm64 = GetRtlUserThreadStart_x64OnArm64();
+    }
+#endif  // _M_ARM64
 #else
 #error "Unsupported architecture"
-#endif  // _M_IX86
+#endif
     THROW_LAST_ERROR_IF(m_pRtlUserThreadStart == 0);
 
     m_appPrivateNamespace =
         SessionPrivateNamespace::Create(GetCurrentProcessId());
 
+    // Statistics are only used for diagnostics, injection works without them.
+    try {
+        m_injectionStats = InjectionStats::Create();
+    } catch (const std::exception& e) {
+        LOG(L"Failed to create injection stats: %S", e.what());
+    }
+
+    // Without a snapshot, the engines read the mods config from storage.
+    try {
+        m_modConfigSnapshotPublisher.emplace();
+    } catch (const std::exception& e) {
+        LOG(L"Failed to publish the mod config snapshot: %S", e.what());
+    }
+
+    // Without it, the mod statuses and tasks aren't shown in the app.
+    try {
+        m_modStatusTable.emplace();
+    } catch (const std::exception& e) {
+        LOG(L"Failed to create the mod status table: %S", e.what());
+    }
+
+    // Without it, crash loops are only detected by the app from the event log,
+    // and only for explorer.
+    try {
+        m_crashLoopGuard.emplace();
+    } catch (const std::exception& e) {
+        LOG(L"Failed to create the crash loop table: %S", e.what());
+    }
+
+    // Without it, mods can't be paused.
+    try {
+        m_modsPause.emplace();
+    } catch (const std::exception& e) {
+        LOG(L"Failed to create the mods pause state: %S", e.what());
+    }
+
+    // Without it, sessions end once the session manager exits, after waiting
+    // for a handover.
+    try {
+        m_sessionShutdown.emplace();
+    } catch (const std::exception& e) {
+        LOG(L"Failed to create the session shutdown state: %S", e.what());
+    }
+
+    // Without it, unused mod files are only deleted when the mod is compiled
+    // or installed again.
+    try {
+        m_modFilesCleanup.emplace();
+    } catch (const std::exception& e) {
+        LOG(L"Failed to schedule the mod files cleanup: %S", e.what());
+    }
+
     auto settings = StorageManager::GetInstance().GetAppConfig(L"Settings");
-    m_includePattern = settings->GetString(L"Include").value_or(L"");
-    m_excludePattern = settings->GetString(L"Exclude").value_or(L"");
-    m_threadAttachExemptPattern =
-        settings->GetString(L"ThreadAttachExempt").value_or(L"");
 
-    if (!settings->GetInt(L"InjectIntoCriticalProcesses").value_or(0)) {
-        if (!m_excludePattern.empty()) {
-            m_excludePattern += L'|';
+    // Without it, the engines log with OutputDebugString directly.
+    if (!settings->GetInt(L"DirectDebugOutputLogging").value_or(0)) {
+        // Without it, the lines are only forwarded to OutputDebugString.
+        std::unique_ptr<LogFileSink> logFileSink;
+        try {
+            logFileSink = LogFileSink::CreateFromConfig();
+        } catch (const std::exception& e) {
+            LOG(L"Failed to create the log file sink: %S", e.what());
         }
 
-        m_excludePattern += ProcessLists::kCriticalProcesses;
+        try {
+            m_logRing.emplace(std::move(logFileSink));
+        } catch (const std::exception& e) {
+            LOG(L"Failed to create the log ring: %S", e.what());
+        }
     }
 
-    if (!settings->GetInt(L"InjectIntoIncompatiblePrograms").value_or(0)) {
-        if (!m_excludePattern.empty()) {
-            m_excludePattern += L'|';
+    // Compiled once, since they're matched against each new process.
+    m_includePattern =
+        PathPattern(settings->GetString(L"Include").value_or(L""));
+    m_excludePattern =
+        PathPattern(ProcessLists::GetInjectionExcludePattern(*settings));
+    m_threadAttachExemptPattern =
+        PathPattern(settings->GetString(L"ThreadAttachExempt").value_or(L""));
+
+    // The engine usually finds out that no mod applies to a process only after
+    // being injected, and then stays loaded. If enabled, processes which no
+    // mod targets are skipped, and are injected into later if the mods config
+    // changes so that a mod targets them.
+    if (settings->GetInt(L"InjectOnlyIntoTargetedProcesses").value_or(0)) {
+        try {
+            m_modConfigChangeNotification.emplace();
+            m_modTargets.emplace();
+            m_modMatchHints.emplace(m_modTargets->GetFingerprint());
+        } catch (const std::exception& e) {
+            LOG(L"Error loading mod targets: %S", e.what());
+            m_modConfigChangeNotification.reset();
+            m_modTargets.reset();
+            m_modMatchHints.reset();
         }
+    }
 
-        m_excludePattern += ProcessLists::kIncompatiblePrograms;
+    // Handling a process involves several cross-process calls, so with many
+    // processes, e.g. on service start on a terminal server, handling them in
+    // parallel saves a lot of time. A value of 1 disables the pool.
+    int concurrency = settings->GetInt(L"InjectionConcurrency").value_or(0);
+    if (concurrency <= 0) {
+        SYSTEM_INFO systemInfo;
+        GetSystemInfo(&systemInfo);
+        concurrency = static_cast<int>(std::min(
+            systemInfo.dwNumberOfProcessors, kDefaultMaxInjectionConcurrency));
     }
 
-    if (!settings->GetInt(L"InjectIntoGames").value_or(0)) {
-        if (!m_excludePattern.empty()) {
-            m_excludePattern += L'|';
+    if (concurrency > 1) {
+        m_threadPool.reset(CreateThreadpool(nullptr));
+        if (m_threadPool) {
+            SetThreadpoolThreadMaximum(m_threadPool.get(), concurrency);
+        } else {
+            LOG(L"CreateThreadpool error: %u", GetLastError());
         }
-
-        m_excludePattern += ProcessLists::kGames;
     }
 }
 
 int AllProcessesInjector::InjectIntoNewProcesses() noexcept {
-    int count = 0;
+    // Without a pool, e.g. if it's disabled or couldn't be created, processes
+    // are handled one by one.
+    std::optional<InjectionBatch> batch;
+    if (m_threadPool) {
+        batch.emplace(m_threadPool.get());
+        if (!batch->IsValid()) {
+            batch.reset();
+        }
+    }
+
+    // On the first pass, all running processes are handled, so the threads
+    // of all processes are counted at once. Processes which are created
+    // later aren't in the snapshot, and their threads are walked as usual.
+    //
+    // Also, processes which are likely to be customized are handled first,
+    // and the rest are deferred until the enumeration is done. Otherwise, the
+    // shell might be handled after hundreds of background processes.
+    //
+    // Deferred processes, which are all processes after the first pass, are
+    // queued per session and handled round-robin. Otherwise, on a terminal
+    // server, a session which starts many processes at once, e.g. during
+    // logon, would delay the new processes of all other sessions.
+    std::optional<PathPattern> priorityPattern;
+    std::vector<SessionQueue> deferredProcesses;
+    if (!m_lastEnumeratedProcess) {
+        try {
+            m_processSnapshot = QueryProcessSnapshot();
+            priorityPattern.emplace(GetPriorityPattern());
+        } catch (const std::exception& e) {
+            LOG(L"Error querying the process snapshot: %S", e.what());
+        }
+    }
+
+    auto processSnapshotCleanup =
+        wil::scope_exit([this] { m_processSnapshot.clear(); });
+
+    std::vector<wil::unique_process_handle> retargetedProcesses =
+        TakeProcessesToRecheckIfChanged();
+
+    std::atomic<int> count = 0;
+
+    auto handleProcess = [this, &batch, &count](HANDLE hProcess,
+                                                DWORD dwProcessId) {
+        // The enumeration handle is replaced on the next iteration, so a
+        // worker gets its own handle. Each process is handled entirely by a
+        // single work item, which keeps the injection steps of a process in
+        // order.
+        if (batch) {
+            auto work = std::make_unique<InjectionWork>(InjectionWork{
+                .injector = this,
+                .processId = dwProcessId,
+                .count = &count,
+            });
+
+            if (DuplicateHandle(GetCurrentProcess(), hProcess,
+                                GetCurrentProcess(), work->process.put(), 0,
+                                FALSE, DUPLICATE_SAME_ACCESS) &&
+                batch->Submit(InjectionWorkCallback, work.get())) {
+                work.release();
+                return;
+            }
+        }
+
+        if (HandleNewProcess(hProcess, dwProcessId)) {
+            count++;
+        }
+    };
+
+    // Processes which weren't targeted by any mod before the mods config
+    // change are handled again, the ones which are still not targeted are
+    // skipped again.
+    for (const auto& retargetedProcess : retargetedProcesses) {
+        handleProcess(retargetedProcess.get(),
+                      GetProcessId(retargetedProcess.get()));
+    }
 
     while (true) {
         // Note: If we don't have the required permissions, the process is
@@ -277,82 +652,366 @@ int AllProcessesInjector::InjectIntoNewProcesses() noexcept {
             continue;
         }
 
-        std::wstring processImageName;
-        switch (HRESULT hr = wil::QueryFullProcessImageName<std::wstring>(
-                    hNewProcess, 0, processImageName)) {
-            case S_OK:
-                break;
+        if (!priorityPattern ||
+            !IsPriorityProcess(*priorityPattern, dwNewProcessId)) {
+            wil::unique_process_handle deferredProcess;
+            if (DuplicateHandle(GetCurrentProcess(), hNewProcess,
+                                GetCurrentProcess(), deferredProcess.put(), 0,
+                                FALSE, DUPLICATE_SAME_ACCESS) &&
+                QueueDeferredProcess(deferredProcesses,
+                                     std::move(deferredProcess),
+                                     dwNewProcessId)) {
+                continue;
+            }
+        }
 
-            case HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED):
-                // Often means the process is terminating.
-                VERBOSE(L"Process %u is inaccessible (likely terminating)",
-                        dwNewProcessId);
+        handleProcess(hNewProcess, dwNewProcessId);
+    }
+
+    for (size_t i = 0;; i++) {
+        bool handledAny = false;
+
+        for (const auto& sessionQueue : deferredProcesses) {
+            if (i >= sessionQueue.processes.size()) {
                 continue;
+            }
 
-            // https://stackoverflow.com/a/74456572
-            case HRESULT_FROM_WIN32(ERROR_GEN_FAILURE):
-                VERBOSE(L"Process %u is likely terminating", dwNewProcessId);
+            handledAny = true;
+
+            const auto& [deferredProcess, dwProcessId] =
+                sessionQueue.processes[i];
+            if (WaitForSingleObject(deferredProcess.get(), 0) ==
+                WAIT_OBJECT_0) {
                 continue;
+            }
+
+            handleProcess(deferredProcess.get(), dwProcessId);
+        }
+
+        if (!handledAny) {
+            break;
+        }
+    }
+
+    // Wait for the pending work items, the callers expect all discovered
+    // processes to be handled on return. The work items also use the
+    // snapshot, so it must not be cleared before that.
+    batch.reset();
+
+    if (m_modMatchHints) {
+        m_modMatchHints->SaveIfChanged();
+    }
+
+    return count;
+}
+
+// static
+bool AllProcessesInjector::QueueDeferredProcess(
+    std::vector<SessionQueue>& sessionQueues,
+    wil::unique_process_handle process,
+    DWORD dwProcessId) noexcept {
+    DWORD sessionId;
+    if (!ProcessIdToSessionId(dwProcessId, &sessionId)) {
+        // Queued with the processes of session 0.
+        sessionId = 0;
+    }
+
+    try {
+        auto it = std::find_if(sessionQueues.begin(), sessionQueues.end(),
+                               [sessionId](const SessionQueue& sessionQueue) {
+                                   return sessionQueue.sessionId == sessionId;
+                               });
+        if (it == sessionQueues.end()) {
+            it = sessionQueues.insert(sessionQueues.end(),
+                                      SessionQueue{.sessionId = sessionId});
+        }
+
+        it->processes.emplace_back(std::move(process), dwProcessId);
+    } catch (const std::exception&) {
+        // The caller handles the process right away.
+        return false;
+    }
+
+    return true;
+}
+
+// static
+void CALLBACK
+AllProcessesInjector::InjectionWorkCallback(PTP_CALLBACK_INSTANCE instance,
+                                            PVOID context) {
+    std::unique_ptr<InjectionWork> work(static_cast<InjectionWork*>(context));
+    if (work->injector->HandleNewProcess(work->process.get(),
+                                         work->processId)) {
+        (*work->count)++;
+    }
+}
+
+void AllProcessesInjector::ReloadSettings() noexcept {
+    Logger::Verbosity verbosity = Logger::GetVerbosityFromConfig();
+
+    if (!m_logRing) {
+        // The running engines keep their verbosity.
+        Logger::GetInstance().SetVerbosity(verbosity);
+        return;
+    }
+
+    try {
+        m_logRing->SetVerbosity(verbosity);
+    } catch (const std::exception& e) {
+        LOG(L"Failed to publish the logging verbosity: %S", e.what());
+    }
+}
+
+bool AllProcessesInjector::SetModsPaused(bool paused) noexcept {
+    if (!m_modsPause) {
+        return false;
+    }
+
+    try {
+        m_modsPause->SetPaused(paused);
+    } catch (const std::exception& e) {
+        LOG(L"Failed to publish the mods pause state: %S", e.what());
+        return false;
+    }
+
+    return true;
+}
+
+bool AllProcessesInjector::Shutdown(DWORD stageTimeout) noexcept {
+    if (!m_sessionShutdown) {
+        return false;
+    }
+
+    return m_sessionShutdown->Run(stageTimeout);
+}
+
+bool AllProcessesInjector::HandleNewProcess(HANDLE hProcess,
+                                            DWORD dwProcessId) noexcept {
+    LONGLONG discoveryTime = InjectionStats::Now();
+    ULONG64 discoveryCycleTime = InjectionStats::ThreadCycleTime();
+    DWORD dwSessionManagerProcessId = GetCurrentProcessId();
+
+    std::wstring processImageName;
+    switch (HRESULT hr = wil::QueryFullProcessImageName<std::wstring>(
+                hProcess, 0, processImageName)) {
+        case S_OK:
+            break;
+
+        case HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED):
+            // Often means the process is terminating.
+            VERBOSE(L"Process %u is inaccessible (likely terminating)",
+                    dwProcessId);
+            InjectionStats::RecordOutcome(
+                dwSessionManagerProcessId,
+                InjectionStats::Outcome::kAccessDenied);
+            return false;
+
+        // https://stackoverflow.com/a/74456572
+        case HRESULT_FROM_WIN32(ERROR_GEN_FAILURE):
+            VERBOSE(L"Process %u is likely terminating", dwProcessId);
+            InjectionStats::RecordOutcome(
+                dwSessionManagerProcessId,
+                InjectionStats::Outcome::kProcessTerminating);
+            return false;
+
+        default:
+            LOG(L"QueryFullProcessImageName error for process %u: %08X",
+                dwProcessId, hr);
+            InjectionStats::RecordOutcome(dwSessionManagerProcessId,
+                                          InjectionStats::Outcome::kFailed);
+            return false;
+    }
+
+    InjectionDecisionCache::Decision decision;
+    bool untargeted = false;
+    try {
+        decision = GetDecision(processImageName);
+        untargeted = !decision.skip && m_modTargets &&
+                     !MightBeTargetedByMods(hProcess, processImageName);
+    } catch (const std::exception& e) {
+        LOG(L"Error handling a new process %u: %S", dwProcessId, e.what());
+        InjectionStats::RecordOutcome(dwSessionManagerProcessId,
+                                      InjectionStats::Outcome::kFailed);
+        return false;
+    }
+
+    if (decision.skip) {
+        VERBOSE(L"Skipping excluded process %u", dwProcessId);
+        InjectionStats::RecordOutcome(dwSessionManagerProcessId,
+                                      InjectionStats::Outcome::kSkipped);
+        return false;
+    }
+
+    if (untargeted) {
+        VERBOSE(L"Skipping process %u, not targeted by any mod", dwProcessId);
+        TrackProcess(hProcess, dwProcessId, /*injected=*/false);
+        InjectionStats::RecordOutcome(dwSessionManagerProcessId,
+                                      InjectionStats::Outcome::kSkipped);
+        return false;
+    }
+
+    LONG statsSlot = InjectionStats::BeginInjection(
+        dwSessionManagerProcessId, dwProcessId, discoveryTime,
+        discoveryCycleTime);
+    auto outcome = InjectionStats::Outcome::kFailed;
+    DllInject::StepTimes stepTimes{};
+
+    try {
+        InjectIntoNewProcess(hProcess, dwProcessId,
+                             decision.threadAttachExempt, &stepTimes);
+        outcome = InjectionStats::Outcome::kInjected;
+    } catch (const wil::ResultException& e) {
+        switch (e.GetErrorCode()) {
+            // STATUS_PROCESS_IS_TERMINATING
+            case 0xC000010A:
+                VERBOSE(L"Process %u is terminating: %S", dwProcessId,
+                        e.what());
+                outcome = InjectionStats::Outcome::kProcessTerminating;
+                break;
+
+            case HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED):
+                // May happen if process is terminating.
+                VERBOSE(L"Access denied for process %u: %S", dwProcessId,
+                        e.what());
+                outcome = InjectionStats::Outcome::kAccessDenied;
+                break;
 
             default:
-                LOG(L"QueryFullProcessImageName error for process %u: %08X",
-                    dwNewProcessId, hr);
-                continue;
+                LOG(L"Error handling a new process %u: %S", dwProcessId,
+                    e.what());
+                break;
         }
+    } catch (const std::exception& e) {
+        LOG(L"Error handling a new process %u: %S", dwProcessId, e.what());
+    }
+
+    InjectionStats::EndInjection(dwSessionManagerProcessId, statsSlot,
+                                 outcome, &stepTimes);
+
+    if (m_modTargets && outcome == InjectionStats::Outcome::kInjected) {
+        TrackProcess(hProcess, dwProcessId, /*injected=*/true);
+    }
+
+    return outcome == InjectionStats::Outcome::kInjected;
+}
+
+InjectionDecisionCache::Decision AllProcessesInjector::GetDecision(
+    std::wstring_view processImageName) {
+    return m_decisionCache.Get(processImageName, [this, processImageName]() {
+        PathPattern::Path path(processImageName);
+        return InjectionDecisionCache::Decision{
+            .skip = ShouldSkipNewProcess(path),
+            .threadAttachExempt = ShouldAttachExemptThread(path),
+        };
+    });
+}
+
+bool AllProcessesInjector::MightBeTargetedByMods(
+    HANDLE hProcess,
+    std::wstring_view processImageName) const {
+    USHORT processMachine = DllInject::GetProcessArch(hProcess);
+    return m_modMatchHints->MightMatch(
+        processImageName, processMachine, [&]() {
+            return m_modTargets->MightMatch(PathPattern::Path(processImageName),
+                                            processMachine);
+        });
+}
 
-        if (ShouldSkipNewProcess(processImageName)) {
-            VERBOSE(L"Skipping excluded process %u", dwNewProcessId);
+void AllProcessesInjector::TrackProcess(HANDLE hProcess,
+                                        DWORD dwProcessId,
+                                        bool injected) {
+    auto createTime = GetProcessCreateTime(hProcess);
+    if (!createTime) {
+        LOG(L"GetProcessTimes error for process %u: %u", dwProcessId,
+            GetLastError());
+        return;
+    }
+
+    // Keyed by the process ID, so that entries of processes which exited are
+    // replaced when the ID is reused, and the map doesn't grow indefinitely.
+    std::lock_guard guard(m_trackedProcessesMutex);
+    m_trackedProcesses[dwProcessId] = {
+        .createTime = *createTime,
+        .injected = injected,
+    };
+}
+
+std::vector<wil::unique_process_handle>
+AllProcessesInjector::TakeProcessesToRecheckIfChanged() {
+    if (!m_modConfigChangeNotification ||
+        WaitForSingleObject(m_modConfigChangeNotification->GetHandle(), 0) !=
+            WAIT_OBJECT_0) {
+        return {};
+    }
+
+    try {
+        m_modConfigChangeNotification->ContinueMonitoring();
+        m_modTargets.emplace();
+        // Changes which don't affect the targeting, e.g. of mod settings,
+        // keep the fingerprint, and the saved hints are loaded again.
+        m_modMatchHints.emplace(m_modTargets->GetFingerprint());
+    } catch (const std::exception& e) {
+        // Without the targets, all processes are injected into.
+        LOG(L"Error reloading mod targets: %S", e.what());
+        m_modConfigChangeNotification.reset();
+        m_modTargets.reset();
+        m_modMatchHints.reset();
+    }
+
+    // No work items are running at this point, but the mutex is locked for
+    // consistency.
+    std::lock_guard guard(m_trackedProcessesMutex);
+
+    DWORD dwSessionManagerProcessId = GetCurrentProcessId();
+    std::vector<wil::unique_process_handle> processes;
+
+    for (auto it = m_trackedProcesses.begin();
+         it != m_trackedProcesses.end();) {
+        const auto& [processId, trackedProcess] = *it;
+
+        wil::unique_process_handle process(OpenProcess(
+            SYNCHRONIZE | DllInject::kProcessAccess, FALSE, processId));
+        if (!process ||
+            WaitForSingleObject(process.get(), 0) == WAIT_OBJECT_0 ||
+            GetProcessCreateTime(process.get()) != trackedProcess.createTime) {
+            // The process exited, or the ID was reused by a new process, which
+            // is handled by the enumeration.
+            it = m_trackedProcesses.erase(it);
             continue;
         }
 
-        try {
-            InjectIntoNewProcess(hNewProcess, dwNewProcessId,
-                                 ShouldAttachExemptThread(processImageName));
-            count++;
-        } catch (const wil::ResultException& e) {
-            switch (e.GetErrorCode()) {
-                // STATUS_PROCESS_IS_TERMINATING
-                case 0xC000010A:
-                    VERBOSE(L"Process %u is terminating: %S", dwNewProcessId,
-                            e.what());
-                    break;
-
-                case HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED):
-                    // May happen if process is terminating.
-                    VERBOSE(L"Access denied for process %u: %S", dwNewProcessId,
-                            e.what());
-                    break;
-
-                default:
-                    LOG(L"Error handling a new process %u: %S", dwNewProcessId,
-                        e.what());
-                    break;
-            }
-        } catch (const std::exception& e) {
-            LOG(L"Error handling a new process %u: %S", dwNewProcessId,
-                e.what());
+        // If the engine is still running, it reloads the mods by itself.
+        if (trackedProcess.injected &&
+            CustomizationSession::IsRunningInProcess(dwSessionManagerProcessId,
+                                                     processId)) {
+            ++it;
+            continue;
         }
+
+        // Tracked again when handled.
+        processes.push_back(std::move(process));
+        it = m_trackedProcesses.erase(it);
     }
 
-    return count;
+    return processes;
 }
 
 bool AllProcessesInjector::ShouldSkipNewProcess(
-    std::wstring_view processImageName) const {
-    return Functions::DoesPathMatchPattern(processImageName,
-                                           m_excludePattern) &&
-           !Functions::DoesPathMatchPattern(processImageName, m_includePattern);
+    const PathPattern::Path& processImageName) const {
+    return m_excludePattern.Matches(processImageName) &&
+           !m_includePattern.Matches(processImageName);
 }
 
 bool AllProcessesInjector::ShouldAttachExemptThread(
-    std::wstring_view processImageName) const {
-    return Functions::DoesPathMatchPattern(processImageName,
-                                           m_threadAttachExemptPattern);
+    const PathPattern::Path& processImageName) const {
+    return m_threadAttachExemptPattern.Matches(processImageName);
 }
 
-void AllProcessesInjector::InjectIntoNewProcess(HANDLE hProcess,
-                                                DWORD dwProcessId,
-                                                bool threadAttachExempt) {
+void AllProcessesInjector::InjectIntoNewProcess(
+    HANDLE hProcess,
+    DWORD dwProcessId,
+    bool threadAttachExempt,
+    DllInject::StepTimes* stepTimes) {
     // We check whether the process began running or not. If it didn't, it's
     // supposed to have only one thread which has its instruction pointer at
     // RtlUserThreadStart. For other cases, we assume the main thread was
@@ -371,7 +1030,8 @@ void AllProcessesInjector::InjectIntoNewProcess(HANDLE hProcess,
 
     wil::unique_process_handle suspendedThread;
 
-    if (dwProcessId != GetCurrentProcessId()) {
+    if (dwProcessId != GetCurrentProcessId() &&
+        !IsRunningAccordingToSnapshot(hProcess, dwProcessId)) {
         DWORD threadAccess = THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT |
                              DllInject::kApcThreadsAccess;
 
@@ -442,9 +1102,24 @@ void AllProcessesInjector::InjectIntoNewProcess(HANDLE hProcess,
                 throw std::runtime_error("Unsupported architecture");
             }
         }
+#elif defined(_M_X64)
+        CONTEXT c;
+        c.ContextFlags = CONTEXT_CONTROL;
+        THROW_IF_WIN32_BOOL_FALSE(GetThreadContext(suspendedThread.get(), &c));
+        if (c.Rip == m_pRtlUserThreadStart) {
+            threadNotStartedYet = true;
+        }
+#elif defined(_M_ARM64)
+        CONTEXT c;
+        c.ContextFlags = CONTEXT_CONTROL;
+        THROW_IF_WIN32_BOOL_FALSE(GetThreadContext(suspendedThread.get(), &c));
+        if (c.Pc == m_pRtlUserThreadStart ||
+            c.Pc == m_pRtlUserThreadStart_x64OnArm64) {
+            threadNotStartedYet = true;
+        }
 #else
 #error "Unsupported architecture"
-#endif  // _M_IX86
+#endif
 
         if (threadNotStartedYet) {
             wil::unique_mutex_nothrow mutex(
@@ -457,7 +1132,7 @@ void AllProcessesInjector::InjectIntoNewProcess(HANDLE hProcess,
 
             DllInject::DllInject(hProcess, suspendedThread.get(),
                                  GetCurrentProcess(), mutex.get(),
-                                 threadAttachExempt);
+                                 threadAttachExempt, stepTimes);
             VERBOSE(L"DllInject succeeded for new process %u via APC",
                     dwProcessId);
 
@@ -472,7 +1147,31 @@ void AllProcessesInjector::InjectIntoNewProcess(HANDLE hProcess,
     }
 
     DllInject::DllInject(hProcess, nullptr, GetCurrentProcess(), nullptr,
-                         threadAttachExempt);
+                         threadAttachExempt, stepTimes);
     VERBOSE(L"DllInject succeeded for new process %u via a remote thread",
             dwProcessId);
 }
+
+bool AllProcessesInjector::IsRunningAccordingToSnapshot(HANDLE hProcess,
+                                                        DWORD dwProcessId) {
+    auto it = m_processSnapshot.find(dwProcessId);
+    if (it == m_processSnapshot.end() || it->second.threadCount <= 1) {
+        return false;
+    }
+
+    // Make sure that the process ID wasn't reused since the snapshot.
+    return GetProcessCreateTime(hProcess) == it->second.createTime;
+}
+
+bool AllProcessesInjector::IsPriorityProcess(const PathPattern& priorityPattern,
+                                             DWORD dwProcessId) const {
+    auto it = m_processSnapshot.find(dwProcessId);
+    if (it == m_processSnapshot.end() || it->second.imageName.empty()) {
+        return true;
+    }
+
+    // Only the file name is known, and wildcard parts such as "*" are ignored,
+    // since they would make all processes a priority.
+    return priorityPattern.Matches(PathPattern::Path(it->second.imageName),
+                                   /*explicitOnly=*/true);
+}
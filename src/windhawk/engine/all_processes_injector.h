@@ -1,17 +1,95 @@
 #pragma once
 
+#include "crash_loop_guard.h"
+#include "dll_inject.h"
+#include "injection_decision_cache.h"
+#include "log_ring.h"
+#include "mod_config_snapshot.h"
+#include "mod_files_cleanup.h"
+#include "mod_match_hints.h"
+#include "mod_status_table.h"
+#include "mod_targets.h"
+#include "mods_pause.h"
+#include "path_pattern.h"
+#include "session_shutdown.h"
+#include "storage_manager.h"
+
 class AllProcessesInjector {
    public:
     AllProcessesInjector();
 
     int InjectIntoNewProcesses() noexcept;
 
+    // Applies the settings which can be changed without restarting the
+    // session, currently only the logging verbosity, which is also published
+    // to the running engines.
+    void ReloadSettings() noexcept;
+
+    // Disables or enables the hooks of the mods in all processes, without
+    // unloading the mods. Engines which start later follow the state as well.
+    bool SetModsPaused(bool paused) noexcept;
+
+    // Ends the sessions of all processes right away, without a handover, see
+    // SessionShutdown. Returns false if some sessions didn't end in time.
+    bool Shutdown(DWORD stageTimeout) noexcept;
+
+    struct ProcessSnapshotEntry {
+        ULONGLONG createTime;
+        ULONG threadCount;
+        // The file name only, without a path.
+        std::wstring imageName;
+    };
+
    private:
-    bool ShouldSkipNewProcess(std::wstring_view processImageName) const;
-    bool ShouldAttachExemptThread(std::wstring_view processImageName) const;
+    using unique_threadpool = wil::
+        unique_any<PTP_POOL, decltype(&::CloseThreadpool), ::CloseThreadpool>;
+
+    struct InjectionWork {
+        AllProcessesInjector* injector;
+        wil::unique_process_handle process;
+        DWORD processId;
+        std::atomic<int>* count;
+    };
+
+    // There are only a few sessions, even on a terminal server, so they're
+    // kept in a vector which is searched linearly.
+    struct SessionQueue {
+        DWORD sessionId;
+        std::vector<std::pair<wil::unique_process_handle, DWORD>> processes;
+    };
+
+    // Returns false if the process couldn't be queued, in which case the
+    // caller should handle it right away.
+    static bool QueueDeferredProcess(std::vector<SessionQueue>& sessionQueues,
+                                     wil::unique_process_handle process,
+                                     DWORD dwProcessId) noexcept;
+    static void CALLBACK InjectionWorkCallback(PTP_CALLBACK_INSTANCE instance,
+                                               PVOID context);
+    bool HandleNewProcess(HANDLE hProcess, DWORD dwProcessId) noexcept;
+    InjectionDecisionCache::Decision GetDecision(
+        std::wstring_view processImageName);
+    bool MightBeTargetedByMods(HANDLE hProcess,
+                               std::wstring_view processImageName) const;
+    void TrackProcess(HANDLE hProcess, DWORD dwProcessId, bool injected);
+    // If the mods config changed since the last call, returns the processes
+    // which might have to be injected into now: the ones which were skipped
+    // since no mod targeted them, and the ones in which the engine unloaded
+    // itself since no mods were left to load.
+    std::vector<wil::unique_process_handle> TakeProcessesToRecheckIfChanged();
+    bool ShouldSkipNewProcess(const PathPattern::Path& processImageName) const;
+    bool ShouldAttachExemptThread(
+        const PathPattern::Path& processImageName) const;
+    // A process with more than one thread is assumed to have begun running,
+    // since only its main thread exists before that.
+    bool IsRunningAccordingToSnapshot(HANDLE hProcess, DWORD dwProcessId);
+    // Processes which aren't in the snapshot were created after it was taken,
+    // and are handled with priority as well.
+    bool IsPriorityProcess(const PathPattern& priorityPattern,
+                           DWORD dwProcessId) const;
     void InjectIntoNewProcess(HANDLE hProcess,
                               DWORD dwProcessId,
-                              bool threadAttachExempt);
+                              bool threadAttachExempt,
+                              DllInject::StepTimes* stepTimes);
 
     using NtGetNextProcess_t = NTSTATUS(NTAPI*)(_In_opt_ HANDLE ProcessHandle,
                                                 _In_ ACCESS_MASK DesiredAccess,
@@ -31,8 +109,34 @@ class AllProcessesInjector {
     DWORD64 m_pRtlUserThreadStart = 0;
     DWORD64 m_pRtlUserThreadStart_x64OnArm64 = 0;
     wil::unique_private_namespace_destroy m_appPrivateNamespace;
-    std::wstring m_includePattern;
-    std::wstring m_excludePattern;
-    std::wstring m_threadAttachExemptPattern;
+    wil::unique_handle m_injectionStats;
+    std::optional<ModConfigSnapshot::Publisher> m_modConfigSnapshotPublisher;
+    std::optional<ModStatusTable::Owner> m_modStatusTable;
+    std::optional<CrashLoopGuard::Owner> m_crashLoopGuard;
+    std::optional<LogRing::Owner> m_logRing;
+    std::optional<ModsPause::Owner> m_modsPause;
+    std::optional<SessionShutdown::Owner> m_sessionShutdown;
+    std::optional<ModFilesCleanup> m_modFilesCleanup;
+    PathPattern m_includePattern;
+    PathPattern m_excludePattern;
+    PathPattern m_threadAttachExemptPattern;
+    InjectionDecisionCache m_decisionCache;
+    // Only set if the engine is injected only into processes which are
+    // targeted by enabled mods.
+    std::optional<ModTargets> m_modTargets;
+    // The results of m_modTargets, persisted across sessions.
+    std::optional<ModMatchHints> m_modMatchHints;
+    std::optional<StorageManager::ModConfigChangeNotification>
+        m_modConfigChangeNotification;
+    struct TrackedProcess {
+        ULONGLONG createTime;
+        bool injected;
+    };
+
+    // Keyed by the process ID, only used with m_modTargets.
+    std::unordered_map<DWORD, TrackedProcess> m_trackedProcesses;
+    std::mutex m_trackedProcessesMutex;
     wil::unique_process_handle m_lastEnumeratedProcess;
+    std::unordered_map<DWORD, ProcessSnapshotEntry> m_processSnapshot;
+    unique_threadpool m_threadPool;
 };
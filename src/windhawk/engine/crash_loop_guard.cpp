@@ -0,0 +1,291 @@
+#include "stdafx.h"
+
+#include "crash_loop_guard.h"
+
+#include "customization_session.h"
+#include "functions.h"
+#include "logger.h"
+#include "session_private_namespace.h"
+
+namespace {
+
+// A process which runs for this long after the engine started in it isn't
+// considered to be in a crash loop, even if it crashes later.
+constexpr DWORD kStableUptime = 30 * 1000;
+
+// The amount of consecutive unstable starts, including the current one, after
+// which no mods are loaded. With the default, two crashes in a row are
+// tolerated.
+constexpr LONG kTripStartCount = 3;
+
+constexpr DWORD kMutexTimeout = 1000;
+
+std::atomic<bool> g_tripped;
+
+// The record of the current process, if it's the one which is counted.
+std::atomic<LONG*> g_unstableStartCount;
+
+ULONGLONG GetProcessCreationTime(HANDLE process) noexcept {
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetProcessTimes(process, &creationTime, &exitTime, &kernelTime,
+                         &userTime)) {
+        return 0;
+    }
+
+    return wil::filetime::to_int64(creationTime);
+}
+
+// If the state of the process can't be queried, it's assumed to be running.
+bool IsProcessRunning(DWORD processId, ULONGLONG processCreationTime) noexcept {
+    wil::unique_process_handle process(OpenProcess(
+        PROCESS_QUERY_LIMITED_INFORMATION | SYNCHRONIZE, FALSE, processId));
+    if (!process) {
+        return GetLastError() != ERROR_INVALID_PARAMETER;
+    }
+
+    if (WaitForSingleObject(process.get(), 0) == WAIT_OBJECT_0) {
+        return false;
+    }
+
+    // A different process with a reused process ID.
+    ULONGLONG creationTime = GetProcessCreationTime(process.get());
+    return !creationTime || creationTime == processCreationTime;
+}
+
+ULONGLONG HashImagePath(std::wstring path) {
+    LCMapStringEx(LOCALE_NAME_USER_DEFAULT, LCMAP_LOWERCASE, &path[0],
+                  wil::safe_cast<int>(path.length()), &path[0],
+                  wil::safe_cast<int>(path.length()), nullptr, nullptr, 0);
+
+    // FNV-1a, the same as SymbolIndex::HashName.
+    ULONGLONG hash = 14695981039346656037ULL;
+    for (WCHAR c : path) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+
+    // Zero marks a free record.
+    return hash ? hash : 1;
+}
+
+}  // namespace
+
+CrashLoopGuard::Owner::Owner() {
+    wil::unique_hlocal secDesc;
+    THROW_IF_WIN32_BOOL_FALSE(
+        Functions::GetFullAccessSecurityDescriptor(&secDesc, nullptr));
+
+    SECURITY_ATTRIBUTES secAttr = {sizeof(SECURITY_ATTRIBUTES)};
+    secAttr.lpSecurityDescriptor = secDesc.get();
+    secAttr.bInheritHandle = FALSE;
+
+    DWORD currentProcessId = GetCurrentProcessId();
+
+    m_mutex.reset(
+        CreateMutex(&secAttr, FALSE, MakeMutexName(currentProcessId).c_str()));
+    THROW_LAST_ERROR_IF(!m_mutex || GetLastError() == ERROR_ALREADY_EXISTS);
+
+    m_mapping.reset(CreateFileMapping(
+        INVALID_HANDLE_VALUE, &secAttr, PAGE_READWRITE, 0, sizeof(SharedData),
+        MakeMappingName(currentProcessId).c_str()));
+    THROW_LAST_ERROR_IF(!m_mapping || GetLastError() == ERROR_ALREADY_EXISTS);
+
+    wil::unique_mapview_ptr<SharedData> view(
+        reinterpret_cast<SharedData*>(MapViewOfFile(
+            m_mapping.get(), FILE_MAP_WRITE, 0, 0, sizeof(SharedData))));
+    THROW_LAST_ERROR_IF(!view);
+
+    // The rest of the memory is zero-initialized.
+    view->version = kVersion;
+}
+
+CrashLoopGuard::Session::Session() noexcept {
+    std::wstring imagePath;
+    bool tripped = false;
+
+    try {
+        DWORD sessionManagerProcessId =
+            CustomizationSession::GetSessionManagerProcessId();
+
+        wil::unique_mutex_nothrow mutex(
+            OpenMutex(SYNCHRONIZE, FALSE,
+                      MakeMutexName(sessionManagerProcessId).c_str()));
+        THROW_LAST_ERROR_IF(!mutex);
+
+        m_mapping.reset(OpenFileMapping(
+            FILE_MAP_READ | FILE_MAP_WRITE, FALSE,
+            MakeMappingName(sessionManagerProcessId).c_str()));
+        THROW_LAST_ERROR_IF(!m_mapping);
+
+        m_view.reset(MapViewOfFile(m_mapping.get(),
+                                   FILE_MAP_READ | FILE_MAP_WRITE, 0, 0,
+                                   sizeof(SharedData)));
+        THROW_LAST_ERROR_IF(!m_view);
+
+        auto* data = static_cast<SharedData*>(m_view.get());
+        if (data->version != kVersion) {
+            throw std::runtime_error("Unsupported crash loop table version");
+        }
+
+        imagePath =
+            wil::QueryFullProcessImageName<std::wstring>(GetCurrentProcess());
+        ULONGLONG imageHash = HashImagePath(imagePath);
+        DWORD processId = GetCurrentProcessId();
+        ULONGLONG processCreationTime =
+            GetProcessCreationTime(GetCurrentProcess());
+        ULONGLONG currentTime =
+            wil::filetime::to_int64(wil::filetime::get_system_time());
+
+        // An abandoned mutex means that a process crashed while holding it.
+        // At worst, its start wasn't counted.
+        DWORD waitResult = WaitForSingleObject(mutex.get(), kMutexTimeout);
+        THROW_LAST_ERROR_IF(waitResult == WAIT_FAILED);
+        if (waitResult == WAIT_TIMEOUT) {
+            throw std::runtime_error("Timed out waiting for the table");
+        }
+
+        auto mutexLock = mutex.ReleaseMutex_scope_exit();
+
+        Record* record = nullptr;
+        Record* freeRecord = nullptr;
+        Record* oldestRecord = &data->records[0];
+        for (auto& r : data->records) {
+            if (r.imageHash == imageHash) {
+                record = &r;
+                break;
+            }
+
+            if (!r.imageHash) {
+                if (!freeRecord) {
+                    freeRecord = &r;
+                }
+            } else if (r.lastStartTime < oldestRecord->lastStartTime) {
+                oldestRecord = &r;
+            }
+        }
+
+        if (!record) {
+            record = freeRecord ? freeRecord : oldestRecord;
+            *record = {.imageHash = imageHash};
+        }
+
+        m_slot = static_cast<LONG>(record - data->records);
+
+        if (record->processId == processId &&
+            record->processCreationTime == processCreationTime) {
+            // The engine started again in the same process, e.g. after it
+            // unloaded itself since no mods were targeting the process.
+        } else if (record->processId &&
+                   IsProcessRunning(record->processId,
+                                    record->processCreationTime)) {
+            // Another process of the same image, not a restart.
+            m_slot = -1;
+        } else {
+            record->processId = processId;
+            record->processCreationTime = processCreationTime;
+            record->lastStartTime = currentTime;
+            record->unstableStartCount++;
+
+            if (record->unstableStartCount >= kTripStartCount) {
+                record->tripped = 1;
+            }
+        }
+
+        tripped = record->tripped;
+    } catch (const std::exception& e) {
+        LOG(L"Crash loop detection failed: %S", e.what());
+        m_slot = -1;
+    }
+
+    if (tripped) {
+        g_tripped = true;
+
+        LOG(L"The process crashed repeatedly right after mods were loaded, "
+            L"not loading mods in %s until Windhawk is restarted",
+            imagePath.c_str());
+
+        try {
+            m_crashLoopEntry.emplace(ModStatusTable::Kind::kCrashLoop, L"");
+            m_crashLoopEntry->Set(imagePath.c_str());
+        } catch (const std::exception& e) {
+            LOG(L"Publishing the crash loop failed: %S", e.what());
+        }
+    }
+
+    if (m_slot == -1 || tripped) {
+        return;
+    }
+
+    auto* data = static_cast<SharedData*>(m_view.get());
+    g_unstableStartCount = &data->records[m_slot].unstableStartCount;
+
+    m_stableTimer.reset(
+        CreateThreadpoolTimer(StableTimerCallback, nullptr, nullptr));
+    if (!m_stableTimer) {
+        LOG(L"CreateThreadpoolTimer failed: %u", GetLastError());
+        return;
+    }
+
+    // A negative due time is relative.
+    FILETIME dueTime = wil::filetime::from_int64(static_cast<UINT64>(
+        -static_cast<INT64>(kStableUptime) *
+        wil::filetime_duration::one_millisecond));
+    SetThreadpoolTimer(m_stableTimer.get(), &dueTime, 0, 0);
+}
+
+CrashLoopGuard::Session::~Session() {
+    // Waits for the callback, if it's running.
+    m_stableTimer.reset();
+
+    // The session ended without the process crashing.
+    OnProcessExit();
+    g_unstableStartCount = nullptr;
+}
+
+// static
+void CALLBACK
+CrashLoopGuard::Session::StableTimerCallback(PTP_CALLBACK_INSTANCE instance,
+                                             PVOID context,
+                                             PTP_TIMER timer) {
+    VERBOSE(L"Process is stable, resetting the crash loop count");
+    OnProcessExit();
+}
+
+// static
+bool CrashLoopGuard::IsTripped() noexcept {
+    return g_tripped;
+}
+
+// static
+void CrashLoopGuard::OnProcessExit() noexcept {
+    // The record is only reset if the current process is still the one which
+    // is counted. Not done under the mutex, since it might be called from
+    // DllMain, and a concurrent start of another process of the image can
+    // only make the count lower.
+    LONG* unstableStartCount = g_unstableStartCount;
+    if (unstableStartCount) {
+        InterlockedExchange(unstableStartCount, 0);
+    }
+}
+
+// static
+std::wstring CrashLoopGuard::MakeMappingName(DWORD sessionManagerProcessId) {
+    WCHAR szName[SessionPrivateNamespace::kPrivateNamespaceMaxLen +
+                 sizeof("\\CrashLoopTable")];
+    int namePos =
+        SessionPrivateNamespace::MakeName(szName, sessionManagerProcessId);
+    swprintf_s(szName + namePos, ARRAYSIZE(szName) - namePos,
+               L"\\CrashLoopTable");
+    return szName;
+}
+
+// static
+std::wstring CrashLoopGuard::MakeMutexName(DWORD sessionManagerProcessId) {
+    WCHAR szName[SessionPrivateNamespace::kPrivateNamespaceMaxLen +
+                 sizeof("\\CrashLoopTableMutex")];
+    int namePos =
+        SessionPrivateNamespace::MakeName(szName, sessionManagerProcessId);
+    swprintf_s(szName + namePos, ARRAYSIZE(szName) - namePos,
+               L"\\CrashLoopTableMutex");
+    return szName;
+}
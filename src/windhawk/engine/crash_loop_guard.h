@@ -0,0 +1,93 @@
+#pragma once
+
+#include "mod_status_table.h"
+
+// Detects processes which crash repeatedly right after mods are loaded in
+// them, e.g. explorer restarting in a loop because of a faulty mod, without
+// waiting for crash reports to reach the event log. The session manager owns
+// a table in shared memory with a record per process image, which counts the
+// consecutive starts of the image that didn't become stable. A start becomes
+// stable once the process runs for a while, or if it exits normally, which
+// resets the count. Concurrent processes of the same image, e.g. of a browser,
+// aren't counted as restarts.
+//
+// Once the count reaches the limit, no mods are loaded in the image until the
+// session manager is restarted, and the app is notified with a record of the
+// mod status table, so that it can offer the safe mode right away.
+class CrashLoopGuard {
+   public:
+    CrashLoopGuard() = delete;
+
+    // Used by the session manager, the table exists as long as the object
+    // exists. Must be created after the private namespace of the session
+    // manager.
+    class Owner {
+       public:
+        Owner();
+
+        Owner(const Owner&) = delete;
+        Owner& operator=(const Owner&) = delete;
+
+       private:
+        wil::unique_mutex_nothrow m_mutex;
+        wil::unique_handle m_mapping;
+    };
+
+    // Held by the customization session, must be created before the mods are
+    // loaded. Never throws, if the table isn't available, the start isn't
+    // counted.
+    class Session {
+       public:
+        Session() noexcept;
+        ~Session();
+
+        Session(const Session&) = delete;
+        Session& operator=(const Session&) = delete;
+
+       private:
+        static void CALLBACK StableTimerCallback(PTP_CALLBACK_INSTANCE instance,
+                                                 PVOID context,
+                                                 PTP_TIMER timer);
+
+        wil::unique_handle m_mapping;
+        wil::unique_mapview_ptr<void> m_view;
+        LONG m_slot = -1;
+        wil::unique_threadpool_timer m_stableTimer;
+        std::optional<ModStatusTable::Entry> m_crashLoopEntry;
+    };
+
+    // Whether mods shouldn't be loaded in the current process since its image
+    // is in a crash loop.
+    static bool IsTripped() noexcept;
+
+    // Called when the process exits normally, which isn't a crash.
+    static void OnProcessExit() noexcept;
+
+   private:
+    static constexpr DWORD kVersion = 1;
+    static constexpr size_t kRecordCount = 256;
+
+    // The layout must be the same for 32-bit and 64-bit processes.
+    struct Record {
+        // A hash of the lowercase image path, zero if the record is free.
+        ULONGLONG imageHash;
+        // The process which started last and is counted.
+        DWORD processId;
+        LONG unstableStartCount;
+        ULONGLONG processCreationTime;
+        // As a FILETIME value, used to replace the oldest record when the
+        // table is full.
+        ULONGLONG lastStartTime;
+        LONG tripped;
+        DWORD reserved;
+    };
+
+    struct SharedData {
+        DWORD version;
+        DWORD reserved;
+        Record records[kRecordCount];
+    };
+
+    static std::wstring MakeMappingName(DWORD sessionManagerProcessId);
+    static std::wstring MakeMutexName(DWORD sessionManagerProcessId);
+};
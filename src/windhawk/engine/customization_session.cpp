@@ -2,8 +2,12 @@
 
 #include "customization_session.h"
 #include "functions.h"
+#include "http_client.h"
+#include "import_hooks.h"
+#include "injection_stats.h"
 #include "logger.h"
 #include "session_private_namespace.h"
+#include "trace_events.h"
 
 extern HINSTANCE g_hDllInst;
 
@@ -13,6 +17,17 @@ extern HINSTANCE g_hDllInst;
 
 namespace {
 
+// The id of the thread which initializes the session from an APC, if any. In
+// this case, the process isn't fully initialized yet, and new threads won't
+// start running until the APC returns.
+std::atomic<DWORD> g_initializingFromAPCThreadId;
+
+// Guards the handover state of the session, see
+// CustomizationSession::WaitForHandover.
+std::mutex g_handoverMutex;
+// The session which waits for a new session manager to take over, if any.
+CustomizationSession* g_sessionWaitingForHandover;
+
 std::optional<HANDLE> GetFirstThreadOfCurrentProcess(DWORD accessMask) {
     using NtGetNextThread_t = NTSTATUS(NTAPI*)(
         _In_ HANDLE ProcessHandle, _In_opt_ HANDLE ThreadHandle,
@@ -109,6 +124,17 @@ void CustomizationSession::Start(
     bool threadAttachExempt,
     wil::unique_process_handle sessionManagerProcess,
     wil::unique_mutex_nothrow sessionMutex) {
+    // The engine is most likely still loaded from the previous session
+    // manager, e.g. after the app restarted. The new session manager adopts
+    // the session, and the process keeps its mods.
+    if (TryHandOver(sessionManagerProcess.get())) {
+        return;
+    }
+
+    LONGLONG engineStartTime = InjectionStats::Now();
+    ULONG64 engineStartCycleTime = InjectionStats::ThreadCycleTime();
+    DWORD sessionManagerProcessId = GetProcessId(sessionManagerProcess.get());
+
     std::wstring semaphoreName = L"WindhawkCustomizationSessionSemaphore-pid=" +
                                  std::to_wstring(GetCurrentProcessId());
     wil::unique_semaphore semaphore(1, 1, semaphoreName.c_str());
@@ -131,8 +157,25 @@ void CustomizationSession::Start(
             "Only one session is supported at any given time");
     }
 
-    session.emplace(ConstructorSecret{}, runningFromAPC, threadAttachExempt,
-                    std::move(sessionManagerProcess), std::move(sessionMutex));
+    if (runningFromAPC) {
+        g_initializingFromAPCThreadId = GetCurrentThreadId();
+    }
+
+    auto initializingFromAPCCleanup =
+        wil::scope_exit([] { g_initializingFromAPCThreadId = 0; });
+
+    {
+        TraceEvents::ScopedPhase phase("SessionInit");
+        session.emplace(ConstructorSecret{}, runningFromAPC, threadAttachExempt,
+                        std::move(sessionManagerProcess),
+                        std::move(sessionMutex));
+    }
+
+    initializingFromAPCCleanup.reset();
+
+    InjectionStats::RecordEngineStarted(
+        sessionManagerProcessId, engineStartTime, engineStartCycleTime,
+        /*modsLoaded=*/!session->m_modsManager.IsEmpty());
 
     session->StartInitialized(std::move(semaphore), std::move(semaphoreLock),
                               runningFromAPC);
@@ -141,7 +184,7 @@ void CustomizationSession::Start(
 // static
 DWORD CustomizationSession::GetSessionManagerProcessId() {
     HANDLE sessionManagerProcess =
-        ScopedStaticSessionManagerProcess::GetInstance().value().get();
+        ScopedStaticSessionManagerProcess::Get();
 
     DWORD processId = GetProcessId(sessionManagerProcess);
     THROW_LAST_ERROR_IF(processId == 0);
@@ -151,7 +194,7 @@ DWORD CustomizationSession::GetSessionManagerProcessId() {
 // static
 FILETIME CustomizationSession::GetSessionManagerProcessCreationTime() {
     HANDLE sessionManagerProcess =
-        ScopedStaticSessionManagerProcess::GetInstance().value().get();
+        ScopedStaticSessionManagerProcess::Get();
 
     FILETIME creationTime;
     FILETIME exitTime;
@@ -166,10 +209,70 @@ FILETIME CustomizationSession::GetSessionManagerProcessCreationTime() {
 // static
 bool CustomizationSession::IsEndingSoon() {
     HANDLE sessionManagerProcess =
-        ScopedStaticSessionManagerProcess::GetInstance().value().get();
+        ScopedStaticSessionManagerProcess::Get();
     return WaitForSingleObject(sessionManagerProcess, 0) == WAIT_OBJECT_0;
 }
 
+// static
+bool CustomizationSession::IsInitializingFromAPC() {
+    DWORD threadId = g_initializingFromAPCThreadId;
+    return threadId && threadId == GetCurrentThreadId();
+}
+
+// static
+bool CustomizationSession::IsRunningInProcess(DWORD sessionManagerProcessId,
+                                              DWORD processId) {
+    wil::unique_mutex_nothrow marker(OpenMutex(
+        SYNCHRONIZE, FALSE,
+        MakeRunningMarkerName(sessionManagerProcessId, processId).c_str()));
+    if (marker) {
+        return true;
+    }
+
+    // Assume it's running if it's not known for sure that it's not.
+    return GetLastError() != ERROR_FILE_NOT_FOUND;
+}
+
+// static
+bool CustomizationSession::TryHandOver(HANDLE sessionManagerProcess) noexcept {
+    HandoverRequest request{.sessionManagerProcess = sessionManagerProcess};
+    if (!request.doneEvent.try_create(wil::EventOptions::None, nullptr)) {
+        LOG(L"CreateEvent failed: %u", GetLastError());
+        return false;
+    }
+
+    {
+        std::lock_guard guard(g_handoverMutex);
+
+        CustomizationSession* session = g_sessionWaitingForHandover;
+        if (!session) {
+            return false;
+        }
+
+        // Only one request is handled, others wait for the session to end as
+        // without a handover.
+        g_sessionWaitingForHandover = nullptr;
+        session->m_handoverRequest = &request;
+        session->m_handoverRequestedEvent.SetEvent();
+    }
+
+    request.doneEvent.wait();
+    return request.succeeded;
+}
+
+// static
+std::wstring CustomizationSession::MakeRunningMarkerName(
+    DWORD sessionManagerProcessId,
+    DWORD processId) {
+    WCHAR szName[SessionPrivateNamespace::kPrivateNamespaceMaxLen +
+                 sizeof("\\SessionRunning-pid=1234567890")];
+    int namePos =
+        SessionPrivateNamespace::MakeName(szName, sessionManagerProcessId);
+    swprintf_s(szName + namePos, ARRAYSIZE(szName) - namePos,
+               L"\\SessionRunning-pid=%u", processId);
+    return szName;
+}
+
 CustomizationSession::CustomizationSession(
     ConstructorSecret constructorSecret,
     bool runningFromAPC,
@@ -180,12 +283,16 @@ CustomizationSession::CustomizationSession(
       m_scopedStaticSessionManagerProcess(std::move(sessionManagerProcess)),
       m_sessionMutex(std::move(sessionMutex)),
       m_privateNamespace(OpenSessionPrivateNamespace()),
+      m_logRingAttachment(std::in_place, GetSessionManagerProcessId()),
+      m_shutdownSession(std::in_place, GetSessionManagerProcessId()),
 #ifdef WH_HOOKING_ENGINE_MINHOOK
       // If runningFromAPC, no other threads should be running, skip thread
       // freeze.
       m_minHookScopeInit(runningFromAPC ? MH_FREEZE_METHOD_NONE_UNSAFE
                                         : MH_FREEZE_METHOD_FAST_UNDOCUMENTED),
 #endif  // WH_HOOKING_ENGINE_MINHOOK
+      m_engineMetricsPublisher(),
+      m_crashLoopGuard(),
       m_modsManager(),
       m_newProcessInjector(m_scopedStaticSessionManagerProcess)
 #ifdef WH_HOOKING_ENGINE_MINHOOK
@@ -198,6 +305,46 @@ CustomizationSession::CustomizationSession(
     } catch (const std::exception& e) {
         LOG(L"AfterInit failed: %S", e.what());
     }
+
+    std::unique_ptr<PortableSettings> settings;
+    try {
+        settings = StorageManager::GetInstance().GetAppConfig(L"Settings");
+        m_threadPoolMainLoop =
+            runningFromAPC &&
+            settings->GetInt(L"ThreadPoolMainLoop").value_or(0);
+        m_leanMemoryMode = settings->GetInt(L"LeanMemoryMode").value_or(0);
+        m_handoverTimeout = static_cast<DWORD>(
+            std::max(0, settings->GetInt(L"SessionHandoverTimeout")
+                            .value_or(kDefaultHandoverTimeout)));
+    } catch (const std::exception& e) {
+        LOG(L"Reading the settings failed: %S", e.what());
+    }
+
+    try {
+        if (settings &&
+            settings->GetInt(L"InjectOnlyIntoTargetedProcesses").value_or(0)) {
+            wil::unique_hlocal secDesc;
+            THROW_IF_WIN32_BOOL_FALSE(
+                Functions::GetFullAccessSecurityDescriptor(&secDesc, nullptr));
+
+            SECURITY_ATTRIBUTES secAttr = {sizeof(SECURITY_ATTRIBUTES)};
+            secAttr.lpSecurityDescriptor = secDesc.get();
+            secAttr.bInheritHandle = FALSE;
+
+            m_runningMarker.reset(CreateMutex(
+                &secAttr, FALSE,
+                MakeRunningMarkerName(GetSessionManagerProcessId(),
+                                      GetCurrentProcessId())
+                    .c_str()));
+            THROW_LAST_ERROR_IF_NULL(m_runningMarker);
+
+            m_unloadWithoutMods = true;
+        }
+    } catch (const std::exception& e) {
+        LOG(L"Creating the session running marker failed: %S", e.what());
+    }
+
+    ReleaseTransientMemory();
 }
 
 CustomizationSession::~CustomizationSession() {
@@ -236,7 +383,16 @@ CustomizationSession::MinHookScopeInit::~MinHookScopeInit() {
 }
 
 CustomizationSession::MinHookScopeApply::MinHookScopeApply() {
-    MH_STATUS status = MH_ApplyQueuedEx(MH_ALL_IDENTS);
+    TraceEvents::ScopedPhase phase("ApplyHooks");
+
+    ImportHooks::GetInstance().ApplyQueued(ImportHooks::kAllOwners);
+
+    MH_STATUS status;
+    {
+        TraceEvents::ScopedHookApply hookApply(/*modCount=*/0);
+        status = MH_ApplyQueuedEx(MH_ALL_IDENTS);
+    }
+
     if (status != MH_OK) {
         LOG(L"MH_ApplyQueuedEx failed with %d", status);
     }
@@ -254,7 +410,36 @@ CustomizationSession::MinHookScopeApply::~MinHookScopeApply() {
 
 CustomizationSession::MainLoopRunner::MainLoopRunner() noexcept {
     try {
-        m_modConfigChangeNotification.emplace();
+        m_modsPauseListener.emplace(GetSessionManagerProcessId());
+    } catch (const std::exception& e) {
+        VERBOSE(L"ModsPause::Listener constructor failed: %S", e.what());
+    }
+
+    try {
+        m_shutdownListener.emplace(GetSessionManagerProcessId());
+    } catch (const std::exception& e) {
+        VERBOSE(L"SessionShutdown::Listener constructor failed: %S",
+                e.what());
+    }
+
+    // Prefer waiting for a new snapshot of the session manager, which avoids
+    // having all processes read the mods config from storage at once. Only
+    // changes of mods which are loaded in this process, and changes which
+    // might cause new mods to load, wake up the loop.
+    try {
+        m_modConfigSnapshotChangeNotification.emplace(
+            GetSessionManagerProcessId(),
+            [](const ModConfigSnapshot::ModConfig& modConfig) {
+                return Mod::ShouldLoadInRunningProcess(modConfig);
+            });
+        return;
+    } catch (const std::exception& e) {
+        VERBOSE(L"ModConfigSnapshot::ChangeNotification constructor failed: %S",
+                e.what());
+    }
+
+    try {
+        CreateModConfigChangeNotification();
     } catch (const std::exception& e) {
         LOG(L"ModConfigChangeNotification constructor failed: %S", e.what());
     }
@@ -262,6 +447,7 @@ CustomizationSession::MainLoopRunner::MainLoopRunner() noexcept {
 
 CustomizationSession::MainLoopRunner::Result
 CustomizationSession::MainLoopRunner::Run(HANDLE sessionManagerProcess,
+                                          HANDLE moduleLoadedEvent,
                                           DWORD* lastThreadExitCode) noexcept {
     DWORD lastThreadExitCodeLocal = 0;
 
@@ -282,71 +468,150 @@ CustomizationSession::MainLoopRunner::Run(HANDLE sessionManagerProcess,
             }
         }
 
-        enum class WaitHandleId {
-            kSessionManagerProcess,
-            kFirstThread,
-            kModConfigChangeNotification,
+        WaitHandles waitHandles;
+        CollectWaitHandles(sessionManagerProcess, firstThread.get(),
+                           moduleLoadedEvent, &waitHandles);
 
-            kCount,
-        };
+        DWORD waitResult =
+            WaitForMultipleObjects(waitHandles.count, waitHandles.handles,
+                                   FALSE, INFINITE);
+        if (waitResult >= WAIT_OBJECT_0 &&
+            waitResult < WAIT_OBJECT_0 + waitHandles.count) {
+            WaitHandleId id = waitHandles.ids[waitResult - WAIT_OBJECT_0];
+            if (id == WaitHandleId::kFirstThread) {
+                GetExitCodeThread(firstThread.get(), &lastThreadExitCodeLocal);
+                continue;
+            }
 
-        constexpr size_t kMaxWaitHandlesCount =
-            static_cast<size_t>(WaitHandleId::kCount);
+            auto result = HandleSignaled(id, sessionManagerProcess);
+            if (!result) {
+                continue;
+            }
 
-        DWORD waitHandlesCount = 0;
-        HANDLE waitHandles[kMaxWaitHandlesCount]{};
-        WaitHandleId waitHandleIds[kMaxWaitHandlesCount]{};
+            return *result;
+        }
 
-        waitHandles[waitHandlesCount] = sessionManagerProcess;
-        waitHandleIds[waitHandlesCount] = WaitHandleId::kSessionManagerProcess;
-        waitHandlesCount++;
+        LOG(L"WaitForMultipleObjects returned %u, last error %u", waitResult,
+            GetLastError());
+        return Result::kError;
+    }
+}
 
-        if (firstThread) {
-            waitHandles[waitHandlesCount] = firstThread.get();
-            waitHandleIds[waitHandlesCount] = WaitHandleId::kFirstThread;
-            waitHandlesCount++;
-        }
+void CustomizationSession::MainLoopRunner::CollectWaitHandles(
+    HANDLE sessionManagerProcess,
+    HANDLE firstThread,
+    HANDLE moduleLoadedEvent,
+    WaitHandles* waitHandles) noexcept {
+    DWORD count = 0;
+    auto add = [waitHandles, &count](HANDLE handle, WaitHandleId id) {
+        waitHandles->handles[count] = handle;
+        waitHandles->ids[count] = id;
+        count++;
+    };
+
+    add(sessionManagerProcess, WaitHandleId::kSessionManagerProcess);
+
+    if (firstThread) {
+        add(firstThread, WaitHandleId::kFirstThread);
+    }
 
-        if (m_modConfigChangeNotification) {
-            waitHandles[waitHandlesCount] =
-                m_modConfigChangeNotification->GetHandle();
-            waitHandleIds[waitHandlesCount] =
-                WaitHandleId::kModConfigChangeNotification;
-            waitHandlesCount++;
+    if (m_modsPaused) {
+        // Config changes and loaded modules are handled after resuming.
+    } else if (m_modConfigSnapshotChangeNotification) {
+        for (HANDLE handle :
+             m_modConfigSnapshotChangeNotification->GetHandles()) {
+            add(handle, WaitHandleId::kModConfigChangeNotification);
         }
+    } else if (m_modConfigChangeNotification) {
+        add(m_modConfigChangeNotification->GetHandle(),
+            WaitHandleId::kModConfigChangeNotification);
+    }
 
-        DWORD waitResult = WaitForMultipleObjects(waitHandlesCount, waitHandles,
-                                                  FALSE, INFINITE);
-        if (waitResult >= WAIT_OBJECT_0 &&
-            waitResult < WAIT_OBJECT_0 + waitHandlesCount) {
-            switch (waitHandleIds[waitResult - WAIT_OBJECT_0]) {
-                case WaitHandleId::kSessionManagerProcess:
-                    return Result::kCompleted;
-
-                case WaitHandleId::kFirstThread:
-                    GetExitCodeThread(firstThread.get(),
-                                      &lastThreadExitCodeLocal);
-                    continue;
-
-                case WaitHandleId::kModConfigChangeNotification:
-                    // Wait for a bit before notifying about the change, in case
-                    // more config changes will follow.
-                    if (WaitForSingleObject(sessionManagerProcess, 200) ==
-                        WAIT_OBJECT_0) {
-                        return Result::kCompleted;
-                    }
-
-                    return Result::kReloadModsAndSettings;
+    if (moduleLoadedEvent && !m_modsPaused) {
+        add(moduleLoadedEvent, WaitHandleId::kModuleLoaded);
+    }
+
+    if (m_modsPauseListener) {
+        add(m_modsPauseListener->GetChangeHandle(),
+            WaitHandleId::kModsPauseChanged);
+    }
+
+    if (m_shutdownListener) {
+        add(m_shutdownListener->GetHandle(), WaitHandleId::kShutdown);
+    }
+
+    waitHandles->count = count;
+}
+
+std::optional<CustomizationSession::MainLoopRunner::Result>
+CustomizationSession::MainLoopRunner::HandleSignaled(
+    WaitHandleId id,
+    HANDLE sessionManagerProcess) noexcept {
+    switch (id) {
+        case WaitHandleId::kSessionManagerProcess:
+            return Result::kSessionManagerExited;
+
+        case WaitHandleId::kFirstThread:
+            return std::nullopt;
+
+        case WaitHandleId::kModConfigChangeNotification:
+            // Wait for a bit before notifying about the change, in case more
+            // config changes will follow.
+            if (WaitForSingleObject(sessionManagerProcess, 200) ==
+                WAIT_OBJECT_0) {
+                return Result::kSessionManagerExited;
             }
-        }
 
-        LOG(L"WaitForMultipleObjects returned %u, last error %u", waitResult,
-            GetLastError());
-        return Result::kError;
+            if (!m_modConfigSnapshotChangeNotification &&
+                !HasRelevantStorageChanges()) {
+                return std::nullopt;
+            }
+
+            return Result::kReloadModsAndSettings;
+
+        case WaitHandleId::kModuleLoaded:
+            // A mod is waiting for the module, load it now that the loader
+            // lock is no longer held.
+            return Result::kReloadModsAndSettings;
+
+        case WaitHandleId::kModsPauseChanged:
+            return Result::kModsPauseChanged;
+
+        case WaitHandleId::kShutdown:
+            return Result::kShutdown;
     }
+
+    return Result::kError;
+}
+
+bool CustomizationSession::MainLoopRunner::ShouldPauseMods() noexcept {
+    m_modsPaused = m_modsPauseListener && m_modsPauseListener->IsPaused();
+    return m_modsPaused;
 }
 
 bool CustomizationSession::MainLoopRunner::ContinueMonitoring() noexcept {
+    if (m_modConfigSnapshotChangeNotification) {
+        try {
+            m_modConfigSnapshotChangeNotification->ContinueMonitoring();
+            return true;
+        } catch (const std::exception& e) {
+            LOG(L"ModConfigSnapshot ContinueMonitoring failed: %S", e.what());
+            m_modConfigSnapshotChangeNotification.reset();
+        }
+
+        // The session manager stopped publishing snapshots, monitor the
+        // changes directly.
+        try {
+            CreateModConfigChangeNotification();
+        } catch (const std::exception& e) {
+            LOG(L"ModConfigChangeNotification constructor failed: %S",
+                e.what());
+            return false;
+        }
+
+        return true;
+    }
+
     if (!m_modConfigChangeNotification) {
         return false;
     }
@@ -362,6 +627,47 @@ bool CustomizationSession::MainLoopRunner::ContinueMonitoring() noexcept {
     return true;
 }
 
+void CustomizationSession::MainLoopRunner::
+    CreateModConfigChangeNotification() {
+    m_modConfigChangeNotification.emplace();
+
+    // Storage notifications are raised for changes of any mod. Without the
+    // filter, all engines reload on every change, which still works.
+    try {
+        m_modConfigStorageChangeFilter.emplace(
+            [](const ModConfigSnapshot::ModConfig& modConfig) {
+                return Mod::ShouldLoadInRunningProcess(modConfig);
+            });
+    } catch (const std::exception& e) {
+        LOG(L"StorageChangeFilter constructor failed: %S", e.what());
+    }
+}
+
+bool CustomizationSession::MainLoopRunner::
+    HasRelevantStorageChanges() noexcept {
+    if (!m_modConfigStorageChangeFilter || !m_modConfigChangeNotification) {
+        return true;
+    }
+
+    // Continue monitoring before reading the configs, so that changes made
+    // while reading aren't missed. If a relevant change is found, monitoring
+    // is continued again after the reload, which is harmless.
+    try {
+        m_modConfigChangeNotification->ContinueMonitoring();
+    } catch (const std::exception& e) {
+        LOG(L"ContinueMonitoring failed: %S", e.what());
+        return true;
+    }
+
+    try {
+        return m_modConfigStorageChangeFilter->Update();
+    } catch (const std::exception& e) {
+        LOG(L"StorageChangeFilter Update failed: %S", e.what());
+        m_modConfigStorageChangeFilter.reset();
+        return true;
+    }
+}
+
 bool CustomizationSession::MainLoopRunner::CanRunAcrossThreads() noexcept {
     if (m_modConfigChangeNotification &&
         !m_modConfigChangeNotification->CanMonitorAcrossThreads()) {
@@ -418,6 +724,13 @@ void CustomizationSession::StartInitialized(
         m_mainLoopRunner.reset();
     }
 
+    // Thread pool threads aren't exempt from thread attach callbacks, and the
+    // waits must be able to run on any thread.
+    if (m_threadPoolMainLoop && !m_threadAttachExempt && m_mainLoopRunner) {
+        StartThreadPoolMainLoop();
+        return;
+    }
+
     // Bump the reference count of the module to ensure that the module will
     // stay loaded as long as the thread is executing.
     HMODULE hDllInst;
@@ -471,10 +784,21 @@ void CustomizationSession::StartInitialized(
 
 void CustomizationSession::
     RunMainLoopAndDeleteThisWithThreadRecreate() noexcept {
-    bool modConfigChanged =
-        m_mainLoopRunner->Run(m_scopedStaticSessionManagerProcess,
-                              &m_lastThreadExitCode) ==
-        MainLoopRunner::Result::kReloadModsAndSettings;
+    bool modConfigChanged = false;
+    if (!ShouldUnloadWithoutMods()) {
+        auto result = m_mainLoopRunner->Run(
+            m_scopedStaticSessionManagerProcess,
+            m_modsManager.GetModuleLoadedEvent(), &m_lastThreadExitCode);
+        if (result == MainLoopRunner::Result::kShutdown) {
+            VERBOSE(L"Session manager is shutting down, ending the session");
+            m_modsManager.PrepareForShutdown();
+        }
+
+        modConfigChanged =
+            result == MainLoopRunner::Result::kReloadModsAndSettings ||
+            (result == MainLoopRunner::Result::kSessionManagerExited &&
+             WaitForHandover());
+    }
 
     if (!m_mainLoopRunner->CanRunAcrossThreads()) {
         m_mainLoopRunner.reset();
@@ -492,16 +816,7 @@ void CustomizationSession::
                 this_->m_mainLoopRunner.emplace();
             }
 
-            if (CurrentProcessHasMitigationPolicy()) {
-                LOG(L"Process prohibits dynamic code, cannot reload mods "
-                    L"safely");
-            } else {
-                try {
-                    this_->m_modsManager.ReloadModsAndSettings();
-                } catch (const std::exception& e) {
-                    LOG(L"ReloadModsAndSettings failed: %S", e.what());
-                }
-            }
+            this_->ReloadModsAndSettings();
 
             this_->RunMainLoop();
             this_->DeleteThis();
@@ -539,27 +854,341 @@ void CustomizationSession::
 }
 
 void CustomizationSession::RunMainLoop() noexcept {
-    while (true) {
-        auto result = m_mainLoopRunner->Run(m_scopedStaticSessionManagerProcess,
-                                            &m_lastThreadExitCode);
-        if (result != MainLoopRunner::Result::kReloadModsAndSettings) {
+    while (PrepareMainLoopWait()) {
+        auto result = m_mainLoopRunner->Run(
+            m_scopedStaticSessionManagerProcess,
+            m_modsManager.GetModuleLoadedEvent(), &m_lastThreadExitCode);
+        if (!HandleMainLoopResult(result)) {
             break;
         }
+    }
 
-        m_mainLoopRunner->ContinueMonitoring();
+    VERBOSE(L"Exiting engine thread wait loop");
+}
 
+bool CustomizationSession::PrepareMainLoopWait() noexcept {
+    if (ShouldUnloadWithoutMods()) {
+        return false;
+    }
+
+    bool modsPaused = m_mainLoopRunner->ShouldPauseMods();
+    if (modsPaused != m_modsPaused) {
+        m_modsPaused = modsPaused;
         if (CurrentProcessHasMitigationPolicy()) {
-            LOG(L"Process prohibits dynamic code, cannot reload mods safely");
+            LOG(L"Process prohibits dynamic code, cannot %s mods safely",
+                modsPaused ? L"pause" : L"resume");
         } else {
-            try {
-                m_modsManager.ReloadModsAndSettings();
-            } catch (const std::exception& e) {
-                LOG(L"ReloadModsAndSettings failed: %S", e.what());
+            VERBOSE(L"%s mods", modsPaused ? L"Pausing" : L"Resuming");
+            m_modsManager.SetHooksPaused(modsPaused);
+        }
+    }
+
+    return true;
+}
+
+bool CustomizationSession::HandleMainLoopResult(
+    MainLoopRunner::Result result) noexcept {
+    if (result == MainLoopRunner::Result::kModsPauseChanged) {
+        return true;
+    }
+
+    if (result == MainLoopRunner::Result::kShutdown) {
+        VERBOSE(L"Session manager is shutting down, ending the session");
+        m_modsManager.PrepareForShutdown();
+        return false;
+    }
+
+    if (result == MainLoopRunner::Result::kSessionManagerExited) {
+        if (!WaitForHandover()) {
+            return false;
+        }
+
+        // The config might have changed while there was no session manager.
+        ReloadModsAndSettings();
+        return true;
+    }
+
+    if (result != MainLoopRunner::Result::kReloadModsAndSettings) {
+        return false;
+    }
+
+    m_mainLoopRunner->ContinueMonitoring();
+
+    ReloadModsAndSettings();
+
+    return true;
+}
+
+bool CustomizationSession::WaitForHandover() noexcept {
+    // In the session manager process, the session ends with the process.
+    try {
+        if (!m_handoverTimeout ||
+            GetSessionManagerProcessId() == GetCurrentProcessId()) {
+            return false;
+        }
+    } catch (const std::exception& e) {
+        LOG(L"%S", e.what());
+        return false;
+    }
+
+    if (!m_handoverRequestedEvent &&
+        !m_handoverRequestedEvent.try_create(wil::EventOptions::None,
+                                             nullptr)) {
+        LOG(L"CreateEvent failed: %u", GetLastError());
+        return false;
+    }
+
+    {
+        std::lock_guard guard(g_handoverMutex);
+        // Might be left signaled by a request which came in right after the
+        // previous wait timed out.
+        m_handoverRequestedEvent.ResetEvent();
+        g_sessionWaitingForHandover = this;
+    }
+
+    VERBOSE(L"Session manager exited, waiting for a new one to take over");
+
+    WaitForSingleObject(m_handoverRequestedEvent.get(), m_handoverTimeout);
+
+    HandoverRequest* request;
+    {
+        std::lock_guard guard(g_handoverMutex);
+        g_sessionWaitingForHandover = nullptr;
+        request = std::exchange(m_handoverRequest, nullptr);
+    }
+
+    if (!request) {
+        VERBOSE(L"No new session manager took over, ending the session");
+        return false;
+    }
+
+    bool succeeded = false;
+    try {
+        AdoptSessionManager(request->sessionManagerProcess);
+        succeeded = true;
+    } catch (const std::exception& e) {
+        LOG(L"Taking over the session failed: %S", e.what());
+    }
+
+    // The request is freed by the injected thread once it's done.
+    request->succeeded = succeeded;
+    request->doneEvent.SetEvent();
+
+    return succeeded;
+}
+
+void CustomizationSession::AdoptSessionManager(HANDLE sessionManagerProcess) {
+    wil::unique_process_handle process;
+    THROW_IF_WIN32_BOOL_FALSE(DuplicateHandle(
+        GetCurrentProcess(), sessionManagerProcess, GetCurrentProcess(),
+        &process, 0, FALSE, DUPLICATE_SAME_ACCESS));
+
+    DWORD processId = GetProcessId(process.get());
+    THROW_LAST_ERROR_IF(processId == 0);
+
+    // The only step which can fail, done first so that a failure leaves the
+    // session as it was, and it ends.
+    auto privateNamespace = SessionPrivateNamespace::Open(processId);
+
+    VERBOSE(L"Session manager %u took over the session", processId);
+
+    m_privateNamespace = std::move(privateNamespace);
+    m_scopedStaticSessionManagerProcess.Replace(std::move(process));
+    m_newProcessInjector.SetSessionManagerProcess(
+        m_scopedStaticSessionManagerProcess);
+
+    m_logRingAttachment.reset();
+    m_logRingAttachment.emplace(processId);
+
+    m_shutdownSession.reset();
+    m_shutdownSession.emplace(processId);
+
+    // The crash loop guard keeps its record in the table of the previous
+    // session manager, the start of the process was already counted there.
+    ModStatusTable::OnSessionManagerChanged();
+
+    if (m_runningMarker) {
+        try {
+            wil::unique_hlocal secDesc;
+            THROW_IF_WIN32_BOOL_FALSE(
+                Functions::GetFullAccessSecurityDescriptor(&secDesc, nullptr));
+
+            SECURITY_ATTRIBUTES secAttr = {sizeof(SECURITY_ATTRIBUTES)};
+            secAttr.lpSecurityDescriptor = secDesc.get();
+            secAttr.bInheritHandle = FALSE;
+
+            m_runningMarker.reset(CreateMutex(
+                &secAttr, FALSE,
+                MakeRunningMarkerName(processId, GetCurrentProcessId())
+                    .c_str()));
+            THROW_LAST_ERROR_IF_NULL(m_runningMarker);
+        } catch (const std::exception& e) {
+            // The new session manager injects the engine again, which then
+            // takes the same path but finds no session waiting.
+            LOG(L"Creating the session running marker failed: %S", e.what());
+        }
+    }
+
+    m_modsManager.OnSessionManagerChanged();
+
+    // The pause state, the shutdown stages and the config snapshots are
+    // published by the new session manager.
+    m_mainLoopRunner.emplace();
+}
+
+void CustomizationSession::ReloadModsAndSettings() noexcept {
+    if (CurrentProcessHasMitigationPolicy()) {
+        LOG(L"Process prohibits dynamic code, cannot reload mods safely");
+        return;
+    }
+
+    try {
+        m_modsManager.ReloadModsAndSettings();
+    } catch (const std::exception& e) {
+        LOG(L"ReloadModsAndSettings failed: %S", e.what());
+    }
+
+    ReleaseTransientMemory();
+}
+
+void CustomizationSession::StartThreadPoolMainLoop() noexcept {
+    // Bump the reference count of the module to ensure that the module will
+    // stay loaded as long as the waits are set. Released by the callback which
+    // ends the session.
+    HMODULE hDllInst;
+    GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS,
+                      reinterpret_cast<LPCWSTR>(g_hDllInst), &hDllInst);
+
+    if (!PrepareMainLoopWait() || !SetThreadPoolWaits()) {
+        FreeLibrary(g_hDllInst);
+        DeleteThis();
+    }
+}
+
+bool CustomizationSession::SetThreadPoolWaits() noexcept {
+    MainLoopRunner::WaitHandles waitHandles;
+    m_mainLoopRunner->CollectWaitHandles(
+        m_scopedStaticSessionManagerProcess, nullptr,
+        m_modsManager.GetModuleLoadedEvent(), &waitHandles);
+
+    std::lock_guard guard(m_threadPoolWaitsMutex);
+
+    // Create all waits before setting any of them, since a callback might
+    // run as soon as the first one is set.
+    for (DWORD i = 0; i < waitHandles.count; i++) {
+        auto waitContext = std::make_unique<ThreadPoolWaitContext>(
+            ThreadPoolWaitContext{
+                .session = this,
+                .id = waitHandles.ids[i],
+            });
+        waitContext->wait = CreateThreadpoolWait(ThreadPoolWaitCallback,
+                                                 waitContext.get(), nullptr);
+        if (!waitContext->wait) {
+            LOG(L"CreateThreadpoolWait failed: %u", GetLastError());
+            for (const auto& created : m_threadPoolWaits) {
+                CloseThreadpoolWait(created->wait);
             }
+
+            m_threadPoolWaits.clear();
+            return false;
         }
+
+        m_threadPoolWaits.push_back(std::move(waitContext));
     }
 
-    VERBOSE(L"Exiting engine thread wait loop");
+    m_threadPoolWaitSignaled = false;
+
+    for (DWORD i = 0; i < waitHandles.count; i++) {
+        SetThreadpoolWait(m_threadPoolWaits[i]->wait, waitHandles.handles[i],
+                          nullptr);
+    }
+
+    return true;
+}
+
+void CustomizationSession::CloseThreadPoolWaits(PTP_WAIT currentWait) noexcept {
+    std::lock_guard guard(m_threadPoolWaitsMutex);
+
+    for (const auto& waitContext : m_threadPoolWaits) {
+        if (waitContext->wait != currentWait) {
+            SetThreadpoolWait(waitContext->wait, nullptr, nullptr);
+            WaitForThreadpoolWaitCallbacks(waitContext->wait, TRUE);
+        }
+
+        // A wait can be closed from its own callback, it's freed once the
+        // callback returns.
+        CloseThreadpoolWait(waitContext->wait);
+    }
+
+    m_threadPoolWaits.clear();
+}
+
+// static
+void CALLBACK
+CustomizationSession::ThreadPoolWaitCallback(PTP_CALLBACK_INSTANCE instance,
+                                             PVOID context,
+                                             PTP_WAIT wait,
+                                             TP_WAIT_RESULT waitResult) {
+    auto* waitContext = static_cast<ThreadPoolWaitContext*>(context);
+    auto* this_ = waitContext->session;
+
+    // Another wait was signaled at the same time, and its callback handles
+    // the iteration.
+    if (this_->m_threadPoolWaitSignaled.exchange(true)) {
+        return;
+    }
+
+    SetThreadErrorMode(SEM_FAILCRITICALERRORS, nullptr);
+
+    MainLoopRunner::WaitHandleId id = waitContext->id;
+
+    // Frees waitContext.
+    this_->CloseThreadPoolWaits(wait);
+
+    auto result = this_->m_mainLoopRunner->HandleSignaled(
+        id, this_->m_scopedStaticSessionManagerProcess);
+    if ((!result || this_->HandleMainLoopResult(*result)) &&
+        this_->PrepareMainLoopWait() && this_->SetThreadPoolWaits()) {
+        return;
+    }
+
+    VERBOSE(L"Exiting engine thread pool wait loop");
+
+    this_->DeleteThis();
+    FreeLibraryWhenCallbackReturns(instance, g_hDllInst);
+}
+
+void CustomizationSession::ReleaseTransientMemory() noexcept {
+    if (!m_leanMemoryMode) {
+        return;
+    }
+
+    try {
+        HttpClient::CloseSessionIfIdle();
+        ImportHooks::GetInstance().ReleaseImportIndexes();
+        LoadedMod::ClearInMemorySymbolCache();
+    } catch (const std::exception& e) {
+        LOG(L"Releasing transient memory failed: %S", e.what());
+    }
+
+    // Returns the free blocks at the end of the heap segments to the system,
+    // most of which are left from parsing symbols and configuration.
+    HeapCompact(GetProcessHeap(), 0);
+}
+
+bool CustomizationSession::ShouldUnloadWithoutMods() noexcept {
+    if (!m_unloadWithoutMods || !m_modsManager.IsEmpty()) {
+        return false;
+    }
+
+    // The session keeps the crash loop record of the process, which the app
+    // is notified with.
+    if (CrashLoopGuard::IsTripped()) {
+        return false;
+    }
+
+    VERBOSE(L"No mods to load, unloading the engine");
+    return true;
 }
 
 void CustomizationSession::DeleteThis() noexcept {
@@ -1,8 +1,14 @@
 #pragma once
 
+#include "crash_loop_guard.h"
+#include "engine_metrics.h"
+#include "log_ring.h"
+#include "mod_config_snapshot.h"
 #include "mods_manager.h"
+#include "mods_pause.h"
 #include "new_process_injector.h"
 #include "no_destructor.h"
+#include "session_shutdown.h"
 #include "storage_manager.h"
 #include "var_init_once.h"
 
@@ -24,6 +30,13 @@ class CustomizationSession {
     static DWORD GetSessionManagerProcessId();
     static FILETIME GetSessionManagerProcessCreationTime();
     static bool IsEndingSoon();
+    static bool IsInitializingFromAPC();
+
+    // Whether a session is running in the process. Only supported for
+    // processes in which the engine might unload itself, see
+    // m_unloadWithoutMods.
+    static bool IsRunningInProcess(DWORD sessionManagerProcessId,
+                                   DWORD processId);
 
     // Must be public for std emplace and destruction, but shouldn't be used
     // outside of this file.
@@ -35,8 +48,13 @@ class CustomizationSession {
     ~CustomizationSession();
 
    private:
+    // Long enough for the app to restart, e.g. after an update.
+    static constexpr DWORD kDefaultHandoverTimeout = 10000;
+
     // Used to hold a single process handle which can be accessed from static
-    // functions.
+    // functions. The handle is replaced when a new session manager takes over
+    // the session, the previous handles are kept open until the session ends,
+    // since other threads might still be using them.
     class ScopedStaticSessionManagerProcess {
        public:
         ScopedStaticSessionManagerProcess(
@@ -45,16 +63,37 @@ class CustomizationSession {
             const ScopedStaticSessionManagerProcess&) = delete;
 
         ScopedStaticSessionManagerProcess(wil::unique_process_handle handle) {
-            GetInstance().emplace(std::move(handle));
+            Replace(std::move(handle));
+        }
+        ~ScopedStaticSessionManagerProcess() {
+            GetInstance().current = nullptr;
+            GetInstance().handles.clear();
         }
-        ~ScopedStaticSessionManagerProcess() { GetInstance().reset(); }
-        static std::optional<wil::unique_process_handle>& GetInstance() {
-            STATIC_INIT_ONCE(NoDestructorIfTerminating<
-                                 std::optional<wil::unique_process_handle>>,
-                             handle);
-            return **handle;
+        void Replace(wil::unique_process_handle handle) {
+            auto& instance = GetInstance();
+            instance.handles.push_back(std::move(handle));
+            instance.current = instance.handles.back().get();
+        }
+        static HANDLE Get() {
+            HANDLE handle = GetInstance().current;
+            if (!handle) {
+                throw std::logic_error("No customization session");
+            }
+
+            return handle;
+        }
+        operator HANDLE() { return Get(); }
+
+       private:
+        struct Handles {
+            std::atomic<HANDLE> current = nullptr;
+            std::vector<wil::unique_process_handle> handles;
+        };
+
+        static Handles& GetInstance() {
+            STATIC_INIT_ONCE(NoDestructorIfTerminating<Handles>, handles);
+            return **handles;
         }
-        operator HANDLE() { return GetInstance().value().get(); }
     };
 
 #ifdef WH_HOOKING_ENGINE_MINHOOK
@@ -83,21 +122,89 @@ class CustomizationSession {
 
         enum class Result {
             kReloadModsAndSettings,
+            kModsPauseChanged,
+            // The session either ends, or is handed over to a new session
+            // manager, see WaitForHandover.
+            kSessionManagerExited,
+            // The session manager ends all sessions, see SessionShutdown.
+            kShutdown,
             kCompleted,
             kError,
         };
 
+        enum class WaitHandleId {
+            kSessionManagerProcess,
+            kFirstThread,
+            kModConfigChangeNotification,
+            kModuleLoaded,
+            kModsPauseChanged,
+            kShutdown,
+        };
+
+        static constexpr size_t kMaxWaitHandlesCount =
+            5 + ModConfigSnapshot::ChangeNotification::kMaxHandleCount;
+        static_assert(kMaxWaitHandlesCount <= MAXIMUM_WAIT_OBJECTS);
+
+        struct WaitHandles {
+            DWORD count;
+            HANDLE handles[kMaxWaitHandlesCount];
+            WaitHandleId ids[kMaxWaitHandlesCount];
+        };
+
         Result Run(HANDLE sessionManagerProcess,
+                   HANDLE moduleLoadedEvent,
                    DWORD* lastThreadExitCode) noexcept;
+        // The handles which Run waits for, which can also be waited for
+        // elsewhere, e.g. with thread pool waits. firstThread can be null.
+        void CollectWaitHandles(HANDLE sessionManagerProcess,
+                                HANDLE firstThread,
+                                HANDLE moduleLoadedEvent,
+                                WaitHandles* waitHandles) noexcept;
+        // Returns the result for a signaled handle, or nullopt if the wait
+        // should continue.
+        std::optional<Result> HandleSignaled(
+            WaitHandleId id,
+            HANDLE sessionManagerProcess) noexcept;
         bool ContinueMonitoring() noexcept;
         bool CanRunAcrossThreads() noexcept;
+        // Whether the session manager paused the mods. While they're paused,
+        // Run doesn't return for changes of the mods config or for loaded
+        // modules, these are handled once the mods are resumed.
+        bool ShouldPauseMods() noexcept;
 
        private:
+        void CreateModConfigChangeNotification();
+        bool HasRelevantStorageChanges() noexcept;
+
+        std::optional<ModConfigSnapshot::ChangeNotification>
+            m_modConfigSnapshotChangeNotification;
         std::optional<StorageManager::ModConfigChangeNotification>
             m_modConfigChangeNotification;
+        // Used with m_modConfigChangeNotification. If not set, every change
+        // causes a reload.
+        std::optional<ModConfigSnapshot::StorageChangeFilter>
+            m_modConfigStorageChangeFilter;
+        std::optional<ModsPause::Listener> m_modsPauseListener;
+        bool m_modsPaused = false;
+        std::optional<SessionShutdown::Listener> m_shutdownListener;
+    };
+
+    // A new session manager which injects the engine while the session waits
+    // for a handover. Lives on the stack of the injected thread, which waits
+    // for doneEvent.
+    struct HandoverRequest {
+        HANDLE sessionManagerProcess;
+        wil::unique_event_nothrow doneEvent;
+        bool succeeded = false;
     };
 
     static std::optional<CustomizationSession>& GetInstance();
+    // Returns true if the session was handed over to the session manager, in
+    // which case no new session is started.
+    static bool TryHandOver(HANDLE sessionManagerProcess) noexcept;
+
+    static std::wstring MakeRunningMarkerName(DWORD sessionManagerProcessId,
+                                              DWORD processId);
 
     wil::unique_private_namespace_close OpenSessionPrivateNamespace();
     void StartInitialized(wil::unique_semaphore semaphore,
@@ -105,15 +212,74 @@ class CustomizationSession {
                           bool runningFromAPC) noexcept;
     void RunMainLoopAndDeleteThisWithThreadRecreate() noexcept;
     void RunMainLoop() noexcept;
+    // Return false if the session should end.
+    bool PrepareMainLoopWait() noexcept;
+    bool HandleMainLoopResult(MainLoopRunner::Result result) noexcept;
+    // Called once the session manager exited. Keeps the mods loaded for a
+    // while, and returns true if a new session manager took over the session
+    // meanwhile, see the SessionHandoverTimeout setting.
+    bool WaitForHandover() noexcept;
+    // Rebinds everything which is named after the session manager: the
+    // private namespace, the log ring, the shutdown slot, the mod status
+    // records, the running marker and the main loop notifications.
+    void AdoptSessionManager(HANDLE sessionManagerProcess);
+    void ReloadModsAndSettings() noexcept;
+
+    struct ThreadPoolWaitContext {
+        CustomizationSession* session;
+        MainLoopRunner::WaitHandleId id;
+        PTP_WAIT wait;
+    };
+
+    // Runs the main loop as thread pool waits instead of on a dedicated
+    // thread, see the ThreadPoolMainLoop setting. Each wake-up runs one
+    // iteration of the loop on a thread pool thread, then the waits are set
+    // again.
+    void StartThreadPoolMainLoop() noexcept;
+    bool SetThreadPoolWaits() noexcept;
+    // Closes all waits, except that the callback of currentWait isn't waited
+    // for, since it's the one which is running.
+    void CloseThreadPoolWaits(PTP_WAIT currentWait) noexcept;
+    static void CALLBACK ThreadPoolWaitCallback(PTP_CALLBACK_INSTANCE instance,
+                                                PVOID context,
+                                                PTP_WAIT wait,
+                                                TP_WAIT_RESULT waitResult);
+    // With the LeanMemoryMode setting, called after mods are loaded or
+    // reloaded to free what's only needed while loading them: the idle HTTP
+    // session, the import indexes, the symbols kept in memory for reloads,
+    // and the free blocks of the heap.
+    void ReleaseTransientMemory() noexcept;
+    bool ShouldUnloadWithoutMods() noexcept;
     void DeleteThis() noexcept;
 
     bool m_threadAttachExempt;
     ScopedStaticSessionManagerProcess m_scopedStaticSessionManagerProcess;
     wil::unique_mutex_nothrow m_sessionMutex;
     wil::unique_private_namespace_close m_privateNamespace;
+    std::optional<LogRing::Attachment> m_logRingAttachment;
+    // Declared before the mods manager, so that the session is only removed
+    // from the shutdown table once the mods are unloaded.
+    std::optional<SessionShutdown::Session> m_shutdownSession;
+    // If set, the session ends once no mods should be loaded in the process,
+    // and the session manager injects the engine again if that changes. The
+    // marker lets the session manager know that the session is still running.
+    bool m_unloadWithoutMods = false;
+    wil::unique_mutex_nothrow m_runningMarker;
+    // Only used for sessions which are started from an APC.
+    bool m_threadPoolMainLoop = false;
+    bool m_leanMemoryMode = false;
+    // How long the mods stay loaded after the session manager exited, waiting
+    // for a new one to take over. Zero to end the session right away.
+    DWORD m_handoverTimeout = kDefaultHandoverTimeout;
+    wil::unique_event_nothrow m_handoverRequestedEvent;
+    // Guarded by the handover mutex.
+    HandoverRequest* m_handoverRequest = nullptr;
 #ifdef WH_HOOKING_ENGINE_MINHOOK
     MinHookScopeInit m_minHookScopeInit;
 #endif  // WH_HOOKING_ENGINE_MINHOOK
+    EngineMetrics::Publisher m_engineMetricsPublisher;
+    // Must be created before the mods are loaded.
+    CrashLoopGuard::Session m_crashLoopGuard;
     ModsManager m_modsManager;
     NewProcessInjector m_newProcessInjector;
 #ifdef WH_HOOKING_ENGINE_MINHOOK
@@ -122,6 +288,15 @@ class CustomizationSession {
 
     std::optional<MainLoopRunner> m_mainLoopRunner;
     DWORD m_lastThreadExitCode = 0;
+    // Held while the waits are set or closed. The callbacks check
+    // m_threadPoolWaitSignaled first, so that only one of them runs an
+    // iteration of the loop.
+    std::mutex m_threadPoolWaitsMutex;
+    std::vector<std::unique_ptr<ThreadPoolWaitContext>> m_threadPoolWaits;
+    std::atomic<bool> m_threadPoolWaitSignaled = false;
+    // Whether the hooks of the loaded mods are disabled since the session
+    // manager paused the mods.
+    bool m_modsPaused = false;
 
     // Must be released after the singleton object is freed. See the careful
     // usage in DeleteThis.
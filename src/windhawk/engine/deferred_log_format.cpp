@@ -0,0 +1,694 @@
+#include "stdafx.h"
+
+#include "deferred_log_format.h"
+
+namespace {
+
+// Each argument is stored as a tag followed by its value. Strings are stored
+// with their length in characters, without a terminating null character.
+enum class ArgType : BYTE {
+    kInt32 = 1,
+    kInt64,
+    kDouble,
+    kChar,
+    kWideChar,
+    kString,
+    kWideString,
+    kNullString,
+    kPointer32,
+    kPointer64,
+};
+
+enum class SizeModifier {
+    kNone,
+    kChar,        // hh
+    kShort,       // h
+    kLong,        // l, w
+    kLongLong,    // ll, I64, j
+    kSizeT,       // z, t, I
+    kInt32,       // I32
+    kLongDouble,  // L
+};
+
+struct FormatSpec {
+    std::wstring_view flags;
+    // Either digits or "*", empty if not specified.
+    std::wstring_view width;
+    bool hasPrecision;
+    // Either digits or "*", empty means zero.
+    std::wstring_view precision;
+    SizeModifier size;
+    WCHAR conversion;
+};
+
+// The longest possible rebuilt spec fits, so it's never truncated.
+constexpr size_t kMaxFlagsLength = 16;
+constexpr size_t kMaxNumberLength = 4;
+constexpr int kMaxNumber = 1024;
+constexpr size_t kMaxSpecLength = 64;
+
+// p points past the '%'. Returns a pointer past the conversion character, or
+// nullptr if the format string ends in the middle of the spec.
+PCWSTR ParseSpec(PCWSTR p, FormatSpec* spec) {
+    PCWSTR start = p;
+    while (*p && wcschr(L"-+0 #", *p)) {
+        p++;
+    }
+
+    spec->flags = std::wstring_view(start, p - start);
+
+    start = p;
+    if (*p == L'*') {
+        p++;
+    } else {
+        while (iswdigit(*p)) {
+            p++;
+        }
+    }
+
+    spec->width = std::wstring_view(start, p - start);
+
+    spec->hasPrecision = *p == L'.';
+    if (spec->hasPrecision) {
+        start = ++p;
+        if (*p == L'*') {
+            p++;
+        } else {
+            while (iswdigit(*p)) {
+                p++;
+            }
+        }
+
+        spec->precision = std::wstring_view(start, p - start);
+    }
+
+    spec->size = SizeModifier::kNone;
+    switch (*p) {
+        case L'h':
+            if (p[1] == L'h') {
+                spec->size = SizeModifier::kChar;
+                p += 2;
+            } else {
+                spec->size = SizeModifier::kShort;
+                p++;
+            }
+            break;
+
+        case L'l':
+            if (p[1] == L'l') {
+                spec->size = SizeModifier::kLongLong;
+                p += 2;
+            } else {
+                spec->size = SizeModifier::kLong;
+                p++;
+            }
+            break;
+
+        case L'w':
+            spec->size = SizeModifier::kLong;
+            p++;
+            break;
+
+        case L'L':
+            spec->size = SizeModifier::kLongDouble;
+            p++;
+            break;
+
+        case L'j':
+            spec->size = SizeModifier::kLongLong;
+            p++;
+            break;
+
+        case L'z':
+        case L't':
+            spec->size = SizeModifier::kSizeT;
+            p++;
+            break;
+
+        case L'I':
+            if (p[1] == L'6' && p[2] == L'4') {
+                spec->size = SizeModifier::kLongLong;
+                p += 3;
+            } else if (p[1] == L'3' && p[2] == L'2') {
+                spec->size = SizeModifier::kInt32;
+                p += 3;
+            } else {
+                spec->size = SizeModifier::kSizeT;
+                p++;
+            }
+            break;
+    }
+
+    spec->conversion = *p;
+    if (!spec->conversion) {
+        return nullptr;
+    }
+
+    return p + 1;
+}
+
+bool IsIntegerConversion(WCHAR c) {
+    return c && wcschr(L"diouxX", c);
+}
+
+bool IsFloatingPointConversion(WCHAR c) {
+    return c && wcschr(L"eEfFgGaA", c);
+}
+
+bool IsCharConversion(WCHAR c) {
+    return c == L'c' || c == L'C';
+}
+
+bool IsStringConversion(WCHAR c) {
+    return c == L's' || c == L'S';
+}
+
+// In the wide printf functions, %c and %s are wide and %C and %S are narrow,
+// unless a size modifier is specified.
+bool IsNarrow(const FormatSpec& spec) {
+    return spec.size == SizeModifier::kShort ||
+           spec.size == SizeModifier::kChar ||
+           (iswupper(spec.conversion) && spec.size != SizeModifier::kLong);
+}
+
+int ParseNumber(std::wstring_view digits) {
+    int number = 0;
+    for (WCHAR c : digits) {
+        if (number > INT_MAX / 10 - 1) {
+            return INT_MAX;
+        }
+
+        number = number * 10 + (c - L'0');
+    }
+
+    return number;
+}
+
+class DataWriter {
+   public:
+    explicit DataWriter(std::span<BYTE> buffer) : m_buffer(buffer) {}
+
+    bool Write(const void* data, size_t size) {
+        if (size > m_buffer.size() - m_size) {
+            return false;
+        }
+
+        memcpy(m_buffer.data() + m_size, data, size);
+        m_size += size;
+        return true;
+    }
+
+    bool WriteType(ArgType type) { return Write(&type, sizeof(type)); }
+
+    template <typename T>
+    bool WriteValue(ArgType type, T value) {
+        return WriteType(type) && Write(&value, sizeof(value));
+    }
+
+    template <typename Char>
+    bool WriteString(ArgType type, const Char* string, size_t length) {
+        if (length > UINT32_MAX) {
+            return false;
+        }
+
+        return WriteValue(type, static_cast<UINT32>(length)) &&
+               Write(string, length * sizeof(Char));
+    }
+
+    size_t GetSize() const { return m_size; }
+
+   private:
+    std::span<BYTE> m_buffer;
+    size_t m_size = 0;
+};
+
+bool EncodeArg(DataWriter& writer,
+               const FormatSpec& spec,
+               int precision,
+               va_list* args) {
+    WCHAR c = spec.conversion;
+
+    if (IsIntegerConversion(c)) {
+        if (spec.size == SizeModifier::kLongLong ||
+            (spec.size == SizeModifier::kSizeT && sizeof(size_t) == 8)) {
+            return writer.WriteValue(ArgType::kInt64, va_arg(*args, INT64));
+        }
+
+        return writer.WriteValue(ArgType::kInt32, va_arg(*args, INT32));
+    }
+
+    if (IsFloatingPointConversion(c)) {
+        return writer.WriteValue(ArgType::kDouble, va_arg(*args, double));
+    }
+
+    if (IsCharConversion(c)) {
+        INT32 value = va_arg(*args, int);
+        return writer.WriteValue(
+            IsNarrow(spec) ? ArgType::kChar : ArgType::kWideChar, value);
+    }
+
+    if (IsStringConversion(c)) {
+        // With a precision, the string doesn't have to be null-terminated.
+        size_t maxLength = precision >= 0 ? precision : SIZE_MAX;
+
+        if (IsNarrow(spec)) {
+            auto* string = va_arg(*args, const char*);
+            if (!string) {
+                return writer.WriteType(ArgType::kNullString);
+            }
+
+            return writer.WriteString(ArgType::kString, string,
+                                      strnlen(string, maxLength));
+        }
+
+        auto* string = va_arg(*args, const WCHAR*);
+        if (!string) {
+            return writer.WriteType(ArgType::kNullString);
+        }
+
+        return writer.WriteString(ArgType::kWideString, string,
+                                  wcsnlen(string, maxLength));
+    }
+
+    if (c == L'p') {
+        auto value = reinterpret_cast<UINT_PTR>(va_arg(*args, void*));
+#ifdef _WIN64
+        return writer.WriteValue(ArgType::kPointer64,
+                                 static_cast<UINT64>(value));
+#else
+        return writer.WriteValue(ArgType::kPointer32,
+                                 static_cast<UINT32>(value));
+#endif
+    }
+
+    // %n, %Z and anything unknown.
+    return false;
+}
+
+class DataReader {
+   public:
+    explicit DataReader(std::span<const BYTE> data) : m_data(data) {}
+
+    bool Read(void* data, size_t size) {
+        if (size > m_data.size() - m_pos) {
+            return false;
+        }
+
+        memcpy(data, m_data.data() + m_pos, size);
+        m_pos += size;
+        return true;
+    }
+
+    template <typename T>
+    bool ReadValue(T* value) {
+        return Read(value, sizeof(*value));
+    }
+
+    // Reads the string into buffer and null-terminates it.
+    template <typename Char>
+    bool ReadString(std::span<Char> buffer) {
+        UINT32 length;
+        if (!ReadValue(&length) || length >= buffer.size() ||
+            !Read(buffer.data(), length * sizeof(Char))) {
+            return false;
+        }
+
+        buffer[length] = 0;
+        return true;
+    }
+
+    size_t GetRemainingSize() const { return m_data.size() - m_pos; }
+
+   private:
+    std::span<const BYTE> m_data;
+    size_t m_pos = 0;
+};
+
+class LineWriter {
+   public:
+    // The buffer must have room for at least a newline and a null character.
+    explicit LineWriter(std::span<WCHAR> buffer) : m_buffer(buffer) {
+        m_buffer[0] = L'\0';
+    }
+
+    void Append(std::wstring_view text) {
+        size_t length = std::min(text.size(), m_buffer.size() - 1 - m_length);
+        wmemcpy(m_buffer.data() + m_length, text.data(), length);
+        m_length += length;
+        m_buffer[m_length] = L'\0';
+    }
+
+    template <typename T>
+    void AppendFormatted(PCWSTR spec, T value) {
+        int length = _snwprintf_s(m_buffer.data() + m_length,
+                                  m_buffer.size() - m_length, _TRUNCATE, spec,
+                                  value);
+        if (length == -1) {
+            // Truncation occurred.
+            m_length = m_buffer.size() - 1;
+        } else {
+            m_length += length;
+        }
+    }
+
+    void FinishLine() {
+        while (m_length > 0 && m_buffer[m_length - 1] == L'\n') {
+            m_length--;
+        }
+
+        m_length = std::min(m_length, m_buffer.size() - 2);
+        m_buffer[m_length++] = L'\n';
+        m_buffer[m_length] = L'\0';
+    }
+
+   private:
+    std::span<WCHAR> m_buffer;
+    size_t m_length = 0;
+};
+
+// Rebuilds the spec with the given size modifier and conversion. Widths and
+// precisions are limited, larger ones are treated as malformed data.
+bool BuildSpec(std::span<WCHAR, kMaxSpecLength> buffer,
+               const FormatSpec& spec,
+               std::optional<int> widthArg,
+               std::optional<int> precisionArg,
+               PCWSTR sizeModifier,
+               WCHAR conversion) {
+    if (spec.flags.size() > kMaxFlagsLength ||
+        spec.width.size() > kMaxNumberLength ||
+        spec.precision.size() > kMaxNumberLength ||
+        (widthArg && (*widthArg < -kMaxNumber || *widthArg > kMaxNumber)) ||
+        (precisionArg && *precisionArg > kMaxNumber)) {
+        return false;
+    }
+
+    size_t length = 0;
+    auto append = [&](PCWSTR format, auto... args) {
+        length += _snwprintf_s(buffer.data() + length, buffer.size() - length,
+                               _TRUNCATE, format, args...);
+    };
+
+    append(L"%%%.*s", static_cast<int>(spec.flags.size()), spec.flags.data());
+
+    if (widthArg) {
+        // A negative width argument is a '-' flag followed by a width.
+        if (*widthArg < 0) {
+            append(L"-%d", -*widthArg);
+        } else {
+            append(L"%d", *widthArg);
+        }
+    } else {
+        append(L"%.*s", static_cast<int>(spec.width.size()), spec.width.data());
+    }
+
+    if (spec.hasPrecision) {
+        if (!precisionArg) {
+            append(L".%.*s", static_cast<int>(spec.precision.size()),
+                   spec.precision.data());
+        } else if (*precisionArg >= 0) {
+            // A negative precision argument is as if there's no precision.
+            append(L".%d", *precisionArg);
+        }
+    }
+
+    append(L"%s%c", sizeModifier, conversion);
+    return true;
+}
+
+bool DecodeArg(LineWriter& writer,
+               DataReader& reader,
+               const FormatSpec& spec) {
+    std::optional<int> widthArg;
+    if (spec.width == L"*") {
+        ArgType type;
+        INT32 value;
+        if (!reader.ReadValue(&type) || type != ArgType::kInt32 ||
+            !reader.ReadValue(&value)) {
+            return false;
+        }
+
+        widthArg = value;
+    }
+
+    std::optional<int> precisionArg;
+    if (spec.hasPrecision && spec.precision == L"*") {
+        ArgType type;
+        INT32 value;
+        if (!reader.ReadValue(&type) || type != ArgType::kInt32 ||
+            !reader.ReadValue(&value)) {
+            return false;
+        }
+
+        precisionArg = value;
+    }
+
+    ArgType type;
+    if (!reader.ReadValue(&type)) {
+        return false;
+    }
+
+    // The argument is always passed as the type of its tag, and the spec is
+    // rebuilt to match it, so that malformed data can't make the formatting
+    // function read an argument of another type.
+    WCHAR specBuffer[kMaxSpecLength];
+    auto buildSpec = [&](PCWSTR sizeModifier, WCHAR conversion) {
+        return BuildSpec(specBuffer, spec, widthArg, precisionArg,
+                         sizeModifier, conversion);
+    };
+
+    WCHAR c = spec.conversion;
+
+    switch (type) {
+        case ArgType::kInt32: {
+            INT32 value;
+            PCWSTR sizeModifier = spec.size == SizeModifier::kChar    ? L"hh"
+                                  : spec.size == SizeModifier::kShort ? L"h"
+                                                                      : L"";
+            if (!IsIntegerConversion(c) || !reader.ReadValue(&value) ||
+                !buildSpec(sizeModifier, c)) {
+                return false;
+            }
+
+            writer.AppendFormatted(specBuffer, value);
+            return true;
+        }
+
+        case ArgType::kInt64: {
+            INT64 value;
+            if (!IsIntegerConversion(c) || !reader.ReadValue(&value) ||
+                !buildSpec(L"ll", c)) {
+                return false;
+            }
+
+            writer.AppendFormatted(specBuffer, value);
+            return true;
+        }
+
+        case ArgType::kDouble: {
+            double value;
+            if (!IsFloatingPointConversion(c) || !reader.ReadValue(&value) ||
+                !buildSpec(L"", c)) {
+                return false;
+            }
+
+            writer.AppendFormatted(specBuffer, value);
+            return true;
+        }
+
+        case ArgType::kChar:
+        case ArgType::kWideChar: {
+            INT32 value;
+            bool narrow = type == ArgType::kChar;
+            if (!IsCharConversion(c) || !reader.ReadValue(&value) ||
+                !buildSpec(narrow ? L"h" : L"l", L'c')) {
+                return false;
+            }
+
+            writer.AppendFormatted(specBuffer, value);
+            return true;
+        }
+
+        case ArgType::kString: {
+            char value[2049];
+            if (!IsStringConversion(c) ||
+                !reader.ReadString(std::span<char>(value)) ||
+                !buildSpec(L"h", L's')) {
+                return false;
+            }
+
+            writer.AppendFormatted(specBuffer, static_cast<const char*>(value));
+            return true;
+        }
+
+        case ArgType::kWideString: {
+            WCHAR value[1025];
+            if (!IsStringConversion(c) ||
+                !reader.ReadString(std::span<WCHAR>(value)) ||
+                !buildSpec(L"l", L's')) {
+                return false;
+            }
+
+            writer.AppendFormatted(specBuffer,
+                                   static_cast<const WCHAR*>(value));
+            return true;
+        }
+
+        case ArgType::kNullString:
+            if (!IsStringConversion(c) || !buildSpec(L"l", L's')) {
+                return false;
+            }
+
+            writer.AppendFormatted(specBuffer,
+                                   static_cast<const WCHAR*>(nullptr));
+            return true;
+
+        // Formatted like %p in the process which logged the line, which might
+        // differ from the current process in the pointer size.
+        case ArgType::kPointer32: {
+            UINT32 value;
+            if (c != L'p' || !reader.ReadValue(&value)) {
+                return false;
+            }
+
+            writer.AppendFormatted(L"%08X", value);
+            return true;
+        }
+
+        case ArgType::kPointer64: {
+            UINT64 value;
+            if (c != L'p' || !reader.ReadValue(&value)) {
+                return false;
+            }
+
+            writer.AppendFormatted(L"%016llX", value);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+}  // namespace
+
+namespace DeferredLogFormat {
+
+size_t Encode(std::span<BYTE> buffer,
+              std::initializer_list<std::wstring_view> prefix,
+              PCWSTR format,
+              va_list args) noexcept {
+    DataWriter writer(buffer);
+
+    for (auto part : prefix) {
+        if (!writer.Write(part.data(), part.size() * sizeof(WCHAR))) {
+            return 0;
+        }
+    }
+
+    constexpr WCHAR kNullChar = L'\0';
+    if (!writer.Write(&kNullChar, sizeof(kNullChar)) ||
+        !writer.Write(format, (wcslen(format) + 1) * sizeof(WCHAR))) {
+        return 0;
+    }
+
+    // A copy can be passed by pointer on all platforms, which isn't true for a
+    // va_list parameter.
+    va_list argsCopy;
+    va_copy(argsCopy, args);
+    auto argsCopyEnd = wil::scope_exit([&argsCopy]() { va_end(argsCopy); });
+
+    for (PCWSTR p = format; *p;) {
+        if (*p++ != L'%') {
+            continue;
+        }
+
+        if (*p == L'%') {
+            p++;
+            continue;
+        }
+
+        FormatSpec spec;
+        p = ParseSpec(p, &spec);
+        if (!p) {
+            return 0;
+        }
+
+        if (spec.width == L"*" &&
+            !writer.WriteValue(ArgType::kInt32, va_arg(argsCopy, INT32))) {
+            return 0;
+        }
+
+        int precision = -1;
+        if (spec.hasPrecision) {
+            if (spec.precision == L"*") {
+                precision = va_arg(argsCopy, INT32);
+                if (!writer.WriteValue(ArgType::kInt32, precision)) {
+                    return 0;
+                }
+            } else {
+                precision = ParseNumber(spec.precision);
+            }
+        }
+
+        if (!EncodeArg(writer, spec, precision, &argsCopy)) {
+            return 0;
+        }
+    }
+
+    return writer.GetSize();
+}
+
+void Decode(std::span<const BYTE> data, std::span<WCHAR> buffer) noexcept {
+    LineWriter writer(buffer);
+
+    auto* chars = reinterpret_cast<const WCHAR*>(data.data());
+    size_t charCount = data.size() / sizeof(WCHAR);
+
+    size_t prefixLength = wcsnlen(chars, charCount);
+    if (prefixLength == charCount) {
+        writer.FinishLine();
+        return;
+    }
+
+    writer.Append(std::wstring_view(chars, prefixLength));
+
+    PCWSTR format = chars + prefixLength + 1;
+    size_t formatMaxLength = charCount - prefixLength - 1;
+    size_t formatLength = wcsnlen(format, formatMaxLength);
+    if (formatLength == formatMaxLength) {
+        writer.FinishLine();
+        return;
+    }
+
+    DataReader reader(
+        data.subspan((prefixLength + 1 + formatLength + 1) * sizeof(WCHAR)));
+
+    for (PCWSTR p = format; *p;) {
+        if (*p != L'%') {
+            PCWSTR literalEnd = p;
+            while (*literalEnd && *literalEnd != L'%') {
+                literalEnd++;
+            }
+
+            writer.Append(std::wstring_view(p, literalEnd - p));
+            p = literalEnd;
+            continue;
+        }
+
+        p++;
+        if (*p == L'%') {
+            writer.Append(L"%");
+            p++;
+            continue;
+        }
+
+        FormatSpec spec;
+        p = ParseSpec(p, &spec);
+        if (!p || !DecodeArg(writer, reader, spec)) {
+            break;
+        }
+    }
+
+    writer.FinishLine();
+}
+
+}  // namespace DeferredLogFormat
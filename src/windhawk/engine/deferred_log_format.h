@@ -0,0 +1,26 @@
+#pragma once
+
+// Encodes a log line as its printf-style format string and raw arguments, so
+// that the formatting can be done later by the consumer of the line, possibly
+// in another process. Only the conversions which are used for logging are
+// supported: integers, floating point values, characters, strings and
+// pointers. Strings are copied, and the arguments of the other conversions
+// are stored by value with a type tag, so that the data is the same for 32-bit
+// and 64-bit processes.
+namespace DeferredLogFormat {
+
+// Returns the encoded size, or zero if the format string or its arguments
+// can't be encoded or don't fit, in which case the line should be formatted
+// right away. The prefix parts are copied as is, they aren't used as a format
+// string.
+size_t Encode(std::span<BYTE> buffer,
+              std::initializer_list<std::wstring_view> prefix,
+              PCWSTR format,
+              va_list args) noexcept;
+
+// Formats the encoded data into buffer, truncating the line if it doesn't
+// fit. The line always ends with a single newline. The data might come from
+// another process, so it's validated and decoding stops on malformed data.
+void Decode(std::span<const BYTE> data, std::span<WCHAR> buffer) noexcept;
+
+}  // namespace DeferredLogFormat
@@ -0,0 +1,108 @@
+#include "stdafx.h"
+
+#include "disassembler.h"
+
+#include "logger.h"
+#include "no_destructor.h"
+#include "storage_manager.h"
+#include "var_init_once.h"
+
+// Loaded once per process and kept loaded as long as the engine is loaded.
+class Disassembler::Library {
+   public:
+    using DISASM_GET_CONTEXT_SIZE = SIZE_T (*)();
+    using DISASM_INIT_CONTEXT = BOOL (*)(void* context);
+    using DISASM_INSTRUCTION = UINT32 (*)(void* context,
+                                          const void* address,
+                                          SIZE_T maxLength,
+                                          SIZE_T* length,
+                                          PSTR text,
+                                          SIZE_T textSize);
+
+    Library() {
+        auto libraryPath = StorageManager::GetInstance().GetEnginePath() /
+                           L"windhawk-disasm.dll";
+
+        m_module.reset(LoadLibraryEx(libraryPath.c_str(), nullptr,
+                                     LOAD_WITH_ALTERED_SEARCH_PATH));
+        THROW_LAST_ERROR_IF_NULL(m_module);
+
+        pDisasmGetContextSize = reinterpret_cast<DISASM_GET_CONTEXT_SIZE>(
+            GetProcAddress(m_module.get(), "DisasmGetContextSize"));
+        THROW_LAST_ERROR_IF_NULL(pDisasmGetContextSize);
+
+        pDisasmInitContext = reinterpret_cast<DISASM_INIT_CONTEXT>(
+            GetProcAddress(m_module.get(), "DisasmInitContext"));
+        THROW_LAST_ERROR_IF_NULL(pDisasmInitContext);
+
+        pDisasmInstruction = reinterpret_cast<DISASM_INSTRUCTION>(
+            GetProcAddress(m_module.get(), "DisasmInstruction"));
+        THROW_LAST_ERROR_IF_NULL(pDisasmInstruction);
+
+        VERBOSE(L"Loaded %s", libraryPath.c_str());
+    }
+
+    Library(const Library&) = delete;
+    Library& operator=(const Library&) = delete;
+
+    // Throws if the library can't be loaded. A failure isn't remembered, the
+    // next call tries again.
+    static Library& Get() {
+        struct Holder {
+            std::mutex mutex;
+            std::optional<Library> library;
+        };
+
+        STATIC_INIT_ONCE(NoDestructorIfTerminating<Holder>, holder);
+
+        std::lock_guard guard((**holder).mutex);
+        if (!(**holder).library) {
+            (**holder).library.emplace();
+        }
+
+        return *(**holder).library;
+    }
+
+    DISASM_GET_CONTEXT_SIZE pDisasmGetContextSize;
+    DISASM_INIT_CONTEXT pDisasmInitContext;
+    DISASM_INSTRUCTION pDisasmInstruction;
+
+   private:
+    wil::unique_hmodule m_module;
+};
+
+Disassembler::Disassembler() : m_library(&Library::Get()) {
+    SIZE_T contextSize = m_library->pDisasmGetContextSize();
+    m_context = std::make_unique<ULONGLONG[]>(
+        (contextSize + sizeof(ULONGLONG) - 1) / sizeof(ULONGLONG));
+
+    if (!m_library->pDisasmInitContext(m_context.get())) {
+        throw std::runtime_error("Failed to initialize the disassembler");
+    }
+}
+
+// static
+Disassembler& Disassembler::GetForCurrentThread() {
+    STATIC_INIT_ONCE(ThreadLocal<Disassembler>, s);
+    return *s;
+}
+
+UINT32 Disassembler::Disassemble(const void* address,
+                                 size_t maxLength,
+                                 WH_DISASM_RESULT* result,
+                                 bool formatText) {
+    SIZE_T length = 0;
+    UINT32 error = m_library->pDisasmInstruction(
+        m_context.get(), address, maxLength, &length,
+        formatText ? result->text : nullptr, sizeof(result->text));
+    if (error) {
+        return error;
+    }
+
+    result->length = length;
+    if (!formatText) {
+        result->text[0] = '\0';
+    }
+
+    return 0;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "mods_api.h"
+
+// Disassembles instructions of the current architecture. The disassemblers
+// live in windhawk-disasm.dll, which is only loaded on first use, since most
+// processes never disassemble anything. The decoder and formatter are
+// initialized once per thread instead of on every call, which matters for
+// mods that disassemble whole functions instruction by instruction.
+class Disassembler {
+   public:
+#if defined(_M_ARM64)
+    static constexpr size_t kMaxInstructionLength = sizeof(DWORD);
+#elif defined(_M_IX86) || defined(_M_X64)
+    static constexpr size_t kMaxInstructionLength = 15;
+#else
+#error "Unsupported architecture"
+#endif
+
+    Disassembler();
+
+    Disassembler(const Disassembler&) = delete;
+    Disassembler& operator=(const Disassembler&) = delete;
+
+    static Disassembler& GetForCurrentThread();
+
+    // Decodes a single instruction which is at most maxLength bytes long.
+    // Returns zero on success, or an error code of the underlying
+    // disassembler. If formatText is false, result->text is left empty.
+    UINT32 Disassemble(const void* address,
+                       size_t maxLength,
+                       WH_DISASM_RESULT* result,
+                       bool formatText);
+
+   private:
+    class Library;
+
+    Library* m_library;
+    // Allocated as ULONGLONG values for the alignment of the context.
+    std::unique_ptr<ULONGLONG[]> m_context;
+};
@@ -3,6 +3,7 @@
 #include "dll_inject.h"
 #include "functions.h"
 #include "logger.h"
+#include "no_destructor.h"
 #include "storage_manager.h"
 #include "var_init_once.h"
 
@@ -631,6 +632,140 @@ void MyQueueUserAPC(PPS_APC_ROUTINE pfnAPC,
         pNtQueueApcThread(hThread, pfnAPC, data, nullptr, nullptr));
 }
 
+// The shellcode followed by a LOAD_LIBRARY_REMOTE_DATA template with the DLL
+// path already laid out. Built once per target architecture, so that only the
+// per-process fields have to be filled in for each injection.
+class InjectionImage {
+   public:
+    explicit InjectionImage(USHORT targetProcessArch) {
+        const BYTE* shellcode;
+
+        switch (targetProcessArch) {
+            case IMAGE_FILE_MACHINE_I386:
+                shellcode = x32Shellcode;
+                m_shellcodeSize = x32ShellcodeSize;
+                m_shellcodeAPCOffset = sizeof(PRE_X32SHELLCODE_ARGS_1_TO_3) - 1;
+                break;
+
+            case IMAGE_FILE_MACHINE_AMD64:
+                shellcode = x64Shellcode;
+                m_shellcodeSize = x64ShellcodeSize;
+                break;
+
+            case IMAGE_FILE_MACHINE_ARM64:
+                shellcode = arm64Shellcode;
+                m_shellcodeSize = arm64ShellcodeSize;
+                break;
+
+            default:
+                throw std::logic_error("Invalid architecture value");
+        }
+
+        std::wstring dllPath =
+            StorageManager::GetInstance().GetEnginePath(targetProcessArch) /
+            L"windhawk.dll";
+        size_t dllPathBytes = (dllPath.length() + 1) * sizeof(WCHAR);
+
+        m_dataOffset = (m_shellcodeSize + (sizeof(LONG_PTR) - 1)) &
+                       ~(sizeof(LONG_PTR) - 1);
+
+        std::vector<BYTE> startupData = BuildStartupData();
+        size_t startupDataOffset =
+            DllInject::GetStartupDataOffset(dllPath.length());
+
+        m_bytes.resize(m_dataOffset + startupDataOffset + startupData.size());
+        memcpy(m_bytes.data(), shellcode, m_shellcodeSize);
+        memcpy(GetData(m_bytes.data())->szDllName, dllPath.c_str(),
+               dllPathBytes);
+        memcpy(m_bytes.data() + m_dataOffset + startupDataOffset,
+               startupData.data(), startupData.size());
+    }
+
+    static const InjectionImage& Get(USHORT targetProcessArch) {
+        switch (targetProcessArch) {
+            case IMAGE_FILE_MACHINE_I386: {
+                STATIC_INIT_ONCE(NoDestructorIfTerminating<InjectionImage>, s,
+                                 IMAGE_FILE_MACHINE_I386);
+                return **s;
+            }
+
+            case IMAGE_FILE_MACHINE_AMD64: {
+                STATIC_INIT_ONCE(NoDestructorIfTerminating<InjectionImage>, s,
+                                 IMAGE_FILE_MACHINE_AMD64);
+                return **s;
+            }
+
+            case IMAGE_FILE_MACHINE_ARM64: {
+                STATIC_INIT_ONCE(NoDestructorIfTerminating<InjectionImage>, s,
+                                 IMAGE_FILE_MACHINE_ARM64);
+                return **s;
+            }
+        }
+
+        throw std::logic_error("Invalid architecture value");
+    }
+
+    const std::vector<BYTE>& GetBytes() const { return m_bytes; }
+    size_t GetShellcodeSize() const { return m_shellcodeSize; }
+    size_t GetShellcodeThreadOffset() const { return m_shellcodeThreadOffset; }
+    size_t GetShellcodeAPCOffset() const { return m_shellcodeAPCOffset; }
+    size_t GetDataOffset() const { return m_dataOffset; }
+
+    DllInject::LOAD_LIBRARY_REMOTE_DATA* GetData(BYTE* bytes) const {
+        return reinterpret_cast<DllInject::LOAD_LIBRARY_REMOTE_DATA*>(
+            bytes + m_dataOffset);
+    }
+
+   private:
+    static std::vector<BYTE> BuildStartupData() {
+        DllInject::LOAD_LIBRARY_REMOTE_STARTUP_DATA header{
+            .bDirectDebugOutput = Logger::GetInstance().IsDirectDebugOutput(),
+        };
+
+        std::wstring_view appDataPath;
+        std::wstring_view registryKey;
+        if (auto* values =
+                StorageManager::GetInstance().GetShareableStartupValues()) {
+            header.bStorageValid = TRUE;
+            header.bPortableStorage = values->portable;
+            appDataPath = values->appDataPath;
+            registryKey = values->registryKey;
+        }
+
+        header.dwAppDataPathOffset = sizeof(header);
+        header.dwRegistryKeyOffset = wil::safe_cast<DWORD>(
+            header.dwAppDataPathOffset +
+            (appDataPath.length() + 1) * sizeof(WCHAR));
+
+        // Zero-initialized, which terminates the strings.
+        std::vector<BYTE> bytes(header.dwRegistryKeyOffset +
+                                (registryKey.length() + 1) * sizeof(WCHAR));
+        memcpy(bytes.data(), &header, sizeof(header));
+        memcpy(bytes.data() + header.dwAppDataPathOffset, appDataPath.data(),
+               appDataPath.length() * sizeof(WCHAR));
+        memcpy(bytes.data() + header.dwRegistryKeyOffset, registryKey.data(),
+               registryKey.length() * sizeof(WCHAR));
+        return bytes;
+    }
+
+    std::vector<BYTE> m_bytes;
+    size_t m_shellcodeSize;
+    size_t m_shellcodeThreadOffset = 0;
+    size_t m_shellcodeAPCOffset = 0;
+    size_t m_dataOffset;
+};
+
+// A per-thread buffer for the image of a single injection. Reused across
+// injections, so that its memory is only allocated once per thread.
+std::vector<BYTE>& GetInjectionImageBuffer() {
+    STATIC_INIT_ONCE(ThreadLocal<std::vector<BYTE>>, s);
+    return *s;
+}
+
+}  // namespace
+
+namespace DllInject {
+
 USHORT GetProcessArch(HANDLE hProcess) {
     using GetProcessInformation_t = BOOL(WINAPI*)(
         HANDLE hProcess, PROCESS_INFORMATION_CLASS ProcessInformationClass,
@@ -669,46 +804,29 @@ USHORT GetProcessArch(HANDLE hProcess) {
     return IMAGE_FILE_MACHINE_AMD64;
 }
 
-}  // namespace
-
-namespace DllInject {
-
 void DllInject(HANDLE hProcess,
                HANDLE hThreadForAPC,
                HANDLE hSessionManagerProcess,
                HANDLE hSessionMutex,
-               bool threadAttachExempt) {
-    const BYTE* shellcode;
-    size_t shellcodeSize;
-    size_t shellcodeThreadOffset = 0;
-    size_t shellcodeAPCOffset = 0;
+               bool threadAttachExempt,
+               StepTimes* stepTimes) {
+    LARGE_INTEGER stepStart;
+    QueryPerformanceCounter(&stepStart);
+
+    // Adds the time since the previous step to the given step.
+    auto endStep = [stepTimes, &stepStart](LONGLONG StepTimes::*step) {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        if (stepTimes) {
+            stepTimes->*step += now.QuadPart - stepStart.QuadPart;
+        }
+        stepStart = now;
+    };
 
     USHORT targetProcessArch = GetProcessArch(hProcess);
-    switch (targetProcessArch) {
-        case IMAGE_FILE_MACHINE_I386:
-            shellcode = x32Shellcode;
-            shellcodeSize = x32ShellcodeSize;
-            shellcodeAPCOffset = sizeof(PRE_X32SHELLCODE_ARGS_1_TO_3) - 1;
-            break;
-
-        case IMAGE_FILE_MACHINE_AMD64:
-            shellcode = x64Shellcode;
-            shellcodeSize = x64ShellcodeSize;
-            break;
-
-        case IMAGE_FILE_MACHINE_ARM64:
-            shellcode = arm64Shellcode;
-            shellcodeSize = arm64ShellcodeSize;
-            break;
-
-        default:
-            throw std::logic_error("Invalid architecture value");
-    }
+    const auto& image = InjectionImage::Get(targetProcessArch);
 
-    std::wstring dllPath =
-        StorageManager::GetInstance().GetEnginePath(targetProcessArch) /
-        L"windhawk.dll";
-    size_t dllPathBytes = (dllPath.length() + 1) * sizeof(WCHAR);
+    endStep(&StepTimes::prepare);
 
     HANDLE hRemoteSessionManagerProcess;
     THROW_IF_WIN32_BOOL_FALSE(DuplicateHandle(
@@ -737,58 +855,64 @@ void DllInject(HANDLE hProcess,
             }
         });
 
-    size_t shellcodeDataSize =
-        offsetof(LOAD_LIBRARY_REMOTE_DATA, szDllName) + dllPathBytes;
-    auto shellcodeDataVector = std::vector<BYTE>(shellcodeDataSize);
-    auto shellcodeData =
-        reinterpret_cast<LOAD_LIBRARY_REMOTE_DATA*>(shellcodeDataVector.data());
-
-    shellcodeData->nLogVerbosity =
-        static_cast<INT32>(Logger::GetInstance().GetVerbosity());
-    shellcodeData->bRunningFromAPC = !!hThreadForAPC;
-    shellcodeData->bThreadAttachExempt = threadAttachExempt;
-    shellcodeData->hSessionManagerProcess = hRemoteSessionManagerProcess;
-    shellcodeData->hSessionMutex = hRemoteSessionMutex;
-    memcpy(shellcodeData->szDllName, dllPath.c_str(), dllPathBytes);
+    endStep(&StepTimes::duplicateHandles);
 
-    size_t shellcodeSizeAligned =
-        (shellcodeSize + (sizeof(LONG_PTR) - 1)) & ~(sizeof(LONG_PTR) - 1);
+    const auto& imageBytes = image.GetBytes();
 
     // Allocate enough memory in the remote process's address space
     // to hold the shellcode and the data struct.
-    void* pRemoteCode = VirtualAllocEx(
-        hProcess, nullptr, shellcodeSizeAligned + shellcodeDataSize,
-        MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    void* pRemoteCode =
+        VirtualAllocEx(hProcess, nullptr, imageBytes.size(),
+                       MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
     THROW_LAST_ERROR_IF_NULL(pRemoteCode);
 
     auto remoteCodeCleanup = wil::scope_exit([hProcess, pRemoteCode] {
         VirtualFreeEx(hProcess, pRemoteCode, 0, MEM_RELEASE);
     });
 
+    endStep(&StepTimes::allocate);
+
     LPTHREAD_START_ROUTINE pRemoteThreadAddress =
         reinterpret_cast<LPTHREAD_START_ROUTINE>(
-            reinterpret_cast<BYTE*>(pRemoteCode) + shellcodeThreadOffset);
+            reinterpret_cast<BYTE*>(pRemoteCode) +
+            image.GetShellcodeThreadOffset());
 
     PPS_APC_ROUTINE pRemoteAPCAddress = reinterpret_cast<PPS_APC_ROUTINE>(
-        reinterpret_cast<BYTE*>(pRemoteCode) + shellcodeAPCOffset);
+        reinterpret_cast<BYTE*>(pRemoteCode) + image.GetShellcodeAPCOffset());
 
+    void* pRemoteData =
+        reinterpret_cast<BYTE*>(pRemoteCode) + image.GetDataOffset();
+
+    // Fill in the per-process fields of a copy of the image.
+    auto& imageBuffer = GetInjectionImageBuffer();
+    imageBuffer.assign(imageBytes.begin(), imageBytes.end());
+
+    auto shellcodeData = image.GetData(imageBuffer.data());
+    shellcodeData->nLogVerbosity =
+        static_cast<INT32>(Logger::GetInstance().GetVerbosity());
+    shellcodeData->bRunningFromAPC = !!hThreadForAPC;
+    shellcodeData->bThreadAttachExempt = threadAttachExempt;
+    shellcodeData->hSessionManagerProcess = hRemoteSessionManagerProcess;
+    shellcodeData->hSessionMutex = hRemoteSessionMutex;
     shellcodeData->pThreadShellcodeAddress = pRemoteThreadAddress;
     shellcodeData->pAPCShellcodeAddress = pRemoteAPCAddress;
 
-    // Write our shellcode into the remote process.
-    THROW_IF_WIN32_BOOL_FALSE(WriteProcessMemory(
-        hProcess, pRemoteCode, shellcode, shellcodeSize, nullptr));
+    endStep(&StepTimes::prepare);
 
-    // Write a copy of our struct to the remote process.
-    void* pRemoteData =
-        reinterpret_cast<BYTE*>(pRemoteCode) + shellcodeSizeAligned;
+    // Write our shellcode and a copy of our struct to the remote process.
     THROW_IF_WIN32_BOOL_FALSE(WriteProcessMemory(
-        hProcess, pRemoteData, shellcodeData, shellcodeDataSize, nullptr));
+        hProcess, pRemoteCode, imageBuffer.data(), imageBuffer.size(),
+        nullptr));
+
+    endStep(&StepTimes::write);
 
     // Mark shellcode as executable.
     DWORD oldProtect;
-    THROW_IF_WIN32_BOOL_FALSE(VirtualProtectEx(
-        hProcess, pRemoteCode, shellcodeSize, PAGE_EXECUTE_READ, &oldProtect));
+    THROW_IF_WIN32_BOOL_FALSE(
+        VirtualProtectEx(hProcess, pRemoteCode, image.GetShellcodeSize(),
+                         PAGE_EXECUTE_READ, &oldProtect));
+
+    endStep(&StepTimes::protect);
 
     if (hThreadForAPC) {
         MyQueueUserAPC(pRemoteAPCAddress, hThreadForAPC, pRemoteData,
@@ -826,6 +950,8 @@ void DllInject(HANDLE hProcess,
         }
     }
 
+    endStep(&StepTimes::start);
+
     remoteSessionManagerProcessCleanup.release();
     remoteSessionMutexCleanup.release();
     remoteCodeCleanup.release();
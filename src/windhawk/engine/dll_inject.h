@@ -36,10 +36,72 @@ struct LOAD_LIBRARY_REMOTE_DATA {
     WCHAR szDllName[1];  // flexible array member
 };
 
+// Follows the DLL name of LOAD_LIBRARY_REMOTE_DATA, see GetStartupData. It's
+// kept out of LOAD_LIBRARY_REMOTE_DATA so that the layout which the shellcode
+// uses doesn't change. Holds what the engine otherwise reads from engine.ini
+// and the settings on startup, so that it does no file or registry I/O until
+// a mod has to be loaded. The strings follow the struct.
+struct LOAD_LIBRARY_REMOTE_STARTUP_DATA {
+    BOOL bDirectDebugOutput;
+    // If false, e.g. if the app data path depends on the user, the engine
+    // reads engine.ini instead, and the fields below aren't used.
+    BOOL bStorageValid;
+    BOOL bPortableStorage;
+    // Offsets of null-terminated strings from the start of the struct.
+    DWORD dwAppDataPathOffset;
+    DWORD dwRegistryKeyOffset;
+};
+
+// Returns the offset of the startup data from the start of
+// LOAD_LIBRARY_REMOTE_DATA, given the length of the DLL name in characters.
+constexpr size_t GetStartupDataOffset(size_t dllNameLength) {
+    constexpr size_t kAlignment = alignof(LOAD_LIBRARY_REMOTE_STARTUP_DATA);
+    size_t offset = FIELD_OFFSET(LOAD_LIBRARY_REMOTE_DATA, szDllName) +
+                    (dllNameLength + 1) * sizeof(WCHAR);
+    return (offset + (kAlignment - 1)) & ~(kAlignment - 1);
+}
+
+// Not using wcslen, since this header is also used by the shellcode, which
+// doesn't link with the CRT.
+inline const LOAD_LIBRARY_REMOTE_STARTUP_DATA* GetStartupData(
+    const LOAD_LIBRARY_REMOTE_DATA* data) {
+    size_t dllNameLength = 0;
+    while (data->szDllName[dllNameLength]) {
+        dllNameLength++;
+    }
+
+    return reinterpret_cast<const LOAD_LIBRARY_REMOTE_STARTUP_DATA*>(
+        reinterpret_cast<const BYTE*>(data) +
+        GetStartupDataOffset(dllNameLength));
+}
+
+inline PCWSTR GetStartupDataString(const LOAD_LIBRARY_REMOTE_STARTUP_DATA* data,
+                                   DWORD offset) {
+    return reinterpret_cast<PCWSTR>(reinterpret_cast<const BYTE*>(data) +
+                                    offset);
+}
+
+// The time spent in each step of DllInject, in QueryPerformanceCounter units.
+// A step which wasn't reached is zero.
+struct StepTimes {
+    // Getting the architecture and filling in the image.
+    LONGLONG prepare;
+    LONGLONG duplicateHandles;
+    LONGLONG allocate;
+    LONGLONG write;
+    LONGLONG protect;
+    // Creating the remote thread or queueing the APC.
+    LONGLONG start;
+};
+
+// Returns the machine type of the process, e.g. IMAGE_FILE_MACHINE_AMD64.
+USHORT GetProcessArch(HANDLE hProcess);
+
 void DllInject(HANDLE hProcess,
                HANDLE hThreadForAPC,
                HANDLE hSessionManagerProcess,
                HANDLE hSessionMutex,
-               bool threadAttachExempt);
+               bool threadAttachExempt,
+               StepTimes* stepTimes = nullptr);
 
 }  // namespace DllInject
@@ -0,0 +1,135 @@
+#include "stdafx.h"
+
+#include "engine_metrics.h"
+#include "functions.h"
+#include "logger.h"
+
+extern HINSTANCE g_hDllInst;
+
+namespace {
+
+std::atomic<LONG> g_loadedModCount;
+std::atomic<ULONGLONG> g_symbolResolutionUs;
+std::atomic<ULONGLONG> g_lastReloadUs;
+std::atomic<ULONGLONG> g_logLineCount;
+
+LONGLONG GetPerformanceCounter() {
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart;
+}
+
+ULONGLONG CounterToMicroseconds(LONGLONG counter) {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    return static_cast<ULONGLONG>(counter) * 1000000 / frequency.QuadPart;
+}
+
+}  // namespace
+
+namespace EngineMetrics {
+
+void ModLoaded() noexcept {
+    g_loadedModCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ModUnloaded() noexcept {
+    g_loadedModCount.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void LogLineEmitted() noexcept {
+    g_logLineCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+ScopedTimer::ScopedTimer(Timer timer) noexcept
+    : m_timer(timer), m_startCounter(GetPerformanceCounter()) {}
+
+ScopedTimer::~ScopedTimer() {
+    ULONGLONG durationUs =
+        CounterToMicroseconds(GetPerformanceCounter() - m_startCounter);
+
+    switch (m_timer) {
+        case Timer::kSymbolResolution:
+            g_symbolResolutionUs.fetch_add(durationUs,
+                                           std::memory_order_relaxed);
+            break;
+
+        case Timer::kReload:
+            g_lastReloadUs.store(durationUs, std::memory_order_relaxed);
+            break;
+    }
+}
+
+Publisher::Publisher() noexcept {
+    try {
+        // A single record per process, the mod name is left empty.
+        m_entry.emplace(ModStatusTable::Kind::kEngineMetrics, L"");
+
+        m_timer.reset(CreateThreadpoolTimer(TimerCallback, this, nullptr));
+        THROW_LAST_ERROR_IF_NULL(m_timer);
+
+        FILETIME dueTime = wil::filetime::from_int64(static_cast<UINT64>(
+            -static_cast<INT64>(kPublishIntervalMs) *
+            wil::filetime_duration::one_millisecond));
+        SetThreadpoolTimer(m_timer.get(), &dueTime, kPublishIntervalMs, 0);
+    } catch (const std::exception& e) {
+        LOG(L"Publishing engine metrics failed: %S", e.what());
+    }
+}
+
+// static
+void CALLBACK Publisher::TimerCallback(PTP_CALLBACK_INSTANCE instance,
+                                       PVOID context,
+                                       PTP_TIMER timer) {
+    static_cast<Publisher*>(context)->Publish();
+}
+
+void Publisher::Publish() noexcept {
+    UINT enabledHookCount = 0;
+    SIZE_T trampolineCommittedSize = 0;
+#ifdef WH_HOOKING_ENGINE_MINHOOK_DETOURS
+    MH_STATUS status =
+        MH_GetStatistics(&enabledHookCount, &trampolineCommittedSize);
+    if (status != MH_OK) {
+        VERBOSE(L"MH_GetStatistics returned %d", status);
+    }
+#endif  // WH_HOOKING_ENGINE_MINHOOK_DETOURS
+
+    // The private pages of the engine image, together with the trampolines,
+    // are the part of the private bytes of the process which can be
+    // attributed to the engine. Heap allocations are shared with the process
+    // and can't be told apart.
+    size_t imagePrivateSize = 0;
+    try {
+        size_t residentCount;
+        size_t sharedCount;
+        if (Functions::CountResidentImagePages(g_hDllInst, &residentCount,
+                                               &sharedCount)) {
+            SYSTEM_INFO systemInfo;
+            GetSystemInfo(&systemInfo);
+            imagePrivateSize =
+                (residentCount - sharedCount) * systemInfo.dwPageSize;
+        }
+    } catch (const std::exception& e) {
+        VERBOSE(L"Counting the engine image pages failed: %S", e.what());
+    }
+
+    WCHAR value[ModStatusTable::kValueMaxLength + 1];
+    _snwprintf_s(
+        value, _TRUNCATE,
+        L"%d mods, %u hooks, %zu KB trampolines, %zu KB image private, "
+        L"symbols %I64u ms, last reload %I64u ms, %I64u log lines",
+        g_loadedModCount.load(std::memory_order_relaxed), enabledHookCount,
+        trampolineCommittedSize / 1024, imagePrivateSize / 1024,
+        g_symbolResolutionUs.load(std::memory_order_relaxed) / 1000,
+        g_lastReloadUs.load(std::memory_order_relaxed) / 1000,
+        g_logLineCount.load(std::memory_order_relaxed));
+    if (wcscmp(value, m_publishedValue) == 0) {
+        return;
+    }
+
+    m_entry->Set(value);
+    wcscpy_s(m_publishedValue, value);
+}
+
+}  // namespace EngineMetrics
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "mod_status_table.h"
+
+// Counters which describe the overhead of the engine in the current process:
+// the amount of loaded mods, enabled hooks, committed trampoline memory and
+// private pages of the engine image, the time spent resolving symbols and
+// reloading mods, and the amount of log lines. The counters are published once
+// per second as a single record of the mod status table, so that the app can
+// show them for each process.
+namespace EngineMetrics {
+
+void ModLoaded() noexcept;
+void ModUnloaded() noexcept;
+void LogLineEmitted() noexcept;
+
+enum class Timer {
+    // Added to the total time spent resolving symbols.
+    kSymbolResolution,
+    // Replaces the duration of the last reload of mods and settings.
+    kReload,
+};
+
+class ScopedTimer {
+   public:
+    explicit ScopedTimer(Timer timer) noexcept;
+    ~ScopedTimer();
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+   private:
+    Timer m_timer;
+    LONGLONG m_startCounter;
+};
+
+// Publishes the counters while the object exists. Held by the customization
+// session of the process, must be destroyed before the hooking engine is
+// uninitialized. Failing to publish isn't fatal, it's only logged.
+class Publisher {
+   public:
+    Publisher() noexcept;
+
+    Publisher(const Publisher&) = delete;
+    Publisher& operator=(const Publisher&) = delete;
+
+   private:
+    static constexpr DWORD kPublishIntervalMs = 1000;
+
+    static void CALLBACK TimerCallback(PTP_CALLBACK_INSTANCE instance,
+                                       PVOID context,
+                                       PTP_TIMER timer);
+    void Publish() noexcept;
+
+    std::optional<ModStatusTable::Entry> m_entry;
+    // The record is only written if the value changed, so that readers aren't
+    // woken up needlessly.
+    WCHAR m_publishedValue[ModStatusTable::kValueMaxLength + 1] = L"";
+    // Declared last, so that the callbacks are done before the rest is
+    // destroyed.
+    wil::unique_threadpool_timer m_timer;
+};
+
+}  // namespace EngineMetrics
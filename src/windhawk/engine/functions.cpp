@@ -1,6 +1,7 @@
 #include "stdafx.h"
 
 #include "functions.h"
+#include "path_pattern.h"
 #include "var_init_once.h"
 
 namespace Functions {
@@ -34,7 +35,7 @@ void PalGetModuleBounds(HANDLE hOsHandle,
 
 }  // namespace
 
-// https://github.com/tidwall/match.c
+// Based on https://github.com/tidwall/match.c, but iterative.
 //
 // match returns true if str matches pattern. This is a very
 // simple wildcard match where '*' matches on any number characters
@@ -43,41 +44,65 @@ void PalGetModuleBounds(HANDLE hOsHandle,
 // pattern:
 //   { term }
 // term:
-// 	 '*'         matches any sequence of non-Separator characters
-// 	 '?'         matches any single non-Separator character
+// 	 '*'         matches any sequence of characters
+// 	 '?'         matches any single character
 // 	 c           matches character c (c != '*', '?')
+//
+// On a mismatch, only the last '*' is retried with one more character, which
+// is enough since an earlier '*' can't make a later match possible. Unlike the
+// recursive version, this makes the worst case quadratic instead of
+// exponential with multiple '*'s. If a literal character follows the '*', the
+// string is scanned for it with std::find, which is vectorized, instead of
+// retrying one character at a time.
 bool wcsmatch(PCWSTR pat, size_t plen, PCWSTR str, size_t slen) {
-    if (plen < 0)
-        plen = wcslen(pat);
-    if (slen < 0)
-        slen = wcslen(str);
-    while (plen > 0) {
-        if (pat[0] == L'*') {
-            if (plen == 1)
-                return true;
-            if (pat[1] == L'*') {
-                pat++;
-                plen--;
-                continue;
-            }
-            if (wcsmatch(pat + 1, plen - 1, str, slen))
-                return true;
-            if (slen == 0)
+    size_t p = 0;
+    size_t s = 0;
+    size_t starP = SIZE_MAX;
+    size_t starS = 0;
+
+    // Continues after the last '*', with the '*' matching the string up to
+    // the given position, or further up to the next literal character.
+    // Returns false if that character doesn't appear in the rest of the
+    // string, in which case nothing can match.
+    auto resumeAfterStar = [&](size_t from) {
+        p = starP + 1;
+        s = from;
+        if (p < plen && pat[p] != L'*' && pat[p] != L'?') {
+            PCWSTR found = std::find(str + s, str + slen, pat[p]);
+            if (found == str + slen) {
                 return false;
-            str++;
-            slen--;
-            continue;
+            }
+
+            s = found - str;
         }
-        if (slen == 0)
-            return false;
-        if (pat[0] != L'?' && str[0] != pat[0])
+
+        starS = s;
+        return true;
+    };
+
+    while (s < slen) {
+        if (p < plen && pat[p] == L'*') {
+            starP = p;
+            if (!resumeAfterStar(s)) {
+                return false;
+            }
+        } else if (p < plen && (pat[p] == L'?' || pat[p] == str[s])) {
+            p++;
+            s++;
+        } else if (starP != SIZE_MAX) {
+            if (!resumeAfterStar(starS + 1)) {
+                return false;
+            }
+        } else {
             return false;
-        pat++;
-        plen--;
-        str++;
-        slen--;
+        }
     }
-    return slen == 0 && plen == 0;
+
+    while (p < plen && pat[p] == L'*') {
+        p++;
+    }
+
+    return p == plen;
 }
 
 std::vector<std::wstring> SplitString(std::wstring_view s, WCHAR delim) {
@@ -104,35 +129,35 @@ std::wstring ReplaceAll(std::wstring_view source,
                         std::wstring_view from,
                         std::wstring_view to,
                         bool ignoreCase) {
-    auto findString = [ignoreCase](std::wstring_view haystack,
-                                   std::wstring_view needle,
-                                   size_t pos) -> size_t {
-        if (!ignoreCase) {
-            return haystack.find(needle, pos);
-        }
-
-        auto it = std::search(
-            haystack.begin() + pos, haystack.end(), needle.begin(),
-            needle.end(), [](WCHAR ch1, WCHAR ch2) {
-                LCMapStringEx(LOCALE_NAME_USER_DEFAULT, LCMAP_UPPERCASE, &ch1,
-                              1, &ch1, 1, nullptr, nullptr, 0);
-                LCMapStringEx(LOCALE_NAME_USER_DEFAULT, LCMAP_UPPERCASE, &ch2,
-                              1, &ch2, 1, nullptr, nullptr, 0);
-                return ch1 == ch2;
-            });
-        if (it == haystack.end()) {
-            return haystack.npos;
-        }
-
-        return std::distance(haystack.begin(), it);
-    };
+    // For a case-insensitive search, the strings are uppercased once, and the
+    // positions found in the uppercased source are used for the original one,
+    // since LCMAP_UPPERCASE maps each character to a single character.
+    std::wstring sourceUpper;
+    std::wstring fromUpper;
+    std::wstring_view haystack = source;
+    std::wstring_view needle = from;
+    if (ignoreCase) {
+        auto toUpper = [](std::wstring_view str) {
+            std::wstring result(str);
+            LCMapStringEx(LOCALE_NAME_USER_DEFAULT, LCMAP_UPPERCASE, &result[0],
+                          wil::safe_cast<int>(result.length()), &result[0],
+                          wil::safe_cast<int>(result.length()), nullptr,
+                          nullptr, 0);
+            return result;
+        };
+
+        sourceUpper = toUpper(source);
+        fromUpper = toUpper(from);
+        haystack = sourceUpper;
+        needle = fromUpper;
+    }
 
     std::wstring newString;
 
     size_t lastPos = 0;
     size_t findPos;
 
-    while ((findPos = findString(source, from, lastPos)) != source.npos) {
+    while ((findPos = haystack.find(needle, lastPos)) != haystack.npos) {
         newString.append(source, lastPos, findPos - lastPos);
         newString += to;
         lastPos = findPos + from.length();
@@ -144,84 +169,50 @@ std::wstring ReplaceAll(std::wstring_view source,
     return newString;
 }
 
-bool DoesPathMatchPattern(std::wstring_view path,
-                          std::wstring_view pattern,
-                          bool explicitOnly) {
-    if (pattern.empty()) {
-        return false;
-    }
-
-    // A case-insensitive comparison as recommended here:
-    // https://stackoverflow.com/q/410502
-
-    std::wstring pathUpper{path};
-
-    // Don't use CharUpperBuff to avoid depending on user32.dll. Use
-    // LCMapStringEx just like it's called internally by CharUpperBuff.
-    // CharUpperBuff(&pathUpper[0], wil::safe_cast<DWORD>(pathUpper.length()));
-    LCMapStringEx(LOCALE_NAME_USER_DEFAULT, LCMAP_UPPERCASE, &pathUpper[0],
-                  wil::safe_cast<int>(pathUpper.length()), &pathUpper[0],
-                  wil::safe_cast<int>(pathUpper.length()), nullptr, nullptr, 0);
-
-    std::wstring_view pathFileNameUpper = pathUpper;
-    if (size_t i = pathFileNameUpper.rfind(L'\\');
-        i != pathFileNameUpper.npos) {
-        pathFileNameUpper.remove_prefix(i + 1);
-    }
-
-    for (const auto& patternPartView : SplitStringToViews(pattern, L'|')) {
-        if (explicitOnly) {
-            bool patternIsWildcard =
-                patternPartView.find_first_of(L"*?") != patternPartView.npos;
-            if (patternIsWildcard) {
-                // If the pattern contains wildcards, it's not an explicit
-                // match.
-                continue;
-            }
-        }
-
-        auto patternPart = std::wstring{patternPartView};
+bool HasUserSpecificEnvironmentVariables(std::wstring_view pattern) {
+    constexpr std::wstring_view kSameForAllUsers[] = {
+        L"SYSTEMROOT",
+        L"WINDIR",
+        L"SYSTEMDRIVE",
+        L"PROGRAMFILES",
+        L"PROGRAMFILES(X86)",
+        L"PROGRAMW6432",
+        L"PROGRAMDATA",
+        L"COMMONPROGRAMFILES",
+        L"COMMONPROGRAMFILES(X86)",
+        L"COMMONPROGRAMW6432",
+    };
 
-#ifndef _WIN64
-        BOOL isWow64;
-        if (IsWow64Process(GetCurrentProcess(), &isWow64) && isWow64) {
-            // Get the native Program Files path regardless of the current
-            // process architecture.
-            patternPart = ReplaceAll(patternPart, L"%ProgramFiles%",
-                                     L"%ProgramW6432%", /*ignoreCase=*/true);
-        }
-#endif  // _WIN64
-
-        auto patternPartNormalized =
-            wil::ExpandEnvironmentStrings<std::wstring>(patternPart.c_str());
-
-        // CharUpperBuff(&patternPartNormalized[0],
-        //               wil::safe_cast<DWORD>(patternPartNormalized.length()));
-        LCMapStringEx(LOCALE_NAME_USER_DEFAULT, LCMAP_UPPERCASE,
-                      &patternPartNormalized[0],
-                      wil::safe_cast<int>(patternPartNormalized.length()),
-                      &patternPartNormalized[0],
-                      wil::safe_cast<int>(patternPartNormalized.length()),
-                      nullptr, nullptr, 0);
-
-        std::wstring_view match = pathUpper;
-
-        // If there's no backslash in the pattern part, match only against the
-        // file name, not the full path.
-        if (patternPartNormalized.find(L'\\') == patternPartNormalized.npos) {
-            match = pathFileNameUpper;
+    size_t start = pattern.find(L'%');
+    while (start != pattern.npos) {
+        size_t end = pattern.find(L'%', start + 1);
+        if (end == pattern.npos) {
+            break;
         }
 
-        if (wcsmatch(patternPartNormalized.data(),
-                     patternPartNormalized.length(), match.data(),
-                     match.length())) {
+        std::wstring name(pattern.substr(start + 1, end - start - 1));
+        std::transform(name.begin(), name.end(), name.begin(), towupper);
+        if (std::find(std::begin(kSameForAllUsers), std::end(kSameForAllUsers),
+                      name) == std::end(kSameForAllUsers)) {
             return true;
         }
+
+        start = pattern.find(L'%', end + 1);
     }
 
     return false;
 }
 
+bool DoesPathMatchPattern(std::wstring_view path,
+                          std::wstring_view pattern,
+                          bool explicitOnly) {
+    if (pattern.empty()) {
+        return false;
+    }
+
+    return PathPattern(pattern).Matches(path, explicitOnly);
+}
+
 void** FindImportPtr(HMODULE hFindInModule,
                      PCSTR pModuleName,
                      PCSTR pImportName) {
@@ -428,10 +419,14 @@ bool IsWindowsVersionOrGreaterWithBuildNumber(WORD wMajorVersion,
 // in eventtrace.cpp.
 bool ModuleGetPDBInfo(HANDLE hOsHandle,
                       _Out_ GUID* pGuidSignature,
-                      _Out_ DWORD* pdwAge) {
+                      _Out_ DWORD* pdwAge,
+                      _Out_opt_ std::string* pPdbPath) {
     // Zero-init [out]-params
     ZeroMemory(pGuidSignature, sizeof(*pGuidSignature));
     *pdwAge = 0;
+    if (pPdbPath) {
+        pPdbPath->clear();
+    }
 
     BYTE* pbModule = (BYTE*)hOsHandle;
 
@@ -576,6 +571,10 @@ bool ModuleGetPDBInfo(HANDLE hOsHandle,
     if (pdbInfoLast.m_pPdb70 != NULL) {
         memcpy(pGuidSignature, &pdbInfoLast.m_pPdb70->signature, sizeof(GUID));
         *pdwAge = pdbInfoLast.m_pPdb70->age;
+        if (pPdbPath) {
+            // Null-termination was verified above.
+            *pPdbPath = pdbInfoLast.m_pPdb70->path;
+        }
         return true;
     }
 
@@ -636,6 +635,99 @@ std::string GetModuleVersion(HMODULE hModule) {
     return result;
 }
 
+std::optional<ULONGLONG> GetImageFileFixedBase(PCWSTR imagePath) {
+    // The headers of a loaded image can't be used, since the loader updates
+    // the base address in them when the image is relocated.
+    wil::unique_hfile file(CreateFile(imagePath, GENERIC_READ,
+                                      FILE_SHARE_READ | FILE_SHARE_DELETE,
+                                      nullptr, OPEN_EXISTING, 0, nullptr));
+    if (!file) {
+        return std::nullopt;
+    }
+
+    BYTE buffer[0x1000];
+    DWORD bytesRead;
+    if (!ReadFile(file.get(), buffer, sizeof(buffer), &bytesRead, nullptr)) {
+        return std::nullopt;
+    }
+
+    auto* dosHeader = reinterpret_cast<const IMAGE_DOS_HEADER*>(buffer);
+    if (bytesRead < sizeof(IMAGE_DOS_HEADER) + sizeof(IMAGE_NT_HEADERS64) ||
+        dosHeader->e_magic != IMAGE_DOS_SIGNATURE || dosHeader->e_lfanew < 0 ||
+        static_cast<DWORD>(dosHeader->e_lfanew) >
+            bytesRead - sizeof(IMAGE_NT_HEADERS64)) {
+        return std::nullopt;
+    }
+
+    auto* ntHeaders = reinterpret_cast<const IMAGE_NT_HEADERS*>(
+        buffer + dosHeader->e_lfanew);
+    if (ntHeaders->Signature != IMAGE_NT_SIGNATURE) {
+        return std::nullopt;
+    }
+
+    ULONGLONG imageBase;
+    WORD dllCharacteristics;
+    if (ntHeaders->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC) {
+        auto* optionalHeader = reinterpret_cast<const IMAGE_OPTIONAL_HEADER32*>(
+            &ntHeaders->OptionalHeader);
+        imageBase = optionalHeader->ImageBase;
+        dllCharacteristics = optionalHeader->DllCharacteristics;
+    } else if (ntHeaders->OptionalHeader.Magic ==
+               IMAGE_NT_OPTIONAL_HDR64_MAGIC) {
+        auto* optionalHeader = reinterpret_cast<const IMAGE_OPTIONAL_HEADER64*>(
+            &ntHeaders->OptionalHeader);
+        imageBase = optionalHeader->ImageBase;
+        dllCharacteristics = optionalHeader->DllCharacteristics;
+    } else {
+        return std::nullopt;
+    }
+
+    if (dllCharacteristics & IMAGE_DLLCHARACTERISTICS_DYNAMIC_BASE) {
+        return std::nullopt;
+    }
+
+    return imageBase;
+}
+
+bool CountResidentImagePages(HMODULE module,
+                             size_t* residentCount,
+                             size_t* sharedCount) {
+    auto* imageBase = reinterpret_cast<BYTE*>(module);
+    auto* dosHeader = reinterpret_cast<const IMAGE_DOS_HEADER*>(imageBase);
+    auto* ntHeaders = reinterpret_cast<const IMAGE_NT_HEADERS*>(
+        imageBase + dosHeader->e_lfanew);
+
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    size_t pageSize = systemInfo.dwPageSize;
+    size_t pageCount =
+        (ntHeaders->OptionalHeader.SizeOfImage + pageSize - 1) / pageSize;
+
+    std::vector<PSAPI_WORKING_SET_EX_INFORMATION> pages(pageCount);
+    for (size_t i = 0; i < pageCount; i++) {
+        pages[i].VirtualAddress = imageBase + i * pageSize;
+    }
+
+    if (!K32QueryWorkingSetEx(
+            GetCurrentProcess(), pages.data(),
+            wil::safe_cast<DWORD>(pages.size() * sizeof(pages[0])))) {
+        return false;
+    }
+
+    *residentCount = 0;
+    *sharedCount = 0;
+    for (const auto& page : pages) {
+        if (page.VirtualAttributes.Valid) {
+            (*residentCount)++;
+            if (page.VirtualAttributes.Shared) {
+                (*sharedCount)++;
+            }
+        }
+    }
+
+    return true;
+}
+
 HRESULT SetThreadDescriptionIfAvailable(HANDLE hThread,
                                         PCWSTR lpThreadDescription) {
     using SetThreadDescription_t = decltype(&SetThreadDescription);
@@ -10,9 +10,15 @@ std::wstring ReplaceAll(std::wstring_view source,
                         std::wstring_view from,
                         std::wstring_view to,
                         bool ignoreCase = false);
+// For patterns which are matched repeatedly, prefer a PathPattern, which is
+// compiled only once.
 bool DoesPathMatchPattern(std::wstring_view path,
                           std::wstring_view pattern,
                           bool explicitOnly = false);
+// The session manager might run as a different user than the target process,
+// e.g. as a service, so variables such as %LocalAppData% might expand to a
+// different value. Variables which are the same for all users are fine.
+bool HasUserSpecificEnvironmentVariables(std::wstring_view pattern);
 void** FindImportPtr(HMODULE hFindInModule,
                      PCSTR pModuleName,
                      PCSTR pImportName);
@@ -50,8 +56,18 @@ bool IsWindowsVersionOrGreaterWithBuildNumber(WORD wMajorVersion,
                                               WORD wBuildNumber);
 bool ModuleGetPDBInfo(HANDLE hOsHandle,
                       _Out_ GUID* pGuidSignature,
-                      _Out_ DWORD* pdwAge);
+                      _Out_ DWORD* pdwAge,
+                      _Out_opt_ std::string* pPdbPath = nullptr);
 std::string GetModuleVersion(HMODULE hModule);
+// Returns the preferred base address of the image file, unless the image
+// opted into ASLR, in which case it's expected to be loaded elsewhere.
+std::optional<ULONGLONG> GetImageFileFixedBase(PCWSTR imagePath);
+// Counts the pages of the loaded image which are in the working set of the
+// current process, and how many of them are shared with other processes. The
+// rest are private, e.g. written data or pages relocated for this process.
+bool CountResidentImagePages(HMODULE module,
+                             size_t* residentCount,
+                             size_t* sharedCount);
 HRESULT SetThreadDescriptionIfAvailable(HANDLE hThread,
                                         PCWSTR lpThreadDescription);
 
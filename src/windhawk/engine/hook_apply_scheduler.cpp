@@ -0,0 +1,84 @@
+#include "stdafx.h"
+
+#include "hook_apply_scheduler.h"
+#include "logger.h"
+#include "no_destructor.h"
+#include "trace_events.h"
+#include "var_init_once.h"
+
+#ifdef WH_HOOKING_ENGINE_MINHOOK
+
+// static
+HookApplyScheduler& HookApplyScheduler::GetInstance() {
+    STATIC_INIT_ONCE(NoDestructorIfTerminating<HookApplyScheduler>, s);
+    return **s;
+}
+
+MH_STATUS HookApplyScheduler::Apply(ULONG_PTR hookIdent) {
+    Request request{.hookIdent = hookIdent};
+
+    std::unique_lock lock(m_mutex);
+
+    m_pendingRequests.push_back(&request);
+
+    m_applyDone.wait(lock,
+                     [this, &request] { return request.done || !m_applying; });
+
+    if (request.done) {
+        // Applied as part of a batch of another thread.
+        return request.status;
+    }
+
+    // Nothing is being applied, apply all pending requests, including this
+    // one.
+    m_applying = true;
+    std::vector<Request*> batch = std::move(m_pendingRequests);
+    m_pendingRequests.clear();
+
+    lock.unlock();
+
+    ApplyBatch(batch);
+
+    lock.lock();
+    m_applying = false;
+    lock.unlock();
+
+    m_applyDone.notify_all();
+
+    return request.status;
+}
+
+// static
+void HookApplyScheduler::ApplyBatch(const std::vector<Request*>& batch) {
+    std::vector<ULONG_PTR> hookIdents;
+    hookIdents.reserve(batch.size());
+    for (const auto* request : batch) {
+        if (std::find(hookIdents.begin(), hookIdents.end(),
+                      request->hookIdent) == hookIdents.end()) {
+            hookIdents.push_back(request->hookIdent);
+        }
+    }
+
+    std::vector<MH_STATUS> statuses(hookIdents.size(), MH_OK);
+
+    TraceEvents::ScopedPhase phase("ApplyHooks");
+    TraceEvents::ScopedHookApply hookApply(
+        static_cast<UINT>(hookIdents.size()));
+    MH_ApplyQueuedMultiEx(hookIdents.data(),
+                          static_cast<UINT>(hookIdents.size()),
+                          statuses.data());
+
+    if (hookIdents.size() > 1) {
+        VERBOSE(L"Applied hooks of %zu mods together", hookIdents.size());
+    }
+
+    for (auto* request : batch) {
+        size_t index = std::find(hookIdents.begin(), hookIdents.end(),
+                                 request->hookIdent) -
+                       hookIdents.begin();
+        request->status = statuses[index];
+        request->done = true;
+    }
+}
+
+#endif  // WH_HOOKING_ENGINE_MINHOOK
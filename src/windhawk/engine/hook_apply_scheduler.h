@@ -0,0 +1,38 @@
+#pragma once
+
+#ifdef WH_HOOKING_ENGINE_MINHOOK
+
+// Applies the queued hook operations of mods, which freezes all threads of the
+// process. In processes with many threads, each freeze is a visible hitch, so
+// requests of mods which arrive while hooks are being applied for another mod
+// are coalesced, and applied together with a single freeze once the current
+// one is done. A request which arrives when nothing is being applied is
+// applied right away, so a single request isn't delayed.
+class HookApplyScheduler {
+   public:
+    HookApplyScheduler() = default;
+
+    HookApplyScheduler(const HookApplyScheduler&) = delete;
+    HookApplyScheduler& operator=(const HookApplyScheduler&) = delete;
+
+    static HookApplyScheduler& GetInstance();
+
+    // Returns once the queued operations of hookIdent are applied.
+    MH_STATUS Apply(ULONG_PTR hookIdent);
+
+   private:
+    struct Request {
+        ULONG_PTR hookIdent;
+        MH_STATUS status = MH_OK;
+        bool done = false;
+    };
+
+    static void ApplyBatch(const std::vector<Request*>& batch);
+
+    std::mutex m_mutex;
+    std::condition_variable m_applyDone;
+    bool m_applying = false;
+    std::vector<Request*> m_pendingRequests;
+};
+
+#endif  // WH_HOOKING_ENGINE_MINHOOK
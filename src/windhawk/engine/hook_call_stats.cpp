@@ -0,0 +1,253 @@
+#include "stdafx.h"
+
+#include "hook_call_stats.h"
+#include "logger.h"
+#include "no_destructor.h"
+#include "storage_manager.h"
+#include "var_init_once.h"
+
+namespace {
+
+#if defined(_M_IX86) || defined(_M_X64)
+constexpr size_t kStubSize = 16;
+#elif defined(_M_ARM64)
+constexpr size_t kStubSize = 32;
+#else
+#error "Unsupported architecture"
+#endif
+
+// The code of all stubs of a chunk is generated when the chunk is allocated,
+// in its first half. Each stub refers to the data at the same index in the
+// second half, so creating a stub only writes data, and the code pages never
+// have to be writable again.
+constexpr size_t kChunkSize = 0x10000;
+constexpr size_t kChunkCodeSize = kChunkSize / 2;
+constexpr size_t kStubsPerChunk = kChunkCodeSize / kStubSize;
+
+struct StubData {
+    volatile ULONG counter;
+    ULONG padding;
+    // Only the low 32 bits are used on x86.
+    ULONG64 hookFunction;
+};
+
+static_assert(sizeof(StubData) * kStubsPerChunk <= kChunkSize - kChunkCodeSize);
+
+StubData* GetStubData(BYTE* chunk, size_t index) {
+    return reinterpret_cast<StubData*>(chunk + kChunkCodeSize) + index;
+}
+
+void WriteStubCode(BYTE* code, const StubData* data) {
+    UINT_PTR counterAddress =
+        reinterpret_cast<UINT_PTR>(data) + offsetof(StubData, counter);
+    UINT_PTR hookFunctionAddress =
+        reinterpret_cast<UINT_PTR>(data) + offsetof(StubData, hookFunction);
+
+#if defined(_M_IX86) || defined(_M_X64)
+    auto writeUInt32 = [](BYTE* p, UINT32 value) {
+        memcpy(p, &value, sizeof(value));
+    };
+
+    memset(code, 0xCC, kStubSize);
+
+    // lock inc dword ptr [counter]
+    code[0] = 0xF0;
+    code[1] = 0xFF;
+    code[2] = 0x05;
+    // jmp dword ptr [hookFunction]
+    code[7] = 0xFF;
+    code[8] = 0x25;
+
+#if defined(_M_X64)
+    // Both are RIP-relative, the data is less than 2 GB away.
+    UINT_PTR codeAddress = reinterpret_cast<UINT_PTR>(code);
+    writeUInt32(code + 3,
+                static_cast<UINT32>(counterAddress - (codeAddress + 7)));
+    writeUInt32(code + 9,
+                static_cast<UINT32>(hookFunctionAddress - (codeAddress + 13)));
+#else
+    writeUInt32(code + 3, static_cast<UINT32>(counterAddress));
+    writeUInt32(code + 9, static_cast<UINT32>(hookFunctionAddress));
+#endif
+#elif defined(_M_ARM64)
+    UINT32* instructions = reinterpret_cast<UINT32*>(code);
+
+    // adr x16, data
+    INT_PTR offset = static_cast<INT_PTR>(counterAddress) -
+                     reinterpret_cast<INT_PTR>(instructions);
+    UINT32 immlo = static_cast<UINT32>(offset) & 0x3;
+    UINT32 immhi = (static_cast<UINT32>(offset) >> 2) & 0x7FFFF;
+    instructions[0] = 0x10000000 | (immlo << 29) | (immhi << 5) | 16;
+    // ldr w17, [x16]
+    instructions[1] = 0xB9400211;
+    // add w17, w17, #1
+    instructions[2] = 0x11000631;
+    // str w17, [x16]
+    instructions[3] = 0xB9000211;
+    // ldr x17, [x16, #8]
+    instructions[4] = 0xF9400611;
+    // br x17
+    instructions[5] = 0xD61F0220;
+    // brk #0
+    instructions[6] = 0xD4200000;
+    instructions[7] = 0xD4200000;
+
+    static_assert(offsetof(StubData, hookFunction) == 8);
+#endif
+}
+
+class StubAllocator {
+   public:
+    static StubAllocator& GetInstance() {
+        STATIC_INIT_ONCE(NoDestructorIfTerminating<StubAllocator>, s);
+        return **s;
+    }
+
+    // Returns the stub code and its data, or nullptr on failure.
+    std::pair<void*, StubData*> Allocate() {
+        std::lock_guard guard(m_mutex);
+
+        if (m_nextStub == kStubsPerChunk) {
+            BYTE* chunk = AllocateChunk();
+            if (!chunk) {
+                return {};
+            }
+
+            m_chunk = chunk;
+            m_nextStub = 0;
+        }
+
+        size_t index = m_nextStub++;
+        return {m_chunk + index * kStubSize, GetStubData(m_chunk, index)};
+    }
+
+   private:
+    static BYTE* AllocateChunk() {
+        BYTE* chunk = static_cast<BYTE*>(VirtualAlloc(
+            nullptr, kChunkSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+        if (!chunk) {
+            LOG(L"VirtualAlloc failed: %u", GetLastError());
+            return nullptr;
+        }
+
+        for (size_t i = 0; i < kStubsPerChunk; i++) {
+            WriteStubCode(chunk + i * kStubSize, GetStubData(chunk, i));
+        }
+
+        DWORD oldProtect;
+        if (!VirtualProtect(chunk, kChunkCodeSize, PAGE_EXECUTE_READ,
+                            &oldProtect)) {
+            LOG(L"VirtualProtect failed: %u", GetLastError());
+            VirtualFree(chunk, 0, MEM_RELEASE);
+            return nullptr;
+        }
+
+        FlushInstructionCache(GetCurrentProcess(), chunk, kChunkCodeSize);
+
+        return chunk;
+    }
+
+    std::mutex m_mutex;
+    BYTE* m_chunk = nullptr;
+    size_t m_nextStub = kStubsPerChunk;
+};
+
+bool IsEnabledInConfig() {
+    try {
+        auto settings = StorageManager::GetInstance().GetAppConfig(L"Settings");
+        return settings->GetInt(L"HookCallStats").value_or(0) != 0;
+    } catch (const std::exception& e) {
+        LOG(L"Reading the HookCallStats setting failed: %S", e.what());
+        return false;
+    }
+}
+
+}  // namespace
+
+HookCallStats::HookCallStats(PCWSTR modName)
+    : m_entry(ModStatusTable::Kind::kHookCallStats, modName),
+      m_lastPublishTickCount(GetTickCount64()) {
+    m_timer.reset(CreateThreadpoolTimer(TimerCallback, this, nullptr));
+    THROW_LAST_ERROR_IF_NULL(m_timer);
+}
+
+// static
+bool HookCallStats::IsEnabled() {
+    STATIC_INIT_ONCE_TRIVIAL(bool, enabled, IsEnabledInConfig());
+    return enabled;
+}
+
+void* HookCallStats::WrapHookFunction(void* targetFunction,
+                                      void* hookFunction) {
+    auto [code, data] = StubAllocator::GetInstance().Allocate();
+    if (!code) {
+        return hookFunction;
+    }
+
+    data->hookFunction = reinterpret_cast<UINT_PTR>(hookFunction);
+
+    std::lock_guard guard(m_mutex);
+
+    m_counters.push_back({
+        .targetFunction = targetFunction,
+        .counter = &data->counter,
+        .lastCount = 0,
+        .totalCount = 0,
+    });
+
+    if (!m_timerSet) {
+        FILETIME dueTime = wil::filetime::from_int64(static_cast<UINT64>(
+            -static_cast<INT64>(kPublishIntervalMs) *
+            wil::filetime_duration::one_millisecond));
+        SetThreadpoolTimer(m_timer.get(), &dueTime, kPublishIntervalMs, 0);
+        m_timerSet = true;
+    }
+
+    return code;
+}
+
+// static
+void CALLBACK HookCallStats::TimerCallback(PTP_CALLBACK_INSTANCE instance,
+                                           PVOID context,
+                                           PTP_TIMER timer) {
+    static_cast<HookCallStats*>(context)->Publish();
+}
+
+void HookCallStats::Publish() noexcept {
+    std::lock_guard guard(m_mutex);
+
+    ULONGLONG tickCount = GetTickCount64();
+    ULONGLONG elapsed = tickCount - m_lastPublishTickCount;
+    m_lastPublishTickCount = tickCount;
+
+    ULONGLONG totalCount = 0;
+    ULONGLONG recentCount = 0;
+    const HookCounter* busiest = nullptr;
+    ULONG busiestRecentCount = 0;
+
+    for (auto& hookCounter : m_counters) {
+        ULONG count = *hookCounter.counter;
+        // Unsigned arithmetic, correct if the counter wrapped around.
+        ULONG recent = count - hookCounter.lastCount;
+        hookCounter.lastCount = count;
+        hookCounter.totalCount += recent;
+
+        totalCount += hookCounter.totalCount;
+        recentCount += recent;
+
+        if (!busiest || recent > busiestRecentCount) {
+            busiest = &hookCounter;
+            busiestRecentCount = recent;
+        }
+    }
+
+    ULONGLONG callsPerSecond = elapsed ? recentCount * 1000 / elapsed : 0;
+
+    WCHAR value[ModStatusTable::kValueMaxLength + 1];
+    _snwprintf_s(value, _TRUNCATE,
+                 L"%I64u calls/s, %I64u total, %zu hooks, busiest: %p (%u)",
+                 callsPerSecond, totalCount, m_counters.size(),
+                 busiest ? busiest->targetFunction : nullptr,
+                 busiestRecentCount);
+    m_entry.Set(value);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "mod_status_table.h"
+
+// Optionally counts the calls of the hooks which are set by a mod, enabled
+// with the HookCallStats engine setting. Each hook function is wrapped with a
+// small stub which increments a counter and jumps to it. The totals of the mod
+// are published in the mod status table once per second, so that the mods
+// which add the most overhead to a process can be found.
+//
+// Only calls are counted, measuring the time spent in a hook would require
+// intercepting its return. On ARM64, the counter isn't incremented atomically,
+// so concurrent calls might occasionally be missed. Stubs are never freed,
+// since a thread might still be executing one after its hook is removed.
+class HookCallStats {
+   public:
+    explicit HookCallStats(PCWSTR modName);
+
+    HookCallStats(const HookCallStats&) = delete;
+    HookCallStats& operator=(const HookCallStats&) = delete;
+
+    static bool IsEnabled();
+
+    // Returns a function which counts the call and jumps to hookFunction, or
+    // hookFunction itself if a stub can't be created.
+    void* WrapHookFunction(void* targetFunction, void* hookFunction);
+
+   private:
+    static constexpr DWORD kPublishIntervalMs = 1000;
+
+    struct HookCounter {
+        void* targetFunction;
+        volatile ULONG* counter;
+        ULONG lastCount;
+        ULONGLONG totalCount;
+    };
+
+    static void CALLBACK TimerCallback(PTP_CALLBACK_INSTANCE instance,
+                                       PVOID context,
+                                       PTP_TIMER timer);
+    void Publish() noexcept;
+
+    std::mutex m_mutex;
+    std::vector<HookCounter> m_counters;
+    ModStatusTable::Entry m_entry;
+    ULONGLONG m_lastPublishTickCount = 0;
+    bool m_timerSet = false;
+    // Declared last, so that the callbacks are done before the rest is
+    // destroyed.
+    wil::unique_threadpool_timer m_timer;
+};
@@ -0,0 +1,615 @@
+#include "stdafx.h"
+
+#include "http_client.h"
+#include "logger.h"
+#include "var_init_once.h"
+#include "version.h"
+
+#ifndef WINHTTP_OPTION_ENABLE_HTTP_PROTOCOL
+#define WINHTTP_OPTION_ENABLE_HTTP_PROTOCOL 133
+#define WINHTTP_PROTOCOL_FLAG_HTTP2 0x1
+#endif
+
+#ifndef WINHTTP_OPTION_DECOMPRESSION
+#define WINHTTP_OPTION_DECOMPRESSION 118
+#define WINHTTP_DECOMPRESSION_FLAG_ALL 0x3
+#endif
+
+namespace {
+
+// How often cancellation is checked while waiting.
+constexpr DWORD kCancelPollInterval = 1000;
+
+// How long to wait for the pending callbacks of a closed request.
+constexpr DWORD kRequestCloseTimeout = 10000;
+
+std::atomic<bool> g_instanceCreated;
+
+// NL_NETWORK_CONNECTIVITY_HINT, which older SDKs don't define.
+struct NetworkConnectivityHint {
+    int connectivityLevel;
+    int connectivityCost;
+    BOOLEAN approachingDataLimit;
+    BOOLEAN overDataLimit;
+    BOOLEAN roaming;
+};
+
+// NetworkConnectivityCostHintFixed and NetworkConnectivityCostHintVariable.
+constexpr int kConnectivityCostFixed = 2;
+constexpr int kConnectivityCostVariable = 3;
+
+}  // namespace
+
+struct HttpClient::RequestContext {
+    // Signaled when a pending operation completes, successfully or not.
+    wil::unique_event completedEvent{wil::EventOptions::None};
+    // Signaled when the request handle is closing, after which no more
+    // callbacks are called for it.
+    wil::unique_event closedEvent{wil::EventOptions::ManualReset};
+    DWORD error = ERROR_SUCCESS;
+    DWORD bytes = 0;
+    // Must stay valid until a pending read completes.
+    std::vector<char> buffer;
+};
+
+// static
+HttpClient& HttpClient::GetInstance() {
+    STATIC_INIT_ONCE(NoDestructorIfTerminating<HttpClient>, s);
+    return **s;
+}
+
+HttpClient::HttpClient() {
+    wil::unique_hmodule winhttpModule{LoadLibraryEx(
+        L"winhttp.dll", nullptr, LOAD_LIBRARY_SEARCH_SYSTEM32)};
+    if (!winhttpModule) {
+        LOG(L"Failed to load winhttp.dll");
+        return;
+    }
+
+    HMODULE moduleRaw = winhttpModule.get();
+
+    m_pCloseHandle = reinterpret_cast<WinHttpCloseHandle_t>(
+        GetProcAddress(moduleRaw, "WinHttpCloseHandle"));
+    m_pOpen = reinterpret_cast<WinHttpOpen_t>(
+        GetProcAddress(moduleRaw, "WinHttpOpen"));
+    m_pConnect = reinterpret_cast<WinHttpConnect_t>(
+        GetProcAddress(moduleRaw, "WinHttpConnect"));
+    m_pQueryHeaders = reinterpret_cast<WinHttpQueryHeaders_t>(
+        GetProcAddress(moduleRaw, "WinHttpQueryHeaders"));
+    m_pReceiveResponse = reinterpret_cast<WinHttpReceiveResponse_t>(
+        GetProcAddress(moduleRaw, "WinHttpReceiveResponse"));
+    m_pSendRequest = reinterpret_cast<WinHttpSendRequest_t>(
+        GetProcAddress(moduleRaw, "WinHttpSendRequest"));
+    m_pOpenRequest = reinterpret_cast<WinHttpOpenRequest_t>(
+        GetProcAddress(moduleRaw, "WinHttpOpenRequest"));
+    m_pQueryDataAvailable = reinterpret_cast<WinHttpQueryDataAvailable_t>(
+        GetProcAddress(moduleRaw, "WinHttpQueryDataAvailable"));
+    m_pReadData = reinterpret_cast<WinHttpReadData_t>(
+        GetProcAddress(moduleRaw, "WinHttpReadData"));
+    m_pCrackUrl = reinterpret_cast<WinHttpCrackUrl_t>(
+        GetProcAddress(moduleRaw, "WinHttpCrackUrl"));
+    m_pSetOption = reinterpret_cast<WinHttpSetOption_t>(
+        GetProcAddress(moduleRaw, "WinHttpSetOption"));
+    m_pSetStatusCallback = reinterpret_cast<WinHttpSetStatusCallback_t>(
+        GetProcAddress(moduleRaw, "WinHttpSetStatusCallback"));
+
+    if (!m_pCloseHandle || !m_pOpen || !m_pConnect || !m_pQueryHeaders ||
+        !m_pReceiveResponse || !m_pSendRequest || !m_pOpenRequest ||
+        !m_pQueryDataAvailable || !m_pReadData || !m_pCrackUrl ||
+        !m_pSetOption || !m_pSetStatusCallback) {
+        LOG(L"Failed to get all winhttp.dll functions");
+        return;
+    }
+
+    m_winhttpModule = std::move(winhttpModule);
+    g_instanceCreated.store(true, std::memory_order_release);
+}
+
+HttpClient::~HttpClient() {
+    if (m_session) {
+        // Make sure no callbacks are called after the engine is unloaded.
+        m_pSetStatusCallback(m_session, nullptr,
+                             WINHTTP_CALLBACK_FLAG_ALL_NOTIFICATIONS, 0);
+        m_pCloseHandle(m_session);
+    }
+}
+
+std::optional<HttpClient::Response> HttpClient::Get(
+    PCWSTR url,
+    HANDLE targetFile,
+    const std::function<bool()>& queryCancel,
+    const RequestOptions& options) {
+    HINTERNET session = AcquireSession();
+    auto sessionRelease = wil::scope_exit([this] { ReleaseSession(); });
+
+    URL_COMPONENTS urlComp = {sizeof(urlComp)};
+    urlComp.dwHostNameLength = (DWORD)-1;
+    urlComp.dwUrlPathLength = (DWORD)-1;
+    THROW_IF_WIN32_BOOL_FALSE(m_pCrackUrl(url, 0, 0, &urlComp));
+
+    // Connections are pooled by the session, so a connection to the same
+    // server is reused even though a new handle is created for each request.
+    HINTERNET connect{m_pConnect(
+        session,
+        std::wstring(urlComp.lpszHostName, urlComp.dwHostNameLength).c_str(),
+        urlComp.nPort, 0)};
+    THROW_LAST_ERROR_IF_NULL(connect);
+
+    auto connectCleanup =
+        wil::scope_exit([this, connect] { m_pCloseHandle(connect); });
+
+    HINTERNET request{m_pOpenRequest(
+        connect, L"GET",
+        std::wstring(urlComp.lpszUrlPath, urlComp.dwUrlPathLength).c_str(),
+        nullptr, WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES,
+        urlComp.nScheme == INTERNET_SCHEME_HTTPS ? WINHTTP_FLAG_SECURE : 0)};
+    THROW_LAST_ERROR_IF_NULL(request);
+
+    auto context = std::make_unique<RequestContext>();
+    DWORD_PTR contextValue = reinterpret_cast<DWORD_PTR>(context.get());
+    if (!m_pSetOption(request, WINHTTP_OPTION_CONTEXT_VALUE, &contextValue,
+                      sizeof(contextValue))) {
+        DWORD error = GetLastError();
+        m_pCloseHandle(request);
+        THROW_WIN32(error);
+    }
+
+    auto requestCleanup = wil::scope_exit([this, request, &context] {
+        CloseRequest(request, std::move(context));
+    });
+
+    std::optional<ULONGLONG> deadline;
+    if (options.timeout) {
+        deadline = GetTickCount64() + *options.timeout;
+    }
+
+    // Returns false if canceled, throws if the operation failed.
+    auto waitForCompletion = [&context, &queryCancel, &options, &deadline]() {
+        HANDLE handles[] = {context->completedEvent.get(), options.cancelEvent};
+        DWORD handleCount = options.cancelEvent ? 2 : 1;
+
+        while (true) {
+            DWORD waitTime = queryCancel ? kCancelPollInterval : INFINITE;
+            if (deadline) {
+                ULONGLONG now = GetTickCount64();
+                ULONGLONG remaining = now < *deadline ? *deadline - now : 0;
+                waitTime = static_cast<DWORD>(
+                    std::min(static_cast<ULONGLONG>(waitTime), remaining));
+            }
+
+            DWORD waitResult =
+                WaitForMultipleObjects(handleCount, handles, FALSE, waitTime);
+            if (waitResult == WAIT_OBJECT_0) {
+                break;
+            }
+
+            if (waitResult == WAIT_OBJECT_0 + 1) {
+                VERBOSE(L"Request canceled");
+                return false;
+            }
+
+            THROW_LAST_ERROR_IF(waitResult != WAIT_TIMEOUT);
+
+            if (deadline && GetTickCount64() >= *deadline) {
+                THROW_WIN32(ERROR_WINHTTP_TIMEOUT);
+            }
+
+            if (queryCancel && queryCancel()) {
+                VERBOSE(L"Request canceled");
+                return false;
+            }
+        }
+
+        THROW_IF_WIN32_ERROR(context->error);
+        return true;
+    };
+
+    std::wstring headers;
+    if (options.rangeStart) {
+        // Ranges of compressed content don't match offsets in the
+        // uncompressed content.
+        DWORD decompression = 0;
+        THROW_IF_WIN32_BOOL_FALSE(m_pSetOption(request,
+                                               WINHTTP_OPTION_DECOMPRESSION,
+                                               &decompression,
+                                               sizeof(decompression)));
+
+        if (*options.rangeStart > 0) {
+            headers = L"Range: bytes=" + std::to_wstring(*options.rangeStart) +
+                      L"-\r\n";
+        }
+    }
+
+    if (!options.ifNoneMatch.empty()) {
+        headers += L"If-None-Match: " + options.ifNoneMatch + L"\r\n";
+    }
+
+    if (!options.ifModifiedSince.empty()) {
+        headers += L"If-Modified-Since: " + options.ifModifiedSince + L"\r\n";
+    }
+
+    PCWSTR additionalHeaders =
+        headers.empty() ? WINHTTP_NO_ADDITIONAL_HEADERS : headers.c_str();
+    THROW_IF_WIN32_BOOL_FALSE(m_pSendRequest(
+        request, additionalHeaders, static_cast<DWORD>(headers.length()),
+        WINHTTP_NO_REQUEST_DATA, 0, 0, 0));
+    if (!waitForCompletion()) {
+        return std::nullopt;
+    }
+
+    THROW_IF_WIN32_BOOL_FALSE(m_pReceiveResponse(request, nullptr));
+    if (!waitForCompletion()) {
+        return std::nullopt;
+    }
+
+    DWORD statusCode = 0;
+    DWORD statusCodeSize = sizeof(statusCode);
+    THROW_IF_WIN32_BOOL_FALSE(m_pQueryHeaders(
+        request, WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
+        WINHTTP_HEADER_NAME_BY_INDEX, &statusCode, &statusCodeSize,
+        WINHTTP_NO_HEADER_INDEX));
+
+    Response response{
+        .statusCode = statusCode,
+        .length = 0,
+    };
+
+    // Queried as a string, since WINHTTP_QUERY_FLAG_NUMBER is limited to 32
+    // bits.
+    WCHAR contentLength[32];
+    DWORD contentLengthSize = sizeof(contentLength);
+    if (m_pQueryHeaders(request, WINHTTP_QUERY_CONTENT_LENGTH,
+                        WINHTTP_HEADER_NAME_BY_INDEX, contentLength,
+                        &contentLengthSize, WINHTTP_NO_HEADER_INDEX)) {
+        PWSTR end;
+        ULONGLONG value = wcstoull(contentLength, &end, 10);
+        if (end != contentLength && *end == L'\0') {
+            response.contentLength = value;
+        }
+    }
+
+    auto queryStringHeader = [this, request](DWORD infoLevel) {
+        DWORD size = 0;
+        if (m_pQueryHeaders(request, infoLevel, WINHTTP_HEADER_NAME_BY_INDEX,
+                            WINHTTP_NO_OUTPUT_BUFFER, &size,
+                            WINHTTP_NO_HEADER_INDEX) ||
+            GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+            return std::wstring();
+        }
+
+        std::wstring value(size / sizeof(WCHAR), L'\0');
+        if (!m_pQueryHeaders(request, infoLevel, WINHTTP_HEADER_NAME_BY_INDEX,
+                             value.data(), &size, WINHTTP_NO_HEADER_INDEX)) {
+            return std::wstring();
+        }
+
+        value.resize(size / sizeof(WCHAR));
+        return value;
+    };
+
+    response.cacheControl = queryStringHeader(WINHTTP_QUERY_CACHE_CONTROL);
+    response.etag = queryStringHeader(WINHTTP_QUERY_ETAG);
+    response.lastModified = queryStringHeader(WINHTTP_QUERY_LAST_MODIFIED);
+
+    bool writeToTargetFile = !!targetFile;
+    if (targetFile && options.rangeStart) {
+        if (statusCode == 200 && *options.rangeStart > 0) {
+            // The server doesn't support ranges, start over.
+            THROW_IF_WIN32_BOOL_FALSE(
+                SetFilePointerEx(targetFile, {}, nullptr, FILE_BEGIN));
+            THROW_IF_WIN32_BOOL_FALSE(SetEndOfFile(targetFile));
+        } else if (statusCode != 200 && statusCode != 206) {
+            writeToTargetFile = false;
+        }
+    }
+
+    ULONGLONG readStartTime = GetTickCount64();
+
+    // Waits until the content read so far is within the rate limit. Returns
+    // false if canceled.
+    auto waitForRateLimit = [&]() {
+        ULONGLONG dueTime =
+            readStartTime + response.length * 1000 / *options.maxBytesPerSecond;
+
+        while (true) {
+            ULONGLONG now = GetTickCount64();
+            if (now >= dueTime) {
+                return true;
+            }
+
+            DWORD waitTime = static_cast<DWORD>(
+                std::min(dueTime - now, ULONGLONG{kCancelPollInterval}));
+            if (options.cancelEvent) {
+                if (WaitForSingleObject(options.cancelEvent, waitTime) ==
+                    WAIT_OBJECT_0) {
+                    return false;
+                }
+            } else {
+                Sleep(waitTime);
+            }
+
+            if (queryCancel && queryCancel()) {
+                return false;
+            }
+        }
+    };
+
+    while (true) {
+        if (options.maxBytesPerSecond && *options.maxBytesPerSecond > 0 &&
+            !waitForRateLimit()) {
+            VERBOSE(L"Request canceled");
+            return std::nullopt;
+        }
+
+        THROW_IF_WIN32_BOOL_FALSE(m_pQueryDataAvailable(request, nullptr));
+        if (!waitForCompletion()) {
+            return std::nullopt;
+        }
+
+        DWORD size = context->bytes;
+        if (size == 0) {
+            break;
+        }
+
+        context->buffer.resize(size);
+        THROW_IF_WIN32_BOOL_FALSE(
+            m_pReadData(request, context->buffer.data(), size, nullptr));
+        if (!waitForCompletion()) {
+            return std::nullopt;
+        }
+
+        DWORD downloaded = context->bytes;
+        if (downloaded == 0) {
+            break;
+        }
+
+        if (options.onData) {
+            std::string_view chunk(context->buffer.data(), downloaded);
+            if (!options.onData(statusCode, chunk)) {
+                VERBOSE(L"Request canceled by the data callback");
+                return std::nullopt;
+            }
+        } else if (writeToTargetFile) {
+            DWORD written = 0;
+            THROW_IF_WIN32_BOOL_FALSE(WriteFile(targetFile,
+                                                context->buffer.data(),
+                                                downloaded, &written, nullptr));
+            THROW_WIN32_IF(ERROR_WRITE_FAULT, written != downloaded);
+        } else if (!targetFile) {
+            response.data.append(context->buffer.data(), downloaded);
+        }
+
+        response.length += downloaded;
+
+        if (options.notifyProgress) {
+            options.notifyProgress(response);
+        }
+    }
+
+    return response;
+}
+
+// static
+bool HttpClient::WaitForNetworkChange(
+    DWORD timeout,
+    const std::function<bool()>& queryCancel) {
+    // Avoid having iphlpapi.dll in the import table.
+    using NotifyAddrChange_t = DWORD(WINAPI*)(PHANDLE, LPOVERLAPPED);
+    using CancelIPChangeNotify_t = BOOL(WINAPI*)(LPOVERLAPPED);
+
+    wil::unique_hmodule iphlpapiModule{LoadLibraryEx(
+        L"iphlpapi.dll", nullptr, LOAD_LIBRARY_SEARCH_SYSTEM32)};
+    NotifyAddrChange_t pNotifyAddrChange = nullptr;
+    CancelIPChangeNotify_t pCancelIPChangeNotify = nullptr;
+    if (iphlpapiModule) {
+        pNotifyAddrChange = reinterpret_cast<NotifyAddrChange_t>(
+            GetProcAddress(iphlpapiModule.get(), "NotifyAddrChange"));
+        pCancelIPChangeNotify = reinterpret_cast<CancelIPChangeNotify_t>(
+            GetProcAddress(iphlpapiModule.get(), "CancelIPChangeNotify"));
+    }
+
+    wil::unique_event changeEvent(wil::EventOptions::ManualReset);
+    OVERLAPPED overlapped{.hEvent = changeEvent.get()};
+    bool notificationPending = false;
+
+    // If notifications aren't available, e.g. in sandboxed processes, the
+    // event is never signaled, and the timeout is used instead.
+    if (pNotifyAddrChange && pCancelIPChangeNotify) {
+        HANDLE notifyHandle;
+        DWORD error = pNotifyAddrChange(&notifyHandle, &overlapped);
+        if (error == ERROR_IO_PENDING) {
+            notificationPending = true;
+        } else {
+            VERBOSE(L"NotifyAddrChange failed with error %u", error);
+        }
+    }
+
+    auto notificationCleanup = wil::scope_exit([&] {
+        if (notificationPending &&
+            WaitForSingleObject(changeEvent.get(), 0) != WAIT_OBJECT_0) {
+            // Wait for the cancellation to complete, since the operation uses
+            // the overlapped structure.
+            pCancelIPChangeNotify(&overlapped);
+            WaitForSingleObject(changeEvent.get(), kCancelPollInterval);
+        }
+    });
+
+    ULONGLONG startTime = GetTickCount64();
+
+    while (true) {
+        if (queryCancel && queryCancel()) {
+            return false;
+        }
+
+        ULONGLONG elapsed = GetTickCount64() - startTime;
+        if (elapsed >= timeout) {
+            return true;
+        }
+
+        DWORD waitTime = static_cast<DWORD>(
+            std::min(timeout - elapsed, ULONGLONG{kCancelPollInterval}));
+        if (WaitForSingleObject(changeEvent.get(), waitTime) ==
+            WAIT_OBJECT_0) {
+            VERBOSE(L"Network addresses changed");
+            return true;
+        }
+    }
+}
+
+// static
+bool HttpClient::IsNetworkMetered() {
+    // Avoid having iphlpapi.dll in the import table.
+    using GetNetworkConnectivityHint_t =
+        DWORD(WINAPI*)(NetworkConnectivityHint * connectivityHint);
+
+    LOAD_LIBRARY_GET_PROC_ADDRESS_ONCE(
+        GetNetworkConnectivityHint_t, pGetNetworkConnectivityHint,
+        L"iphlpapi.dll", LOAD_LIBRARY_SEARCH_SYSTEM32,
+        "GetNetworkConnectivityHint");
+
+    if (!pGetNetworkConnectivityHint) {
+        return false;
+    }
+
+    NetworkConnectivityHint hint{};
+    DWORD error = pGetNetworkConnectivityHint(&hint);
+    if (error != NO_ERROR) {
+        VERBOSE(L"GetNetworkConnectivityHint failed with error %u", error);
+        return false;
+    }
+
+    return hint.connectivityCost == kConnectivityCostFixed ||
+           hint.connectivityCost == kConnectivityCostVariable ||
+           hint.approachingDataLimit || hint.overDataLimit || hint.roaming;
+}
+
+// static
+void HttpClient::CloseSessionIfIdle() {
+    if (!g_instanceCreated.load(std::memory_order_acquire)) {
+        return;
+    }
+
+    auto& httpClient = GetInstance();
+
+    std::lock_guard<std::mutex> guard(httpClient.m_sessionMutex);
+
+    if (!httpClient.m_session || httpClient.m_sessionUserCount > 0) {
+        return;
+    }
+
+    httpClient.m_pSetStatusCallback(httpClient.m_session, nullptr,
+                                    WINHTTP_CALLBACK_FLAG_ALL_NOTIFICATIONS,
+                                    0);
+    httpClient.m_pCloseHandle(httpClient.m_session);
+    httpClient.m_session = nullptr;
+
+    VERBOSE(L"Closed the idle HTTP session");
+}
+
+HINTERNET HttpClient::AcquireSession() {
+    std::lock_guard<std::mutex> guard(m_sessionMutex);
+
+    if (m_session) {
+        m_sessionUserCount++;
+        return m_session;
+    }
+
+    if (!m_winhttpModule) {
+        throw std::runtime_error("WinHttp functions are not available");
+    }
+
+    HINTERNET session{m_pOpen(L"Windhawk/" VER_FILE_VERSION_WSTR,
+                              WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
+                              WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS,
+                              WINHTTP_FLAG_ASYNC)};
+    THROW_LAST_ERROR_IF_NULL(session);
+
+    DWORD notificationFlags =
+        WINHTTP_CALLBACK_FLAG_ALL_COMPLETIONS | WINHTTP_CALLBACK_FLAG_HANDLES;
+    if (m_pSetStatusCallback(session, StatusCallback, notificationFlags, 0) ==
+        WINHTTP_INVALID_STATUS_CALLBACK) {
+        DWORD error = GetLastError();
+        m_pCloseHandle(session);
+        THROW_WIN32(error);
+    }
+
+    // Supported since Windows 10 version 1607, HTTP/1.1 is used otherwise.
+    DWORD protocols = WINHTTP_PROTOCOL_FLAG_HTTP2;
+    if (!m_pSetOption(session, WINHTTP_OPTION_ENABLE_HTTP_PROTOCOL, &protocols,
+                      sizeof(protocols))) {
+        VERBOSE(L"HTTP/2 isn't available: %u", GetLastError());
+    }
+
+    // Supported since Windows 8.1, content is served uncompressed otherwise.
+    DWORD decompression = WINHTTP_DECOMPRESSION_FLAG_ALL;
+    if (!m_pSetOption(session, WINHTTP_OPTION_DECOMPRESSION, &decompression,
+                      sizeof(decompression))) {
+        VERBOSE(L"HTTP decompression isn't available: %u", GetLastError());
+    }
+
+    m_session = session;
+    m_sessionUserCount++;
+    return m_session;
+}
+
+void HttpClient::ReleaseSession() {
+    std::lock_guard<std::mutex> guard(m_sessionMutex);
+
+    m_sessionUserCount--;
+}
+
+void HttpClient::CloseRequest(HINTERNET request,
+                              std::unique_ptr<RequestContext> context) {
+    m_pCloseHandle(request);
+
+    // A pending operation completes after the handle is closed, and the
+    // closing notification is the last callback for the handle.
+    if (WaitForSingleObject(context->closedEvent.get(),
+                            kRequestCloseTimeout) != WAIT_OBJECT_0) {
+        LOG(L"Timed out waiting for an HTTP request to close");
+
+        // Leak the context rather than having a late callback use it after
+        // it's freed.
+        context.release();
+    }
+}
+
+// static
+void CALLBACK HttpClient::StatusCallback(HINTERNET handle,
+                                         DWORD_PTR context,
+                                         DWORD internetStatus,
+                                         LPVOID statusInformation,
+                                         DWORD statusInformationLength) {
+    // The session and connection handles have no context.
+    auto* requestContext = reinterpret_cast<RequestContext*>(context);
+    if (!requestContext) {
+        return;
+    }
+
+    switch (internetStatus) {
+        case WINHTTP_CALLBACK_STATUS_SENDREQUEST_COMPLETE:
+        case WINHTTP_CALLBACK_STATUS_HEADERS_AVAILABLE:
+            requestContext->completedEvent.SetEvent();
+            break;
+
+        case WINHTTP_CALLBACK_STATUS_DATA_AVAILABLE:
+            requestContext->bytes = *static_cast<DWORD*>(statusInformation);
+            requestContext->completedEvent.SetEvent();
+            break;
+
+        case WINHTTP_CALLBACK_STATUS_READ_COMPLETE:
+            requestContext->bytes = statusInformationLength;
+            requestContext->completedEvent.SetEvent();
+            break;
+
+        case WINHTTP_CALLBACK_STATUS_REQUEST_ERROR:
+            requestContext->error =
+                static_cast<WINHTTP_ASYNC_RESULT*>(statusInformation)->dwError;
+            requestContext->completedEvent.SetEvent();
+            break;
+
+        case WINHTTP_CALLBACK_STATUS_HANDLE_CLOSING:
+            requestContext->closedEvent.SetEvent();
+            break;
+    }
+}
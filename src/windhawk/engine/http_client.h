@@ -0,0 +1,130 @@
+#pragma once
+
+#include "no_destructor.h"
+
+// A process-wide HTTP client. All requests share a single asynchronous WinHTTP
+// session, so that connections are kept alive and reused between requests,
+// e.g. when the online symbol cache is queried for several modules, and HTTP/2
+// is used where available. winhttp.dll is loaded dynamically, since it might
+// not be available in all cases, e.g. sandboxed processes.
+class HttpClient {
+   public:
+    struct Response {
+        DWORD statusCode;
+        std::string data;
+        size_t length;
+        // The length of the response content, if known in advance.
+        std::optional<ULONGLONG> contentLength;
+        // Headers used for caching, empty if not sent.
+        std::wstring cacheControl;
+        std::wstring etag;
+        std::wstring lastModified;
+    };
+
+    struct RequestOptions {
+        // If set, the content is requested starting from the given offset,
+        // uncompressed, so that offsets match the content as stored. If the
+        // server returns the full content instead, the target file is
+        // rewritten from the beginning. Only successful responses are written
+        // to the target file.
+        std::optional<ULONGLONG> rangeStart;
+        // If set, sent as If-None-Match and If-Modified-Since, so that the
+        // server can respond with 304 if a cached copy is still valid.
+        std::wstring ifNoneMatch;
+        std::wstring ifModifiedSince;
+        // Called after each received chunk with the response so far.
+        std::function<void(const Response&)> notifyProgress;
+        // If set, each received chunk is passed to it instead of being
+        // written to the target file or added to the response data. Returning
+        // false cancels the request.
+        std::function<bool(DWORD statusCode, std::string_view chunk)> onData;
+        // If set, the request is canceled once the event is signaled, without
+        // waiting for the next poll of the cancellation callback.
+        HANDLE cancelEvent = nullptr;
+        // If set, the request fails with ERROR_WINHTTP_TIMEOUT if it doesn't
+        // complete within the given number of milliseconds.
+        std::optional<DWORD> timeout;
+        // If set, the content is read no faster than the given rate, so that
+        // large downloads don't saturate slow links.
+        std::optional<DWORD> maxBytesPerSecond;
+    };
+
+    static HttpClient& GetInstance();
+
+    // If targetFile isn't null, the content is written to it instead of being
+    // returned in the response data. Returns std::nullopt if the request was
+    // canceled, and throws on errors.
+    std::optional<Response> Get(PCWSTR url,
+                                HANDLE targetFile,
+                                const std::function<bool()>& queryCancel,
+                                const RequestOptions& options = {});
+
+    // Waits until the network addresses of the computer change, which
+    // usually means that connectivity was established, or until the timeout
+    // elapses. Returns false if canceled.
+    static bool WaitForNetworkChange(DWORD timeout,
+                                     const std::function<bool()>& queryCancel);
+
+    // Returns whether the current connection is metered, e.g. a mobile
+    // connection, or is close to or over its data limit. Returns false if it
+    // can't be determined, e.g. before Windows 10 version 2004.
+    static bool IsNetworkMetered();
+
+    // Closes the session, with its pooled connections, if no request is in
+    // progress. A new session is opened by the next request. Does nothing if
+    // the client was never used in this process.
+    static void CloseSessionIfIdle();
+
+   private:
+    friend class NoDestructorIfTerminating<HttpClient>;
+
+    // Avoid having winhttp.dll in the import table.
+    using WinHttpCloseHandle_t = decltype(&WinHttpCloseHandle);
+    using WinHttpOpen_t = decltype(&WinHttpOpen);
+    using WinHttpConnect_t = decltype(&WinHttpConnect);
+    using WinHttpQueryHeaders_t = decltype(&WinHttpQueryHeaders);
+    using WinHttpReceiveResponse_t = decltype(&WinHttpReceiveResponse);
+    using WinHttpSendRequest_t = decltype(&WinHttpSendRequest);
+    using WinHttpOpenRequest_t = decltype(&WinHttpOpenRequest);
+    using WinHttpQueryDataAvailable_t = decltype(&WinHttpQueryDataAvailable);
+    using WinHttpReadData_t = decltype(&WinHttpReadData);
+    using WinHttpCrackUrl_t = decltype(&WinHttpCrackUrl);
+    using WinHttpSetOption_t = decltype(&WinHttpSetOption);
+    using WinHttpSetStatusCallback_t = decltype(&WinHttpSetStatusCallback);
+
+    struct RequestContext;
+
+    HttpClient();
+    ~HttpClient();
+
+    // Each call must be paired with a ReleaseSession call once the handles
+    // created from the session are closed.
+    HINTERNET AcquireSession();
+    void ReleaseSession();
+    void CloseRequest(HINTERNET request,
+                      std::unique_ptr<RequestContext> context);
+
+    static void CALLBACK StatusCallback(HINTERNET handle,
+                                        DWORD_PTR context,
+                                        DWORD internetStatus,
+                                        LPVOID statusInformation,
+                                        DWORD statusInformationLength);
+
+    wil::unique_hmodule m_winhttpModule;
+    WinHttpCloseHandle_t m_pCloseHandle = nullptr;
+    WinHttpOpen_t m_pOpen = nullptr;
+    WinHttpConnect_t m_pConnect = nullptr;
+    WinHttpQueryHeaders_t m_pQueryHeaders = nullptr;
+    WinHttpReceiveResponse_t m_pReceiveResponse = nullptr;
+    WinHttpSendRequest_t m_pSendRequest = nullptr;
+    WinHttpOpenRequest_t m_pOpenRequest = nullptr;
+    WinHttpQueryDataAvailable_t m_pQueryDataAvailable = nullptr;
+    WinHttpReadData_t m_pReadData = nullptr;
+    WinHttpCrackUrl_t m_pCrackUrl = nullptr;
+    WinHttpSetOption_t m_pSetOption = nullptr;
+    WinHttpSetStatusCallback_t m_pSetStatusCallback = nullptr;
+
+    std::mutex m_sessionMutex;
+    HINTERNET m_session = nullptr;
+    size_t m_sessionUserCount = 0;
+};
@@ -0,0 +1,335 @@
+#include "stdafx.h"
+
+#include "import_hooks.h"
+#include "logger.h"
+#include "no_destructor.h"
+#include "var_init_once.h"
+
+// static
+ImportHooks& ImportHooks::GetInstance() {
+    STATIC_INIT_ONCE(NoDestructorIfTerminating<ImportHooks>, s);
+    return **s;
+}
+
+bool ImportHooks::QueueSet(ULONG_PTR owner,
+                           HMODULE module,
+                           PCSTR dllName,
+                           PCSTR functionName,
+                           void* hookFunction,
+                           void** originalFunction) {
+    std::lock_guard guard(m_mutex);
+
+    void** slotAddress = FindSlot(module, dllName, functionName);
+    if (!slotAddress) {
+        return false;
+    }
+
+    auto it = m_slots.find(slotAddress);
+    if (it == m_slots.end()) {
+        wil::unique_hmodule moduleReference;
+        THROW_IF_WIN32_BOOL_FALSE(GetModuleHandleEx(
+            GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS,
+            reinterpret_cast<PCWSTR>(module), &moduleReference));
+
+        it = m_slots
+                 .try_emplace(slotAddress,
+                              Slot{
+                                  .module = std::move(moduleReference),
+                                  .originalFunction = *slotAddress,
+                              })
+                 .first;
+    }
+
+    Slot& slot = it->second;
+
+    auto hookIt = std::ranges::find(slot.hooks, owner, &Hook::owner);
+    if (hookIt != slot.hooks.end()) {
+        if (hookIt->hookFunction != hookFunction ||
+            hookIt->originalFunction != originalFunction) {
+            throw std::runtime_error(
+                "A different hook is already set for the import");
+        }
+
+        hookIt->queuedRemove = false;
+        return true;
+    }
+
+    if (originalFunction) {
+        *originalFunction = *slotAddress;
+    }
+
+    slot.hooks.push_back({
+        .owner = owner,
+        .hookFunction = hookFunction,
+        .originalFunction = originalFunction,
+    });
+
+    return true;
+}
+
+void ImportHooks::QueueRemoveAll(ULONG_PTR owner) {
+    std::lock_guard guard(m_mutex);
+
+    for (auto& [slotAddress, slot] : m_slots) {
+        for (auto& hook : slot.hooks) {
+            if (hook.owner == owner) {
+                hook.queuedRemove = true;
+            }
+        }
+    }
+}
+
+void ImportHooks::QueueSetPaused(ULONG_PTR owner, bool paused) {
+    std::lock_guard guard(m_mutex);
+
+    m_queuedPaused[owner] = paused;
+}
+
+void ImportHooks::ApplyQueued(ULONG_PTR owner) {
+    std::lock_guard guard(m_mutex);
+
+    ApplyQueuedLocked(owner, /*removeAll=*/false);
+}
+
+void ImportHooks::RemoveAll(ULONG_PTR owner) {
+    std::lock_guard guard(m_mutex);
+
+    ApplyQueuedLocked(owner, /*removeAll=*/true);
+    m_pausedOwners.erase(owner);
+}
+
+void ImportHooks::ReleaseImportIndexes() {
+    std::lock_guard guard(m_mutex);
+
+    m_moduleImports.clear();
+}
+
+void** ImportHooks::FindSlot(HMODULE module,
+                             PCSTR dllName,
+                             PCSTR functionName) {
+    auto* dosHeader = reinterpret_cast<const IMAGE_DOS_HEADER*>(module);
+    if (dosHeader->e_magic != IMAGE_DOS_SIGNATURE) {
+        throw std::runtime_error("Invalid module");
+    }
+
+    auto* ntHeader = reinterpret_cast<const IMAGE_NT_HEADERS*>(
+        reinterpret_cast<const BYTE*>(module) + dosHeader->e_lfanew);
+    if (ntHeader->Signature != IMAGE_NT_SIGNATURE) {
+        throw std::runtime_error("Invalid module");
+    }
+
+    // A different module might have been loaded at the same address since the
+    // index was built.
+    auto it = m_moduleImports.find(module);
+    if (it == m_moduleImports.end() ||
+        it->second.timeDateStamp != ntHeader->FileHeader.TimeDateStamp ||
+        it->second.sizeOfImage != ntHeader->OptionalHeader.SizeOfImage) {
+        it = m_moduleImports
+                 .insert_or_assign(module, IndexModuleImports(module))
+                 .first;
+    }
+
+    auto& slots = it->second.slots;
+    auto slotIt = slots.find(MakeImportKey(dllName, functionName));
+    if (slotIt == slots.end()) {
+        return nullptr;
+    }
+
+    return slotIt->second;
+}
+
+bool ImportHooks::IsPaused(ULONG_PTR owner) {
+    return m_pausedOwners.contains(owner);
+}
+
+void ImportHooks::UpdateSlot(void** slotAddress, Slot& slot) {
+    // The original function pointers of all hooks are updated, including
+    // inactive ones, so that a call which is already in progress in any of
+    // them continues through the chain.
+    void* value = slot.originalFunction;
+    for (const auto& hook : slot.hooks) {
+        if (hook.originalFunction) {
+            *hook.originalFunction = value;
+        }
+
+        if (hook.applied && !IsPaused(hook.owner)) {
+            value = hook.hookFunction;
+        }
+    }
+
+    void* currentValue = *slotAddress;
+    if (currentValue == value) {
+        return;
+    }
+
+    if (currentValue != slot.originalFunction &&
+        std::ranges::find(slot.hooks, currentValue, &Hook::hookFunction) ==
+            slot.hooks.end()) {
+        LOG(L"Import at %p was changed externally, overwriting", slotAddress);
+    }
+
+    WriteSlot(slotAddress, value);
+}
+
+void ImportHooks::ApplyQueuedLocked(ULONG_PTR owner, bool removeAll) {
+    for (auto it = m_queuedPaused.begin(); it != m_queuedPaused.end();) {
+        if (owner != kAllOwners && it->first != owner) {
+            ++it;
+            continue;
+        }
+
+        if (it->second) {
+            m_pausedOwners.insert(it->first);
+        } else {
+            m_pausedOwners.erase(it->first);
+        }
+
+        it = m_queuedPaused.erase(it);
+    }
+
+    for (auto it = m_slots.begin(); it != m_slots.end();) {
+        auto& [slotAddress, slot] = *it;
+
+        bool affected = false;
+        std::erase_if(slot.hooks, [&](Hook& hook) {
+            if (owner != kAllOwners && hook.owner != owner) {
+                return false;
+            }
+
+            affected = true;
+            if (removeAll || hook.queuedRemove) {
+                return true;
+            }
+
+            hook.applied = true;
+            return false;
+        });
+
+        if (affected) {
+            try {
+                UpdateSlot(slotAddress, slot);
+            } catch (const std::exception& e) {
+                LOG(L"Updating import at %p failed: %S", slotAddress,
+                    e.what());
+            }
+        }
+
+        if (slot.hooks.empty()) {
+            it = m_slots.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// static
+ImportHooks::ModuleImports ImportHooks::IndexModuleImports(HMODULE module) {
+    auto* imageBase = reinterpret_cast<BYTE*>(module);
+    auto* dosHeader = reinterpret_cast<const IMAGE_DOS_HEADER*>(imageBase);
+    auto* ntHeader = reinterpret_cast<const IMAGE_NT_HEADERS*>(
+        imageBase + dosHeader->e_lfanew);
+
+    ModuleImports moduleImports{
+        .timeDateStamp = ntHeader->FileHeader.TimeDateStamp,
+        .sizeOfImage = ntHeader->OptionalHeader.SizeOfImage,
+    };
+
+    if (ntHeader->OptionalHeader.NumberOfRvaAndSizes <=
+        IMAGE_DIRECTORY_ENTRY_IMPORT) {
+        return moduleImports;
+    }
+
+    const auto& importDirectory =
+        ntHeader->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT];
+    if (!importDirectory.VirtualAddress) {
+        return moduleImports;
+    }
+
+    for (auto* importDescriptor = reinterpret_cast<IMAGE_IMPORT_DESCRIPTOR*>(
+             imageBase + importDirectory.VirtualAddress);
+         importDescriptor->Name; importDescriptor++) {
+        // Without the name table, the names of the bound imports are unknown.
+        if (!importDescriptor->OriginalFirstThunk) {
+            continue;
+        }
+
+        PCSTR importDllName =
+            reinterpret_cast<PCSTR>(imageBase + importDescriptor->Name);
+
+        auto* nameThunk = reinterpret_cast<IMAGE_THUNK_DATA*>(
+            imageBase + importDescriptor->OriginalFirstThunk);
+        auto* addressThunk = reinterpret_cast<IMAGE_THUNK_DATA*>(
+            imageBase + importDescriptor->FirstThunk);
+        for (; nameThunk->u1.AddressOfData; nameThunk++, addressThunk++) {
+            PCSTR functionName;
+            if (IMAGE_SNAP_BY_ORDINAL(nameThunk->u1.Ordinal)) {
+                functionName = MAKEINTRESOURCEA(
+                    IMAGE_ORDINAL(nameThunk->u1.Ordinal));
+            } else {
+                functionName =
+                    reinterpret_cast<const IMAGE_IMPORT_BY_NAME*>(
+                        imageBase + nameThunk->u1.AddressOfData)
+                        ->Name;
+            }
+
+            // If a function is imported more than once, the first one wins,
+            // the same as a linear search.
+            moduleImports.slots.try_emplace(
+                MakeImportKey(importDllName, functionName),
+                reinterpret_cast<void**>(&addressThunk->u1.Function));
+        }
+    }
+
+    return moduleImports;
+}
+
+// static
+std::string ImportHooks::MakeImportKey(std::string_view dllName,
+                                       PCSTR functionName) {
+    std::string key(dllName);
+    std::ranges::transform(key, key.begin(), [](char c) {
+        return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+    });
+
+    key += '!';
+
+    if (IS_INTRESOURCE(functionName)) {
+        key += '#';
+        key += std::to_string(reinterpret_cast<ULONG_PTR>(functionName));
+    } else {
+        key += functionName;
+    }
+
+    return key;
+}
+
+// static
+void ImportHooks::WriteSlot(void** slotAddress, void* value) {
+    MEMORY_BASIC_INFORMATION memoryInfo;
+    THROW_LAST_ERROR_IF(!VirtualQuery(slotAddress, &memoryInfo,
+                                      sizeof(memoryInfo)));
+
+    constexpr DWORD kWritableProtect = PAGE_READWRITE | PAGE_WRITECOPY |
+                                       PAGE_EXECUTE_READWRITE |
+                                       PAGE_EXECUTE_WRITECOPY;
+    if (memoryInfo.Protect & kWritableProtect) {
+        InterlockedExchangePointer(slotAddress, value);
+        return;
+    }
+
+    // Keep the page executable if it was, in case code shares it.
+    constexpr DWORD kExecutableProtect =
+        PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE |
+        PAGE_EXECUTE_WRITECOPY;
+    DWORD newProtect = (memoryInfo.Protect & kExecutableProtect)
+                           ? PAGE_EXECUTE_READWRITE
+                           : PAGE_READWRITE;
+
+    DWORD oldProtect;
+    THROW_IF_WIN32_BOOL_FALSE(
+        VirtualProtect(slotAddress, sizeof(void*), newProtect, &oldProtect));
+
+    InterlockedExchangePointer(slotAddress, value);
+
+    VirtualProtect(slotAddress, sizeof(void*), oldProtect, &oldProtect);
+}
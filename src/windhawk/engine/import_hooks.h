@@ -0,0 +1,90 @@
+#pragma once
+
+// Hooks of imported functions, done by replacing the pointer in the import
+// address table (IAT) of the importing module instead of patching the code of
+// the function. Only calls from that module are affected, and no threads have
+// to be frozen, since a pointer-sized write is atomic.
+//
+// The imports of each module are indexed on first use, so that hooking
+// several functions of a module doesn't walk its import directory each time.
+// Operations are queued like MinHook hooks, per owner, and are applied
+// together with them. Several owners can hook the same import, in which case
+// the hooks are chained in the order in which they were applied, and the
+// original function pointers of the owners are updated whenever the chain
+// changes, so any hook can be removed without breaking the others. The
+// importing module is kept loaded while any of its imports is hooked.
+class ImportHooks {
+   public:
+    static constexpr ULONG_PTR kAllOwners = 0;
+
+    ImportHooks() = default;
+
+    ImportHooks(const ImportHooks&) = delete;
+    ImportHooks& operator=(const ImportHooks&) = delete;
+
+    static ImportHooks& GetInstance();
+
+    // functionName is either a name or an ordinal, as with GetProcAddress.
+    // dllName is compared case-insensitively. Returns false if the module
+    // doesn't import the function. *originalFunction is set right away, and
+    // is kept up to date once the hook is applied. Setting the same hook
+    // again, e.g. on a soft reload, keeps it, and setting a different hook for
+    // the same import by the same owner fails.
+    bool QueueSet(ULONG_PTR owner,
+                  HMODULE module,
+                  PCSTR dllName,
+                  PCSTR functionName,
+                  void* hookFunction,
+                  void** originalFunction);
+    // Queues the removal of all hooks of the owner, which are kept if they're
+    // set again before being applied.
+    void QueueRemoveAll(ULONG_PTR owner);
+    // While paused, the hooks of the owner stay registered but aren't called.
+    void QueueSetPaused(ULONG_PTR owner, bool paused);
+    void ApplyQueued(ULONG_PTR owner);
+    // Removes all hooks of the owner right away.
+    void RemoveAll(ULONG_PTR owner);
+    // Frees the import indexes of the modules. They're built again when
+    // needed, so this only costs time on the next hook operation.
+    void ReleaseImportIndexes();
+
+   private:
+    struct Hook {
+        ULONG_PTR owner;
+        void* hookFunction;
+        void** originalFunction;
+        bool applied = false;
+        bool queuedRemove = false;
+    };
+
+    struct Slot {
+        // Holds a reference, so that the slot stays valid.
+        wil::unique_hmodule module;
+        void* originalFunction;
+        // In the order of the chain, the first one is called last.
+        std::vector<Hook> hooks;
+    };
+
+    struct ModuleImports {
+        DWORD timeDateStamp;
+        DWORD sizeOfImage;
+        // Keyed by "dll!name" or "dll!#ordinal", with a lowercase DLL name.
+        std::unordered_map<std::string, void**> slots;
+    };
+
+    void** FindSlot(HMODULE module, PCSTR dllName, PCSTR functionName);
+    bool IsPaused(ULONG_PTR owner);
+    void UpdateSlot(void** slotAddress, Slot& slot);
+    void ApplyQueuedLocked(ULONG_PTR owner, bool removeAll);
+
+    static ModuleImports IndexModuleImports(HMODULE module);
+    static std::string MakeImportKey(std::string_view dllName,
+                                     PCSTR functionName);
+    static void WriteSlot(void** slotAddress, void* value);
+
+    std::mutex m_mutex;
+    std::unordered_map<HMODULE, ModuleImports> m_moduleImports;
+    std::unordered_map<void**, Slot> m_slots;
+    std::unordered_set<ULONG_PTR> m_pausedOwners;
+    std::unordered_map<ULONG_PTR, bool> m_queuedPaused;
+};
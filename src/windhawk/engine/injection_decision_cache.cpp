@@ -0,0 +1,56 @@
+#include "stdafx.h"
+
+#include "injection_decision_cache.h"
+
+namespace {
+
+// Paths are compared case-insensitively, the same way as in
+// Functions::DoesPathMatchPattern.
+std::wstring NormalizeImagePath(std::wstring_view imagePath) {
+    std::wstring result{imagePath};
+    LCMapStringEx(LOCALE_NAME_USER_DEFAULT, LCMAP_UPPERCASE, &result[0],
+                  wil::safe_cast<int>(result.length()), &result[0],
+                  wil::safe_cast<int>(result.length()), nullptr, nullptr, 0);
+    return result;
+}
+
+}  // namespace
+
+InjectionDecisionCache::InjectionDecisionCache(size_t capacity)
+    : m_capacity(capacity) {}
+
+InjectionDecisionCache::Decision InjectionDecisionCache::Get(
+    std::wstring_view imagePath,
+    const std::function<Decision()>& computeDecision) {
+    std::wstring key = NormalizeImagePath(imagePath);
+
+    {
+        std::lock_guard guard(m_mutex);
+
+        if (auto it = m_index.find(key); it != m_index.end()) {
+            m_entries.splice(m_entries.begin(), m_entries, it->second);
+            return it->second->second;
+        }
+    }
+
+    // Computed without holding the lock, so that other threads aren't blocked
+    // on the pattern matching. Concurrent misses for the same path compute the
+    // same decision, and only one of them is stored.
+    Decision decision = computeDecision();
+
+    std::lock_guard guard(m_mutex);
+
+    if (m_index.contains(key) || m_capacity == 0) {
+        return decision;
+    }
+
+    if (m_entries.size() >= m_capacity) {
+        m_index.erase(m_entries.back().first);
+        m_entries.pop_back();
+    }
+
+    m_entries.emplace_front(std::move(key), decision);
+    m_index.emplace(m_entries.front().first, m_entries.begin());
+
+    return decision;
+}
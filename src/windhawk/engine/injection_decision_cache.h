@@ -0,0 +1,36 @@
+#pragma once
+
+// Caches the include/exclude decisions of an injector per process image path.
+// The same executables, such as compilers, git and conhost, are started over
+// and over, and matching a path against all of the patterns is relatively
+// expensive. The decisions depend only on the patterns, which are fixed for the
+// lifetime of an injector, so a cache is owned by an injector and is dropped
+// together with it when the patterns change. Thread safe.
+class InjectionDecisionCache {
+   public:
+    struct Decision {
+        bool skip;
+        bool threadAttachExempt;
+    };
+
+    static constexpr size_t kDefaultCapacity = 256;
+
+    explicit InjectionDecisionCache(size_t capacity = kDefaultCapacity);
+
+    InjectionDecisionCache(const InjectionDecisionCache&) = delete;
+    InjectionDecisionCache& operator=(const InjectionDecisionCache&) = delete;
+
+    // Returns the cached decision for the image path, or calls computeDecision
+    // and caches its result, evicting the least recently used entry if full.
+    Decision Get(std::wstring_view imagePath,
+                 const std::function<Decision()>& computeDecision);
+
+   private:
+    using Entry = std::pair<std::wstring, Decision>;
+
+    // Most recently used first.
+    std::list<Entry> m_entries;
+    std::unordered_map<std::wstring_view, std::list<Entry>::iterator> m_index;
+    size_t m_capacity;
+    std::mutex m_mutex;
+};
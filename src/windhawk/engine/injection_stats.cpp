@@ -0,0 +1,543 @@
+#include "stdafx.h"
+
+#include "dll_inject.h"
+#include "functions.h"
+#include "injection_stats.h"
+#include "logger.h"
+#include "no_destructor.h"
+#include "session_private_namespace.h"
+#include "var_init_once.h"
+
+namespace {
+
+// Set by SetEngineLoadTimes, the engine is started once per process.
+LONGLONG g_engineLoadedTime;
+LONGLONG g_injectInitTime;
+
+}  // namespace
+
+// Opens the shared memory of the session manager once per process. Only the
+// first session manager is supported, a view is never replaced since it might
+// be in use by other threads.
+class InjectionStats::SharedDataCache {
+   public:
+    SharedData* Get(DWORD sessionManagerProcessId) noexcept {
+        std::lock_guard guard(m_mutex);
+
+        if (!m_opened) {
+            m_opened = true;
+            m_sessionManagerProcessId = sessionManagerProcessId;
+            Open();
+        }
+
+        if (sessionManagerProcessId != m_sessionManagerProcessId) {
+            return nullptr;
+        }
+
+        return m_view.get();
+    }
+
+   private:
+    void Open() noexcept {
+        try {
+            m_mapping.reset(OpenFileMapping(
+                FILE_MAP_READ | FILE_MAP_WRITE, FALSE,
+                InjectionStats::MakeName(m_sessionManagerProcessId).c_str()));
+            if (!m_mapping) {
+                VERBOSE(L"OpenFileMapping error: %u", GetLastError());
+                return;
+            }
+
+            wil::unique_mapview_ptr<SharedData> view(
+                reinterpret_cast<SharedData*>(MapViewOfFile(
+                    m_mapping.get(), FILE_MAP_READ | FILE_MAP_WRITE, 0, 0,
+                    sizeof(SharedData))));
+            if (!view) {
+                VERBOSE(L"MapViewOfFile error: %u", GetLastError());
+                return;
+            }
+
+            if (view->version != kVersion) {
+                VERBOSE(L"Unsupported injection stats version %u",
+                        view->version);
+                return;
+            }
+
+            m_view = std::move(view);
+        } catch (const std::exception& e) {
+            VERBOSE(L"Error: %S", e.what());
+        }
+    }
+
+    std::mutex m_mutex;
+    bool m_opened = false;
+    DWORD m_sessionManagerProcessId = 0;
+    wil::unique_handle m_mapping;
+    wil::unique_mapview_ptr<SharedData> m_view;
+};
+
+// static
+wil::unique_handle InjectionStats::Create() {
+    wil::unique_hlocal secDesc;
+    THROW_IF_WIN32_BOOL_FALSE(
+        Functions::GetFullAccessSecurityDescriptor(&secDesc, nullptr));
+
+    SECURITY_ATTRIBUTES secAttr = {sizeof(SECURITY_ATTRIBUTES)};
+    secAttr.lpSecurityDescriptor = secDesc.get();
+    secAttr.bInheritHandle = FALSE;
+
+    wil::unique_handle mapping(CreateFileMapping(
+        INVALID_HANDLE_VALUE, &secAttr, PAGE_READWRITE, 0, sizeof(SharedData),
+        MakeName(GetCurrentProcessId()).c_str()));
+    THROW_LAST_ERROR_IF(!mapping || GetLastError() == ERROR_ALREADY_EXISTS);
+
+    wil::unique_mapview_ptr<SharedData> view(
+        reinterpret_cast<SharedData*>(MapViewOfFile(
+            mapping.get(), FILE_MAP_WRITE, 0, 0, sizeof(SharedData))));
+    THROW_LAST_ERROR_IF(!view);
+
+    // The rest of the memory is zero-initialized.
+    view->version = kVersion;
+
+    return mapping;
+}
+
+// static
+LONGLONG InjectionStats::Now() noexcept {
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart;
+}
+
+// static
+ULONG64 InjectionStats::ThreadCycleTime() noexcept {
+    ULONG64 cycleTime = 0;
+    QueryThreadCycleTime(GetCurrentThread(), &cycleTime);
+    return cycleTime;
+}
+
+// static
+LONG InjectionStats::BeginInjection(DWORD sessionManagerProcessId,
+                                    DWORD processId,
+                                    LONGLONG discoveryTime,
+                                    ULONG64 discoveryCycleTime) noexcept {
+    SharedData* data = GetSharedData(sessionManagerProcessId);
+    if (!data) {
+        return -1;
+    }
+
+    ULONG index =
+        static_cast<ULONG>(InterlockedIncrement(&data->nextRecord)) - 1;
+    LONG slot = static_cast<LONG>(index % kRecordCount);
+
+    // The process ID is written last, since it's what the target process looks
+    // for.
+    Record& record = data->records[slot];
+    record.processId = 0;
+    MemoryBarrier();
+    record.discoveryTime = discoveryTime;
+    record.dataWrittenTime = 0;
+    record.engineLoadedTime = 0;
+    record.injectInitTime = 0;
+    record.engineStartTime = 0;
+    record.modsLoadedTime = 0;
+    record.injectorCycles = discoveryCycleTime;
+    record.engineCycles = 0;
+    memset(record.injectorStepsUs, 0, sizeof(record.injectorStepsUs));
+    record.flags = 0;
+    MemoryBarrier();
+    record.processId = processId;
+
+    return slot;
+}
+
+// static
+void InjectionStats::EndInjection(
+    DWORD sessionManagerProcessId,
+    LONG slot,
+    Outcome outcome,
+    const DllInject::StepTimes* stepTimes) noexcept {
+    SharedData* data = GetSharedData(sessionManagerProcessId);
+    if (!data) {
+        return;
+    }
+
+    InterlockedIncrement(&data->outcomeCounts[static_cast<size_t>(outcome)]);
+
+    if (slot < 0) {
+        return;
+    }
+
+    Record& record = data->records[slot];
+    if (outcome == Outcome::kInjected) {
+        record.injectorCycles = ThreadCycleTime() - record.injectorCycles;
+        record.dataWrittenTime = Now();
+
+        if (stepTimes) {
+            LARGE_INTEGER frequency;
+            QueryPerformanceFrequency(&frequency);
+
+            LONGLONG steps[] = {
+                stepTimes->prepare,  stepTimes->duplicateHandles,
+                stepTimes->allocate, stepTimes->write,
+                stepTimes->protect,  stepTimes->start,
+            };
+            static_assert(std::size(steps) == kInjectorStepCount);
+
+            for (size_t i = 0; i < kInjectorStepCount; i++) {
+                record.injectorStepsUs[i] = static_cast<DWORD>(
+                    std::min(steps[i] * 1000000 / frequency.QuadPart,
+                             LONGLONG{MAXDWORD}));
+            }
+        }
+    } else {
+        record.processId = 0;
+    }
+}
+
+// static
+void InjectionStats::RecordOutcome(DWORD sessionManagerProcessId,
+                                   Outcome outcome) noexcept {
+    EndInjection(sessionManagerProcessId, -1, outcome);
+}
+
+// static
+void InjectionStats::SetEngineLoadTimes(LONGLONG engineLoadedTime,
+                                        LONGLONG injectInitTime) noexcept {
+    g_engineLoadedTime = engineLoadedTime;
+    g_injectInitTime = injectInitTime;
+}
+
+// static
+void InjectionStats::RecordEngineStarted(DWORD sessionManagerProcessId,
+                                         LONGLONG engineStartTime,
+                                         ULONG64 engineStartCycleTime,
+                                         bool modsLoaded) noexcept {
+    SharedData* data = GetSharedData(sessionManagerProcessId);
+    if (!data) {
+        return;
+    }
+
+    LONGLONG modsLoadedTime = Now();
+    ULONG64 engineCycles = ThreadCycleTime() - engineStartCycleTime;
+    DWORD processId = GetCurrentProcessId();
+
+    // Look for the most recent record of this process.
+    ULONG next = static_cast<ULONG>(ReadAcquire(&data->nextRecord));
+    ULONG count = std::min(next, static_cast<ULONG>(kRecordCount));
+    for (ULONG i = 0; i < count; i++) {
+        Record& record = data->records[(next - 1 - i) % kRecordCount];
+        if (record.processId == processId && !record.engineStartTime) {
+            record.flags = modsLoaded ? kRecordFlagModsLoaded : 0;
+            record.engineCycles = engineCycles;
+            record.engineLoadedTime = g_engineLoadedTime;
+            record.injectInitTime = g_injectInitTime;
+            record.engineStartTime = engineStartTime;
+            record.modsLoadedTime = modsLoadedTime;
+            break;
+        }
+    }
+}
+
+// static
+std::wstring InjectionStats::GetReport(DWORD sessionManagerProcessId,
+                                       ReportFormat format) {
+    // The session manager has its namespace open already.
+    wil::unique_private_namespace_close privateNamespace;
+    if (sessionManagerProcessId != GetCurrentProcessId()) {
+        privateNamespace =
+            SessionPrivateNamespace::Open(sessionManagerProcessId);
+    }
+
+    wil::unique_handle mapping(OpenFileMapping(
+        FILE_MAP_READ, FALSE, MakeName(sessionManagerProcessId).c_str()));
+    THROW_LAST_ERROR_IF_NULL(mapping);
+
+    wil::unique_mapview_ptr<SharedData> view(reinterpret_cast<SharedData*>(
+        MapViewOfFile(mapping.get(), FILE_MAP_READ, 0, 0, sizeof(SharedData))));
+    THROW_LAST_ERROR_IF(!view);
+
+    // Copy the data, it keeps changing while being processed.
+    auto data = std::make_unique<SharedData>();
+    memcpy(data.get(), view.get(), sizeof(SharedData));
+
+    if (data->version != kVersion) {
+        throw std::runtime_error("Unsupported injection stats version");
+    }
+
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+
+    auto toMilliseconds = [&frequency](LONGLONG from, LONGLONG to) {
+        return static_cast<double>(to - from) * 1000.0 /
+               static_cast<double>(frequency.QuadPart);
+    };
+
+    struct Phase {
+        PCWSTR name;
+        std::vector<double> values;
+    };
+
+    Phase phases[] = {
+        {L"Discovery to remote data written"},
+        {L"Remote data written to engine start"},
+        {L"Engine start to mods loaded, no mods"},
+        {L"Engine start to mods loaded, with mods"},
+        {L"Discovery to engine start"},
+        {L"Total"},
+    };
+
+    // The parts of "Remote data written to engine start". The first one
+    // includes starting the remote thread or running the APC, the shellcode,
+    // and the loader until it calls DllMain of the engine, including waiting
+    // for the loader lock.
+    Phase loadPhases[] = {
+        {L"Remote data written to engine DLL loaded"},
+        {L"Engine DLL loaded to InjectInit"},
+        {L"InjectInit to engine start"},
+    };
+
+    Phase injectorSteps[] = {
+        {L"Prepare"},
+        {L"Duplicate handles"},
+        {L"Allocate remote memory"},
+        {L"Write remote memory"},
+        {L"Protect remote memory"},
+        {L"Create remote thread or queue APC"},
+    };
+    static_assert(std::size(injectorSteps) == kInjectorStepCount);
+
+    Phase enginePhases[] = {
+        {L"No mods"},
+        {L"With mods"},
+    };
+
+    std::vector<double> injectorCycles;
+    LONGLONG firstDiscoveryTime = 0;
+    LONGLONG lastDataWrittenTime = 0;
+    size_t dataWrittenCount = 0;
+
+    for (const auto& record : data->records) {
+        if (!record.processId || !record.discoveryTime) {
+            continue;
+        }
+
+        // The injected code might start running before the injector records
+        // that the data was written, such phases are skipped.
+        if (record.dataWrittenTime >= record.discoveryTime) {
+            phases[0].values.push_back(
+                toMilliseconds(record.discoveryTime, record.dataWrittenTime));
+
+            // Only valid once the data was written.
+            injectorCycles.push_back(
+                static_cast<double>(record.injectorCycles) / 1000.0);
+
+            if (!firstDiscoveryTime ||
+                record.discoveryTime < firstDiscoveryTime) {
+                firstDiscoveryTime = record.discoveryTime;
+            }
+
+            lastDataWrittenTime =
+                std::max(lastDataWrittenTime, record.dataWrittenTime);
+            dataWrittenCount++;
+
+            for (size_t i = 0; i < kInjectorStepCount; i++) {
+                injectorSteps[i].values.push_back(record.injectorStepsUs[i]);
+            }
+        }
+
+        // Not set if the engine was started in another way.
+        if (record.dataWrittenTime && record.engineLoadedTime &&
+            record.injectInitTime >= record.engineLoadedTime &&
+            record.engineStartTime >= record.injectInitTime) {
+            if (record.engineLoadedTime >= record.dataWrittenTime) {
+                loadPhases[0].values.push_back(toMilliseconds(
+                    record.dataWrittenTime, record.engineLoadedTime));
+            }
+
+            loadPhases[1].values.push_back(toMilliseconds(
+                record.engineLoadedTime, record.injectInitTime));
+            loadPhases[2].values.push_back(
+                toMilliseconds(record.injectInitTime, record.engineStartTime));
+        }
+
+        if (record.dataWrittenTime &&
+            record.engineStartTime >= record.dataWrittenTime) {
+            phases[1].values.push_back(
+                toMilliseconds(record.dataWrittenTime, record.engineStartTime));
+        }
+
+        if (record.engineStartTime &&
+            record.modsLoadedTime >= record.engineStartTime) {
+            size_t modsIndex = (record.flags & kRecordFlagModsLoaded) ? 1 : 0;
+            phases[2 + modsIndex].values.push_back(
+                toMilliseconds(record.engineStartTime, record.modsLoadedTime));
+            enginePhases[modsIndex].values.push_back(
+                static_cast<double>(record.engineCycles) / 1000.0);
+        }
+
+        if (record.engineStartTime >= record.discoveryTime) {
+            phases[4].values.push_back(
+                toMilliseconds(record.discoveryTime, record.engineStartTime));
+        }
+
+        if (record.modsLoadedTime >= record.discoveryTime) {
+            phases[5].values.push_back(
+                toMilliseconds(record.discoveryTime, record.modsLoadedTime));
+        }
+    }
+
+    auto outcomeCount = [&data](Outcome outcome) {
+        return data->outcomeCounts[static_cast<size_t>(outcome)];
+    };
+
+    struct Section {
+        PCWSTR name;
+        PCWSTR unit;
+        std::span<Phase> phases;
+    };
+
+    Phase injectorCpuPhases[] = {
+        {L"Discovery to remote data written", std::move(injectorCycles)},
+    };
+
+    Section sections[] = {
+        {L"Last injections", L"milliseconds", phases},
+        {L"Remote data written to engine start", L"milliseconds", loadPhases},
+        {L"Injector steps", L"microseconds", injectorSteps},
+        {L"Injector CPU time", L"thousands of cycles", injectorCpuPhases},
+        {L"Engine CPU time until mods loaded", L"thousands of cycles",
+         enginePhases},
+    };
+
+    // Only meaningful if the processes were created in a burst, otherwise it's
+    // bounded by how often processes are created.
+    double rateSeconds = 0;
+    if (dataWrittenCount > 1 && lastDataWrittenTime > firstDiscoveryTime) {
+        rateSeconds =
+            toMilliseconds(firstDiscoveryTime, lastDataWrittenTime) / 1000.0;
+    }
+
+    std::wstring report;
+    WCHAR line[256];
+
+    if (format == ReportFormat::kJson) {
+        swprintf_s(line,
+                   L"{\"version\":1,\"outcomes\":{\"injected\":%ld,"
+                   L"\"skipped\":%ld,\"processTerminating\":%ld,"
+                   L"\"accessDenied\":%ld,\"failed\":%ld},\"sections\":[",
+                   outcomeCount(Outcome::kInjected),
+                   outcomeCount(Outcome::kSkipped),
+                   outcomeCount(Outcome::kProcessTerminating),
+                   outcomeCount(Outcome::kAccessDenied),
+                   outcomeCount(Outcome::kFailed));
+        report += line;
+    } else {
+        swprintf_s(line, L"Injected: %ld, skipped: %ld\n",
+                   outcomeCount(Outcome::kInjected),
+                   outcomeCount(Outcome::kSkipped));
+        report += line;
+
+        swprintf_s(line,
+                   L"Failed: process terminating: %ld, access denied: %ld, "
+                   L"other: %ld\n",
+                   outcomeCount(Outcome::kProcessTerminating),
+                   outcomeCount(Outcome::kAccessDenied),
+                   outcomeCount(Outcome::kFailed));
+        report += line;
+    }
+
+    // The names are constants without characters which need escaping in JSON.
+    auto appendPercentiles = [format, &report, &line](
+                                 PCWSTR name, std::vector<double>& values) {
+        std::sort(values.begin(), values.end());
+
+        auto percentile = [&values](size_t percent) {
+            return values[std::min(values.size() - 1,
+                                   values.size() * percent / 100)];
+        };
+
+        if (format == ReportFormat::kJson) {
+            if (values.empty()) {
+                swprintf_s(line, L"{\"name\":\"%s\",\"count\":0}", name);
+            } else {
+                swprintf_s(line,
+                           L"{\"name\":\"%s\",\"count\":%zu,\"p50\":%.3f,"
+                           L"\"p90\":%.3f,\"p99\":%.3f,\"max\":%.3f}",
+                           name, values.size(), percentile(50),
+                           percentile(90), percentile(99), values.back());
+            }
+        } else if (values.empty()) {
+            swprintf_s(line, L"%s: no data\n", name);
+        } else {
+            swprintf_s(line,
+                       L"%s (%zu): p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n",
+                       name, values.size(), percentile(50), percentile(90),
+                       percentile(99), values.back());
+        }
+
+        report += line;
+    };
+
+    for (size_t i = 0; i < std::size(sections); i++) {
+        const auto& section = sections[i];
+
+        if (format == ReportFormat::kJson) {
+            swprintf_s(line, L"%s{\"name\":\"%s\",\"unit\":\"%s\",\"phases\":[",
+                       i > 0 ? L"," : L"", section.name, section.unit);
+            report += line;
+        } else {
+            swprintf_s(line, L"\n%s, in %s:\n", section.name, section.unit);
+            report += line;
+        }
+
+        for (size_t j = 0; j < section.phases.size(); j++) {
+            if (format == ReportFormat::kJson && j > 0) {
+                report += L',';
+            }
+
+            appendPercentiles(section.phases[j].name,
+                              section.phases[j].values);
+        }
+
+        if (format == ReportFormat::kJson) {
+            report += L"]}";
+        }
+    }
+
+    if (format == ReportFormat::kJson) {
+        swprintf_s(line,
+                   L"],\"rate\":{\"injectionsPerSecond\":%.3f,"
+                   L"\"seconds\":%.3f}}",
+                   rateSeconds
+                       ? static_cast<double>(dataWrittenCount) / rateSeconds
+                       : 0.0,
+                   rateSeconds);
+        report += line;
+    } else if (rateSeconds) {
+        swprintf_s(line, L"\nRate: %.1f injections/s over %.1f s\n",
+                   static_cast<double>(dataWrittenCount) / rateSeconds,
+                   rateSeconds);
+        report += line;
+    }
+
+    return report;
+}
+
+// static
+std::wstring InjectionStats::MakeName(DWORD sessionManagerProcessId) {
+    WCHAR szName[SessionPrivateNamespace::kPrivateNamespaceMaxLen +
+                 sizeof("\\InjectionStats")];
+    int namePos =
+        SessionPrivateNamespace::MakeName(szName, sessionManagerProcessId);
+    swprintf_s(szName + namePos, ARRAYSIZE(szName) - namePos,
+               L"\\InjectionStats");
+    return szName;
+}
+
+// static
+InjectionStats::SharedData* InjectionStats::GetSharedData(
+    DWORD sessionManagerProcessId) noexcept {
+    STATIC_INIT_ONCE(NoDestructorIfTerminating<SharedDataCache>, cache);
+    return (**cache).Get(sessionManagerProcessId);
+}
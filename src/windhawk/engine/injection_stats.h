@@ -0,0 +1,128 @@
+#pragma once
+
+namespace DllInject {
+struct StepTimes;
+}  // namespace DllInject
+
+// Per-process injection timings and outcome counts, kept in shared memory which
+// is owned by the session manager process. Injectors record when a process was
+// discovered and when the remote data was written to it, and the engine in the
+// target process records when it started and when the mods were loaded. The
+// timestamps are QueryPerformanceCounter values, which are comparable across
+// processes. The CPU time spent by the injector on each injection is also
+// recorded, as the cycle time of the injecting thread, and so is the CPU time
+// spent by the engine until the mods are loaded, separately for processes
+// without mods to load, so that the overhead of the engine alone can be told
+// apart from that of the mods. The time of each step of DllInject is recorded
+// too, as well as when the engine DLL was loaded and when InjectInit was called
+// in the target process, to tell the injector, the loader and the engine
+// initialization apart. The last kRecordCount injections are kept. Recording
+// never throws, and is silently skipped if the shared memory isn't available.
+class InjectionStats {
+   public:
+    enum class Outcome {
+        kInjected,
+        kSkipped,
+        kProcessTerminating,
+        kAccessDenied,
+        kFailed,
+        kCount,
+    };
+
+    enum class ReportFormat {
+        kText,
+        // A single JSON object with the same data, with stable names, so that
+        // reports can be compared by tools, e.g. across versions.
+        kJson,
+    };
+
+    static constexpr size_t kRecordCount = 1024;
+
+    InjectionStats() = delete;
+
+    // Must be called by the session manager after creating its private
+    // namespace. The shared memory exists as long as the handle is open.
+    static wil::unique_handle Create();
+
+    static LONGLONG Now() noexcept;
+    // The cycle time of the current thread, to be passed to BeginInjection
+    // along with the discovery time.
+    static ULONG64 ThreadCycleTime() noexcept;
+
+    // Returns a slot to be passed to EndInjection, or -1 if the injection isn't
+    // recorded. Must be called before the remote code might run, so that the
+    // target process can find the record. EndInjection must be called on the
+    // same thread, since the injector's CPU time is measured with the thread
+    // cycle time.
+    static LONG BeginInjection(DWORD sessionManagerProcessId,
+                               DWORD processId,
+                               LONGLONG discoveryTime,
+                               ULONG64 discoveryCycleTime) noexcept;
+    static void EndInjection(DWORD sessionManagerProcessId,
+                             LONG slot,
+                             Outcome outcome,
+                             const DllInject::StepTimes* stepTimes =
+                                 nullptr) noexcept;
+
+    // For outcomes of processes which weren't injected into, such as excluded
+    // processes.
+    static void RecordOutcome(DWORD sessionManagerProcessId,
+                              Outcome outcome) noexcept;
+
+    // Called in the target process by InjectInit, the times are recorded by
+    // RecordEngineStarted.
+    static void SetEngineLoadTimes(LONGLONG engineLoadedTime,
+                                   LONGLONG injectInitTime) noexcept;
+
+    // Called in the target process once the mods are loaded, on the thread
+    // which started the engine.
+    static void RecordEngineStarted(DWORD sessionManagerProcessId,
+                                    LONGLONG engineStartTime,
+                                    ULONG64 engineStartCycleTime,
+                                    bool modsLoaded) noexcept;
+
+    // Returns a human readable summary with percentiles of each phase, of the
+    // injector steps, the injector's CPU time and the injection rate.
+    static std::wstring GetReport(DWORD sessionManagerProcessId,
+                                  ReportFormat format = ReportFormat::kText);
+
+   private:
+    static constexpr DWORD kVersion = 4;
+
+    static constexpr DWORD kRecordFlagModsLoaded = 0x01;
+
+    // The fields of DllInject::StepTimes.
+    static constexpr size_t kInjectorStepCount = 6;
+
+    // The layout must be the same for 32-bit and 64-bit processes.
+    struct Record {
+        DWORD processId;
+        DWORD flags;
+        LONGLONG discoveryTime;
+        LONGLONG dataWrittenTime;
+        // When DllMain of the engine was called, i.e. once the loader mapped
+        // it.
+        LONGLONG engineLoadedTime;
+        LONGLONG injectInitTime;
+        LONGLONG engineStartTime;
+        LONGLONG modsLoadedTime;
+        // While BeginInjection wasn't matched by EndInjection, the cycle time
+        // of the injecting thread at discovery. Then, the cycles spent.
+        ULONG64 injectorCycles;
+        ULONG64 engineCycles;
+        // In microseconds.
+        DWORD injectorStepsUs[kInjectorStepCount];
+    };
+
+    struct SharedData {
+        DWORD version;
+        LONG nextRecord;
+        LONG outcomeCounts[static_cast<size_t>(Outcome::kCount)];
+        Record records[kRecordCount];
+    };
+
+    class SharedDataCache;
+
+    static std::wstring MakeName(DWORD sessionManagerProcessId);
+    static SharedData* GetSharedData(DWORD sessionManagerProcessId) noexcept;
+};
@@ -22,6 +22,9 @@ typedef struct _HOOK_ENTRY
     LPVOID pTrampolineToFree;
     UINT8 isEnabled : 1;
     UINT8 queueEnable : 1;
+    UINT8 isSelected : 1;   // Part of the apply operation in progress.
+    UINT8 applyEnable : 1;  // The state to apply if selected.
+    UINT chainSequence;     // The order in the chain of the target's hooks.
     HRESULT bulkLastError;
 } HOOK_ENTRY, *PHOOK_ENTRY;
 
@@ -32,6 +35,9 @@ static BOOL g_initialized = FALSE;
 // Thread freeze related variables.
 static MH_THREAD_FREEZE_METHOD g_threadFreezeMethod = MH_FREEZE_METHOD_ORIGINAL;
 
+// Incremented for each enabled hook, to order the chains of hooks.
+static UINT g_chainSequence = 0;
+
 // Bulk operation related variables.
 static BOOL g_bulkContinueOnError = FALSE;
 static MH_ERROR_CALLBACK g_bulkErrorCallback = NULL;
@@ -78,21 +84,37 @@ static UINT FindHookEntryEnabled(ULONG_PTR hookIdent, LPVOID pTarget, UINT pos,
     return i;
 }
 
-static UINT FindHookEntryQueued(ULONG_PTR hookIdent, LPVOID pTarget, UINT pos)
+// Returns the index of the first identifier which matches the hook, or
+// INVALID_HOOK_POS.
+static UINT FindMatchingIdent(PHOOK_ENTRY pHook, const ULONG_PTR *hookIdents, UINT count)
 {
-    UINT i = FindHookEntry(hookIdent, pTarget, pos);
-    while (i != INVALID_HOOK_POS)
+    UINT i;
+    for (i = 0; i < count; ++i)
     {
-        PHOOK_ENTRY pHook = &g_hooks.pItems[i];
-        if (pHook->queueEnable != pHook->isEnabled)
+        if (hookIdents[i] == MH_ALL_IDENTS || hookIdents[i] == pHook->hookIdent)
         {
-            break;
+            return i;
         }
+    }
 
-        i = FindHookEntry(hookIdent, pTarget, i + 1);
+    return INVALID_HOOK_POS;
+}
+
+// Returns INVALID_HOOK_POS if not found.
+static UINT FindHookEntryQueuedMulti(const ULONG_PTR *hookIdents, UINT count, UINT pos)
+{
+    UINT i;
+    for (i = pos; i < g_hooks.size; ++i)
+    {
+        PHOOK_ENTRY pHook = &g_hooks.pItems[i];
+        if (pHook->queueEnable != pHook->isEnabled &&
+            FindMatchingIdent(pHook, hookIdents, count) != INVALID_HOOK_POS)
+        {
+            return i;
+        }
     }
 
-    return i;
+    return INVALID_HOOK_POS;
 }
 
 static PHOOK_ENTRY AddHookEntry()
@@ -159,24 +181,178 @@ static HRESULT MHDetoursTransactionBegin()
 {
     DETOUR_TRANSACTION_OPTIONS options = {
         .fSuspendThreads = g_threadFreezeMethod != MH_FREEZE_METHOD_NONE_UNSAFE,
+        // Keep the threads running while the trampolines are prepared, only
+        // suspend them while the target code is written.
+        .fDeferThreadSuspension = TRUE,
     };
     return SlimDetoursTransactionBeginEx(&options);
 }
 
-static HRESULT MHDetoursAttach(PHOOK_ENTRY pHook)
+static LPVOID *GetOriginalPointer(PHOOK_ENTRY pHook)
 {
-    FreeHookTrampolineIfNeeded(pHook);
-    LPVOID ppOriginal = pHook->ppOriginal ? pHook->ppOriginal : &pHook->pTargetOrTrampoline;
-    return SlimDetoursAttach(ppOriginal, pHook->pDetour);
+    return pHook->ppOriginal ? pHook->ppOriginal : &pHook->pTargetOrTrampoline;
 }
 
-static HRESULT MHDetoursDetach(PHOOK_ENTRY pHook)
+// Returns whether the hook is enabled once the apply operation in progress
+// is committed.
+static BOOL IsEnabledAfterApply(PHOOK_ENTRY pHook)
 {
-    LPVOID ppOriginal = pHook->ppOriginal ? pHook->ppOriginal : &pHook->pTargetOrTrampoline;
-    DETOUR_DETACH_OPTIONS options = {
-        .ppTrampolineToFreeManually = &pHook->pTrampolineToFree,
-    };
-    return SlimDetoursDetachEx(ppOriginal, pHook->pDetour, &options);
+    if (pHook->isSelected && SUCCEEDED(pHook->bulkLastError))
+        return pHook->applyEnable;
+
+    return pHook->isEnabled;
+}
+
+// Fills pChain with the positions of the enabled hooks of the target, before
+// or after the apply operation in progress, and returns their amount. The
+// hooks are ordered from the first enabled one, which calls the trampoline, to
+// the last enabled one, which the target jumps to. pChain must have room for
+// all hooks.
+static UINT GetTargetChain(LPVOID pTarget, BOOL afterApply, UINT *pChain)
+{
+    UINT count = 0;
+    UINT i;
+    for (i = 0; i < g_hooks.size; ++i)
+    {
+        PHOOK_ENTRY pHook = &g_hooks.pItems[i];
+        if (pHook->pTarget != pTarget)
+            continue;
+
+        if (!(afterApply ? IsEnabledAfterApply(pHook) : pHook->isEnabled))
+            continue;
+
+        // Insertion sort, chains are short.
+        UINT j = count++;
+        while (j > 0 && g_hooks.pItems[pChain[j - 1]].chainSequence > pHook->chainSequence)
+        {
+            pChain[j] = pChain[j - 1];
+            j--;
+        }
+
+        pChain[j] = i;
+    }
+
+    return count;
+}
+
+// Points the original function of each hook of the chain to the hook before
+// it, and of the first hook to the trampoline. If newOnly is set, only the
+// hooks which aren't enabled yet are linked, which is safe before the commit
+// since they can't be called yet. A NULL trampoline means that Detours sets
+// it on commit.
+static VOID LinkTargetChain(const UINT *pChain, UINT count, LPVOID pTrampoline, BOOL newOnly)
+{
+    UINT i;
+    for (i = 0; i < count; ++i)
+    {
+        PHOOK_ENTRY pHook = &g_hooks.pItems[pChain[i]];
+        if (newOnly && pHook->isEnabled)
+            continue;
+
+        LPVOID pOriginal = i > 0 ? g_hooks.pItems[pChain[i - 1]].pDetour : pTrampoline;
+        if (pOriginal == NULL)
+            continue;
+
+        // Other threads might be calling the hook, each value along the way
+        // is valid.
+        LPVOID *ppOriginal = GetOriginalPointer(pHook);
+        if (*ppOriginal != pOriginal)
+            InterlockedExchangePointer(ppOriginal, pOriginal);
+    }
+}
+
+// Queues the Detours operations for the changes of the target's hooks. The
+// target is only patched when its first hook is enabled or its last hook is
+// disabled, otherwise the trampoline is made to jump to the new last hook.
+// That way, a call goes through a single patch and a single trampoline no
+// matter how many hooks the target has, and the order of the hooks doesn't
+// depend on how their patches were stacked.
+static HRESULT PrepareTargetChain(LPVOID pTarget, UINT *pBefore, UINT *pAfter)
+{
+    UINT beforeCount = GetTargetChain(pTarget, FALSE, pBefore);
+    UINT afterCount = GetTargetChain(pTarget, TRUE, pAfter);
+    LPVOID pTrampoline = NULL;
+    HRESULT hr = S_OK;
+
+    if (beforeCount == 0 && afterCount > 0)
+    {
+        PHOOK_ENTRY pFirst = &g_hooks.pItems[pAfter[0]];
+        PHOOK_ENTRY pLast = &g_hooks.pItems[pAfter[afterCount - 1]];
+
+        // The trampoline is stored in the original pointer of the first hook
+        // on commit.
+        FreeHookTrampolineIfNeeded(pFirst);
+        hr = SlimDetoursAttach(GetOriginalPointer(pFirst), pLast->pDetour);
+    }
+    else if (beforeCount > 0 && afterCount == 0)
+    {
+        PHOOK_ENTRY pFirst = &g_hooks.pItems[pBefore[0]];
+        PHOOK_ENTRY pLast = &g_hooks.pItems[pBefore[beforeCount - 1]];
+
+        // Threads might still be running the trampoline from the first hook,
+        // so it's freed with it.
+        DETOUR_DETACH_OPTIONS options = {
+            .ppTrampolineToFreeManually = &pFirst->pTrampolineToFree,
+        };
+        hr = SlimDetoursDetachEx(GetOriginalPointer(pFirst), pLast->pDetour, &options);
+    }
+    else if (beforeCount > 0 && afterCount > 0)
+    {
+        PHOOK_ENTRY pLastBefore = &g_hooks.pItems[pBefore[beforeCount - 1]];
+        PHOOK_ENTRY pLastAfter = &g_hooks.pItems[pAfter[afterCount - 1]];
+
+        pTrampoline = *GetOriginalPointer(&g_hooks.pItems[pBefore[0]]);
+        if (pLastAfter != pLastBefore)
+        {
+            hr = SlimDetoursSetDetour(pTrampoline, pLastAfter->pDetour);
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        LinkTargetChain(pAfter, afterCount, pTrampoline, TRUE);
+    }
+
+    return hr;
+}
+
+// Called after the commit, before the hook states are updated. Links the hooks
+// which stay enabled, and points the hooks which were disabled to the target,
+// like Detours does with a detached hook.
+static VOID FinishTargetChain(LPVOID pTarget, UINT *pBefore, UINT *pAfter)
+{
+    UINT beforeCount = GetTargetChain(pTarget, FALSE, pBefore);
+    UINT afterCount = GetTargetChain(pTarget, TRUE, pAfter);
+    UINT i;
+
+    if (afterCount > 0)
+    {
+        UINT trampolineHolder = beforeCount > 0 ? pBefore[0] : pAfter[0];
+        LPVOID pTrampoline = *GetOriginalPointer(&g_hooks.pItems[trampolineHolder]);
+        LinkTargetChain(pAfter, afterCount, pTrampoline, FALSE);
+    }
+
+    for (i = 0; i < beforeCount; ++i)
+    {
+        PHOOK_ENTRY pHook = &g_hooks.pItems[pBefore[i]];
+        if (!IsEnabledAfterApply(pHook))
+            InterlockedExchangePointer(GetOriginalPointer(pHook), pTarget);
+    }
+}
+
+// Returns whether the hook at pos is the first selected hook of its target,
+// so that each target is handled once.
+static BOOL IsFirstSelectedOfTarget(UINT pos)
+{
+    UINT i;
+    for (i = 0; i < pos; ++i)
+    {
+        PHOOK_ENTRY pHook = &g_hooks.pItems[i];
+        if (pHook->isSelected && pHook->pTarget == g_hooks.pItems[pos].pTarget)
+            return FALSE;
+    }
+
+    return TRUE;
 }
 
 static MH_STATUS CreateHook(ULONG_PTR hookIdent, LPVOID pTarget, LPVOID pDetour, LPVOID *ppOriginal)
@@ -241,6 +417,9 @@ static MH_STATUS CreateHook(ULONG_PTR hookIdent, LPVOID pTarget, LPVOID pDetour,
             pHook->pTrampolineToFree = NULL;
             pHook->isEnabled = FALSE;
             pHook->queueEnable = FALSE;
+            pHook->isSelected = FALSE;
+            pHook->applyEnable = FALSE;
+            pHook->chainSequence = 0;
             pHook->bulkLastError = S_OK;
         }
         else
@@ -252,83 +431,29 @@ static MH_STATUS CreateHook(ULONG_PTR hookIdent, LPVOID pTarget, LPVOID pDetour,
     return status;
 }
 
-static MH_STATUS EnableHook(ULONG_PTR hookIdent, LPVOID pTarget, BOOL enable)
+static void RemoveDisabledHooks(ULONG_PTR hookIdent, LPVOID pTarget)
+{
+    UINT pos = FindHookEntryEnabled(hookIdent, pTarget, 0, FALSE);
+    while (pos != INVALID_HOOK_POS)
+    {
+        FreeHookTrampolineIfNeeded(&g_hooks.pItems[pos]);
+        DeleteHookEntry(pos);
+        pos = FindHookEntryEnabled(hookIdent, pTarget, pos, FALSE);
+    }
+}
+
+static MH_STATUS QueueHook(ULONG_PTR hookIdent, LPVOID pTarget, BOOL queueEnable)
 {
     MH_STATUS status = MH_OK;
-    HRESULT hr;
 
     if (hookIdent == MH_ALL_IDENTS || pTarget == MH_ALL_HOOKS)
     {
-        UINT pos = FindHookEntryEnabled(hookIdent, pTarget, 0, !enable);
-        if (pos != INVALID_HOOK_POS)
+        UINT pos = FindHookEntry(hookIdent, pTarget, 0);
+        while (pos != INVALID_HOOK_POS)
         {
-            hr = MHDetoursTransactionBegin();
-            if (SUCCEEDED(hr))
-            {
-                do
-                {
-                    PHOOK_ENTRY pHook = &g_hooks.pItems[pos];
-
-                    if (enable)
-                    {
-                        hr = MHDetoursAttach(pHook);
-                    }
-                    else
-                    {
-                        hr = MHDetoursDetach(pHook);
-                    }
-
-                    pHook->bulkLastError = hr;
-
-                    if (g_bulkContinueOnError)
-                    {
-                        hr = S_OK;
-                    }
-                    else if (FAILED(hr))
-                    {
-                        break;
-                    }
-
-                    pos = FindHookEntryEnabled(hookIdent, pTarget, pos + 1, !enable);
-                } while (pos != INVALID_HOOK_POS);
-
-                if (SUCCEEDED(hr))
-                {
-                    hr = SlimDetoursTransactionCommit();
-                    if (SUCCEEDED(hr))
-                    {
-                        UINT pos = FindHookEntryEnabled(hookIdent, pTarget, 0, !enable);
-                        while (pos != INVALID_HOOK_POS)
-                        {
-                            PHOOK_ENTRY pHook = &g_hooks.pItems[pos];
-                            if (SUCCEEDED(pHook->bulkLastError))
-                            {
-                                pHook->isEnabled = enable;
-                                pHook->queueEnable = enable;
-                            }
-                            else if (g_bulkErrorCallback)
-                            {
-                                g_bulkErrorCallback(pHook->pTarget, pHook->bulkLastError);
-                                status = MH_ERROR_PARTIAL_FAILURE;
-                            }
-                            pos = FindHookEntryEnabled(hookIdent, pTarget, pos + 1, !enable);
-                        }
-                    }
-                    else
-                    {
-                        status = MH_ERROR_DETOURS_TRANSACTION_COMMIT;
-                    }
-                }
-                else
-                {
-                    status = MH_ERROR_UNSUPPORTED_FUNCTION;
-                    SlimDetoursTransactionAbort();
-                }
-            }
-            else
-            {
-                status = MH_ERROR_DETOURS_TRANSACTION_BEGIN;
-            }
+            PHOOK_ENTRY pHook = &g_hooks.pItems[pos];
+            pHook->queueEnable = queueEnable;
+            pos = FindHookEntry(hookIdent, pTarget, pos + 1);
         }
     }
     else
@@ -337,48 +462,7 @@ static MH_STATUS EnableHook(ULONG_PTR hookIdent, LPVOID pTarget, BOOL enable)
         if (pos != INVALID_HOOK_POS)
         {
             PHOOK_ENTRY pHook = &g_hooks.pItems[pos];
-            if (pHook->isEnabled != enable)
-            {
-                hr = MHDetoursTransactionBegin();
-                if (SUCCEEDED(hr))
-                {
-                    if (enable)
-                    {
-                        hr = MHDetoursAttach(pHook);
-                    }
-                    else
-                    {
-                        hr = MHDetoursDetach(pHook);
-                    }
-
-                    if (SUCCEEDED(hr))
-                    {
-                        hr = SlimDetoursTransactionCommit();
-                        if (SUCCEEDED(hr))
-                        {
-                            pHook->isEnabled = enable;
-                            pHook->queueEnable = enable;
-                        }
-                        else
-                        {
-                            status = MH_ERROR_DETOURS_TRANSACTION_COMMIT;
-                        }
-                    }
-                    else
-                    {
-                        status = MH_ERROR_UNSUPPORTED_FUNCTION;
-                        SlimDetoursTransactionAbort();
-                    }
-                }
-                else
-                {
-                    status = MH_ERROR_DETOURS_TRANSACTION_BEGIN;
-                }
-            }
-            else
-            {
-                status = enable ? MH_ERROR_ENABLED : MH_ERROR_DISABLED;
-            }
+            pHook->queueEnable = queueEnable;
         }
         else
         {
@@ -389,127 +473,230 @@ static MH_STATUS EnableHook(ULONG_PTR hookIdent, LPVOID pTarget, BOOL enable)
     return status;
 }
 
-static void RemoveDisabledHooks(ULONG_PTR hookIdent, LPVOID pTarget)
+static VOID SetAllStatuses(MH_STATUS *statuses, UINT count, MH_STATUS status)
 {
-    UINT pos = FindHookEntryEnabled(hookIdent, pTarget, 0, FALSE);
-    while (pos != INVALID_HOOK_POS)
+    UINT i;
+    if (statuses != NULL)
     {
-        FreeHookTrampolineIfNeeded(&g_hooks.pItems[pos]);
-        DeleteHookEntry(pos);
-        pos = FindHookEntryEnabled(hookIdent, pTarget, pos, FALSE);
+        for (i = 0; i < count; ++i)
+        {
+            statuses[i] = status;
+        }
     }
 }
 
-static MH_STATUS QueueHook(ULONG_PTR hookIdent, LPVOID pTarget, BOOL queueEnable)
+// Applies the changes of the selected hooks to applyEnable in a single
+// transaction, and clears the selection. If statuses isn't NULL, it receives
+// the status of each of the given identifiers.
+static MH_STATUS ApplySelected(const ULONG_PTR *hookIdents, UINT count, MH_STATUS *statuses)
 {
     MH_STATUS status = MH_OK;
+    HRESULT hr;
+    UINT pos;
 
-    if (hookIdent == MH_ALL_IDENTS || pTarget == MH_ALL_HOOKS)
+    SetAllStatuses(statuses, count, MH_OK);
+
+    UINT *pChains = (UINT *)HeapAlloc(GetProcessHeap(), 0, g_hooks.size * 2 * sizeof(UINT));
+    if (pChains == NULL)
     {
-        UINT pos = FindHookEntry(hookIdent, pTarget, 0);
-        while (pos != INVALID_HOOK_POS)
+        status = MH_ERROR_MEMORY_ALLOC;
+        SetAllStatuses(statuses, count, status);
+        goto cleanup;
+    }
+
+    UINT *pBefore = pChains;
+    UINT *pAfter = pChains + g_hooks.size;
+
+    for (pos = 0; pos < g_hooks.size; ++pos)
+    {
+        PHOOK_ENTRY pHook = &g_hooks.pItems[pos];
+        if (pHook->isSelected)
         {
-            PHOOK_ENTRY pHook = &g_hooks.pItems[pos];
-            pHook->queueEnable = queueEnable;
-            pos = FindHookEntry(hookIdent, pTarget, pos + 1);
+            pHook->bulkLastError = S_OK;
+
+            // Newly enabled hooks are added at the end of the chain.
+            if (pHook->applyEnable)
+                pHook->chainSequence = ++g_chainSequence;
+        }
+    }
+
+    hr = MHDetoursTransactionBegin();
+    if (FAILED(hr))
+    {
+        status = MH_ERROR_DETOURS_TRANSACTION_BEGIN;
+        SetAllStatuses(statuses, count, status);
+        goto cleanup;
+    }
+
+    for (pos = 0; pos < g_hooks.size; ++pos)
+    {
+        PHOOK_ENTRY pHook = &g_hooks.pItems[pos];
+        if (!pHook->isSelected || !IsFirstSelectedOfTarget(pos))
+            continue;
+
+        hr = PrepareTargetChain(pHook->pTarget, pBefore, pAfter);
+        if (FAILED(hr))
+        {
+            UINT i;
+            for (i = pos; i < g_hooks.size; ++i)
+            {
+                PHOOK_ENTRY pHookIter = &g_hooks.pItems[i];
+                if (pHookIter->isSelected && pHookIter->pTarget == pHook->pTarget)
+                    pHookIter->bulkLastError = hr;
+            }
+
+            if (!g_bulkContinueOnError)
+                break;
+
+            hr = S_OK;
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = SlimDetoursTransactionCommit();
+        if (FAILED(hr))
+        {
+            status = MH_ERROR_DETOURS_TRANSACTION_COMMIT;
         }
     }
     else
     {
-        UINT pos = FindHookEntry(hookIdent, pTarget, 0);
-        if (pos != INVALID_HOOK_POS)
+        status = MH_ERROR_UNSUPPORTED_FUNCTION;
+        SlimDetoursTransactionAbort();
+    }
+
+    if (FAILED(hr))
+    {
+        // Undo the links of the hooks which weren't enabled.
+        for (pos = 0; pos < g_hooks.size; ++pos)
         {
             PHOOK_ENTRY pHook = &g_hooks.pItems[pos];
-            pHook->queueEnable = queueEnable;
+            if (pHook->isSelected && pHook->applyEnable)
+                *GetOriginalPointer(pHook) = pHook->pTarget;
         }
-        else
+
+        SetAllStatuses(statuses, count, status);
+        goto cleanup;
+    }
+
+    for (pos = 0; pos < g_hooks.size; ++pos)
+    {
+        PHOOK_ENTRY pHook = &g_hooks.pItems[pos];
+        if (pHook->isSelected && IsFirstSelectedOfTarget(pos))
+            FinishTargetChain(pHook->pTarget, pBefore, pAfter);
+    }
+
+    for (pos = 0; pos < g_hooks.size; ++pos)
+    {
+        PHOOK_ENTRY pHook = &g_hooks.pItems[pos];
+        if (!pHook->isSelected)
+            continue;
+
+        if (SUCCEEDED(pHook->bulkLastError))
         {
-            status = MH_ERROR_NOT_CREATED;
+            pHook->isEnabled = pHook->applyEnable;
+            pHook->queueEnable = pHook->applyEnable;
+        }
+        else if (g_bulkErrorCallback)
+        {
+            g_bulkErrorCallback(pHook->pTarget, pHook->bulkLastError);
+            status = MH_ERROR_PARTIAL_FAILURE;
+            if (statuses != NULL)
+            {
+                statuses[FindMatchingIdent(pHook, hookIdents, count)] = status;
+            }
         }
     }
 
+cleanup:
+    for (pos = 0; pos < g_hooks.size; ++pos)
+    {
+        g_hooks.pItems[pos].isSelected = FALSE;
+    }
+
+    if (pChains != NULL)
+    {
+        HeapFree(GetProcessHeap(), 0, pChains);
+    }
+
     return status;
 }
 
-static MH_STATUS ApplyQueued(ULONG_PTR hookIdent)
+static MH_STATUS EnableHook(ULONG_PTR hookIdent, LPVOID pTarget, BOOL enable)
 {
     MH_STATUS status = MH_OK;
-    HRESULT hr;
 
-    UINT pos = FindHookEntryQueued(hookIdent, MH_ALL_HOOKS, 0);
-    if (pos != INVALID_HOOK_POS)
+    if (hookIdent == MH_ALL_IDENTS || pTarget == MH_ALL_HOOKS)
     {
-        hr = MHDetoursTransactionBegin();
-        if (SUCCEEDED(hr))
+        UINT pos = FindHookEntryEnabled(hookIdent, pTarget, 0, !enable);
+        if (pos != INVALID_HOOK_POS)
         {
             do
             {
                 PHOOK_ENTRY pHook = &g_hooks.pItems[pos];
-
-                if (pHook->queueEnable)
-                {
-                    hr = MHDetoursAttach(pHook);
-                }
-                else
-                {
-                    hr = MHDetoursDetach(pHook);
-                }
-
-                pHook->bulkLastError = hr;
-
-                if (g_bulkContinueOnError)
-                {
-                    hr = S_OK;
-                }
-                else if (FAILED(hr))
-                {
-                    break;
-                }
-
-                pos = FindHookEntryQueued(hookIdent, MH_ALL_HOOKS, pos + 1);
+                pHook->isSelected = TRUE;
+                pHook->applyEnable = enable;
+                pos = FindHookEntryEnabled(hookIdent, pTarget, pos + 1, !enable);
             } while (pos != INVALID_HOOK_POS);
 
-            if (SUCCEEDED(hr))
+            status = ApplySelected(NULL, 0, NULL);
+        }
+    }
+    else
+    {
+        UINT pos = FindHookEntry(hookIdent, pTarget, 0);
+        if (pos != INVALID_HOOK_POS)
+        {
+            PHOOK_ENTRY pHook = &g_hooks.pItems[pos];
+            if (pHook->isEnabled != enable)
             {
-                hr = SlimDetoursTransactionCommit();
-                if (SUCCEEDED(hr))
-                {
-                    UINT pos = FindHookEntryQueued(hookIdent, MH_ALL_HOOKS, 0);
-                    while (pos != INVALID_HOOK_POS)
-                    {
-                        PHOOK_ENTRY pHook = &g_hooks.pItems[pos];
-                        if (SUCCEEDED(pHook->bulkLastError))
-                        {
-                            pHook->isEnabled = pHook->queueEnable;
-                        }
-                        else if (g_bulkErrorCallback)
-                        {
-                            g_bulkErrorCallback(pHook->pTarget, pHook->bulkLastError);
-                            status = MH_ERROR_PARTIAL_FAILURE;
-                        }
-                        pos = FindHookEntryQueued(hookIdent, MH_ALL_HOOKS, pos + 1);
-                    }
-                }
-                else
-                {
-                    status = MH_ERROR_DETOURS_TRANSACTION_COMMIT;
-                }
+                pHook->isSelected = TRUE;
+                pHook->applyEnable = enable;
+                status = ApplySelected(NULL, 0, NULL);
+
+                // A single hook isn't a bulk operation, report its failure
+                // even if bulk operations continue on error.
+                if (status == MH_OK && pHook->isEnabled != enable)
+                    status = MH_ERROR_UNSUPPORTED_FUNCTION;
             }
             else
             {
-                status = MH_ERROR_UNSUPPORTED_FUNCTION;
-                SlimDetoursTransactionAbort();
+                status = enable ? MH_ERROR_ENABLED : MH_ERROR_DISABLED;
             }
         }
         else
         {
-            status = MH_ERROR_DETOURS_TRANSACTION_BEGIN;
+            status = MH_ERROR_NOT_CREATED;
         }
     }
 
     return status;
 }
 
+// Applies the queued hooks of all the given identifiers in a single
+// transaction. If statuses isn't NULL, it receives the status of each
+// identifier.
+static MH_STATUS ApplyQueued(const ULONG_PTR *hookIdents, UINT count, MH_STATUS *statuses)
+{
+    UINT pos = FindHookEntryQueuedMulti(hookIdents, count, 0);
+    if (pos == INVALID_HOOK_POS)
+    {
+        SetAllStatuses(statuses, count, MH_OK);
+        return MH_OK;
+    }
+
+    do
+    {
+        PHOOK_ENTRY pHook = &g_hooks.pItems[pos];
+        pHook->isSelected = TRUE;
+        pHook->applyEnable = pHook->queueEnable;
+        pos = FindHookEntryQueuedMulti(hookIdents, count, pos + 1);
+    } while (pos != INVALID_HOOK_POS);
+
+    return ApplySelected(hookIdents, count, statuses);
+}
+
 MH_STATUS WINAPI MH_Initialize(VOID)
 {
     if (g_initialized)
@@ -752,13 +939,56 @@ MH_STATUS WINAPI MH_ApplyQueuedEx(ULONG_PTR hookIdent)
 
     EnterCriticalSection(&g_criticalSection);
 
-    MH_STATUS status = ApplyQueued(hookIdent);
+    MH_STATUS status = ApplyQueued(&hookIdent, 1, NULL);
+
+    LeaveCriticalSection(&g_criticalSection);
+
+    return status;
+}
+
+MH_STATUS WINAPI MH_ApplyQueuedMultiEx(const ULONG_PTR *hookIdents, UINT count, MH_STATUS *statuses)
+{
+    if (!g_initialized)
+    {
+        SetAllStatuses(statuses, count, MH_ERROR_NOT_INITIALIZED);
+        return MH_ERROR_NOT_INITIALIZED;
+    }
+
+    EnterCriticalSection(&g_criticalSection);
+
+    MH_STATUS status = ApplyQueued(hookIdents, count, statuses);
 
     LeaveCriticalSection(&g_criticalSection);
 
     return status;
 }
 
+MH_STATUS WINAPI MH_GetStatistics(UINT *pEnabledHookCount, SIZE_T *pTrampolineCommittedSize)
+{
+    if (!g_initialized)
+        return MH_ERROR_NOT_INITIALIZED;
+
+    EnterCriticalSection(&g_criticalSection);
+
+    if (pEnabledHookCount != NULL)
+    {
+        UINT count = 0;
+        for (UINT i = 0; i < g_hooks.size; ++i)
+        {
+            if (g_hooks.pItems[i].isEnabled)
+                count++;
+        }
+        *pEnabledHookCount = count;
+    }
+
+    if (pTrampolineCommittedSize != NULL)
+        *pTrampolineCommittedSize = SlimDetoursGetTrampolineCommittedSize();
+
+    LeaveCriticalSection(&g_criticalSection);
+
+    return MH_OK;
+}
+
 const char *WINAPI MH_StatusToString(MH_STATUS status)
 {
 #define MH_ST2STR(x)    \
@@ -30,6 +30,13 @@ extern "C" {
 typedef struct _DETOUR_TRANSACTION_OPTIONS
 {
     BOOL fSuspendThreads;
+    /*
+     * Suspend the threads in SlimDetoursTransactionCommit instead of in
+     * SlimDetoursTransactionBeginEx, so that threads keep running while the
+     * trampolines are prepared, and are only suspended while the target code
+     * is written.
+     */
+    BOOL fDeferThreadSuspension;
 } DETOUR_TRANSACTION_OPTIONS, *PDETOUR_TRANSACTION_OPTIONS;
 
 typedef const DETOUR_TRANSACTION_OPTIONS* PCDETOUR_TRANSACTION_OPTIONS;
@@ -45,6 +52,7 @@ SlimDetoursTransactionBegin(VOID)
 {
     DETOUR_TRANSACTION_OPTIONS Options;
     Options.fSuspendThreads = TRUE;
+    Options.fDeferThreadSuspension = FALSE;
     return SlimDetoursTransactionBeginEx(&Options);
 }
 
@@ -87,6 +95,18 @@ SlimDetoursDetach(
     return SlimDetoursDetachEx(ppPointer, pDetour, &Options);
 }
 
+/// <summary>
+/// Makes an attached hook call a different detour, without writing to the target.
+/// </summary>
+/// <param name="pPointer">The trampoline, the value stored in <c>*ppPointer</c> by <c>SlimDetoursAttach</c>.</param>
+/// <param name="pDetour">The new detour function.</param>
+/// <returns>Returns HRESULT</returns>
+HRESULT
+NTAPI
+SlimDetoursSetDetour(
+    _In_ PVOID pPointer,
+    _In_ PVOID pDetour);
+
 HRESULT
 NTAPI
 SlimDetoursFreeTrampoline(
@@ -105,6 +125,15 @@ SlimDetoursCopyInstruction(
     _Out_opt_ PVOID* ppTarget,
     _Out_opt_ LONG* plExtra);
 
+/// <summary>
+/// Get the size of the committed trampoline memory
+/// </summary>
+/// <returns>Returns the size in bytes</returns>
+/// <remarks>Must not be called concurrently with other SlimDetours functions.</remarks>
+SIZE_T
+NTAPI
+SlimDetoursGetTrampolineCommittedSize(VOID);
+
 HRESULT
 NTAPI
 SlimDetoursUninitialize(VOID);
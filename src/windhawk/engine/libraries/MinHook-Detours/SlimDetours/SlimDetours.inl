@@ -101,6 +101,7 @@ enum
     DETOUR_OPERATION_NONE = 0,
     DETOUR_OPERATION_ADD,
     DETOUR_OPERATION_REMOVE,
+    DETOUR_OPERATION_RETARGET,
 };
 
 typedef struct _DETOUR_OPERATION DETOUR_OPERATION, *PDETOUR_OPERATION;
@@ -114,6 +115,7 @@ struct _DETOUR_OPERATION
     PDETOUR_TRAMPOLINE pTrampoline;
     ULONG dwPerm;
     PVOID* ppTrampolineToFreeManually;
+    PBYTE pbDetour; // The new detour of DETOUR_OPERATION_RETARGET.
 };
 
 /* Memory management */
@@ -259,7 +261,8 @@ detour_thread_update(
 /* Trampoline management */
 
 NTSTATUS
-detour_writable_trampoline_regions(VOID);
+detour_writable_trampoline(
+    _In_ PDETOUR_TRAMPOLINE pTrampoline);
 
 VOID
 detour_runnable_trampoline_regions(VOID);
@@ -279,6 +282,9 @@ VOID
 detour_free_trampoline_region_if_unused(
     _In_ PDETOUR_TRAMPOLINE pTrampoline);
 
+SIZE_T
+detour_get_trampoline_committed_size(VOID);
+
 BYTE
 detour_align_from_trampoline(
     _In_ PDETOUR_TRAMPOLINE pTrampoline,
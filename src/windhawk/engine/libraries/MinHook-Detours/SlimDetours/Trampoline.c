@@ -19,36 +19,73 @@ struct _DETOUR_REGION
     ULONGLONG ullSignature;
     PDETOUR_REGION pNext;       // Next region in list of regions.
     PDETOUR_TRAMPOLINE pFree;   // List of free trampolines in this region.
+    ULONG cbCommitted;          // Size of the committed part, from the start of the region.
+    BOOL bWritable;             // Made writable since the regions were last made runnable.
 };
 
 #define DETOUR_REGION_SIGNATURE ((ULONGLONG)'lSNK' << 32 | 'srtD')
 #define DETOUR_REGION_SIZE 0x10000UL
-#define DETOUR_TRAMPOLINES_PER_REGION ((DETOUR_REGION_SIZE / sizeof(DETOUR_TRAMPOLINE)) - 1)
+// Regions are reserved as a whole, but committed one page at a time as
+// trampolines are needed, since most regions only hold a few trampolines.
+#define DETOUR_REGION_COMMIT_SIZE 0x1000UL
 static PDETOUR_REGION s_pRegions = NULL; // List of all regions.
 static PDETOUR_REGION s_pRegion = NULL; // Default region.
 
+_STATIC_ASSERT(sizeof(DETOUR_REGION) <= sizeof(DETOUR_TRAMPOLINE));
+
+static
+PDETOUR_REGION
+detour_region_from_trampoline(
+    _In_ PDETOUR_TRAMPOLINE pTrampoline)
+{
+    return (PDETOUR_REGION)((ULONG_PTR)pTrampoline & ~(ULONG_PTR)(DETOUR_REGION_SIZE - 1));
+}
+
+// The region header takes the place of the first trampoline.
+static
+ULONG
+detour_region_committed_trampoline_limit(
+    _In_ PDETOUR_REGION pRegion)
+{
+    return pRegion->cbCommitted / sizeof(DETOUR_TRAMPOLINE);
+}
+
+// Only the regions which are modified are made writable, and only for the time
+// of the transaction, so a transaction doesn't have to reprotect all regions.
+static
 NTSTATUS
-detour_writable_trampoline_regions(VOID)
+detour_writable_region(
+    _In_ PDETOUR_REGION pRegion)
 {
     NTSTATUS Status;
     PVOID pMem;
     SIZE_T sMem;
     DWORD dwOld;
 
-    // Mark all of the regions as writable.
-    sMem = DETOUR_REGION_SIZE;
-    for (PDETOUR_REGION pRegion = s_pRegions; pRegion != NULL; pRegion = pRegion->pNext)
+    if (pRegion->bWritable)
     {
-        pMem = pRegion;
-        Status = NtProtectVirtualMemory(NtCurrentProcess(), &pMem, &sMem, PAGE_EXECUTE_READWRITE, &dwOld);
-        if (!NT_SUCCESS(Status))
-        {
-            return Status;
-        }
+        return STATUS_SUCCESS;
     }
+
+    pMem = pRegion;
+    sMem = pRegion->cbCommitted;
+    Status = NtProtectVirtualMemory(NtCurrentProcess(), &pMem, &sMem, PAGE_EXECUTE_READWRITE, &dwOld);
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+
+    pRegion->bWritable = TRUE;
     return STATUS_SUCCESS;
 }
 
+NTSTATUS
+detour_writable_trampoline(
+    _In_ PDETOUR_TRAMPOLINE pTrampoline)
+{
+    return detour_writable_region(detour_region_from_trampoline(pTrampoline));
+}
+
 VOID
 detour_runnable_trampoline_regions(VOID)
 {
@@ -56,14 +93,71 @@ detour_runnable_trampoline_regions(VOID)
     SIZE_T sMem;
     DWORD dwOld;
 
-    // Mark all of the regions as executable.
-    sMem = DETOUR_REGION_SIZE;
+    // Mark all of the regions which were made writable as executable.
     for (PDETOUR_REGION pRegion = s_pRegions; pRegion != NULL; pRegion = pRegion->pNext)
     {
+        if (!pRegion->bWritable)
+        {
+            continue;
+        }
+
+        pRegion->bWritable = FALSE;
         pMem = pRegion;
+        sMem = pRegion->cbCommitted;
         NtProtectVirtualMemory(NtCurrentProcess(), &pMem, &sMem, PAGE_EXECUTE_READ, &dwOld);
-        NtFlushInstructionCache(NtCurrentProcess(), pRegion, DETOUR_REGION_SIZE);
+        NtFlushInstructionCache(NtCurrentProcess(), pRegion, pRegion->cbCommitted);
+    }
+}
+
+// Commits the next page of the region and puts its trampolines on the free
+// list. Fails if the region is fully committed.
+static
+NTSTATUS
+detour_grow_region(
+    _In_ PDETOUR_REGION pRegion)
+{
+    NTSTATUS Status;
+    PVOID pMem;
+    SIZE_T sMem;
+
+    if (pRegion->cbCommitted >= DETOUR_REGION_SIZE)
+    {
+        return STATUS_NO_MEMORY;
+    }
+
+    Status = detour_writable_region(pRegion);
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+
+    pMem = Add2Ptr(pRegion, pRegion->cbCommitted);
+    sMem = DETOUR_REGION_COMMIT_SIZE;
+    Status = NtAllocateVirtualMemory(NtCurrentProcess(), &pMem, 0, &sMem, MEM_COMMIT, PAGE_EXECUTE_READWRITE);
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
     }
+
+    // A trampoline which crosses the previous commit boundary is only usable
+    // now.
+    ULONG ulFirst = detour_region_committed_trampoline_limit(pRegion);
+    if (ulFirst < 1)
+    {
+        ulFirst = 1;
+    }
+    pRegion->cbCommitted += DETOUR_REGION_COMMIT_SIZE;
+    ULONG ulLimit = detour_region_committed_trampoline_limit(pRegion);
+
+    // Put the new trampolines on the free list, lowest first.
+    PDETOUR_TRAMPOLINE pTrampolines = (PDETOUR_TRAMPOLINE)pRegion;
+    for (ULONG i = ulLimit; i > ulFirst; i--)
+    {
+        pTrampolines[i - 1].pbRemain = (PBYTE)pRegion->pFree;
+        pRegion->pFree = &pTrampolines[i - 1];
+    }
+
+    return STATUS_SUCCESS;
 }
 
 static
@@ -145,7 +239,7 @@ detour_alloc_region_from_lo(
                                              &pMem,
                                              0,
                                              &sMem,
-                                             MEM_COMMIT | MEM_RESERVE,
+                                             MEM_RESERVE,
                                              PAGE_EXECUTE_READWRITE);
             if (NT_SUCCESS(Status))
             {
@@ -214,7 +308,7 @@ detour_alloc_region_from_hi(
                                              &pMem,
                                              0,
                                              &sMem,
-                                             MEM_COMMIT | MEM_RESERVE,
+                                             MEM_RESERVE,
                                              PAGE_EXECUTE_READWRITE);
             if (NT_SUCCESS(Status))
             {
@@ -313,6 +407,10 @@ found_region:
         {
             return NULL;
         }
+        if (!NT_SUCCESS(detour_writable_region(s_pRegion)))
+        {
+            return NULL;
+        }
         s_pRegion->pFree = (PDETOUR_TRAMPOLINE)pTrampoline->pbRemain;
         RtlFillMemory(pTrampoline, sizeof(*pTrampoline), 0xcc);
         return pTrampoline;
@@ -327,6 +425,17 @@ found_region:
         }
     }
 
+    // Then commit more of an existing region, rather than taking up a new one.
+    for (s_pRegion = s_pRegions; s_pRegion != NULL; s_pRegion = s_pRegion->pNext)
+    {
+        if ((PDETOUR_TRAMPOLINE)s_pRegion >= pLo &&
+            (PDETOUR_TRAMPOLINE)Add2Ptr(s_pRegion, DETOUR_REGION_SIZE - sizeof(DETOUR_TRAMPOLINE)) <= pHi &&
+            NT_SUCCESS(detour_grow_region(s_pRegion)))
+        {
+            goto found_region;
+        }
+    }
+
     // We need to allocate a new region.
 
     // Round pbTarget down to 64KB block.
@@ -336,23 +445,36 @@ found_region:
     PVOID pbNewlyAllocated = detour_alloc_trampoline_allocate_new(pbTarget, pLo, pHi);
     if (pbNewlyAllocated != NULL)
     {
+        // The region is only reserved, commit the page of its header.
+        PVOID pMem = pbNewlyAllocated;
+        SIZE_T sMem = DETOUR_REGION_COMMIT_SIZE;
+        if (!NT_SUCCESS(NtAllocateVirtualMemory(NtCurrentProcess(),
+                                                &pMem,
+                                                0,
+                                                &sMem,
+                                                MEM_COMMIT,
+                                                PAGE_EXECUTE_READWRITE)))
+        {
+            sMem = 0;
+            NtFreeVirtualMemory(NtCurrentProcess(), &pbNewlyAllocated, &sMem, MEM_RELEASE);
+            return NULL;
+        }
+
         s_pRegion = (DETOUR_REGION*)pbNewlyAllocated;
         s_pRegion->ullSignature = DETOUR_REGION_SIGNATURE;
         s_pRegion->pFree = NULL;
+        s_pRegion->cbCommitted = 0;
+        s_pRegion->bWritable = TRUE;
         s_pRegion->pNext = s_pRegions;
         s_pRegions = s_pRegion;
         DETOUR_TRACE("  Allocated region %p..%p\n\n", s_pRegion, Add2Ptr(s_pRegion, DETOUR_REGION_SIZE - 1));
 
-        // Put everything but the first trampoline on the free list.
-        PBYTE pFree = NULL;
-        pTrampoline = ((PDETOUR_TRAMPOLINE)s_pRegion) + 1;
-        for (int i = DETOUR_TRAMPOLINES_PER_REGION - 1; i > 1; i--)
+        // The first page is already committed, NtAllocateVirtualMemory
+        // doesn't fail for it.
+        if (NT_SUCCESS(detour_grow_region(s_pRegion)) && s_pRegion->pFree != NULL)
         {
-            pTrampoline[i].pbRemain = pFree;
-            pFree = (PBYTE)&pTrampoline[i];
+            goto found_region;
         }
-        s_pRegion->pFree = (PDETOUR_TRAMPOLINE)pFree;
-        goto found_region;
     }
 
     DETOUR_TRACE("Couldn't find available memory region!\n");
@@ -363,7 +485,13 @@ VOID
 detour_free_trampoline(
     _In_ PDETOUR_TRAMPOLINE pTrampoline)
 {
-    PDETOUR_REGION pRegion = (PDETOUR_REGION)((ULONG_PTR)pTrampoline & ~(ULONG_PTR)0xffff);
+    PDETOUR_REGION pRegion = detour_region_from_trampoline(pTrampoline);
+
+    if (!NT_SUCCESS(detour_writable_region(pRegion)))
+    {
+        DETOUR_TRACE("detours: Leaked trampoline %p, the region isn't writable\n", pTrampoline);
+        return;
+    }
 
     RtlZeroMemory(pTrampoline, sizeof(*pTrampoline));
     pTrampoline->pbRemain = (PBYTE)pRegion->pFree;
@@ -384,9 +512,10 @@ detour_is_region_empty(
     PBYTE pbRegionBeg = (PBYTE)pRegion;
     PBYTE pbRegionLim = pbRegionBeg + DETOUR_REGION_SIZE;
 
-    // Stop if any of the trampolines aren't free.
-    PDETOUR_TRAMPOLINE pTrampoline = ((PDETOUR_TRAMPOLINE)pRegion) + 1;
-    for (int i = 0; i < DETOUR_TRAMPOLINES_PER_REGION; i++)
+    // Stop if any of the committed trampolines aren't free.
+    PDETOUR_TRAMPOLINE pTrampoline = (PDETOUR_TRAMPOLINE)pRegion;
+    ULONG ulLimit = detour_region_committed_trampoline_limit(pRegion);
+    for (ULONG i = 1; i < ulLimit; i++)
     {
         if (pTrampoline[i].pbRemain != NULL &&
             (pTrampoline[i].pbRemain < pbRegionBeg ||
@@ -401,15 +530,23 @@ detour_is_region_empty(
 }
 
 static
-VOID
+BOOL
 detour_free_region(
     _Out_ PDETOUR_REGION* ppRegionBase,
     _In_ PDETOUR_REGION pRegion)
 {
+    // Unlinking writes to the previous region, if there is one.
+    if (ppRegionBase != &s_pRegions &&
+        !NT_SUCCESS(detour_writable_region(CONTAINING_RECORD(ppRegionBase, DETOUR_REGION, pNext))))
+    {
+        return FALSE;
+    }
+
     *ppRegionBase = pRegion->pNext;
     PVOID pMem = pRegion;
     SIZE_T sMem = 0;
     NtFreeVirtualMemory(NtCurrentProcess(), &pMem, &sMem, MEM_RELEASE);
+    return TRUE;
 }
 
 VOID
@@ -420,9 +557,8 @@ detour_free_unused_trampoline_regions(VOID)
 
     while (pRegion != NULL)
     {
-        if (detour_is_region_empty(pRegion))
+        if (detour_is_region_empty(pRegion) && detour_free_region(ppRegionBase, pRegion))
         {
-            detour_free_region(ppRegionBase, pRegion);
             s_pRegion = NULL;
         } else
         {
@@ -436,7 +572,7 @@ VOID
 detour_free_trampoline_region_if_unused(
     _In_ PDETOUR_TRAMPOLINE pTrampoline)
 {
-    PDETOUR_REGION pTargetRegion = (PDETOUR_REGION)((ULONG_PTR)pTrampoline & ~(ULONG_PTR)0xffff);
+    PDETOUR_REGION pTargetRegion = detour_region_from_trampoline(pTrampoline);
 
     PDETOUR_REGION* ppRegionBase = &s_pRegions;
     PDETOUR_REGION pRegion = s_pRegions;
@@ -445,9 +581,8 @@ detour_free_trampoline_region_if_unused(
     {
         if (pRegion == pTargetRegion)
         {
-            if (detour_is_region_empty(pRegion))
+            if (detour_is_region_empty(pRegion) && detour_free_region(ppRegionBase, pRegion))
             {
-                detour_free_region(ppRegionBase, pRegion);
                 s_pRegion = NULL;
             }
             break;
@@ -458,6 +593,18 @@ detour_free_trampoline_region_if_unused(
     }
 }
 
+SIZE_T
+detour_get_trampoline_committed_size(VOID)
+{
+    SIZE_T cbTotal = 0;
+
+    for (PDETOUR_REGION pRegion = s_pRegions; pRegion != NULL; pRegion = pRegion->pNext)
+    {
+        cbTotal += pRegion->cbCommitted;
+    }
+    return cbTotal;
+}
+
 BYTE
 detour_align_from_trampoline(
     _In_ PDETOUR_TRAMPOLINE pTrampoline,
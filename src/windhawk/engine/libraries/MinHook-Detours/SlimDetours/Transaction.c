@@ -15,6 +15,7 @@
 static _Interlocked_operand_ HANDLE volatile s_nPendingThreadId = NULL; // Thread owning pending transaction.
 static PHANDLE s_phSuspendedThreads = NULL;
 static ULONG s_ulSuspendedThreadCount = 0;
+static BOOL s_bDeferredThreadSuspension = FALSE;
 static PDETOUR_OPERATION s_pPendingOperations = NULL;
 
 HRESULT
@@ -33,19 +34,18 @@ SlimDetoursTransactionBeginEx(
     // Initialize memory management
     detour_memory_init();
 
-    // Make sure the trampoline pages are writable.
-    Status = detour_writable_trampoline_regions();
-    if (!NT_SUCCESS(Status))
+    // The trampoline regions are made writable as they're modified.
+    s_bDeferredThreadSuspension = FALSE;
+    if (pOptions->fSuspendThreads && pOptions->fDeferThreadSuspension)
     {
-        goto fail;
-    }
-
-    if (pOptions->fSuspendThreads)
+        s_phSuspendedThreads = NULL;
+        s_ulSuspendedThreadCount = 0;
+        s_bDeferredThreadSuspension = TRUE;
+    } else if (pOptions->fSuspendThreads)
     {
         Status = detour_thread_suspend(&s_phSuspendedThreads, &s_ulSuspendedThreadCount);
         if (!NT_SUCCESS(Status))
         {
-            detour_runnable_trampoline_regions();
             goto fail;
         }
     } else
@@ -86,9 +86,12 @@ SlimDetoursTransactionAbort(VOID)
     for (PDETOUR_OPERATION o = s_pPendingOperations; o != NULL;)
     {
         // We don't care if this fails, because the code is still accessible.
-        pMem = o->pbTarget;
-        sMem = o->pTrampoline->cbRestore;
-        NtProtectVirtualMemory(NtCurrentProcess(), &pMem, &sMem, o->dwPerm, &dwOld);
+        if (o->dwOperation != DETOUR_OPERATION_RETARGET)
+        {
+            pMem = o->pbTarget;
+            sMem = o->pTrampoline->cbRestore;
+            NtProtectVirtualMemory(NtCurrentProcess(), &pMem, &sMem, o->dwPerm, &dwOld);
+        }
         if (o->dwOperation == DETOUR_OPERATION_ADD)
         {
             detour_free_trampoline(o->pTrampoline);
@@ -142,6 +145,20 @@ SlimDetoursTransactionCommit(VOID)
         goto _exit;
     }
 
+    if (s_bDeferredThreadSuspension)
+    {
+        // The trampolines are ready, only the writes below need the threads
+        // to be suspended.
+        NTSTATUS Status = detour_thread_suspend(&s_phSuspendedThreads, &s_ulSuspendedThreadCount);
+        if (!NT_SUCCESS(Status))
+        {
+            s_phSuspendedThreads = NULL;
+            s_ulSuspendedThreadCount = 0;
+            SlimDetoursTransactionAbort();
+            return HRESULT_FROM_NT(Status);
+        }
+    }
+
     // Insert each of the detours.
     for (o = s_pPendingOperations; o != NULL; o = o->pNext)
     {
@@ -261,6 +278,15 @@ SlimDetoursTransactionCommit(VOID)
         *o->ppbPointer = o->pbTarget;
     }
 
+    // Switch each of the retargeted hooks to its new detour.
+    for (o = s_pPendingOperations; o != NULL; o = o->pNext)
+    {
+        if (o->dwOperation != DETOUR_OPERATION_RETARGET)
+            continue;
+
+        o->pTrampoline->pbDetour = o->pbDetour;
+    }
+
     // Update any suspended threads.
     for (i = 0; i < s_ulSuspendedThreadCount; i++)
     {
@@ -271,9 +297,12 @@ SlimDetoursTransactionCommit(VOID)
     for (o = s_pPendingOperations; o != NULL;)
     {
         // We don't care if this fails, because the code is still accessible.
-        pMem = o->pbTarget;
-        sMem = o->pTrampoline->cbRestore;
-        NtProtectVirtualMemory(NtCurrentProcess(), &pMem, &sMem, o->dwPerm, &dwOld);
+        if (o->dwOperation != DETOUR_OPERATION_RETARGET)
+        {
+            pMem = o->pbTarget;
+            sMem = o->pTrampoline->cbRestore;
+            NtProtectVirtualMemory(NtCurrentProcess(), &pMem, &sMem, o->dwPerm, &dwOld);
+        }
         if (o->dwOperation == DETOUR_OPERATION_REMOVE)
         {
             if (!o->ppTrampolineToFreeManually)
@@ -567,6 +596,14 @@ fail:
         goto fail;
     }
 
+    // The hook is put in bypass mode on commit.
+    Status = detour_writable_trampoline(pTrampoline);
+    if (!NT_SUCCESS(Status))
+    {
+        DETOUR_BREAK();
+        goto fail;
+    }
+
     pMem = pbTarget;
     sMem = cbTarget;
     Status = NtProtectVirtualMemory(NtCurrentProcess(), &pMem, &sMem, PAGE_EXECUTE_READWRITE, &dwOld);
@@ -588,6 +625,52 @@ fail:
     return HRESULT_FROM_NT(STATUS_SUCCESS);
 }
 
+HRESULT
+NTAPI
+SlimDetoursSetDetour(
+    _In_ PVOID pPointer,
+    _In_ PVOID pDetour)
+{
+    if (s_nPendingThreadId != NtCurrentThreadId())
+    {
+        return HRESULT_FROM_NT(STATUS_TRANSACTIONAL_CONFLICT);
+    }
+
+    PDETOUR_TRAMPOLINE pTrampoline = (PDETOUR_TRAMPOLINE)pPointer;
+    if (pTrampoline->cbRestore == 0 || pTrampoline->cbRestore > sizeof(pTrampoline->rbCode))
+    {
+        DETOUR_BREAK();
+        return HRESULT_FROM_NT(STATUS_INVALID_BLOCK_LENGTH);
+    }
+
+    NTSTATUS Status = detour_writable_trampoline(pTrampoline);
+    if (!NT_SUCCESS(Status))
+    {
+        DETOUR_BREAK();
+        return HRESULT_FROM_NT(Status);
+    }
+
+    PDETOUR_OPERATION o = detour_memory_alloc(sizeof(DETOUR_OPERATION));
+    if (o == NULL)
+    {
+        DETOUR_BREAK();
+        return HRESULT_FROM_NT(STATUS_NO_MEMORY);
+    }
+
+    // The target isn't written, only the trampoline.
+    o->dwOperation = DETOUR_OPERATION_RETARGET;
+    o->ppbPointer = NULL;
+    o->pTrampoline = pTrampoline;
+    o->pbTarget = pTrampoline->pbRemain - pTrampoline->cbRestore;
+    o->dwPerm = 0;
+    o->ppTrampolineToFreeManually = NULL;
+    o->pbDetour = (PBYTE)detour_skip_jmp((PBYTE)pDetour);
+    o->pNext = s_pPendingOperations;
+    s_pPendingOperations = o;
+
+    return HRESULT_FROM_NT(STATUS_SUCCESS);
+}
+
 HRESULT
 NTAPI
 SlimDetoursFreeTrampoline(
@@ -606,31 +689,13 @@ SlimDetoursFreeTrampoline(
         return HRESULT_FROM_NT(STATUS_TRANSACTIONAL_CONFLICT);
     }
 
-    NTSTATUS Status;
-
-    if (!bInTransaction)
-    {
-        // Make sure the trampoline pages are writable.
-        Status = detour_writable_trampoline_regions();
-        if (!NT_SUCCESS(Status))
-        {
-            goto fail;
-        }
-    }
-
+    // The region is made writable as needed.
     detour_free_trampoline((PDETOUR_TRAMPOLINE)pTrampoline);
     detour_free_trampoline_region_if_unused((PDETOUR_TRAMPOLINE)pTrampoline);
 
     if (!bInTransaction)
     {
         detour_runnable_trampoline_regions();
-    }
-
-    Status = STATUS_SUCCESS;
-
-fail:
-    if (!bInTransaction)
-    {
 #ifdef _MSC_VER
 #pragma warning(disable: __WARNING_INTERLOCKED_ACCESS)
 #endif
@@ -639,7 +704,15 @@ fail:
 #pragma warning(default: __WARNING_INTERLOCKED_ACCESS)
 #endif
     }
-    return HRESULT_FROM_NT(Status);
+
+    return HRESULT_FROM_NT(STATUS_SUCCESS);
+}
+
+SIZE_T
+NTAPI
+SlimDetoursGetTrampolineCommittedSize(VOID)
+{
+    return detour_get_trampoline_committed_size();
 }
 
 HRESULT
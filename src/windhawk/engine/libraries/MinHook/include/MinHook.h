@@ -245,6 +245,14 @@ extern "C" {
     MH_STATUS WINAPI MH_ApplyQueued(VOID);
     MH_STATUS WINAPI MH_ApplyQueuedEx(ULONG_PTR hookIdent);
 
+    // Applies all queued changes of several hook identifiers in one go.
+    //   hookIdents  [in]  An array of hook identifiers.
+    //   count       [in]  The amount of hook identifiers.
+    //   statuses    [out] An array which receives the status of each hook
+    //                     identifier. Can be NULL.
+    MH_STATUS WINAPI MH_ApplyQueuedMultiEx(
+        const ULONG_PTR *hookIdents, UINT count, MH_STATUS *statuses);
+
     // Translates the MH_STATUS to its name as a string.
     const char * WINAPI MH_StatusToString(MH_STATUS status);
 
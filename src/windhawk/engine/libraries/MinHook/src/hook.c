@@ -1108,13 +1108,47 @@ MH_STATUS WINAPI MH_QueueDisableHook(LPVOID pTarget)
 }
 
 //-------------------------------------------------------------------------
-MH_STATUS WINAPI MH_ApplyQueuedEx(ULONG_PTR hookIdent)
+// Returns the index of the first identifier which matches the hook, or
+// INVALID_HOOK_POS.
+static UINT FindMatchingIdent(PHOOK_ENTRY pHook, const ULONG_PTR *hookIdents, UINT count)
+{
+    UINT i;
+    for (i = 0; i < count; ++i)
+    {
+        if (hookIdents[i] == MH_ALL_IDENTS || hookIdents[i] == pHook->hookIdent)
+            return i;
+    }
+
+    return INVALID_HOOK_POS;
+}
+
+//-------------------------------------------------------------------------
+static VOID SetAllStatuses(MH_STATUS *statuses, UINT count, MH_STATUS status)
+{
+    UINT i;
+    if (statuses != NULL)
+    {
+        for (i = 0; i < count; ++i)
+            statuses[i] = status;
+    }
+}
+
+//-------------------------------------------------------------------------
+MH_STATUS WINAPI MH_ApplyQueuedMultiEx(const ULONG_PTR *hookIdents, UINT count, MH_STATUS *statuses)
 {
     if (g_hMutex == NULL)
+    {
+        SetAllStatuses(statuses, count, MH_ERROR_NOT_INITIALIZED);
         return MH_ERROR_NOT_INITIALIZED;
+    }
 
     if (WaitForSingleObject(g_hMutex, INFINITE) != WAIT_OBJECT_0)
+    {
+        SetAllStatuses(statuses, count, MH_ERROR_MUTEX_FAILURE);
         return MH_ERROR_MUTEX_FAILURE;
+    }
+
+    SetAllStatuses(statuses, count, MH_OK);
 
     MH_STATUS status = MH_OK;
     UINT i, first = INVALID_HOOK_POS;
@@ -1122,8 +1156,8 @@ MH_STATUS WINAPI MH_ApplyQueuedEx(ULONG_PTR hookIdent)
     for (i = 0; i < g_hooks.size; ++i)
     {
         PHOOK_ENTRY pHook = &g_hooks.pItems[i];
-        if ((hookIdent == MH_ALL_IDENTS || pHook->hookIdent == hookIdent) &&
-            pHook->isEnabled != pHook->queueEnable)
+        if (pHook->isEnabled != pHook->queueEnable &&
+            FindMatchingIdent(pHook, hookIdents, count) != INVALID_HOOK_POS)
         {
             first = i;
             break;
@@ -1139,20 +1173,31 @@ MH_STATUS WINAPI MH_ApplyQueuedEx(ULONG_PTR hookIdent)
             for (i = first; i < g_hooks.size; ++i)
             {
                 PHOOK_ENTRY pHook = &g_hooks.pItems[i];
-                if ((hookIdent == MH_ALL_IDENTS || pHook->hookIdent == hookIdent) &&
-                    pHook->isEnabled != pHook->queueEnable)
-                {
-                    MH_STATUS enable_status = EnableHookLL(i, pHook->queueEnable, &threads);
+                if (pHook->isEnabled == pHook->queueEnable)
+                    continue;
 
-                    // Instead of stopping on the first error, we apply as much
-                    // hooks as we can, and return the last error, if any.
-                    if (enable_status != MH_OK)
-                        status = enable_status;
+                UINT identIndex = FindMatchingIdent(pHook, hookIdents, count);
+                if (identIndex == INVALID_HOOK_POS)
+                    continue;
+
+                MH_STATUS enable_status = EnableHookLL(i, pHook->queueEnable, &threads);
+
+                // Instead of stopping on the first error, we apply as much
+                // hooks as we can, and return the last error, if any.
+                if (enable_status != MH_OK)
+                {
+                    status = enable_status;
+                    if (statuses != NULL)
+                        statuses[identIndex] = enable_status;
                 }
             }
 
             Unfreeze(&threads);
         }
+        else
+        {
+            SetAllStatuses(statuses, count, status);
+        }
     }
 
     ReleaseMutex(g_hMutex);
@@ -1160,6 +1205,12 @@ MH_STATUS WINAPI MH_ApplyQueuedEx(ULONG_PTR hookIdent)
     return status;
 }
 
+//-------------------------------------------------------------------------
+MH_STATUS WINAPI MH_ApplyQueuedEx(ULONG_PTR hookIdent)
+{
+    return MH_ApplyQueuedMultiEx(&hookIdent, 1, NULL);
+}
+
 //-------------------------------------------------------------------------
 MH_STATUS WINAPI MH_ApplyQueued(VOID)
 {
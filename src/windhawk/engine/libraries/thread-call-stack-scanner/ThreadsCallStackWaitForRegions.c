@@ -4,6 +4,8 @@
 
 #include "ThreadsCallStackIterate.h"
 
+#define MIN_ITERATION_INTERVAL 10
+
 typedef struct {
     const ThreadCallStackRegionInfo* regionInfos;
     DWORD regionInfosCount;
@@ -40,6 +42,14 @@ BOOL ThreadsCallStackWaitForRegions(
     };
     BOOL result = FALSE;
 
+    // Calls which are in flight usually return quickly, so start with a short
+    // interval and double it up to timeoutPerIteration, instead of waiting for
+    // the full interval right after the first iteration.
+    DWORD iterationInterval = MIN_ITERATION_INTERVAL;
+    if (iterationInterval > timeoutPerIteration) {
+        iterationInterval = timeoutPerIteration;
+    }
+
     ThreadsCallStackInitialize();
 
     for (DWORD i = 0; i < maxIterations; i++) {
@@ -53,8 +63,13 @@ BOOL ThreadsCallStackWaitForRegions(
 
         if (i < maxIterations - 1) {
             DWORD elapsedTime = GetTickCount() - startTime;
-            if (elapsedTime < timeoutPerIteration) {
-                Sleep(timeoutPerIteration - elapsedTime);
+            if (elapsedTime < iterationInterval) {
+                Sleep(iterationInterval - elapsedTime);
+            }
+
+            iterationInterval *= 2;
+            if (iterationInterval > timeoutPerIteration) {
+                iterationInterval = timeoutPerIteration;
             }
         }
     }
@@ -11,7 +11,10 @@ extern "C" {
 
 // Iterates over the call stacks of all threads and waits until no address is
 // within any of the specified regions. Can be used to wait for a specific
-// module to stop executing in order to safely unload it.
+// module to stop executing in order to safely unload it. Returns right away if
+// no address is within the regions. Otherwise, the call stacks are checked
+// again after an interval which starts short and grows up to
+// timeoutPerIteration, for at most maxIterations iterations.
 BOOL ThreadsCallStackWaitForRegions(
     const ThreadCallStackRegionInfo* regionInfos,
     DWORD regionInfosCount,
@@ -0,0 +1,167 @@
+#include "stdafx.h"
+
+#include "local_storage_buffer.h"
+#include "logger.h"
+#include "storage_manager.h"
+
+LocalStorageBuffer::LocalStorageBuffer(PCWSTR modName) : m_modName(modName) {
+    m_timer.reset(CreateThreadpoolTimer(TimerCallback, this, nullptr));
+    THROW_LAST_ERROR_IF_NULL(m_timer);
+}
+
+LocalStorageBuffer::~LocalStorageBuffer() {
+    // Waits for a running callback and cancels a pending one.
+    m_timer.reset();
+
+    Flush();
+}
+
+std::optional<int> LocalStorageBuffer::GetInt(PCWSTR valueName) {
+    return Get<int>(valueName);
+}
+
+std::optional<std::wstring> LocalStorageBuffer::GetString(PCWSTR valueName) {
+    return Get<std::wstring>(valueName);
+}
+
+std::optional<std::vector<BYTE>> LocalStorageBuffer::GetBinary(
+    PCWSTR valueName) {
+    return Get<std::vector<BYTE>>(valueName);
+}
+
+void LocalStorageBuffer::Set(
+    std::vector<std::pair<std::wstring, Value>> values) {
+    std::lock_guard guard(m_mutex);
+
+    ULONGLONG tickCount = GetTickCount64();
+
+    if (m_pending.empty() &&
+        tickCount - m_lastWriteTickCount >= kFlushDelayMs) {
+        std::vector<PendingValue> pendingValues;
+        pendingValues.reserve(values.size());
+        for (auto& [name, value] : values) {
+            pendingValues.push_back({std::move(name), std::move(value)});
+        }
+
+        WriteLocked(pendingValues);
+        m_lastWriteTickCount = tickCount;
+        return;
+    }
+
+    for (auto& [name, value] : values) {
+        std::wstring key = NormalizeValueName(name);
+        m_pending.insert_or_assign(std::move(key),
+                                   PendingValue{std::move(name),
+                                                std::move(value)});
+    }
+
+    if (!m_timerSet) {
+        // A negative due time is relative.
+        FILETIME dueTime = wil::filetime::from_int64(static_cast<UINT64>(
+            -static_cast<INT64>(kFlushDelayMs) *
+            wil::filetime_duration::one_millisecond));
+        SetThreadpoolTimer(m_timer.get(), &dueTime, 0, 0);
+        m_timerSet = true;
+    }
+}
+
+void LocalStorageBuffer::Flush() noexcept {
+    std::lock_guard guard(m_mutex);
+
+    try {
+        FlushLocked();
+    } catch (const std::exception& e) {
+        LOG(L"Mod %s error: Writing to local storage failed: %S",
+            m_modName.c_str(), e.what());
+    }
+}
+
+template <typename T>
+std::optional<T> LocalStorageBuffer::Get(PCWSTR valueName) {
+    std::lock_guard guard(m_mutex);
+
+    auto it = m_pending.find(NormalizeValueName(valueName));
+    if (it != m_pending.end()) {
+        const auto& value = it->second.value;
+        if (std::holds_alternative<std::monostate>(value)) {
+            return std::nullopt;
+        }
+
+        if (const T* typedValue = std::get_if<T>(&value)) {
+            return *typedValue;
+        }
+
+        // Read as a different type than it was written, let the storage
+        // convert it.
+        FlushLocked();
+    }
+
+    auto settings = StorageManager::GetInstance().GetModWritableConfig(
+        m_modName.c_str(), L"LocalStorage", false);
+
+    if constexpr (std::is_same_v<T, int>) {
+        return settings->GetInt(valueName);
+    } else if constexpr (std::is_same_v<T, std::wstring>) {
+        return settings->GetString(valueName);
+    } else {
+        return settings->GetBinary(valueName);
+    }
+}
+
+// static
+void CALLBACK LocalStorageBuffer::TimerCallback(PTP_CALLBACK_INSTANCE instance,
+                                                PVOID context,
+                                                PTP_TIMER timer) {
+    static_cast<LocalStorageBuffer*>(context)->Flush();
+}
+
+// static
+std::wstring LocalStorageBuffer::NormalizeValueName(
+    std::wstring_view valueName) {
+    std::wstring result(valueName);
+    std::transform(result.begin(), result.end(), result.begin(), towlower);
+    return result;
+}
+
+void LocalStorageBuffer::WriteLocked(const std::vector<PendingValue>& values) {
+    auto settings = StorageManager::GetInstance().GetModWritableConfig(
+        m_modName.c_str(), L"LocalStorage", true);
+
+    for (const auto& [name, value] : values) {
+        std::visit(
+            [&settings, &name](const auto& v) {
+                using T = std::decay_t<decltype(v)>;
+                if constexpr (std::is_same_v<T, std::monostate>) {
+                    settings->Remove(name.c_str());
+                } else if constexpr (std::is_same_v<T, int>) {
+                    settings->SetInt(name.c_str(), v);
+                } else if constexpr (std::is_same_v<T, std::wstring>) {
+                    settings->SetString(name.c_str(), v.c_str());
+                } else {
+                    settings->SetBinary(name.c_str(), v.data(), v.size());
+                }
+            },
+            value);
+    }
+}
+
+void LocalStorageBuffer::FlushLocked() {
+    m_timerSet = false;
+
+    if (m_pending.empty()) {
+        return;
+    }
+
+    std::vector<PendingValue> values;
+    values.reserve(m_pending.size());
+    for (auto& [key, pendingValue] : m_pending) {
+        values.push_back(std::move(pendingValue));
+    }
+
+    // The values are dropped even if writing fails, retrying is unlikely to
+    // help.
+    m_pending.clear();
+    m_lastWriteTickCount = GetTickCount64();
+
+    WriteLocked(values);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+// Buffers the writes of a mod to its LocalStorage section. Each write used to
+// open the storage and write synchronously, and in portable mode rewrite the
+// whole ini file, which is a lot of I/O for mods which persist state often,
+// such as window positions or counters.
+//
+// A write which follows a quiet period is written right away. Writes which
+// follow it within kFlushDelayMs are coalesced, and written together once the
+// delay passes or on destruction. Reads see the pending writes.
+class LocalStorageBuffer {
+   public:
+    // std::monostate means that the value is removed.
+    using Value =
+        std::variant<std::monostate, int, std::wstring, std::vector<BYTE>>;
+
+    explicit LocalStorageBuffer(PCWSTR modName);
+    ~LocalStorageBuffer();
+
+    LocalStorageBuffer(const LocalStorageBuffer&) = delete;
+    LocalStorageBuffer& operator=(const LocalStorageBuffer&) = delete;
+
+    std::optional<int> GetInt(PCWSTR valueName);
+    std::optional<std::wstring> GetString(PCWSTR valueName);
+    std::optional<std::vector<BYTE>> GetBinary(PCWSTR valueName);
+
+    // The values are written together, with a single storage open.
+    void Set(std::vector<std::pair<std::wstring, Value>> values);
+
+    void Flush() noexcept;
+
+   private:
+    static constexpr DWORD kFlushDelayMs = 1000;
+
+    struct PendingValue {
+        std::wstring name;
+        Value value;
+    };
+
+    template <typename T>
+    std::optional<T> Get(PCWSTR valueName);
+
+    static void CALLBACK TimerCallback(PTP_CALLBACK_INSTANCE instance,
+                                       PVOID context,
+                                       PTP_TIMER timer);
+    static std::wstring NormalizeValueName(std::wstring_view valueName);
+
+    void WriteLocked(const std::vector<PendingValue>& values);
+    void FlushLocked();
+
+    std::wstring m_modName;
+    std::mutex m_mutex;
+    // Keyed by the lowercase value name, since names are case-insensitive.
+    std::unordered_map<std::wstring, PendingValue> m_pending;
+    ULONGLONG m_lastWriteTickCount = 0;
+    bool m_timerSet = false;
+    // Declared last, so that the callbacks are done before the rest is
+    // destroyed.
+    wil::unique_threadpool_timer m_timer;
+};
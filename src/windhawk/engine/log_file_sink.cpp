@@ -0,0 +1,223 @@
+#include "stdafx.h"
+
+#include "log_file_format.h"
+#include "log_file_sink.h"
+#include "storage_manager.h"
+
+namespace {
+
+constexpr int kDefaultMaxFileCount = 4;
+constexpr int kMaxMaxFileCount = 32;
+
+}  // namespace
+
+LogFileSink::LogFileSink(std::filesystem::path directory,
+                         ULONGLONG maxFileSize,
+                         int maxFileCount)
+    : m_directory(std::move(directory)),
+      m_maxFileSize(maxFileSize),
+      m_maxFileCount(maxFileCount) {
+    std::filesystem::create_directories(m_directory);
+
+    m_work.reset(CreateThreadpoolWork(WorkCallback, this, nullptr));
+    THROW_LAST_ERROR_IF_NULL(m_work);
+}
+
+// static
+std::unique_ptr<LogFileSink> LogFileSink::CreateFromConfig() {
+    auto settings = StorageManager::GetInstance().GetAppConfig(L"Settings");
+
+    int maxFileSizeKb = settings->GetInt(L"LogFileMaxSize").value_or(0);
+    if (maxFileSizeKb <= 0) {
+        return nullptr;
+    }
+
+    int maxFileCount =
+        settings->GetInt(L"LogFileCount").value_or(kDefaultMaxFileCount);
+    maxFileCount = std::clamp(maxFileCount, 1, kMaxMaxFileCount);
+
+    return std::make_unique<LogFileSink>(
+        StorageManager::GetInstance().GetLogsPath(),
+        static_cast<ULONGLONG>(maxFileSizeKb) * 1024, maxFileCount);
+}
+
+void LogFileSink::Append(ULONGLONG timestamp,
+                         DWORD processId,
+                         DWORD threadId,
+                         std::wstring_view text) noexcept {
+    std::lock_guard guard(m_pendingMutex);
+
+    size_t recordSize = sizeof(LogFileFormat::RecordHeader) +
+                        text.size() * sizeof(WCHAR);
+    if (m_pending.size() + recordSize > kMaxPendingSize ||
+        !AppendRecord(m_pending, timestamp, processId, threadId, text)) {
+        m_droppedCount++;
+    }
+}
+
+void LogFileSink::Flush() noexcept {
+    {
+        std::lock_guard guard(m_pendingMutex);
+        if (m_pending.empty() && !m_droppedCount) {
+            return;
+        }
+    }
+
+    SubmitThreadpoolWork(m_work.get());
+}
+
+// static
+void CALLBACK LogFileSink::WorkCallback(PTP_CALLBACK_INSTANCE instance,
+                                        PVOID context,
+                                        PTP_WORK work) {
+    static_cast<LogFileSink*>(context)->Write();
+}
+
+void LogFileSink::Write() noexcept {
+    std::lock_guard guard(m_writeMutex);
+
+    ULONGLONG droppedCount;
+    {
+        std::lock_guard pendingGuard(m_pendingMutex);
+        // Keeps the capacity of both buffers.
+        m_pending.swap(m_writing);
+        droppedCount = std::exchange(m_droppedCount, 0);
+    }
+
+    auto clearWriting = wil::scope_exit([this] { m_writing.clear(); });
+
+    if (droppedCount) {
+        WCHAR text[128];
+        int textLength =
+            _snwprintf_s(text, _TRUNCATE,
+                         L"[WH] %I64u log lines were dropped while writing "
+                         L"the log file\n",
+                         droppedCount);
+        if (textLength > 0) {
+            AppendRecord(m_writing,
+                         wil::filetime::to_int64(
+                             wil::filetime::get_system_time()),
+                         GetCurrentProcessId(), GetCurrentThreadId(),
+                         std::wstring_view(text, textLength));
+        }
+    }
+
+    if (m_writing.empty()) {
+        return;
+    }
+
+    // A batch is never split between files, so a file might be slightly
+    // larger than the maximum size.
+    if (m_file && m_fileSize + m_writing.size() > m_maxFileSize) {
+        m_file.reset();
+        RotateFiles();
+    }
+
+    if (!m_file && !OpenFile()) {
+        return;
+    }
+
+    DWORD written;
+    if (!WriteFile(m_file.get(), m_writing.data(),
+                   static_cast<DWORD>(m_writing.size()), &written, nullptr)) {
+        // Start over with a new file on the next write.
+        m_file.reset();
+        return;
+    }
+
+    m_fileSize += written;
+}
+
+bool LogFileSink::AppendRecord(std::vector<BYTE>& buffer,
+                               ULONGLONG timestamp,
+                               DWORD processId,
+                               DWORD threadId,
+                               std::wstring_view text) noexcept {
+    LogFileFormat::RecordHeader header{
+        .timestamp = timestamp,
+        .processId = processId,
+        .threadId = threadId,
+        .textLength = static_cast<DWORD>(text.size()),
+    };
+
+    auto* headerBytes = reinterpret_cast<const BYTE*>(&header);
+    auto* textBytes = reinterpret_cast<const BYTE*>(text.data());
+
+    try {
+        buffer.insert(buffer.end(), headerBytes, headerBytes + sizeof(header));
+        buffer.insert(buffer.end(), textBytes,
+                      textBytes + text.size() * sizeof(WCHAR));
+    } catch (const std::exception&) {
+        // Can't log, the line is counted as dropped by the caller.
+        return false;
+    }
+
+    return true;
+}
+
+bool LogFileSink::OpenFile() noexcept {
+    try {
+        m_file.reset(CreateFile(GetFilePath(0).c_str(), FILE_APPEND_DATA,
+                                FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                                OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+    } catch (const std::exception&) {
+        return false;
+    }
+
+    if (!m_file) {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(m_file.get(), &fileSize)) {
+        m_file.reset();
+        return false;
+    }
+
+    m_fileSize = static_cast<ULONGLONG>(fileSize.QuadPart);
+
+    if (m_fileSize == 0) {
+        LogFileFormat::FileHeader header{
+            .magic = LogFileFormat::kMagic,
+            .version = LogFileFormat::kVersion,
+        };
+
+        DWORD written;
+        if (!WriteFile(m_file.get(), &header, sizeof(header), &written,
+                       nullptr)) {
+            m_file.reset();
+            return false;
+        }
+
+        m_fileSize = written;
+    }
+
+    return true;
+}
+
+void LogFileSink::RotateFiles() noexcept {
+    try {
+        for (int i = m_maxFileCount - 1; i > 0; i--) {
+            MoveFileEx(GetFilePath(i - 1).c_str(), GetFilePath(i).c_str(),
+                       MOVEFILE_REPLACE_EXISTING);
+        }
+
+        if (m_maxFileCount == 1) {
+            DeleteFile(GetFilePath(0).c_str());
+        }
+    } catch (const std::exception&) {
+        // The current file is appended to if it can't be rotated.
+    }
+}
+
+std::filesystem::path LogFileSink::GetFilePath(int index) {
+    std::wstring fileName = LogFileFormat::kFileNamePrefix;
+    if (index > 0) {
+        fileName += L'.';
+        fileName += std::to_wstring(index);
+    }
+
+    fileName += LogFileFormat::kFileNameExtension;
+
+    return m_directory / fileName;
+}
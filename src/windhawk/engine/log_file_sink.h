@@ -0,0 +1,67 @@
+#pragma once
+
+// Writes the log lines which the session manager drains from the log ring to
+// size-capped rotating files, see LogFileFormat, so that logs are kept on
+// machines where nobody runs a debug output consumer. Enabled with the
+// LogFileMaxSize setting, in KB.
+//
+// Lines are appended to a pending buffer, and each batch is written by a
+// threadpool work item with a single WriteFile call, so that a slow disk
+// doesn't delay the drain. If the writer falls behind too much, new lines are
+// dropped and a line which tells how many were dropped is written instead.
+class LogFileSink {
+   public:
+    LogFileSink(std::filesystem::path directory,
+                ULONGLONG maxFileSize,
+                int maxFileCount);
+
+    LogFileSink(const LogFileSink&) = delete;
+    LogFileSink& operator=(const LogFileSink&) = delete;
+
+    // Returns nullptr if logging to files isn't enabled.
+    static std::unique_ptr<LogFileSink> CreateFromConfig();
+
+    // Never logs, since it's used while draining log lines.
+    void Append(ULONGLONG timestamp,
+                DWORD processId,
+                DWORD threadId,
+                std::wstring_view text) noexcept;
+
+    // Submits the lines which were appended since the last call for writing.
+    void Flush() noexcept;
+
+   private:
+    static constexpr size_t kMaxPendingSize = 4 * 1024 * 1024;
+
+    static void CALLBACK WorkCallback(PTP_CALLBACK_INSTANCE instance,
+                                      PVOID context,
+                                      PTP_WORK work);
+    void Write() noexcept;
+    bool AppendRecord(std::vector<BYTE>& buffer,
+                      ULONGLONG timestamp,
+                      DWORD processId,
+                      DWORD threadId,
+                      std::wstring_view text) noexcept;
+    bool OpenFile() noexcept;
+    void RotateFiles() noexcept;
+    std::filesystem::path GetFilePath(int index);
+
+    std::filesystem::path m_directory;
+    ULONGLONG m_maxFileSize;
+    int m_maxFileCount;
+
+    std::mutex m_pendingMutex;
+    std::vector<BYTE> m_pending;
+    ULONGLONG m_droppedCount = 0;
+
+    // Used by the work items, the callbacks of several submits might run
+    // concurrently.
+    std::mutex m_writeMutex;
+    std::vector<BYTE> m_writing;
+    wil::unique_hfile m_file;
+    ULONGLONG m_fileSize = 0;
+
+    // Declared last, so that the pending writes are done before the rest is
+    // destroyed.
+    wil::unique_threadpool_work_nocancel m_work;
+};
@@ -0,0 +1,84 @@
+#include "stdafx.h"
+
+#include "log_rate_limiter.h"
+#include "logger.h"
+#include "storage_manager.h"
+#include "var_init_once.h"
+
+namespace {
+
+ULONG GetLinesPerSecondFromConfig(ULONG defaultValue, ULONG maxValue) {
+    try {
+        auto settings = StorageManager::GetInstance().GetAppConfig(L"Settings");
+        int value = settings->GetInt(L"ModLogRateLimit")
+                        .value_or(static_cast<int>(defaultValue));
+        if (value <= 0) {
+            return 0;
+        }
+
+        return std::min(static_cast<ULONG>(value), maxValue);
+    } catch (const std::exception& e) {
+        LOG(L"Reading the ModLogRateLimit setting failed: %S", e.what());
+        return defaultValue;
+    }
+}
+
+}  // namespace
+
+LogRateLimiter::LogRateLimiter()
+    : m_linesPerSecond(GetLinesPerSecond()),
+      m_state((GetTickCount64() << kTokenBits) | m_linesPerSecond) {}
+
+bool LogRateLimiter::TryAcquire() noexcept {
+    if (!m_linesPerSecond) {
+        return true;
+    }
+
+    ULONGLONG now = GetTickCount64();
+    ULONGLONG state = m_state.load(std::memory_order_relaxed);
+
+    while (true) {
+        ULONGLONG lastRefillTime = state >> kTokenBits;
+        ULONGLONG tokens = state & kTokenMask;
+
+        ULONGLONG elapsed = now > lastRefillTime ? now - lastRefillTime : 0;
+        ULONGLONG refill = elapsed * m_linesPerSecond / 1000;
+        if (refill > 0) {
+            tokens = std::min(tokens + refill, ULONGLONG{m_linesPerSecond});
+            // Keep the remainder of the elapsed time for the next refill,
+            // unless the bucket is full.
+            lastRefillTime = tokens == m_linesPerSecond
+                                 ? now
+                                 : lastRefillTime +
+                                       refill * 1000 / m_linesPerSecond;
+        }
+
+        if (tokens == 0) {
+            m_suppressedCount.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        ULONGLONG newState = (lastRefillTime << kTokenBits) | (tokens - 1);
+        if (m_state.compare_exchange_weak(state, newState,
+                                          std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+}
+
+ULONG LogRateLimiter::TakeSuppressedCount() noexcept {
+    if (!m_suppressedCount.load(std::memory_order_relaxed)) {
+        return 0;
+    }
+
+    return m_suppressedCount.exchange(0, std::memory_order_relaxed);
+}
+
+// static
+ULONG LogRateLimiter::GetLinesPerSecond() {
+    STATIC_INIT_ONCE_TRIVIAL(
+        ULONG, linesPerSecond,
+        GetLinesPerSecondFromConfig(kDefaultLinesPerSecond,
+                                    static_cast<ULONG>(kTokenMask)));
+    return linesPerSecond;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+// A token bucket which limits the rate of the log lines of a mod, so that a
+// mod which logs in a frequently called hook doesn't flood the debug output
+// and slow down the process. The rate is set with the ModLogRateLimit engine
+// setting, in lines per second, and up to a second's worth of lines can be
+// logged in a burst. Lock free, since it's checked on every Wh_Log call, from
+// any thread.
+class LogRateLimiter {
+   public:
+    LogRateLimiter();
+
+    LogRateLimiter(const LogRateLimiter&) = delete;
+    LogRateLimiter& operator=(const LogRateLimiter&) = delete;
+
+    // Returns false if the line should be suppressed, in which case it's
+    // counted as such.
+    bool TryAcquire() noexcept;
+
+    // Returns the number of lines which were suppressed since the last call.
+    ULONG TakeSuppressedCount() noexcept;
+
+   private:
+    // The tokens are kept in the low bits of the state, and the time of the
+    // last refill, in milliseconds, in the rest of it.
+    static constexpr int kTokenBits = 20;
+    static constexpr ULONGLONG kTokenMask = (1ULL << kTokenBits) - 1;
+    static constexpr ULONG kDefaultLinesPerSecond = 500;
+
+    static ULONG GetLinesPerSecond();
+
+    // Zero if unlimited.
+    const ULONG m_linesPerSecond;
+    std::atomic<ULONGLONG> m_state;
+    std::atomic<ULONG> m_suppressedCount = 0;
+};
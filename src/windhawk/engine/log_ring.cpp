@@ -0,0 +1,480 @@
+#include "stdafx.h"
+
+#include "deferred_log_format.h"
+#include "functions.h"
+#include "log_ring.h"
+#include "logger.h"
+#include "no_destructor.h"
+#include "session_private_namespace.h"
+#include "var_init_once.h"
+
+// Opens the shared memory of a session manager once per process. A view is
+// never unmapped while the engine is loaded since it might be in use by other
+// threads, detaching only stops new lines from being appended.
+class LogRing::SharedDataCache {
+   public:
+    SharedData* GetAttached() noexcept {
+        return m_attached.load(std::memory_order_acquire);
+    }
+
+    void Attach(DWORD sessionManagerProcessId) noexcept {
+        std::lock_guard guard(m_mutex);
+
+        if (sessionManagerProcessId != m_sessionManagerProcessId) {
+            m_sessionManagerProcessId = sessionManagerProcessId;
+            m_sharedData = Open(sessionManagerProcessId);
+        }
+
+        m_attached.store(m_sharedData, std::memory_order_release);
+    }
+
+    void Detach() noexcept { m_attached.store(nullptr); }
+
+   private:
+    SharedData* Open(DWORD sessionManagerProcessId) noexcept {
+        try {
+            wil::unique_handle mapping(OpenFileMapping(
+                FILE_MAP_READ | FILE_MAP_WRITE, FALSE,
+                LogRing::MakeMappingName(sessionManagerProcessId).c_str()));
+            if (!mapping) {
+                VERBOSE(L"OpenFileMapping error: %u", GetLastError());
+                return nullptr;
+            }
+
+            wil::unique_mapview_ptr<SharedData> view(
+                reinterpret_cast<SharedData*>(MapViewOfFile(
+                    mapping.get(), FILE_MAP_READ | FILE_MAP_WRITE, 0, 0,
+                    sizeof(SharedData))));
+            if (!view) {
+                VERBOSE(L"MapViewOfFile error: %u", GetLastError());
+                return nullptr;
+            }
+
+            if (view->version != kVersion) {
+                VERBOSE(L"Unsupported log ring version %u", view->version);
+                return nullptr;
+            }
+
+            SharedData* sharedData = view.get();
+            m_mappings.push_back(std::move(mapping));
+            m_views.push_back(std::move(view));
+            return sharedData;
+        } catch (const std::exception& e) {
+            VERBOSE(L"Error: %S", e.what());
+            return nullptr;
+        }
+    }
+
+    std::atomic<SharedData*> m_attached = nullptr;
+    std::mutex m_mutex;
+    DWORD m_sessionManagerProcessId = 0;
+    SharedData* m_sharedData = nullptr;
+    std::vector<wil::unique_handle> m_mappings;
+    std::vector<wil::unique_mapview_ptr<SharedData>> m_views;
+};
+
+// static
+template <typename Filter, typename Callback>
+LONG64 LogRing::ReadRecords(const SharedData* data,
+                            LONG64* readIndex,
+                            int* uncommittedReads,
+                            Filter&& filter,
+                            Callback&& callback) {
+    LONG64 lostCount = 0;
+
+    LONG64 writeIndex = ReadAcquire64(&data->writeIndex);
+    if (writeIndex - *readIndex > static_cast<LONG64>(kRecordCount)) {
+        LONG64 newReadIndex = writeIndex - static_cast<LONG64>(kRecordCount);
+        lostCount += newReadIndex - *readIndex;
+        *readIndex = newReadIndex;
+        *uncommittedReads = 0;
+    }
+
+    alignas(WCHAR) BYTE recordData[sizeof(Record::data)];
+    WCHAR text[1025];
+
+    while (*readIndex < writeIndex) {
+        const Record& record = data->records[*readIndex % kRecordCount];
+        LONG64 sequence = ReadAcquire64(&record.sequence);
+
+        if (sequence == *readIndex + 1) {
+            ULONGLONG timestamp = record.timestamp;
+            DWORD processId = record.processId;
+            DWORD threadId = record.threadId;
+            DWORD flags = record.flags;
+            DWORD dataSize = std::min(record.dataSize,
+                                      static_cast<DWORD>(sizeof(recordData)));
+            if (flags & kRecordFlagDeferredFormat) {
+                memcpy(recordData, record.data, dataSize);
+            } else {
+                wcsncpy_s(text, record.text, _TRUNCATE);
+            }
+
+            MemoryBarrier();
+            if (ReadAcquire64(&record.sequence) == sequence) {
+                // The encoded data of a deferred line starts with its prefix.
+                std::wstring_view lineStart =
+                    (flags & kRecordFlagDeferredFormat)
+                        ? std::wstring_view(
+                              reinterpret_cast<const WCHAR*>(recordData),
+                              dataSize / sizeof(WCHAR))
+                        : std::wstring_view(text);
+                if (filter(processId, lineStart)) {
+                    if (flags & kRecordFlagDeferredFormat) {
+                        DeferredLogFormat::Decode(
+                            std::span<const BYTE>(recordData, dataSize), text);
+                    }
+
+                    callback(timestamp, processId, threadId, text);
+                }
+            } else {
+                // Overwritten by a newer line while copying.
+                lostCount++;
+            }
+        } else if (sequence > *readIndex + 1) {
+            // Already overwritten by a newer line.
+            lostCount++;
+        } else if (++*uncommittedReads < kMaxUncommittedReads) {
+            // Not committed yet, try again on the next read.
+            break;
+        } else {
+            lostCount++;
+        }
+
+        ++*readIndex;
+        *uncommittedReads = 0;
+    }
+
+    return lostCount;
+}
+
+LogRing::Owner::Owner(std::unique_ptr<LogFileSink> fileSink)
+    : m_fileSink(std::move(fileSink)) {
+    wil::unique_hlocal secDesc;
+    THROW_IF_WIN32_BOOL_FALSE(
+        Functions::GetFullAccessSecurityDescriptor(&secDesc, nullptr));
+
+    SECURITY_ATTRIBUTES secAttr = {sizeof(SECURITY_ATTRIBUTES)};
+    secAttr.lpSecurityDescriptor = secDesc.get();
+    secAttr.bInheritHandle = FALSE;
+
+    m_mapping.reset(CreateFileMapping(
+        INVALID_HANDLE_VALUE, &secAttr, PAGE_READWRITE, 0, sizeof(SharedData),
+        MakeMappingName(GetCurrentProcessId()).c_str()));
+    THROW_LAST_ERROR_IF(!m_mapping || GetLastError() == ERROR_ALREADY_EXISTS);
+
+    m_view.reset(MapViewOfFile(m_mapping.get(), FILE_MAP_READ | FILE_MAP_WRITE,
+                               0, 0, sizeof(SharedData)));
+    THROW_LAST_ERROR_IF(!m_view);
+
+    // The rest of the memory is zero-initialized.
+    auto* data = static_cast<SharedData*>(m_view.get());
+    data->version = kVersion;
+    data->verbosity = static_cast<LONG>(Logger::GetInstance().GetVerbosity());
+
+    m_nextVerbosityGenerationEvent = CreateVerbosityGenerationEvent(0);
+
+    m_timer.reset(CreateThreadpoolTimer(TimerCallback, this, nullptr));
+    THROW_LAST_ERROR_IF_NULL(m_timer);
+
+    FILETIME dueTime = wil::filetime::from_int64(static_cast<UINT64>(
+        -static_cast<INT64>(kDrainIntervalMs) *
+        wil::filetime_duration::one_millisecond));
+    SetThreadpoolTimer(m_timer.get(), &dueTime, kDrainIntervalMs, 0);
+}
+
+LogRing::Owner::~Owner() {
+    // Forward the lines which were appended since the last drain.
+    m_timer.reset();
+    Drain();
+}
+
+void LogRing::Owner::SetVerbosity(Logger::Verbosity verbosity) {
+    Logger::GetInstance().SetVerbosity(verbosity);
+
+    auto* data = static_cast<SharedData*>(m_view.get());
+    if (ReadNoFence(&data->verbosity) == static_cast<LONG>(verbosity)) {
+        return;
+    }
+
+    // Only the owner writes the generation.
+    LONG generation = data->verbosityGeneration;
+    auto nextEvent = CreateVerbosityGenerationEvent(generation + 1);
+
+    InterlockedExchange(&data->verbosity, static_cast<LONG>(verbosity));
+    WriteRelease(&data->verbosityGeneration, generation + 1);
+
+    // Wake up the engines which wait for the previous generation.
+    m_nextVerbosityGenerationEvent.SetEvent();
+    m_nextVerbosityGenerationEvent = std::move(nextEvent);
+}
+
+// static
+void CALLBACK LogRing::Owner::TimerCallback(PTP_CALLBACK_INSTANCE instance,
+                                            PVOID context,
+                                            PTP_TIMER timer) {
+    static_cast<Owner*>(context)->Drain();
+}
+
+void LogRing::Owner::Drain() noexcept {
+    // Skip the drain if the previous one is still running.
+    std::unique_lock lock(m_drainMutex, std::try_to_lock);
+    if (!lock) {
+        return;
+    }
+
+    LONG64 lostCount = ReadRecords(
+        static_cast<const SharedData*>(m_view.get()), &m_readIndex,
+        &m_uncommittedReads,
+        [](DWORD processId, std::wstring_view lineStart) { return true; },
+        [this](ULONGLONG timestamp, DWORD processId, DWORD threadId,
+               PCWSTR text) {
+            OutputDebugString(text);
+
+            if (m_fileSink) {
+                m_fileSink->Append(timestamp, processId, threadId, text);
+            }
+        });
+
+    if (lostCount > 0) {
+        LOG(L"%lld log lines were lost", lostCount);
+    }
+
+    if (m_fileSink) {
+        m_fileSink->Flush();
+    }
+}
+
+wil::unique_event_nothrow LogRing::Owner::CreateVerbosityGenerationEvent(
+    LONG generation) {
+    wil::unique_hlocal secDesc;
+    THROW_IF_WIN32_BOOL_FALSE(
+        Functions::GetFullAccessSecurityDescriptor(&secDesc, nullptr));
+
+    SECURITY_ATTRIBUTES secAttr = {sizeof(SECURITY_ATTRIBUTES)};
+    secAttr.lpSecurityDescriptor = secDesc.get();
+    secAttr.bInheritHandle = FALSE;
+
+    wil::unique_event_nothrow event(CreateEvent(
+        &secAttr, TRUE, FALSE,
+        MakeVerbosityEventName(GetCurrentProcessId(), generation).c_str()));
+    THROW_LAST_ERROR_IF_NULL(event);
+
+    return event;
+}
+
+LogRing::Attachment::Attachment(DWORD sessionManagerProcessId) noexcept
+    : m_sessionManagerProcessId(sessionManagerProcessId) {
+    GetCache().Attach(sessionManagerProcessId);
+
+    m_wait.reset(CreateThreadpoolWait(WaitCallback, this, nullptr));
+    if (!m_wait) {
+        LOG(L"CreateThreadpoolWait failed: %u", GetLastError());
+        return;
+    }
+
+    ApplyVerbosity();
+}
+
+LogRing::Attachment::~Attachment() {
+    m_wait.reset();
+    GetCache().Detach();
+}
+
+// static
+void CALLBACK LogRing::Attachment::WaitCallback(PTP_CALLBACK_INSTANCE instance,
+                                                PVOID context,
+                                                PTP_WAIT wait,
+                                                TP_WAIT_RESULT waitResult) {
+    static_cast<Attachment*>(context)->ApplyVerbosity();
+}
+
+void LogRing::Attachment::ApplyVerbosity() noexcept {
+    SharedData* data = GetCache().GetAttached();
+    if (!data) {
+        return;
+    }
+
+    for (int attempt = 0; attempt < kMaxVerbosityEventOpenAttempts;
+         attempt++) {
+        LONG generation = ReadAcquire(&data->verbosityGeneration);
+
+        LONG verbosity = ReadNoFence(&data->verbosity);
+        switch (verbosity) {
+            case static_cast<LONG>(Logger::Verbosity::kOff):
+            case static_cast<LONG>(Logger::Verbosity::kOn):
+            case static_cast<LONG>(Logger::Verbosity::kVerbose):
+                Logger::GetInstance().SetVerbosity(
+                    static_cast<Logger::Verbosity>(verbosity));
+                break;
+        }
+
+        wil::unique_event_nothrow event;
+        DWORD error;
+        try {
+            event.reset(OpenEvent(
+                SYNCHRONIZE, FALSE,
+                MakeVerbosityEventName(m_sessionManagerProcessId, generation)
+                    .c_str()));
+            error = GetLastError();
+        } catch (const std::exception& e) {
+            LOG(L"Error: %S", e.what());
+            return;
+        }
+
+        if (event) {
+            m_verbosityGenerationEvent = std::move(event);
+            SetThreadpoolWait(m_wait.get(), m_verbosityGenerationEvent.get(),
+                              nullptr);
+            return;
+        }
+
+        // The event is closed once the next generation is published, try
+        // again with the new generation.
+        if (ReadAcquire(&data->verbosityGeneration) == generation) {
+            LOG(L"OpenEvent error: %u", error);
+            return;
+        }
+    }
+
+    LOG(L"The verbosity changed too many times, changes are ignored");
+}
+
+LogRing::Reader::Reader(DWORD sessionManagerProcessId, const Filter& filter)
+    : m_processId(filter.processId) {
+    if (!filter.modName.empty()) {
+        m_linePrefix = L"[WH] [" + filter.modName + L"] ";
+    }
+
+    // The session manager has its namespace open already.
+    wil::unique_private_namespace_close privateNamespace;
+    if (sessionManagerProcessId != GetCurrentProcessId()) {
+        privateNamespace =
+            SessionPrivateNamespace::Open(sessionManagerProcessId);
+    }
+
+    m_mapping.reset(OpenFileMapping(
+        FILE_MAP_READ, FALSE,
+        MakeMappingName(sessionManagerProcessId).c_str()));
+    THROW_LAST_ERROR_IF_NULL(m_mapping);
+
+    m_view.reset(MapViewOfFile(m_mapping.get(), FILE_MAP_READ, 0, 0,
+                               sizeof(SharedData)));
+    THROW_LAST_ERROR_IF(!m_view);
+
+    auto* data = static_cast<const SharedData*>(m_view.get());
+    if (data->version != kVersion) {
+        throw std::runtime_error("Unsupported log ring version");
+    }
+
+    m_readIndex = ReadAcquire64(&data->writeIndex);
+}
+
+LONG64 LogRing::Reader::Read(const Callback& callback) {
+    return ReadRecords(
+        static_cast<const SharedData*>(m_view.get()), &m_readIndex,
+        &m_uncommittedReads,
+        [this](DWORD processId, std::wstring_view lineStart) {
+            return (!m_processId || processId == m_processId) &&
+                   lineStart.starts_with(m_linePrefix);
+        },
+        callback);
+}
+
+// static
+bool LogRing::Append(PCWSTR line) noexcept {
+    SharedData* data = GetCache().GetAttached();
+    if (!data) {
+        return false;
+    }
+
+    LONG64 index;
+    Record& record = BeginRecord(data, &index);
+
+    record.flags = 0;
+    record.dataSize = 0;
+    wcsncpy_s(record.text, line, _TRUNCATE);
+
+    CommitRecord(record, index);
+
+    return true;
+}
+
+// static
+bool LogRing::AppendDeferred(std::initializer_list<std::wstring_view> prefix,
+                             PCWSTR format,
+                             va_list args) noexcept {
+    SharedData* data = GetCache().GetAttached();
+    if (!data) {
+        return false;
+    }
+
+    // Encoded before claiming a record, since a claimed record can't be given
+    // back if the line can't be encoded.
+    BYTE encoded[sizeof(Record::data)];
+    size_t encodedSize =
+        DeferredLogFormat::Encode(encoded, prefix, format, args);
+    if (!encodedSize) {
+        return false;
+    }
+
+    LONG64 index;
+    Record& record = BeginRecord(data, &index);
+
+    record.flags = kRecordFlagDeferredFormat;
+    record.dataSize = static_cast<DWORD>(encodedSize);
+    memcpy(record.data, encoded, encodedSize);
+
+    CommitRecord(record, index);
+
+    return true;
+}
+
+// static
+std::wstring LogRing::MakeMappingName(DWORD sessionManagerProcessId) {
+    WCHAR szName[SessionPrivateNamespace::kPrivateNamespaceMaxLen +
+                 sizeof("\\LogRing")];
+    int namePos =
+        SessionPrivateNamespace::MakeName(szName, sessionManagerProcessId);
+    swprintf_s(szName + namePos, ARRAYSIZE(szName) - namePos, L"\\LogRing");
+    return szName;
+}
+
+// static
+std::wstring LogRing::MakeVerbosityEventName(DWORD sessionManagerProcessId,
+                                             LONG generation) {
+    WCHAR szName[SessionPrivateNamespace::kPrivateNamespaceMaxLen +
+                 sizeof("\\LogRingVerbosity-4294967295")];
+    int namePos =
+        SessionPrivateNamespace::MakeName(szName, sessionManagerProcessId);
+    swprintf_s(szName + namePos, ARRAYSIZE(szName) - namePos,
+               L"\\LogRingVerbosity-%u", static_cast<DWORD>(generation));
+    return szName;
+}
+
+// static
+LogRing::SharedDataCache& LogRing::GetCache() noexcept {
+    STATIC_INIT_ONCE(NoDestructorIfTerminating<SharedDataCache>, cache);
+    return **cache;
+}
+
+// static
+LogRing::Record& LogRing::BeginRecord(SharedData* data,
+                                      LONG64* index) noexcept {
+    *index = InterlockedIncrement64(&data->writeIndex) - 1;
+    Record& record = data->records[*index % kRecordCount];
+
+    InterlockedExchange64(&record.sequence, 0);
+
+    record.timestamp =
+        wil::filetime::to_int64(wil::filetime::get_system_time());
+    record.processId = GetCurrentProcessId();
+    record.threadId = GetCurrentThreadId();
+
+    return record;
+}
+
+// static
+void LogRing::CommitRecord(Record& record, LONG64 index) noexcept {
+    WriteRelease64(&record.sequence, index + 1);
+}
@@ -0,0 +1,219 @@
+#pragma once
+
+#include "log_file_sink.h"
+#include "logger.h"
+
+// A ring of log lines in shared memory which is owned by the session manager
+// process. The engines of all processes append their lines to it instead of
+// calling OutputDebugString, which serializes all processes of the system on
+// a single global mutex and waits for the debug output consumer on each call.
+// A line is appended by claiming the next record with an atomic increment of
+// the write index and committing it with its sequence number, so writers
+// never wait for each other or for the reader.
+//
+// The session manager drains the ring periodically and forwards the lines to
+// OutputDebugString, so that existing debug output consumers keep working. If
+// the reader falls behind by more than the ring size, the oldest lines are
+// dropped and a line which tells how many were lost is forwarded instead.
+// The lines can also be written to log files, see LogFileSink. Other
+// processes can read the lines as well, with a filter which is applied before
+// the lines are formatted, see Reader.
+//
+// A line can also be appended as its format string and raw arguments, see
+// DeferredLogFormat, in which case it's formatted by the session manager
+// instead of the logging thread.
+//
+// The session manager also publishes the logging verbosity, so that a change
+// of the setting is picked up by running engines without restarting them. A
+// new named event is created for each change, and the event of the previous
+// generation is signaled, so that each engine waits for its own event without
+// having to reset a shared one.
+class LogRing {
+   public:
+    static constexpr size_t kRecordCount = 2048;
+    static constexpr size_t kTextMaxLength = 1023;
+
+    LogRing() = delete;
+
+    // Used by the session manager, the shared memory exists as long as the
+    // object exists. Must be created after the private namespace of the
+    // session manager. If a file sink is given, the drained lines are also
+    // written to it.
+    class Owner {
+       public:
+        explicit Owner(std::unique_ptr<LogFileSink> fileSink = nullptr);
+        ~Owner();
+
+        Owner(const Owner&) = delete;
+        Owner& operator=(const Owner&) = delete;
+
+        // Publishes the verbosity to the engines which are attached to the
+        // ring, and applies it to the current process.
+        void SetVerbosity(Logger::Verbosity verbosity);
+
+       private:
+        static constexpr DWORD kDrainIntervalMs = 100;
+
+        static void CALLBACK TimerCallback(PTP_CALLBACK_INSTANCE instance,
+                                           PVOID context,
+                                           PTP_TIMER timer);
+        void Drain() noexcept;
+        wil::unique_event_nothrow CreateVerbosityGenerationEvent(
+            LONG generation);
+
+        wil::unique_handle m_mapping;
+        wil::unique_mapview_ptr<void> m_view;
+        // Signaled and replaced when the verbosity changes.
+        wil::unique_event_nothrow m_nextVerbosityGenerationEvent;
+        std::unique_ptr<LogFileSink> m_fileSink;
+        std::mutex m_drainMutex;
+        LONG64 m_readIndex = 0;
+        int m_uncommittedReads = 0;
+        // Declared last, so that the callbacks are done before the rest is
+        // destroyed.
+        wil::unique_threadpool_timer m_timer;
+    };
+
+    // Lines are appended to the ring of the given session manager while the
+    // object exists, and the verbosity which it publishes is applied to the
+    // logger. Held by the customization session of the process.
+    class Attachment {
+       public:
+        explicit Attachment(DWORD sessionManagerProcessId) noexcept;
+        ~Attachment();
+
+        Attachment(const Attachment&) = delete;
+        Attachment& operator=(const Attachment&) = delete;
+
+       private:
+        static void CALLBACK WaitCallback(PTP_CALLBACK_INSTANCE instance,
+                                          PVOID context,
+                                          PTP_WAIT wait,
+                                          TP_WAIT_RESULT waitResult);
+        // Applies the current verbosity and waits for the next change.
+        void ApplyVerbosity() noexcept;
+
+        DWORD m_sessionManagerProcessId;
+        wil::unique_event_nothrow m_verbosityGenerationEvent;
+        // Declared last, so that the callbacks are done before the rest is
+        // destroyed.
+        wil::unique_threadpool_wait m_wait;
+    };
+
+    // Reads the lines which are appended to the ring of the given session
+    // manager after the object is created, independently of the session
+    // manager and of other readers. Used by the app to deliver only the lines
+    // of the mod which is being edited to the editor.
+    class Reader {
+       public:
+        struct Filter {
+            // Zero for all processes.
+            DWORD processId = 0;
+            // Empty for all lines, otherwise only the lines which the given
+            // mod logged are read.
+            std::wstring modName;
+        };
+
+        using Callback = std::function<void(ULONGLONG timestamp,
+                                            DWORD processId,
+                                            DWORD threadId,
+                                            PCWSTR text)>;
+
+        Reader(DWORD sessionManagerProcessId, const Filter& filter);
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        // Calls the callback for each matching line which was appended since
+        // the last call, and returns the number of lines which were lost
+        // since the reader fell behind. Should be called about as often as
+        // the session manager drains the ring.
+        LONG64 Read(const Callback& callback);
+
+       private:
+        DWORD m_processId;
+        std::wstring m_linePrefix;
+        wil::unique_handle m_mapping;
+        wil::unique_mapview_ptr<void> m_view;
+        LONG64 m_readIndex;
+        int m_uncommittedReads = 0;
+    };
+
+    // Returns false if no ring is attached, in which case the caller should
+    // output the line in another way. Never logs, since it's used by the
+    // logger.
+    static bool Append(PCWSTR line) noexcept;
+
+    // Same as Append, but also returns false if the line can't be appended
+    // without formatting it, in which case the caller should format it.
+    static bool AppendDeferred(std::initializer_list<std::wstring_view> prefix,
+                               PCWSTR format,
+                               va_list args) noexcept;
+
+   private:
+    static constexpr DWORD kVersion = 3;
+    // The verbosity might change again while an engine opens the event of the
+    // current generation, in which case the event might be already closed.
+    static constexpr int kMaxVerbosityEventOpenAttempts = 16;
+    // A record which stays uncommitted for this many reads is skipped, its
+    // writer probably terminated in the middle of the write.
+    static constexpr int kMaxUncommittedReads = 10;
+
+    enum RecordFlags : DWORD {
+        kRecordFlagDeferredFormat = 0x00000001,
+    };
+
+    // The layout must be the same for 32-bit and 64-bit processes.
+    struct Record {
+        // The write index of the line plus one once the record is committed,
+        // zero while it's being written.
+        LONG64 sequence;
+        // As a FILETIME value.
+        ULONGLONG timestamp;
+        DWORD processId;
+        DWORD threadId;
+        DWORD flags;
+        // The size of data, only used with kRecordFlagDeferredFormat.
+        DWORD dataSize;
+        union {
+            WCHAR text[kTextMaxLength + 1];
+            BYTE data[(kTextMaxLength + 1) * sizeof(WCHAR)];
+        };
+    };
+
+    struct SharedData {
+        DWORD version;
+        // A Logger::Verbosity value.
+        LONG verbosity;
+        // Incremented after each change of verbosity.
+        LONG verbosityGeneration;
+        DWORD reserved;
+        // The number of records ever claimed, the next record is at this
+        // index modulo kRecordCount.
+        LONG64 writeIndex;
+        Record records[kRecordCount];
+    };
+
+    class SharedDataCache;
+
+    static std::wstring MakeMappingName(DWORD sessionManagerProcessId);
+    static std::wstring MakeVerbosityEventName(DWORD sessionManagerProcessId,
+                                               LONG generation);
+    static SharedDataCache& GetCache() noexcept;
+    // Claims the next record and fills everything but the payload, which must
+    // be written before calling CommitRecord.
+    static Record& BeginRecord(SharedData* data, LONG64* index) noexcept;
+    static void CommitRecord(Record& record, LONG64 index) noexcept;
+    // Calls the callback for each record which was committed since the last
+    // read, and advances the read index. uncommittedReads counts the reads
+    // during which the record at the read index stayed uncommitted. Records for which the filter returns
+    // false are skipped without being formatted, the filter gets the process
+    // ID and the start of the line before it's formatted, which is enough to
+    // match its prefix. Returns the number of lines which were lost.
+    template <typename Filter, typename Callback>
+    static LONG64 ReadRecords(const SharedData* data,
+                              LONG64* readIndex,
+                              int* uncommittedReads,
+                              Filter&& filter,
+                              Callback&& callback);
+};
@@ -1,31 +1,47 @@
 #include "stdafx.h"
 
+#include "engine_metrics.h"
+#include "log_ring.h"
 #include "logger.h"
 #include "storage_manager.h"
 #include "var_init_once.h"
 
 namespace {
 
-Logger::Verbosity GetVerbosityFromConfig() {
-    try {
-        auto settings = StorageManager::GetInstance().GetAppConfig(L"Settings");
-        int verbosity = settings->GetInt(L"LoggingVerbosity").value_or(0);
+struct InitialSettings {
+    Logger::Verbosity verbosity;
+    bool directDebugOutput;
+};
 
-        switch (verbosity) {
-            case static_cast<int>(Logger::Verbosity::kOff):
-                return Logger::Verbosity::kOff;
+std::mutex g_initialSettingsMutex;
+std::optional<InitialSettings> g_initialSettings;
 
-            case static_cast<int>(Logger::Verbosity::kOn):
-                return Logger::Verbosity::kOn;
+std::optional<InitialSettings> GetInitialSettings() {
+    std::lock_guard guard(g_initialSettingsMutex);
+    return g_initialSettings;
+}
 
-            case static_cast<int>(Logger::Verbosity::kVerbose):
-                return Logger::Verbosity::kVerbose;
-        }
+bool IsDirectDebugOutputInConfig() {
+    try {
+        auto settings = StorageManager::GetInstance().GetAppConfig(L"Settings");
+        return settings->GetInt(L"DirectDebugOutputLogging").value_or(0) != 0;
     } catch (const std::exception&) {
         // Ignore and use default settings. We can't log it, anyway.
     }
 
-    return Logger::kDefaultVerbosity;
+    return false;
+}
+
+Logger::Verbosity GetInitialVerbosity() {
+    auto initialSettings = GetInitialSettings();
+    return initialSettings ? initialSettings->verbosity
+                           : Logger::GetVerbosityFromConfig();
+}
+
+bool GetInitialDirectDebugOutput() {
+    auto initialSettings = GetInitialSettings();
+    return initialSettings ? initialSettings->directDebugOutput
+                           : IsDirectDebugOutputInConfig();
 }
 
 }  // namespace
@@ -40,19 +56,105 @@ Logger::ScopedThreadVerbosity::~ScopedThreadVerbosity() {
     }
 }
 
-Logger::Logger(Verbosity initialVerbosity)
-    : m_initialVerbosity(initialVerbosity), LoggerBase(initialVerbosity) {}
+Logger::Logger(Verbosity initialVerbosity, bool directDebugOutput)
+    : m_verbose(initialVerbosity >= Verbosity::kVerbose),
+      m_directDebugOutput(directDebugOutput),
+      LoggerBase(initialVerbosity) {
+    // The initial value of s_verboseLoggingUsers counts the logger as verbose.
+    if (!m_verbose) {
+        s_verboseLoggingUsers.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+// static
+void Logger::SetInitialSettings(Verbosity verbosity, bool directDebugOutput) {
+    std::lock_guard guard(g_initialSettingsMutex);
+    g_initialSettings = InitialSettings{
+        .verbosity = verbosity,
+        .directDebugOutput = directDebugOutput,
+    };
+}
 
 // static
 Logger& Logger::GetInstance() {
-    STATIC_INIT_ONCE(Logger, s, GetVerbosityFromConfig());
+    STATIC_INIT_ONCE(Logger, s, GetInitialVerbosity(),
+                     GetInitialDirectDebugOutput());
     return *s;
 }
 
+// static
+Logger::Verbosity Logger::GetVerbosityFromConfig() {
+    try {
+        auto settings = StorageManager::GetInstance().GetAppConfig(L"Settings");
+        int verbosity = settings->GetInt(L"LoggingVerbosity").value_or(0);
+
+        switch (verbosity) {
+            case static_cast<int>(Logger::Verbosity::kOff):
+                return Logger::Verbosity::kOff;
+
+            case static_cast<int>(Logger::Verbosity::kOn):
+                return Logger::Verbosity::kOn;
+
+            case static_cast<int>(Logger::Verbosity::kVerbose):
+                return Logger::Verbosity::kVerbose;
+        }
+    } catch (const std::exception&) {
+        // Ignore and use default settings. We can't log it, anyway.
+    }
+
+    return Logger::kDefaultVerbosity;
+}
+
 bool Logger::ShouldLog(Verbosity verbosity) {
+    if (m_threadVerbosityCount.load(std::memory_order_relaxed) == 0) {
+        return GetVerbosity() >= verbosity;
+    }
+
     auto& threadVerbosity = GetThreadVerbosity();
     return threadVerbosity ? *threadVerbosity >= verbosity
-                           : m_initialVerbosity >= verbosity;
+                           : GetVerbosity() >= verbosity;
+}
+
+void Logger::SetVerbosity(Verbosity verbosity) {
+    LoggerBase::SetVerbosity(verbosity);
+
+    bool verbose = verbosity >= Verbosity::kVerbose;
+    if (m_verbose.exchange(verbose) != verbose) {
+        s_verboseLoggingUsers.fetch_add(verbose ? 1 : -1,
+                                        std::memory_order_relaxed);
+    }
+}
+
+void Logger::VLogLine(PCWSTR format, va_list args) {
+    EngineMetrics::LogLineEmitted();
+
+    if (!m_directDebugOutput && LogRing::AppendDeferred({}, format, args)) {
+        return;
+    }
+
+    LoggerBase::VLogLine(format, args);
+}
+
+void Logger::VLogModLine(PCWSTR modName, PCWSTR format, va_list args) {
+    if (!m_directDebugOutput &&
+        LogRing::AppendDeferred({L"[WH] [", modName, L"] "}, format, args)) {
+        // Otherwise, counted by VLogLine.
+        EngineMetrics::LogLineEmitted();
+        return;
+    }
+
+    WCHAR logFormatted[1025];
+    _vsnwprintf_s(logFormatted, _TRUNCATE, format, args);
+
+    LogLine(L"[WH] [%s] %s\n", modName, logFormatted);
+}
+
+void Logger::Output(PCWSTR line) {
+    if (!m_directDebugOutput && LogRing::Append(line)) {
+        return;
+    }
+
+    LoggerBase::Output(line);
 }
 
 // static
@@ -70,13 +172,10 @@ bool Logger::SetThreadVerbosity(Verbosity verbosity) {
 
     threadVerbosity = verbosity;
 
-    std::lock_guard guard(m_threadVerbosityMutex);
-
-    m_threadVerbosityCount++;
-
-    if (GetVerbosity() < verbosity) {
-        SetVerbosity(verbosity);
-    }
+    // Only the current thread reads its own verbosity, so the counter doesn't
+    // have to be ordered with it.
+    m_threadVerbosityCount.fetch_add(1, std::memory_order_relaxed);
+    s_verboseLoggingUsers.fetch_add(1, std::memory_order_relaxed);
 
     return true;
 }
@@ -85,9 +184,6 @@ void Logger::ResetThreadVerbosity() {
     auto& threadVerbosity = GetThreadVerbosity();
     threadVerbosity.reset();
 
-    std::lock_guard guard(m_threadVerbosityMutex);
-
-    if (--m_threadVerbosityCount == 0) {
-        SetVerbosity(m_initialVerbosity);
-    }
+    m_threadVerbosityCount.fetch_sub(1, std::memory_order_relaxed);
+    s_verboseLoggingUsers.fetch_sub(1, std::memory_order_relaxed);
 }
@@ -19,26 +19,66 @@ class Logger : public LoggerBase {
         bool m_inUse = false;
     };
 
-    Logger(Verbosity initialVerbosity);
+    Logger(Verbosity initialVerbosity, bool directDebugOutput);
+
+    // Makes the logger use the given settings instead of reading them from
+    // the config, used with the settings passed by the session manager on
+    // injection. Must be called before the first GetInstance call.
+    static void SetInitialSettings(Verbosity verbosity, bool directDebugOutput);
 
     static Logger& GetInstance();
 
+    bool IsDirectDebugOutput() const { return m_directDebugOutput; }
+
+    // Reads the LoggingVerbosity setting, used on initialization and when the
+    // setting changes.
+    static Verbosity GetVerbosityFromConfig();
+
     bool ShouldLog(Verbosity verbosity);
 
+    // Hides LoggerBase::SetVerbosity to keep IsVerboseLoggingPossible up to
+    // date.
+    void SetVerbosity(Verbosity verbosity);
+
+    // A single relaxed load, checked by VERBOSE before anything else. False
+    // only if neither the logger nor any thread uses the verbose verbosity.
+    // True until the logger is created, since the configured verbosity isn't
+    // known yet.
+    static bool IsVerboseLoggingPossible() {
+        return s_verboseLoggingUsers.load(std::memory_order_relaxed) != 0;
+    }
+
+    // Unless the DirectDebugOutputLogging setting is set, the line is
+    // formatted by the session manager if possible, see LogRing.
+    void VLogLine(PCWSTR format, va_list args) override;
+    void VLogModLine(PCWSTR modName, PCWSTR format, va_list args);
+
+   protected:
+    // Lines are appended to the log ring of the session manager if it's
+    // available, unless the DirectDebugOutputLogging setting is set.
+    void Output(PCWSTR line) override;
+
    private:
     static std::optional<Verbosity>& GetThreadVerbosity();
     bool SetThreadVerbosity(Verbosity verbosity);
     void ResetThreadVerbosity();
 
-    const std::atomic<Verbosity> m_initialVerbosity;
-    std::mutex m_threadVerbosityMutex;
-    int m_threadVerbosityCount = 0;
+    // One for the logger if its verbosity is kVerbose, plus one for each
+    // thread with its own verbosity, which might be kVerbose. Updated with
+    // atomic increments, so that concurrent changes can't leave it stale.
+    static inline std::atomic<int> s_verboseLoggingUsers = 1;
+
+    std::atomic<bool> m_verbose;
+    const bool m_directDebugOutput;
+    // The number of threads which have their own verbosity. The verbosity of
+    // the current thread only has to be looked up if it's not zero.
+    std::atomic<int> m_threadVerbosityCount = 0;
 };
 
 #define LOG_WITH_VERBOSITY(verbosity, message, ...)                          \
     do {                                                                     \
         auto& inst = Logger::GetInstance();                                  \
-        if (inst.GetVerbosity() >= verbosity && inst.ShouldLog(verbosity)) { \
+        if (inst.ShouldLog(verbosity)) {                                     \
             inst.LogLine(L"[WH] [%S]: " message L"\n", __FUNCTION__,         \
                          __VA_ARGS__);                                       \
         }                                                                    \
@@ -46,5 +86,24 @@ class Logger : public LoggerBase {
 
 #define LOG(message, ...) \
     LOG_WITH_VERBOSITY(Logger::Verbosity::kOn, message, __VA_ARGS__)
-#define VERBOSE(message, ...) \
-    LOG_WITH_VERBOSITY(Logger::Verbosity::kVerbose, message, __VA_ARGS__)
+
+// Defined by release builds with the WindhawkStripVerboseLogging property. The
+// call sites are still compiled, so that they keep building, but no code is
+// generated for them.
+#ifdef WH_ENGINE_STRIP_VERBOSE_LOGGING
+#define VERBOSE(message, ...)                                           \
+    do {                                                                \
+        if constexpr (false) {                                          \
+            LOG_WITH_VERBOSITY(Logger::Verbosity::kVerbose, message,    \
+                               __VA_ARGS__);                            \
+        }                                                               \
+    } while (0)
+#else
+#define VERBOSE(message, ...)                                           \
+    do {                                                                \
+        if (Logger::IsVerboseLoggingPossible()) [[unlikely]] {          \
+            LOG_WITH_VERBOSITY(Logger::Verbosity::kVerbose, message,    \
+                               __VA_ARGS__);                            \
+        }                                                               \
+    } while (0)
+#endif  // WH_ENGINE_STRIP_VERBOSE_LOGGING
@@ -1,18 +1,32 @@
 #include "stdafx.h"
 
 #include "all_processes_injector.h"
+#include "crash_loop_guard.h"
 #include "customization_session.h"
 #include "dll_inject.h"
+#include "functions.h"
+#include "injection_stats.h"
+#include "log_ring.h"
 #include "logger.h"
+#include "mod_status_table.h"
 #include "no_destructor.h"
 #include "storage_manager.h"
+#include "symbol_broker.h"
+#include "symbol_prefetch.h"
+#include "targeting_dry_run.h"
+#include "trace_events.h"
+#include "visual_tree_notifier.h"
 
 HINSTANCE g_hDllInst;
+// For the injection stats, a QueryPerformanceCounter value.
+LONGLONG g_dllAttachTime;
 
 BOOL APIENTRY DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved) {
     switch (fdwReason) {
         case DLL_PROCESS_ATTACH:
             g_hDllInst = hinstDLL;
+            g_dllAttachTime = InjectionStats::Now();
+            TraceEvents::Register();
             break;
 
         case DLL_THREAD_ATTACH:
@@ -26,13 +40,56 @@ BOOL APIENTRY DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved) {
             // explicitly terminated by a call to the ExitProcess function.
             if (lpvReserved) {
                 NoDestructorIfTerminatingBase::SetProcessTerminating();
+
+                // A crash doesn't get here, since the process is terminated
+                // right away.
+                CrashLoopGuard::OnProcessExit();
             }
+
+            TraceEvents::Unregister();
             break;
     }
 
     return TRUE;
 }
 
+namespace {
+
+using MOD_STATUS_READ_CALLBACK = void (*)(void* context,
+                                          ULONG id,
+                                          ULONG version,
+                                          DWORD processId,
+                                          ULONGLONG creationTime,
+                                          PCWSTR modName,
+                                          PCWSTR processName,
+                                          PCWSTR value);
+
+using LOG_RING_READ_CALLBACK = void (*)(void* context,
+                                        ULONGLONG timestamp,
+                                        DWORD processId,
+                                        DWORD threadId,
+                                        PCWSTR text);
+
+// Logs how many of the resident pages of the engine image are shared with
+// other processes. ASLR images are relocated once per boot, and the relocated
+// pages are shared by all processes which map the image at the same address.
+// If that address is already taken in a process, the image is relocated
+// privately, and each relocated page becomes private memory.
+void LogEngineImagePageSharing() {
+    size_t residentCount;
+    size_t sharedCount;
+    if (!Functions::CountResidentImagePages(g_hDllInst, &residentCount,
+                                            &sharedCount)) {
+        VERBOSE(L"K32QueryWorkingSetEx error: %u", GetLastError());
+        return;
+    }
+
+    VERBOSE(L"Engine image at %p: %zu of %zu resident pages are shared",
+            g_hDllInst, sharedCount, residentCount);
+}
+
+}  // namespace
+
 bool LazyInitialize() {
     try {
         // Make sure we can get an instance.
@@ -47,12 +104,34 @@ bool LazyInitialize() {
 
 // Exported
 BOOL InjectInit(const DllInject::LOAD_LIBRARY_REMOTE_DATA* pInjData) {
+    InjectionStats::SetEngineLoadTimes(g_dllAttachTime, InjectionStats::Now());
+
+    // Use the values of the session manager, so that nothing has to be read
+    // from engine.ini or the settings before a mod is loaded.
+    const auto* startupData = DllInject::GetStartupData(pInjData);
+    Logger::SetInitialSettings(
+        static_cast<Logger::Verbosity>(pInjData->nLogVerbosity),
+        !!startupData->bDirectDebugOutput);
+    if (startupData->bStorageValid) {
+        StorageManager::SetStartupValues({
+            .portable = !!startupData->bPortableStorage,
+            .appDataPath = DllInject::GetStartupDataString(
+                startupData, startupData->dwAppDataPathOffset),
+            .registryKey = DllInject::GetStartupDataString(
+                startupData, startupData->dwRegistryKeyOffset),
+        });
+    }
+
     if (!LazyInitialize()) {
         return FALSE;
     }
 
     VERBOSE(L"Running InjectInit");
 
+    if (Logger::GetInstance().ShouldLog(Logger::Verbosity::kVerbose)) {
+        LogEngineImagePageSharing();
+    }
+
     if (WaitForSingleObject(pInjData->hSessionManagerProcess, 0) ==
         WAIT_OBJECT_0) {
         VERBOSE(L"Session manager process is no longer running");
@@ -78,8 +157,6 @@ BOOL InjectInit(const DllInject::LOAD_LIBRARY_REMOTE_DATA* pInjData) {
 
 // Exported
 HANDLE GlobalHookSessionStart() {
-// Only used by the x86 background process.
-#ifdef _M_IX86
     if (!LazyInitialize()) {
         return nullptr;
     }
@@ -91,14 +168,13 @@ HANDLE GlobalHookSessionStart() {
     } catch (const std::exception& e) {
         LOG(L"%S", e.what());
     }
-#endif  // _M_IX86
 
     return nullptr;
 }
 
 // Exported
-BOOL GlobalHookSessionHandleNewProcesses(HANDLE hSession) {
-#ifdef _M_IX86
+BOOL GlobalHookSessionHandleNewProcesses(HANDLE hSession,
+                                         int* pInjectedCount) {
     if (!LazyInitialize()) {
         return FALSE;
     }
@@ -106,16 +182,54 @@ BOOL GlobalHookSessionHandleNewProcesses(HANDLE hSession) {
     // VERBOSE(L"Running GlobalHookSessionHandleNewProcesses");
 
     auto allProcessInjector = static_cast<AllProcessesInjector*>(hSession);
-    allProcessInjector->InjectIntoNewProcesses();
+    int injectedCount = allProcessInjector->InjectIntoNewProcesses();
+    if (pInjectedCount) {
+        *pInjectedCount = injectedCount;
+    }
+
+    return TRUE;
+}
+
+// Exported
+BOOL GlobalHookSessionReloadSettings(HANDLE hSession) {
+    if (!LazyInitialize()) {
+        return FALSE;
+    }
+
+    VERBOSE(L"Running GlobalHookSessionReloadSettings");
+
+    auto allProcessInjector = static_cast<AllProcessesInjector*>(hSession);
+    allProcessInjector->ReloadSettings();
     return TRUE;
-#else
-	return FALSE;
-#endif  // _M_IX86
+}
+
+// Exported
+BOOL GlobalHookSessionSetModsPaused(HANDLE hSession, BOOL paused) {
+    if (!LazyInitialize()) {
+        return FALSE;
+    }
+
+    VERBOSE(L"Running GlobalHookSessionSetModsPaused, paused=%d", paused);
+
+    auto allProcessInjector = static_cast<AllProcessesInjector*>(hSession);
+    return allProcessInjector->SetModsPaused(!!paused);
+}
+
+// Exported
+BOOL GlobalHookSessionShutdown(HANDLE hSession, DWORD stageTimeout) {
+    if (!LazyInitialize()) {
+        return FALSE;
+    }
+
+    VERBOSE(L"Running GlobalHookSessionShutdown, stageTimeout=%u",
+            stageTimeout);
+
+    auto allProcessInjector = static_cast<AllProcessesInjector*>(hSession);
+    return allProcessInjector->Shutdown(stageTimeout);
 }
 
 // Exported
 BOOL GlobalHookSessionEnd(HANDLE hSession) {
-#ifdef _M_IX86
     if (!LazyInitialize()) {
         return FALSE;
     }
@@ -126,7 +240,306 @@ BOOL GlobalHookSessionEnd(HANDLE hSession) {
     delete allProcessInjector;
 
     return TRUE;
-#else
+}
+
+// Exported
+HANDLE SymbolPrefetchStart() {
+    if (!LazyInitialize()) {
+        return nullptr;
+    }
+
+    VERBOSE(L"Running SymbolPrefetchStart");
+
+    try {
+        return static_cast<HANDLE>(new SymbolPrefetcher());
+    } catch (const std::exception& e) {
+        LOG(L"%S", e.what());
+    }
+
+    return nullptr;
+}
+
+// Exported
+BOOL SymbolPrefetchRun(HANDLE hSession, HANDLE hStopEvent) {
+    if (!LazyInitialize()) {
+        return FALSE;
+    }
+
+    VERBOSE(L"Running SymbolPrefetchRun");
+
+    try {
+        auto symbolPrefetcher = static_cast<SymbolPrefetcher*>(hSession);
+        symbolPrefetcher->Run(hStopEvent);
+        return TRUE;
+    } catch (const std::exception& e) {
+        LOG(L"%S", e.what());
+    }
+
+    return FALSE;
+}
+
+// Exported
+HANDLE SymbolPrefetchGetModsChangeEvent(HANDLE hSession) {
+    auto symbolPrefetcher = static_cast<SymbolPrefetcher*>(hSession);
+    return symbolPrefetcher->GetModsChangeEvent();
+}
+
+// Exported
+BOOL SymbolPrefetchContinueMonitoring(HANDLE hSession) {
+    auto symbolPrefetcher = static_cast<SymbolPrefetcher*>(hSession);
+    symbolPrefetcher->ContinueMonitoring();
+    return TRUE;
+}
+
+// Exported
+BOOL SymbolPrefetchEnd(HANDLE hSession) {
+    if (!LazyInitialize()) {
+        return FALSE;
+    }
+
+    VERBOSE(L"Running SymbolPrefetchEnd");
+
+    auto symbolPrefetcher = static_cast<SymbolPrefetcher*>(hSession);
+    delete symbolPrefetcher;
+
+    return TRUE;
+}
+
+// Exported
+BOOL SymbolBrokerRun(HANDLE hStopEvent) {
+    if (!LazyInitialize()) {
+        return FALSE;
+    }
+
+    VERBOSE(L"Running SymbolBrokerRun");
+
+    try {
+        SymbolBroker::RunServer(hStopEvent);
+        return TRUE;
+    } catch (const std::exception& e) {
+        LOG(L"%S", e.what());
+    }
+
+    return FALSE;
+}
+
+// Exported
+BOOL InjectionStatsGetReport(DWORD dwSessionManagerProcessId,
+                             PWSTR pszReport,
+                             SIZE_T cchReport) {
+    if (!LazyInitialize()) {
+        return FALSE;
+    }
+
+    try {
+        auto report = InjectionStats::GetReport(dwSessionManagerProcessId);
+        wcsncpy_s(pszReport, cchReport, report.c_str(), _TRUNCATE);
+        return TRUE;
+    } catch (const std::exception& e) {
+        LOG(L"%S", e.what());
+    }
+
+    return FALSE;
+}
+
+// Exported
+BOOL InjectionStatsGetJsonReport(DWORD dwSessionManagerProcessId,
+                                 PWSTR pszReport,
+                                 SIZE_T cchReport) {
+    if (!LazyInitialize()) {
+        return FALSE;
+    }
+
+    try {
+        auto report = InjectionStats::GetReport(
+            dwSessionManagerProcessId, InjectionStats::ReportFormat::kJson);
+        // A truncated report isn't valid JSON.
+        if (report.length() >= cchReport) {
+            throw std::length_error("Report buffer too small");
+        }
+
+        wcscpy_s(pszReport, cchReport, report.c_str());
+        return TRUE;
+    } catch (const std::exception& e) {
+        LOG(L"%S", e.what());
+    }
+
+    return FALSE;
+}
+
+// Exported
+HANDLE TargetingDryRunOpen() {
+    if (!LazyInitialize()) {
+        return nullptr;
+    }
+
+    try {
+        return static_cast<HANDLE>(new TargetingDryRun());
+    } catch (const std::exception& e) {
+        LOG(L"%S", e.what());
+    }
+
+    return nullptr;
+}
+
+// Exported
+// The names of the mods are separated by '|'.
+BOOL TargetingDryRunEvaluate(HANDLE hDryRun,
+                             HANDLE hProcess,
+                             BOOL* pbExcluded,
+                             PWSTR pszModNames,
+                             SIZE_T cchModNames) {
+    try {
+        auto dryRun = static_cast<TargetingDryRun*>(hDryRun);
+        auto result = dryRun->Evaluate(hProcess);
+
+        std::wstring modNames;
+        for (const auto& modName : result.modNames) {
+            if (!modNames.empty()) {
+                modNames += L'|';
+            }
+
+            modNames += modName;
+        }
+
+        if (modNames.length() >= cchModNames) {
+            throw std::length_error("Mod names buffer too small");
+        }
+
+        *pbExcluded = result.excluded;
+        wcscpy_s(pszModNames, cchModNames, modNames.c_str());
+        return TRUE;
+    } catch (const std::exception& e) {
+        VERBOSE(L"%S", e.what());
+    }
+
+    return FALSE;
+}
+
+// Exported
+BOOL TargetingDryRunClose(HANDLE hDryRun) {
+    auto dryRun = static_cast<TargetingDryRun*>(hDryRun);
+    delete dryRun;
+
+    return TRUE;
+}
+
+// Exported
+HANDLE ModStatusReaderOpen(DWORD dwSessionManagerProcessId, DWORD dwKind) {
+    if (!LazyInitialize()) {
+        return nullptr;
+    }
+
+    try {
+        if (dwKind >= static_cast<DWORD>(ModStatusTable::Kind::kCount)) {
+            throw std::invalid_argument("Invalid mod status kind");
+        }
+
+        return static_cast<HANDLE>(new ModStatusTable::Reader(
+            dwSessionManagerProcessId,
+            static_cast<ModStatusTable::Kind>(dwKind)));
+    } catch (const std::exception& e) {
+        LOG(L"%S", e.what());
+    }
+
+    return nullptr;
+}
+
+// Exported
+HANDLE ModStatusReaderGetChangeEvent(HANDLE hReader) {
+    auto reader = static_cast<ModStatusTable::Reader*>(hReader);
+    return reader->GetChangeEvent();
+}
+
+// Exported
+BOOL ModStatusReaderContinueMonitoring(HANDLE hReader) {
+    auto reader = static_cast<ModStatusTable::Reader*>(hReader);
+    reader->ContinueMonitoring();
+    return TRUE;
+}
+
+// Exported
+BOOL ModStatusReaderRead(HANDLE hReader,
+                         MOD_STATUS_READ_CALLBACK callback,
+                         void* context) {
+    try {
+        auto reader = static_cast<ModStatusTable::Reader*>(hReader);
+        for (const auto& item : reader->Read()) {
+            callback(context, item.id, item.version, item.processId,
+                     item.creationTime, item.modName.c_str(),
+                     item.processName.c_str(), item.value.c_str());
+        }
+
+        return TRUE;
+    } catch (const std::exception& e) {
+        LOG(L"%S", e.what());
+    }
+
+    return FALSE;
+}
+
+// Exported
+BOOL ModStatusReaderClose(HANDLE hReader) {
+    auto reader = static_cast<ModStatusTable::Reader*>(hReader);
+    delete reader;
+
+    return TRUE;
+}
+
+// Exported
+HANDLE LogRingReaderOpen(DWORD dwSessionManagerProcessId,
+                         DWORD dwProcessId,
+                         PCWSTR pszModName) {
+    if (!LazyInitialize()) {
+        return nullptr;
+    }
+
+    try {
+        LogRing::Reader::Filter filter{
+            .processId = dwProcessId,
+            .modName = pszModName ? pszModName : L"",
+        };
+        return static_cast<HANDLE>(
+            new LogRing::Reader(dwSessionManagerProcessId, filter));
+    } catch (const std::exception& e) {
+        LOG(L"%S", e.what());
+    }
+
+    return nullptr;
+}
+
+// Exported
+BOOL LogRingReaderRead(HANDLE hReader,
+                       LOG_RING_READ_CALLBACK callback,
+                       void* context,
+                       ULONGLONG* pLostCount) {
+    try {
+        auto reader = static_cast<LogRing::Reader*>(hReader);
+        LONG64 lostCount =
+            reader->Read([callback, context](ULONGLONG timestamp,
+                                             DWORD processId, DWORD threadId,
+                                             PCWSTR text) {
+                callback(context, timestamp, processId, threadId, text);
+            });
+        *pLostCount = static_cast<ULONGLONG>(lostCount);
+        return TRUE;
+    } catch (const std::exception& e) {
+        LOG(L"%S", e.what());
+    }
+
     return FALSE;
-#endif  // _M_IX86
+}
+
+// Exported
+BOOL LogRingReaderClose(HANDLE hReader) {
+    auto reader = static_cast<LogRing::Reader*>(hReader);
+    delete reader;
+
+    return TRUE;
+}
+
+// Exported, used by XAML diagnostics to create the TAP of the visual tree
+// notifier.
+STDAPI DllGetClassObject(REFCLSID rclsid, REFIID riid, LPVOID* ppv) {
+    return VisualTreeNotifier::GetClassObject(rclsid, riid, ppv);
 }
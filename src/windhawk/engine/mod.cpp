@@ -1,14 +1,35 @@
 #include "stdafx.h"
 
+#include "crash_loop_guard.h"
 #include "customization_session.h"
+#include "disassembler.h"
+#include "engine_metrics.h"
 #include "functions.h"
+#include "hook_apply_scheduler.h"
+#include "http_client.h"
+#include "import_hooks.h"
 #include "logger.h"
 #include "mod.h"
+#include "mod_cpu_sampler.h"
+#include "mod_config_snapshot.h"
+#include "module_identity_cache.h"
+#include "module_load_notifier.h"
+#include "path_pattern.h"
+#include "pattern_scanner.h"
 #include "process_lists.h"
 #include "session_private_namespace.h"
 #include "storage_manager.h"
+#include "symbol_broker.h"
+#include "symbol_cache.h"
 #include "symbol_enum.h"
+#include "symbol_index.h"
+#include "symbol_load_throttle.h"
+#include "symbol_resolution_trace.h"
+#include "thread_call.h"
+#include "trace_events.h"
+#include "url_cache.h"
 #include "version.h"
+#include "visual_tree_notifier.h"
 
 extern HINSTANCE g_hDllInst;
 
@@ -63,11 +84,71 @@ class ModDebugLoggingScopeHelper {
 #define MOD_DEBUG_LOGGING_SCOPE_QUIET() \
     ModDebugLoggingScopeHelper(m_debugLoggingEnabled, nullptr)
 
+// The name of an object shared by all processes of the session, in the private
+// namespace of the session manager.
+std::wstring MakeSessionObjectName(PCWSTR identifier) {
+    DWORD dwSessionManagerProcessId =
+        CustomizationSession::GetSessionManagerProcessId();
+
+    WCHAR sessionPrivateNamespaceName
+        [SessionPrivateNamespace::kPrivateNamespaceMaxLen + 1];
+    SessionPrivateNamespace::MakeName(sessionPrivateNamespaceName,
+                                      dwSessionManagerProcessId);
+
+    std::wstring objectName = sessionPrivateNamespaceName;
+    objectName += L'\\';
+    objectName += identifier;
+    return objectName;
+}
+
+// Allows access from all processes of the session, including sandboxed ones.
+struct SessionObjectSecurityAttributes {
+    wil::unique_hlocal secDesc;
+    SECURITY_ATTRIBUTES attributes;
+};
+
+SessionObjectSecurityAttributes GetSessionObjectSecurityAttributes() {
+    SessionObjectSecurityAttributes result;
+    THROW_IF_WIN32_BOOL_FALSE(
+        Functions::GetFullAccessSecurityDescriptor(&result.secDesc, nullptr));
+
+    result.attributes = {
+        .nLength = sizeof(result.attributes),
+        .lpSecurityDescriptor = result.secDesc.get(),
+        .bInheritHandle = FALSE,
+    };
+    return result;
+}
+
+// A mutex shared by all processes of the session, which guards work such as
+// downloading a file. The owner can mark the work as completed, which releases
+// all waiters at once, so that they can use the result concurrently instead of
+// taking the mutex one at a time.
 class CrossModMutex {
    public:
+    enum class WaitResult {
+        kAcquired,
+        kCompleted,
+        kFailed,
+    };
+
     CrossModMutex(PCWSTR mutexIdentifier) {
         try {
-            m_mutex.reset(CreateSymbolLoadLockMutex(mutexIdentifier, FALSE));
+            auto mutexName = MakeSessionObjectName(mutexIdentifier);
+            auto secAttr = GetSessionObjectSecurityAttributes();
+
+            m_mutex.reset(CreateMutex(&secAttr.attributes, FALSE,
+                                      mutexName.c_str()));
+            THROW_LAST_ERROR_IF_NULL(m_mutex);
+
+            // Optional, without it, waiters always take the mutex.
+            mutexName += L"-Completed";
+            m_completedEvent.reset(CreateEvent(&secAttr.attributes, TRUE,
+                                               FALSE, mutexName.c_str()));
+            if (!m_completedEvent) {
+                LOG(L"Couldn't create the completion event: %u",
+                    GetLastError());
+            }
         } catch (const std::exception& e) {
             LOG(L"%S", e.what());
         }
@@ -80,79 +161,43 @@ class CrossModMutex {
         return !!m_mutexLock;
     }
 
-   private:
-    HANDLE CreateSymbolLoadLockMutex(PCWSTR mutexIdentifier,
-                                     BOOL initialOwner) {
-        DWORD dwSessionManagerProcessId =
-            CustomizationSession::GetSessionManagerProcessId();
-
-        WCHAR sessionPrivateNamespaceName
-            [SessionPrivateNamespace::kPrivateNamespaceMaxLen + 1];
-        SessionPrivateNamespace::MakeName(sessionPrivateNamespaceName,
-                                          dwSessionManagerProcessId);
-
-        std::wstring mutexName = sessionPrivateNamespaceName;
-        mutexName += L'\\';
-        mutexName += mutexIdentifier;
-
-        wil::unique_hlocal secDesc;
-        THROW_IF_WIN32_BOOL_FALSE(
-            Functions::GetFullAccessSecurityDescriptor(&secDesc, nullptr));
+    // Waits until either the mutex is acquired, or the work is marked as
+    // completed by another owner, in which case the mutex isn't acquired.
+    WaitResult AcquireOrWaitForCompletion() {
+        if (!m_completedEvent) {
+            return Acquire() ? WaitResult::kAcquired : WaitResult::kFailed;
+        }
 
-        SECURITY_ATTRIBUTES secAttr{
-            .nLength = sizeof(secAttr),
-            .lpSecurityDescriptor = secDesc.get(),
-            .bInheritHandle = FALSE,
-        };
+        // The event comes first, so that if both are signaled, the mutex isn't
+        // acquired.
+        HANDLE handles[] = {m_completedEvent.get(), m_mutex.get()};
+        DWORD waitResult = WaitForMultipleObjects(ARRAYSIZE(handles), handles,
+                                                  FALSE, INFINITE);
+        switch (waitResult) {
+            case WAIT_OBJECT_0:
+                return WaitResult::kCompleted;
+
+            case WAIT_OBJECT_0 + 1:
+            case WAIT_ABANDONED_0 + 1:
+                m_mutexLock.reset(m_mutex.get());
+                return WaitResult::kAcquired;
+        }
 
-        wil::unique_mutex_nothrow mutex(
-            CreateMutex(&secAttr, initialOwner, mutexName.c_str()));
-        THROW_LAST_ERROR_IF_NULL(mutex);
+        return WaitResult::kFailed;
+    }
 
-        return mutex.release();
+    void MarkCompleted() {
+        if (m_completedEvent) {
+            m_completedEvent.SetEvent();
+        }
     }
 
+   private:
     wil::unique_mutex_nothrow m_mutex;
+    wil::unique_event_nothrow m_completedEvent;
     wil::mutex_release_scope_exit m_mutexLock;
 };
 
-std::wstring GenerateModInstanceId(PCWSTR modName) {
-    DWORD sessionManagerProcessId =
-        CustomizationSession::GetSessionManagerProcessId();
-
-    FILETIME sessionManagerProcessCreationTime =
-        CustomizationSession::GetSessionManagerProcessCreationTime();
-
-    return std::to_wstring(sessionManagerProcessId) + L"_" +
-           std::to_wstring(
-               wil::filetime::to_int64(sessionManagerProcessCreationTime)) +
-           L"_" + std::to_wstring(GetCurrentProcessId()) + L"_" + modName;
-}
-
-void SetModMetadataValue(wil::unique_hfile& metadataFile,
-                         PCWSTR value,
-                         PCWSTR metadataCategory,
-                         PCWSTR modInstanceId) {
-    if (!value) {
-        metadataFile.reset();
-        return;
-    }
-
-    auto& storageManager = StorageManager::GetInstance();
-
-    if (!metadataFile) {
-        metadataFile = storageManager.CreateModMetadataFile(metadataCategory,
-                                                            modInstanceId);
-    }
-
-    std::filesystem::path fullProcessImageName =
-        wil::QueryFullProcessImageName<std::wstring>(GetCurrentProcess());
-    std::wstring fullValue =
-        fullProcessImageName.filename().native() + L'|' + value;
-
-    storageManager.SetModMetadataValue(metadataFile, fullValue.c_str());
-}
-
 bool DoesArchitectureMatchPatternPart(std::wstring_view patternPart) {
 #if defined(_M_IX86)
     if (patternPart == L"x86") {
@@ -186,19 +231,141 @@ bool DoesArchitectureMatchPattern(std::wstring_view pattern) {
     return false;
 }
 
-std::wstring GetModVersion(PCWSTR modName) {
-    auto settings =
-        StorageManager::GetInstance().GetModConfig(modName, nullptr);
+bool DoesModTargetRunningProcess(
+    const ModConfigSnapshot::ModConfig& modConfig) {
+    if (modConfig.disabled) {
+        return false;
+    }
+
+    const auto& architecturePattern = modConfig.architecture;
+    if (!architecturePattern.empty() &&
+        !DoesArchitectureMatchPattern(architecturePattern)) {
+        return false;
+    }
+
+    bool patternsMatchCriticalSystemProcesses =
+        modConfig.patternsMatchCriticalSystemProcesses;
+
+    // The process path and whether it's a critical process are only computed
+    // once.
+    STATIC_INIT_ONCE(NoDestructorIfTerminating<PathPattern::Path>, processPath,
+                     wil::GetModuleFileName<std::wstring>());
+    STATIC_INIT_ONCE_TRIVIAL(bool, isCriticalProcess, []() {
+        PathPattern::Path path(wil::GetModuleFileName<std::wstring>());
+        return PathPattern(ProcessLists::kCriticalProcesses).Matches(path) ||
+               PathPattern(ProcessLists::kCriticalProcessesForMods)
+                   .Matches(path);
+    }());
+
+    bool includeExcludeCustomOnly = modConfig.includeExcludeCustomOnly;
+
+    bool matchPatternExplicitOnly =
+        !patternsMatchCriticalSystemProcesses && isCriticalProcess;
+
+    auto matchesPattern = [processPath](const std::wstring& pattern,
+                                        bool explicitOnly) {
+        return !pattern.empty() &&
+               PathPattern(pattern).Matches(**processPath, explicitOnly);
+    };
+
+    bool include =
+        (!includeExcludeCustomOnly &&
+         matchesPattern(modConfig.include, matchPatternExplicitOnly)) ||
+        matchesPattern(modConfig.includeCustom, matchPatternExplicitOnly);
+
+    if (!include) {
+        return false;
+    }
+
+    bool exclude = (!includeExcludeCustomOnly &&
+                    matchesPattern(modConfig.exclude, false)) ||
+                   matchesPattern(modConfig.excludeCustom, false);
+
+    return !exclude;
+}
+
+// Remembers the last load decision of each mod together with the targeting
+// values it was made for.
+class LoadDecisionCache {
+   public:
+    std::optional<bool> Get(const ModConfigSnapshot::ModConfig& modConfig) {
+        std::lock_guard guard(m_mutex);
+
+        auto it = m_decisions.find(modConfig.name);
+        if (it == m_decisions.end() ||
+            !ModConfigSnapshot::HasSameTargeting(it->second.modConfig,
+                                                 modConfig)) {
+            return std::nullopt;
+        }
+
+        return it->second.decision;
+    }
+
+    void Set(const ModConfigSnapshot::ModConfig& modConfig, bool decision) {
+        std::lock_guard guard(m_mutex);
+
+        m_decisions.insert_or_assign(
+            modConfig.name,
+            Decision{.modConfig = modConfig, .decision = decision});
+    }
+
+   private:
+    struct Decision {
+        ModConfigSnapshot::ModConfig modConfig;
+        bool decision;
+    };
+
+    std::mutex m_mutex;
+    std::unordered_map<std::wstring, Decision> m_decisions;
+};
+
+// Returns the values which decide whether and how the mod is loaded, or
+// nullopt if the mod no longer exists according to the config snapshot.
+std::optional<ModConfigSnapshot::ModConfig> GetModLoadConfig(PCWSTR modName) {
+    auto snapshot = Mod::GetModConfigSnapshot();
+    if (!snapshot) {
+        return ModConfigSnapshot::ReadModConfigFromStorage(modName);
+    }
+
+    for (const auto& modConfig : snapshot->mods) {
+        if (modConfig.name == modName) {
+            return modConfig;
+        }
+    }
+
+    return std::nullopt;
+}
+
+// modules is a list of module file names separated by '|'.
+bool IsAnyModuleLoaded(std::wstring_view modules) {
+    for (const auto& moduleName :
+         Functions::SplitStringToViews(modules, L'|')) {
+        if (GetModuleHandle(std::wstring(moduleName).c_str())) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// The versions of a mod to which a compatibility rule applies. Mods without
+// a version match as well. Unused entries are empty.
+using ModVersions = std::array<std::wstring_view, 6>;
 
-    return settings->GetString(L"Version").value_or(L"-");
+bool IsModVersionInList(std::wstring_view modVersion,
+                        const ModVersions& versions) {
+    return modVersion.empty() ||
+           std::find(versions.begin(), versions.end(), modVersion) !=
+               versions.end();
 }
 
 // Temporary compatibility code.
-bool ShouldUseCompatDemangling(wil::zwstring_view modName) {
-    struct {
+bool ShouldUseCompatDemangling(std::wstring_view modName,
+                               std::wstring_view modVersion) {
+    static constexpr struct {
         std::wstring_view modNamePrefix;
-        std::vector<std::wstring_view> versions;
-    } compatMods[] = {
+        ModVersions versions;
+    } kCompatMods[] = {
         {L"start-menu-all-apps", {L"1.0", L"1.0.1"}},
         {L"taskbar-button-click", {L"1.0", L"1.0.1"}},
         {L"taskbar-clock-customization",
@@ -209,41 +376,34 @@ bool ShouldUseCompatDemangling(wil::zwstring_view modName) {
         {L"taskbar-thumbnail-reorder", {L"1.0", L"1.0.1", L"1.0.2"}},
     };
 
-    for (const auto& compatMod : compatMods) {
-        if (modName == compatMod.modNamePrefix ||
-            (modName.starts_with(L"local@") &&
-             modName.substr(6).starts_with(compatMod.modNamePrefix))) {
-            auto modVersion = GetModVersion(modName.c_str());
-            if (modVersion == L"-") {
-                return true;
-            }
-
-            for (const auto& compatModVersion : compatMod.versions) {
-                if (modVersion == compatModVersion) {
-                    return true;
-                }
-            }
+    constexpr std::wstring_view kLocalPrefix = L"local@";
+    bool isLocal = modName.starts_with(kLocalPrefix);
+    std::wstring_view name =
+        isLocal ? modName.substr(kLocalPrefix.length()) : modName;
 
-            return false;
+    for (const auto& compatMod : kCompatMods) {
+        if (isLocal ? name.starts_with(compatMod.modNamePrefix)
+                    : name == compatMod.modNamePrefix) {
+            return IsModVersionInList(modVersion, compatMod.versions);
         }
     }
 
     return false;
 }
 
-bool IsModBanned(wil::zwstring_view modName) {
+bool IsModBanned(std::wstring_view modName, std::wstring_view modVersion) {
     bool banned = false;
 
 #if defined(_M_IX86)
-    constexpr std::wstring_view kX86 =
+    static constexpr std::wstring_view kX86 =
         L"Not loading an incompatible mod: "
         L"https://github.com/ramensoftware/windhawk-mods/issues/1878";
 
-    struct {
+    static constexpr struct {
         std::wstring_view modName;
-        std::vector<std::wstring_view> versions;
+        ModVersions versions;
         std::wstring_view reason;
-    } incompatibleMods[] = {
+    } kIncompatibleMods[] = {
         // Incompatible with 32-bit programs, caused by a missing calling
         // convention.
         // https://github.com/ramensoftware/windhawk-mods/issues/1878
@@ -255,21 +415,11 @@ bool IsModBanned(wil::zwstring_view modName) {
 
     std::wstring_view reason;
 
-    for (const auto& incompatibleMod : incompatibleMods) {
+    for (const auto& incompatibleMod : kIncompatibleMods) {
         if (modName == incompatibleMod.modName) {
-            auto modVersion = GetModVersion(modName.c_str());
-            if (modVersion == L"-") {
+            if (IsModVersionInList(modVersion, incompatibleMod.versions)) {
                 banned = true;
                 reason = incompatibleMod.reason;
-                break;
-            }
-
-            for (const auto& compatModVersion : incompatibleMod.versions) {
-                if (modVersion == compatModVersion) {
-                    banned = true;
-                    reason = incompatibleMod.reason;
-                    break;
-                }
             }
 
             break;
@@ -522,34 +672,284 @@ wil::unique_hmodule SetModShimsLibraryIfNeeded(HMODULE mod) {
     return shimModule;
 }
 
-// Checks whether the module is CHPE, ARM64EC or ARM64X.
-bool IsHybridModule(const IMAGE_DOS_HEADER* dosHeader,
-                    const IMAGE_NT_HEADERS* ntHeader) {
-    auto* opt = &ntHeader->OptionalHeader;
+// Returns the longest identifier from the qualified name of an undecorated
+// symbol name, or an empty string if there's no suitable identifier. The
+// identifier is expected to appear verbatim both in the decorated name and in
+// the name DIA reports for non-public symbols. For example, for:
+// public: void __cdecl CTaskBand::Launch(void)
+// The result is "CTaskBand", which appears in the decorated name:
+// ?Launch@CTaskBand@@QEAAXXZ
+// And in the function symbol name:
+// CTaskBand::Launch
+std::wstring_view GetUndecoratedSymbolKeyIdentifier(std::wstring_view symbol) {
+    // Special names such as `vftable' or `anonymous namespace', as well as
+    // operator names, are encoded differently in decorated names.
+    if (symbol.find_first_of(L"`'") != symbol.npos ||
+        symbol.find(L"operator") != symbol.npos) {
+        return {};
+    }
 
-    if (opt->NumberOfRvaAndSizes <= IMAGE_DIRECTORY_ENTRY_LOAD_CONFIG ||
-        !opt->DataDirectory[IMAGE_DIRECTORY_ENTRY_LOAD_CONFIG].VirtualAddress) {
-        return false;
+    // Skip the arch=...\ and tag=...\ prefixes added by SymbolEnum.
+    if (auto lastBackslash = symbol.rfind(L'\\');
+        lastBackslash != symbol.npos) {
+        symbol = symbol.substr(lastBackslash + 1);
     }
 
-    DWORD directorySize =
-        opt->DataDirectory[IMAGE_DIRECTORY_ENTRY_LOAD_CONFIG].Size;
+    // Skip the parameters and any qualifiers which follow them.
+    size_t end = symbol.length();
+    if (size_t closingParen = symbol.rfind(L')'); closingParen != symbol.npos) {
+        int depth = 0;
+        for (size_t i = closingParen + 1; i-- > 0;) {
+            if (symbol[i] == L')') {
+                depth++;
+            } else if (symbol[i] == L'(' && --depth == 0) {
+                end = i;
+                break;
+            }
+        }
+    }
+
+    // Skip the return type and the other specifiers, which are separated from
+    // the qualified name with a space outside of template arguments.
+    size_t begin = 0;
+    int templateDepth = 0;
+    for (size_t i = end; i-- > 0;) {
+        if (symbol[i] == L'>') {
+            templateDepth++;
+        } else if (symbol[i] == L'<') {
+            templateDepth--;
+        } else if (symbol[i] == L' ' && templateDepth == 0) {
+            begin = i + 1;
+            break;
+        }
+    }
 
-    auto* cfg =
-        (const IMAGE_LOAD_CONFIG_DIRECTORY*)((const char*)dosHeader +
-                                             opt->DataDirectory
-                                                 [IMAGE_DIRECTORY_ENTRY_LOAD_CONFIG]
-                                                     .VirtualAddress);
+    auto isIdentifierChar = [](WCHAR c) {
+        return (c >= L'a' && c <= L'z') || (c >= L'A' && c <= L'Z') ||
+               (c >= L'0' && c <= L'9') || c == L'_';
+    };
 
-    constexpr DWORD kMinSize =
-        offsetof(IMAGE_LOAD_CONFIG_DIRECTORY, CHPEMetadataPointer) +
-        sizeof(IMAGE_LOAD_CONFIG_DIRECTORY::CHPEMetadataPointer);
+    // Template arguments are formatted differently in the different names, so
+    // only identifiers outside of them are considered.
+    std::wstring_view result;
+    templateDepth = 0;
 
-    if (directorySize < kMinSize || cfg->Size < kMinSize) {
-        return false;
+    for (size_t i = begin; i < end;) {
+        if (symbol[i] == L'<') {
+            templateDepth++;
+            i++;
+            continue;
+        }
+
+        if (symbol[i] == L'>') {
+            templateDepth--;
+            i++;
+            continue;
+        }
+
+        if (!isIdentifierChar(symbol[i])) {
+            i++;
+            continue;
+        }
+
+        size_t start = i;
+        while (i < end && isIdentifierChar(symbol[i])) {
+            i++;
+        }
+
+        if (templateDepth != 0 ||
+            (symbol[start] >= L'0' && symbol[start] <= L'9')) {
+            continue;
+        }
+
+        if (i - start > result.length()) {
+            result = symbol.substr(start, i - start);
+        }
+    }
+
+    return result;
+}
+
+// Returns an identifier which is contained in the name that DIA looks up for
+// each symbol matching the filter of Wh_FindFirstSymbol, or an empty string if
+// there's no such identifier. DIA looks up the decorated name of public
+// symbols and the qualified name of other symbols.
+std::wstring_view GetSymbolNameFilterIdentifier(std::wstring_view filter,
+                                                bool wildcard,
+                                                bool decorated) {
+    auto isIdentifierChar = [](WCHAR c) {
+        return (c >= L'a' && c <= L'z') || (c >= L'A' && c <= L'Z') ||
+               (c >= L'0' && c <= L'9') || c == L'_';
+    };
+
+    // The decorated name which is matched is the name which DIA looks up, so
+    // it contains any identifier of the filter. Wildcard characters aren't
+    // identifier characters.
+    if (decorated) {
+        std::wstring_view result;
+        for (size_t i = 0; i < filter.length();) {
+            if (!isIdentifierChar(filter[i])) {
+                i++;
+                continue;
+            }
+
+            size_t start = i;
+            while (i < filter.length() && isIdentifierChar(filter[i])) {
+                i++;
+            }
+
+            if (i - start > result.length()) {
+                result = filter.substr(start, i - start);
+            }
+        }
+
+        return result;
+    }
+
+    // For an undecorated name, only the qualified name, which is right before
+    // the parameter list, is known to be contained in both DIA names.
+    // Anything else, e.g. a type of the return value or of a parameter, might
+    // not be in the qualified name.
+    size_t paren = filter.find(L'(');
+    if (paren == filter.npos) {
+        return {};
+    }
+
+    auto name = filter.substr(0, paren);
+
+    // The parenthesis might be a part of template arguments, e.g. of a
+    // function type.
+    if (name.find(L')') != name.npos ||
+        std::count(name.begin(), name.end(), L'<') !=
+            std::count(name.begin(), name.end(), L'>')) {
+        return {};
+    }
+
+    // A wildcard might match the space between the return type and the
+    // qualified name.
+    if (wildcard) {
+        if (size_t lastWildcard = name.find_last_of(L"*?");
+            lastWildcard != name.npos) {
+            name = name.substr(lastWildcard + 1);
+        }
+    }
+
+    return GetUndecoratedSymbolKeyIdentifier(name);
+}
+
+// Symbols resolved by mods in this process, kept for the lifetime of the
+// customization session. When a mod is reloaded, e.g. after its settings are
+// changed, its symbols are resolved from memory instead of reading and parsing
+// its symbol cache again. The entries of a mod are cleared when it's unloaded
+// without being loaded again, or when its library changes, and all entries are
+// cleared when the mods manager of the session is destroyed.
+class InMemorySymbolCache {
+   public:
+    static InMemorySymbolCache& GetInstance() {
+        STATIC_INIT_ONCE(NoDestructorIfTerminating<InMemorySymbolCache>, s);
+        return **s;
+    }
+
+    std::optional<SymbolCacheData> Get(const std::wstring& modName,
+                                       const std::wstring& cacheKey) {
+        std::lock_guard<std::mutex> guard(m_mutex);
+
+        auto modIt = m_symbolCaches.find(modName);
+        if (modIt == m_symbolCaches.end()) {
+            return std::nullopt;
+        }
+
+        auto it = modIt->second.find(cacheKey);
+        if (it == modIt->second.end()) {
+            return std::nullopt;
+        }
+
+        return it->second;
+    }
+
+    void Set(const std::wstring& modName,
+             const std::wstring& cacheKey,
+             SymbolCacheData cacheData) {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_symbolCaches[modName][cacheKey] = std::move(cacheData);
+    }
+
+    void Clear() {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_symbolCaches.clear();
+    }
+
+    void Clear(const std::wstring& modName) {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_symbolCaches.erase(modName);
+    }
+
+   private:
+    std::mutex m_mutex;
+    std::unordered_map<std::wstring,
+                       std::unordered_map<std::wstring, SymbolCacheData>>
+        m_symbolCaches;
+};
+
+// Pattern scan results are stored in the symbol cache of the mod as well, with
+// the key of the module prefixed, and the hash of the pattern bytes instead of
+// a name hash.
+constexpr WCHAR kPatternCacheKeyPrefix[] = L"pattern_";
+
+ULONGLONG HashPattern(const BYTE* pattern,
+                      const BYTE* mask,
+                      size_t patternSize) {
+    // FNV-1a, the same as SymbolIndex::HashName.
+    ULONGLONG hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < patternSize; i++) {
+        BYTE maskByte = mask ? mask[i] : 0xFF;
+        hash ^= pattern[i] & maskByte;
+        hash *= 1099511628211ULL;
+        hash ^= maskByte;
+        hash *= 1099511628211ULL;
+    }
+
+    hash ^= patternSize;
+    hash *= 1099511628211ULL;
+
+    return hash;
+}
+
+std::optional<SymbolCacheData> ReadPatternCache(PCWSTR modName,
+                                                const std::wstring& cacheKey) {
+    if (auto cacheData =
+            InMemorySymbolCache::GetInstance().Get(modName, cacheKey)) {
+        return cacheData;
+    }
+
+    auto symbolCache = StorageManager::GetInstance().GetModWritableConfig(
+        modName, L"SymbolCache", false);
+    auto cacheBinary = symbolCache->GetBinary(cacheKey.c_str());
+    if (!cacheBinary) {
+        return std::nullopt;
+    }
+
+    auto cacheData = SymbolCacheData::Parse(*cacheBinary);
+    if (cacheData) {
+        InMemorySymbolCache::GetInstance().Set(modName, cacheKey, *cacheData);
     }
 
-    return cfg->CHPEMetadataPointer != 0;
+    return cacheData;
+}
+
+// Concurrent scans of the same module might drop each other's entries, which
+// only means that they're scanned again next time.
+void WritePatternCache(PCWSTR modName,
+                       const std::wstring& cacheKey,
+                       SymbolCacheData cacheData) {
+    auto cacheBinary = cacheData.Serialize();
+    InMemorySymbolCache::GetInstance().Set(modName, cacheKey,
+                                           std::move(cacheData));
+
+    auto symbolCache = StorageManager::GetInstance().GetModWritableConfig(
+        modName, L"SymbolCache", true);
+    symbolCache->SetBinary(cacheKey.c_str(), cacheBinary.data(),
+                           cacheBinary.size());
 }
 
 class HookSymbolsSession {
@@ -564,22 +964,42 @@ class HookSymbolsSession {
         std::transform(symbolHooks, symbolHooks + symbolHooksCount,
                        std::back_inserter(m_symbolHooksUnresolved),
                        [](auto& elem) { return &elem; });
-    }
 
-    bool OnSymbolResolved(std::wstring_view symbol, void* address) {
-        auto it = std::find_if(
-            m_symbolHooksUnresolved.begin(), m_symbolHooksUnresolved.end(),
-            [&symbol](const auto* symbolHook) {
-                for (size_t s = 0; s < symbolHook->symbolsCount; s++) {
-                    auto hookSymbol =
-                        std::wstring_view(symbolHook->symbols[s].string,
-                                          symbolHook->symbols[s].length);
-                    if (hookSymbol == symbol) {
-                        return true;
-                    }
+        // Index the requested names, so that each enumerated symbol costs a
+        // single lookup. The hooks are added in order, since the first
+        // unresolved hook which matches a symbol is the one to be resolved.
+        for (const auto* symbolHook : m_symbolHooksUnresolved) {
+            for (size_t s = 0; s < symbolHook->symbolsCount; s++) {
+                auto hookSymbol =
+                    std::wstring_view(symbolHook->symbols[s].string,
+                                      symbolHook->symbols[s].length);
+                auto& hooks = m_symbolHooksByName[hookSymbol];
+                if (hooks.empty() || hooks.back() != symbolHook) {
+                    hooks.push_back(symbolHook);
                 }
-                return false;
-            });
+            }
+        }
+    }
+
+    // Addresses which aren't in the target module, such as forwarded exports,
+    // must not be cached, since the cache stores RVAs.
+    bool OnSymbolResolved(std::wstring_view symbol,
+                          void* address,
+                          bool addToCache = true) {
+        auto indexIt = m_symbolHooksByName.find(symbol);
+        if (indexIt == m_symbolHooksByName.end()) {
+            return false;
+        }
+
+        auto it = m_symbolHooksUnresolved.end();
+        for (const auto* candidate : indexIt->second) {
+            it = std::find(m_symbolHooksUnresolved.begin(),
+                           m_symbolHooksUnresolved.end(), candidate);
+            if (it != m_symbolHooksUnresolved.end()) {
+                break;
+            }
+        }
+
         if (it == m_symbolHooksUnresolved.end()) {
             return false;
         }
@@ -599,11 +1019,13 @@ class HookSymbolsSession {
                     wil::safe_cast<int>(symbol.length()), symbol.data());
         }
 
-        m_newSystemCacheStr += m_cacheSep;
-        m_newSystemCacheStr += symbol;
-        m_newSystemCacheStr += m_cacheSep;
-        m_newSystemCacheStr +=
-            std::to_wstring((ULONG_PTR)address - (ULONG_PTR)m_module);
+        if (addToCache) {
+            m_newSystemCache.entries.push_back({
+                .nameHash = SymbolIndex::HashName(symbol),
+                .rva = static_cast<DWORD>((ULONG_PTR)address -
+                                          (ULONG_PTR)m_module),
+            });
+        }
 
         m_symbolHooksUnresolved.erase(it);
         return true;
@@ -618,21 +1040,58 @@ class HookSymbolsSession {
 
     ResolveSymbolsFromCacheResult ResolveSymbolsFromCache(
         std::optional<ULONGLONG> cachedErrorForThrottleMaxTime) {
+        if (auto inMemoryCacheData = InMemorySymbolCache::GetInstance().Get(
+                m_loadedMod->GetModName(), m_cacheStrKey)) {
+            ResolveSymbolsFromCacheData(*inMemoryCacheData);
+            if (AreAllSymbolsResolved()) {
+                VERBOSE(L"Resolved symbols from in-memory cache %.*s",
+                        wil::safe_cast<int>(m_cacheStrKey.length()),
+                        m_cacheStrKey.data());
+                return ResolveSymbolsFromCacheResult::kSuccess;
+            }
+        }
+
         std::wstring cacheBuffer;
+        std::optional<SymbolCacheData> cacheData;
         try {
             auto symbolCache =
                 StorageManager::GetInstance().GetModWritableConfig(
                     m_loadedMod->GetModName(), L"SymbolCache", false);
             cacheBuffer =
                 symbolCache->GetString(m_cacheStrKey.c_str()).value_or(L"");
-            if (cacheBuffer.empty()) {
-                return ResolveSymbolsFromCacheResult::kNoCache;
+
+            // Errors for throttling and caches created by older versions are
+            // stored as strings. A binary value is read as an empty string
+            // from the registry, and as a hex string from an ini file, neither
+            // of which looks like a cache string.
+            if (!IsCacheString(cacheBuffer)) {
+                auto cacheBinary =
+                    symbolCache->GetBinary(m_cacheStrKey.c_str());
+                if (cacheBinary) {
+                    cacheData = SymbolCacheData::Parse(*cacheBinary);
+                }
+
+                if (!cacheData) {
+                    return ResolveSymbolsFromCacheResult::kNoCache;
+                }
             }
         } catch (const std::exception& e) {
             LOG(L"%S", e.what());
             return ResolveSymbolsFromCacheResult::kError;
         }
 
+        if (cacheData) {
+            VERBOSE(L"Using symbol cache %.*s: %zu entries",
+                    wil::safe_cast<int>(m_cacheStrKey.length()),
+                    m_cacheStrKey.data(), cacheData->entries.size());
+
+            ResolveSymbolsFromCacheData(*cacheData);
+            InMemorySymbolCache::GetInstance().Set(m_loadedMod->GetModName(),
+                                                   m_cacheStrKey,
+                                                   std::move(*cacheData));
+            return ResolveSymbolsFromCacheResult::kSuccess;
+        }
+
         VERBOSE(L"Using symbol cache %.*s: %.*s",
                 wil::safe_cast<int>(m_cacheStrKey.length()),
                 m_cacheStrKey.data(), wil::safe_cast<int>(cacheBuffer.length()),
@@ -676,9 +1135,41 @@ class HookSymbolsSession {
             return ResolveSymbolsFromCacheResult::kNoCache;
         }
 
+        // Convert a cache created by an older version to the binary format.
+        if (AreAllSymbolsResolved()) {
+            UpdateSymbolsCache();
+        }
+
         return ResolveSymbolsFromCacheResult::kSuccess;
     }
 
+    void ResolveSymbolsFromCacheData(const SymbolCacheData& cacheData) {
+        std::unordered_map<ULONGLONG, std::wstring_view> hookSymbolsByHash;
+        for (const auto& [hookSymbol, symbolHooks] : m_symbolHooksByName) {
+            hookSymbolsByHash.try_emplace(SymbolIndex::HashName(hookSymbol),
+                                          hookSymbol);
+        }
+
+        std::unordered_set<std::wstring_view> noAddressSymbols;
+
+        for (const auto& entry : cacheData.entries) {
+            auto it = hookSymbolsByHash.find(entry.nameHash);
+            if (it == hookSymbolsByHash.end()) {
+                continue;
+            }
+
+            if (entry.flags & SymbolCacheData::kEntryFlagNoAddress) {
+                noAddressSymbols.insert(it->second);
+                continue;
+            }
+
+            OnSymbolResolved(it->second,
+                             reinterpret_cast<BYTE*>(m_module) + entry.rva);
+        }
+
+        MarkOptionalSymbolsAsMissing(noAddressSymbols);
+    }
+
     bool ResolveSymbolsFromCacheString(std::wstring_view cache) {
         auto cacheParts = Functions::SplitStringToViews(cache, m_cacheSep);
         return ResolveSymbolsFromCacheStringParts(cacheParts);
@@ -708,35 +1199,35 @@ class HookSymbolsSession {
             OnSymbolResolved(symbol, addressPtr);
         }
 
-        std::erase_if(m_symbolHooksUnresolved, [this, &cacheParts](
+        std::unordered_set<std::wstring_view> noAddressSymbols;
+        for (size_t i = 3; i + 1 < cacheParts.size(); i += 2) {
+            if (cacheParts[i + 1].length() == 0) {
+                noAddressSymbols.insert(cacheParts[i]);
+            }
+        }
+
+        MarkOptionalSymbolsAsMissing(noAddressSymbols);
+
+        return true;
+    }
+
+    void MarkOptionalSymbolsAsMissing(
+        const std::unordered_set<std::wstring_view>& noAddressSymbols) {
+        std::erase_if(m_symbolHooksUnresolved, [this, &noAddressSymbols](
                                                    const auto* symbolHook) {
             if (!symbolHook->optional) {
                 return false;
             }
 
-            size_t noAddressMatchCount = 0;
-            for (size_t j = 3; j + 1 < cacheParts.size(); j += 2) {
-                const auto& symbol = cacheParts[j];
-                const auto& address = cacheParts[j + 1];
-                if (address.length() != 0) {
-                    continue;
-                }
-
-                for (size_t s = 0; s < symbolHook->symbolsCount; s++) {
-                    auto hookSymbol =
-                        std::wstring_view(symbolHook->symbols[s].string,
-                                          symbolHook->symbols[s].length);
-                    if (hookSymbol == symbol) {
-                        noAddressMatchCount++;
-                        break;
-                    }
+            for (size_t s = 0; s < symbolHook->symbolsCount; s++) {
+                auto hookSymbol =
+                    std::wstring_view(symbolHook->symbols[s].string,
+                                      symbolHook->symbols[s].length);
+                if (!noAddressSymbols.contains(hookSymbol)) {
+                    return false;
                 }
             }
 
-            if (noAddressMatchCount != symbolHook->symbolsCount) {
-                return false;
-            }
-
             VERBOSE(L"Optional symbol doesn't exist (from cache)");
             for (size_t s = 0; s < symbolHook->symbolsCount; s++) {
                 auto hookSymbol =
@@ -750,24 +1241,180 @@ class HookSymbolsSession {
                 auto hookSymbol =
                     std::wstring_view(symbolHook->symbols[s].string,
                                       symbolHook->symbols[s].length);
-                m_newSystemCacheStr += m_cacheSep;
-                m_newSystemCacheStr += hookSymbol;
-                m_newSystemCacheStr += m_cacheSep;
+                m_newSystemCache.entries.push_back({
+                    .nameHash = SymbolIndex::HashName(hookSymbol),
+                    .flags = SymbolCacheData::kEntryFlagNoAddress,
+                });
             }
 
             return true;  // Mark for removal.
         });
+    }
 
-        return true;
+    void ResolveSymbolsFromIndex(const SymbolIndex& symbolIndex,
+                                 SymbolIndex::Table table) {
+        struct IndexMatch {
+            DWORD ordinal;
+            DWORD rva;
+            std::wstring_view symbol;
+        };
+
+        std::vector<IndexMatch> matches;
+
+        for (const auto* symbolHook : m_symbolHooksUnresolved) {
+            for (size_t s = 0; s < symbolHook->symbolsCount; s++) {
+                auto hookSymbol =
+                    std::wstring_view(symbolHook->symbols[s].string,
+                                      symbolHook->symbols[s].length);
+                if (const auto* entry = symbolIndex.Find(table, hookSymbol)) {
+                    matches.push_back({entry->ordinal, entry->rva, hookSymbol});
+                }
+            }
+        }
+
+        // Resolve in the original enumeration order, the same way as if the
+        // symbols were enumerated.
+        std::sort(matches.begin(), matches.end(),
+                  [](const IndexMatch& a, const IndexMatch& b) {
+                      return a.ordinal < b.ordinal;
+                  });
+
+        for (const auto& match : matches) {
+            OnSymbolResolved(match.symbol,
+                             reinterpret_cast<BYTE*>(m_module) + match.rva);
+        }
+    }
+
+    // Resolves the hooks whose names are exported by the target module, which
+    // doesn't require its symbols. An exported name is the same as the
+    // decorated name of the public symbol. Undecorated names can only be
+    // matched for C names of 64-bit modules, since in 32-bit modules, these
+    // are decorated with the calling convention in the PDB. Exports of hybrid
+    // modules point to thunks, so these are skipped. A forwarded export is
+    // resolved only if its target module is already loaded.
+    void ResolveSymbolsFromExports(bool decoratedNames) {
+        if (m_isHybridModule) {
+            return;
+        }
+
+        auto* imageBase = reinterpret_cast<const BYTE*>(m_module);
+        auto* dosHeader = reinterpret_cast<const IMAGE_DOS_HEADER*>(imageBase);
+        auto* ntHeader = reinterpret_cast<const IMAGE_NT_HEADERS*>(
+            imageBase + dosHeader->e_lfanew);
+
+        if (!decoratedNames && ntHeader->OptionalHeader.Magic !=
+                                   IMAGE_NT_OPTIONAL_HDR64_MAGIC) {
+            return;
+        }
+
+        if (ntHeader->OptionalHeader.NumberOfRvaAndSizes <=
+            IMAGE_DIRECTORY_ENTRY_EXPORT) {
+            return;
+        }
+
+        const auto& exportDirectoryEntry =
+            ntHeader->OptionalHeader
+                .DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT];
+        if (!exportDirectoryEntry.VirtualAddress ||
+            !exportDirectoryEntry.Size) {
+            return;
+        }
+
+        auto* exportDirectory = reinterpret_cast<const IMAGE_EXPORT_DIRECTORY*>(
+            imageBase + exportDirectoryEntry.VirtualAddress);
+        auto* functions = reinterpret_cast<const DWORD*>(
+            imageBase + exportDirectory->AddressOfFunctions);
+        auto* names = reinterpret_cast<const DWORD*>(
+            imageBase + exportDirectory->AddressOfNames);
+        auto* nameOrdinals = reinterpret_cast<const WORD*>(
+            imageBase + exportDirectory->AddressOfNameOrdinals);
+
+        std::wstring name;
+        for (DWORD i = 0;
+             i < exportDirectory->NumberOfNames && !AreAllSymbolsResolved();
+             i++) {
+            auto* exportName =
+                reinterpret_cast<const char*>(imageBase + names[i]);
+            name.assign(exportName, exportName + strlen(exportName));
+
+            if (!decoratedNames &&
+                (name.starts_with(L'?') || name.find(L'@') != name.npos)) {
+                continue;
+            }
+
+            if (!m_symbolHooksByName.contains(name)) {
+                continue;
+            }
+
+            WORD ordinalIndex = nameOrdinals[i];
+            if (ordinalIndex >= exportDirectory->NumberOfFunctions) {
+                continue;
+            }
+
+            DWORD functionRva = functions[ordinalIndex];
+            if (!functionRva) {
+                continue;
+            }
+
+            bool forwarded =
+                functionRva >= exportDirectoryEntry.VirtualAddress &&
+                functionRva < exportDirectoryEntry.VirtualAddress +
+                                  exportDirectoryEntry.Size;
+            void* address;
+            if (forwarded) {
+                address = ResolveForwardedExport(
+                    reinterpret_cast<PCSTR>(imageBase + functionRva));
+                if (!address) {
+                    continue;
+                }
+            } else {
+                address = const_cast<BYTE*>(imageBase) + functionRva;
+            }
+
+            OnSymbolResolved(name, address, /*addToCache=*/!forwarded);
+        }
+    }
+
+    // Returns identifiers such that each symbol matching one of the
+    // unresolved hooks contains at least one of them in its name, or an empty
+    // vector if one of the hooks can't be expressed this way.
+    std::vector<std::wstring> GetSymbolNameIdentifiers() const {
+        std::vector<std::wstring> identifiers;
+
+        for (const auto* symbolHook : m_symbolHooksUnresolved) {
+            for (size_t s = 0; s < symbolHook->symbolsCount; s++) {
+                auto hookSymbol =
+                    std::wstring_view(symbolHook->symbols[s].string,
+                                      symbolHook->symbols[s].length);
+                auto identifier = GetUndecoratedSymbolKeyIdentifier(hookSymbol);
+                if (identifier.empty()) {
+                    VERBOSE(L"Can't look up symbol by name: %.*s",
+                            wil::safe_cast<int>(hookSymbol.length()),
+                            hookSymbol.data());
+                    return {};
+                }
+
+                if (std::find(identifiers.begin(), identifiers.end(),
+                              identifier) == identifiers.end()) {
+                    identifiers.emplace_back(identifier);
+                }
+            }
+        }
+
+        return identifiers;
     }
 
     bool UpdateSymbolsCache() {
+        InMemorySymbolCache::GetInstance().Set(m_loadedMod->GetModName(),
+                                               m_cacheStrKey, m_newSystemCache);
+
         try {
             auto symbolCache =
                 StorageManager::GetInstance().GetModWritableConfig(
                     m_loadedMod->GetModName(), L"SymbolCache", true);
-            symbolCache->SetString(m_cacheStrKey.c_str(),
-                                   m_newSystemCacheStr.c_str());
+            auto cacheBinary = m_newSystemCache.Serialize();
+            symbolCache->SetBinary(m_cacheStrKey.c_str(), cacheBinary.data(),
+                                   cacheBinary.size());
             return true;
         } catch (const std::exception& e) {
             LOG(L"%S", e.what());
@@ -833,9 +1480,10 @@ class HookSymbolsSession {
                 auto hookSymbol =
                     std::wstring_view(symbolHook->symbols[s].string,
                                       symbolHook->symbols[s].length);
-                m_newSystemCacheStr += m_cacheSep;
-                m_newSystemCacheStr += hookSymbol;
-                m_newSystemCacheStr += m_cacheSep;
+                m_newSystemCache.entries.push_back({
+                    .nameHash = SymbolIndex::HashName(hookSymbol),
+                    .flags = SymbolCacheData::kEntryFlagNoAddress,
+                });
             }
 
             return true;  // Mark for removal.
@@ -854,7 +1502,29 @@ class HookSymbolsSession {
         return m_symbolHooksUnresolved.empty();
     }
 
-    void ApplyPendingHooks() {
+    bool AreAllRequiredSymbolsResolved() const {
+        return std::all_of(
+            m_symbolHooksUnresolved.begin(), m_symbolHooksUnresolved.end(),
+            [](const auto* symbolHook) { return symbolHook->optional; });
+    }
+
+    // Whether all requested names are MSVC decorated names, which only public
+    // symbols have.
+    bool AreAllRequestedNamesDecorated() const {
+        return std::all_of(
+            m_symbolHooksByName.begin(), m_symbolHooksByName.end(),
+            [](const auto& item) { return item.first.starts_with(L'?'); });
+    }
+
+    void ApplyPendingHooks(
+        std::vector<LoadedMod::PendingHook>* deferredHooks = nullptr) {
+        if (deferredHooks) {
+            deferredHooks->insert(deferredHooks->end(), m_pendingHooks.begin(),
+                                  m_pendingHooks.end());
+            m_pendingHooks.clear();
+            return;
+        }
+
         VERBOSE(L"Applying hooks");
 
         for (const auto& hook : m_pendingHooks) {
@@ -866,98 +1536,60 @@ class HookSymbolsSession {
     }
 
    private:
+    // A forwarder is "module.function" or "module.#ordinal", where the module
+    // name has no extension.
+    static void* ResolveForwardedExport(PCSTR forwarder) {
+        PCSTR dot = strrchr(forwarder, '.');
+        if (!dot) {
+            return nullptr;
+        }
+
+        std::string moduleName(forwarder, dot);
+        moduleName += ".dll";
+
+        HMODULE module = GetModuleHandleA(moduleName.c_str());
+        if (!module) {
+            return nullptr;
+        }
+
+        PCSTR function = dot + 1;
+        if (*function == '#') {
+            return reinterpret_cast<void*>(GetProcAddress(
+                module, MAKEINTRESOURCEA(atoi(function + 1))));
+        }
+
+        return reinterpret_cast<void*>(GetProcAddress(module, function));
+    }
+
     void CalculateHookSymbolsInitialParams() {
         HMODULE module = m_module;
 
-        std::filesystem::path modulePath =
-            wil::GetModuleFileName<std::wstring>(module);
-        auto moduleFileName = modulePath.filename().wstring();
-        LCMapStringEx(
-            LOCALE_NAME_USER_DEFAULT, LCMAP_LOWERCASE, &moduleFileName[0],
-            wil::safe_cast<int>(moduleFileName.length()), &moduleFileName[0],
-            wil::safe_cast<int>(moduleFileName.length()), nullptr, nullptr, 0);
+        auto identity = ModuleIdentityCache::GetInstance().Get(module);
 
         VERBOSE(L"Module: %p", module);
-        VERBOSE(L"Path: %s", modulePath.c_str());
+        VERBOSE(L"Path: %s", identity->path.c_str());
         VERBOSE(L"Version: %S", Functions::GetModuleVersion(module).c_str());
 
-        IMAGE_DOS_HEADER* dosHeader = (IMAGE_DOS_HEADER*)module;
-        IMAGE_NT_HEADERS* ntHeader =
-            (IMAGE_NT_HEADERS*)((BYTE*)dosHeader + dosHeader->e_lfanew);
-        auto timeStamp = std::to_wstring(ntHeader->FileHeader.TimeDateStamp);
-        auto imageSize = std::to_wstring(ntHeader->OptionalHeader.SizeOfImage);
-
-        bool isHybridModule = IsHybridModule(dosHeader, ntHeader);
+        m_isHybridModule = identity->isHybrid;
+        m_cacheSep = identity->isHybrid ? L';' : L'#';
+        m_moduleFileName = identity->fileName;
+        m_timeStamp = std::to_wstring(identity->timeStamp);
+        m_imageSize = std::to_wstring(identity->imageSize);
+        m_cacheStrKey = identity->cacheKey;
 
-        std::wstring cacheStrKey;
-
-        constexpr WCHAR currentArch[] =
-#if defined(_M_IX86)
-            L"x86";
-#elif defined(_M_X64)
-            L"x86-64";
-#elif defined(_M_ARM64)
-            L"arm64";
-#else
-#error "Unsupported architecture"
-#endif
+        m_newSystemCache.moduleName = m_moduleFileName;
+        m_newSystemCache.timeStamp = identity->timeStamp;
+        m_newSystemCache.imageSize = identity->imageSize;
+    }
 
-        GUID pdbGuid;
-        DWORD pdbAge;
-        if (Functions::ModuleGetPDBInfo(module, &pdbGuid, &pdbAge)) {
-            constexpr size_t kMaxPdbIdentifierLength =
-                sizeof("AAAAAAAABBBBCCCCDDDDEEEEEEEEEEEE12345678") - 1;
-            WCHAR pdbIdentifier[kMaxPdbIdentifierLength + 1];
-            swprintf_s(pdbIdentifier,
-                       L"%08X%04X%04X%02X%02X%02X%02X%02X%02X%02X%02X%x",
-                       pdbGuid.Data1, pdbGuid.Data2, pdbGuid.Data3,
-                       pdbGuid.Data4[0], pdbGuid.Data4[1], pdbGuid.Data4[2],
-                       pdbGuid.Data4[3], pdbGuid.Data4[4], pdbGuid.Data4[5],
-                       pdbGuid.Data4[6], pdbGuid.Data4[7], pdbAge);
-
-            cacheStrKey = L"pdb_";
-            cacheStrKey += pdbIdentifier;
-            if (isHybridModule) {
-                cacheStrKey += L"_hybrid-";
-                cacheStrKey += currentArch;
-            }
-        } else {
-            cacheStrKey = L"pe_";
-            cacheStrKey += currentArch;
-            cacheStrKey += L'_';
-            cacheStrKey += timeStamp;
-            cacheStrKey += L'_';
-            cacheStrKey += imageSize;
-            cacheStrKey += L'_';
-            cacheStrKey += moduleFileName;
-            if (isHybridModule) {
-                cacheStrKey += L"_hybrid";
-            }
-        }
-
-        m_isHybridModule = isHybridModule;
-        m_cacheSep = isHybridModule ? L';' : L'#';
-        m_moduleFileName = std::move(moduleFileName);
-        m_timeStamp = std::move(timeStamp);
-        m_imageSize = std::move(imageSize);
-        m_cacheStrKey = std::move(cacheStrKey);
-
-        m_newSystemCacheStr = kCacheVer;
-        m_newSystemCacheStr += m_cacheSep;
-        m_newSystemCacheStr += Functions::ReplaceAll(
-            m_moduleFileName, std::wstring_view(&m_cacheSep, 1), L"%sep%");
-        m_newSystemCacheStr += m_cacheSep;
-        m_newSystemCacheStr += m_timeStamp;
-        m_newSystemCacheStr += L'-';
-        m_newSystemCacheStr += m_imageSize;
-    }
-
-    struct PendingHook {
-        void* targetFunction;
-        void* hookFunction;
-        void** originalFunction;
-    };
+    bool IsCacheString(std::wstring_view cache) const {
+        return cache.starts_with(kErrorCachePrefix) ||
+               (cache.length() >= 2 && cache[0] == kCacheVer &&
+                cache[1] == m_cacheSep);
+    }
 
+    // The version of the string format, used by the online cache. The local
+    // cache uses the binary format of SymbolCacheData.
     static constexpr WCHAR kCacheVer = L'1';
     static constexpr std::wstring_view kErrorCachePrefix = L"error:"sv;
     static constexpr WCHAR kErrorCacheVer = L'1';
@@ -971,9 +1603,11 @@ class HookSymbolsSession {
     std::wstring m_timeStamp;
     std::wstring m_imageSize;
     std::wstring m_cacheStrKey;
-    std::wstring m_newSystemCacheStr;
+    SymbolCacheData m_newSystemCache;
     std::vector<const WH_SYMBOL_HOOK*> m_symbolHooksUnresolved;
-    std::vector<PendingHook> m_pendingHooks;
+    std::unordered_map<std::wstring_view, std::vector<const WH_SYMBOL_HOOK*>>
+        m_symbolHooksByName;
+    std::vector<LoadedMod::PendingHook> m_pendingHooks;
 };
 
 std::wstring GetWindowsVersionForLogging() {
@@ -1016,22 +1650,382 @@ std::wstring GetWindowsVersionForLogging() {
     return result;
 }
 
+// Returns the Windows build and its revision, e.g. "22631.4169", which
+// determine the versions of system modules.
+std::wstring GetWindowsBuildForOnlineCache() {
+    static const std::wstring result = []() {
+        WCHAR buildNumberReg[32] = L"";
+        DWORD buildNumberRegSize = sizeof(buildNumberReg);
+        RegGetValue(HKEY_LOCAL_MACHINE,
+                    L"SOFTWARE\\Microsoft\\Windows NT\\CurrentVersion",
+                    L"CurrentBuild", RRF_RT_REG_SZ, nullptr, buildNumberReg,
+                    &buildNumberRegSize);
+
+        DWORD buildRevisionReg = 0;
+        DWORD buildRevisionRegSize = sizeof(buildRevisionReg);
+        RegGetValue(HKEY_LOCAL_MACHINE,
+                    L"SOFTWARE\\Microsoft\\Windows NT\\CurrentVersion", L"UBR",
+                    RRF_RT_REG_DWORD, nullptr, &buildRevisionReg,
+                    &buildRevisionRegSize);
+
+        if (!*buildNumberReg) {
+            return std::wstring();
+        }
+
+        std::wstring result = buildNumberReg;
+        result += L'.';
+        result += std::to_wstring(buildRevisionReg);
+
+        return result;
+    }();
+
+    return result;
+}
+
+// Lowers the CPU, I/O and memory priority of the current thread while in
+// scope, so that downloading and enumerating symbols doesn't compete with the
+// UI of the target process, e.g. explorer.exe during logon. Doesn't nest: an
+// inner scope does nothing if the thread is already in background mode.
+class BackgroundThreadModeScope {
+   public:
+    BackgroundThreadModeScope()
+        : m_entered(SetThreadPriority(GetCurrentThread(),
+                                      THREAD_MODE_BACKGROUND_BEGIN)) {}
+
+    ~BackgroundThreadModeScope() {
+        if (m_entered) {
+            SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+        }
+    }
+
+    BackgroundThreadModeScope(const BackgroundThreadModeScope&) = delete;
+    BackgroundThreadModeScope& operator=(const BackgroundThreadModeScope&) =
+        delete;
+
+   private:
+    bool m_entered;
+};
+
+// Runs the function on a new thread in background mode and waits for it. The
+// calling thread keeps its priority, since it might hold a lock which other
+// threads or processes wait for, and lowering the priority of a lock holder
+// makes all of them wait behind it. New threads can't run while mods are
+// initialized from an APC, and waiting for them would result in a deadlock. In
+// this case, or if the thread can't be created, the function runs on the
+// calling thread with its regular priority. Exceptions are rethrown on the
+// calling thread.
+void RunInBackgroundModeThread(const std::function<void()>& function) {
+    struct ThreadParam {
+        const std::function<void()>& function;
+        std::exception_ptr exception;
+    } threadParam{function};
+
+    wil::unique_handle thread;
+    if (!CustomizationSession::IsInitializingFromAPC()) {
+        thread.reset(CreateThread(
+            nullptr, 0,
+            [](LPVOID pParameter) -> DWORD {
+                auto* threadParam = static_cast<ThreadParam*>(pParameter);
+
+                BackgroundThreadModeScope backgroundThreadModeScope;
+
+                try {
+                    threadParam->function();
+                } catch (...) {
+                    threadParam->exception = std::current_exception();
+                }
+
+                return 0;
+            },
+            &threadParam, 0, nullptr));
+        if (!thread) {
+            LOG(L"Thread creation failed: %u", GetLastError());
+        }
+    }
+
+    if (!thread) {
+        function();
+        return;
+    }
+
+    Functions::SetThreadDescriptionIfAvailable(thread.get(),
+                                               L"WindhawkSymbolsWorker");
+    WaitForSingleObject(thread.get(), INFINITE);
+
+    if (threadParam.exception) {
+        std::rethrow_exception(threadParam.exception);
+    }
+}
+
+// Measures the time spent in each phase of resolving symbols, so that the
+// performance of symbol resolution can be compared between engine builds from
+// the debug log. The memory peak is of the whole process, since loading the
+// PDB is usually what determines it.
+class SymbolResolutionTimer {
+   public:
+    enum class Phase {
+        kLocalCache,
+        kLockWait,
+        kOnlineCache,
+        kSymbolIndex,
+        // Includes downloading the PDB and opening it with DIA.
+        kSymbolLoad,
+        // Includes undecorating and matching the symbols.
+        kEnumeration,
+        kCount,
+    };
+
+    // If a trace is set, the start of each phase and the durations are
+    // added to it.
+    explicit SymbolResolutionTimer(SymbolResolutionTrace* trace)
+        : m_trace(trace) {}
+
+    SymbolResolutionTimer(const SymbolResolutionTimer&) = delete;
+    SymbolResolutionTimer& operator=(const SymbolResolutionTimer&) = delete;
+
+    void Start(Phase phase) {
+        Stop();
+        m_currentPhase = phase;
+        m_phaseStartTime = GetTickCount64();
+
+        if (m_trace) {
+            m_trace->AddEvent(kPhaseNames[static_cast<size_t>(phase)]);
+        }
+    }
+
+    void Stop() {
+        if (m_currentPhase) {
+            m_durations[static_cast<size_t>(*m_currentPhase)] +=
+                GetTickCount64() - m_phaseStartTime;
+            m_currentPhase.reset();
+        }
+    }
+
+    void Log() {
+        Stop();
+
+        PROCESS_MEMORY_COUNTERS memoryCounters;
+        size_t peakWorkingSetKb =
+            K32GetProcessMemoryInfo(GetCurrentProcess(), &memoryCounters,
+                                    sizeof(memoryCounters))
+                ? memoryCounters.PeakWorkingSetSize / 1024
+                : 0;
+
+        VERBOSE(
+            L"Symbol resolution timings (ms): local cache %I64u, lock wait "
+            L"%I64u, online cache %I64u, symbol index %I64u, symbol load "
+            L"%I64u, enumeration %I64u; peak working set %zu KB",
+            GetDuration(Phase::kLocalCache), GetDuration(Phase::kLockWait),
+            GetDuration(Phase::kOnlineCache),
+            GetDuration(Phase::kSymbolIndex), GetDuration(Phase::kSymbolLoad),
+            GetDuration(Phase::kEnumeration), peakWorkingSetKb);
+
+        if (m_trace) {
+            try {
+                for (size_t i = 0; i < m_durations.size(); i++) {
+                    m_trace->AddPhaseDuration(kPhaseNames[i], m_durations[i]);
+                }
+            } catch (const std::exception& e) {
+                LOG(L"%S", e.what());
+            }
+        }
+    }
+
+   private:
+    static constexpr PCSTR kPhaseNames[] = {
+        "localCache",  "lockWait",   "onlineCache",
+        "symbolIndex", "symbolLoad", "enumeration",
+    };
+    static_assert(ARRAYSIZE(kPhaseNames) == static_cast<size_t>(Phase::kCount));
+
+    ULONGLONG GetDuration(Phase phase) const {
+        return m_durations[static_cast<size_t>(phase)];
+    }
+
+    SymbolResolutionTrace* m_trace;
+    std::array<ULONGLONG, static_cast<size_t>(Phase::kCount)> m_durations{};
+    std::optional<Phase> m_currentPhase;
+    ULONGLONG m_phaseStartTime = 0;
+};
+
+// Formats a setting name with printf-style arguments, and returns it in
+// lowercase, since names are case-insensitive.
+std::wstring FormatSettingName(PCWSTR name, va_list args) {
+    std::wstring nameFormatted;
+    if (wcschr(name, L'%')) {
+        va_list argsCopy;
+        va_copy(argsCopy, args);  // https://stackoverflow.com/q/55274350
+        nameFormatted.resize(_vscwprintf(name, argsCopy));
+        va_end(argsCopy);
+        vswprintf_s(nameFormatted.data(), nameFormatted.length() + 1, name,
+                    args);
+
+        VERBOSE(L"Formatted name: %s", nameFormatted.c_str());
+    } else {
+        nameFormatted = name;
+    }
+
+    std::transform(nameFormatted.begin(), nameFormatted.end(),
+                   nameFormatted.begin(), towlower);
+    return nameFormatted;
+}
+
+// Compares lowercase setting names such that the items of a list are in index
+// order, e.g. "items[2].name" comes before "items[10].name".
+bool SettingNameLess(std::wstring_view a, std::wstring_view b) {
+    auto isDigit = [](WCHAR c) { return c >= L'0' && c <= L'9'; };
+
+    // Returns the number which starts at pos, without leading zeros, and
+    // advances pos past it.
+    auto takeNumber = [&isDigit](std::wstring_view s, size_t& pos) {
+        size_t start = pos;
+        while (pos < s.size() && isDigit(s[pos])) {
+            pos++;
+        }
+
+        auto number = s.substr(start, pos - start);
+        while (number.size() > 1 && number[0] == L'0') {
+            number.remove_prefix(1);
+        }
+
+        return number;
+    };
+
+    size_t i = 0;
+    size_t j = 0;
+    while (i < a.size() && j < b.size()) {
+        if (isDigit(a[i]) && isDigit(b[j])) {
+            auto numberA = takeNumber(a, i);
+            auto numberB = takeNumber(b, j);
+            if (numberA.size() != numberB.size()) {
+                return numberA.size() < numberB.size();
+            }
+
+            if (numberA != numberB) {
+                return numberA < numberB;
+            }
+
+            continue;
+        }
+
+        if (a[i] != b[j]) {
+            return a[i] < b[j];
+        }
+
+        i++;
+        j++;
+    }
+
+    return a.size() - i < b.size() - j;
+}
+
+struct SettingsBlockItem {
+    std::wstring_view nameLower;
+    const std::wstring* name;
+    // Null for a removed setting.
+    const std::wstring* value;
+};
+
+// Returns the settings sorted by name, allocated as a single block together
+// with the items and the strings, which is freed at once by FreeSettingsBlock.
+const WH_SETTINGS* MakeSettingsBlock(std::vector<SettingsBlockItem> items) {
+    std::sort(items.begin(), items.end(), [](const auto& a, const auto& b) {
+        return SettingNameLess(a.nameLower, b.nameLower);
+    });
+
+    size_t stringsLength = 0;
+    for (const auto& item : items) {
+        stringsLength += item.name->length() + 1;
+        if (item.value) {
+            stringsLength += item.value->length() + 1;
+        }
+    }
+
+    static_assert(sizeof(WH_SETTINGS) % alignof(WH_SETTING) == 0);
+    size_t itemsOffset = sizeof(WH_SETTINGS);
+    size_t stringsOffset = itemsOffset + items.size() * sizeof(WH_SETTING);
+    auto block = std::make_unique<BYTE[]>(stringsOffset +
+                                          stringsLength * sizeof(WCHAR));
+
+    auto* blockItems = reinterpret_cast<WH_SETTING*>(block.get() + itemsOffset);
+    auto* strings = reinterpret_cast<PWSTR>(block.get() + stringsOffset);
+    auto copyString = [&strings](const std::wstring& string) {
+        PCWSTR result = strings;
+        wmemcpy(strings, string.c_str(), string.length() + 1);
+        strings += string.length() + 1;
+        return result;
+    };
+
+    for (size_t i = 0; i < items.size(); i++) {
+        blockItems[i].name = copyString(*items[i].name);
+        blockItems[i].value =
+            items[i].value ? copyString(*items[i].value) : nullptr;
+    }
+
+    auto* settings = reinterpret_cast<WH_SETTINGS*>(block.release());
+    settings->count = items.size();
+    settings->items = blockItems;
+    return settings;
+}
+
+void FreeSettingsBlock(const WH_SETTINGS* settings) {
+    delete[] reinterpret_cast<const BYTE*>(settings);
+}
+
+// The content is freed by LoadedMod::FreeUrlContent. If the data wasn't
+// collected in the response, e.g. since it was written to a file, the data of
+// the content is null.
+const WH_URL_CONTENT* MakeUrlContent(const HttpClient::Response& response,
+                                     bool withData) {
+    auto content = std::make_unique<WH_URL_CONTENT>();
+    content->statusCode = response.statusCode;
+
+    if (withData) {
+        auto data = std::make_unique<char[]>(response.data.size() + 1);
+        std::copy(response.data.begin(), response.data.end(), data.get());
+        data[response.data.size()] = '\0';
+        content->data = data.release();
+    } else {
+        content->data = nullptr;
+    }
+
+    content->length = response.length;
+
+    return content.release();
+}
+
 }  // namespace
 
 LoadedMod::LoadedMod(PCWSTR modName,
-                     PCWSTR modInstanceId,
                      PCWSTR libraryPath,
                      bool loadedOnStartup,
-                     bool loggingEnabled,
-                     bool debugLoggingEnabled)
+                     const ModConfigSnapshot::ModConfig& modConfig)
     : m_modName(modName),
-      m_modInstanceId(modInstanceId),
+      m_modTask(ModStatusTable::Kind::kTask, modName),
+      m_loadTimes(modName),
+      m_localStorage(modName),
       m_loadedOnStartup(loadedOnStartup),
-      m_loggingEnabled(loggingEnabled),
-      m_debugLoggingEnabled(debugLoggingEnabled),
-      m_compatDemangling(ShouldUseCompatDemangling(m_modName)) {
+      m_loggingEnabled(modConfig.loggingEnabled),
+      m_debugLoggingEnabled(modConfig.debugLoggingEnabled),
+      m_compatDemangling(
+          ShouldUseCompatDemangling(m_modName, modConfig.version)) {
     auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
 
+    LONGLONG loadStartCounter = ModLoadTimes::Now();
+
+    m_modTaskTimer.reset(
+        CreateThreadpoolTimer(ModTaskTimerCallback, this, nullptr));
+    THROW_LAST_ERROR_IF_NULL(m_modTaskTimer);
+
+    if (HookCallStats::IsEnabled()) {
+        try {
+            m_hookCallStats.emplace(modName);
+        } catch (const std::exception& e) {
+            LOG(L"Mod %s: Creating hook call stats failed: %S",
+                m_modName.c_str(), e.what());
+        }
+    }
+
     VERBOSE(L"Windows %s", GetWindowsVersionForLogging().c_str());
 #if defined(_M_IX86)
 #define WINDHAWK_ARCH L"x86"
@@ -1045,7 +2039,8 @@ LoadedMod::LoadedMod(PCWSTR modName,
     VERBOSE(L"Windhawk v" VER_FILE_VERSION_WSTR L" " WINDHAWK_ARCH);
 #undef WINDHAWK_ARCH
     VERBOSE(L"Mod id: %s", m_modName.c_str());
-    VERBOSE(L"Mod version: %s", GetModVersion(m_modName.c_str()).c_str());
+    VERBOSE(L"Mod version: %s",
+            modConfig.version.empty() ? L"-" : modConfig.version.c_str());
 
     m_modModule.reset(
         LoadLibraryEx(libraryPath, nullptr, LOAD_WITH_ALTERED_SEARCH_PATH));
@@ -1053,6 +2048,34 @@ LoadedMod::LoadedMod(PCWSTR modName,
 
     VERBOSE(L"Mod base address: %p", m_modModule.get());
 
+    // Mods are compiled with a fixed base address, so that their code pages
+    // are shared by all processes. A mod which is relocated, e.g. because the
+    // address is taken, gets a private copy of each page which has a
+    // relocation.
+    if (std::optional<ULONGLONG> fixedBase =
+            Functions::GetImageFileFixedBase(libraryPath);
+        fixedBase &&
+        *fixedBase != reinterpret_cast<ULONG_PTR>(m_modModule.get())) {
+        LOG(L"Mod %s: Relocated from its base address %p",
+            m_modName.c_str(), reinterpret_cast<void*>(*fixedBase));
+    }
+
+    auto getCallback = [this](auto* callback, PCSTR name) {
+        *callback = reinterpret_cast<std::remove_pointer_t<decltype(callback)>>(
+            GetProcAddress(m_modModule.get(), name));
+    };
+
+    getCallback(&m_modCallbacks.init, "_Z10Wh_ModInitv");
+    getCallback(&m_modCallbacks.afterInit, "_Z15Wh_ModAfterInitv");
+    getCallback(&m_modCallbacks.beforeUninit, "_Z18Wh_ModBeforeUninitv");
+    getCallback(&m_modCallbacks.uninit, "_Z12Wh_ModUninitv");
+    getCallback(&m_modCallbacks.settingsChangedEx2,
+                "_Z21Wh_ModSettingsChangedPiPK14tagWH_SETTINGS");
+    getCallback(&m_modCallbacks.settingsChangedEx,
+                "_Z21Wh_ModSettingsChangedPi");
+    getCallback(&m_modCallbacks.settingsChanged, "_Z21Wh_ModSettingsChangedv");
+    getCallback(&m_modCallbacks.reinit, "_Z12Wh_ModReinitv");
+
     LoadedMod** pModPtr = reinterpret_cast<LoadedMod**>(
         GetProcAddress(m_modModule.get(), "InternalWhModPtr"));
     if (pModPtr) {
@@ -1066,11 +2089,46 @@ LoadedMod::LoadedMod(PCWSTR modName,
     } catch (const std::exception& e) {
         LOG(L"Mod %s: %S", m_modName.c_str(), e.what());
     }
+
+    m_loadTimes.Add(ModLoadTimes::Phase::kLoad, loadStartCounter);
+
+    if (ModCpuSampler::IsEnabled()) {
+        try {
+            m_cpuSamplerId = ModCpuSampler::GetInstance().Register(
+                modName, m_modModule.get());
+        } catch (const std::exception& e) {
+            LOG(L"Mod %s: Registering for CPU sampling failed: %S",
+                m_modName.c_str(), e.what());
+        }
+    }
+
+    EngineMetrics::ModLoaded();
 }
 
 LoadedMod::~LoadedMod() {
     auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
 
+    EngineMetrics::ModUnloaded();
+
+    if (m_cpuSamplerId) {
+        ModCpuSampler::GetInstance().Unregister(m_cpuSamplerId);
+    }
+
+    // In case BeforeUninit wasn't called, e.g. if initialization failed.
+    UnregisterAllModuleLoadCallbacks();
+    UnregisterAllVisualTreeCallbacks();
+    CancelAllUrlContentRequests();
+    m_threadPool.Close();
+
+    try {
+        ImportHooks::GetInstance().RemoveAll(reinterpret_cast<ULONG_PTR>(this));
+    } catch (const std::exception& e) {
+        LOG(L"Mod %s: %S", m_modName.c_str(), e.what());
+    }
+
+    // Waits for a running callback and cancels a pending one.
+    m_modTaskTimer.reset();
+
 #ifdef WH_HOOKING_ENGINE_MINHOOK
     MH_STATUS status =
         MH_RemoveHookEx(reinterpret_cast<ULONG_PTR>(this), MH_ALL_HOOKS);
@@ -1087,6 +2145,9 @@ LoadedMod::~LoadedMod() {
 
 bool LoadedMod::Initialize() {
     auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
+    TraceEvents::ScopedPhase phase("ModInitialize", m_modName.c_str());
+    ModLoadTimes::ScopedTimer loadTimer(m_loadTimes,
+                                        ModLoadTimes::Phase::kInit);
 
     if (m_initialized) {
         throw std::logic_error("Already initialized");
@@ -1094,15 +2155,34 @@ bool LoadedMod::Initialize() {
 
     SetTask(L"Initializing...");
 
-    using WH_MOD_INIT_T = BOOL(__cdecl*)();
-    auto pWH_ModInit = reinterpret_cast<WH_MOD_INIT_T>(
-        GetProcAddress(m_modModule.get(), "_Z10Wh_ModInitv"));
-    if (pWH_ModInit) {
-        m_initialized = pWH_ModInit();
-    } else {
-        m_initialized = true;
-    }
-
+    // Loaded before the mod can change them, so that the changes can be
+    // computed on the first settings change.
+    if (m_modCallbacks.settingsChangedEx2) {
+        try {
+            GetSettingsValues();
+        } catch (const std::exception& e) {
+            LOG(L"Mod %s: %S", m_modName.c_str(), e.what());
+        }
+    }
+
+    m_initStartTickCount = GetTickCount64();
+
+    if (m_modCallbacks.init) {
+        m_initialized = m_modCallbacks.init();
+    } else {
+        m_initialized = true;
+    }
+
+    // The mod might have ignored the HookSymbols failure. Its queued hooks
+    // are discarded with it, and it's initialized again from scratch.
+    if (m_initDeferred && m_initialized) {
+        if (m_modCallbacks.uninit) {
+            m_modCallbacks.uninit();
+        }
+
+        m_initialized = false;
+    }
+
     SetTask(nullptr);
 
     return m_initialized;
@@ -1110,12 +2190,11 @@ bool LoadedMod::Initialize() {
 
 void LoadedMod::AfterInit() {
     auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
+    ModLoadTimes::ScopedTimer loadTimer(m_loadTimes,
+                                        ModLoadTimes::Phase::kAfterInit);
 
-    using WH_MOD_AFTER_INIT_T = void(__cdecl*)();
-    auto pWH_ModAfterInit = reinterpret_cast<WH_MOD_AFTER_INIT_T>(
-        GetProcAddress(m_modModule.get(), "_Z15Wh_ModAfterInitv"));
-    if (pWH_ModAfterInit) {
-        pWH_ModAfterInit();
+    if (m_modCallbacks.afterInit) {
+        m_modCallbacks.afterInit();
     }
 }
 
@@ -1124,15 +2203,20 @@ void LoadedMod::BeforeUninit() {
 
     SetTask(L"Uninitializing...");
 
-    using WH_MOD_BEFORE_UNINIT_T = void(__cdecl*)();
-    auto pWH_ModBeforeUninit = reinterpret_cast<WH_MOD_BEFORE_UNINIT_T>(
-        GetProcAddress(m_modModule.get(), "_Z18Wh_ModBeforeUninitv"));
-    if (pWH_ModBeforeUninit) {
-        pWH_ModBeforeUninit();
+    if (m_modCallbacks.beforeUninit) {
+        m_modCallbacks.beforeUninit();
     }
 
     m_uninitializing = true;
 
+    UnregisterAllModuleLoadCallbacks();
+    UnregisterAllVisualTreeCallbacks();
+    CancelAllUrlContentRequests();
+    m_threadPool.Close();
+
+    ImportHooks::GetInstance().QueueRemoveAll(
+        reinterpret_cast<ULONG_PTR>(this));
+
 #ifdef WH_HOOKING_ENGINE_MINHOOK
     MH_STATUS status =
         MH_QueueDisableHookEx(reinterpret_cast<ULONG_PTR>(this), MH_ALL_HOOKS);
@@ -1150,11 +2234,8 @@ void LoadedMod::BeforeUninit() {
 void LoadedMod::Uninitialize() {
     auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
 
-    using WH_MOD_UNINIT_T = void(__cdecl*)();
-    auto pWH_ModUninit = reinterpret_cast<WH_MOD_UNINIT_T>(
-        GetProcAddress(m_modModule.get(), "_Z12Wh_ModUninitv"));
-    if (pWH_ModUninit) {
-        pWH_ModUninit();
+    if (m_modCallbacks.uninit) {
+        m_modCallbacks.uninit();
     }
 }
 
@@ -1166,33 +2247,155 @@ void LoadedMod::EnableDebugLogging(bool enable) {
     m_debugLoggingEnabled = enable;
 }
 
-bool LoadedMod::SettingsChanged(bool* reload) {
+bool LoadedMod::SettingsChanged(bool* reload, bool deferHookOperations) {
     auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
 
     *reload = false;
 
-    using WH_MOD_SETTINGS_CHANGED_EX_T = BOOL(__cdecl*)(BOOL*);
-    auto pWH_ModSettingsChangedEx =
-        reinterpret_cast<WH_MOD_SETTINGS_CHANGED_EX_T>(
-            GetProcAddress(m_modModule.get(), "_Z21Wh_ModSettingsChangedPi"));
-    if (pWH_ModSettingsChangedEx) {
+    std::shared_ptr<const SettingsValues> previousSettingsValues;
+    {
+        std::lock_guard guard(m_settingsValuesMutex);
+        previousSettingsValues = std::exchange(m_settingsValues, nullptr);
+    }
+
+    m_deferHookOperations = deferHookOperations;
+    auto deferHookOperationsReset =
+        wil::scope_exit([this] { m_deferHookOperations = false; });
+
+    if (m_modCallbacks.settingsChangedEx2) {
+        // Without the previous settings, e.g. if they couldn't be loaded, the
+        // changes are unknown, and null is passed.
+        const WH_SETTINGS* changedSettings = nullptr;
+        if (previousSettingsValues) {
+            try {
+                changedSettings = MakeChangedSettings(*previousSettingsValues,
+                                                      *GetSettingsValues());
+                VERBOSE(L"Changed settings: %zu", changedSettings->count);
+            } catch (const std::exception& e) {
+                LogFunctionError(e);
+            }
+        }
+
+        auto changedSettingsFree = wil::scope_exit(
+            [changedSettings] { FreeSettingsBlock(changedSettings); });
+
+        BOOL bReload = FALSE;
+        bool result =
+            m_modCallbacks.settingsChangedEx2(&bReload, changedSettings);
+        *reload = bReload;
+        return result;
+    }
+
+    if (m_modCallbacks.settingsChangedEx) {
         BOOL bReload = FALSE;
-        bool result = pWH_ModSettingsChangedEx(&bReload);
+        bool result = m_modCallbacks.settingsChangedEx(&bReload);
         *reload = bReload;
         return result;
     }
 
-    using WH_MOD_SETTINGS_CHANGED_T = void(__cdecl*)();
-    auto pWH_ModSettingsChanged = reinterpret_cast<WH_MOD_SETTINGS_CHANGED_T>(
-        GetProcAddress(m_modModule.get(), "_Z21Wh_ModSettingsChangedv"));
-    if (pWH_ModSettingsChanged) {
-        pWH_ModSettingsChanged();
+    if (m_modCallbacks.settingsChanged) {
+        m_modCallbacks.settingsChanged();
         return true;
     }
 
     return true;
 }
 
+void LoadedMod::FinishDeferredHookOperations() {
+    if (!m_hookOperationsDeferred.exchange(false)) {
+        return;
+    }
+
+#ifdef WH_HOOKING_ENGINE_MINHOOK
+    MH_STATUS status =
+        MH_RemoveDisabledHooksEx(reinterpret_cast<ULONG_PTR>(this));
+    if (status != MH_OK) {
+        LOG(L"Mod %s error: MH_RemoveDisabledHooksEx returned %d",
+            m_modName.c_str(), status);
+    }
+#elif WH_HOOKING_ENGINE == WH_HOOKING_ENGINE_NONE
+// For testing without a hooking engine.
+#else
+#error "Unsupported hooking engine"
+#endif  // WH_HOOKING_ENGINE
+}
+
+void LoadedMod::CancelLongOperations() noexcept {
+    m_cancelEvent.SetEvent();
+}
+
+bool LoadedMod::CanSoftReload() {
+    return m_modCallbacks.reinit != nullptr;
+}
+
+bool LoadedMod::SoftReload() {
+    auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
+
+    if (!m_modCallbacks.reinit) {
+        throw std::logic_error("Wh_ModReinit isn't exported");
+    }
+
+    // Hooks which are set again re-queue themselves to stay enabled.
+    ImportHooks::GetInstance().QueueRemoveAll(
+        reinterpret_cast<ULONG_PTR>(this));
+
+#ifdef WH_HOOKING_ENGINE_MINHOOK
+    MH_STATUS status =
+        MH_QueueDisableHookEx(reinterpret_cast<ULONG_PTR>(this), MH_ALL_HOOKS);
+    if (status != MH_OK) {
+        LOG(L"Mod %s error: MH_QueueDisableHookEx returned %d",
+            m_modName.c_str(), status);
+        return false;
+    }
+#endif  // WH_HOOKING_ENGINE_MINHOOK
+
+    m_softReloadFailed = false;
+    m_softReloading = true;
+    m_deferHookOperations = true;
+    // Disabled hooks have to be removed once applied, even if the mod doesn't
+    // apply hook operations itself.
+    m_hookOperationsDeferred = true;
+    auto softReloadingReset = wil::scope_exit([this] {
+        m_deferHookOperations = false;
+        m_softReloading = false;
+    });
+
+    SetTask(L"Reinitializing...");
+    BOOL result = m_modCallbacks.reinit();
+    SetTask(nullptr);
+
+    return result && !m_softReloadFailed;
+}
+
+void LoadedMod::QueueSetHooksPaused(bool paused) {
+    ImportHooks::GetInstance().QueueSetPaused(reinterpret_cast<ULONG_PTR>(this),
+                                              paused);
+
+#ifdef WH_HOOKING_ENGINE_MINHOOK
+    ULONG_PTR hookIdent = reinterpret_cast<ULONG_PTR>(this);
+    MH_STATUS status = paused ? MH_QueueDisableHookEx(hookIdent, MH_ALL_HOOKS)
+                              : MH_QueueEnableHookEx(hookIdent, MH_ALL_HOOKS);
+    if (status != MH_OK) {
+        LOG(L"Mod %s error: MH_Queue%sHookEx returned %d", m_modName.c_str(),
+            paused ? L"Disable" : L"Enable", status);
+    }
+#elif WH_HOOKING_ENGINE == WH_HOOKING_ENGINE_NONE
+// For testing without a hooking engine.
+#else
+#error "Unsupported hooking engine"
+#endif  // WH_HOOKING_ENGINE
+}
+
+// static
+void LoadedMod::ClearInMemorySymbolCache() {
+    InMemorySymbolCache::GetInstance().Clear();
+}
+
+// static
+void LoadedMod::ClearInMemorySymbolCache(PCWSTR modName) {
+    InMemorySymbolCache::GetInstance().Clear(modName);
+}
+
 PCWSTR LoadedMod::GetModName() {
     return m_modName.c_str();
 }
@@ -1202,18 +2405,21 @@ HMODULE LoadedMod::GetModModuleHandle() {
 }
 
 BOOL LoadedMod::IsLogEnabled() {
-    return m_loggingEnabled || m_debugLoggingEnabled;
+    // Checked here rather than in Log, so that the arguments of suppressed
+    // lines aren't even evaluated.
+    return (m_loggingEnabled || m_debugLoggingEnabled) &&
+           m_logRateLimiter.TryAcquire();
 }
 
 void LoadedMod::Log(PCWSTR format, va_list args) {
-    va_list argsCopy;
-    va_copy(argsCopy, args);  // https://stackoverflow.com/q/55274350
-    WCHAR logFormatted[1025];
-    _vsnwprintf_s(logFormatted, _TRUNCATE, format, args);
-    va_end(argsCopy);
+    ULONG suppressedCount = m_logRateLimiter.TakeSuppressedCount();
+    if (suppressedCount > 0) {
+        Logger::GetInstance().LogLine(
+            L"[WH] [%s] %u messages suppressed by the rate limit\n",
+            m_modName.c_str(), suppressedCount);
+    }
 
-    Logger::GetInstance().LogLine(L"[WH] [%s] %s\n", m_modName.c_str(),
-                                  logFormatted);
+    Logger::GetInstance().VLogModLine(m_modName.c_str(), format, args);
 }
 
 int LoadedMod::GetIntValue(PCWSTR valueName, int defaultValue) {
@@ -1221,9 +2427,7 @@ int LoadedMod::GetIntValue(PCWSTR valueName, int defaultValue) {
     VERBOSE(L"valueName: %s", valueName);
 
     try {
-        auto settings = StorageManager::GetInstance().GetModWritableConfig(
-            m_modName.c_str(), L"LocalStorage", false);
-        int value = settings->GetInt(valueName).value_or(defaultValue);
+        int value = m_localStorage.GetInt(valueName).value_or(defaultValue);
         VERBOSE(L"value: %d", value);
         return value;
     } catch (const std::exception& e) {
@@ -1239,9 +2443,7 @@ BOOL LoadedMod::SetIntValue(PCWSTR valueName, int value) {
     VERBOSE(L"value: %d", value);
 
     try {
-        auto settings = StorageManager::GetInstance().GetModWritableConfig(
-            m_modName.c_str(), L"LocalStorage", true);
-        settings->SetInt(valueName, value);
+        m_localStorage.Set({{valueName, value}});
         return TRUE;
     } catch (const std::exception& e) {
         LogFunctionError(e);
@@ -1261,9 +2463,7 @@ size_t LoadedMod::GetStringValue(PCWSTR valueName,
     }
 
     try {
-        auto settings = StorageManager::GetInstance().GetModWritableConfig(
-            m_modName.c_str(), L"LocalStorage", false);
-        auto value = settings->GetString(valueName).value_or(L"");
+        auto value = m_localStorage.GetString(valueName).value_or(L"");
         if (value.length() <= bufferChars - 1) {
             wcscpy_s(stringBuffer, bufferChars, value.c_str());
             VERBOSE(L"value: %s", value.c_str());
@@ -1286,9 +2486,7 @@ BOOL LoadedMod::SetStringValue(PCWSTR valueName, PCWSTR value) {
     VERBOSE(L"value: %s", value);
 
     try {
-        auto settings = StorageManager::GetInstance().GetModWritableConfig(
-            m_modName.c_str(), L"LocalStorage", true);
-        settings->SetString(valueName, value);
+        m_localStorage.Set({{valueName, std::wstring(value)}});
         return TRUE;
     } catch (const std::exception& e) {
         LogFunctionError(e);
@@ -1304,10 +2502,8 @@ size_t LoadedMod::GetBinaryValue(PCWSTR valueName,
     VERBOSE(L"valueName: %s", valueName);
 
     try {
-        auto settings = StorageManager::GetInstance().GetModWritableConfig(
-            m_modName.c_str(), L"LocalStorage", false);
         auto value =
-            settings->GetBinary(valueName).value_or(std::vector<BYTE>{});
+            m_localStorage.GetBinary(valueName).value_or(std::vector<BYTE>{});
         if (value.size() <= bufferSize) {
             memcpy(buffer, value.data(), value.size());
             return value.size();
@@ -1328,10 +2524,9 @@ BOOL LoadedMod::SetBinaryValue(PCWSTR valueName,
     VERBOSE(L"valueName: %s", valueName);
 
     try {
-        auto settings = StorageManager::GetInstance().GetModWritableConfig(
-            m_modName.c_str(), L"LocalStorage", true);
-        settings->SetBinary(valueName, reinterpret_cast<const BYTE*>(buffer),
-                            bufferSize);
+        auto bytes = reinterpret_cast<const BYTE*>(buffer);
+        m_localStorage.Set(
+            {{valueName, std::vector<BYTE>(bytes, bytes + bufferSize)}});
         return TRUE;
     } catch (const std::exception& e) {
         LogFunctionError(e);
@@ -1345,9 +2540,58 @@ BOOL LoadedMod::DeleteValue(PCWSTR valueName) {
     VERBOSE(L"valueName: %s", valueName);
 
     try {
-        auto settings = StorageManager::GetInstance().GetModWritableConfig(
-            m_modName.c_str(), L"LocalStorage", true);
-        settings->Remove(valueName);
+        m_localStorage.Set({{valueName, std::monostate{}}});
+        return TRUE;
+    } catch (const std::exception& e) {
+        LogFunctionError(e);
+    }
+
+    return FALSE;
+}
+
+BOOL LoadedMod::SetValues(const WH_VALUE* values, size_t valuesCount) {
+    auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
+    VERBOSE(L"valuesCount: %zu", valuesCount);
+
+    try {
+        std::vector<std::pair<std::wstring, LocalStorageBuffer::Value>>
+            localStorageValues;
+        localStorageValues.reserve(valuesCount);
+
+        for (size_t i = 0; i < valuesCount; i++) {
+            const WH_VALUE& value = values[i];
+            VERBOSE(L"valueName: %s", value.valueName);
+
+            LocalStorageBuffer::Value localStorageValue;
+            switch (value.type) {
+                case WH_VALUE_TYPE_INT:
+                    localStorageValue = value.intValue;
+                    break;
+
+                case WH_VALUE_TYPE_STRING:
+                    localStorageValue = std::wstring(value.stringValue);
+                    break;
+
+                case WH_VALUE_TYPE_BINARY: {
+                    auto bytes =
+                        reinterpret_cast<const BYTE*>(value.binaryValue);
+                    localStorageValue = std::vector<BYTE>(
+                        bytes, bytes + value.binaryValueSize);
+                    break;
+                }
+
+                case WH_VALUE_TYPE_DELETE:
+                    break;
+
+                default:
+                    throw std::invalid_argument("Invalid value type");
+            }
+
+            localStorageValues.emplace_back(value.valueName,
+                                            std::move(localStorageValue));
+        }
+
+        m_localStorage.Set(std::move(localStorageValues));
         return TRUE;
     } catch (const std::exception& e) {
         LogFunctionError(e);
@@ -1388,19 +2632,20 @@ int LoadedMod::GetIntSetting(PCWSTR valueName, va_list args) {
     VERBOSE(L"valueName: %s", valueName);
 
     try {
-        va_list argsCopy;
-        va_copy(argsCopy, args);  // https://stackoverflow.com/q/55274350
-        std::wstring valueNameFormatted(_vscwprintf(valueName, argsCopy),
-                                        L'\0');
-        va_end(argsCopy);
-        vswprintf_s(valueNameFormatted.data(), valueNameFormatted.length() + 1,
-                    valueName, args);
-
-        VERBOSE(L"valueNameFormatted: %s", valueNameFormatted.c_str());
+        int value = 0;
+        auto stringValue = GetSettingValue(valueName, args);
+        if (stringValue) {
+            // Same conversion as for values read from storage.
+            long longValue = std::stol(*stringValue, nullptr, 0);
+            if (longValue > INT_MAX) {
+                value = INT_MAX;
+            } else if (longValue < INT_MIN) {
+                value = INT_MIN;
+            } else {
+                value = wil::safe_cast<int>(longValue);
+            }
+        }
 
-        auto settings = StorageManager::GetInstance().GetModConfig(
-            m_modName.c_str(), L"Settings");
-        int value = settings->GetInt(valueNameFormatted.c_str()).value_or(0);
         VERBOSE(L"value: %d", value);
         return value;
     } catch (const std::exception& e) {
@@ -1415,20 +2660,7 @@ PCWSTR LoadedMod::GetStringSetting(PCWSTR valueName, va_list args) {
     VERBOSE(L"valueName: %s", valueName);
 
     try {
-        va_list argsCopy;
-        va_copy(argsCopy, args);  // https://stackoverflow.com/q/55274350
-        std::wstring valueNameFormatted(_vscwprintf(valueName, argsCopy),
-                                        L'\0');
-        va_end(argsCopy);
-        vswprintf_s(valueNameFormatted.data(), valueNameFormatted.length() + 1,
-                    valueName, args);
-
-        VERBOSE(L"valueNameFormatted: %s", valueNameFormatted.c_str());
-
-        auto settings = StorageManager::GetInstance().GetModConfig(
-            m_modName.c_str(), L"Settings");
-        auto value =
-            settings->GetString(valueNameFormatted.c_str()).value_or(L"");
+        auto value = GetSettingValue(valueName, args).value_or(L"");
 
         auto valueAllocated = std::make_unique<WCHAR[]>(value.length() + 1);
         wcscpy_s(valueAllocated.get(), value.length() + 1, value.c_str());
@@ -1449,6 +2681,53 @@ void LoadedMod::FreeStringSetting(PCWSTR string) {
     }
 }
 
+const WH_SETTINGS* LoadedMod::GetSettings(PCWSTR prefix, va_list args) {
+    auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
+    VERBOSE(L"prefix: %s", prefix ? prefix : L"(none)");
+
+    try {
+        std::wstring prefixFormatted =
+            prefix ? FormatSettingName(prefix, args) : std::wstring();
+
+        // The prefix matches whole parts of names, e.g. "items" matches
+        // "items[0].name" and "items.count", but not "itemsCount".
+        auto matchesPrefix = [&prefixFormatted](const std::wstring& name) {
+            size_t prefixLen = prefixFormatted.length();
+            return prefixLen == 0 ||
+                   (name.starts_with(prefixFormatted) &&
+                    (name.length() == prefixLen || name[prefixLen] == L'.' ||
+                     name[prefixLen] == L'['));
+        };
+
+        auto settingsValues = GetSettingsValues();
+
+        std::vector<SettingsBlockItem> items;
+        for (const auto& [nameLower, setting] : *settingsValues) {
+            if (matchesPrefix(nameLower)) {
+                items.push_back({
+                    .nameLower = nameLower,
+                    .name = &setting.name,
+                    .value = &setting.value,
+                });
+            }
+        }
+
+        auto settings = MakeSettingsBlock(std::move(items));
+        VERBOSE(L"count: %zu", settings->count);
+        return settings;
+    } catch (const std::exception& e) {
+        LogFunctionError(e);
+    }
+
+    return nullptr;
+}
+
+void LoadedMod::FreeSettings(const WH_SETTINGS* settings) {
+    auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
+
+    FreeSettingsBlock(settings);
+}
+
 BOOL LoadedMod::SetFunctionHook(void* targetFunction,
                                 void* hookFunction,
                                 void** originalFunction) {
@@ -1462,13 +2741,47 @@ BOOL LoadedMod::SetFunctionHook(void* targetFunction,
         return FALSE;
     }
 
+    void* detourFunction = hookFunction;
+    if (m_hookCallStats) {
+        detourFunction =
+            m_hookCallStats->WrapHookFunction(targetFunction, hookFunction);
+    }
+
     MH_STATUS status =
         MH_CreateHookEx(reinterpret_cast<ULONG_PTR>(this), targetFunction,
-                        hookFunction, originalFunction);
-    if (status != MH_OK) {
+                        detourFunction, originalFunction);
+    if (status == MH_ERROR_ALREADY_CREATED && m_softReloading) {
+        // Kept as is if it's the same hook, a trampoline can't be replaced
+        // without unhooking.
+        bool sameHook = false;
+        {
+            std::lock_guard guard(m_setHooksMutex);
+            auto it = m_setHooks.find(targetFunction);
+            sameHook = it != m_setHooks.end() &&
+                       it->second.hookFunction == hookFunction &&
+                       it->second.originalFunction == originalFunction;
+        }
+
+        if (!sameHook) {
+            LOG(L"Mod %s error: A different hook was set for %p on reinit, "
+                L"reloading",
+                m_modName.c_str(), targetFunction);
+            m_softReloadFailed = true;
+            return FALSE;
+        }
+
+        status = MH_OK;
+    } else if (status != MH_OK) {
         LOG(L"Mod %s error: MH_CreateHookEx returned %d", m_modName.c_str(),
             status);
         return FALSE;
+    } else if (m_modCallbacks.reinit) {
+        std::lock_guard guard(m_setHooksMutex);
+        m_setHooks[targetFunction] = {
+            .targetFunction = targetFunction,
+            .hookFunction = hookFunction,
+            .originalFunction = originalFunction,
+        };
     }
 
     status =
@@ -1489,6 +2802,49 @@ BOOL LoadedMod::SetFunctionHook(void* targetFunction,
 #endif  // WH_HOOKING_ENGINE
 }
 
+BOOL LoadedMod::HookImport(HMODULE module,
+                           PCSTR dllName,
+                           PCSTR functionName,
+                           void* hookFunction,
+                           void** originalFunction) {
+    auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
+    VERBOSE(L"Module: %p", module);
+    VERBOSE(L"DLL: %S", dllName);
+    if (IS_INTRESOURCE(functionName)) {
+        ULONG_PTR ordinal = reinterpret_cast<ULONG_PTR>(functionName);
+        VERBOSE(L"Function: #%Iu", ordinal);
+    } else {
+        VERBOSE(L"Function: %S", functionName);
+    }
+
+    if (m_uninitializing) {
+        VERBOSE(L"Uninitializing, not allowed to set hooks");
+        return FALSE;
+    }
+
+    if (!module) {
+        module = GetModuleHandle(nullptr);
+    }
+
+    try {
+        if (!ImportHooks::GetInstance().QueueSet(
+                reinterpret_cast<ULONG_PTR>(this), module, dllName,
+                functionName, hookFunction, originalFunction)) {
+            VERBOSE(L"The function isn't imported by the module");
+            return FALSE;
+        }
+    } catch (const std::exception& e) {
+        LOG(L"Mod %s error: Hooking the import failed: %S", m_modName.c_str(),
+            e.what());
+        if (m_softReloading) {
+            m_softReloadFailed = true;
+        }
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 BOOL LoadedMod::RemoveFunctionHook(void* targetFunction) {
     auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
     VERBOSE(L"Target: %p", targetFunction);
@@ -1535,8 +2891,23 @@ BOOL LoadedMod::ApplyHookOperations() {
         return FALSE;
     }
 
+    if (m_deferHookOperations) {
+        // Applied with the other mods which are reloaded, in a single
+        // transaction.
+        VERBOSE(L"Deferring hook operations until the settings are applied");
+        m_hookOperationsDeferred = true;
+        return TRUE;
+    }
+
+    ModLoadTimes::ScopedTimer loadTimer(m_loadTimes,
+                                        ModLoadTimes::Phase::kHooks);
+
+    ImportHooks::GetInstance().ApplyQueued(reinterpret_cast<ULONG_PTR>(this));
+
 #ifdef WH_HOOKING_ENGINE_MINHOOK
-    MH_STATUS status = MH_ApplyQueuedEx(reinterpret_cast<ULONG_PTR>(this));
+    // Coalesced with concurrent requests of other mods, if any.
+    MH_STATUS status = HookApplyScheduler::GetInstance().Apply(
+        reinterpret_cast<ULONG_PTR>(this));
     if (status != MH_OK) {
         LOG(L"Mod %s error: MH_ApplyQueuedEx returned %d", m_modName.c_str(),
             status);
@@ -1616,40 +2987,101 @@ HANDLE LoadedMod::FindFirstSymbol4(HMODULE hModule,
                                    WH_FIND_SYMBOL* findData) {
     auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
 
-    if (options && options->optionsSize != sizeof(WH_FIND_SYMBOL_OPTIONS)) {
-        struct WH_FIND_SYMBOL_OPTIONS_V1 {
-            size_t optionsSize;
-            PCWSTR symbolServer;
-            BOOL noUndecoratedSymbols;
-        };
-        static_assert(
-            sizeof(WH_FIND_SYMBOL_OPTIONS) == sizeof(WH_FIND_SYMBOL_OPTIONS_V1),
-            "Struct was updated, update this code too");
+    return FindFirstSymbolInternal(hModule, options, findData, {});
+}
 
-        LOG(L"Unsupported options->optionsSize value: %zu",
-            options->optionsSize);
-        return nullptr;
+HANDLE LoadedMod::FindFirstSymbolInternal(
+    HMODULE hModule,
+    const WH_FIND_SYMBOL_OPTIONS* options,
+    WH_FIND_SYMBOL* findData,
+    std::vector<std::wstring> nameIdentifiers,
+    bool publicSymbolsOnly,
+    SymbolResolutionTrace* trace) {
+    struct WH_FIND_SYMBOL_OPTIONS_CURRENT {
+        size_t optionsSize;
+        PCWSTR symbolServer;
+        BOOL noUndecoratedSymbols;
+        PCWSTR nameFilter;
+        DWORD nameFilterType;
+    };
+    static_assert(sizeof(WH_FIND_SYMBOL_OPTIONS) ==
+                      sizeof(WH_FIND_SYMBOL_OPTIONS_CURRENT),
+                  "Struct was updated, update this code too");
+
+    struct WH_FIND_SYMBOL_OPTIONS_V1 {
+        size_t optionsSize;
+        PCWSTR symbolServer;
+        BOOL noUndecoratedSymbols;
+    };
+
+    WH_FIND_SYMBOL_OPTIONS optionsResolved;
+
+    switch (options ? options->optionsSize : 0) {
+        case sizeof(WH_FIND_SYMBOL_OPTIONS):
+            optionsResolved = *options;
+            break;
+
+        case sizeof(WH_FIND_SYMBOL_OPTIONS_V1): {
+            const WH_FIND_SYMBOL_OPTIONS_V1* optionsV1 =
+                reinterpret_cast<const WH_FIND_SYMBOL_OPTIONS_V1*>(options);
+            optionsResolved = {
+                .optionsSize = sizeof(optionsResolved),
+                .symbolServer = optionsV1->symbolServer,
+                .noUndecoratedSymbols = optionsV1->noUndecoratedSymbols,
+            };
+            break;
+        }
+
+        case 0:
+            optionsResolved = {
+                .optionsSize = sizeof(optionsResolved),
+            };
+            break;
+
+        default:
+            LOG(L"Unsupported options->optionsSize value: %zu",
+                options->optionsSize);
+            return nullptr;
     }
 
+    options = &optionsResolved;
+
     try {
+        std::optional<SymbolEnum::NameFilterType> nameFilterType;
+        if (options->nameFilter && *options->nameFilter) {
+            switch (options->nameFilterType) {
+                case WH_SYMBOL_NAME_FILTER_PREFIX:
+                    nameFilterType = SymbolEnum::NameFilterType::kPrefix;
+                    break;
+
+                case WH_SYMBOL_NAME_FILTER_SUBSTRING:
+                    nameFilterType = SymbolEnum::NameFilterType::kSubstring;
+                    break;
+
+                case WH_SYMBOL_NAME_FILTER_WILDCARD:
+                    nameFilterType = SymbolEnum::NameFilterType::kWildcard;
+                    break;
+
+                default:
+                    throw std::invalid_argument(
+                        "Unsupported nameFilterType value");
+            }
+        }
+
         HMODULE moduleBase = hModule;
         if (!moduleBase) {
             moduleBase = GetModuleHandle(nullptr);
         }
 
-        std::filesystem::path modulePath =
-            wil::GetModuleFileName<std::wstring>(moduleBase);
+        auto identity = ModuleIdentityCache::GetInstance().Get(moduleBase);
+        const std::filesystem::path& modulePath = identity->path;
 
         VERBOSE(L"Module: %p%s", moduleBase, !hModule ? L" (main)" : L"");
         VERBOSE(L"Path: %s", modulePath.c_str());
         VERBOSE(L"Version: %S",
                 Functions::GetModuleVersion(moduleBase).c_str());
 
-        std::wstring moduleName = modulePath.filename();
-        LCMapStringEx(LOCALE_NAME_USER_DEFAULT, LCMAP_LOWERCASE, &moduleName[0],
-                      wil::safe_cast<int>(moduleName.length()), &moduleName[0],
-                      wil::safe_cast<int>(moduleName.length()), nullptr,
-                      nullptr, 0);
+        const std::wstring& moduleName = identity->fileName;
 
         SetTask((L"Loading symbols... (" + moduleName + L")").c_str());
 
@@ -1658,36 +3090,25 @@ HANDLE LoadedMod::FindFirstSymbol4(HMODULE hModule,
 
         SymbolEnum::Callbacks callbacks;
 
-        bool canceled = false;
-        DWORD lastQueryCancelTick = GetTickCount();
-
-        callbacks.queryCancel = [this, &canceled, &lastQueryCancelTick]() {
-            if (canceled) {
-                return true;
-            }
+        callbacks.queryCancel = [this]() {
+            return ShouldCancelLongOperations();
+        };
 
-            DWORD tick = GetTickCount();
-            if (tick - lastQueryCancelTick < 1000) {
-                return false;
+        // Each update rewrites the mod task metadata file, so skip repeated
+        // values, which symsrv reports often.
+        callbacks.notifyProgress = [this, &moduleName, trace,
+                                    lastProgress = -1](int progress) mutable {
+            if (progress == lastProgress) {
+                return;
             }
 
-            lastQueryCancelTick = tick;
+            lastProgress = progress;
 
             try {
-                if (!Mod::ShouldLoadInRunningProcess(m_modName.c_str()) ||
-                    CustomizationSession::IsEndingSoon()) {
-                    canceled = true;
-                    return true;
+                if (trace) {
+                    trace->AddEvent("progress", std::to_wstring(progress));
                 }
-            } catch (const std::exception& e) {
-                LOG(L"%S", e.what());
-            }
-
-            return false;
-        };
 
-        callbacks.notifyProgress = [this, &moduleName](int progress) {
-            try {
                 std::wstring status = L"Loading symbols... " +
                                       std::to_wstring(progress) + L"% (" +
                                       moduleName + L")";
@@ -1697,6 +3118,16 @@ HANDLE LoadedMod::FindFirstSymbol4(HMODULE hModule,
             }
         };
 
+        if (trace) {
+            callbacks.notifyEvent = [trace](std::string_view event) {
+                try {
+                    trace->AddEvent("symbolServer", event);
+                } catch (const std::exception& e) {
+                    LOG(L"%S", e.what());
+                }
+            };
+        }
+
         SymbolEnum::UndecorateMode undecorateMode =
             SymbolEnum::UndecorateMode::Default;
         if (options && options->noUndecoratedSymbols) {
@@ -1713,23 +3144,10 @@ HANDLE LoadedMod::FindFirstSymbol4(HMODULE hModule,
         } else {
             std::optional<CrossModMutex> symbolLoadLock;
 
-            GUID pdbGuid;
-            DWORD pdbAge;
-            if (Functions::ModuleGetPDBInfo(moduleBase, &pdbGuid, &pdbAge)) {
-                constexpr size_t kMaxPdbIdentifierLength =
-                    sizeof("AAAAAAAABBBBCCCCDDDDEEEEEEEEEEEE12345678") - 1;
-                WCHAR mutexIdentifier[sizeof("SymbolLoadLockMutex-") - 1 +
-                                      kMaxPdbIdentifierLength + 1];
-                swprintf_s(
-                    mutexIdentifier,
-                    L"SymbolLoadLockMutex-%08X%04X%04X%02X%02X%02X%02X%02X%"
-                    L"02X%02X%02X%x",
-                    pdbGuid.Data1, pdbGuid.Data2, pdbGuid.Data3,
-                    pdbGuid.Data4[0], pdbGuid.Data4[1], pdbGuid.Data4[2],
-                    pdbGuid.Data4[3], pdbGuid.Data4[4], pdbGuid.Data4[5],
-                    pdbGuid.Data4[6], pdbGuid.Data4[7], pdbAge);
-
-                symbolLoadLock.emplace(mutexIdentifier);
+            if (!identity->pdbIdentifier.empty()) {
+                symbolLoadLock.emplace(
+                    (L"SymbolLoadLockMutex-" + identity->pdbIdentifier)
+                        .c_str());
                 if (!*symbolLoadLock) {
                     symbolLoadLock.reset();
                 }
@@ -1746,22 +3164,49 @@ HANDLE LoadedMod::FindFirstSymbol4(HMODULE hModule,
                         modulePath.c_str(), hModule, L"", undecorateMode);
                 } catch (const std::exception& e) {
                     VERBOSE(L"Failed to load local symbol file: %S", e.what());
+                    if (trace) {
+                        trace->AddEvent("symbolLoadLockWait",
+                                        L"no local symbol file");
+                    }
 
                     SetTask((L"Waiting for symbols... (" + moduleName + L")")
                                 .c_str());
 
-                    symbolLoadLock->Acquire();
+                    auto waitResult =
+                        symbolLoadLock->AcquireOrWaitForCompletion();
+                    if (trace) {
+                        using WaitResult = CrossModMutex::WaitResult;
+                        trace->AddEvent("symbolLoadLockWaitResult",
+                                        waitResult == WaitResult::kCompleted
+                                            ? L"completed"
+                                        : waitResult == WaitResult::kAcquired
+                                            ? L"acquired"
+                                            : L"failed");
+                    }
 
                     // In case the mod was disabled, abort without starting the
                     // symbol server flow.
-                    if (!Mod::ShouldLoadInRunningProcess(m_modName.c_str()) ||
-                        CustomizationSession::IsEndingSoon()) {
+                    if (ShouldCancelLongOperations()) {
                         VERBOSE(L"Aborting symbol loading");
                         return nullptr;
                     }
 
                     SetTask(
                         (L"Loading symbols... (" + moduleName + L")").c_str());
+
+                    // Another process got the symbol file, so it can be loaded
+                    // concurrently with the other waiting processes.
+                    if (waitResult == CrossModMutex::WaitResult::kCompleted) {
+                        try {
+                            symbolEnum = std::make_unique<SymbolEnum>(
+                                modulePath.c_str(), hModule, L"",
+                                undecorateMode);
+                        } catch (const std::exception& retryException) {
+                            VERBOSE(L"Failed to load local symbol file: %S",
+                                    retryException.what());
+                            symbolLoadLock->Acquire();
+                        }
+                    }
                 }
             }
 
@@ -1771,6 +3216,38 @@ HANDLE LoadedMod::FindFirstSymbol4(HMODULE hModule,
                     options ? options->symbolServer : nullptr, undecorateMode,
                     std::move(callbacks));
             }
+
+            // The symbol file is available locally now.
+            if (symbolLoadLock) {
+                symbolLoadLock->MarkCompleted();
+            }
+        }
+
+        if (publicSymbolsOnly) {
+            symbolEnum->SetPublicSymbolsOnly();
+        }
+
+        if (nameFilterType) {
+            symbolEnum->SetNameFilter(*nameFilterType, options->nameFilter);
+
+            // Let DIA look up only the symbols which might match, instead of
+            // enumerating and undecorating all of them.
+            if (nameIdentifiers.empty()) {
+                auto identifier = GetSymbolNameFilterIdentifier(
+                    options->nameFilter,
+                    *nameFilterType == SymbolEnum::NameFilterType::kWildcard,
+                    options->noUndecoratedSymbols);
+                if (!identifier.empty()) {
+                    VERBOSE(L"Looking up symbols by identifier: %.*s",
+                            wil::safe_cast<int>(identifier.length()),
+                            identifier.data());
+                    nameIdentifiers.emplace_back(identifier);
+                }
+            }
+        }
+
+        if (!nameIdentifiers.empty()) {
+            symbolEnum->SetNameIdentifiers(std::move(nameIdentifiers));
         }
 
         if (!FindNextSymbol2(symbolEnum.get(), findData)) {
@@ -1834,22 +3311,305 @@ void LoadedMod::FindCloseSymbol(HANDLE symSearch) {
     delete symbolEnum;
 }
 
+size_t LoadedMod::GetSymbolFromAddress(HMODULE module,
+                                       const void* address,
+                                       PWSTR nameBuffer,
+                                       size_t bufferChars,
+                                       size_t* offset) {
+    auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
+    VERBOSE(L"Module: %p, address: %p", module, address);
+
+    try {
+        if (!nameBuffer || bufferChars == 0) {
+            throw std::invalid_argument("The buffer must be set");
+        }
+
+        *nameBuffer = L'\0';
+
+        if (!module) {
+            THROW_IF_WIN32_BOOL_FALSE(GetModuleHandleEx(
+                GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+                    GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                static_cast<PCWSTR>(address), &module));
+        }
+
+        auto* dosHeader = reinterpret_cast<const IMAGE_DOS_HEADER*>(module);
+        auto* ntHeader = reinterpret_cast<const IMAGE_NT_HEADERS*>(
+            reinterpret_cast<const BYTE*>(module) + dosHeader->e_lfanew);
+
+        ULONG_PTR moduleBase = reinterpret_cast<ULONG_PTR>(module);
+        ULONG_PTR addressValue = reinterpret_cast<ULONG_PTR>(address);
+        if (addressValue < moduleBase ||
+            addressValue - moduleBase >= ntHeader->OptionalHeader.SizeOfImage) {
+            throw std::invalid_argument("The address isn't in the module");
+        }
+
+        DWORD rva = static_cast<DWORD>(addressValue - moduleBase);
+
+        auto identity = ModuleIdentityCache::GetInstance().Get(module);
+        const std::filesystem::path& modulePath = identity->path;
+        bool isHybridModule = identity->isHybrid;
+        const std::wstring& indexKey = identity->cacheKey;
+        if (!indexKey.starts_with(L"pdb_")) {
+            VERBOSE(L"The module has no PDB");
+            return 0;
+        }
+
+        // Opened for this lookup only, so that the file can be replaced, e.g.
+        // by an index with more tables.
+        auto symbolIndexPath = SymbolIndex::GetPath(indexKey);
+        auto symbolIndex = SymbolIndex::Open(symbolIndexPath);
+
+        // The broker doesn't index hybrid modules, they're indexed when a mod
+        // hooks their symbols.
+        if (!symbolIndex && !isHybridModule) {
+            auto queryCancel = [this]() {
+                return ShouldCancelLongOperations();
+            };
+
+            SetTask((L"Loading symbols... (" + modulePath.filename().wstring() +
+                     L")")
+                        .c_str());
+            auto taskReset = wil::scope_exit([this] { SetTask(nullptr); });
+
+            if (SymbolBroker::RequestSymbolIndex(modulePath.c_str(), indexKey,
+                                                 queryCancel) ==
+                SymbolBroker::RequestResult::kIndexed) {
+                symbolIndex = SymbolIndex::Open(symbolIndexPath);
+            }
+        }
+
+        if (!symbolIndex) {
+            VERBOSE(L"No symbol index for %s", modulePath.c_str());
+            return 0;
+        }
+
+        auto symbol = symbolIndex->FindByAddress(rva);
+        if (!symbol) {
+            VERBOSE(L"No symbol found");
+            return 0;
+        }
+
+        if (offset) {
+            *offset = rva - symbol->rva;
+        }
+
+        size_t length = std::min(symbol->name.length(), bufferChars - 1);
+        std::copy_n(symbol->name.data(), length, nameBuffer);
+        nameBuffer[length] = L'\0';
+        return length;
+    } catch (const std::exception& e) {
+        LogFunctionError(e);
+    }
+
+    return 0;
+}
+
 BOOL LoadedMod::HookSymbols(HMODULE module,
                             const WH_SYMBOL_HOOK* symbolHooks,
                             size_t symbolHooksCount,
                             const WH_HOOK_SYMBOLS_OPTIONS* options) {
     auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
 
+    return HookSymbolsInternal(module, symbolHooks, symbolHooksCount, options,
+                               nullptr);
+}
+
+BOOL LoadedMod::HookSymbolsBatch(const WH_HOOK_SYMBOLS_BATCH_ITEM* items,
+                                 size_t itemsCount,
+                                 const WH_HOOK_SYMBOLS_OPTIONS* options) {
+    auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
+
+    if (itemsCount == 0) {
+        return TRUE;
+    }
+
+    if (!items) {
+        LOG(L"items is null");
+        return FALSE;
+    }
+
+    // Each module is resolved independently (local cache, online cache,
+    // symbol enumeration), which is mostly waiting for downloads, so resolve
+    // the modules concurrently. The per-mod state which is used along the way
+    // is either read-only while the mod is initialized, or synchronized: the
+    // task status, the load times, the online cache manifest, the in-memory
+    // symbol cache and the storage. Items of the same module share a symbol
+    // cache entry and a symbol load lock, so they're resolved one after the
+    // other by the same thread. The hooks are only collected, and are set
+    // afterwards on this thread.
+    constexpr size_t kMaxWorkerThreads = 4;
+
+    std::vector<std::vector<size_t>> moduleGroups;
+    {
+        std::unordered_map<HMODULE, size_t> groupIndexByModule;
+        for (size_t i = 0; i < itemsCount; i++) {
+            auto [it, inserted] = groupIndexByModule.try_emplace(
+                items[i].module, moduleGroups.size());
+            if (inserted) {
+                moduleGroups.emplace_back();
+            }
+
+            moduleGroups[it->second].push_back(i);
+        }
+    }
+
+    struct BatchState {
+        LoadedMod* loadedMod;
+        const WH_HOOK_SYMBOLS_BATCH_ITEM* items;
+        const std::vector<std::vector<size_t>>& moduleGroups;
+        const WH_HOOK_SYMBOLS_OPTIONS* options;
+        std::atomic<size_t> nextGroup = 0;
+        std::vector<BOOL> results;
+        std::vector<std::vector<PendingHook>> deferredHooks;
+
+        void Run() {
+            size_t groupIndex;
+            while ((groupIndex = nextGroup++) < moduleGroups.size()) {
+                for (size_t i : moduleGroups[groupIndex]) {
+                    const auto& item = items[i];
+                    results[i] = loadedMod->HookSymbolsInternal(
+                        item.module, item.symbolHooks, item.symbolHooksCount,
+                        options, &deferredHooks[i]);
+                }
+            }
+        }
+    } batchState{
+        .loadedMod = this,
+        .items = items,
+        .moduleGroups = moduleGroups,
+        .options = options,
+        .results = std::vector<BOOL>(itemsCount, FALSE),
+        .deferredHooks = std::vector<std::vector<PendingHook>>(itemsCount),
+    };
+
+    std::vector<wil::unique_handle> workerThreads;
+
+    // New threads can't run before the APC returns, and waiting for them would
+    // result in a deadlock. Resolve the items one by one in this case.
+    if (!CustomizationSession::IsInitializingFromAPC()) {
+        size_t workerThreadsCount =
+            std::min(moduleGroups.size(), kMaxWorkerThreads) - 1;
+        for (size_t i = 0; i < workerThreadsCount; i++) {
+            wil::unique_handle thread(CreateThread(
+                nullptr, 0,
+                [](LPVOID pParameter) -> DWORD {
+                    auto* batchState = static_cast<BatchState*>(pParameter);
+                    auto* loadedMod = batchState->loadedMod;
+
+                    // Make the worker thread follow the debug logging state of
+                    // the calling thread.
+                    ModDebugLoggingScopeHelper modDebugLoggingScope(
+                        loadedMod->m_debugLoggingEnabled, nullptr);
+
+                    batchState->Run();
+                    return 0;
+                },
+                &batchState, 0, nullptr));
+            if (!thread) {
+                LOG(L"Thread creation failed: %u", GetLastError());
+                break;
+            }
+
+            Functions::SetThreadDescriptionIfAvailable(
+                thread.get(), L"WindhawkHookSymbolsWorker");
+            workerThreads.push_back(std::move(thread));
+        }
+    }
+
+    batchState.Run();
+
+    for (const auto& thread : workerThreads) {
+        WaitForSingleObject(thread.get(), INFINITE);
+    }
+
+    // Like a single HookSymbols call, the batch is all or nothing: if any item
+    // fails, none of the hooks are set. The symbols which were resolved are
+    // still cached.
+    BOOL succeeded = TRUE;
+
+    for (size_t i = 0; i < itemsCount; i++) {
+        if (!batchState.results[i]) {
+            LOG(L"Failed to hook symbols of module %p (batch item %zu)",
+                items[i].module, i);
+            succeeded = FALSE;
+        }
+    }
+
+    if (!succeeded) {
+        return FALSE;
+    }
+
+    for (const auto& itemHooks : batchState.deferredHooks) {
+        for (const auto& hook : itemHooks) {
+            SetFunctionHook(hook.targetFunction, hook.hookFunction,
+                            hook.originalFunction);
+        }
+    }
+
+    return TRUE;
+}
+
+BOOL LoadedMod::HookSymbolsInternal(HMODULE module,
+                                    const WH_SYMBOL_HOOK* symbolHooks,
+                                    size_t symbolHooksCount,
+                                    const WH_HOOK_SYMBOLS_OPTIONS* options,
+                                    std::vector<PendingHook>* deferredHooks) {
+    std::optional<SymbolResolutionTrace> trace;
+    if (SymbolResolutionTrace::IsEnabled()) {
+        try {
+            trace.emplace(m_modName.c_str(), module);
+        } catch (const std::exception& e) {
+            LOG(L"Starting the symbol resolution trace failed: %S", e.what());
+        }
+    }
+
+    BOOL result =
+        HookSymbolsWithTrace(module, symbolHooks, symbolHooksCount, options,
+                             deferredHooks, trace ? &*trace : nullptr);
+
+    if (trace) {
+        trace->Write(result);
+    }
+
+    return result;
+}
+
+BOOL LoadedMod::HookSymbolsWithTrace(HMODULE module,
+                                     const WH_SYMBOL_HOOK* symbolHooks,
+                                     size_t symbolHooksCount,
+                                     const WH_HOOK_SYMBOLS_OPTIONS* options,
+                                     std::vector<PendingHook>* deferredHooks,
+                                     SymbolResolutionTrace* trace) {
+    TraceEvents::ScopedPhase phase("HookSymbols", m_modName.c_str());
+    ModLoadTimes::ScopedTimer loadTimer(m_loadTimes,
+                                        ModLoadTimes::Phase::kSymbols);
+    EngineMetrics::ScopedTimer metricsTimer(
+        EngineMetrics::Timer::kSymbolResolution);
+
+    if (ShouldDeferInit(/*slowOperationAhead=*/false)) {
+        return FALSE;
+    }
+
     struct WH_HOOK_SYMBOLS_OPTIONS_CURRENT {
         size_t optionsSize;
         PCWSTR symbolServer;
         BOOL noUndecoratedSymbols;
         PCWSTR onlineCacheUrl;
+        BOOL publicSymbolsOnly;
+        BOOL stopAtRequiredSymbols;
     };
     static_assert(sizeof(WH_HOOK_SYMBOLS_OPTIONS) ==
                       sizeof(WH_HOOK_SYMBOLS_OPTIONS_CURRENT),
                   "Struct was updated, update this code too");
 
+    struct WH_HOOK_SYMBOLS_OPTIONS_V2 {
+        size_t optionsSize;
+        PCWSTR symbolServer;
+        BOOL noUndecoratedSymbols;
+        PCWSTR onlineCacheUrl;
+    };
+
     struct WH_HOOK_SYMBOLS_OPTIONS_V1 {
         size_t optionsSize;
         PCWSTR symbolServer;
@@ -1863,6 +3623,18 @@ BOOL LoadedMod::HookSymbols(HMODULE module,
             optionsResolved = *options;
             break;
 
+        case sizeof(WH_HOOK_SYMBOLS_OPTIONS_V2): {
+            const WH_HOOK_SYMBOLS_OPTIONS_V2* optionsV2 =
+                reinterpret_cast<const WH_HOOK_SYMBOLS_OPTIONS_V2*>(options);
+            optionsResolved = {
+                .optionsSize = sizeof(optionsResolved),
+                .symbolServer = optionsV2->symbolServer,
+                .noUndecoratedSymbols = optionsV2->noUndecoratedSymbols,
+                .onlineCacheUrl = optionsV2->onlineCacheUrl,
+            };
+            break;
+        }
+
         case sizeof(WH_HOOK_SYMBOLS_OPTIONS_V1): {
             const WH_HOOK_SYMBOLS_OPTIONS_V1* optionsV1 =
                 reinterpret_cast<const WH_HOOK_SYMBOLS_OPTIONS_V1*>(options);
@@ -1902,10 +3674,51 @@ BOOL LoadedMod::HookSymbols(HMODULE module,
 
     std::optional<CrossModMutex> symbolLoadLock;
 
+    SymbolResolutionTimer timer(trace);
+    auto timerLogOnExit = wil::scope_exit([&timer]() { timer.Log(); });
+
+    auto traceEvent = [trace](PCSTR event, std::wstring_view detail = {}) {
+        if (trace) {
+            trace->AddEvent(event, detail);
+        }
+    };
+
     try {
         auto hookSymbolsSession =
             HookSymbolsSession(this, module, symbolHooks, symbolHooksCount);
 
+        if (trace) {
+            trace->SetOptions(optionsResolved, m_compatDemangling);
+            trace->SetCacheKey(hookSymbolsSession.GetCacheStrKey());
+            for (size_t i = 0; i < symbolHooksCount; i++) {
+                trace->AddHook(symbolHooks[i]);
+            }
+        }
+
+        auto traceCacheResult =
+            [&traceEvent, &hookSymbolsSession](
+                HookSymbolsSession::ResolveSymbolsFromCacheResult result) {
+                using Result =
+                    HookSymbolsSession::ResolveSymbolsFromCacheResult;
+                switch (result) {
+                    case Result::kSuccess:
+                        traceEvent("localCacheResult",
+                                   hookSymbolsSession.AreAllSymbolsResolved()
+                                       ? L"resolved"
+                                       : L"incomplete");
+                        break;
+                    case Result::kError:
+                        traceEvent("localCacheResult", L"error");
+                        break;
+                    case Result::kNoCache:
+                        traceEvent("localCacheResult", L"none");
+                        break;
+                    case Result::kCachedErrorForThrottle:
+                        traceEvent("localCacheResult", L"cachedError");
+                        break;
+                }
+            };
+
 #if !defined(_M_ARM64)
         if (hookSymbolsSession.IsTargetModuleHybrid()) {
             auto settings = StorageManager::GetInstance().GetModWritableConfig(
@@ -1948,6 +3761,9 @@ BOOL LoadedMod::HookSymbols(HMODULE module,
         // If the mod is loaded later, allow cached errors for throttling for a
         // shorter time, so that the mod can try to load symbols again after
         // disabling and re-enabling the mod.
+        //
+        // For symbol load failures, which are shared by all mods, this is the
+        // maximum throttle time, reached after repeated failures.
         std::optional<ULONGLONG> cachedErrorForThrottleMaxTime =
             (m_loggingEnabled || m_debugLoggingEnabled)
                 ? std::nullopt
@@ -1955,11 +3771,16 @@ BOOL LoadedMod::HookSymbols(HMODULE module,
                                          ? 4 * wil::filetime_duration::one_hour
                                          : wil::filetime_duration::one_minute);
 
-        switch (hookSymbolsSession.ResolveSymbolsFromCache(
-            cachedErrorForThrottleMaxTime)) {
+        timer.Start(SymbolResolutionTimer::Phase::kLocalCache);
+
+        auto cacheResult = hookSymbolsSession.ResolveSymbolsFromCache(
+            cachedErrorForThrottleMaxTime);
+        traceCacheResult(cacheResult);
+
+        switch (cacheResult) {
             case HookSymbolsSession::ResolveSymbolsFromCacheResult::kSuccess:
                 if (hookSymbolsSession.AreAllSymbolsResolved()) {
-                    hookSymbolsSession.ApplyPendingHooks();
+                    hookSymbolsSession.ApplyPendingHooks(deferredHooks);
                     return TRUE;
                 }
                 break;
@@ -1972,6 +3793,24 @@ BOOL LoadedMod::HookSymbols(HMODULE module,
 
         VERBOSE(L"Couldn't resolve all symbols from local cache");
 
+        // Exported names need neither the network nor the PDB.
+        hookSymbolsSession.ResolveSymbolsFromExports(
+            optionsResolved.noUndecoratedSymbols);
+        if (hookSymbolsSession.AreAllSymbolsResolved()) {
+            traceEvent("exportsResult", L"resolved");
+            VERBOSE(L"Resolved the remaining symbols from the exports");
+            hookSymbolsSession.ApplyPendingHooks(deferredHooks);
+            hookSymbolsSession.UpdateSymbolsCache();
+            return TRUE;
+        }
+
+        traceEvent("exportsResult", L"incomplete");
+
+        if (ShouldDeferInit(/*slowOperationAhead=*/true)) {
+            traceEvent("initDeferred");
+            return FALSE;
+        }
+
         SetTask((L"Waiting for symbols... (" +
                  hookSymbolsSession.GetTargetModuleFileName() + L")")
                     .c_str());
@@ -1989,23 +3828,52 @@ BOOL LoadedMod::HookSymbols(HMODULE module,
         // hopefully the first mod to acquire it will get and store the online
         // cache. Then, the other processes will be able to use it without
         // having to go online too.
+        //
+        // Once the first process stores the symbols in the cache, all of the
+        // waiting processes are released at once to use it.
+        timer.Start(SymbolResolutionTimer::Phase::kLockWait);
+
         symbolLoadLock.emplace(mutexIdentieir.c_str());
-        if (!*symbolLoadLock || !symbolLoadLock->Acquire()) {
+        auto symbolLoadLockWaitResult = CrossModMutex::WaitResult::kFailed;
+        if (*symbolLoadLock) {
+            symbolLoadLockWaitResult =
+                symbolLoadLock->AcquireOrWaitForCompletion();
+        }
+
+        if (symbolLoadLockWaitResult == CrossModMutex::WaitResult::kFailed) {
             symbolLoadLock.reset();
         }
 
+        switch (symbolLoadLockWaitResult) {
+            case CrossModMutex::WaitResult::kAcquired:
+                traceEvent("lockWaitResult", L"acquired");
+                break;
+            case CrossModMutex::WaitResult::kCompleted:
+                traceEvent("lockWaitResult", L"completed");
+                break;
+            case CrossModMutex::WaitResult::kFailed:
+                traceEvent("lockWaitResult", L"failed");
+                break;
+        }
+
         SetTask((L"Loading symbols... (" +
                  hookSymbolsSession.GetTargetModuleFileName() + L")")
                     .c_str());
 
         if (symbolLoadLock) {
-            // Retry resolving symbols from cache after acquiring the lock.
-            switch (hookSymbolsSession.ResolveSymbolsFromCache(
-                cachedErrorForThrottleMaxTime)) {
+            timer.Start(SymbolResolutionTimer::Phase::kLocalCache);
+
+            // Retry resolving symbols from cache after acquiring the lock, or
+            // after another process updated the cache.
+            cacheResult = hookSymbolsSession.ResolveSymbolsFromCache(
+                cachedErrorForThrottleMaxTime);
+            traceCacheResult(cacheResult);
+
+            switch (cacheResult) {
                 case HookSymbolsSession::ResolveSymbolsFromCacheResult::
                     kSuccess:
                     if (hookSymbolsSession.AreAllSymbolsResolved()) {
-                        hookSymbolsSession.ApplyPendingHooks();
+                        hookSymbolsSession.ApplyPendingHooks(deferredHooks);
                         return TRUE;
                     }
                     break;
@@ -2015,7 +3883,18 @@ BOOL LoadedMod::HookSymbols(HMODULE module,
                     VERBOSE(L"Returning FALSE due to a previous failure");
                     return FALSE;
             }
-        } else {
+
+            // The cache still doesn't have all symbols, e.g. if the other
+            // process hooks different ones, so take the lock after all.
+            timer.Start(SymbolResolutionTimer::Phase::kLockWait);
+            if (symbolLoadLockWaitResult ==
+                    CrossModMutex::WaitResult::kCompleted &&
+                !symbolLoadLock->Acquire()) {
+                symbolLoadLock.reset();
+            }
+        }
+
+        if (!symbolLoadLock) {
             LOG(L"Couldn't acquire the symbol load lock");
         }
 
@@ -2025,17 +3904,22 @@ BOOL LoadedMod::HookSymbols(HMODULE module,
             });
 
         auto applyHooksAndUpdateCache =
-            [&hookSymbolsSession,
-             &scopeUpdateSymbolsCacheWithErrorForThrottle]() {
-                hookSymbolsSession.ApplyPendingHooks();
-                hookSymbolsSession.UpdateSymbolsCache();
+            [&hookSymbolsSession, &scopeUpdateSymbolsCacheWithErrorForThrottle,
+             &symbolLoadLock, deferredHooks]() {
+                hookSymbolsSession.ApplyPendingHooks(deferredHooks);
+                if (hookSymbolsSession.UpdateSymbolsCache() && symbolLoadLock) {
+                    symbolLoadLock->MarkCompleted();
+                }
                 scopeUpdateSymbolsCacheWithErrorForThrottle.release();
             };
 
+        timer.Start(SymbolResolutionTimer::Phase::kOnlineCache);
+
         auto onlineCache =
             HookSymbolsGetOnlineCache(optionsResolved.onlineCacheUrl,
                                       hookSymbolsSession.GetCacheStrKey())
                 .value_or(L"");
+        traceEvent("onlineCacheResult", onlineCache);
         if (!onlineCache.empty()) {
             const auto& cacheStrKey = hookSymbolsSession.GetCacheStrKey();
             VERBOSE(
@@ -2052,18 +3936,139 @@ BOOL LoadedMod::HookSymbols(HMODULE module,
 
         VERBOSE(L"Couldn't resolve all symbols from online cache");
 
+        // The symbol index is shared by all mods and keyed by the PDB
+        // identity. Undecorated names depend on the undecoration mode, so only
+        // the decorated names can be used with the compatibility mode.
+        auto symbolIndexTable = optionsResolved.noUndecoratedSymbols
+                                    ? SymbolIndex::Table::kDecorated
+                                    : SymbolIndex::Table::kUndecorated;
+        bool symbolIndexWithUndecorated =
+            !optionsResolved.noUndecoratedSymbols && !m_compatDemangling;
+        std::optional<SymbolIndex::Builder> symbolIndexBuilder;
+        std::filesystem::path symbolIndexPath;
+
+        bool publicSymbolsOnly =
+            optionsResolved.publicSymbolsOnly ||
+            (optionsResolved.noUndecoratedSymbols &&
+             hookSymbolsSession.AreAllRequestedNamesDecorated());
+        if (publicSymbolsOnly) {
+            VERBOSE(L"Enumerating public symbols only");
+        }
+
+        if (hookSymbolsSession.GetCacheStrKey().starts_with(L"pdb_") &&
+            (symbolIndexTable == SymbolIndex::Table::kDecorated ||
+             symbolIndexWithUndecorated)) {
+            timer.Start(SymbolResolutionTimer::Phase::kSymbolIndex);
+
+            try {
+                symbolIndexPath =
+                    SymbolIndex::GetPath(hookSymbolsSession.GetCacheStrKey());
+                auto symbolIndex = SymbolIndex::Open(symbolIndexPath);
+
+                // Ask the broker in the service to index the symbols, so that
+                // msdia and the PDB don't have to be loaded in this process.
+                // The broker uses the default symbol server, and doesn't index
+                // hybrid modules.
+                bool brokerAvailable =
+                    !optionsResolved.symbolServer &&
+                    !hookSymbolsSession.IsTargetModuleHybrid();
+                if (!symbolIndex && brokerAvailable) {
+                    std::wstring modulePath =
+                        wil::GetModuleFileName<std::wstring>(module);
+
+                    auto queryCancel = [this]() {
+                        return ShouldCancelLongOperations();
+                    };
+
+                    using RequestResult = SymbolBroker::RequestResult;
+                    auto brokerResult = SymbolBroker::RequestSymbolIndex(
+                        modulePath.c_str(),
+                        hookSymbolsSession.GetCacheStrKey(), queryCancel);
+                    switch (brokerResult) {
+                        case RequestResult::kIndexed:
+                            traceEvent("symbolBrokerResult", L"indexed");
+                            symbolIndex = SymbolIndex::Open(symbolIndexPath);
+                            break;
+
+                        case RequestResult::kNotIndexed:
+                            traceEvent("symbolBrokerResult", L"failed");
+                            break;
+
+                        case RequestResult::kUnavailable:
+                            traceEvent("symbolBrokerResult", L"unavailable");
+                            brokerAvailable = false;
+                            break;
+                    }
+                }
+
+                if (symbolIndex && symbolIndex->HasTable(symbolIndexTable)) {
+                    VERBOSE(L"Using symbol index %s", symbolIndexPath.c_str());
+                    traceEvent("symbolIndexResult", symbolIndexPath.native());
+
+                    hookSymbolsSession.ResolveSymbolsFromIndex(
+                        *symbolIndex, symbolIndexTable);
+
+                    // The index was built from a full enumeration, so symbols
+                    // which aren't in it don't exist.
+                    if (!hookSymbolsSession.AreAllSymbolsResolved()) {
+                        hookSymbolsSession.MarkUnresolvedSymbolsAsMissing();
+                        if (!hookSymbolsSession.AreAllSymbolsResolved()) {
+                            return FALSE;
+                        }
+                    }
+
+                    applyHooksAndUpdateCache();
+                    return TRUE;
+                }
+
+                // Building the index requires a full enumeration, which is
+                // what the fast paths and the early exit of the enumeration
+                // avoid. While the broker is available, indexes are only built
+                // by it, in the background service. An existing index which
+                // lacks the table is still rebuilt here, since the broker
+                // doesn't replace it.
+                if (!publicSymbolsOnly &&
+                    !optionsResolved.stopAtRequiredSymbols &&
+                    (!brokerAvailable || symbolIndex)) {
+                    symbolIndexBuilder.emplace(symbolIndexWithUndecorated);
+                }
+            } catch (const std::exception& e) {
+                LOG(L"Symbol index error: %S", e.what());
+            }
+        }
+
         WH_FIND_SYMBOL findSymbol;
         WH_FIND_SYMBOL_OPTIONS findFirstSymbolOptions = {
             .optionsSize = sizeof(findFirstSymbolOptions),
             .symbolServer = optionsResolved.symbolServer,
             .noUndecoratedSymbols = optionsResolved.noUndecoratedSymbols,
         };
-        HANDLE findSymbolHandle =
-            FindFirstSymbol4(module, &findFirstSymbolOptions, &findSymbol);
-        if (!findSymbolHandle) {
+        // Unless all symbols are needed for the symbol index, let DIA look up
+        // only the symbols which might match one of the requested names,
+        // instead of enumerating and undecorating all of them.
+        std::vector<std::wstring> nameIdentifiers;
+        if (!optionsResolved.noUndecoratedSymbols && !symbolIndexBuilder) {
+            nameIdentifiers = hookSymbolsSession.GetSymbolNameIdentifiers();
+        }
+
+        // Failures to load the symbols are shared by all mods, so that e.g. an
+        // unreachable symbol server isn't retried by each mod separately.
+        const auto& cacheStrKey = hookSymbolsSession.GetCacheStrKey();
+        bool useSymbolLoadThrottle =
+            cacheStrKey.starts_with(L"pdb_") && cachedErrorForThrottleMaxTime;
+        if (useSymbolLoadThrottle &&
+            SymbolLoadThrottle::IsThrottled(cacheStrKey,
+                                            *cachedErrorForThrottleMaxTime)) {
+            VERBOSE(L"Returning FALSE due to a previous symbol load failure");
+            traceEvent("symbolLoadThrottled");
             return FALSE;
         }
 
+        // Loading and enumerating the symbols is done on an engine thread in
+        // background mode, while this thread, which might hold the symbol load
+        // lock that other processes wait for, keeps its priority.
+        HANDLE findSymbolHandle = nullptr;
+
         // Prefer closing the handle on function exit, not earlier. Closing the
         // handle unloads the MSDIA library, and that was observed to cause
         // hangs if Application Verifier is used. Example:
@@ -2071,22 +4076,132 @@ BOOL LoadedMod::HookSymbols(HMODULE module,
         // By closing the handle on function exit, at least the symbol offsets
         // will be written to cache, so symbols will just be loaded from cache
         // on the next try.
-        auto findSymbolHandleScopeClose = wil::scope_exit(
-            [this, findSymbolHandle]() { FindCloseSymbol(findSymbolHandle); });
-
-        do {
-            PCWSTR symbol = optionsResolved.noUndecoratedSymbols
-                                ? findSymbol.symbolDecorated
-                                : findSymbol.symbol;
-            if (!symbol || !hookSymbolsSession.OnSymbolResolved(
-                               symbol, findSymbol.address)) {
-                continue;
+        auto findSymbolHandleScopeClose =
+            wil::scope_exit([this, &findSymbolHandle]() {
+                if (findSymbolHandle) {
+                    FindCloseSymbol(findSymbolHandle);
+                }
+            });
+
+        RunInBackgroundModeThread([&]() {
+            auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE_QUIET();
+
+            timer.Start(SymbolResolutionTimer::Phase::kSymbolLoad);
+
+            findSymbolHandle = FindFirstSymbolInternal(
+                module, &findFirstSymbolOptions, &findSymbol,
+                std::move(nameIdentifiers), publicSymbolsOnly, trace);
+            if (!findSymbolHandle) {
+                return;
             }
 
-            if (hookSymbolsSession.AreAllSymbolsResolved()) {
-                break;
+            auto* symbolEnum = static_cast<SymbolEnum*>(findSymbolHandle);
+
+            // Enumeration statistics for the debug log.
+            size_t symbolsVisited = 0;
+            size_t symbolsMatched = 0;
+            bool stoppedEarly = false;
+            ULONGLONG enumStartTime = GetTickCount64();
+            timer.Start(SymbolResolutionTimer::Phase::kEnumeration);
+
+            // Returns whether the enumeration should continue, which is until
+            // there are no outstanding hooks, required or optional.
+            auto onSymbol = [&](PCWSTR symbolDecorated,
+                                PCWSTR symbolUndecorated, void* address) {
+                symbolsVisited++;
+
+                // When building the symbol index, all symbols are enumerated,
+                // even after all hooks are resolved.
+                if (symbolIndexBuilder) {
+                    symbolIndexBuilder->Add(
+                        symbolDecorated && *symbolDecorated ? symbolDecorated
+                                                            : nullptr,
+                        symbolUndecorated && *symbolUndecorated
+                            ? symbolUndecorated
+                            : nullptr,
+                        static_cast<DWORD>(
+                            reinterpret_cast<ULONG_PTR>(address) -
+                            reinterpret_cast<ULONG_PTR>(module)));
+                }
+
+                PCWSTR symbol = optionsResolved.noUndecoratedSymbols
+                                    ? symbolDecorated
+                                    : symbolUndecorated;
+                if (!symbol ||
+                    !hookSymbolsSession.OnSymbolResolved(symbol, address)) {
+                    return true;
+                }
+
+                symbolsMatched++;
+
+                if (symbolIndexBuilder) {
+                    return true;
+                }
+
+                if (optionsResolved.stopAtRequiredSymbols
+                        ? hookSymbolsSession.AreAllRequiredSymbolsResolved()
+                        : hookSymbolsSession.AreAllSymbolsResolved()) {
+                    stoppedEarly = true;
+                    return false;
+                }
+
+                return true;
+            };
+
+            if (onSymbol(findSymbol.symbolDecorated, findSymbol.symbol,
+                         findSymbol.address)) {
+                try {
+                    symbolEnum->EnumRemainingSymbols(
+                        [&onSymbol](const SymbolEnum::Symbol& symbol) {
+                            return onSymbol(symbol.name, symbol.nameUndecorated,
+                                            symbol.address);
+                        });
+                } catch (const std::exception& e) {
+                    LogFunctionError(e);
+                }
+            }
+
+            VERBOSE(L"Enumerated %zu symbols, %zu matched, in %I64u ms%s",
+                    symbolsVisited, symbolsMatched,
+                    GetTickCount64() - enumStartTime,
+                    stoppedEarly ? L" (stopped early, all hooks resolved)"
+                                 : L"");
+
+            if (trace) {
+                WCHAR detail[128];
+                swprintf_s(detail, L"visited %zu, matched %zu%s",
+                           symbolsVisited, symbolsMatched,
+                           stoppedEarly ? L", stopped early" : L"");
+                traceEvent("enumerationResult", detail);
             }
-        } while (FindNextSymbol2(findSymbolHandle, &findSymbol));
+
+            timer.Stop();
+
+            if (symbolIndexBuilder) {
+                if (symbolEnum->IsEnumerationComplete()) {
+                    try {
+                        symbolIndexBuilder->Write(symbolIndexPath);
+                    } catch (const std::exception& e) {
+                        LOG(L"Symbol index error: %S", e.what());
+                    }
+                }
+
+                symbolIndexBuilder.reset();
+            }
+        });
+
+        if (!findSymbolHandle) {
+            traceEvent("symbolLoadResult", L"failed");
+            if (useSymbolLoadThrottle && !ShouldCancelLongOperations()) {
+                SymbolLoadThrottle::OnFailure(cacheStrKey);
+            }
+
+            return FALSE;
+        }
+
+        if (useSymbolLoadThrottle) {
+            SymbolLoadThrottle::OnSuccess(cacheStrKey);
+        }
 
         if (!hookSymbolsSession.AreAllSymbolsResolved()) {
             hookSymbolsSession.MarkUnresolvedSymbolsAsMissing();
@@ -2105,151 +4220,240 @@ BOOL LoadedMod::HookSymbols(HMODULE module,
 }
 
 BOOL LoadedMod::Disasm(void* address, WH_DISASM_RESULT* result) {
-#if defined(_M_ARM64)
-    int rc = aarch64_decompose_and_disassemble(
-        reinterpret_cast<ULONG_PTR>(address),
-        *reinterpret_cast<DWORD*>(address), result->text, sizeof(result->text));
-    if (rc) {
-        LOG(L"Mod %s error: aarch64_decompose_and_disassemble returned %d",
-            m_modName.c_str(), rc);
-        return FALSE;
-    }
+    try {
+        UINT32 error = Disassembler::GetForCurrentThread().Disassemble(
+            address, Disassembler::kMaxInstructionLength, result,
+            /*formatText=*/true);
+        if (error) {
+            LOG(L"Mod %s error: Disassembling %p failed with %u",
+                m_modName.c_str(), address, error);
+            return FALSE;
+        }
 
-    result->length = sizeof(DWORD);
+        return TRUE;
+    } catch (const std::exception& e) {
+        LogFunctionError(e);
+    }
 
-    return TRUE;
-#else
-#if defined(_M_IX86)
-    auto machineMode = ZYDIS_MACHINE_MODE_LEGACY_32;
-#elif defined(_M_X64)
-    auto machineMode = ZYDIS_MACHINE_MODE_LONG_64;
-#else
-#error "Unsupported architecture"
-#endif
+    return FALSE;
+}
 
-    ZydisDisassembledInstruction instruction;
-    ZyanStatus status = ZydisDisassembleIntel(
-        /* machine_mode:    */ machineMode,
-        /* runtime_address: */ (ZyanU64)address,
-        /* buffer:          */ address,
-        /* length:          */ ZYDIS_MAX_INSTRUCTION_LENGTH,
-        /* instruction:     */ &instruction);
-    if (!ZYAN_SUCCESS(status)) {
-        LOG(L"Mod %s error: ZydisDisassembleIntel returned %u",
-            m_modName.c_str(), status);
-        return FALSE;
+size_t LoadedMod::DisasmRange(void* address,
+                              size_t size,
+                              WH_DISASM_RESULT* results,
+                              size_t resultsCount,
+                              DWORD flags) {
+    if (flags & ~WH_DISASM_RANGE_NO_TEXT) {
+        LOG(L"Mod %s error: Unsupported flags: 0x%X", m_modName.c_str(),
+            flags);
+        return 0;
     }
 
-    result->length = instruction.info.length;
-    strcpy_s(result->text, instruction.text);
+    try {
+        auto& disassembler = Disassembler::GetForCurrentThread();
+        bool formatText = !(flags & WH_DISASM_RANGE_NO_TEXT);
+
+        const BYTE* p = static_cast<const BYTE*>(address);
+        size_t remaining = size;
+        size_t count = 0;
+
+        while (count < resultsCount && remaining > 0) {
+            // Stops at an instruction which can't be decoded or which doesn't
+            // fit in the range, the caller can tell by the total length.
+            if (disassembler.Disassemble(p, remaining, &results[count],
+                                         formatText)) {
+                break;
+            }
 
-    return TRUE;
-#endif  // defined(_M_ARM64)
+            p += results[count].length;
+            remaining -= results[count].length;
+            count++;
+        }
+
+        return count;
+    } catch (const std::exception& e) {
+        LogFunctionError(e);
+    }
+
+    return 0;
 }
 
-const WH_URL_CONTENT* LoadedMod::GetUrlContent(
-    PCWSTR url,
-    const WH_GET_URL_CONTENT_OPTIONS* options) {
+void* LoadedMod::FindPattern(HMODULE module,
+                             const void* pattern,
+                             const void* mask,
+                             size_t patternSize,
+                             const WH_FIND_PATTERN_OPTIONS* options) {
     auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
-    VERBOSE(L"URL: %s", url);
-    VERBOSE(L"Target file path: %s", options && options->targetFilePath
-                                         ? options->targetFilePath
-                                         : L"(none)");
-
-    if (options && options->optionsSize != sizeof(WH_GET_URL_CONTENT_OPTIONS)) {
-        struct WH_GET_URL_CONTENT_OPTIONS_V1 {
-            size_t optionsSize;
-            PCWSTR targetFilePath;
-        };
-        static_assert(sizeof(WH_GET_URL_CONTENT_OPTIONS) ==
-                          sizeof(WH_GET_URL_CONTENT_OPTIONS_V1),
-                      "Struct was updated, update this code too");
+    VERBOSE(L"Module: %p, pattern size: %zu", module, patternSize);
 
+    if (options && options->optionsSize != sizeof(WH_FIND_PATTERN_OPTIONS)) {
         LOG(L"Unsupported options->optionsSize value: %zu",
             options->optionsSize);
         return nullptr;
     }
 
-    // Avoid having winhttp.dll in the import table, since it might not be
-    // available in all cases, e.g. sandboxed processes.
-    using WinHttpCloseHandle_t = decltype(&WinHttpCloseHandle);
-    using WinHttpOpen_t = decltype(&WinHttpOpen);
-    using WinHttpConnect_t = decltype(&WinHttpConnect);
-    using WinHttpQueryHeaders_t = decltype(&WinHttpQueryHeaders);
-    using WinHttpReceiveResponse_t = decltype(&WinHttpReceiveResponse);
-    using WinHttpSendRequest_t = decltype(&WinHttpSendRequest);
-    using WinHttpOpenRequest_t = decltype(&WinHttpOpenRequest);
-    using WinHttpQueryDataAvailable_t = decltype(&WinHttpQueryDataAvailable);
-    using WinHttpReadData_t = decltype(&WinHttpReadData);
-    using WinHttpCrackUrl_t = decltype(&WinHttpCrackUrl);
-
-    class WinHttpFunctions {
-       public:
-        wil::unique_hmodule module;
-
-        WinHttpCloseHandle_t CloseHandle;
-        WinHttpOpen_t Open;
-        WinHttpConnect_t Connect;
-        WinHttpQueryHeaders_t QueryHeaders;
-        WinHttpReceiveResponse_t ReceiveResponse;
-        WinHttpSendRequest_t SendRequest;
-        WinHttpOpenRequest_t OpenRequest;
-        WinHttpQueryDataAvailable_t QueryDataAvailable;
-        WinHttpReadData_t ReadData;
-        WinHttpCrackUrl_t CrackUrl;
-
-        WinHttpFunctions() {
-            wil::unique_hmodule winhttpModule{LoadLibraryEx(
-                L"winhttp.dll", nullptr, LOAD_LIBRARY_SEARCH_SYSTEM32)};
-            if (!winhttpModule) {
-                LOG(L"Failed to load winhttp.dll");
-                return;
+    if (!module || !pattern || patternSize == 0) {
+        LOG(L"Invalid arguments");
+        return nullptr;
+    }
+
+    try {
+        auto patternBytes = static_cast<const BYTE*>(pattern);
+        auto maskBytes = static_cast<const BYTE*>(mask);
+        auto moduleBase = reinterpret_cast<const BYTE*>(module);
+
+        auto sections = PatternScanner::GetExecutableSections(module);
+
+        auto isInSections = [&sections, patternSize](const BYTE* p) {
+            return std::any_of(
+                sections.begin(), sections.end(),
+                [p, patternSize](std::span<const BYTE> section) {
+                    return section.size() >= patternSize &&
+                           p >= section.data() &&
+                           p <= section.data() + section.size() - patternSize;
+                });
+        };
+
+        bool useCache = !options || !options->noCache;
+
+        std::shared_ptr<const ModuleIdentityCache::Identity> identity;
+        std::wstring cacheKey;
+        ULONGLONG patternHash = 0;
+        std::optional<SymbolCacheData> cacheData;
+
+        if (useCache) {
+            identity = ModuleIdentityCache::GetInstance().Get(module);
+            cacheKey = kPatternCacheKeyPrefix;
+            cacheKey += identity->cacheKey;
+            patternHash = HashPattern(patternBytes, maskBytes, patternSize);
+
+            try {
+                cacheData = ReadPatternCache(m_modName.c_str(), cacheKey);
+            } catch (const std::exception& e) {
+                LOG(L"Reading pattern cache failed: %S", e.what());
             }
 
-            HMODULE moduleRaw = winhttpModule.get();
-
-            CloseHandle = reinterpret_cast<WinHttpCloseHandle_t>(
-                GetProcAddress(moduleRaw, "WinHttpCloseHandle"));
-            Open = reinterpret_cast<WinHttpOpen_t>(
-                GetProcAddress(moduleRaw, "WinHttpOpen"));
-            Connect = reinterpret_cast<WinHttpConnect_t>(
-                GetProcAddress(moduleRaw, "WinHttpConnect"));
-            QueryHeaders = reinterpret_cast<WinHttpQueryHeaders_t>(
-                GetProcAddress(moduleRaw, "WinHttpQueryHeaders"));
-            ReceiveResponse = reinterpret_cast<WinHttpReceiveResponse_t>(
-                GetProcAddress(moduleRaw, "WinHttpReceiveResponse"));
-            SendRequest = reinterpret_cast<WinHttpSendRequest_t>(
-                GetProcAddress(moduleRaw, "WinHttpSendRequest"));
-            OpenRequest = reinterpret_cast<WinHttpOpenRequest_t>(
-                GetProcAddress(moduleRaw, "WinHttpOpenRequest"));
-            QueryDataAvailable = reinterpret_cast<WinHttpQueryDataAvailable_t>(
-                GetProcAddress(moduleRaw, "WinHttpQueryDataAvailable"));
-            ReadData = reinterpret_cast<WinHttpReadData_t>(
-                GetProcAddress(moduleRaw, "WinHttpReadData"));
-            CrackUrl = reinterpret_cast<WinHttpCrackUrl_t>(
-                GetProcAddress(moduleRaw, "WinHttpCrackUrl"));
-
-            if (!CloseHandle || !Open || !Connect || !QueryHeaders ||
-                !ReceiveResponse || !SendRequest || !OpenRequest ||
-                !QueryDataAvailable || !ReadData || !CrackUrl) {
-                LOG(L"Failed to get all winhttp.dll functions");
-                return;
+            if (cacheData) {
+                auto it = std::find_if(
+                    cacheData->entries.begin(), cacheData->entries.end(),
+                    [patternHash](const SymbolCacheData::Entry& entry) {
+                        return entry.nameHash == patternHash;
+                    });
+                if (it != cacheData->entries.end()) {
+                    // Verified, since the bytes might have been patched, e.g.
+                    // by a hook of another mod.
+                    const BYTE* cached = moduleBase + it->rva;
+                    if (isInSections(cached) &&
+                        PatternScanner::Matches(cached, patternBytes,
+                                                maskBytes, patternSize)) {
+                        VERBOSE(L"Found in cache: %p", cached);
+                        return const_cast<BYTE*>(cached);
+                    }
+
+                    cacheData->entries.erase(it);
+                }
             }
+        }
 
-            module = std::move(winhttpModule);
+        const BYTE* found = nullptr;
+        for (auto section : sections) {
+            found = PatternScanner::Find(section, patternBytes, maskBytes,
+                                         patternSize);
+            if (found) {
+                break;
+            }
         }
+
+        VERBOSE(L"Found: %p", found);
+
+        // Only found patterns are cached, a pattern might not be found since
+        // the code it matches was patched this time.
+        if (found && useCache) {
+            if (!cacheData) {
+                cacheData.emplace();
+                cacheData->moduleName = identity->fileName;
+                cacheData->timeStamp = identity->timeStamp;
+                cacheData->imageSize = identity->imageSize;
+            }
+
+            cacheData->entries.push_back({
+                .nameHash = patternHash,
+                .rva = static_cast<DWORD>(found - moduleBase),
+                .flags = 0,
+            });
+
+            try {
+                WritePatternCache(m_modName.c_str(), cacheKey,
+                                  std::move(*cacheData));
+            } catch (const std::exception& e) {
+                LOG(L"Writing pattern cache failed: %S", e.what());
+            }
+        }
+
+        return const_cast<BYTE*>(found);
+    } catch (const std::exception& e) {
+        LogFunctionError(e);
+    }
+
+    return nullptr;
+}
+
+const WH_URL_CONTENT* LoadedMod::GetUrlContent(
+    PCWSTR url,
+    const WH_GET_URL_CONTENT_OPTIONS* options) {
+    auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
+    VERBOSE(L"URL: %s", url);
+    VERBOSE(L"Target file path: %s", options && options->targetFilePath
+                                         ? options->targetFilePath
+                                         : L"(none)");
+
+    struct WH_GET_URL_CONTENT_OPTIONS_CURRENT {
+        size_t optionsSize;
+        PCWSTR targetFilePath;
+        DWORD cacheMaxAge;
     };
+    static_assert(sizeof(WH_GET_URL_CONTENT_OPTIONS) ==
+                      sizeof(WH_GET_URL_CONTENT_OPTIONS_CURRENT),
+                  "Struct was updated, update this code too");
 
-    STATIC_INIT_ONCE(WinHttpFunctions, winhttp, );
+    struct WH_GET_URL_CONTENT_OPTIONS_V1 {
+        size_t optionsSize;
+        PCWSTR targetFilePath;
+    };
 
-    if (!winhttp->module) {
-        LOG(L"WinHttp functions are not available");
-        return nullptr;
+    WH_GET_URL_CONTENT_OPTIONS optionsResolved;
+
+    switch (options ? options->optionsSize : 0) {
+        case sizeof(WH_GET_URL_CONTENT_OPTIONS):
+            optionsResolved = *options;
+            break;
+
+        case sizeof(WH_GET_URL_CONTENT_OPTIONS_V1): {
+            const WH_GET_URL_CONTENT_OPTIONS_V1* optionsV1 =
+                reinterpret_cast<const WH_GET_URL_CONTENT_OPTIONS_V1*>(
+                    options);
+            optionsResolved = {
+                .optionsSize = sizeof(optionsResolved),
+                .targetFilePath = optionsV1->targetFilePath,
+            };
+            break;
+        }
+
+        case 0:
+            optionsResolved = {
+                .optionsSize = sizeof(optionsResolved),
+            };
+            break;
+
+        default:
+            LOG(L"Unsupported options->optionsSize value: %zu",
+                options->optionsSize);
+            return nullptr;
     }
 
     try {
         wil::unique_hfile targetFile;
-        PCWSTR targetFilePath = options ? options->targetFilePath : nullptr;
+        PCWSTR targetFilePath = optionsResolved.targetFilePath;
         if (targetFilePath) {
             targetFile.reset(CreateFile(targetFilePath, GENERIC_WRITE,
                                         FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
@@ -2257,105 +4461,438 @@ const WH_URL_CONTENT* LoadedMod::GetUrlContent(
             THROW_LAST_ERROR_IF(!targetFile);
         }
 
-        URL_COMPONENTS urlComp = {sizeof(urlComp)};
-        urlComp.dwHostNameLength = (DWORD)-1;
-        urlComp.dwUrlPathLength = (DWORD)-1;
-        THROW_IF_WIN32_BOOL_FALSE(winhttp->CrackUrl(url, 0, 0, &urlComp));
+        if (optionsResolved.cacheMaxAge) {
+            auto response =
+                UrlCache::Get(m_modName.c_str(), url,
+                              optionsResolved.cacheMaxAge, targetFile.get());
+            return MakeUrlContent(response, !targetFile);
+        }
 
-        HINTERNET session{winhttp->Open(L"Windhawk/" VER_FILE_VERSION_WSTR,
-                                        WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
-                                        WINHTTP_NO_PROXY_NAME,
-                                        WINHTTP_NO_PROXY_BYPASS, 0)};
-        THROW_LAST_ERROR_IF_NULL(session);
+        // Without a cancellation callback, a response is always returned.
+        auto response =
+            HttpClient::GetInstance().Get(url, targetFile.get(), nullptr);
 
-        auto sessionCleanup = wil::scope_exit(
-            [winhttp, session] { winhttp->CloseHandle(session); });
+        return MakeUrlContent(*response, !targetFile);
+    } catch (const std::exception& e) {
+        LogFunctionError(e);
+    }
 
-        HINTERNET connect{winhttp->Connect(
-            session,
-            std::wstring(urlComp.lpszHostName, urlComp.dwHostNameLength)
-                .c_str(),
-            urlComp.nPort, 0)};
-        THROW_LAST_ERROR_IF_NULL(connect);
+    return nullptr;
+}
+
+void LoadedMod::FreeUrlContent(const WH_URL_CONTENT* content) {
+    auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
 
-        auto connectCleanup = wil::scope_exit(
-            [winhttp, connect] { winhttp->CloseHandle(connect); });
+    if (content) {
+        delete[] content->data;
+        delete content;
+    }
+}
 
-        HINTERNET request{winhttp->OpenRequest(
-            connect, L"GET",
-            std::wstring(urlComp.lpszUrlPath, urlComp.dwUrlPathLength).c_str(),
-            nullptr, WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES,
-            urlComp.nScheme == INTERNET_SCHEME_HTTPS ? WINHTTP_FLAG_SECURE
-                                                     : 0)};
-        THROW_LAST_ERROR_IF_NULL(request);
+HANDLE LoadedMod::GetUrlContentAsync(
+    PCWSTR url,
+    const WH_GET_URL_CONTENT_ASYNC_OPTIONS* options,
+    WH_URL_CONTENT_CALLBACK callback,
+    void* context) {
+    auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
+    VERBOSE(L"URL: %s", url);
+    VERBOSE(L"Target file path: %s", options && options->targetFilePath
+                                         ? options->targetFilePath
+                                         : L"(none)");
 
-        auto requestCleanup = wil::scope_exit(
-            [winhttp, request] { winhttp->CloseHandle(request); });
+    if (options &&
+        options->optionsSize != sizeof(WH_GET_URL_CONTENT_ASYNC_OPTIONS)) {
+        LOG(L"Unsupported options->optionsSize value: %zu",
+            options->optionsSize);
+        return nullptr;
+    }
 
-        THROW_IF_WIN32_BOOL_FALSE(
-            winhttp->SendRequest(request, WINHTTP_NO_ADDITIONAL_HEADERS, 0,
-                                 WINHTTP_NO_REQUEST_DATA, 0, 0, 0));
-
-        THROW_IF_WIN32_BOOL_FALSE(winhttp->ReceiveResponse(request, nullptr));
-
-        DWORD statusCode = 0;
-        DWORD statusCodeSize = sizeof(statusCode);
-        THROW_IF_WIN32_BOOL_FALSE(winhttp->QueryHeaders(
-            request, WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
-            WINHTTP_HEADER_NAME_BY_INDEX, &statusCode, &statusCodeSize,
-            WINHTTP_NO_HEADER_INDEX));
-
-        auto content = std::make_unique<WH_URL_CONTENT>();
-        content->statusCode = statusCode;
-
-        std::string chunk;
-        std::vector<std::string> chunks;
-        DWORD downloaded = 0;
-        size_t downloadedTotal = 0;
-        do {
-            DWORD size = 0;
-            THROW_IF_WIN32_BOOL_FALSE(
-                winhttp->QueryDataAvailable(request, &size));
-
-            if (size == 0) {
-                break;
-            }
+    try {
+        if (!url) {
+            throw std::invalid_argument("The URL must be set");
+        }
 
-            chunk.resize(size);
-            THROW_IF_WIN32_BOOL_FALSE(winhttp->ReadData(
-                request, (PVOID)chunk.data(), size, &downloaded));
+        if (!callback) {
+            throw std::invalid_argument("The callback must be set");
+        }
 
-            if (targetFile) {
-                DWORD written = 0;
-                THROW_IF_WIN32_BOOL_FALSE(WriteFile(targetFile.get(),
-                                                    chunk.data(), downloaded,
-                                                    &written, nullptr));
-                THROW_WIN32_IF(ERROR_WRITE_FAULT, written != downloaded);
-            } else {
-                chunk.resize(downloaded);
-                chunks.push_back(std::move(chunk));
-                chunk.clear();
-            }
+        PCWSTR targetFilePath = options ? options->targetFilePath : nullptr;
+        WH_URL_DATA_CALLBACK dataCallback =
+            options ? options->dataCallback : nullptr;
+        if (targetFilePath && dataCallback) {
+            throw std::invalid_argument(
+                "A target file and a data callback can't be combined");
+        }
+
+        auto request = std::make_unique<UrlContentRequest>(UrlContentRequest{
+            .mod = this,
+            .url = url,
+            .timeout = options ? options->timeout : 0,
+            .dataCallback = dataCallback,
+            .callback = callback,
+            .context = context,
+        });
+
+        // Opened right away, so that errors are reported to the caller.
+        if (targetFilePath) {
+            request->targetFile.reset(CreateFile(
+                targetFilePath, GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+            THROW_LAST_ERROR_IF(!request->targetFile);
+        }
+
+        std::lock_guard guard(m_urlContentRequestsMutex);
+
+        if (m_urlContentRequestsClosed) {
+            VERBOSE(L"Uninitializing, not allowed to start requests");
+            return nullptr;
+        }
+
+        UINT64 id = ++m_urlContentRequestsLastId;
+        request->id = id;
+
+        THROW_IF_WIN32_BOOL_FALSE(TrySubmitThreadpoolCallback(
+            UrlContentRequestCallback, request.get(), nullptr));
+        m_urlContentRequests.emplace(id, std::move(request));
+
+        // The ID is never zero, so the handle is never NULL.
+        return reinterpret_cast<HANDLE>(static_cast<ULONG_PTR>(id));
+    } catch (const std::exception& e) {
+        LogFunctionError(e);
+    }
+
+    return nullptr;
+}
+
+BOOL LoadedMod::CancelUrlContentAsync(HANDLE request) {
+    auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
+
+    UINT64 id = reinterpret_cast<ULONG_PTR>(request);
+
+    std::lock_guard guard(m_urlContentRequestsMutex);
+
+    auto it = m_urlContentRequests.find(id);
+    if (it == m_urlContentRequests.end()) {
+        VERBOSE(L"The request isn't pending");
+        return FALSE;
+    }
+
+    it->second->cancelEvent.SetEvent();
+    return TRUE;
+}
+
+HANDLE LoadedMod::RegisterModuleLoadCallback(PCWSTR moduleName,
+                                             WH_MODULE_LOAD_CALLBACK callback,
+                                             void* context) {
+    auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
+    VERBOSE(L"moduleName: %s", moduleName);
+
+    try {
+        if (!moduleName || !*moduleName || wcspbrk(moduleName, L"\\/:")) {
+            throw std::invalid_argument(
+                "The module name must be a file name without a path");
+        }
+
+        if (!callback) {
+            throw std::invalid_argument("The callback must be set");
+        }
+
+        std::lock_guard guard(m_moduleLoadCallbacksMutex);
+
+        if (m_uninitializing) {
+            VERBOSE(L"Uninitializing, not allowed to register callbacks");
+            return nullptr;
+        }
+
+        UINT64 id = ModuleLoadNotifier::GetInstance().Register(
+            moduleName,
+            [callback, context](HMODULE module) { callback(module, context); });
+        m_moduleLoadCallbacks.insert(id);
+
+        // The ID is never zero, so the handle is never NULL.
+        return reinterpret_cast<HANDLE>(static_cast<ULONG_PTR>(id));
+    } catch (const std::exception& e) {
+        LogFunctionError(e);
+    }
+
+    return nullptr;
+}
+
+BOOL LoadedMod::UnregisterModuleLoadCallback(HANDLE registration) {
+    auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
+
+    UINT64 id = reinterpret_cast<ULONG_PTR>(registration);
+
+    std::lock_guard guard(m_moduleLoadCallbacksMutex);
+
+    if (!m_moduleLoadCallbacks.erase(id)) {
+        LOG(L"Mod %s error: Unknown module load callback registration",
+            m_modName.c_str());
+        return FALSE;
+    }
+
+    ModuleLoadNotifier::GetInstance().Unregister(id);
+    return TRUE;
+}
+
+HANDLE LoadedMod::SubscribeVisualTreeChanges(
+    const WH_VISUAL_TREE_OPTIONS* options,
+    WH_VISUAL_TREE_CALLBACK callback,
+    void* context) {
+    auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
+
+    try {
+        if (options && options->optionsSize != sizeof(*options)) {
+            throw std::invalid_argument("Unsupported options size");
+        }
+
+        if (!callback) {
+            throw std::invalid_argument("The callback must be set");
+        }
+
+        VisualTreeNotifier::Filter filter;
+        if (options && options->typeName) {
+            filter.typeName = options->typeName;
+        }
+
+        if (options && options->name) {
+            filter.name = options->name;
+        }
+
+        auto& visualTreeNotifier = VisualTreeNotifier::GetInstance();
+
+        std::unique_lock lock(m_visualTreeCallbacksMutex);
+
+        if (m_uninitializing) {
+            VERBOSE(L"Uninitializing, not allowed to register callbacks");
+            return nullptr;
+        }
+
+        UINT64 id = visualTreeNotifier.Register(
+            std::move(filter),
+            [callback, context](bool added,
+                                const VisualTreeNotifier::Element& element) {
+                WH_VISUAL_TREE_ELEMENT info{
+                    .element = element.element,
+                    .parent = element.parent,
+                    .typeName = element.typeName,
+                    .name = element.name,
+                    .handle = element.handle,
+                    .parentHandle = element.parentHandle,
+                };
+                callback(added ? WH_VISUAL_TREE_ELEMENT_ADDED
+                               : WH_VISUAL_TREE_ELEMENT_REMOVED,
+                         &info, context);
+            });
+        m_visualTreeCallbacks.insert(id);
+
+        // Without holding the lock, the callback can unsubscribe.
+        lock.unlock();
+        visualTreeNotifier.ReportExistingElements(id);
+
+        // The ID is never zero, so the handle is never NULL.
+        return reinterpret_cast<HANDLE>(static_cast<ULONG_PTR>(id));
+    } catch (const std::exception& e) {
+        LogFunctionError(e);
+    }
+
+    return nullptr;
+}
+
+BOOL LoadedMod::UnsubscribeVisualTreeChanges(HANDLE subscription) {
+    auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
+
+    UINT64 id = reinterpret_cast<ULONG_PTR>(subscription);
+
+    std::lock_guard guard(m_visualTreeCallbacksMutex);
+
+    if (!m_visualTreeCallbacks.erase(id)) {
+        LOG(L"Mod %s error: Unknown visual tree subscription",
+            m_modName.c_str());
+        return FALSE;
+    }
+
+    VisualTreeNotifier::GetInstance().Unregister(id);
+    return TRUE;
+}
+
+BOOL LoadedMod::QueueWork(WH_THREAD_POOL_CALLBACK callback, void* context) {
+    auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
+
+    try {
+        m_threadPool.QueueWork(callback, context);
+        return TRUE;
+    } catch (const std::exception& e) {
+        LogFunctionError(e);
+    }
+
+    return FALSE;
+}
+
+HANDLE LoadedMod::CreateTimer(WH_THREAD_POOL_CALLBACK callback,
+                              void* context,
+                              DWORD dueTime,
+                              DWORD period) {
+    auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
+    VERBOSE(L"Due time: %u, period: %u", dueTime, period);
+
+    try {
+        return m_threadPool.CreateTimer(callback, context, dueTime, period);
+    } catch (const std::exception& e) {
+        LogFunctionError(e);
+    }
+
+    return nullptr;
+}
+
+BOOL LoadedMod::SetTimer(HANDLE timer, DWORD dueTime, DWORD period) {
+    auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
+    VERBOSE(L"Due time: %u, period: %u", dueTime, period);
+
+    if (!m_threadPool.SetTimer(timer, dueTime, period)) {
+        LOG(L"Mod %s error: Unknown timer", m_modName.c_str());
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOL LoadedMod::CloseTimer(HANDLE timer) {
+    auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
+
+    try {
+        if (!m_threadPool.CloseTimer(timer)) {
+            LOG(L"Mod %s error: Unknown timer", m_modName.c_str());
+            return FALSE;
+        }
+
+        return TRUE;
+    } catch (const std::exception& e) {
+        LogFunctionError(e);
+    }
+
+    return FALSE;
+}
+
+BOOL LoadedMod::RunOnThread(DWORD threadId,
+                            WH_RUN_ON_THREAD_CALLBACK callback,
+                            void* context,
+                            DWORD timeout) {
+    auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
+    VERBOSE(L"Thread ID: %u, timeout: %u", threadId, timeout);
+
+    try {
+        if (!callback) {
+            throw std::invalid_argument("The callback must be set");
+        }
+
+        if (!ThreadCall::Run(threadId, callback, context, timeout)) {
+            VERBOSE(L"Timed out");
+            return FALSE;
+        }
+
+        return TRUE;
+    } catch (const std::exception& e) {
+        LogFunctionError(e);
+    }
+
+    return FALSE;
+}
+
+const WH_SHARED_MEMORY* LoadedMod::OpenSharedMemory(PCWSTR name,
+                                                    size_t size) {
+    auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
+    VERBOSE(L"Name: %s, size: %zu", name, size);
+
+    try {
+        if (!name || !*name || wcslen(name) > kSharedMemoryNameMaxLength ||
+            wcschr(name, L'\\')) {
+            throw std::invalid_argument("Invalid shared memory name");
+        }
+
+        if (size == 0) {
+            throw std::invalid_argument("The size must be nonzero");
+        }
+
+        std::wstring identifier = L"ModSharedMemory-";
+        identifier += m_modName;
+        identifier += L'-';
+        identifier += name;
+
+        auto objectName = MakeSessionObjectName(identifier.c_str());
+        auto secAttr = GetSessionObjectSecurityAttributes();
+
+        auto sharedMemory = std::make_unique<SharedMemory>();
+
+        ULARGE_INTEGER mappingSize{.QuadPart = size};
+        sharedMemory->mapping.reset(CreateFileMapping(
+            INVALID_HANDLE_VALUE, &secAttr.attributes, PAGE_READWRITE,
+            mappingSize.HighPart, mappingSize.LowPart, objectName.c_str()));
+        THROW_LAST_ERROR_IF_NULL(sharedMemory->mapping);
+
+        bool created = GetLastError() != ERROR_ALREADY_EXISTS;
+
+        sharedMemory->view.reset(MapViewOfFile(sharedMemory->mapping.get(),
+                                               FILE_MAP_READ | FILE_MAP_WRITE,
+                                               0, 0, size));
+        THROW_LAST_ERROR_IF_NULL(sharedMemory->view);
+
+        objectName += L"-Event";
+        sharedMemory->event.reset(CreateEvent(&secAttr.attributes, FALSE,
+                                              FALSE, objectName.c_str()));
+        THROW_LAST_ERROR_IF_NULL(sharedMemory->event);
+
+        sharedMemory->info = {
+            .data = sharedMemory->view.get(),
+            .size = size,
+            .event = sharedMemory->event.get(),
+            .created = created,
+        };
+
+        const WH_SHARED_MEMORY* info = &sharedMemory->info;
+
+        std::lock_guard guard(m_sharedMemoriesMutex);
+        m_sharedMemories.emplace(info, std::move(sharedMemory));
+
+        return info;
+    } catch (const std::exception& e) {
+        LogFunctionError(e);
+    }
+
+    return nullptr;
+}
+
+void LoadedMod::CloseSharedMemory(const WH_SHARED_MEMORY* sharedMemory) {
+    auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
+
+    if (!sharedMemory) {
+        return;
+    }
+
+    std::lock_guard guard(m_sharedMemoriesMutex);
+
+    if (!m_sharedMemories.erase(sharedMemory)) {
+        LOG(L"Mod %s error: Unknown shared memory", m_modName.c_str());
+    }
+}
 
-            downloadedTotal += downloaded;
-        } while (downloaded > 0);
+bool LoadedMod::HasSharedMemory() {
+    std::lock_guard guard(m_sharedMemoriesMutex);
+    return !m_sharedMemories.empty();
+}
 
-        if (targetFile) {
-            content->data = nullptr;
-        } else {
-            auto data = std::make_unique<char[]>(downloadedTotal + 1);
-            size_t dataIter = 0;
-            for (const auto& chunk : chunks) {
-                std::copy(chunk.begin(), chunk.end(), data.get() + dataIter);
-                dataIter += chunk.size();
-            }
-            data[dataIter] = '\0';
-            content->data = data.release();
-        }
+HANDLE LoadedMod::ArenaCreate(size_t maxSize) {
+    auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
+    VERBOSE(L"Max size: %zu", maxSize);
 
-        content->length = downloadedTotal;
+    try {
+        auto arena =
+            std::make_unique<ModArena>(maxSize ? maxSize : kArenaDefaultSize);
+        HANDLE handle = arena.get();
 
-        return content.release();
+        std::lock_guard guard(m_arenasMutex);
+        m_arenas.try_emplace(handle, std::move(arena));
+        return handle;
     } catch (const std::exception& e) {
         LogFunctionError(e);
     }
@@ -2363,13 +4900,38 @@ const WH_URL_CONTENT* LoadedMod::GetUrlContent(
     return nullptr;
 }
 
-void LoadedMod::FreeUrlContent(const WH_URL_CONTENT* content) {
+void* LoadedMod::ArenaAlloc(HANDLE arena, size_t size, size_t alignment) {
+    // Called often from hooks, so the handle isn't looked up, and nothing is
+    // logged.
+    return static_cast<ModArena*>(arena)->Alloc(size, alignment);
+}
+
+BOOL LoadedMod::ArenaReset(HANDLE arena) {
     auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
 
-    if (content) {
-        delete[] content->data;
-        delete content;
+    std::lock_guard guard(m_arenasMutex);
+
+    auto it = m_arenas.find(arena);
+    if (it == m_arenas.end()) {
+        LOG(L"Mod %s error: Unknown arena", m_modName.c_str());
+        return FALSE;
+    }
+
+    it->second->Reset();
+    return TRUE;
+}
+
+BOOL LoadedMod::ArenaDestroy(HANDLE arena) {
+    auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
+
+    std::lock_guard guard(m_arenasMutex);
+
+    if (!m_arenas.erase(arena)) {
+        LOG(L"Mod %s error: Unknown arena", m_modName.c_str());
+        return FALSE;
     }
+
+    return TRUE;
 }
 
 std::optional<std::wstring> LoadedMod::HookSymbolsGetOnlineCache(
@@ -2382,10 +4944,22 @@ std::optional<std::wstring> LoadedMod::HookSymbolsGetOnlineCache(
             onlineCacheUrl += L'/';
         }
     } else if (!m_modName.starts_with(L"local@")) {
+        // The base URL of the engine settings, e.g. a mirror in the local
+        // network, replaces the default cache for the mods which don't
+        // specify their own. It has the same layout, with a folder per mod.
+        auto settings = StorageManager::GetInstance().GetAppConfig(L"Settings");
         onlineCacheUrl =
-            L"https://ramensoftware.github.io/windhawk-mod-symbol-cache/";
-        onlineCacheUrl += m_modName;
-        onlineCacheUrl += L'/';
+            settings->GetString(L"OnlineSymbolCacheUrl")
+                .value_or(L"https://ramensoftware.github.io/"
+                          L"windhawk-mod-symbol-cache/");
+        if (!onlineCacheUrl.empty()) {
+            if (onlineCacheUrl.back() != L'/') {
+                onlineCacheUrl += L'/';
+            }
+
+            onlineCacheUrl += m_modName;
+            onlineCacheUrl += L'/';
+        }
     }
 
     if (onlineCacheUrl.empty()) {
@@ -2393,6 +4967,13 @@ std::optional<std::wstring> LoadedMod::HookSymbolsGetOnlineCache(
         return std::wstring();
     }
 
+    auto queryCancel = [this]() { return ShouldCancelLongOperations(); };
+
+    if (auto manifestCache = HookSymbolsGetOnlineCacheFromManifest(
+            onlineCacheUrl, cacheStrKey, queryCancel)) {
+        return manifestCache;
+    }
+
     onlineCacheUrl += cacheStrKey;
     onlineCacheUrl += L".txt";
 
@@ -2400,56 +4981,60 @@ std::optional<std::wstring> LoadedMod::HookSymbolsGetOnlineCache(
     // connectivity to be established on startup.
     ULONGLONG sessionCreationTime = wil::filetime::to_int64(
         CustomizationSession::GetSessionManagerProcessCreationTime());
+    ULONGLONG retryEndTime =
+        sessionCreationTime + wil::filetime_duration::one_second * 30;
 
     for (int i = 0;; i++) {
         if (i > 0) {
             ULONGLONG now =
                 wil::filetime::to_int64(wil::filetime::get_system_time());
-            if (now < sessionCreationTime ||
-                now > sessionCreationTime +
-                          wil::filetime_duration::one_second * 30) {
+            if (now < sessionCreationTime || now >= retryEndTime) {
                 break;
             }
 
-            // In case the mod was disabled, abort.
-            if (!Mod::ShouldLoadInRunningProcess(m_modName.c_str()) ||
-                CustomizationSession::IsEndingSoon()) {
+            // Retry as soon as the network addresses change, which is when
+            // connectivity is usually established. Connectivity might also
+            // be established without an address change, e.g. once a proxy is
+            // reachable, so retry after a while regardless.
+            DWORD timeout = static_cast<DWORD>(
+                std::min(retryEndTime - now,
+                         static_cast<ULONGLONG>(
+                             wil::filetime_duration::one_second * 10)) /
+                wil::filetime_duration::one_millisecond);
+            if (!HttpClient::WaitForNetworkChange(timeout, queryCancel)) {
                 VERBOSE(L"Aborting getting online symbol cache");
                 return std::nullopt;
             }
 
-            Sleep(5000);
-
             VERBOSE(L"Getting online symbol cache (attempt %d)", i + 1);
         } else {
             VERBOSE(L"Getting online symbol cache");
         }
 
-        const WH_URL_CONTENT* onlineCacheUrlContent =
-            GetUrlContent(onlineCacheUrl.c_str(), nullptr);
-        if (!onlineCacheUrlContent) {
-            LOG(L"Couldn't contact the online cache server");
+        std::optional<HttpClient::Response> response;
+        try {
+            response = HttpClient::GetInstance().Get(onlineCacheUrl.c_str(),
+                                                     nullptr, queryCancel);
+        } catch (const std::exception& e) {
+            LOG(L"Couldn't contact the online cache server: %S", e.what());
             continue;
         }
 
-        auto scopeFreeUrlContent =
-            wil::scope_exit([this, onlineCacheUrlContent]() {
-                FreeUrlContent(onlineCacheUrlContent);
-            });
+        if (!response) {
+            VERBOSE(L"Aborting getting online symbol cache");
+            return std::nullopt;
+        }
 
-        if (onlineCacheUrlContent->statusCode == 200) {
-            return std::wstring(
-                onlineCacheUrlContent->data,
-                onlineCacheUrlContent->data + onlineCacheUrlContent->length);
+        if (response->statusCode == 200) {
+            return std::wstring(response->data.begin(), response->data.end());
         }
 
-        if (onlineCacheUrlContent->statusCode == 404) {
+        if (response->statusCode == 404) {
             VERBOSE(L"Online cache not found");
             return std::wstring();
         }
 
-        LOG(L"Online cache server returned status %d",
-            onlineCacheUrlContent->statusCode);
+        LOG(L"Online cache server returned status %u", response->statusCode);
     }
 
     VERBOSE(
@@ -2463,13 +5048,370 @@ std::optional<std::wstring> LoadedMod::HookSymbolsGetOnlineCache(
     return std::nullopt;
 }
 
-void LoadedMod::SetTask(PCWSTR task) {
+std::optional<std::wstring> LoadedMod::HookSymbolsGetOnlineCacheFromManifest(
+    const std::wstring& onlineCacheUrl,
+    std::wstring_view cacheStrKey,
+    const std::function<bool()>& queryCancel) {
+    // Can be called concurrently by HookSymbolsBatch worker threads.
+    std::lock_guard guard(m_onlineCacheManifestMutex);
+
+    if (!m_onlineCacheManifest) {
+        m_onlineCacheManifest.emplace();
+
+        std::wstring windowsBuild = GetWindowsBuildForOnlineCache();
+        if (windowsBuild.empty()) {
+            return std::nullopt;
+        }
+
+        // The manifest has a line for each module the mod is known to hook
+        // on this Windows build: <cache key>=<cache string>. It's usually
+        // served compressed, and is decompressed by the HTTP client.
+        std::wstring manifestUrl =
+            onlineCacheUrl + L"manifest/" + windowsBuild + L".txt";
+
+        VERBOSE(L"Getting online symbol cache manifest");
+
+        std::optional<HttpClient::Response> response;
+        try {
+            response = HttpClient::GetInstance().Get(manifestUrl.c_str(),
+                                                     nullptr, queryCancel);
+        } catch (const std::exception& e) {
+            LOG(L"Couldn't get the online symbol cache manifest: %S", e.what());
+            return std::nullopt;
+        }
+
+        if (!response) {
+            return std::nullopt;
+        }
+
+        if (response->statusCode != 200) {
+            VERBOSE(L"Online symbol cache manifest not available (status %u)",
+                    response->statusCode);
+            return std::nullopt;
+        }
+
+        std::wstring manifest(response->data.begin(), response->data.end());
+        for (auto line : Functions::SplitStringToViews(manifest, L'\n')) {
+            if (line.ends_with(L'\r')) {
+                line.remove_suffix(1);
+            }
+
+            auto separator = line.find(L'=');
+            if (separator == line.npos || separator == 0) {
+                continue;
+            }
+
+            m_onlineCacheManifest->try_emplace(
+                std::wstring(line.substr(0, separator)),
+                line.substr(separator + 1));
+        }
+
+        VERBOSE(L"Online symbol cache manifest has %zu entries",
+                m_onlineCacheManifest->size());
+
+        // Store the entries in the local cache, so that hooking the other
+        // modules doesn't have to go online, also in other processes.
+        try {
+            auto symbolCache =
+                StorageManager::GetInstance().GetModWritableConfig(
+                    m_modName.c_str(), L"SymbolCache", true);
+            for (const auto& [key, value] : *m_onlineCacheManifest) {
+                if (symbolCache->GetString(key.c_str())) {
+                    continue;
+                }
+
+                if (auto cacheData = SymbolCacheData::ParseString(value)) {
+                    auto cacheBinary = cacheData->Serialize();
+                    symbolCache->SetBinary(key.c_str(), cacheBinary.data(),
+                                           cacheBinary.size());
+                }
+            }
+        } catch (const std::exception& e) {
+            LOG(L"%S", e.what());
+        }
+    }
+
+    auto it = m_onlineCacheManifest->find(std::wstring(cacheStrKey));
+    if (it == m_onlineCacheManifest->end()) {
+        return std::nullopt;
+    }
+
+    VERBOSE(L"Found in online symbol cache manifest");
+    return it->second;
+}
+
+std::shared_ptr<const LoadedMod::SettingsValues>
+LoadedMod::GetSettingsValues() {
+    std::lock_guard guard(m_settingsValuesMutex);
+
+    if (!m_settingsValues) {
+        auto settings = StorageManager::GetInstance().GetModConfig(
+            m_modName.c_str(), L"Settings");
+
+        auto settingsValues = std::make_shared<SettingsValues>();
+        for (auto it = settings->EnumStringValues(); it; ++it) {
+            auto [name, value] = *it;
+            std::wstring nameLower = name;
+            std::transform(nameLower.begin(), nameLower.end(),
+                           nameLower.begin(), towlower);
+            settingsValues->insert_or_assign(
+                std::move(nameLower), SettingValue{
+                                          .name = std::move(name),
+                                          .value = std::move(value),
+                                      });
+        }
+
+        m_settingsValues = std::move(settingsValues);
+    }
+
+    return m_settingsValues;
+}
+
+// static
+const WH_SETTINGS* LoadedMod::MakeChangedSettings(
+    const SettingsValues& previous,
+    const SettingsValues& current) {
+    std::vector<SettingsBlockItem> items;
+
+    for (const auto& [nameLower, setting] : current) {
+        auto it = previous.find(nameLower);
+        if (it == previous.end() || it->second.value != setting.value) {
+            items.push_back({
+                .nameLower = nameLower,
+                .name = &setting.name,
+                .value = &setting.value,
+            });
+        }
+    }
+
+    for (const auto& [nameLower, setting] : previous) {
+        if (!current.contains(nameLower)) {
+            items.push_back({
+                .nameLower = nameLower,
+                .name = &setting.name,
+                .value = nullptr,
+            });
+        }
+    }
+
+    return MakeSettingsBlock(std::move(items));
+}
+
+std::optional<std::wstring> LoadedMod::GetSettingValue(PCWSTR valueName,
+                                                       va_list args) {
+    std::wstring valueNameFormatted = FormatSettingName(valueName, args);
+
+    auto settingsValues = GetSettingsValues();
+    auto it = settingsValues->find(valueNameFormatted);
+    if (it == settingsValues->end()) {
+        return std::nullopt;
+    }
+
+    return it->second.value;
+}
+
+bool LoadedMod::ShouldDeferInit(bool slowOperationAhead) {
+    if (m_initDeferred) {
+        return true;
+    }
+
+    if (m_initialized || !m_initStartTickCount ||
+        !CustomizationSession::IsInitializingFromAPC()) {
+        return false;
+    }
+
+    ULONGLONG elapsed = GetTickCount64() - m_initStartTickCount;
+    if (!slowOperationAhead && elapsed < kApcInitTimeBudgetMs) {
+        return false;
+    }
+
+    LOG(L"Mod %s: Deferring the initialization to let the process start (%I64u "
+        L"ms elapsed)",
+        m_modName.c_str(), elapsed);
+
+    m_initDeferred = true;
+    return true;
+}
+
+bool LoadedMod::ShouldCancelLongOperations() {
+    if (m_cancelEvent.is_signaled() || CustomizationSession::IsEndingSoon()) {
+        return true;
+    }
+
+    // While the mod is being initialized, the reload which would cancel the
+    // operations waits for the initialization to finish. Check the mod config
+    // instead, at most once per second, since it involves registry reads.
+    if (m_initialized) {
+        return false;
+    }
+
+    DWORD tick = GetTickCount();
+    DWORD lastTick = m_lastCancelConfigCheckTick;
+    if (tick - lastTick < 1000 ||
+        !m_lastCancelConfigCheckTick.compare_exchange_strong(lastTick, tick)) {
+        return false;
+    }
+
     try {
-        SetModMetadataValue(m_modTaskFile, task, L"mod-task",
-                            m_modInstanceId.c_str());
+        if (!Mod::ShouldLoadInRunningProcess(m_modName.c_str())) {
+            m_cancelEvent.SetEvent();
+            return true;
+        }
     } catch (const std::exception& e) {
         LOG(L"%S", e.what());
     }
+
+    return false;
+}
+
+void LoadedMod::UnregisterAllModuleLoadCallbacks() {
+    std::lock_guard guard(m_moduleLoadCallbacksMutex);
+
+    if (m_moduleLoadCallbacks.empty()) {
+        return;
+    }
+
+    auto& moduleLoadNotifier = ModuleLoadNotifier::GetInstance();
+    for (UINT64 id : m_moduleLoadCallbacks) {
+        moduleLoadNotifier.Unregister(id);
+    }
+
+    m_moduleLoadCallbacks.clear();
+}
+
+void LoadedMod::UnregisterAllVisualTreeCallbacks() {
+    std::lock_guard guard(m_visualTreeCallbacksMutex);
+
+    if (m_visualTreeCallbacks.empty()) {
+        return;
+    }
+
+    auto& visualTreeNotifier = VisualTreeNotifier::GetInstance();
+    for (UINT64 id : m_visualTreeCallbacks) {
+        visualTreeNotifier.Unregister(id);
+    }
+
+    m_visualTreeCallbacks.clear();
+}
+
+// static
+void CALLBACK
+LoadedMod::UrlContentRequestCallback(PTP_CALLBACK_INSTANCE instance,
+                                     PVOID context) {
+    // The request might take a while, don't block other thread pool work.
+    CallbackMayRunLong(instance);
+
+    auto* request = static_cast<UrlContentRequest*>(context);
+    LoadedMod* mod = request->mod;
+
+    const WH_URL_CONTENT* content = mod->RunUrlContentRequest(*request);
+    request->callback(content, request->context);
+
+    // The mod might be freed once the last request is removed, so the lock is
+    // held until the notification is sent.
+    std::lock_guard guard(mod->m_urlContentRequestsMutex);
+    mod->m_urlContentRequests.erase(request->id);
+    mod->m_urlContentRequestsDone.notify_all();
+}
+
+const WH_URL_CONTENT* LoadedMod::RunUrlContentRequest(
+    const UrlContentRequest& request) {
+    auto modDebugLoggingScope = MOD_DEBUG_LOGGING_SCOPE();
+    VERBOSE(L"URL: %s", request.url.c_str());
+
+    try {
+        HttpClient::RequestOptions options{
+            .cancelEvent = request.cancelEvent.get(),
+        };
+
+        if (request.timeout) {
+            options.timeout = request.timeout;
+        }
+
+        if (request.dataCallback) {
+            options.onData = [&request](DWORD statusCode,
+                                        std::string_view chunk) {
+                return !!request.dataCallback(static_cast<int>(statusCode),
+                                              chunk.data(), chunk.size(),
+                                              request.context);
+            };
+        }
+
+        auto response = HttpClient::GetInstance().Get(
+            request.url.c_str(), request.targetFile.get(), nullptr, options);
+        if (response) {
+            return MakeUrlContent(*response,
+                                  !request.targetFile && !request.dataCallback);
+        }
+    } catch (const std::exception& e) {
+        LogFunctionError(e);
+    }
+
+    return nullptr;
+}
+
+void LoadedMod::CancelAllUrlContentRequests() {
+    std::unique_lock lock(m_urlContentRequestsMutex);
+
+    m_urlContentRequestsClosed = true;
+
+    for (const auto& [id, request] : m_urlContentRequests) {
+        request->cancelEvent.SetEvent();
+    }
+
+    m_urlContentRequestsDone.wait(
+        lock, [this] { return m_urlContentRequests.empty(); });
+}
+
+void LoadedMod::SetTask(PCWSTR task) {
+    // Can be called concurrently by HookSymbolsBatch worker threads.
+    std::lock_guard guard(m_modTaskMutex);
+
+    ULONGLONG tickCount = GetTickCount64();
+
+    if (!task ||
+        (!m_modTaskPending &&
+         tickCount - m_modTaskLastWriteTickCount >= kModTaskUpdateIntervalMs)) {
+        // A pending task is dropped, and the timer will find nothing to
+        // write.
+        m_modTaskPending.reset();
+        m_modTask.Set(task);
+        m_modTaskLastWriteTickCount = tickCount;
+        return;
+    }
+
+    m_modTaskPending = task;
+
+    if (!m_modTaskTimerSet) {
+        ULONGLONG elapsed = tickCount - m_modTaskLastWriteTickCount;
+        ULONGLONG delay = elapsed < kModTaskUpdateIntervalMs
+                              ? kModTaskUpdateIntervalMs - elapsed
+                              : 0;
+
+        // A negative due time is relative.
+        FILETIME dueTime = wil::filetime::from_int64(static_cast<UINT64>(
+            -static_cast<INT64>(delay) *
+            wil::filetime_duration::one_millisecond));
+        SetThreadpoolTimer(m_modTaskTimer.get(), &dueTime, 0, 0);
+        m_modTaskTimerSet = true;
+    }
+}
+
+// static
+void CALLBACK LoadedMod::ModTaskTimerCallback(PTP_CALLBACK_INSTANCE instance,
+                                              PVOID context,
+                                              PTP_TIMER timer) {
+    auto* loadedMod = static_cast<LoadedMod*>(context);
+
+    std::lock_guard guard(loadedMod->m_modTaskMutex);
+
+    loadedMod->m_modTaskTimerSet = false;
+
+    if (loadedMod->m_modTaskPending) {
+        loadedMod->m_modTask.Set(loadedMod->m_modTaskPending->c_str());
+        loadedMod->m_modTaskPending.reset();
+        loadedMod->m_modTaskLastWriteTickCount = GetTickCount64();
+    }
 }
 
 void LoadedMod::LogFunctionError(const std::exception& e) {
@@ -2477,45 +5419,64 @@ void LoadedMod::LogFunctionError(const std::exception& e) {
 }
 
 Mod::Mod(PCWSTR modName)
-    : m_modName(modName), m_modInstanceId(GenerateModInstanceId(modName)) {
+    : m_modName(modName), m_modStatus(ModStatusTable::Kind::kStatus, modName) {
     SetStatus(L"Pending...");
 }
 
 bool Mod::Load(bool loadedOnStartup) {
+    TraceEvents::ScopedPhase phase("ModLoad", m_modName.c_str());
+
     if (m_loadedMod) {
         throw std::logic_error("Already loaded");
     }
 
-    if (IsModBanned(m_modName)) {
+    // All the values which are needed to load the mod, read once.
+    auto modConfig = GetModLoadConfig(m_modName.c_str());
+
+    if (modConfig && IsModBanned(m_modName, modConfig->version)) {
         return false;
     }
 
-    auto setStatusOnExit = wil::scope_exit(
-        [this] { SetStatus(m_loadedMod ? L"Loaded" : L"Unloaded"); });
+    auto setStatusOnExit = wil::scope_exit([this] {
+        if (m_loadedMod) {
+            SetStatus(L"Loaded");
+        } else if (!m_waitingForModules.empty()) {
+            SetStatus(L"Waiting for module...");
+        } else if (m_initDeferred) {
+            SetStatus(L"Initializing in the background...");
+        } else {
+            SetStatus(L"Unloaded");
+        }
+    });
 
-    auto& storageManager = StorageManager::GetInstance();
-    auto settings = storageManager.GetModConfig(m_modName.c_str(), nullptr);
+    if (!modConfig) {
+        throw std::runtime_error("Missing mod config");
+    }
 
-    m_libraryFileName = settings->GetString(L"LibraryFileName").value_or(L"");
+    m_libraryFileName = modConfig->libraryFileName;
     if (m_libraryFileName.empty()) {
         throw std::runtime_error("Missing LibraryFileName value");
     }
 
-    auto libraryPath = storageManager.GetModsPath() / m_libraryFileName;
+    m_settingsChangeTime = modConfig->settingsChangeTime;
 
-    m_settingsChangeTime = settings->GetInt(L"SettingsChangeTime").value_or(0);
+    m_waitingForModules.clear();
+    if (!modConfig->loadWithModule.empty() &&
+        !IsAnyModuleLoaded(modConfig->loadWithModule)) {
+        m_waitingForModules = modConfig->loadWithModule;
+        return false;
+    }
 
-    bool loggingEnabled = settings->GetInt(L"LoggingEnabled").value_or(0);
-    bool debugLoggingEnabled =
-        settings->GetInt(L"DebugLoggingEnabled").value_or(0);
+    auto libraryPath =
+        StorageManager::GetInstance().GetModsPath() / m_libraryFileName;
 
     m_loadedMod = std::make_unique<LoadedMod>(
-        m_modName.c_str(), m_modInstanceId.c_str(), libraryPath.c_str(),
-        loadedOnStartup, loggingEnabled, debugLoggingEnabled);
+        m_modName.c_str(), libraryPath.c_str(), loadedOnStartup, *modConfig);
 
     SetStatus(L"Loading...");
 
     if (!m_loadedMod->Initialize()) {
+        m_initDeferred = m_loadedMod->IsInitDeferred();
         m_loadedMod.reset();
         return false;
     }
@@ -2544,17 +5505,29 @@ void Mod::Uninitialize() {
 bool Mod::ApplyChangedSettings(bool* reload) {
     *reload = false;
 
-    auto& storageManager = StorageManager::GetInstance();
-    auto settings = storageManager.GetModConfig(m_modName.c_str(), nullptr);
+    // Loading checks whether the module is loaded now, and keeps waiting
+    // otherwise. A deferred initialization is done by loading the mod again.
+    if (!m_waitingForModules.empty() || m_initDeferred ||
+        m_reloadForSessionManager) {
+        *reload = true;
+        return true;
+    }
+
+    auto modConfig = GetModLoadConfig(m_modName.c_str());
+    if (!modConfig) {
+        throw std::runtime_error("Missing mod config");
+    }
 
-    if (settings->GetString(L"LibraryFileName").value_or(L"") !=
-        m_libraryFileName) {
+    if (modConfig->libraryFileName != m_libraryFileName) {
+        // A new version of the mod might hook other symbols, with other
+        // options.
+        LoadedMod::ClearInMemorySymbolCache(m_modName.c_str());
         *reload = true;
         return true;
     }
 
     int oldSettingsChangeTime = m_settingsChangeTime;
-    m_settingsChangeTime = settings->GetInt(L"SettingsChangeTime").value_or(0);
+    m_settingsChangeTime = modConfig->settingsChangeTime;
 
     if (m_settingsChangeTime != oldSettingsChangeTime) {
         if (!m_loadedMod) {
@@ -2562,22 +5535,55 @@ bool Mod::ApplyChangedSettings(bool* reload) {
             return true;
         }
 
-        if (!m_loadedMod->SettingsChanged(reload)) {
+        if (!m_loadedMod->SettingsChanged(reload,
+                                          modConfig->atomicReconfigure)) {
             return false;
         }
+
+        if (*reload && m_loadedMod->CanSoftReload()) {
+            // Keeps the library and its state, the hooks only change where
+            // the mod sets different ones.
+            if (m_loadedMod->SoftReload()) {
+                *reload = false;
+            } else {
+                LOG(L"Mod %s: Reinit failed, reloading", m_modName.c_str());
+            }
+        }
     }
 
     if (m_loadedMod) {
-        m_loadedMod->EnableLogging(
-            settings->GetInt(L"LoggingEnabled").value_or(0));
+        m_loadedMod->EnableLogging(modConfig->loggingEnabled);
 
-        m_loadedMod->EnableDebugLogging(
-            settings->GetInt(L"DebugLoggingEnabled").value_or(0));
+        m_loadedMod->EnableDebugLogging(modConfig->debugLoggingEnabled);
     }
 
     return true;
 }
 
+void Mod::FinishDeferredHookOperations() {
+    if (m_loadedMod) {
+        m_loadedMod->FinishDeferredHookOperations();
+    }
+}
+
+void Mod::QueueSetHooksPaused(bool paused) {
+    if (m_loadedMod) {
+        m_loadedMod->QueueSetHooksPaused(paused);
+    }
+}
+
+void Mod::CancelLongOperations() noexcept {
+    if (m_loadedMod) {
+        m_loadedMod->CancelLongOperations();
+    }
+}
+
+void Mod::OnSessionManagerChanged() {
+    if (m_loadedMod && m_loadedMod->HasSharedMemory()) {
+        m_reloadForSessionManager = true;
+    }
+}
+
 void Mod::Unload() {
     m_loadedMod.reset();
     SetStatus(L"Unloaded");
@@ -2587,65 +5593,56 @@ HMODULE Mod::GetLoadedModModuleHandle() {
     return m_loadedMod ? m_loadedMod->GetModModuleHandle() : nullptr;
 }
 
+void Mod::LogReloaded(ULONGLONG milliseconds) {
+    if (!m_loadedMod || !m_loadedMod->IsLogEnabled()) {
+        return;
+    }
+
+    Logger::GetInstance().LogLine(L"[WH] [%s] Reloaded in %I64u ms\n",
+                                  m_modName.c_str(), milliseconds);
+}
+
 // static
 bool Mod::ShouldLoadInRunningProcess(PCWSTR modName) {
-    auto settings =
-        StorageManager::GetInstance().GetModConfig(modName, nullptr);
-
-    if (settings->GetInt(L"Disabled").value_or(0)) {
-        return false;
-    }
+    auto modConfig = GetModLoadConfig(modName);
+    return modConfig && ShouldLoadInRunningProcess(*modConfig);
+}
 
-    auto architecturePattern =
-        settings->GetString(L"Architecture").value_or(L"");
-    if (!architecturePattern.empty() &&
-        !DoesArchitectureMatchPattern(architecturePattern)) {
+// static
+bool Mod::ShouldLoadInRunningProcess(
+    const ModConfigSnapshot::ModConfig& modConfig) {
+    if (CrashLoopGuard::IsTripped()) {
         return false;
     }
 
-    bool patternsMatchCriticalSystemProcesses =
-        settings->GetInt(L"PatternsMatchCriticalSystemProcesses").value_or(0);
-
-    std::wstring processPath = wil::GetModuleFileName<std::wstring>();
-
-    bool includeExcludeCustomOnly =
-        settings->GetInt(L"IncludeExcludeCustomOnly").value_or(0);
-
-    bool matchPatternExplicitOnly =
-        !patternsMatchCriticalSystemProcesses &&
-        (Functions::DoesPathMatchPattern(processPath,
-                                         ProcessLists::kCriticalProcesses) ||
-         Functions::DoesPathMatchPattern(
-             processPath, ProcessLists::kCriticalProcessesForMods));
-
-    bool include =
-        (!includeExcludeCustomOnly &&
-         Functions::DoesPathMatchPattern(
-             processPath, settings->GetString(L"Include").value_or(L""),
-             matchPatternExplicitOnly)) ||
-        Functions::DoesPathMatchPattern(
-            processPath, settings->GetString(L"IncludeCustom").value_or(L""),
-            matchPatternExplicitOnly);
+    // This function is called repeatedly, e.g. to check for cancellation
+    // while loading symbols, and for each mod on every config change. The
+    // decision is remembered for each mod until its targeting values change.
+    STATIC_INIT_ONCE(NoDestructorIfTerminating<LoadDecisionCache>, cache);
 
-    if (!include) {
-        return false;
+    auto cachedDecision = (**cache).Get(modConfig);
+    if (cachedDecision) {
+        return *cachedDecision;
     }
 
-    bool exclude =
-        (!includeExcludeCustomOnly &&
-         Functions::DoesPathMatchPattern(
-             processPath, settings->GetString(L"Exclude").value_or(L""))) ||
-        Functions::DoesPathMatchPattern(
-            processPath, settings->GetString(L"ExcludeCustom").value_or(L""));
-
-    return !exclude;
+    bool decision = DoesModTargetRunningProcess(modConfig);
+    (**cache).Set(modConfig, decision);
+    return decision;
 }
 
-void Mod::SetStatus(PCWSTR status) {
+// static
+std::shared_ptr<const ModConfigSnapshot::Snapshot>
+Mod::GetModConfigSnapshot() noexcept {
     try {
-        SetModMetadataValue(m_modStatusFile, status, L"mod-status",
-                            m_modInstanceId.c_str());
+        return ModConfigSnapshot::Get(
+            CustomizationSession::GetSessionManagerProcessId());
     } catch (const std::exception& e) {
-        LOG(L"%S", e.what());
+        VERBOSE(L"Error: %S", e.what());
     }
+
+    return nullptr;
+}
+
+void Mod::SetStatus(PCWSTR status) {
+    m_modStatus.Set(status);
 }
@@ -1,15 +1,29 @@
 #pragma once
 
+#include "hook_call_stats.h"
+#include "local_storage_buffer.h"
+#include "log_rate_limiter.h"
+#include "mod_arena.h"
+#include "mod_config_snapshot.h"
+#include "mod_load_times.h"
+#include "mod_status_table.h"
+#include "mod_thread_pool.h"
 #include "mods_api.h"
 
+class SymbolResolutionTrace;
+
 class LoadedMod {
    public:
+    struct PendingHook {
+        void* targetFunction;
+        void* hookFunction;
+        void** originalFunction;
+    };
+
     LoadedMod(PCWSTR modName,
-              PCWSTR modInstanceId,
               PCWSTR libraryPath,
               bool loadedOnStartup,
-              bool loggingEnabled,
-              bool debugLoggingEnabled);
+              const ModConfigSnapshot::ModConfig& modConfig);
     ~LoadedMod();
 
     // Disallow copy and move - we assume that the pointer of the class won't
@@ -18,12 +32,41 @@ class LoadedMod {
     LoadedMod& operator=(const LoadedMod&) = delete;
 
     bool Initialize();
+    // Whether the initialization was abandoned since it didn't fit the time
+    // budget of the process start, see ShouldDeferInit.
+    bool IsInitDeferred() const { return m_initDeferred; }
     void AfterInit();
     void BeforeUninit();
     void Uninitialize();
     void EnableLogging(bool enable);
     void EnableDebugLogging(bool enable);
-    bool SettingsChanged(bool* reload);
+    // If deferHookOperations is set, hook operations which are applied by the
+    // mod while it handles the change are only queued, and are applied by the
+    // caller together with the rest of the reload. FinishDeferredHookOperations
+    // must be called once they're applied.
+    bool SettingsChanged(bool* reload, bool deferHookOperations);
+    void FinishDeferredHookOperations();
+    // True if the mod exports Wh_ModReinit, and can be reloaded without
+    // unloading its library.
+    bool CanSoftReload();
+    // Calls Wh_ModReinit. The hooks of the mod which it sets again are kept as
+    // is, the rest are disabled. The hook operations are deferred as in
+    // SettingsChanged. If it fails, the mod should be fully reloaded.
+    bool SoftReload();
+    // Queues enabling or disabling all hooks of the mod, the caller applies
+    // the queued operations.
+    void QueueSetHooksPaused(bool paused);
+    // Aborts the long operations of the mod, such as symbol loading and
+    // downloads of the online symbol cache, which are in progress or are
+    // started later. Called before the mod is unloaded, possibly while such an
+    // operation is running on another thread of the mod.
+    void CancelLongOperations() noexcept;
+
+    // Frees the symbols which were resolved in this process and kept in
+    // memory for reloads, of all mods or of the given mod. Later reloads read
+    // the symbol caches of the mods from storage instead.
+    static void ClearInMemorySymbolCache();
+    static void ClearInMemorySymbolCache(PCWSTR modName);
 
     PCWSTR GetModName();
     HMODULE GetModModuleHandle();
@@ -42,16 +85,24 @@ class LoadedMod {
                         const void* buffer,
                         size_t bufferSize);
     BOOL DeleteValue(PCWSTR valueName);
+    BOOL SetValues(const WH_VALUE* values, size_t valuesCount);
 
     size_t GetModStoragePath(PWSTR pathBuffer, size_t bufferChars);
 
     int GetIntSetting(PCWSTR valueName, va_list args);
     PCWSTR GetStringSetting(PCWSTR valueName, va_list args);
     void FreeStringSetting(PCWSTR string);
+    const WH_SETTINGS* GetSettings(PCWSTR prefix, va_list args);
+    void FreeSettings(const WH_SETTINGS* settings);
 
     BOOL SetFunctionHook(void* targetFunction,
                          void* hookFunction,
                          void** originalFunction);
+    BOOL HookImport(HMODULE module,
+                    PCSTR dllName,
+                    PCSTR functionName,
+                    void* hookFunction,
+                    void** originalFunction);
     BOOL RemoveFunctionHook(void* targetFunction);
     BOOL ApplyHookOperations();
 
@@ -70,35 +121,263 @@ class LoadedMod {
     BOOL FindNextSymbol(HANDLE symSearch, BYTE* findData);
     BOOL FindNextSymbol2(HANDLE symSearch, WH_FIND_SYMBOL* findData);
     void FindCloseSymbol(HANDLE symSearch);
+    size_t GetSymbolFromAddress(HMODULE module,
+                                const void* address,
+                                PWSTR nameBuffer,
+                                size_t bufferChars,
+                                size_t* offset);
 
     BOOL HookSymbols(HMODULE module,
                      const WH_SYMBOL_HOOK* symbolHooks,
                      size_t symbolHooksCount,
                      const WH_HOOK_SYMBOLS_OPTIONS* options);
+    BOOL HookSymbolsBatch(const WH_HOOK_SYMBOLS_BATCH_ITEM* items,
+                          size_t itemsCount,
+                          const WH_HOOK_SYMBOLS_OPTIONS* options);
 
     BOOL Disasm(void* address, WH_DISASM_RESULT* result);
+    size_t DisasmRange(void* address,
+                       size_t size,
+                       WH_DISASM_RESULT* results,
+                       size_t resultsCount,
+                       DWORD flags);
+    void* FindPattern(HMODULE module,
+                      const void* pattern,
+                      const void* mask,
+                      size_t patternSize,
+                      const WH_FIND_PATTERN_OPTIONS* options);
 
     const WH_URL_CONTENT* GetUrlContent(
         PCWSTR url,
         const WH_GET_URL_CONTENT_OPTIONS* options);
     void FreeUrlContent(const WH_URL_CONTENT* content);
+    HANDLE GetUrlContentAsync(PCWSTR url,
+                              const WH_GET_URL_CONTENT_ASYNC_OPTIONS* options,
+                              WH_URL_CONTENT_CALLBACK callback,
+                              void* context);
+    BOOL CancelUrlContentAsync(HANDLE request);
+
+    HANDLE RegisterModuleLoadCallback(PCWSTR moduleName,
+                                      WH_MODULE_LOAD_CALLBACK callback,
+                                      void* context);
+    BOOL UnregisterModuleLoadCallback(HANDLE registration);
+
+    BOOL QueueWork(WH_THREAD_POOL_CALLBACK callback, void* context);
+    HANDLE CreateTimer(WH_THREAD_POOL_CALLBACK callback,
+                       void* context,
+                       DWORD dueTime,
+                       DWORD period);
+    BOOL SetTimer(HANDLE timer, DWORD dueTime, DWORD period);
+    BOOL CloseTimer(HANDLE timer);
+
+    BOOL RunOnThread(DWORD threadId,
+                     WH_RUN_ON_THREAD_CALLBACK callback,
+                     void* context,
+                     DWORD timeout);
+
+    const WH_SHARED_MEMORY* OpenSharedMemory(PCWSTR name, size_t size);
+    void CloseSharedMemory(const WH_SHARED_MEMORY* sharedMemory);
+    // Shared memory is named in the private namespace of the session
+    // manager, so it isn't shared with the processes of a new session manager
+    // which took over the session.
+    bool HasSharedMemory();
+
+    HANDLE ArenaCreate(size_t maxSize);
+    void* ArenaAlloc(HANDLE arena, size_t size, size_t alignment);
+    BOOL ArenaReset(HANDLE arena);
+    BOOL ArenaDestroy(HANDLE arena);
+
+    HANDLE SubscribeVisualTreeChanges(const WH_VISUAL_TREE_OPTIONS* options,
+                                      WH_VISUAL_TREE_CALLBACK callback,
+                                      void* context);
+    BOOL UnsubscribeVisualTreeChanges(HANDLE subscription);
 
    private:
+    // The lifecycle callbacks exported by the mod, resolved once on load. Each
+    // one is optional.
+    struct ModCallbacks {
+        BOOL(__cdecl* init)();
+        void(__cdecl* afterInit)();
+        void(__cdecl* beforeUninit)();
+        void(__cdecl* uninit)();
+        BOOL(__cdecl* settingsChangedEx2)(BOOL* reload,
+                                          const WH_SETTINGS* changedSettings);
+        BOOL(__cdecl* settingsChangedEx)(BOOL* reload);
+        void(__cdecl* settingsChanged)();
+        BOOL(__cdecl* reinit)();
+    };
+
+    HANDLE FindFirstSymbolInternal(
+        HMODULE hModule,
+        const WH_FIND_SYMBOL_OPTIONS* options,
+        WH_FIND_SYMBOL* findData,
+        std::vector<std::wstring> nameIdentifiers,
+        bool publicSymbolsOnly = false,
+        SymbolResolutionTrace* trace = nullptr);
+
+    // If deferredHooks is set, the resolved hooks are appended to it instead of
+    // being set. Records a trace if enabled, see SymbolResolutionTrace.
+    BOOL HookSymbolsInternal(HMODULE module,
+                             const WH_SYMBOL_HOOK* symbolHooks,
+                             size_t symbolHooksCount,
+                             const WH_HOOK_SYMBOLS_OPTIONS* options,
+                             std::vector<PendingHook>* deferredHooks);
+    BOOL HookSymbolsWithTrace(HMODULE module,
+                              const WH_SYMBOL_HOOK* symbolHooks,
+                              size_t symbolHooksCount,
+                              const WH_HOOK_SYMBOLS_OPTIONS* options,
+                              std::vector<PendingHook>* deferredHooks,
+                              SymbolResolutionTrace* trace);
     std::optional<std::wstring> HookSymbolsGetOnlineCache(
         PCWSTR onlineCacheBaseUrl,
         std::wstring_view cacheStrKey);
+    std::optional<std::wstring> HookSymbolsGetOnlineCacheFromManifest(
+        const std::wstring& onlineCacheUrl,
+        std::wstring_view cacheStrKey,
+        const std::function<bool()>& queryCancel);
+
+    // Cheap enough to be called often, e.g. from the symbol server callbacks.
+    bool ShouldCancelLongOperations();
+
+    // While the mods are loaded from an APC, the process can't start before
+    // Wh_ModInit returns. Called by HookSymbols, returns true if the
+    // initialization should be abandoned, either since the time budget is
+    // exceeded, or since a slow operation, such as a symbol load, is about to
+    // start. Once it returns true, it keeps returning true.
+    bool ShouldDeferInit(bool slowOperationAhead);
+
+    void UnregisterAllModuleLoadCallbacks();
+    void UnregisterAllVisualTreeCallbacks();
+
+    // A request of Wh_GetUrlContentAsync, run by a thread pool callback which
+    // completes it and removes it from m_urlContentRequests.
+    struct UrlContentRequest {
+        LoadedMod* mod;
+        UINT64 id;
+        std::wstring url;
+        wil::unique_hfile targetFile;
+        DWORD timeout;
+        WH_URL_DATA_CALLBACK dataCallback;
+        WH_URL_CONTENT_CALLBACK callback;
+        void* context;
+        wil::unique_event cancelEvent{wil::EventOptions::ManualReset};
+    };
+
+    static void CALLBACK UrlContentRequestCallback(
+        PTP_CALLBACK_INSTANCE instance,
+        PVOID context);
+    // Returns null if the request failed or was canceled.
+    const WH_URL_CONTENT* RunUrlContentRequest(
+        const UrlContentRequest& request);
+    // Cancels the pending requests and waits for their callbacks to return.
+    void CancelAllUrlContentRequests();
+
+    struct SharedMemory {
+        WH_SHARED_MEMORY info;
+        wil::unique_handle mapping;
+        wil::unique_mapview_ptr<void> view;
+        wil::unique_event_nothrow event;
+    };
+
+    static constexpr size_t kSharedMemoryNameMaxLength = 64;
+    // The time a mod can spend in Wh_ModInit while the process start is
+    // blocked by the APC which loads the mods.
+    static constexpr ULONGLONG kApcInitTimeBudgetMs = 500;
+    static constexpr size_t kArenaDefaultSize = 1024 * 1024;
+
+    // The values of the mod's settings by lowercase name, since names are
+    // case-insensitive. Loaded from storage on first use after the mod is
+    // loaded and after each settings change, and immutable once loaded.
+    struct SettingValue {
+        // As stored, not lowercase.
+        std::wstring name;
+        std::wstring value;
+    };
+    using SettingsValues = std::unordered_map<std::wstring, SettingValue>;
+    std::shared_ptr<const SettingsValues> GetSettingsValues();
+    std::optional<std::wstring> GetSettingValue(PCWSTR valueName,
+                                                va_list args);
+    // The settings which were added, changed or removed, with the current
+    // values, or null values for removed ones. Freed with FreeSettings.
+    static const WH_SETTINGS* MakeChangedSettings(
+        const SettingsValues& previous,
+        const SettingsValues& current);
+
+    // Updates of a task are coalesced and written at most once per
+    // kModTaskUpdateIntervalMs, since progress callbacks, such as the symbol
+    // download progress, can be called very often. Clearing the task is
+    // written right away.
+    static constexpr DWORD kModTaskUpdateIntervalMs = 250;
 
     void SetTask(PCWSTR task);
+    static void CALLBACK ModTaskTimerCallback(PTP_CALLBACK_INSTANCE instance,
+                                              PVOID context,
+                                              PTP_TIMER timer);
     void LogFunctionError(const std::exception& e);
 
     std::wstring m_modName;
-    std::wstring m_modInstanceId;
-    wil::unique_hfile m_modTaskFile;
+    std::mutex m_modTaskMutex;
+    ModStatusTable::Entry m_modTask;
+    ModLoadTimes m_loadTimes;
+    // The latest task which wasn't written yet.
+    std::optional<std::wstring> m_modTaskPending;
+    ULONGLONG m_modTaskLastWriteTickCount = 0;
+    bool m_modTaskTimerSet = false;
+    wil::unique_threadpool_timer m_modTaskTimer;
+    std::mutex m_onlineCacheManifestMutex;
+    // Set once the manifest was fetched, even if it failed or wasn't found.
+    std::optional<std::unordered_map<std::wstring, std::wstring>>
+        m_onlineCacheManifest;
+    LocalStorageBuffer m_localStorage;
+    // Only set if enabled in the engine settings.
+    std::optional<HookCallStats> m_hookCallStats;
+    // The ModCpuSampler registration, zero if not registered.
+    UINT64 m_cpuSamplerId = 0;
+    std::mutex m_moduleLoadCallbacksMutex;
+    // IDs of the ModuleLoadNotifier registrations.
+    std::unordered_set<UINT64> m_moduleLoadCallbacks;
+    std::mutex m_visualTreeCallbacksMutex;
+    // IDs of the VisualTreeNotifier registrations.
+    std::unordered_set<UINT64> m_visualTreeCallbacks;
+    std::mutex m_urlContentRequestsMutex;
+    std::condition_variable m_urlContentRequestsDone;
+    std::unordered_map<UINT64, std::unique_ptr<UrlContentRequest>>
+        m_urlContentRequests;
+    UINT64 m_urlContentRequestsLastId = 0;
+    bool m_urlContentRequestsClosed = false;
+    ModThreadPool m_threadPool;
+    std::mutex m_sharedMemoriesMutex;
+    // Keyed by the address of the info returned to the mod. Any which the mod
+    // didn't close are closed when the mod is freed.
+    std::unordered_map<const WH_SHARED_MEMORY*, std::unique_ptr<SharedMemory>>
+        m_sharedMemories;
+    std::mutex m_arenasMutex;
+    // Declared before the mod module, so that arenas which the mod didn't
+    // destroy are only freed after the module is unloaded, in case static
+    // destructors of the mod use them.
+    std::unordered_map<HANDLE, std::unique_ptr<ModArena>> m_arenas;
+    std::mutex m_settingsValuesMutex;
+    std::shared_ptr<const SettingsValues> m_settingsValues;
     bool m_loadedOnStartup;
     std::atomic<bool> m_loggingEnabled = false;
     std::atomic<bool> m_debugLoggingEnabled = false;
+    LogRateLimiter m_logRateLimiter;
     std::atomic<bool> m_initialized = false;
+    ULONGLONG m_initStartTickCount = 0;
+    bool m_initDeferred = false;
     std::atomic<bool> m_uninitializing = false;
+    std::atomic<bool> m_deferHookOperations = false;
+    std::atomic<bool> m_hookOperationsDeferred = false;
+    std::atomic<bool> m_softReloading = false;
+    std::atomic<bool> m_softReloadFailed = false;
+    // Signaled by CancelLongOperations, or once the mod was found to be
+    // disabled before it's initialized.
+    wil::unique_event m_cancelEvent{wil::EventOptions::ManualReset};
+    std::atomic<DWORD> m_lastCancelConfigCheckTick = GetTickCount();
+    // The hooks which were set, by target, to recognize a hook which is set
+    // again on a soft reload. Only kept if the mod can be soft reloaded.
+    std::mutex m_setHooksMutex;
+    std::unordered_map<void*, PendingHook> m_setHooks;
 
     // Temporary compatibility flag.
     const bool m_compatDemangling = false;
@@ -107,6 +386,7 @@ class LoadedMod {
     wil::unique_hmodule m_modShimLibrary;
 
     wil::unique_hmodule m_modModule;
+    ModCallbacks m_modCallbacks{};
 };
 
 class Mod {
@@ -118,19 +398,49 @@ class Mod {
     void BeforeUninit();
     void Uninitialize();
     bool ApplyChangedSettings(bool* reload);
+    void FinishDeferredHookOperations();
+    void QueueSetHooksPaused(bool paused);
+    void CancelLongOperations() noexcept;
+    // Called after a new session manager took over the session. A mod which
+    // uses objects named in the private namespace of the previous one is
+    // loaded again on the next reload.
+    void OnSessionManagerChanged();
     void Unload();
 
     HMODULE GetLoadedModModuleHandle();
+    // Shown in the log of the mod, e.g. in the editor, after a new build of
+    // the mod replaced the previous one in this process.
+    void LogReloaded(ULONGLONG milliseconds);
+
+    // If the mod wasn't loaded since none of the modules it's loaded with is
+    // loaded yet, returns these modules, separated by '|'.
+    const std::wstring& GetWaitingForModules() const {
+        return m_waitingForModules;
+    }
+
+    // If the mod wasn't loaded since its initialization didn't fit the time
+    // budget of the process start, returns true. The mod is loaded again on
+    // the next reload, which doesn't block the process.
+    bool IsInitDeferred() const { return m_initDeferred; }
 
     static bool ShouldLoadInRunningProcess(PCWSTR modName);
+    static bool ShouldLoadInRunningProcess(
+        const ModConfigSnapshot::ModConfig& modConfig);
+
+    // Returns the mod config snapshot published by the session manager, or
+    // nullptr if the mod configs should be read from storage.
+    static std::shared_ptr<const ModConfigSnapshot::Snapshot>
+    GetModConfigSnapshot() noexcept;
 
    private:
     void SetStatus(PCWSTR status);
 
     std::wstring m_modName;
-    std::wstring m_modInstanceId;
-    wil::unique_hfile m_modStatusFile;
+    ModStatusTable::Entry m_modStatus;
     std::wstring m_libraryFileName;
     int m_settingsChangeTime = 0;
+    std::wstring m_waitingForModules;
+    bool m_initDeferred = false;
+    bool m_reloadForSessionManager = false;
     std::unique_ptr<LoadedMod> m_loadedMod;
 };
@@ -0,0 +1,86 @@
+#include "stdafx.h"
+
+#include "mod_arena.h"
+
+ModArena::ModArena(size_t reserveSize) {
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+
+    size_t granularity = systemInfo.dwAllocationGranularity;
+    if (reserveSize > SIZE_MAX - granularity) {
+        throw std::invalid_argument("The arena size is too large");
+    }
+
+    m_reserveSize = (reserveSize + granularity - 1) / granularity * granularity;
+
+    m_base.reset(static_cast<BYTE*>(
+        VirtualAlloc(nullptr, m_reserveSize, MEM_RESERVE, PAGE_READWRITE)));
+    THROW_LAST_ERROR_IF_NULL(m_base);
+}
+
+void* ModArena::Alloc(size_t size, size_t alignment) noexcept {
+    if (alignment == 0) {
+        alignment = MEMORY_ALLOCATION_ALIGNMENT;
+    } else if ((alignment & (alignment - 1)) != 0 ||
+               alignment > kMaxAlignment) {
+        return nullptr;
+    }
+
+    size_t offset = m_offset.load(std::memory_order_relaxed);
+    size_t alignedOffset;
+    size_t end;
+    do {
+        alignedOffset = (offset + alignment - 1) & ~(alignment - 1);
+        if (alignedOffset < offset || alignedOffset > m_reserveSize ||
+            size > m_reserveSize - alignedOffset) {
+            return nullptr;
+        }
+
+        end = alignedOffset + size;
+    } while (!m_offset.compare_exchange_weak(offset, end,
+                                             std::memory_order_relaxed));
+
+    // If committing fails, the range stays allocated but unusable, which only
+    // wastes address space until the arena is reset.
+    if (end > m_committedSize.load(std::memory_order_acquire) &&
+        !Commit(end)) {
+        return nullptr;
+    }
+
+    return m_base.get() + alignedOffset;
+}
+
+void ModArena::Reset() {
+    std::lock_guard guard(m_commitMutex);
+
+    m_offset = 0;
+
+    size_t committedSize = m_committedSize;
+    if (committedSize > kCommitChunkSize) {
+        VirtualFree(m_base.get() + kCommitChunkSize,
+                    committedSize - kCommitChunkSize, MEM_DECOMMIT);
+        m_committedSize = kCommitChunkSize;
+    }
+}
+
+bool ModArena::Commit(size_t size) noexcept {
+    std::lock_guard guard(m_commitMutex);
+
+    size_t committedSize = m_committedSize.load(std::memory_order_relaxed);
+    if (size <= committedSize) {
+        return true;
+    }
+
+    size_t newCommittedSize =
+        std::min((size + kCommitChunkSize - 1) / kCommitChunkSize *
+                     kCommitChunkSize,
+                 m_reserveSize);
+    if (!VirtualAlloc(m_base.get() + committedSize,
+                      newCommittedSize - committedSize, MEM_COMMIT,
+                      PAGE_READWRITE)) {
+        return false;
+    }
+
+    m_committedSize.store(newCommittedSize, std::memory_order_release);
+    return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+// A bump allocator over a range of address space which is reserved up front
+// and committed as it's used, so that allocating is a single interlocked
+// operation in the common case, and freeing is done at once by resetting or
+// destroying the arena. Unlike the CRT heap of a mod, the memory is returned
+// to the system when the arena is reset or destroyed.
+class ModArena {
+   public:
+    // The base address is aligned to the allocation granularity, which is at
+    // least this.
+    static constexpr size_t kMaxAlignment = 64 * 1024;
+
+    explicit ModArena(size_t reserveSize);
+
+    ModArena(const ModArena&) = delete;
+    ModArena& operator=(const ModArena&) = delete;
+
+    // Can be called concurrently. The alignment must be a power of two up to
+    // kMaxAlignment, or zero for MEMORY_ALLOCATION_ALIGNMENT. Returns nullptr
+    // if the arena is full, or if committing the memory fails.
+    void* Alloc(size_t size, size_t alignment) noexcept;
+    // Frees all allocations. Must not be called concurrently with Alloc. The
+    // first chunk stays committed, so the memory returned by Alloc isn't
+    // necessarily zeroed.
+    void Reset();
+
+   private:
+    static constexpr size_t kCommitChunkSize = 64 * 1024;
+
+    bool Commit(size_t size) noexcept;
+
+    wil::unique_virtualalloc_ptr<BYTE> m_base;
+    size_t m_reserveSize;
+    std::atomic<size_t> m_offset = 0;
+    std::atomic<size_t> m_committedSize = 0;
+    std::mutex m_commitMutex;
+};
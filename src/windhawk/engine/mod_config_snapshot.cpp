@@ -0,0 +1,723 @@
+#include "stdafx.h"
+
+#include "functions.h"
+#include "logger.h"
+#include "mod_config_snapshot.h"
+#include "no_destructor.h"
+#include "session_private_namespace.h"
+#include "var_init_once.h"
+
+namespace {
+
+// The snapshot is only written by the session manager when the config
+// changes, so a reader rarely has to retry.
+constexpr int kMaxReadAttempts = 16;
+
+class SnapshotWriter {
+   public:
+    void WriteDword(DWORD value) {
+        auto* bytes = reinterpret_cast<const BYTE*>(&value);
+        m_data.insert(m_data.end(), bytes, bytes + sizeof(value));
+    }
+
+    void WriteQword(ULONGLONG value) {
+        auto* bytes = reinterpret_cast<const BYTE*>(&value);
+        m_data.insert(m_data.end(), bytes, bytes + sizeof(value));
+    }
+
+    void WriteString(const std::wstring& value) {
+        WriteDword(wil::safe_cast<DWORD>(value.length()));
+        auto* bytes = reinterpret_cast<const BYTE*>(value.data());
+        m_data.insert(m_data.end(), bytes,
+                      bytes + value.length() * sizeof(WCHAR));
+    }
+
+    void WriteSnapshot(const ModConfigSnapshot::Snapshot& snapshot) {
+        WriteDword(snapshot.generation);
+        WriteDword(snapshot.broadcastGeneration);
+        WriteQword(static_cast<ULONGLONG>(snapshot.publishTime));
+        WriteDword(wil::safe_cast<DWORD>(snapshot.mods.size()));
+        for (const auto& modConfig : snapshot.mods) {
+            WriteModConfig(modConfig);
+        }
+    }
+
+    std::vector<BYTE>& GetData() { return m_data; }
+
+   private:
+    void WriteModConfig(const ModConfigSnapshot::ModConfig& modConfig) {
+        WriteString(modConfig.name);
+        WriteDword(modConfig.disabled);
+        WriteString(modConfig.architecture);
+        WriteDword(modConfig.patternsMatchCriticalSystemProcesses);
+        WriteDword(modConfig.includeExcludeCustomOnly);
+        WriteString(modConfig.include);
+        WriteString(modConfig.includeCustom);
+        WriteString(modConfig.exclude);
+        WriteString(modConfig.excludeCustom);
+        WriteString(modConfig.libraryFileName);
+        WriteString(modConfig.version);
+        WriteDword(static_cast<DWORD>(modConfig.settingsChangeTime));
+        WriteDword(modConfig.loggingEnabled);
+        WriteDword(modConfig.debugLoggingEnabled);
+        WriteString(modConfig.loadWithModule);
+        WriteDword(modConfig.atomicReconfigure);
+        WriteDword(modConfig.generation);
+    }
+
+    std::vector<BYTE> m_data;
+};
+
+class SnapshotReader {
+   public:
+    explicit SnapshotReader(const std::vector<BYTE>& data)
+        : m_data(data.data()), m_remaining(data.size()) {}
+
+    ModConfigSnapshot::Snapshot ReadSnapshot() {
+        ModConfigSnapshot::Snapshot snapshot;
+        snapshot.generation = ReadDword();
+        snapshot.broadcastGeneration = ReadDword();
+        snapshot.publishTime = static_cast<LONGLONG>(ReadQword());
+        DWORD count = ReadDword();
+        for (DWORD i = 0; i < count; i++) {
+            snapshot.mods.push_back(ReadModConfig());
+        }
+
+        return snapshot;
+    }
+
+   private:
+    DWORD ReadDword() {
+        DWORD value;
+        memcpy(&value, Consume(sizeof(value)), sizeof(value));
+        return value;
+    }
+
+    ULONGLONG ReadQword() {
+        ULONGLONG value;
+        memcpy(&value, Consume(sizeof(value)), sizeof(value));
+        return value;
+    }
+
+    std::wstring ReadString() {
+        size_t length = ReadDword();
+        if (length > m_remaining / sizeof(WCHAR)) {
+            throw std::runtime_error("Malformed mod config snapshot");
+        }
+
+        std::wstring value(length, L'\0');
+        memcpy(value.data(), Consume(length * sizeof(WCHAR)),
+               length * sizeof(WCHAR));
+        return value;
+    }
+
+    ModConfigSnapshot::ModConfig ReadModConfig() {
+        ModConfigSnapshot::ModConfig modConfig;
+        modConfig.name = ReadString();
+        modConfig.disabled = !!ReadDword();
+        modConfig.architecture = ReadString();
+        modConfig.patternsMatchCriticalSystemProcesses = !!ReadDword();
+        modConfig.includeExcludeCustomOnly = !!ReadDword();
+        modConfig.include = ReadString();
+        modConfig.includeCustom = ReadString();
+        modConfig.exclude = ReadString();
+        modConfig.excludeCustom = ReadString();
+        modConfig.libraryFileName = ReadString();
+        modConfig.version = ReadString();
+        modConfig.settingsChangeTime = static_cast<int>(ReadDword());
+        modConfig.loggingEnabled = !!ReadDword();
+        modConfig.debugLoggingEnabled = !!ReadDword();
+        modConfig.loadWithModule = ReadString();
+        modConfig.atomicReconfigure = !!ReadDword();
+        modConfig.generation = ReadDword();
+        return modConfig;
+    }
+
+    const BYTE* Consume(size_t size) {
+        if (size > m_remaining) {
+            throw std::runtime_error("Malformed mod config snapshot");
+        }
+
+        const BYTE* p = m_data;
+        m_data += size;
+        m_remaining -= size;
+        return p;
+    }
+
+    const BYTE* m_data;
+    size_t m_remaining;
+};
+
+bool HasSameLoadValues(const ModConfigSnapshot::ModConfig& a,
+                       const ModConfigSnapshot::ModConfig& b) {
+    return a.libraryFileName == b.libraryFileName && a.version == b.version &&
+           a.settingsChangeTime == b.settingsChangeTime &&
+           a.loggingEnabled == b.loggingEnabled &&
+           a.debugLoggingEnabled == b.debugLoggingEnabled &&
+           a.loadWithModule == b.loadWithModule &&
+           a.atomicReconfigure == b.atomicReconfigure;
+}
+
+const ModConfigSnapshot::ModConfig* FindModConfig(
+    const ModConfigSnapshot::Mods& mods,
+    const std::wstring& modName) {
+    for (const auto& modConfig : mods) {
+        if (modConfig.name == modName) {
+            return &modConfig;
+        }
+    }
+
+    return nullptr;
+}
+
+}  // namespace
+
+// Opens the shared memory of the session manager once per process, and keeps
+// the last parsed snapshot until a newer one is published. Only the first
+// session manager is supported, a view is never replaced since it might be in
+// use by other threads.
+class ModConfigSnapshot::Cache {
+   public:
+    std::shared_ptr<const Snapshot> Get(
+        DWORD sessionManagerProcessId) noexcept {
+        std::lock_guard guard(m_mutex);
+
+        if (!m_opened) {
+            m_opened = true;
+            m_sessionManagerProcessId = sessionManagerProcessId;
+            Open();
+        }
+
+        if (sessionManagerProcessId != m_sessionManagerProcessId ||
+            !m_view) {
+            return nullptr;
+        }
+
+        const SharedHeader* header = m_view.get();
+        auto data = reinterpret_cast<const BYTE*>(header + 1);
+
+        try {
+            for (int attempt = 0; attempt < kMaxReadAttempts; attempt++) {
+                LONG sequence = ReadAcquire(&header->sequence);
+                if (sequence & 1) {
+                    Sleep(0);
+                    continue;
+                }
+
+                if (m_snapshot && sequence == m_sequence) {
+                    return m_snapshot;
+                }
+
+                DWORD dataSize = header->dataSize;
+                if (dataSize == kDataUnavailable) {
+                    return nullptr;
+                }
+
+                if (dataSize > kMaxDataSize) {
+                    throw std::runtime_error("Malformed mod config snapshot");
+                }
+
+                std::vector<BYTE> dataCopy(data, data + dataSize);
+
+                MemoryBarrier();
+                if (ReadAcquire(&header->sequence) != sequence) {
+                    continue;
+                }
+
+                SnapshotReader reader(dataCopy);
+                m_snapshot = std::make_shared<Snapshot>(reader.ReadSnapshot());
+                m_sequence = sequence;
+                return m_snapshot;
+            }
+
+            VERBOSE(L"Mod config snapshot is being written, giving up");
+        } catch (const std::exception& e) {
+            LOG(L"Error reading mod config snapshot: %S", e.what());
+        }
+
+        return nullptr;
+    }
+
+   private:
+    void Open() noexcept {
+        try {
+            m_mapping.reset(OpenFileMapping(
+                FILE_MAP_READ, FALSE,
+                MakeMappingName(m_sessionManagerProcessId).c_str()));
+            if (!m_mapping) {
+                VERBOSE(L"OpenFileMapping error: %u", GetLastError());
+                return;
+            }
+
+            wil::unique_mapview_ptr<const SharedHeader> view(
+                reinterpret_cast<const SharedHeader*>(
+                    MapViewOfFile(m_mapping.get(), FILE_MAP_READ, 0, 0,
+                                  sizeof(SharedHeader) + kMaxDataSize)));
+            if (!view) {
+                VERBOSE(L"MapViewOfFile error: %u", GetLastError());
+                return;
+            }
+
+            if (view->version != kVersion) {
+                VERBOSE(L"Unsupported mod config snapshot version %u",
+                        view->version);
+                return;
+            }
+
+            m_view = std::move(view);
+        } catch (const std::exception& e) {
+            VERBOSE(L"Error: %S", e.what());
+        }
+    }
+
+    std::mutex m_mutex;
+    bool m_opened = false;
+    DWORD m_sessionManagerProcessId = 0;
+    wil::unique_handle m_mapping;
+    wil::unique_mapview_ptr<const SharedHeader> m_view;
+    LONG m_sequence = 0;
+    std::shared_ptr<const Snapshot> m_snapshot;
+};
+
+// static
+bool ModConfigSnapshot::HasSameTargeting(const ModConfig& a,
+                                         const ModConfig& b) {
+    return a.disabled == b.disabled && a.architecture == b.architecture &&
+           a.patternsMatchCriticalSystemProcesses ==
+               b.patternsMatchCriticalSystemProcesses &&
+           a.includeExcludeCustomOnly == b.includeExcludeCustomOnly &&
+           a.include == b.include && a.includeCustom == b.includeCustom &&
+           a.exclude == b.exclude && a.excludeCustom == b.excludeCustom;
+}
+
+// static
+ModConfigSnapshot::ModConfig ModConfigSnapshot::ReadModConfigFromStorage(
+    PCWSTR modName) {
+    auto settings =
+        StorageManager::GetInstance().GetModConfig(modName, nullptr)->ReadAll();
+
+    return {
+        .name = modName,
+        .disabled = !!settings.GetInt(L"Disabled").value_or(0),
+        .architecture = settings.GetString(L"Architecture").value_or(L""),
+        .patternsMatchCriticalSystemProcesses =
+            !!settings.GetInt(L"PatternsMatchCriticalSystemProcesses")
+                  .value_or(0),
+        .includeExcludeCustomOnly =
+            !!settings.GetInt(L"IncludeExcludeCustomOnly").value_or(0),
+        .include = settings.GetString(L"Include").value_or(L""),
+        .includeCustom = settings.GetString(L"IncludeCustom").value_or(L""),
+        .exclude = settings.GetString(L"Exclude").value_or(L""),
+        .excludeCustom = settings.GetString(L"ExcludeCustom").value_or(L""),
+        .libraryFileName = settings.GetString(L"LibraryFileName").value_or(L""),
+        .version = settings.GetString(L"Version").value_or(L""),
+        .settingsChangeTime =
+            settings.GetInt(L"SettingsChangeTime").value_or(0),
+        .loggingEnabled = !!settings.GetInt(L"LoggingEnabled").value_or(0),
+        .debugLoggingEnabled =
+            !!settings.GetInt(L"DebugLoggingEnabled").value_or(0),
+        .loadWithModule = settings.GetString(L"LoadWithModule").value_or(L""),
+        .atomicReconfigure =
+            !!settings.GetInt(L"AtomicReconfigure").value_or(0),
+        .generation = 0,
+    };
+}
+
+// static
+std::shared_ptr<const ModConfigSnapshot::Snapshot> ModConfigSnapshot::Get(
+    DWORD sessionManagerProcessId) noexcept {
+    STATIC_INIT_ONCE(NoDestructorIfTerminating<Cache>, cache);
+    return (**cache).Get(sessionManagerProcessId);
+}
+
+ModConfigSnapshot::Publisher::Publisher() {
+    wil::unique_hlocal secDesc;
+    THROW_IF_WIN32_BOOL_FALSE(
+        Functions::GetFullAccessSecurityDescriptor(&secDesc, nullptr));
+
+    SECURITY_ATTRIBUTES secAttr = {sizeof(SECURITY_ATTRIBUTES)};
+    secAttr.lpSecurityDescriptor = secDesc.get();
+    secAttr.bInheritHandle = FALSE;
+
+    m_mapping.reset(CreateFileMapping(
+        INVALID_HANDLE_VALUE, &secAttr, PAGE_READWRITE, 0,
+        sizeof(SharedHeader) + kMaxDataSize,
+        MakeMappingName(GetCurrentProcessId()).c_str()));
+    THROW_LAST_ERROR_IF(!m_mapping || GetLastError() == ERROR_ALREADY_EXISTS);
+
+    m_view.reset(MapViewOfFile(m_mapping.get(), FILE_MAP_WRITE, 0, 0,
+                               sizeof(SharedHeader) + kMaxDataSize));
+    THROW_LAST_ERROR_IF(!m_view);
+
+    // The rest of the memory is zero-initialized.
+    static_cast<SharedHeader*>(m_view.get())->version = kVersion;
+
+    // Created before the first snapshot, so that no change is missed.
+    m_modConfigChangeNotification.emplace();
+    if (!m_modConfigChangeNotification->CanMonitorAcrossThreads()) {
+        throw std::runtime_error(
+            "Mod config changes can't be monitored from a thread pool");
+    }
+
+    Publish();
+
+    m_wait.reset(CreateThreadpoolWait(WaitCallback, this, nullptr));
+    THROW_LAST_ERROR_IF_NULL(m_wait);
+
+    SetThreadpoolWait(m_wait.get(), m_modConfigChangeNotification->GetHandle(),
+                      nullptr);
+}
+
+// static
+void CALLBACK
+ModConfigSnapshot::Publisher::WaitCallback(PTP_CALLBACK_INSTANCE instance,
+                                           PVOID context,
+                                           PTP_WAIT wait,
+                                           TP_WAIT_RESULT waitResult) {
+    auto* this_ = static_cast<Publisher*>(context);
+
+    // Wait for a bit in case more config changes follow.
+    Sleep(200);
+
+    try {
+        this_->m_modConfigChangeNotification->ContinueMonitoring();
+    } catch (const std::exception& e) {
+        LOG(L"ContinueMonitoring failed: %S", e.what());
+
+        auto* header = static_cast<SharedHeader*>(this_->m_view.get());
+        header->monitoringStopped = TRUE;
+        this_->Publish();
+        return;
+    }
+
+    this_->Publish();
+
+    SetThreadpoolWait(wait, this_->m_modConfigChangeNotification->GetHandle(),
+                      nullptr);
+}
+
+void ModConfigSnapshot::Publisher::Publish() noexcept {
+    auto* header = static_cast<SharedHeader*>(m_view.get());
+    auto* data = reinterpret_cast<BYTE*>(header + 1);
+
+    Snapshot snapshot{
+        .generation = m_snapshot.generation + 1,
+        .broadcastGeneration = m_snapshot.broadcastGeneration,
+    };
+
+    SnapshotWriter writer;
+    wil::unique_event_nothrow nextGenerationEvent;
+    wil::unique_event_nothrow nextBroadcastGenerationEvent;
+    std::unordered_map<std::wstring, wil::unique_event_nothrow>
+        nextModGenerationEvents;
+
+    bool dataAvailable = !header->monitoringStopped;
+    if (dataAvailable) {
+        try {
+            StorageManager::GetInstance().EnumMods([&snapshot](PCWSTR modName) {
+                snapshot.mods.push_back(ReadModConfigFromStorage(modName));
+            });
+
+            bool broadcast = false;
+
+            for (auto& modConfig : snapshot.mods) {
+                const ModConfig* previous =
+                    FindModConfig(m_snapshot.mods, modConfig.name);
+                if (previous && HasSameTargeting(*previous, modConfig) &&
+                    HasSameLoadValues(*previous, modConfig)) {
+                    modConfig.generation = previous->generation;
+                    continue;
+                }
+
+                modConfig.generation = snapshot.generation;
+
+                // A disabled mod only affects the processes it's loaded in.
+                if (!modConfig.disabled &&
+                    (!previous || !HasSameTargeting(*previous, modConfig))) {
+                    broadcast = true;
+                }
+            }
+
+            if (broadcast) {
+                snapshot.broadcastGeneration = snapshot.generation;
+            }
+
+            LARGE_INTEGER publishCounter;
+            QueryPerformanceCounter(&publishCounter);
+            snapshot.publishTime = publishCounter.QuadPart;
+
+            writer.WriteSnapshot(snapshot);
+            if (writer.GetData().size() > kMaxDataSize) {
+                throw std::runtime_error("Mod config snapshot is too large");
+            }
+
+            wil::unique_hlocal secDesc;
+            THROW_IF_WIN32_BOOL_FALSE(
+                Functions::GetFullAccessSecurityDescriptor(&secDesc, nullptr));
+
+            SECURITY_ATTRIBUTES secAttr = {sizeof(SECURITY_ATTRIBUTES)};
+            secAttr.lpSecurityDescriptor = secDesc.get();
+            secAttr.bInheritHandle = FALSE;
+
+            // The events must exist before the snapshot is published, since
+            // that's when the engines start waiting for them.
+            auto createEvent = [&secAttr](const std::wstring& name) {
+                wil::unique_event_nothrow event(
+                    CreateEvent(&secAttr, TRUE, FALSE, name.c_str()));
+                THROW_LAST_ERROR_IF_NULL(event);
+                return event;
+            };
+
+            DWORD currentProcessId = GetCurrentProcessId();
+
+            nextGenerationEvent = createEvent(MakeEventName(
+                currentProcessId, L"Changed", snapshot.generation));
+
+            if (broadcast) {
+                nextBroadcastGenerationEvent = createEvent(MakeEventName(
+                    currentProcessId, L"Broadcast", snapshot.generation));
+            }
+
+            for (const auto& modConfig : snapshot.mods) {
+                if (modConfig.generation == snapshot.generation) {
+                    nextModGenerationEvents.try_emplace(
+                        modConfig.name,
+                        createEvent(MakeEventName(
+                            currentProcessId, L"ModChanged",
+                            snapshot.generation, modConfig.name.c_str())));
+                }
+            }
+        } catch (const std::exception& e) {
+            // Engines which fail to open the events fall back to monitoring
+            // the changes by themselves, stop publishing for consistency.
+            LOG(L"Error creating mod config snapshot: %S", e.what());
+            header->monitoringStopped = TRUE;
+            dataAvailable = false;
+            nextGenerationEvent.reset();
+            nextBroadcastGenerationEvent.reset();
+            nextModGenerationEvents.clear();
+        }
+    }
+
+    InterlockedIncrement(&header->sequence);
+
+    if (dataAvailable) {
+        const auto& bytes = writer.GetData();
+        memcpy(data, bytes.data(), bytes.size());
+        header->dataSize = static_cast<DWORD>(bytes.size());
+    } else {
+        header->dataSize = kDataUnavailable;
+    }
+
+    InterlockedIncrement(&header->sequence);
+
+    // Wake up the engines which wait for the previous generations.
+    auto signalAndReplace = [](wil::unique_event_nothrow& event,
+                               wil::unique_event_nothrow nextEvent) {
+        if (event) {
+            SetEvent(event.get());
+        }
+
+        event = std::move(nextEvent);
+    };
+
+    if (!dataAvailable) {
+        // All engines have to wake up and fall back to reading the storage.
+        snapshot = {
+            .generation = snapshot.generation,
+            .broadcastGeneration = snapshot.generation,
+        };
+    }
+
+    signalAndReplace(m_nextGenerationEvent, std::move(nextGenerationEvent));
+
+    if (snapshot.broadcastGeneration != m_snapshot.broadcastGeneration) {
+        signalAndReplace(m_nextBroadcastGenerationEvent,
+                         std::move(nextBroadcastGenerationEvent));
+    }
+
+    for (auto it = m_nextModGenerationEvents.begin();
+         it != m_nextModGenerationEvents.end();) {
+        auto& [modName, event] = *it;
+        const ModConfig* modConfig = FindModConfig(snapshot.mods, modName);
+        if (!modConfig) {
+            // The mod was removed.
+            SetEvent(event.get());
+            it = m_nextModGenerationEvents.erase(it);
+            continue;
+        }
+
+        if (modConfig->generation == snapshot.generation) {
+            SetEvent(event.get());
+            event = std::move(nextModGenerationEvents[modName]);
+            nextModGenerationEvents.erase(modName);
+        }
+
+        ++it;
+    }
+
+    // Events of mods which were added.
+    for (auto& [modName, event] : nextModGenerationEvents) {
+        m_nextModGenerationEvents.try_emplace(modName, std::move(event));
+    }
+
+    m_snapshot = std::move(snapshot);
+}
+
+ModConfigSnapshot::ChangeNotification::ChangeNotification(
+    DWORD sessionManagerProcessId,
+    std::function<bool(const ModConfig&)> isModRelevant)
+    : m_sessionManagerProcessId(sessionManagerProcessId),
+      m_isModRelevant(std::move(isModRelevant)) {
+    ContinueMonitoring();
+}
+
+void ModConfigSnapshot::ChangeNotification::ContinueMonitoring() {
+    m_events.clear();
+    m_handles.clear();
+
+    auto snapshot = Get(m_sessionManagerProcessId);
+    if (!snapshot) {
+        throw std::runtime_error("Mod config snapshot isn't available");
+    }
+
+    std::vector<const ModConfig*> relevantMods;
+    for (const auto& modConfig : snapshot->mods) {
+        if (m_isModRelevant(modConfig)) {
+            relevantMods.push_back(&modConfig);
+        }
+    }
+
+    std::vector<std::wstring> eventNames;
+    if (relevantMods.size() < kMaxHandleCount) {
+        eventNames.push_back(MakeEventName(m_sessionManagerProcessId,
+                                           L"Broadcast",
+                                           snapshot->broadcastGeneration));
+
+        for (const auto* modConfig : relevantMods) {
+            eventNames.push_back(MakeEventName(
+                m_sessionManagerProcessId, L"ModChanged",
+                modConfig->generation, modConfig->name.c_str()));
+        }
+    } else {
+        // Too many mods to wait for each one, wait for any change.
+        eventNames.push_back(MakeEventName(m_sessionManagerProcessId,
+                                           L"Changed", snapshot->generation));
+    }
+
+    for (const auto& eventName : eventNames) {
+        wil::unique_event_nothrow event(
+            OpenEvent(SYNCHRONIZE, FALSE, eventName.c_str()));
+        if (!event) {
+            if (GetLastError() != ERROR_FILE_NOT_FOUND) {
+                THROW_LAST_ERROR();
+            }
+
+            // The event was already signaled and closed, since a newer
+            // generation was published in the meantime. Report the change
+            // right away.
+            m_events.clear();
+            m_handles.clear();
+
+            THROW_IF_WIN32_BOOL_FALSE(event.try_create(
+                wil::EventOptions::ManualReset | wil::EventOptions::Signaled,
+                nullptr));
+            m_handles.push_back(event.get());
+            m_events.push_back(std::move(event));
+            return;
+        }
+
+        m_handles.push_back(event.get());
+        m_events.push_back(std::move(event));
+    }
+}
+
+ModConfigSnapshot::StorageChangeFilter::StorageChangeFilter(
+    std::function<bool(const ModConfig&)> isModRelevant)
+    : m_isModRelevant(std::move(isModRelevant)),
+      m_mods(ReadModsFromStorage()) {}
+
+bool ModConfigSnapshot::StorageChangeFilter::Update() {
+    Mods mods = ReadModsFromStorage();
+
+    bool relevant = false;
+
+    for (const auto& modConfig : mods) {
+        const ModConfig* previous = FindModConfig(m_mods, modConfig.name);
+        if (previous && HasSameTargeting(*previous, modConfig) &&
+            HasSameLoadValues(*previous, modConfig)) {
+            continue;
+        }
+
+        // Might cause the mod to load in the current process, same as a
+        // broadcast change of the publisher.
+        if (!modConfig.disabled &&
+            (!previous || !HasSameTargeting(*previous, modConfig))) {
+            relevant = true;
+            break;
+        }
+
+        if (m_isModRelevant(modConfig) ||
+            (previous && m_isModRelevant(*previous))) {
+            relevant = true;
+            break;
+        }
+    }
+
+    if (!relevant) {
+        for (const auto& previous : m_mods) {
+            if (!FindModConfig(mods, previous.name) &&
+                m_isModRelevant(previous)) {
+                relevant = true;
+                break;
+            }
+        }
+    }
+
+    m_mods = std::move(mods);
+    return relevant;
+}
+
+// static
+ModConfigSnapshot::Mods
+ModConfigSnapshot::StorageChangeFilter::ReadModsFromStorage() {
+    Mods mods;
+    StorageManager::GetInstance().EnumMods([&mods](PCWSTR modName) {
+        mods.push_back(ReadModConfigFromStorage(modName));
+    });
+    return mods;
+}
+
+// static
+std::wstring ModConfigSnapshot::MakeEventName(DWORD sessionManagerProcessId,
+                                              PCWSTR kind,
+                                              DWORD generation,
+                                              PCWSTR modName) {
+    WCHAR szName[SessionPrivateNamespace::kPrivateNamespaceMaxLen + 1];
+    int namePos =
+        SessionPrivateNamespace::MakeName(szName, sessionManagerProcessId);
+
+    std::wstring name(szName, namePos);
+    name += L"\\ModConfigSnapshot";
+    name += kind;
+    name += L"-gen=";
+    name += std::to_wstring(generation);
+    if (modName) {
+        name += L"-mod=";
+        name += modName;
+    }
+
+    return name;
+}
+
+// static
+std::wstring ModConfigSnapshot::MakeMappingName(
+    DWORD sessionManagerProcessId) {
+    WCHAR szName[SessionPrivateNamespace::kPrivateNamespaceMaxLen +
+                 sizeof("\\ModConfigSnapshot")];
+    int namePos =
+        SessionPrivateNamespace::MakeName(szName, sessionManagerProcessId);
+    swprintf_s(szName + namePos, ARRAYSIZE(szName) - namePos,
+               L"\\ModConfigSnapshot");
+    return szName;
+}
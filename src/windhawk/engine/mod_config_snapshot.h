@@ -0,0 +1,173 @@
+#pragma once
+
+#include "storage_manager.h"
+
+// A snapshot of the config values which decide where and how the mods are
+// loaded, published by the session manager in shared memory. Without it, each
+// engine instance reads the config of every mod from storage on start and on
+// every config change, which with hundreds of processes means thousands of
+// registry reads at the same moment. The snapshot is read with a sequence
+// counter.
+//
+// To avoid waking up all engines on every change, a new event is created for
+// each change of each mod, and engines only wait for the mods which are
+// relevant to them. Changes which might make a mod load in new processes are
+// broadcast to all engines.
+class ModConfigSnapshot {
+   public:
+    struct ModConfig {
+        std::wstring name;
+        bool disabled;
+        std::wstring architecture;
+        bool patternsMatchCriticalSystemProcesses;
+        bool includeExcludeCustomOnly;
+        std::wstring include;
+        std::wstring includeCustom;
+        std::wstring exclude;
+        std::wstring excludeCustom;
+        std::wstring libraryFileName;
+        // Empty if the mod has no version.
+        std::wstring version;
+        int settingsChangeTime;
+        bool loggingEnabled;
+        bool debugLoggingEnabled;
+        // If not empty, the mod is only loaded once one of these modules is
+        // loaded, separated by '|'.
+        std::wstring loadWithModule;
+        // Hook operations applied while the mod handles a settings change are
+        // deferred, and applied together with the rest of the reload.
+        bool atomicReconfigure;
+        // The snapshot generation in which any of the values above last
+        // changed, zero if read from storage.
+        DWORD generation;
+    };
+
+    using Mods = std::vector<ModConfig>;
+
+    struct Snapshot {
+        DWORD generation;
+        // The last generation with a change which might affect processes the
+        // mod isn't loaded in.
+        DWORD broadcastGeneration;
+        // The QueryPerformanceCounter value of the session manager when the
+        // snapshot was published, comparable across processes. Used to
+        // measure how long it takes for the engines to apply a change.
+        LONGLONG publishTime;
+        Mods mods;
+    };
+
+    ModConfigSnapshot() = delete;
+
+    static ModConfig ReadModConfigFromStorage(PCWSTR modName);
+
+    // True if the values which decide which processes the mod is loaded in
+    // are the same.
+    static bool HasSameTargeting(const ModConfig& a, const ModConfig& b);
+
+    // Returns the current snapshot, or nullptr if it's not available, in which
+    // case the mod configs should be read from storage.
+    static std::shared_ptr<const Snapshot> Get(
+        DWORD sessionManagerProcessId) noexcept;
+
+    // Used by the session manager, publishes a snapshot on construction and
+    // whenever the mods config changes. Must be created after the private
+    // namespace of the session manager.
+    class Publisher {
+       public:
+        Publisher();
+
+        Publisher(const Publisher&) = delete;
+        Publisher& operator=(const Publisher&) = delete;
+
+       private:
+        static void CALLBACK WaitCallback(PTP_CALLBACK_INSTANCE instance,
+                                          PVOID context,
+                                          PTP_WAIT wait,
+                                          TP_WAIT_RESULT waitResult);
+        void Publish() noexcept;
+
+        wil::unique_handle m_mapping;
+        wil::unique_mapview_ptr<void> m_view;
+        Snapshot m_snapshot{};
+        // Signaled and replaced when the corresponding generation changes.
+        wil::unique_event_nothrow m_nextGenerationEvent;
+        wil::unique_event_nothrow m_nextBroadcastGenerationEvent;
+        std::unordered_map<std::wstring, wil::unique_event_nothrow>
+            m_nextModGenerationEvents;
+        std::optional<StorageManager::ModConfigChangeNotification>
+            m_modConfigChangeNotification;
+        // Declared last, so that the callbacks are done before the rest is
+        // destroyed.
+        wil::unique_threadpool_wait m_wait;
+    };
+
+    // Signaled once a snapshot with a change which is relevant to the current
+    // process is published, relative to the snapshot which was current on
+    // construction or on the last ContinueMonitoring call. A change is
+    // relevant if it's broadcast, or if it's a change of a mod for which
+    // isModRelevant returns true.
+    class ChangeNotification {
+       public:
+        // The maximum amount of handles returned by GetHandles.
+        static constexpr size_t kMaxHandleCount = 32;
+
+        ChangeNotification(
+            DWORD sessionManagerProcessId,
+            std::function<bool(const ModConfig&)> isModRelevant);
+
+        const std::vector<HANDLE>& GetHandles() { return m_handles; }
+        void ContinueMonitoring();
+
+       private:
+        DWORD m_sessionManagerProcessId;
+        std::function<bool(const ModConfig&)> m_isModRelevant;
+        std::vector<wil::unique_event_nothrow> m_events;
+        std::vector<HANDLE> m_handles;
+    };
+
+    // Used when the mods config storage is monitored directly, in which case
+    // a change of any mod is reported. Filters the changes the same way
+    // ChangeNotification does, by comparing the mod configs with the ones
+    // which were read previously.
+    class StorageChangeFilter {
+       public:
+        explicit StorageChangeFilter(
+            std::function<bool(const ModConfig&)> isModRelevant);
+
+        // Reads the mod configs from storage, and returns true if they changed
+        // in a way which is relevant to the current process since
+        // construction or since the last call.
+        bool Update();
+
+       private:
+        static Mods ReadModsFromStorage();
+
+        std::function<bool(const ModConfig&)> m_isModRelevant;
+        Mods m_mods;
+    };
+
+   private:
+    static constexpr DWORD kVersion = 5;
+    static constexpr DWORD kMaxDataSize = 1024 * 1024;
+    // The mod configs couldn't be read or don't fit.
+    static constexpr DWORD kDataUnavailable = 0xFFFFFFFF;
+
+    // Followed by the serialized snapshot.
+    struct SharedHeader {
+        DWORD version;
+        // Odd while the data is being written.
+        LONG sequence;
+        DWORD dataSize;
+        // Set if the session manager stopped monitoring config changes, the
+        // engines have to monitor them by themselves.
+        BOOL monitoringStopped;
+    };
+
+    class Cache;
+
+    static std::wstring MakeEventName(DWORD sessionManagerProcessId,
+                                      PCWSTR kind,
+                                      DWORD generation,
+                                      PCWSTR modName = nullptr);
+    static std::wstring MakeMappingName(DWORD sessionManagerProcessId);
+};
@@ -0,0 +1,298 @@
+#include "stdafx.h"
+
+#include "mod_cpu_sampler.h"
+
+#include "logger.h"
+#include "no_destructor.h"
+#include "storage_manager.h"
+#include "var_init_once.h"
+
+extern "C" {
+#include <thread-call-stack-scanner/ThreadsCallStackIterate.h>
+}
+
+namespace {
+
+DWORD GetModuleSizeOfImage(HMODULE module) {
+    auto* dosHeader = reinterpret_cast<IMAGE_DOS_HEADER*>(module);
+    auto* ntHeader = reinterpret_cast<IMAGE_NT_HEADERS*>(
+        reinterpret_cast<BYTE*>(dosHeader) + dosHeader->e_lfanew);
+    return ntHeader->OptionalHeader.SizeOfImage;
+}
+
+bool IsEnabledInConfig() {
+    try {
+        auto settings = StorageManager::GetInstance().GetAppConfig(L"Settings");
+        return settings->GetInt(L"ModCpuSampling").value_or(0) != 0;
+    } catch (const std::exception& e) {
+        LOG(L"Reading the ModCpuSampling setting failed: %S", e.what());
+        return false;
+    }
+}
+
+double GetPercentage(ULONGLONG part, ULONGLONG total) {
+    return total ? static_cast<double>(part) * 100.0 / total : 0.0;
+}
+
+}  // namespace
+
+// Used by the scan callback, which is called while all other threads are
+// suspended, so it can't allocate or take locks. Everything is allocated
+// beforehand.
+struct ModCpuSampler::ScanState {
+    struct Region {
+        DWORD_PTR address;
+        DWORD_PTR end;
+        size_t index;
+    };
+
+    // Sorted by address.
+    std::vector<Region> regions;
+    // By registration index.
+    std::vector<ULONGLONG> cycles;
+    std::vector<bool> inCallStack;
+    const std::vector<ThreadCycles>* previousThreadCycles;
+    std::vector<ThreadCycles>* threadCycles;
+    HANDLE thread = nullptr;
+    ULONG64 threadCyclesDelta = 0;
+    ULONGLONG processCycles = 0;
+
+    void BeginThread(HANDLE threadHandle) noexcept {
+        EndThread();
+
+        thread = threadHandle;
+        threadCyclesDelta = 0;
+
+        ThreadCycles current{
+            .threadId = GetThreadId(threadHandle),
+        };
+        if (!current.threadId ||
+            !QueryThreadCycleTime(threadHandle, &current.cycles)) {
+            return;
+        }
+
+        auto it = std::lower_bound(
+            previousThreadCycles->begin(), previousThreadCycles->end(),
+            current.threadId, [](const ThreadCycles& item, DWORD threadId) {
+                return item.threadId < threadId;
+            });
+        // A new thread is only counted from the next sample.
+        if (it != previousThreadCycles->end() &&
+            it->threadId == current.threadId && current.cycles >= it->cycles) {
+            threadCyclesDelta = current.cycles - it->cycles;
+        }
+
+        if (threadCycles->size() < threadCycles->capacity()) {
+            threadCycles->push_back(current);
+        }
+
+        processCycles += threadCyclesDelta;
+    }
+
+    void EndThread() noexcept {
+        for (size_t i = 0; i < inCallStack.size(); i++) {
+            if (inCallStack[i]) {
+                cycles[i] += threadCyclesDelta;
+                inCallStack[i] = false;
+            }
+        }
+    }
+
+    void AddFrame(DWORD_PTR address) noexcept {
+        auto it = std::upper_bound(
+            regions.begin(), regions.end(), address,
+            [](DWORD_PTR address, const Region& region) {
+                return address < region.address;
+            });
+        if (it == regions.begin()) {
+            return;
+        }
+
+        --it;
+        if (address < it->end) {
+            inCallStack[it->index] = true;
+        }
+    }
+};
+
+ModCpuSampler::ModCpuSampler() {
+    m_timer.reset(CreateThreadpoolTimer(TimerCallback, this, nullptr));
+    THROW_LAST_ERROR_IF_NULL(m_timer);
+}
+
+// static
+ModCpuSampler& ModCpuSampler::GetInstance() {
+    STATIC_INIT_ONCE(NoDestructorIfTerminating<ModCpuSampler>, s);
+    return **s;
+}
+
+// static
+bool ModCpuSampler::IsEnabled() {
+    STATIC_INIT_ONCE_TRIVIAL(bool, enabled, IsEnabledInConfig());
+    return enabled;
+}
+
+UINT64 ModCpuSampler::Register(PCWSTR modName, HMODULE module) {
+    auto entry = std::make_unique<ModStatusTable::Entry>(
+        ModStatusTable::Kind::kCpuUsage, modName);
+
+    std::lock_guard guard(m_mutex);
+
+    UINT64 id = m_nextId++;
+    m_registrations.push_back({
+        .id = id,
+        .address = reinterpret_cast<DWORD_PTR>(module),
+        .size = GetModuleSizeOfImage(module),
+        .recentCycles = 0,
+        .totalCycles = 0,
+        .processCyclesAtRegistration = m_totalProcessCycles,
+        .entry = std::move(entry),
+    });
+
+    if (!m_timerSet) {
+        SetTimer();
+    }
+
+    return id;
+}
+
+void ModCpuSampler::Unregister(UINT64 id) noexcept {
+    std::lock_guard guard(m_mutex);
+
+    std::erase_if(m_registrations, [id](const Registration& registration) {
+        return registration.id == id;
+    });
+}
+
+// static
+std::mutex& ModCpuSampler::GetScanMutex() noexcept {
+    static std::mutex mutex;
+    return mutex;
+}
+
+// static
+void CALLBACK ModCpuSampler::TimerCallback(PTP_CALLBACK_INSTANCE instance,
+                                           PVOID context,
+                                           PTP_TIMER timer) {
+    static_cast<ModCpuSampler*>(context)->Sample();
+}
+
+void ModCpuSampler::SetTimer() noexcept {
+    // Not periodic, so that a slow sample doesn't overlap with the next one.
+    FILETIME dueTime = wil::filetime::from_int64(static_cast<UINT64>(
+        -static_cast<INT64>(kSampleIntervalMs) *
+        wil::filetime_duration::one_millisecond));
+    SetThreadpoolTimer(m_timer.get(), &dueTime, 0, 0);
+    m_timerSet = true;
+}
+
+void ModCpuSampler::Sample() noexcept {
+    try {
+        ScanState state;
+        std::vector<UINT64> ids;
+
+        {
+            std::lock_guard guard(m_mutex);
+
+            if (m_registrations.empty()) {
+                m_timerSet = false;
+                return;
+            }
+
+            for (const auto& registration : m_registrations) {
+                state.regions.push_back({
+                    .address = registration.address,
+                    .end = registration.address + registration.size,
+                    .index = ids.size(),
+                });
+                ids.push_back(registration.id);
+            }
+        }
+
+        std::sort(state.regions.begin(), state.regions.end(),
+                  [](const ScanState::Region& a, const ScanState::Region& b) {
+                      return a.address < b.address;
+                  });
+        state.cycles.resize(ids.size());
+        state.inCallStack.resize(ids.size());
+        state.previousThreadCycles = &m_previousThreadCycles;
+        m_threadCycles.clear();
+        m_threadCycles.reserve(kMaxThreads);
+        state.threadCycles = &m_threadCycles;
+
+        {
+            std::lock_guard scanGuard(GetScanMutex());
+
+            ThreadsCallStackInitialize();
+            ThreadsCallStackIterate(ScanCallback, &state, kScanTimeoutMs);
+            state.EndThread();
+            ThreadsCallStackCleanup();
+        }
+
+        std::sort(m_threadCycles.begin(), m_threadCycles.end(),
+                  [](const ThreadCycles& a, const ThreadCycles& b) {
+                      return a.threadId < b.threadId;
+                  });
+        m_previousThreadCycles.swap(m_threadCycles);
+
+        std::lock_guard guard(m_mutex);
+
+        m_recentProcessCycles += state.processCycles;
+        m_totalProcessCycles += state.processCycles;
+
+        for (size_t i = 0; i < ids.size(); i++) {
+            auto it = std::find_if(
+                m_registrations.begin(), m_registrations.end(),
+                [id = ids[i]](const Registration& registration) {
+                    return registration.id == id;
+                });
+            if (it != m_registrations.end()) {
+                it->recentCycles += state.cycles[i];
+                it->totalCycles += state.cycles[i];
+            }
+        }
+
+        if (++m_samplesSincePublish == kSamplesPerPublish) {
+            Publish();
+            m_samplesSincePublish = 0;
+            m_recentProcessCycles = 0;
+        }
+
+        SetTimer();
+    } catch (const std::exception& e) {
+        LOG(L"Sampling the mod CPU usage failed: %S", e.what());
+
+        std::lock_guard guard(m_mutex);
+        m_timerSet = false;
+    }
+}
+
+// static
+BOOL ModCpuSampler::ScanCallback(HANDLE threadHandle,
+                                 void* stackFrameAddress,
+                                 void* userData) {
+    auto* state = static_cast<ScanState*>(userData);
+
+    // The first frame of each thread is its instruction pointer.
+    if (threadHandle != state->thread) {
+        state->BeginThread(threadHandle);
+    }
+
+    state->AddFrame(reinterpret_cast<DWORD_PTR>(stackFrameAddress));
+    return TRUE;
+}
+
+void ModCpuSampler::Publish() noexcept {
+    for (auto& registration : m_registrations) {
+        // The recent share comes first, the task manager dialog sorts by it.
+        WCHAR value[ModStatusTable::kValueMaxLength + 1];
+        _snwprintf_s(
+            value, _TRUNCATE, L"%.1f%%, %.1f%% since loaded",
+            GetPercentage(registration.recentCycles, m_recentProcessCycles),
+            GetPercentage(registration.totalCycles,
+                          m_totalProcessCycles -
+                              registration.processCyclesAtRegistration));
+        registration.entry->Set(value);
+        registration.recentCycles = 0;
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "mod_status_table.h"
+
+// Optionally estimates the share of the CPU time of the current process which
+// is spent in each mod, enabled with the ModCpuSampling engine setting. The
+// call stacks of all threads are sampled periodically with the
+// thread-call-stack-scanner library, and the cycles which a thread used since
+// the previous sample are attributed to each mod which has a frame in its call
+// stack, including the original functions which its hooks call. The share of
+// each mod is published in the mod status table once per second.
+//
+// Sampling suspends all threads of the process for a moment, so the interval
+// is long and the result is only an estimate, which is good enough to tell
+// which mods are expensive. Threads which are waiting use no cycles, so mod
+// threads which are idle aren't counted.
+class ModCpuSampler {
+   public:
+    ModCpuSampler();
+
+    ModCpuSampler(const ModCpuSampler&) = delete;
+    ModCpuSampler& operator=(const ModCpuSampler&) = delete;
+
+    static ModCpuSampler& GetInstance();
+    static bool IsEnabled();
+
+    // Sampling starts with the first registered module. Returns an ID for
+    // Unregister.
+    UINT64 Register(PCWSTR modName, HMODULE module);
+    void Unregister(UINT64 id) noexcept;
+
+    // Must be held while scanning the call stacks of the threads with the
+    // thread-call-stack-scanner library, which keeps its heap in a global
+    // variable.
+    static std::mutex& GetScanMutex() noexcept;
+
+   private:
+    static constexpr DWORD kSampleIntervalMs = 250;
+    static constexpr DWORD kSamplesPerPublish = 4;
+    static constexpr DWORD kScanTimeoutMs = 50;
+    // Threads past that aren't counted, to avoid allocating while the threads
+    // are suspended.
+    static constexpr size_t kMaxThreads = 4096;
+
+    struct Registration {
+        UINT64 id;
+        DWORD_PTR address;
+        DWORD_PTR size;
+        ULONGLONG recentCycles;
+        ULONGLONG totalCycles;
+        // The total cycles of the process when the module was registered.
+        ULONGLONG processCyclesAtRegistration;
+        std::unique_ptr<ModStatusTable::Entry> entry;
+    };
+
+    struct ThreadCycles {
+        DWORD threadId;
+        ULONG64 cycles;
+    };
+
+    struct ScanState;
+
+    static void CALLBACK TimerCallback(PTP_CALLBACK_INSTANCE instance,
+                                       PVOID context,
+                                       PTP_TIMER timer);
+    static BOOL ScanCallback(HANDLE threadHandle,
+                             void* stackFrameAddress,
+                             void* userData);
+
+    void SetTimer() noexcept;
+    void Sample() noexcept;
+    void Publish() noexcept;
+
+    std::mutex m_mutex;
+    std::vector<Registration> m_registrations;
+    UINT64 m_nextId = 1;
+    bool m_timerSet = false;
+    ULONGLONG m_recentProcessCycles = 0;
+    ULONGLONG m_totalProcessCycles = 0;
+    DWORD m_samplesSincePublish = 0;
+    // Only used by the timer callback, which is set again once it's done, so
+    // it never runs concurrently. Sorted by thread ID.
+    std::vector<ThreadCycles> m_previousThreadCycles;
+    std::vector<ThreadCycles> m_threadCycles;
+    // Declared last, so that the callbacks are done before the rest is
+    // destroyed.
+    wil::unique_threadpool_timer m_timer;
+};
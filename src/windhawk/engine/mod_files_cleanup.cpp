@@ -0,0 +1,125 @@
+#include "stdafx.h"
+
+#include "logger.h"
+#include "mod_files_cleanup.h"
+#include "storage_manager.h"
+
+namespace {
+
+std::wstring ToLower(std::wstring_view s) {
+    std::wstring result(s);
+    std::transform(result.begin(), result.end(), result.begin(), towlower);
+    return result;
+}
+
+// Compiled mods are named "<mod id>_<version>_<random number>.dll". Other
+// files in the folder, such as the runtime libraries, must be kept.
+bool IsCompiledModFileName(std::wstring_view fileName) {
+    constexpr std::wstring_view kExtension = L".dll";
+    if (fileName.length() <= kExtension.length() ||
+        CompareStringOrdinal(
+            fileName.data() + fileName.length() - kExtension.length(),
+            static_cast<int>(kExtension.length()), kExtension.data(),
+            static_cast<int>(kExtension.length()), TRUE) != CSTR_EQUAL) {
+        return false;
+    }
+
+    auto stem = fileName.substr(0, fileName.length() - kExtension.length());
+    size_t underscore = stem.rfind(L'_');
+    if (underscore == stem.npos || underscore == 0 ||
+        underscore + 1 == stem.length()) {
+        return false;
+    }
+
+    return std::all_of(stem.begin() + underscore + 1, stem.end(),
+                       [](WCHAR c) { return c >= L'0' && c <= L'9'; });
+}
+
+}  // namespace
+
+ModFilesCleanup::ModFilesCleanup() {
+    m_timer.reset(CreateThreadpoolTimer(TimerCallback, nullptr, nullptr));
+    THROW_LAST_ERROR_IF_NULL(m_timer);
+
+    FILETIME dueTime = wil::filetime::from_int64(static_cast<UINT64>(
+        -static_cast<INT64>(kInitialDelayMs) *
+        wil::filetime_duration::one_millisecond));
+    SetThreadpoolTimer(m_timer.get(), &dueTime, kIntervalMs, 0);
+}
+
+// static
+void CALLBACK ModFilesCleanup::TimerCallback(PTP_CALLBACK_INSTANCE instance,
+                                             PVOID context,
+                                             PTP_TIMER timer) {
+    Run();
+}
+
+// static
+void ModFilesCleanup::Run() noexcept {
+    auto& storageManager = StorageManager::GetInstance();
+
+    // If the config of any mod can't be read, nothing is deleted, since the
+    // file it refers to might be deleted otherwise.
+    std::unordered_set<std::wstring> usedFileNames;
+    try {
+        storageManager.EnumMods([&storageManager,
+                                 &usedFileNames](PCWSTR modName) {
+            auto libraryFileName =
+                storageManager.GetModConfig(modName, nullptr)
+                    ->GetString(L"LibraryFileName");
+            if (libraryFileName) {
+                usedFileNames.insert(ToLower(*libraryFileName));
+            }
+        });
+    } catch (const std::exception& e) {
+        LOG(L"Enumerating the mods failed: %S", e.what());
+        return;
+    }
+
+    FILETIME currentFileTime;
+    GetSystemTimeAsFileTime(&currentFileTime);
+    ULONGLONG currentTime = wil::filetime::to_int64(currentFileTime);
+
+    int deletedCount = 0;
+
+    for (USHORT machine : {IMAGE_FILE_MACHINE_I386, IMAGE_FILE_MACHINE_AMD64,
+                           IMAGE_FILE_MACHINE_ARM64}) {
+        try {
+            std::error_code ec;
+            for (const auto& entry : std::filesystem::directory_iterator(
+                     storageManager.GetModsPath(machine), ec)) {
+                std::wstring fileName = entry.path().filename().native();
+                if (!entry.is_regular_file(ec) ||
+                    !IsCompiledModFileName(fileName) ||
+                    usedFileNames.contains(ToLower(fileName))) {
+                    continue;
+                }
+
+                WIN32_FILE_ATTRIBUTE_DATA attributes;
+                if (!GetFileAttributesEx(entry.path().c_str(),
+                                         GetFileExInfoStandard, &attributes)) {
+                    continue;
+                }
+
+                ULONGLONG writeTime =
+                    wil::filetime::to_int64(attributes.ftLastWriteTime);
+                if (writeTime + kMinFileAgeMs *
+                                    wil::filetime_duration::one_millisecond >
+                    currentTime) {
+                    continue;
+                }
+
+                // Fails if the file is loaded in a process.
+                if (DeleteFile(entry.path().c_str())) {
+                    deletedCount++;
+                }
+            }
+        } catch (const std::exception& e) {
+            LOG(L"Cleaning up mod files failed: %S", e.what());
+        }
+    }
+
+    if (deletedCount > 0) {
+        VERBOSE(L"Deleted %d unused mod files", deletedCount);
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+// Deletes the compiled mod files which are no longer used, run periodically
+// by the session manager. Each compilation or installation of a mod writes a
+// new, uniquely named file, and the previous one is deleted right away if
+// possible, but not if it's loaded in a process at that moment. Over time,
+// these files accumulate, especially on computers on which mods are
+// developed.
+//
+// A file is deleted if no mod refers to it with its LibraryFileName value.
+// Files which are loaded in a process can't be deleted, and are retried on
+// the next run. Recently written files are kept, since the config of the mod
+// might not have been updated yet.
+class ModFilesCleanup {
+   public:
+    ModFilesCleanup();
+
+    ModFilesCleanup(const ModFilesCleanup&) = delete;
+    ModFilesCleanup& operator=(const ModFilesCleanup&) = delete;
+
+   private:
+    static constexpr DWORD kInitialDelayMs = 60 * 1000;
+    static constexpr DWORD kIntervalMs = 60 * 60 * 1000;
+    static constexpr ULONGLONG kMinFileAgeMs = 10 * 60 * 1000;
+
+    static void CALLBACK TimerCallback(PTP_CALLBACK_INSTANCE instance,
+                                       PVOID context,
+                                       PTP_TIMER timer);
+    static void Run() noexcept;
+
+    // Declared last, so that the callbacks are done before the rest is
+    // destroyed.
+    wil::unique_threadpool_timer m_timer;
+};
@@ -0,0 +1,53 @@
+#include "stdafx.h"
+
+#include "mod_load_times.h"
+
+ModLoadTimes::ModLoadTimes(PCWSTR modName)
+    : m_entry(ModStatusTable::Kind::kLoadTimes, modName) {}
+
+void ModLoadTimes::Add(Phase phase, LONGLONG startCounter) noexcept {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    ULONGLONG durationUs = static_cast<ULONGLONG>(Now() - startCounter) *
+                           1000000 / frequency.QuadPart;
+
+    std::lock_guard guard(m_mutex);
+
+    m_durationsUs[static_cast<size_t>(phase)] += durationUs;
+    Publish();
+}
+
+ModLoadTimes::ScopedTimer::ScopedTimer(ModLoadTimes& loadTimes,
+                                       Phase phase) noexcept
+    : m_loadTimes(loadTimes), m_phase(phase), m_startCounter(Now()) {}
+
+ModLoadTimes::ScopedTimer::~ScopedTimer() {
+    m_loadTimes.Add(m_phase, m_startCounter);
+}
+
+// static
+LONGLONG ModLoadTimes::Now() noexcept {
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart;
+}
+
+void ModLoadTimes::Publish() noexcept {
+    auto ms = [this](Phase phase) {
+        return static_cast<double>(m_durationsUs[static_cast<size_t>(phase)]) /
+               1000.0;
+    };
+
+    // Symbols are left out of the total, they're usually part of the init
+    // time. The total comes first, the task manager dialog sorts by it.
+    double total = ms(Phase::kLoad) + ms(Phase::kInit) +
+                   ms(Phase::kAfterInit) + ms(Phase::kHooks);
+
+    WCHAR value[ModStatusTable::kValueMaxLength + 1];
+    _snwprintf_s(value, _TRUNCATE,
+                 L"%.1f ms: load %.1f, init %.1f, symbols %.1f, "
+                 L"after init %.1f, hooks %.1f",
+                 total, ms(Phase::kLoad), ms(Phase::kInit),
+                 ms(Phase::kSymbols), ms(Phase::kAfterInit), ms(Phase::kHooks));
+    m_entry.Set(value);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "mod_status_table.h"
+
+// The time a mod instance spent in each phase of being loaded, published in
+// the mod status table, so that the mods which slow down the start of a
+// process can be told apart from the engine itself. The record is updated
+// whenever a phase ends, and is freed with the mod instance.
+//
+// Symbols are usually hooked from Wh_ModInit, in which case their time is also
+// part of the init time. The hooks phase is the time of the hook operations
+// which the mod applies explicitly after being initialized. The hooks which
+// are applied for all mods together once they're initialized aren't
+// attributed to any mod.
+class ModLoadTimes {
+   public:
+    enum class Phase {
+        // Loading the mod library.
+        kLoad,
+        kInit,
+        kSymbols,
+        kHooks,
+        kAfterInit,
+        kCount,
+    };
+
+    explicit ModLoadTimes(PCWSTR modName);
+
+    ModLoadTimes(const ModLoadTimes&) = delete;
+    ModLoadTimes& operator=(const ModLoadTimes&) = delete;
+
+    // Adds the time since the given QueryPerformanceCounter value to the
+    // phase. Thread safe.
+    void Add(Phase phase, LONGLONG startCounter) noexcept;
+
+    class ScopedTimer {
+       public:
+        ScopedTimer(ModLoadTimes& loadTimes, Phase phase) noexcept;
+        ~ScopedTimer();
+
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+       private:
+        ModLoadTimes& m_loadTimes;
+        Phase m_phase;
+        LONGLONG m_startCounter;
+    };
+
+    static LONGLONG Now() noexcept;
+
+   private:
+    void Publish() noexcept;
+
+    std::mutex m_mutex;
+    ULONGLONG m_durationsUs[static_cast<size_t>(Phase::kCount)] = {};
+    ModStatusTable::Entry m_entry;
+};
@@ -0,0 +1,196 @@
+#include "stdafx.h"
+
+#include "mod_match_hints.h"
+
+#include "logger.h"
+#include "storage_manager.h"
+
+namespace {
+
+constexpr DWORD kMagic = 'HMMW';
+constexpr DWORD kVersion = 1;
+
+struct Header {
+    DWORD magic;
+    DWORD version;
+    ULONGLONG configFingerprint;
+    DWORD count;
+    DWORD reserved;
+};
+
+struct Entry {
+    ULONGLONG key;
+    DWORD matches;
+    DWORD reserved;
+};
+
+}  // namespace
+
+ModMatchHints::ModMatchHints(ULONGLONG configFingerprint) noexcept
+    : m_configFingerprint(configFingerprint) {
+    try {
+        Load();
+    } catch (const std::exception& e) {
+        LOG(L"Loading the mod match hints failed: %S", e.what());
+        m_hints.clear();
+    }
+}
+
+bool ModMatchHints::MightMatch(std::wstring_view imagePath,
+                               USHORT processMachine,
+                               const std::function<bool()>& computeMatch) {
+    ULONGLONG key = MakeKey(imagePath, processMachine);
+
+    {
+        std::lock_guard guard(m_mutex);
+        auto it = m_hints.find(key);
+        if (it != m_hints.end()) {
+            return it->second;
+        }
+    }
+
+    // Computed without holding the lock, a concurrent computation for the
+    // same image gets the same result.
+    bool matches = computeMatch();
+
+    std::lock_guard guard(m_mutex);
+    if (m_hints.size() < kMaxHints &&
+        m_hints.try_emplace(key, matches).second) {
+        m_changed = true;
+    }
+
+    return matches;
+}
+
+void ModMatchHints::SaveIfChanged() noexcept {
+    try {
+        Save();
+    } catch (const std::exception& e) {
+        LOG(L"Saving the mod match hints failed: %S", e.what());
+    }
+}
+
+// static
+ULONGLONG ModMatchHints::MakeKey(std::wstring_view imagePath,
+                                 USHORT processMachine) {
+    std::wstring path(imagePath);
+    LCMapStringEx(LOCALE_NAME_USER_DEFAULT, LCMAP_LOWERCASE, &path[0],
+                  wil::safe_cast<int>(path.length()), &path[0],
+                  wil::safe_cast<int>(path.length()), nullptr, nullptr, 0);
+
+    // FNV-1a, the same as SymbolIndex::HashName, with the machine type
+    // appended.
+    ULONGLONG hash = 14695981039346656037ULL;
+    for (WCHAR c : path) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+
+    hash ^= processMachine;
+    hash *= 1099511628211ULL;
+
+    return hash;
+}
+
+void ModMatchHints::Load() {
+    auto path = StorageManager::GetInstance().GetModMatchHintsPath();
+
+    wil::unique_hfile file(CreateFile(
+        path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+    if (!file) {
+        return;
+    }
+
+    Header header;
+    DWORD read;
+    THROW_IF_WIN32_BOOL_FALSE(
+        ReadFile(file.get(), &header, sizeof(header), &read, nullptr));
+    if (read != sizeof(header) || header.magic != kMagic ||
+        header.version != kVersion || header.count > kMaxHints) {
+        return;
+    }
+
+    if (header.configFingerprint != m_configFingerprint) {
+        VERBOSE(L"The mods config changed, discarding the mod match hints");
+        return;
+    }
+
+    std::vector<Entry> entries(header.count);
+    DWORD entriesSize = static_cast<DWORD>(entries.size() * sizeof(Entry));
+    THROW_IF_WIN32_BOOL_FALSE(
+        ReadFile(file.get(), entries.data(), entriesSize, &read, nullptr));
+    if (read != entriesSize) {
+        return;
+    }
+
+    m_hints.reserve(entries.size());
+    for (const auto& entry : entries) {
+        m_hints.try_emplace(entry.key, !!entry.matches);
+    }
+
+    VERBOSE(L"Loaded %zu mod match hints", m_hints.size());
+}
+
+void ModMatchHints::Save() {
+    std::vector<Entry> entries;
+
+    {
+        std::lock_guard guard(m_mutex);
+        if (!m_changed) {
+            return;
+        }
+
+        m_changed = false;
+
+        entries.reserve(m_hints.size());
+        for (const auto& [key, matches] : m_hints) {
+            entries.push_back({.key = key, .matches = matches});
+        }
+    }
+
+    Header header{
+        .magic = kMagic,
+        .version = kVersion,
+        .configFingerprint = m_configFingerprint,
+        .count = static_cast<DWORD>(entries.size()),
+    };
+
+    auto path = StorageManager::GetInstance().GetModMatchHintsPath();
+
+    // Write to a temporary file first and then move it into place, so that a
+    // partially written file is never loaded.
+    std::filesystem::path tempPath = path;
+    tempPath += L".tmp" + std::to_wstring(GetCurrentProcessId());
+
+    {
+        wil::unique_hfile file(CreateFile(tempPath.c_str(), GENERIC_WRITE, 0,
+                                          nullptr, CREATE_ALWAYS,
+                                          FILE_ATTRIBUTE_NORMAL, nullptr));
+        THROW_LAST_ERROR_IF(!file);
+
+        auto writeData = [&file](const void* data, size_t size) {
+            DWORD written;
+            return WriteFile(file.get(), data, wil::safe_cast<DWORD>(size),
+                             &written, nullptr) &&
+                   written == size;
+        };
+
+        if (!writeData(&header, sizeof(header)) ||
+            !writeData(entries.data(), entries.size() * sizeof(Entry))) {
+            DWORD error = GetLastError();
+            file.reset();
+            DeleteFile(tempPath.c_str());
+            THROW_WIN32(error);
+        }
+    }
+
+    if (!MoveFileEx(tempPath.c_str(), path.c_str(),
+                    MOVEFILE_REPLACE_EXISTING)) {
+        DWORD error = GetLastError();
+        DeleteFile(tempPath.c_str());
+        THROW_WIN32(error);
+    }
+
+    VERBOSE(L"Saved %zu mod match hints", entries.size());
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+// Remembers, per process image path and machine type, whether any mod targets
+// the processes of the image, so that the session manager doesn't have to
+// match each new process against the patterns of all mods. The hints are
+// saved to a file and are loaded in the next session, e.g. after a reboot,
+// where most processes of the initial enumeration are of known images. They
+// are only valid for the targeting config of the ModTargets fingerprint they
+// were created with, and are discarded on load if it differs. Thread safe.
+class ModMatchHints {
+   public:
+    // Loads the hints saved by a previous session with the same fingerprint,
+    // if any.
+    explicit ModMatchHints(ULONGLONG configFingerprint) noexcept;
+
+    ModMatchHints(const ModMatchHints&) = delete;
+    ModMatchHints& operator=(const ModMatchHints&) = delete;
+
+    // Returns the remembered result of ModTargets::MightMatch, or calls
+    // computeMatch and remembers its result.
+    bool MightMatch(std::wstring_view imagePath,
+                    USHORT processMachine,
+                    const std::function<bool()>& computeMatch);
+
+    // Saves the hints if new ones were added since the last save. Cheap
+    // otherwise, so it can be called after each injection pass.
+    void SaveIfChanged() noexcept;
+
+   private:
+    // Hints of images which were seen once are kept as well, but the file
+    // doesn't grow beyond this.
+    static constexpr size_t kMaxHints = 4096;
+
+    static ULONGLONG MakeKey(std::wstring_view imagePath,
+                             USHORT processMachine);
+    void Load();
+    void Save();
+
+    ULONGLONG m_configFingerprint;
+    std::unordered_map<ULONGLONG, bool> m_hints;
+    bool m_changed = false;
+    std::mutex m_mutex;
+};
@@ -0,0 +1,563 @@
+#include "stdafx.h"
+
+#include "customization_session.h"
+#include "functions.h"
+#include "logger.h"
+#include "mod_status_table.h"
+#include "no_destructor.h"
+#include "session_private_namespace.h"
+#include "var_init_once.h"
+
+namespace {
+
+constexpr int kMaxReadAttempts = 16;
+
+ULONGLONG GetProcessCreationTime(HANDLE process) noexcept {
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetProcessTimes(process, &creationTime, &exitTime, &kernelTime,
+                         &userTime)) {
+        return 0;
+    }
+
+    return wil::filetime::to_int64(creationTime);
+}
+
+// If the state of the process can't be queried, it's assumed to be running.
+bool IsProcessRunning(DWORD processId, ULONGLONG processCreationTime) noexcept {
+    wil::unique_process_handle process(OpenProcess(
+        PROCESS_QUERY_LIMITED_INFORMATION | SYNCHRONIZE, FALSE, processId));
+    if (!process) {
+        return GetLastError() != ERROR_INVALID_PARAMETER;
+    }
+
+    if (WaitForSingleObject(process.get(), 0) == WAIT_OBJECT_0) {
+        return false;
+    }
+
+    // A different process with a reused process ID.
+    ULONGLONG creationTime = GetProcessCreationTime(process.get());
+    return !creationTime || !processCreationTime ||
+           creationTime == processCreationTime;
+}
+
+struct CurrentProcessInfo {
+    std::wstring name;
+    ULONGLONG creationTime;
+};
+
+const CurrentProcessInfo& GetCurrentProcessInfo() {
+    STATIC_INIT_ONCE(NoDestructorIfTerminating<CurrentProcessInfo>, info, []() {
+        std::filesystem::path fullProcessImageName =
+            wil::QueryFullProcessImageName<std::wstring>(GetCurrentProcess());
+        return CurrentProcessInfo{
+            .name = fullProcessImageName.filename().native(),
+            .creationTime = GetProcessCreationTime(GetCurrentProcess()),
+        };
+    }());
+    return **info;
+}
+
+}  // namespace
+
+// Opens the shared memory and the events of the session manager once per
+// process, and again after a new session manager took over the session. The
+// mutex is held by the entries while they write their records, and while the
+// table is replaced, so that no record is written to a replaced view.
+class ModStatusTable::SharedDataCache {
+   public:
+    std::mutex& GetMutex() noexcept { return m_mutex; }
+
+    // The entries of the current process, so that their records can be
+    // written again after a handover. Must be used with the mutex held.
+    std::unordered_set<Entry*>& GetEntries() noexcept { return m_entries; }
+
+    // Must be called with the mutex held.
+    SharedData* GetSharedData() noexcept {
+        EnsureOpened();
+        return m_view.get();
+    }
+
+    // Must be called with the mutex held.
+    HANDLE GetChangedEvent(Kind kind) noexcept {
+        EnsureOpened();
+        return m_changedEvents[static_cast<size_t>(kind)].get();
+    }
+
+    // Opens the table of the current session manager instead of the previous
+    // one. Must be called with the mutex held.
+    void Reopen() noexcept {
+        m_view.reset();
+        m_mapping.reset();
+        for (auto& changedEvent : m_changedEvents) {
+            changedEvent.reset();
+        }
+
+        m_opened = true;
+        Open();
+    }
+
+   private:
+    void EnsureOpened() noexcept {
+        if (!m_opened) {
+            m_opened = true;
+            Open();
+        }
+    }
+
+    void Open() noexcept {
+        try {
+            DWORD sessionManagerProcessId =
+                CustomizationSession::GetSessionManagerProcessId();
+
+            m_mapping.reset(OpenFileMapping(
+                FILE_MAP_READ | FILE_MAP_WRITE, FALSE,
+                ModStatusTable::MakeMappingName(sessionManagerProcessId)
+                    .c_str()));
+            if (!m_mapping) {
+                VERBOSE(L"OpenFileMapping error: %u", GetLastError());
+                return;
+            }
+
+            wil::unique_mapview_ptr<SharedData> view(
+                reinterpret_cast<SharedData*>(MapViewOfFile(
+                    m_mapping.get(), FILE_MAP_READ | FILE_MAP_WRITE, 0, 0,
+                    sizeof(SharedData))));
+            if (!view) {
+                VERBOSE(L"MapViewOfFile error: %u", GetLastError());
+                return;
+            }
+
+            if (view->version != kVersion) {
+                VERBOSE(L"Unsupported mod status table version %u",
+                        view->version);
+                return;
+            }
+
+            for (size_t i = 0; i < static_cast<size_t>(Kind::kCount); i++) {
+                m_changedEvents[i].reset(OpenEvent(
+                    EVENT_MODIFY_STATE, FALSE,
+                    ModStatusTable::MakeEventName(sessionManagerProcessId,
+                                                  static_cast<Kind>(i))
+                        .c_str()));
+                if (!m_changedEvents[i]) {
+                    VERBOSE(L"OpenEvent error: %u", GetLastError());
+                }
+            }
+
+            m_view = std::move(view);
+        } catch (const std::exception& e) {
+            VERBOSE(L"Error: %S", e.what());
+        }
+    }
+
+    std::mutex m_mutex;
+    std::unordered_set<Entry*> m_entries;
+    bool m_opened = false;
+    wil::unique_handle m_mapping;
+    wil::unique_mapview_ptr<SharedData> m_view;
+    wil::unique_event_nothrow
+        m_changedEvents[static_cast<size_t>(Kind::kCount)];
+};
+
+ModStatusTable::Owner::Owner() {
+    wil::unique_hlocal secDesc;
+    THROW_IF_WIN32_BOOL_FALSE(
+        Functions::GetFullAccessSecurityDescriptor(&secDesc, nullptr));
+
+    SECURITY_ATTRIBUTES secAttr = {sizeof(SECURITY_ATTRIBUTES)};
+    secAttr.lpSecurityDescriptor = secDesc.get();
+    secAttr.bInheritHandle = FALSE;
+
+    DWORD currentProcessId = GetCurrentProcessId();
+
+    for (size_t i = 0; i < static_cast<size_t>(Kind::kCount); i++) {
+        m_changedEvents[i].reset(CreateEvent(
+            &secAttr, TRUE, FALSE,
+            MakeEventName(currentProcessId, static_cast<Kind>(i)).c_str()));
+        THROW_LAST_ERROR_IF(!m_changedEvents[i] ||
+                            GetLastError() == ERROR_ALREADY_EXISTS);
+    }
+
+    m_mapping.reset(CreateFileMapping(
+        INVALID_HANDLE_VALUE, &secAttr, PAGE_READWRITE, 0, sizeof(SharedData),
+        MakeMappingName(currentProcessId).c_str()));
+    THROW_LAST_ERROR_IF(!m_mapping || GetLastError() == ERROR_ALREADY_EXISTS);
+
+    wil::unique_mapview_ptr<SharedData> view(
+        reinterpret_cast<SharedData*>(MapViewOfFile(
+            m_mapping.get(), FILE_MAP_WRITE, 0, 0, sizeof(SharedData))));
+    THROW_LAST_ERROR_IF(!view);
+
+    // The rest of the memory is zero-initialized.
+    view->version = kVersion;
+}
+
+ModStatusTable::Entry::Entry(Kind kind, PCWSTR modName)
+    : m_kind(kind), m_modName(modName) {
+    auto& cache = GetCache();
+    std::lock_guard guard(cache.GetMutex());
+    cache.GetEntries().insert(this);
+}
+
+ModStatusTable::Entry::~Entry() {
+    auto& cache = GetCache();
+    std::lock_guard guard(cache.GetMutex());
+    Free();
+    cache.GetEntries().erase(this);
+}
+
+void ModStatusTable::Entry::Set(PCWSTR value) noexcept {
+    std::lock_guard guard(GetCache().GetMutex());
+
+    if (!value) {
+        Free();
+        m_value.clear();
+        return;
+    }
+
+    // Kept to write the record again after a handover, see
+    // OnSessionManagerChanged.
+    try {
+        m_value = value;
+    } catch (const std::exception& e) {
+        VERBOSE(L"Error: %S", e.what());
+        m_value.clear();
+    }
+
+    Write(value);
+}
+
+void ModStatusTable::Entry::Write(PCWSTR value) noexcept {
+    SharedData* data = GetSharedData();
+    if (!data) {
+        return;
+    }
+
+    bool claimed = false;
+    if (m_slot == -1) {
+        m_slot = ClaimRecord(data);
+        if (m_slot == -1) {
+            VERBOSE(L"No free mod status record for %s", m_modName.c_str());
+            return;
+        }
+
+        claimed = true;
+    }
+
+    Record& record = data->records[m_slot];
+
+    BeginWrite(record);
+
+    if (claimed) {
+        try {
+            const auto& processInfo = GetCurrentProcessInfo();
+            wcsncpy_s(record.processName, processInfo.name.c_str(),
+                      _TRUNCATE);
+            record.processCreationTime = processInfo.creationTime;
+        } catch (const std::exception& e) {
+            VERBOSE(L"Error: %S", e.what());
+            record.processName[0] = L'\0';
+            record.processCreationTime = 0;
+        }
+
+        record.kind = static_cast<DWORD>(m_kind);
+        record.processId = GetCurrentProcessId();
+        record.creationTime =
+            wil::filetime::to_int64(wil::filetime::get_system_time());
+        wcsncpy_s(record.modName, m_modName.c_str(), _TRUNCATE);
+    }
+
+    wcsncpy_s(record.value, value, _TRUNCATE);
+
+    EndWrite(record);
+
+    NotifyChanged(m_kind);
+}
+
+void ModStatusTable::Entry::Free() noexcept {
+    if (m_slot == -1) {
+        return;
+    }
+
+    // Can't be null, since the record was claimed.
+    SharedData* data = GetSharedData();
+    Record& record = data->records[m_slot];
+
+    BeginWrite(record);
+    record.processId = 0;
+    record.value[0] = L'\0';
+    EndWrite(record);
+
+    InterlockedExchange(&record.ownerProcessId, 0);
+    m_slot = -1;
+
+    NotifyChanged(m_kind);
+}
+
+void ModStatusTable::Entry::WriteToNewTable() noexcept {
+    // The record in the table of the previous session manager is left as is,
+    // the table isn't read anymore.
+    bool hadRecord = m_slot != -1;
+    m_slot = -1;
+
+    if (hadRecord) {
+        Write(m_value.c_str());
+    }
+}
+
+ModStatusTable::Reader::Reader(DWORD sessionManagerProcessId, Kind kind)
+    : m_kind(kind) {
+    // The session manager has its namespace open already.
+    wil::unique_private_namespace_close privateNamespace;
+    if (sessionManagerProcessId != GetCurrentProcessId()) {
+        privateNamespace =
+            SessionPrivateNamespace::Open(sessionManagerProcessId);
+    }
+
+    m_mapping.reset(OpenFileMapping(
+        FILE_MAP_READ, FALSE,
+        MakeMappingName(sessionManagerProcessId).c_str()));
+    THROW_LAST_ERROR_IF_NULL(m_mapping);
+
+    m_view.reset(MapViewOfFile(m_mapping.get(), FILE_MAP_READ, 0, 0,
+                               sizeof(SharedData)));
+    THROW_LAST_ERROR_IF(!m_view);
+
+    auto* data = static_cast<const SharedData*>(m_view.get());
+    if (data->version != kVersion) {
+        throw std::runtime_error("Unsupported mod status table version");
+    }
+
+    m_changedEvent.reset(
+        OpenEvent(SYNCHRONIZE | EVENT_MODIFY_STATE, FALSE,
+                  MakeEventName(sessionManagerProcessId, kind).c_str()));
+    THROW_LAST_ERROR_IF(!m_changedEvent);
+
+    ContinueMonitoring();
+}
+
+HANDLE ModStatusTable::Reader::GetChangeEvent() noexcept {
+    auto* data = static_cast<const SharedData*>(m_view.get());
+
+    // Another reader might have reset the event before this reader waited for
+    // it.
+    if (ReadAcquire(&data->changeCounts[static_cast<size_t>(m_kind)]) !=
+        m_seenChangeCount) {
+        m_changedEvent.SetEvent();
+    }
+
+    return m_changedEvent.get();
+}
+
+void ModStatusTable::Reader::ContinueMonitoring() noexcept {
+    auto* data = static_cast<const SharedData*>(m_view.get());
+
+    m_changedEvent.ResetEvent();
+    m_seenChangeCount =
+        ReadAcquire(&data->changeCounts[static_cast<size_t>(m_kind)]);
+}
+
+std::vector<ModStatusTable::Item> ModStatusTable::Reader::Read() {
+    auto* data = static_cast<const SharedData*>(m_view.get());
+
+    std::vector<Item> items;
+
+    struct ProcessState {
+        ULONGLONG creationTime;
+        bool running;
+    };
+
+    std::unordered_map<DWORD, ProcessState> processStates;
+
+    ULONG recordCount = std::min(
+        static_cast<ULONG>(ReadAcquire(&data->recordCountUsed)),
+        static_cast<ULONG>(kRecordCount));
+    for (ULONG i = 0; i < recordCount; i++) {
+        const Record& sharedRecord = data->records[i];
+        if (!ReadAcquire(&sharedRecord.ownerProcessId) ||
+            sharedRecord.kind != static_cast<DWORD>(m_kind)) {
+            continue;
+        }
+
+        Record record;
+        bool consistent = false;
+        for (int attempt = 0; attempt < kMaxReadAttempts; attempt++) {
+            LONG sequence = ReadAcquire(&sharedRecord.sequence);
+            if (sequence & 1) {
+                Sleep(0);
+                continue;
+            }
+
+            memcpy(&record, &sharedRecord, sizeof(Record));
+
+            MemoryBarrier();
+            if (ReadAcquire(&sharedRecord.sequence) == sequence) {
+                consistent = true;
+                break;
+            }
+        }
+
+        if (!consistent || !record.processId ||
+            record.kind != static_cast<DWORD>(m_kind)) {
+            continue;
+        }
+
+        auto [it, inserted] = processStates.try_emplace(record.processId);
+        if (inserted || it->second.creationTime != record.processCreationTime) {
+            it->second = {
+                .creationTime = record.processCreationTime,
+                .running = IsProcessRunning(record.processId,
+                                            record.processCreationTime),
+            };
+        }
+
+        if (!it->second.running) {
+            continue;
+        }
+
+        record.modName[ARRAYSIZE(record.modName) - 1] = L'\0';
+        record.processName[ARRAYSIZE(record.processName) - 1] = L'\0';
+        record.value[ARRAYSIZE(record.value) - 1] = L'\0';
+
+        items.push_back({
+            .id = i,
+            .version = static_cast<ULONG>(record.sequence),
+            .processId = record.processId,
+            .creationTime = record.creationTime,
+            .modName = record.modName,
+            .processName = record.processName,
+            .value = record.value,
+        });
+    }
+
+    return items;
+}
+
+// static
+void ModStatusTable::OnSessionManagerChanged() noexcept {
+    auto& cache = GetCache();
+    std::lock_guard guard(cache.GetMutex());
+
+    cache.Reopen();
+
+    for (Entry* entry : cache.GetEntries()) {
+        entry->WriteToNewTable();
+    }
+}
+
+// static
+std::wstring ModStatusTable::MakeMappingName(DWORD sessionManagerProcessId) {
+    WCHAR szName[SessionPrivateNamespace::kPrivateNamespaceMaxLen +
+                 sizeof("\\ModStatusTable")];
+    int namePos =
+        SessionPrivateNamespace::MakeName(szName, sessionManagerProcessId);
+    swprintf_s(szName + namePos, ARRAYSIZE(szName) - namePos,
+               L"\\ModStatusTable");
+    return szName;
+}
+
+// static
+std::wstring ModStatusTable::MakeEventName(DWORD sessionManagerProcessId,
+                                           Kind kind) {
+    WCHAR szName[SessionPrivateNamespace::kPrivateNamespaceMaxLen +
+                 sizeof("\\ModStatusTableChanged-kind=4294967295")];
+    int namePos =
+        SessionPrivateNamespace::MakeName(szName, sessionManagerProcessId);
+    swprintf_s(szName + namePos, ARRAYSIZE(szName) - namePos,
+               L"\\ModStatusTableChanged-kind=%u", static_cast<DWORD>(kind));
+    return szName;
+}
+
+// static
+ModStatusTable::SharedDataCache& ModStatusTable::GetCache() noexcept {
+    STATIC_INIT_ONCE(NoDestructorIfTerminating<SharedDataCache>, cache);
+    return **cache;
+}
+
+// static
+ModStatusTable::SharedData* ModStatusTable::GetSharedData() noexcept {
+    return GetCache().GetSharedData();
+}
+
+// static
+void ModStatusTable::NotifyChanged(Kind kind) noexcept {
+    SharedData* data = GetSharedData();
+    if (!data) {
+        return;
+    }
+
+    InterlockedIncrement(&data->changeCounts[static_cast<size_t>(kind)]);
+
+    HANDLE changedEvent = GetCache().GetChangedEvent(kind);
+    if (changedEvent) {
+        SetEvent(changedEvent);
+    }
+}
+
+// static
+LONG ModStatusTable::ClaimRecord(SharedData* data) noexcept {
+    LONG currentProcessId = static_cast<LONG>(GetCurrentProcessId());
+
+    auto tryClaim = [data, currentProcessId](ULONG slot, LONG owner) {
+        if (InterlockedCompareExchange(&data->records[slot].ownerProcessId,
+                                       currentProcessId,
+                                       owner) != owner) {
+            return false;
+        }
+
+        // Keep track of the used part of the table, so that readers don't have
+        // to go over all of it.
+        LONG recordCountUsed = ReadAcquire(&data->recordCountUsed);
+        while (recordCountUsed <= static_cast<LONG>(slot)) {
+            LONG previous = InterlockedCompareExchange(
+                &data->recordCountUsed, static_cast<LONG>(slot) + 1,
+                recordCountUsed);
+            if (previous == recordCountUsed) {
+                break;
+            }
+
+            recordCountUsed = previous;
+        }
+
+        return true;
+    };
+
+    // Free records are reused first, so that the used part of the table stays
+    // small.
+    for (ULONG i = 0; i < kRecordCount; i++) {
+        if (!ReadAcquire(&data->records[i].ownerProcessId) && tryClaim(i, 0)) {
+            return static_cast<LONG>(i);
+        }
+    }
+
+    // Records of processes which terminated without freeing them.
+    for (ULONG i = 0; i < kRecordCount; i++) {
+        const Record& record = data->records[i];
+        LONG owner = ReadAcquire(&record.ownerProcessId);
+        if (owner && (owner == currentProcessId ||
+                      IsProcessRunning(static_cast<DWORD>(owner),
+                                       record.processCreationTime))) {
+            continue;
+        }
+
+        if (tryClaim(i, owner)) {
+            return static_cast<LONG>(i);
+        }
+    }
+
+    return -1;
+}
+
+// static
+void ModStatusTable::BeginWrite(Record& record) noexcept {
+    // If the sequence was odd, the previous owner terminated in the middle of
+    // a write.
+    if (!(InterlockedIncrement(&record.sequence) & 1)) {
+        InterlockedIncrement(&record.sequence);
+    }
+}
+
+// static
+void ModStatusTable::EndWrite(Record& record) noexcept {
+    InterlockedIncrement(&record.sequence);
+}
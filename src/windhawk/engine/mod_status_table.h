@@ -0,0 +1,166 @@
+#pragma once
+
+// The statuses and tasks of the mods loaded in all processes, kept in shared
+// memory which is owned by the session manager process. Each mod instance owns
+// a record per kind, which it claims on the first write and frees when it's
+// done. Records are written with a per-record sequence counter, so that
+// readers can copy them without locking. This replaces a temporary file per
+// mod instance per process, which was a lot of file system churn with many
+// mods and processes.
+//
+// For each kind, a named event is signaled on every change. Readers reset it,
+// so a change counter is kept as well to re-signal the event for readers which
+// weren't waiting at that moment.
+class ModStatusTable {
+   public:
+    enum class Kind {
+        kStatus,
+        kTask,
+        kHookCallStats,
+        // A single record per process, see EngineMetrics.
+        kEngineMetrics,
+        // See ModLoadTimes.
+        kLoadTimes,
+        // See ModCpuSampler.
+        kCpuUsage,
+        // A single record per process, see CrashLoopGuard.
+        kCrashLoop,
+        kCount,
+    };
+
+    static constexpr size_t kRecordCount = 16384;
+    static constexpr size_t kModNameMaxLength = 63;
+    static constexpr size_t kProcessNameMaxLength = 63;
+    static constexpr size_t kValueMaxLength = 127;
+
+    ModStatusTable() = delete;
+
+    // Used by the session manager, the shared memory exists as long as the
+    // object exists. Must be created after the private namespace of the
+    // session manager.
+    class Owner {
+       public:
+        Owner();
+
+        Owner(const Owner&) = delete;
+        Owner& operator=(const Owner&) = delete;
+
+       private:
+        wil::unique_handle m_mapping;
+        wil::unique_event_nothrow
+            m_changedEvents[static_cast<size_t>(Kind::kCount)];
+    };
+
+    // A record of a mod instance in the current process. Setting a value never
+    // throws, and is silently skipped if the shared memory isn't available or
+    // is full. Not thread safe.
+    class Entry {
+       public:
+        Entry(Kind kind, PCWSTR modName);
+        ~Entry();
+
+        Entry(const Entry&) = delete;
+        Entry& operator=(const Entry&) = delete;
+
+        // Setting nullptr frees the record.
+        void Set(PCWSTR value) noexcept;
+
+       private:
+        friend class ModStatusTable;
+
+        void Write(PCWSTR value) noexcept;
+        void Free() noexcept;
+        // Claims a record in the table of a new session manager, and writes
+        // the last value to it, if there was a record before.
+        void WriteToNewTable() noexcept;
+
+        Kind m_kind;
+        std::wstring m_modName;
+        std::wstring m_value;
+        LONG m_slot = -1;
+    };
+
+    // Called by the customization session after a new session manager took
+    // over the session. The records of the current process are written to the
+    // table of the new session manager from now on, and the existing ones are
+    // written to it right away.
+    static void OnSessionManagerChanged() noexcept;
+
+    struct Item {
+        // The record slot, stays the same while the record is used by the
+        // same mod instance.
+        ULONG id;
+        // Changes whenever the record is written.
+        ULONG version;
+        DWORD processId;
+        // When the record was claimed, as a FILETIME value.
+        ULONGLONG creationTime;
+        std::wstring modName;
+        std::wstring processName;
+        std::wstring value;
+    };
+
+    // Reads the records of one kind, used by the app.
+    class Reader {
+       public:
+        Reader(DWORD sessionManagerProcessId, Kind kind);
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        // Signaled when the records changed since the last ContinueMonitoring
+        // call, or since construction.
+        HANDLE GetChangeEvent() noexcept;
+        void ContinueMonitoring() noexcept;
+
+        // Records of processes which are no longer running are skipped.
+        std::vector<Item> Read();
+
+       private:
+        Kind m_kind;
+        LONG m_seenChangeCount;
+        wil::unique_handle m_mapping;
+        wil::unique_mapview_ptr<void> m_view;
+        wil::unique_event_nothrow m_changedEvent;
+    };
+
+   private:
+    static constexpr DWORD kVersion = 6;
+
+    // The layout must be the same for 32-bit and 64-bit processes.
+    struct Record {
+        // The ID of the process which owns the record, zero if free.
+        LONG ownerProcessId;
+        // Odd while the record is being written.
+        LONG sequence;
+        DWORD kind;
+        // Zero if the record is empty.
+        DWORD processId;
+        ULONGLONG processCreationTime;
+        ULONGLONG creationTime;
+        WCHAR modName[kModNameMaxLength + 1];
+        WCHAR processName[kProcessNameMaxLength + 1];
+        WCHAR value[kValueMaxLength + 1];
+    };
+
+    struct SharedData {
+        DWORD version;
+        LONG changeCounts[static_cast<size_t>(Kind::kCount)];
+        // The records past this index were never used.
+        LONG recordCountUsed;
+        Record records[kRecordCount];
+    };
+
+    class SharedDataCache;
+
+    static std::wstring MakeMappingName(DWORD sessionManagerProcessId);
+    static std::wstring MakeEventName(DWORD sessionManagerProcessId,
+                                      Kind kind);
+    static SharedDataCache& GetCache() noexcept;
+    static SharedData* GetSharedData() noexcept;
+    static void NotifyChanged(Kind kind) noexcept;
+    // Returns the slot of the claimed record, or -1 if the table is full.
+    static LONG ClaimRecord(SharedData* data) noexcept;
+    static void BeginWrite(Record& record) noexcept;
+    static void EndWrite(Record& record) noexcept;
+};
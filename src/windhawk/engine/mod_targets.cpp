@@ -0,0 +1,203 @@
+#include "stdafx.h"
+
+#include "functions.h"
+#include "logger.h"
+#include "mod_targets.h"
+#include "process_lists.h"
+#include "storage_manager.h"
+
+namespace {
+
+// Same as DoesArchitectureMatchPatternPart in mod.cpp, but for the given
+// machine type instead of the architecture the engine was compiled for.
+bool DoesArchitectureMatchMachine(std::wstring_view pattern,
+                                  USHORT processMachine) {
+    for (const auto& patternPart :
+         Functions::SplitStringToViews(pattern, L'|')) {
+        switch (processMachine) {
+            case IMAGE_FILE_MACHINE_I386:
+                if (patternPart == L"x86") {
+                    return true;
+                }
+                break;
+
+            // For now, x86-64 matches both x64 and ARM64.
+            case IMAGE_FILE_MACHINE_AMD64:
+                if (patternPart == L"x86-64" || patternPart == L"amd64") {
+                    return true;
+                }
+                break;
+
+            case IMAGE_FILE_MACHINE_ARM64:
+                if (patternPart == L"x86-64" || patternPart == L"arm64") {
+                    return true;
+                }
+                break;
+
+            default:
+                // Unknown, assume it might match.
+                return true;
+        }
+    }
+
+    return false;
+}
+
+std::wstring JoinPatterns(std::wstring first, const std::wstring& second) {
+    if (first.empty()) {
+        return second;
+    }
+
+    if (!second.empty()) {
+        first += L'|';
+        first += second;
+    }
+
+    return first;
+}
+
+// FNV-1a, the same as SymbolIndex::HashName. The terminating null is hashed
+// as well, so that the boundaries of consecutive values are part of the hash.
+void HashValue(ULONGLONG& hash, std::wstring_view value) {
+    for (WCHAR c : value) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+
+    // The terminating null, for which the xor is a no-op.
+    hash *= 1099511628211ULL;
+}
+
+}  // namespace
+
+ModTargets::ModTargets()
+    : m_criticalProcesses(
+          std::wstring(ProcessLists::kCriticalProcesses) + L'|' +
+          ProcessLists::kCriticalProcessesForMods),
+      m_fingerprint(14695981039346656037ULL) {
+    HashValue(m_fingerprint, ProcessLists::kCriticalProcesses);
+    HashValue(m_fingerprint, ProcessLists::kCriticalProcessesForMods);
+
+    auto& storageManager = StorageManager::GetInstance();
+
+    storageManager.EnumMods([this, &storageManager](PCWSTR modName) {
+        try {
+            auto settings =
+                storageManager.GetModConfig(modName, nullptr)->ReadAll();
+            if (settings.GetInt(L"Disabled").value_or(0)) {
+                return;
+            }
+
+            bool includeExcludeCustomOnly =
+                settings.GetInt(L"IncludeExcludeCustomOnly").value_or(0);
+
+            std::wstring include;
+            std::wstring exclude;
+            if (!includeExcludeCustomOnly) {
+                include = settings.GetString(L"Include").value_or(L"");
+                exclude = settings.GetString(L"Exclude").value_or(L"");
+            }
+
+            include = JoinPatterns(
+                std::move(include),
+                settings.GetString(L"IncludeCustom").value_or(L""));
+            if (include.empty()) {
+                return;
+            }
+
+            exclude = JoinPatterns(
+                std::move(exclude),
+                settings.GetString(L"ExcludeCustom").value_or(L""));
+
+            // Err on the side of injecting if the patterns can't be evaluated
+            // correctly.
+            bool includeAll =
+                Functions::HasUserSpecificEnvironmentVariables(include);
+            if (Functions::HasUserSpecificEnvironmentVariables(exclude)) {
+                exclude.clear();
+            }
+
+            const auto& target = m_targets.emplace_back(Target{
+                .modName = modName,
+                .include = PathPattern(include),
+                .exclude = PathPattern(exclude),
+                .architecture =
+                    settings.GetString(L"Architecture").value_or(L""),
+                .includeAll = includeAll,
+                .patternsMatchCriticalSystemProcesses =
+                    !!settings.GetInt(L"PatternsMatchCriticalSystemProcesses")
+                          .value_or(0),
+            });
+
+            // The mod name doesn't affect the matching. The raw patterns are
+            // hashed, environment variables in them are assumed not to change.
+            // A different enumeration order only makes the fingerprint change
+            // needlessly.
+            HashValue(m_fingerprint, include);
+            HashValue(m_fingerprint, exclude);
+            HashValue(m_fingerprint, target.architecture);
+            HashValue(m_fingerprint, target.includeAll ? L"1" : L"0");
+            HashValue(m_fingerprint,
+                      target.patternsMatchCriticalSystemProcesses ? L"1"
+                                                                  : L"0");
+        } catch (const std::exception& e) {
+            LOG(L"Error reading the config of mod %s: %S", modName, e.what());
+        }
+    });
+}
+
+bool ModTargets::MightMatch(const PathPattern::Path& processPath,
+                            USHORT processMachine) const {
+    if (m_targets.empty()) {
+        return false;
+    }
+
+    bool isCriticalProcess = m_criticalProcesses.Matches(processPath);
+
+    return std::any_of(m_targets.begin(), m_targets.end(),
+                       [&](const Target& target) {
+                           return TargetMatches(target, processPath,
+                                                isCriticalProcess,
+                                                processMachine);
+                       });
+}
+
+std::vector<std::wstring> ModTargets::GetMatchingMods(
+    const PathPattern::Path& processPath,
+    USHORT processMachine) const {
+    std::vector<std::wstring> modNames;
+    if (m_targets.empty()) {
+        return modNames;
+    }
+
+    bool isCriticalProcess = m_criticalProcesses.Matches(processPath);
+
+    for (const auto& target : m_targets) {
+        if (TargetMatches(target, processPath, isCriticalProcess,
+                          processMachine)) {
+            modNames.push_back(target.modName);
+        }
+    }
+
+    return modNames;
+}
+
+// static
+bool ModTargets::TargetMatches(const Target& target,
+                               const PathPattern::Path& processPath,
+                               bool isCriticalProcess,
+                               USHORT processMachine) {
+    if (!target.architecture.empty() &&
+        !DoesArchitectureMatchMachine(target.architecture, processMachine)) {
+        return false;
+    }
+
+    bool explicitOnly =
+        !target.patternsMatchCriticalSystemProcesses && isCriticalProcess;
+    if (!target.includeAll &&
+        !target.include.Matches(processPath, explicitOnly)) {
+        return false;
+    }
+
+    return !target.exclude.Matches(processPath);
+}
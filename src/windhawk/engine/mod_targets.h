@@ -0,0 +1,48 @@
+#pragma once
+
+#include "path_pattern.h"
+
+// The targeting settings of all enabled mods, which allow the session manager
+// to tell whether any mod might be loaded in a process before injecting the
+// engine into it. The checks are the same as in
+// Mod::ShouldLoadInRunningProcess, but for a process other than the current
+// one. The settings are read once on construction, so a new instance has to be
+// created when the mods config changes.
+class ModTargets {
+   public:
+    ModTargets();
+
+    // processMachine is the machine type of the process, as returned by
+    // DllInject::GetProcessArch.
+    bool MightMatch(const PathPattern::Path& processPath,
+                    USHORT processMachine) const;
+
+    // Returns the names of the mods which might be loaded in the process.
+    std::vector<std::wstring> GetMatchingMods(
+        const PathPattern::Path& processPath,
+        USHORT processMachine) const;
+
+    // A hash of all the settings which the matching depends on, which changes
+    // whenever a check might return a different result, and is the same
+    // across sessions otherwise.
+    ULONGLONG GetFingerprint() const { return m_fingerprint; }
+
+   private:
+    struct Target {
+        std::wstring modName;
+        PathPattern include;
+        PathPattern exclude;
+        std::wstring architecture;
+        bool includeAll;
+        bool patternsMatchCriticalSystemProcesses;
+    };
+
+    static bool TargetMatches(const Target& target,
+                              const PathPattern::Path& processPath,
+                              bool isCriticalProcess,
+                              USHORT processMachine);
+
+    std::vector<Target> m_targets;
+    PathPattern m_criticalProcesses;
+    ULONGLONG m_fingerprint;
+};
@@ -0,0 +1,201 @@
+#include "stdafx.h"
+
+#include "logger.h"
+#include "mod_thread_pool.h"
+#include "no_destructor.h"
+#include "var_init_once.h"
+
+ModThreadPool::ModThreadPool()
+    : m_workEnvironment(MakeEnvironment()),
+      m_timerEnvironment(MakeEnvironment()) {
+    m_cleanupGroup.reset(CreateThreadpoolCleanupGroup());
+    THROW_LAST_ERROR_IF_NULL(m_cleanupGroup);
+
+    SetThreadpoolCallbackCleanupGroup(&m_workEnvironment, m_cleanupGroup.get(),
+                                      WorkCancelCallback);
+}
+
+ModThreadPool::~ModThreadPool() {
+    Close();
+
+    DestroyThreadpoolEnvironment(&m_workEnvironment);
+    DestroyThreadpoolEnvironment(&m_timerEnvironment);
+}
+
+void ModThreadPool::QueueWork(Callback callback, void* context) {
+    if (!callback) {
+        throw std::invalid_argument("The callback must be set");
+    }
+
+    auto work = std::make_unique<Work>(Work{
+        .callback = callback,
+        .context = context,
+    });
+
+    std::lock_guard guard(m_mutex);
+
+    if (m_closed) {
+        throw std::logic_error("Not allowed while uninitializing");
+    }
+
+    THROW_IF_WIN32_BOOL_FALSE(
+        TrySubmitThreadpoolCallback(WorkCallback, work.get(),
+                                    &m_workEnvironment));
+    work.release();
+}
+
+HANDLE ModThreadPool::CreateTimer(Callback callback,
+                                  void* context,
+                                  DWORD dueTime,
+                                  DWORD period) {
+    if (!callback) {
+        throw std::invalid_argument("The callback must be set");
+    }
+
+    auto timer = std::make_unique<Timer>();
+    timer->callback = callback;
+    timer->context = context;
+
+    std::lock_guard guard(m_mutex);
+
+    if (m_closed) {
+        throw std::logic_error("Not allowed while uninitializing");
+    }
+
+    timer->timer.reset(
+        CreateThreadpoolTimer(TimerCallback, timer.get(), &m_timerEnvironment));
+    THROW_LAST_ERROR_IF_NULL(timer->timer);
+
+    SetTimerDueTime(timer->timer.get(), dueTime, period);
+
+    // The address is unique while the timer exists, and is never null.
+    HANDLE handle = timer.get();
+    m_timers.emplace(handle, std::move(timer));
+    return handle;
+}
+
+bool ModThreadPool::SetTimer(HANDLE timer, DWORD dueTime, DWORD period) {
+    std::lock_guard guard(m_mutex);
+
+    auto it = m_timers.find(timer);
+    if (it == m_timers.end()) {
+        return false;
+    }
+
+    SetTimerDueTime(it->second->timer.get(), dueTime, period);
+    return true;
+}
+
+bool ModThreadPool::CloseTimer(HANDLE timer) {
+    std::unique_ptr<Timer> closedTimer;
+
+    {
+        std::lock_guard guard(m_mutex);
+
+        auto it = m_timers.find(timer);
+        if (it == m_timers.end()) {
+            return false;
+        }
+
+        if (it->second->callbackThreadId == GetCurrentThreadId()) {
+            throw std::logic_error(
+                "A timer can't be closed from its own callback");
+        }
+
+        closedTimer = std::move(it->second);
+        m_timers.erase(it);
+    }
+
+    // Waits for the running callbacks without holding the lock, since they
+    // might use the other timers.
+    closedTimer.reset();
+    return true;
+}
+
+void ModThreadPool::Close() {
+    std::unordered_map<HANDLE, std::unique_ptr<Timer>> timers;
+
+    {
+        std::lock_guard guard(m_mutex);
+
+        m_closed = true;
+        timers = std::move(m_timers);
+        m_timers.clear();
+    }
+
+    timers.clear();
+
+    // Cancels the work items which didn't start yet, which frees them via
+    // WorkCancelCallback, and waits for the running ones.
+    CloseThreadpoolCleanupGroupMembers(m_cleanupGroup.get(), TRUE, nullptr);
+}
+
+// static
+TP_CALLBACK_ENVIRON ModThreadPool::MakeEnvironment() {
+    // Created on first use and shared by all mods of the process. If it can't
+    // be created, the default thread pool of the process is used.
+    STATIC_INIT_ONCE(NoDestructorIfTerminating<unique_threadpool>, pool, []() {
+        unique_threadpool pool(CreateThreadpool(nullptr));
+        if (pool) {
+            SetThreadpoolThreadMaximum(pool.get(), kMaxThreads);
+        } else {
+            LOG(L"CreateThreadpool error: %u", GetLastError());
+        }
+
+        return pool;
+    }());
+
+    TP_CALLBACK_ENVIRON environment;
+    InitializeThreadpoolEnvironment(&environment);
+    if (**pool) {
+        SetThreadpoolCallbackPool(&environment, (**pool).get());
+    }
+
+    return environment;
+}
+
+// static
+void ModThreadPool::SetTimerDueTime(PTP_TIMER timer,
+                                    DWORD dueTime,
+                                    DWORD period) {
+    if (dueTime == INFINITE) {
+        SetThreadpoolTimer(timer, nullptr, 0, 0);
+        return;
+    }
+
+    // A negative due time is relative. A due time of zero is rounded up, so
+    // that it's never taken as an absolute time.
+    FILETIME fileTime = wil::filetime::from_int64(static_cast<UINT64>(
+        -static_cast<INT64>(std::max(dueTime, 1UL)) *
+        wil::filetime_duration::one_millisecond));
+    SetThreadpoolTimer(timer, &fileTime, period, 0);
+}
+
+// static
+void CALLBACK ModThreadPool::WorkCallback(PTP_CALLBACK_INSTANCE instance,
+                                          PVOID context) {
+    std::unique_ptr<Work> work(static_cast<Work*>(context));
+    work->callback(work->context);
+}
+
+// static
+void CALLBACK ModThreadPool::WorkCancelCallback(PVOID objectContext,
+                                                PVOID cleanupContext) {
+    delete static_cast<Work*>(objectContext);
+}
+
+// static
+void CALLBACK ModThreadPool::TimerCallback(PTP_CALLBACK_INSTANCE instance,
+                                           PVOID context,
+                                           PTP_TIMER timer) {
+    auto* modTimer = static_cast<Timer*>(context);
+
+    // Best effort, if callbacks of a periodic timer overlap, only the thread
+    // which entered last is recorded.
+    DWORD threadId = GetCurrentThreadId();
+    modTimer->callbackThreadId = threadId;
+
+    modTimer->callback(modTimer->context);
+
+    modTimer->callbackThreadId.compare_exchange_strong(threadId, 0);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+// Runs the work items and the timers of a mod on a thread pool which is shared
+// by all mods of the process, so that mods don't need threads of their own,
+// each of which would have to be waited for on unload. Close cancels the work
+// items which didn't start yet, closes the timers, and waits for the running
+// callbacks to return.
+class ModThreadPool {
+   public:
+    using Callback = void (*)(void* context);
+
+    ModThreadPool();
+    ~ModThreadPool();
+
+    ModThreadPool(const ModThreadPool&) = delete;
+    ModThreadPool& operator=(const ModThreadPool&) = delete;
+
+    // Throws on errors, and if called after Close.
+    void QueueWork(Callback callback, void* context);
+    // The due time and the period are in milliseconds, a due time of INFINITE
+    // creates a stopped timer and a period of zero fires the timer once.
+    // Returns a handle which is never null. Throws on errors, and if called
+    // after Close.
+    HANDLE CreateTimer(Callback callback,
+                       void* context,
+                       DWORD dueTime,
+                       DWORD period);
+    // Returns false if the timer isn't known, e.g. if it was closed.
+    bool SetTimer(HANDLE timer, DWORD dueTime, DWORD period);
+    // Stops the timer and waits for its running callbacks to return. Throws if
+    // called from a callback of the timer, since it would wait for itself.
+    // Returns false if the timer isn't known.
+    bool CloseTimer(HANDLE timer);
+    void Close();
+
+   private:
+    using unique_threadpool = wil::
+        unique_any<PTP_POOL, decltype(&::CloseThreadpool), ::CloseThreadpool>;
+    using unique_cleanup_group =
+        wil::unique_any<PTP_CLEANUP_GROUP,
+                        decltype(&::CloseThreadpoolCleanupGroup),
+                        ::CloseThreadpoolCleanupGroup>;
+
+    // Limits the threads which mods occupy in each process. Callbacks which
+    // block for a long time delay the callbacks of other mods.
+    static constexpr DWORD kMaxThreads = 8;
+
+    struct Work {
+        Callback callback;
+        void* context;
+    };
+
+    struct Timer {
+        Callback callback;
+        void* context;
+        // The thread which runs the callback, if any, to detect a timer which
+        // is closed from its own callback.
+        std::atomic<DWORD> callbackThreadId = 0;
+        // Declared last, so that the callbacks are done before the rest is
+        // destroyed.
+        wil::unique_threadpool_timer timer;
+    };
+
+    static TP_CALLBACK_ENVIRON MakeEnvironment();
+    static void SetTimerDueTime(PTP_TIMER timer, DWORD dueTime, DWORD period);
+
+    static void CALLBACK WorkCallback(PTP_CALLBACK_INSTANCE instance,
+                                      PVOID context);
+    static void CALLBACK WorkCancelCallback(PVOID objectContext,
+                                            PVOID cleanupContext);
+    static void CALLBACK TimerCallback(PTP_CALLBACK_INSTANCE instance,
+                                       PVOID context,
+                                       PTP_TIMER timer);
+
+    // Work items are members of the cleanup group, so that Close can cancel
+    // and wait for them. Timers are tracked separately, since they can also
+    // be closed individually.
+    TP_CALLBACK_ENVIRON m_workEnvironment;
+    TP_CALLBACK_ENVIRON m_timerEnvironment;
+    unique_cleanup_group m_cleanupGroup;
+    std::mutex m_mutex;
+    std::unordered_map<HANDLE, std::unique_ptr<Timer>> m_timers;
+    bool m_closed = false;
+};
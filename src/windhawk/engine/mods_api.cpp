@@ -51,6 +51,12 @@ BOOL InternalWh_DeleteValue(void* mod, PCWSTR valueName) {
     return static_cast<LoadedMod*>(mod)->DeleteValue(valueName);
 }
 
+BOOL InternalWh_SetValues(void* mod,
+                          const WH_VALUE* values,
+                          size_t valuesCount) {
+    return static_cast<LoadedMod*>(mod)->SetValues(values, valuesCount);
+}
+
 size_t InternalWh_GetModStoragePath(void* mod,
                                     PWSTR pathBuffer,
                                     size_t bufferChars) {
@@ -70,6 +76,16 @@ void InternalWh_FreeStringSetting(void* mod, PCWSTR string) {
     static_cast<LoadedMod*>(mod)->FreeStringSetting(string);
 }
 
+const WH_SETTINGS* InternalWh_GetSettings(void* mod,
+                                          PCWSTR prefix,
+                                          va_list args) {
+    return static_cast<LoadedMod*>(mod)->GetSettings(prefix, args);
+}
+
+void InternalWh_FreeSettings(void* mod, const WH_SETTINGS* settings) {
+    static_cast<LoadedMod*>(mod)->FreeSettings(settings);
+}
+
 BOOL InternalWh_SetFunctionHook(void* mod,
                                 void* targetFunction,
                                 void* hookFunction,
@@ -78,6 +94,16 @@ BOOL InternalWh_SetFunctionHook(void* mod,
         targetFunction, hookFunction, originalFunction);
 }
 
+BOOL InternalWh_HookImport(void* mod,
+                           HMODULE module,
+                           PCSTR dllName,
+                           PCSTR functionName,
+                           void* hookFunction,
+                           void** originalFunction) {
+    return static_cast<LoadedMod*>(mod)->HookImport(
+        module, dllName, functionName, hookFunction, originalFunction);
+}
+
 BOOL InternalWh_RemoveFunctionHook(void* mod, void* targetFunction) {
     return static_cast<LoadedMod*>(mod)->RemoveFunctionHook(targetFunction);
 }
@@ -132,6 +158,16 @@ void InternalWh_FindCloseSymbol(void* mod, HANDLE symSearch) {
     static_cast<LoadedMod*>(mod)->FindCloseSymbol(symSearch);
 }
 
+size_t InternalWh_GetSymbolFromAddress(void* mod,
+                                       HMODULE module,
+                                       const void* address,
+                                       PWSTR nameBuffer,
+                                       size_t bufferChars,
+                                       size_t* offset) {
+    return static_cast<LoadedMod*>(mod)->GetSymbolFromAddress(
+        module, address, nameBuffer, bufferChars, offset);
+}
+
 BOOL InternalWh_HookSymbols(void* mod,
                             HMODULE module,
                             const WH_SYMBOL_HOOK* symbolHooks,
@@ -141,10 +177,38 @@ BOOL InternalWh_HookSymbols(void* mod,
                                                      symbolHooksCount, options);
 }
 
+BOOL InternalWh_HookSymbolsBatch(void* mod,
+                                 const WH_HOOK_SYMBOLS_BATCH_ITEM* items,
+                                 size_t itemsCount,
+                                 const WH_HOOK_SYMBOLS_OPTIONS* options) {
+    return static_cast<LoadedMod*>(mod)->HookSymbolsBatch(items, itemsCount,
+                                                          options);
+}
+
 BOOL InternalWh_Disasm(void* mod, void* address, WH_DISASM_RESULT* result) {
     return static_cast<LoadedMod*>(mod)->Disasm(address, result);
 }
 
+size_t InternalWh_DisasmRange(void* mod,
+                              void* address,
+                              size_t size,
+                              WH_DISASM_RESULT* results,
+                              size_t resultsCount,
+                              DWORD flags) {
+    return static_cast<LoadedMod*>(mod)->DisasmRange(address, size, results,
+                                                     resultsCount, flags);
+}
+
+void* InternalWh_FindPattern(void* mod,
+                             HMODULE module,
+                             const void* pattern,
+                             const void* mask,
+                             size_t patternSize,
+                             const WH_FIND_PATTERN_OPTIONS* options) {
+    return static_cast<LoadedMod*>(mod)->FindPattern(module, pattern, mask,
+                                                     patternSize, options);
+}
+
 const WH_URL_CONTENT* InternalWh_GetUrlContent(
     void* mod,
     PCWSTR url,
@@ -155,3 +219,106 @@ const WH_URL_CONTENT* InternalWh_GetUrlContent(
 void InternalWh_FreeUrlContent(void* mod, const WH_URL_CONTENT* content) {
     static_cast<LoadedMod*>(mod)->FreeUrlContent(content);
 }
+
+HANDLE InternalWh_GetUrlContentAsync(
+    void* mod,
+    PCWSTR url,
+    const WH_GET_URL_CONTENT_ASYNC_OPTIONS* options,
+    WH_URL_CONTENT_CALLBACK callback,
+    void* context) {
+    return static_cast<LoadedMod*>(mod)->GetUrlContentAsync(url, options,
+                                                            callback, context);
+}
+
+BOOL InternalWh_CancelUrlContentAsync(void* mod, HANDLE request) {
+    return static_cast<LoadedMod*>(mod)->CancelUrlContentAsync(request);
+}
+
+HANDLE InternalWh_RegisterModuleLoadCallback(void* mod,
+                                             PCWSTR moduleName,
+                                             WH_MODULE_LOAD_CALLBACK callback,
+                                             void* context) {
+    return static_cast<LoadedMod*>(mod)->RegisterModuleLoadCallback(
+        moduleName, callback, context);
+}
+
+BOOL InternalWh_UnregisterModuleLoadCallback(void* mod, HANDLE registration) {
+    return static_cast<LoadedMod*>(mod)->UnregisterModuleLoadCallback(
+        registration);
+}
+
+BOOL InternalWh_QueueWork(void* mod,
+                          WH_THREAD_POOL_CALLBACK callback,
+                          void* context) {
+    return static_cast<LoadedMod*>(mod)->QueueWork(callback, context);
+}
+
+HANDLE InternalWh_CreateTimer(void* mod,
+                              WH_THREAD_POOL_CALLBACK callback,
+                              void* context,
+                              DWORD dueTime,
+                              DWORD period) {
+    return static_cast<LoadedMod*>(mod)->CreateTimer(callback, context,
+                                                     dueTime, period);
+}
+
+BOOL InternalWh_SetTimer(void* mod, HANDLE timer, DWORD dueTime, DWORD period) {
+    return static_cast<LoadedMod*>(mod)->SetTimer(timer, dueTime, period);
+}
+
+BOOL InternalWh_CloseTimer(void* mod, HANDLE timer) {
+    return static_cast<LoadedMod*>(mod)->CloseTimer(timer);
+}
+
+BOOL InternalWh_RunOnThread(void* mod,
+                            DWORD threadId,
+                            WH_RUN_ON_THREAD_CALLBACK callback,
+                            void* context,
+                            DWORD timeout) {
+    return static_cast<LoadedMod*>(mod)->RunOnThread(threadId, callback,
+                                                     context, timeout);
+}
+
+const WH_SHARED_MEMORY* InternalWh_OpenSharedMemory(void* mod,
+                                                    PCWSTR name,
+                                                    size_t size) {
+    return static_cast<LoadedMod*>(mod)->OpenSharedMemory(name, size);
+}
+
+void InternalWh_CloseSharedMemory(void* mod,
+                                  const WH_SHARED_MEMORY* sharedMemory) {
+    static_cast<LoadedMod*>(mod)->CloseSharedMemory(sharedMemory);
+}
+
+HANDLE InternalWh_ArenaCreate(void* mod, size_t maxSize) {
+    return static_cast<LoadedMod*>(mod)->ArenaCreate(maxSize);
+}
+
+void* InternalWh_ArenaAlloc(void* mod,
+                            HANDLE arena,
+                            size_t size,
+                            size_t alignment) {
+    return static_cast<LoadedMod*>(mod)->ArenaAlloc(arena, size, alignment);
+}
+
+BOOL InternalWh_ArenaReset(void* mod, HANDLE arena) {
+    return static_cast<LoadedMod*>(mod)->ArenaReset(arena);
+}
+
+BOOL InternalWh_ArenaDestroy(void* mod, HANDLE arena) {
+    return static_cast<LoadedMod*>(mod)->ArenaDestroy(arena);
+}
+
+HANDLE InternalWh_SubscribeVisualTreeChanges(
+    void* mod,
+    const WH_VISUAL_TREE_OPTIONS* options,
+    WH_VISUAL_TREE_CALLBACK callback,
+    void* context) {
+    return static_cast<LoadedMod*>(mod)->SubscribeVisualTreeChanges(
+        options, callback, context);
+}
+
+BOOL InternalWh_UnsubscribeVisualTreeChanges(void* mod, HANDLE subscription) {
+    return static_cast<LoadedMod*>(mod)->UnsubscribeVisualTreeChanges(
+        subscription);
+}
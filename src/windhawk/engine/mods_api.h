@@ -11,16 +11,35 @@
 #define WH_INTERNAL_OR(x, y) (y)
 #endif
 
+// Values for `WH_FIND_SYMBOL_OPTIONS::nameFilterType`.
+// The symbol name starts with the filter.
+#define WH_SYMBOL_NAME_FILTER_PREFIX 0
+// The symbol name contains the filter.
+#define WH_SYMBOL_NAME_FILTER_SUBSTRING 1
+// The symbol name matches the filter, in which `*` matches any sequence of
+// characters and `?` matches any single character.
+#define WH_SYMBOL_NAME_FILTER_WILDCARD 2
+
 typedef struct tagWH_FIND_SYMBOL_OPTIONS {
     // Must be set to `sizeof(WH_FIND_SYMBOL_OPTIONS)`.
     size_t optionsSize;
-    // The symbol server to query. Set to `NULL` to query the Microsoft public
-    // symbol server.
+    // The symbol server to query. Set to `NULL` to query the default symbol
+    // server, which is the Microsoft public symbol server unless another one
+    // is configured with the `SymbolServer` engine setting.
     PCWSTR symbolServer;
     // Set to `TRUE` to only retrieve decorated symbols, making the enumeration
     // faster. Can be especially useful for very large modules such as Chrome or
     // Firefox.
     BOOL noUndecoratedSymbols;
+    // If set, only symbols whose name matches the filter are returned, which
+    // is much faster than enumerating all symbols and filtering them in the
+    // mod. The undecorated name (`symbol`) is matched, or the decorated name
+    // (`symbolDecorated`) if `noUndecoratedSymbols` is set. Matching is case
+    // sensitive. Since Windhawk v1.8.
+    PCWSTR nameFilter;
+    // How `nameFilter` is matched, one of the `WH_SYMBOL_NAME_FILTER_*`
+    // values. Since Windhawk v1.8.
+    DWORD nameFilterType;
 } WH_FIND_SYMBOL_OPTIONS;
 
 typedef struct tagWH_FIND_SYMBOL {
@@ -37,9 +56,20 @@ typedef struct tagWH_HOOK_SYMBOLS_OPTIONS {
     // Same as for `WH_FIND_SYMBOL_OPTIONS`.
     BOOL noUndecoratedSymbols;
     // The online cache URL that will be used before downloading the symbols.
-    // Set to `NULL` to use the default online cache URL. Set to an empty string
-    // to disable the online cache.
+    // Set to `NULL` to use the default online cache URL, which can be
+    // configured with the `OnlineSymbolCacheUrl` engine setting. Set to an
+    // empty string to disable the online cache.
     PCWSTR onlineCacheUrl;
+    // Set to `TRUE` to only enumerate public symbols, which are the symbols
+    // with decorated names. Makes the enumeration faster for modules with
+    // private symbols, in which each function is also listed as a public
+    // symbol. Enabled automatically if `noUndecoratedSymbols` is set and all
+    // requested symbols are MSVC decorated names. Since Windhawk v1.8.
+    BOOL publicSymbolsOnly;
+    // Set to `TRUE` to stop the enumeration as soon as all non-optional hooks
+    // are resolved. Optional hooks which weren't found by then are treated as
+    // missing. Since Windhawk v1.8.
+    BOOL stopAtRequiredSymbols;
 } WH_HOOK_SYMBOLS_OPTIONS;
 
 typedef struct tagWH_DISASM_RESULT {
@@ -49,6 +79,21 @@ typedef struct tagWH_DISASM_RESULT {
     char text[96];
 } WH_DISASM_RESULT;
 
+// Flags for `Wh_DisasmRange`.
+// Only decode the instructions, leaving `text` empty. Much faster if only the
+// instruction lengths are needed.
+#define WH_DISASM_RANGE_NO_TEXT 0x00000001
+
+typedef struct tagWH_FIND_PATTERN_OPTIONS {
+    // Must be set to `sizeof(WH_FIND_PATTERN_OPTIONS)`.
+    size_t optionsSize;
+    // Set to `TRUE` to always scan the module. By default, the address of a
+    // found pattern is stored in the mod's symbol cache for the module
+    // version, and the module isn't scanned again as long as the bytes at the
+    // cached address still match.
+    BOOL noCache;
+} WH_FIND_PATTERN_OPTIONS;
+
 typedef struct tagWH_GET_URL_CONTENT_OPTIONS {
     // Must be set to `sizeof(WH_GET_URL_CONTENT_OPTIONS)`.
     size_t optionsSize;
@@ -57,6 +102,13 @@ typedef struct tagWH_GET_URL_CONTENT_OPTIONS {
     // struct will be `NULL`. If this field is `NULL`, the content will be
     // returned in the `data` field.
     PCWSTR targetFilePath;
+    // If not zero, successful responses are cached in a per-mod folder which
+    // is shared by all processes that the mod is loaded in, and a cached copy
+    // which is at most this many seconds old is returned without a request.
+    // The Cache-Control response header can shorten this, and stale copies
+    // are revalidated with their ETag or Last-Modified value, so that
+    // unchanged content isn't downloaded again. Since Windhawk v1.8.
+    DWORD cacheMaxAge;
 } WH_GET_URL_CONTENT_OPTIONS;
 
 typedef struct tagWH_URL_CONTENT {
@@ -65,6 +117,122 @@ typedef struct tagWH_URL_CONTENT {
     int statusCode;
 } WH_URL_CONTENT;
 
+// Called with the content once an asynchronous request completes, or with
+// `NULL` if it failed, timed out or was canceled.
+typedef void (*WH_URL_CONTENT_CALLBACK)(const WH_URL_CONTENT* content,
+                                        void* context);
+
+// Called with each received chunk of the content. Return `FALSE` to cancel the
+// request.
+typedef BOOL (*WH_URL_DATA_CALLBACK)(int statusCode,
+                                     const char* data,
+                                     size_t length,
+                                     void* context);
+
+typedef struct tagWH_GET_URL_CONTENT_ASYNC_OPTIONS {
+    // Must be set to `sizeof(WH_GET_URL_CONTENT_ASYNC_OPTIONS)`.
+    size_t optionsSize;
+    // The path to the file to which the content will be written, as for
+    // `WH_GET_URL_CONTENT_OPTIONS`. Can't be combined with `dataCallback`.
+    PCWSTR targetFilePath;
+    // The maximum time for the whole request, in milliseconds. If zero, there's
+    // no timeout.
+    DWORD timeout;
+    // If set, the content is passed to the callback as it's received instead
+    // of being collected, and the `data` field of the completed content will
+    // be `NULL`.
+    WH_URL_DATA_CALLBACK dataCallback;
+} WH_GET_URL_CONTENT_ASYNC_OPTIONS;
+
+typedef void (*WH_MODULE_LOAD_CALLBACK)(HMODULE module, void* context);
+
+typedef struct tagWH_SETTING {
+    PCWSTR name;
+    PCWSTR value;
+} WH_SETTING;
+
+// Returned by `Wh_GetSettings`. Also passed to the mod on a settings change if
+// it exports this overload of the callback, listing the settings which were
+// added, changed or removed, with a `NULL` value for removed ones:
+//
+// BOOL Wh_ModSettingsChanged(BOOL* bReload,
+//                            const WH_SETTINGS* changedSettings);
+//
+// `changedSettings` is `NULL` if the changes couldn't be computed, in which
+// case all settings should be read again. It's freed once the callback
+// returns.
+typedef struct tagWH_SETTINGS {
+    size_t count;
+    const WH_SETTING* items;
+} WH_SETTINGS;
+
+typedef void (*WH_THREAD_POOL_CALLBACK)(void* context);
+
+typedef void (*WH_RUN_ON_THREAD_CALLBACK)(void* context);
+
+#define WH_VISUAL_TREE_ELEMENT_ADDED 1
+#define WH_VISUAL_TREE_ELEMENT_REMOVED 2
+
+typedef struct tagWH_VISUAL_TREE_ELEMENT {
+    // The `IInspectable` of the element. Only valid during the callback, and
+    // must only be used on the UI thread of the element. Can be `NULL` for a
+    // removed element which is no longer available.
+    void* element;
+    // The `IInspectable` of the parent element, `NULL` for the root of a tree.
+    void* parent;
+    // The full type name of the element, e.g.
+    // `Windows.UI.Xaml.Controls.Grid`.
+    PCWSTR typeName;
+    // The `x:Name` of the element, empty if it has none.
+    PCWSTR name;
+    // Identifies the element as long as it's in the tree, e.g. to match a
+    // removal to an addition.
+    UINT64 handle;
+    UINT64 parentHandle;
+} WH_VISUAL_TREE_ELEMENT;
+
+// `change` is one of the `WH_VISUAL_TREE_ELEMENT_*` values.
+typedef void (*WH_VISUAL_TREE_CALLBACK)(int change,
+                                        const WH_VISUAL_TREE_ELEMENT* element,
+                                        void* context);
+
+typedef struct tagWH_VISUAL_TREE_OPTIONS {
+    size_t optionsSize;
+    // If set, only elements of this full type name are reported.
+    PCWSTR typeName;
+    // If set, only elements with this `x:Name` are reported.
+    PCWSTR name;
+} WH_VISUAL_TREE_OPTIONS;
+
+typedef struct tagWH_SHARED_MEMORY {
+    // The mapped memory, zero-initialized when created.
+    void* data;
+    size_t size;
+    // An auto-reset event with the same name scope as the memory, which can be
+    // used to notify another process of a change, e.g. with `SetEvent` and
+    // `WaitForSingleObject`. Owned by the shared memory, don't close it.
+    HANDLE event;
+    // `TRUE` if the memory was created by this call, `FALSE` if it was already
+    // opened by another process or by an earlier call.
+    BOOL created;
+} WH_SHARED_MEMORY;
+
+#define WH_VALUE_TYPE_INT 1
+#define WH_VALUE_TYPE_STRING 2
+#define WH_VALUE_TYPE_BINARY 3
+#define WH_VALUE_TYPE_DELETE 4
+
+typedef struct tagWH_VALUE {
+    PCWSTR valueName;
+    // One of the `WH_VALUE_TYPE_*` values. For `WH_VALUE_TYPE_DELETE`, the
+    // value is deleted and the other fields are ignored.
+    int type;
+    int intValue;
+    PCWSTR stringValue;
+    const void* binaryValue;
+    size_t binaryValueSize;
+} WH_VALUE;
+
 // Definitions for mods.
 #ifdef WH_MOD
 
@@ -191,6 +359,21 @@ inline BOOL Wh_DeleteValue(PCWSTR valueName) {
                           FALSE);
 }
 
+/**
+ * @brief Stores or deletes several values in the mod's local storage with a
+ *     single write. Writes to the local storage which closely follow each
+ *     other are coalesced, and written within a second or when the mod is
+ *     unloaded.
+ * @since Windhawk v1.8
+ * @param values The values to store or delete.
+ * @param valuesCount The number of items in `values`.
+ * @return A boolean value indicating whether the function succeeded.
+ */
+inline BOOL Wh_SetValues(const WH_VALUE* values, size_t valuesCount) {
+    return WH_INTERNAL_OR(
+        InternalWh_SetValues(InternalWhModPtr, values, valuesCount), FALSE);
+}
+
 /**
  * @brief Retrieves the mod's storage directory path. The directory can be used
  *     by the mod to store any necessary files. The directory will be removed
@@ -253,10 +436,48 @@ inline void Wh_FreeStringSetting(PCWSTR string) {
     WH_INTERNAL(InternalWh_FreeStringSetting(InternalWhModPtr, string));
 }
 
+/**
+ * @brief Retrieves all of the mod's user settings whose names start with a
+ *     prefix, at once. Much faster than retrieving many values one by one,
+ *     e.g. for a long list. When no longer needed, free the settings with
+ *     `Wh_FreeSettings`.
+ * @since Windhawk v1.8
+ * @param prefix The prefix, which matches whole parts of setting names. For
+ *     example, `L"items"` matches `items`, `items.count` and `items[0].name`,
+ *     but not `itemsCount`. Pass `NULL` or an empty string to retrieve all
+ *     settings. It can optionally contain embedded printf-style format
+ *     specifiers, as for `Wh_GetStringSetting`.
+ * @return The settings, sorted by name with list items in index order. All
+ *     values are strings as stored, integer values can be converted with
+ *     `wcstol`. In case of an error, the return value is `NULL`.
+ */
+inline const WH_SETTINGS* Wh_GetSettings(PCWSTR prefix, ...) {
+    va_list args;
+    va_start(args, prefix);
+    const WH_SETTINGS* result = WH_INTERNAL_OR(
+        InternalWh_GetSettings(InternalWhModPtr, prefix, args), NULL);
+    va_end(args);
+    return result;
+}
+
+/**
+ * @brief Frees settings returned by `Wh_GetSettings`.
+ * @since Windhawk v1.8
+ * @param settings The settings to free. If `NULL`, the function does nothing.
+ * @return None.
+ */
+inline void Wh_FreeSettings(const WH_SETTINGS* settings) {
+    WH_INTERNAL(InternalWh_FreeSettings(InternalWhModPtr, settings));
+}
+
 /**
  * @brief Registers a hook for the specified target function. Can't be called
  *     after `Wh_ModBeforeUninit` returns. Registered hook operations can be
- *     applied with `Wh_ApplyHookOperations`.
+ *     applied with `Wh_ApplyHookOperations`. If the mod exports
+ *     `Wh_ModReinit`, it's called instead of reloading the mod when
+ *     `Wh_ModSettingsChanged` requests a reload. Hooks which are set again
+ *     from it with the same arguments are kept, and other hooks of the mod are
+ *     removed.
  * @param targetFunction A pointer to the target function, which will be
  *     overridden by the detour function.
  * @param hookFunction A pointer to the detour function, which will override the
@@ -274,6 +495,44 @@ inline BOOL Wh_SetFunctionHook(void* targetFunction,
         FALSE);
 }
 
+/**
+ * @brief Registers a hook of a function imported by a module, which replaces
+ *     the pointer in the import address table of the module instead of
+ *     patching the code of the function. Only calls made by that module
+ *     through the import are affected, and no trampoline is needed, which
+ *     makes it cheaper than `Wh_SetFunctionHook` when hooking a single module
+ *     is enough. The imports of each module are indexed once and reused.
+ *     Otherwise behaves like `Wh_SetFunctionHook`: the hook is applied with
+ *     the other hook operations, is kept if set again from `Wh_ModReinit`,
+ *     and is removed when the mod is unloaded. Other hooks of the same import,
+ *     including ones set by other mods, are chained.
+ * @since Windhawk v1.8
+ * @param module The module whose import is hooked, or `NULL` for the
+ *     executable of the current process.
+ * @param dllName The name of the imported DLL, e.g. `"kernel32.dll"`, as it
+ *     appears in the import table. Compared case-insensitively. Imports which
+ *     are resolved through an API set have the name of the API set.
+ * @param functionName The name of the imported function, or its ordinal in the
+ *     low-order word, as with `GetProcAddress`.
+ * @param hookFunction A pointer to the hook function.
+ * @param originalFunction A pointer which is set to the function that was
+ *     called through the import before the hook, and which is used to call it.
+ *     Can be updated when other hooks of the import are added or removed, so
+ *     it must be read on each call. Can be `NULL`.
+ * @return A boolean value indicating whether the function succeeded. Fails
+ *     if the module doesn't import the function.
+ */
+inline BOOL Wh_HookImport(HMODULE module,
+                          PCSTR dllName,
+                          PCSTR functionName,
+                          void* hookFunction,
+                          void** originalFunction) {
+    return WH_INTERNAL_OR(
+        InternalWh_HookImport(InternalWhModPtr, module, dllName, functionName,
+                              hookFunction, originalFunction),
+        FALSE);
+}
+
 /**
  * @brief Registers a hook to be removed for the specified target function.
  *     Can't be called before `Wh_ModInit` returns or after `Wh_ModBeforeUninit`
@@ -353,6 +612,38 @@ inline void Wh_FindCloseSymbol(HANDLE symSearch) {
     WH_INTERNAL(InternalWh_FindCloseSymbol(InternalWhModPtr, symSearch));
 }
 
+/**
+ * @brief Returns the name of the symbol which contains an address, e.g. for
+ *     logging the caller of a hooked function. Uses the symbol index which
+ *     Windhawk keeps for each PDB, with a binary search by address instead of
+ *     an enumeration of all symbols. If there's no index for the module yet,
+ *     it's built first, which requires downloading the symbols and might take
+ *     a while. Only modules with a PDB are supported.
+ * @since Windhawk v1.8
+ * @param module The module which contains the address, or `NULL` to use the
+ *     module which the address belongs to.
+ * @param address The address.
+ * @param nameBuffer The buffer which receives the name of the symbol, the
+ *     undecorated name if there's one. Truncated if the buffer is too small,
+ *     and always null-terminated.
+ * @param bufferChars The size of the buffer, in characters.
+ * @param offset If not `NULL`, receives the offset of the address from the
+ *     start of the symbol. Symbol sizes aren't known, so a large offset
+ *     might mean that the address isn't in a symbol of the PDB at all.
+ * @return The length of the name which was copied to the buffer, not
+ *     including the null terminator, or zero if no symbol was found.
+ */
+inline size_t Wh_GetSymbolFromAddress(HMODULE module,
+                                      const void* address,
+                                      PWSTR nameBuffer,
+                                      size_t bufferChars,
+                                      size_t* offset) {
+    return WH_INTERNAL_OR(
+        InternalWh_GetSymbolFromAddress(InternalWhModPtr, module, address,
+                                        nameBuffer, bufferChars, offset),
+        0);
+}
+
 /**
  * @brief Disassembles an instruction and formats it to human-readable text.
  * @since Windhawk v1.2
@@ -366,6 +657,59 @@ inline BOOL Wh_Disasm(void* address, WH_DISASM_RESULT* result) {
                           FALSE);
 }
 
+/**
+ * @brief Disassembles consecutive instructions of a range in a single call.
+ *     Much faster than calling `Wh_Disasm` for each instruction.
+ * @since Windhawk v1.8
+ * @param address The address of the first instruction to disassemble.
+ * @param size The size of the range, in bytes. An instruction which doesn't
+ *     fit in the range isn't disassembled.
+ * @param results An array to receive the disassembly information for each
+ *     instruction.
+ * @param resultsCount The number of items in the results array.
+ * @param flags A combination of `WH_DISASM_RANGE_*` flags, or zero.
+ * @return The number of instructions which were disassembled. Disassembling
+ *     stops at the end of the range, when the array is full, or at an
+ *     instruction which can't be decoded, which can be told apart by the total
+ *     length of the instructions.
+ */
+inline size_t Wh_DisasmRange(void* address,
+                             size_t size,
+                             WH_DISASM_RESULT* results,
+                             size_t resultsCount,
+                             DWORD flags) {
+    return WH_INTERNAL_OR(
+        InternalWh_DisasmRange(InternalWhModPtr, address, size, results,
+                               resultsCount, flags),
+        0);
+}
+
+/**
+ * @brief Finds the first occurrence of a byte pattern in the code sections of a
+ *     module. Much faster than a byte by byte comparison loop.
+ * @since Windhawk v1.8
+ * @param module The module to scan.
+ * @param pattern The bytes to find.
+ * @param mask An array of the same size as the pattern. Each byte selects the
+ *     bits which must match, `0xFF` for an exact match and `0x00` for any byte.
+ *     Can be `NULL`, in which case all bytes must match exactly.
+ * @param patternSize The size of the pattern, in bytes.
+ * @param options The options for the search. Pass `NULL` to use the default
+ *     options.
+ * @return The address of the first occurrence. If the pattern isn't found or
+ *     in case of an error, the return value is `NULL`.
+ */
+inline void* Wh_FindPattern(HMODULE module,
+                            const void* pattern,
+                            const void* mask,
+                            size_t patternSize,
+                            const WH_FIND_PATTERN_OPTIONS* options) {
+    return WH_INTERNAL_OR(
+        InternalWh_FindPattern(InternalWhModPtr, module, pattern, mask,
+                               patternSize, options),
+        NULL);
+}
+
 /**
  * @brief Retrieves the content of a URL. When no longer needed, call
  *     `Wh_FreeUrlContent` to free the content.
@@ -392,6 +736,324 @@ inline void Wh_FreeUrlContent(const WH_URL_CONTENT* content) {
     WH_INTERNAL(InternalWh_FreeUrlContent(InternalWhModPtr, content));
 }
 
+/**
+ * @brief Retrieves the content of a URL in the background. Requests of all
+ *     mods in the process share connections, so requests to the same server
+ *     are cheap. Pending requests are canceled automatically after
+ *     `Wh_ModBeforeUninit` returns, and their callbacks are called before
+ *     `Wh_ModUninit` is called.
+ * @since Windhawk v1.8
+ * @param url The URL to retrieve.
+ * @param options The options for the URL content retrieval. Pass `NULL` to use
+ *     the default options.
+ * @param callback The callback, called exactly once on a background thread
+ *     when the request completes, unless the function fails. When no longer
+ *     needed, call `Wh_FreeUrlContent` to free the content passed to it. The
+ *     callback can't be `NULL`.
+ * @param context A value passed to the callbacks.
+ * @return A request handle which can be passed to `Wh_CancelUrlContentAsync`
+ *     until the callback is called. In case of an error, the return value is
+ *     `NULL` and the callback isn't called.
+ */
+inline HANDLE Wh_GetUrlContentAsync(
+    PCWSTR url,
+    const WH_GET_URL_CONTENT_ASYNC_OPTIONS* options,
+    WH_URL_CONTENT_CALLBACK callback,
+    void* context) {
+    return WH_INTERNAL_OR(
+        InternalWh_GetUrlContentAsync(InternalWhModPtr, url, options, callback,
+                                      context),
+        NULL);
+}
+
+/**
+ * @brief Cancels a request started by `Wh_GetUrlContentAsync`. The callback of
+ *     the request is still called, with `NULL` unless the request completed in
+ *     the meantime.
+ * @since Windhawk v1.8
+ * @param request The request handle.
+ * @return A boolean value indicating whether the request was still pending.
+ */
+inline BOOL Wh_CancelUrlContentAsync(HANDLE request) {
+    return WH_INTERNAL_OR(
+        InternalWh_CancelUrlContentAsync(InternalWhModPtr, request), FALSE);
+}
+
+/**
+ * @brief Queues a callback to run on a thread pool shared by all mods of the
+ *     process. Can be used instead of creating a thread. Callbacks which didn't
+ *     start yet are canceled automatically after `Wh_ModBeforeUninit` returns,
+ *     and running ones are waited for before `Wh_ModUninit` is called.
+ *     Callbacks shouldn't block for a long time, since the number of threads
+ *     is limited.
+ * @since Windhawk v1.8
+ * @param callback The callback.
+ * @param context A value passed to the callback.
+ * @return A boolean value indicating whether the function succeeded.
+ */
+inline BOOL Wh_QueueWork(WH_THREAD_POOL_CALLBACK callback, void* context) {
+    return WH_INTERNAL_OR(
+        InternalWh_QueueWork(InternalWhModPtr, callback, context), FALSE);
+}
+
+/**
+ * @brief Creates a timer which runs a callback on the thread pool used by
+ *     `Wh_QueueWork`. Timers which weren't closed are closed automatically
+ *     after `Wh_ModBeforeUninit` returns, and running callbacks are waited for
+ *     before `Wh_ModUninit` is called.
+ * @since Windhawk v1.8
+ * @param callback The callback.
+ * @param context A value passed to the callback.
+ * @param dueTime The time until the first call, in milliseconds. Pass
+ *     `INFINITE` to create a stopped timer.
+ * @param period The interval of subsequent calls, in milliseconds. Pass zero to
+ *     call the callback once.
+ * @return A timer handle. When no longer needed, call `Wh_CloseTimer` to close
+ *     it. In case of an error, the return value is `NULL`.
+ */
+inline HANDLE Wh_CreateTimer(WH_THREAD_POOL_CALLBACK callback,
+                             void* context,
+                             DWORD dueTime,
+                             DWORD period) {
+    return WH_INTERNAL_OR(InternalWh_CreateTimer(InternalWhModPtr, callback,
+                                                 context, dueTime, period),
+                          NULL);
+}
+
+/**
+ * @brief Restarts or stops a timer created by `Wh_CreateTimer`.
+ * @since Windhawk v1.8
+ * @param timer The timer handle.
+ * @param dueTime The time until the next call, in milliseconds. Pass `INFINITE`
+ *     to stop the timer.
+ * @param period The interval of subsequent calls, in milliseconds. Pass zero to
+ *     call the callback once.
+ * @return A boolean value indicating whether the function succeeded.
+ */
+inline BOOL Wh_SetTimer(HANDLE timer, DWORD dueTime, DWORD period) {
+    return WH_INTERNAL_OR(
+        InternalWh_SetTimer(InternalWhModPtr, timer, dueTime, period), FALSE);
+}
+
+/**
+ * @brief Closes a timer created by `Wh_CreateTimer`, and waits for its running
+ *     callback to return. Can't be called from the callback of the timer, use
+ *     `Wh_SetTimer` to stop the timer in that case.
+ * @since Windhawk v1.8
+ * @param timer The timer handle.
+ * @return A boolean value indicating whether the function succeeded.
+ */
+inline BOOL Wh_CloseTimer(HANDLE timer) {
+    return WH_INTERNAL_OR(InternalWh_CloseTimer(InternalWhModPtr, timer),
+                          FALSE);
+}
+
+/**
+ * @brief Runs a callback on another thread of the current process, from the
+ *     message loop of the thread, and waits for it to return. Can be used to
+ *     access windows and other objects which belong to a UI thread, without a
+ *     hidden window or a hook of the mod's own. If called from the target
+ *     thread, the callback is called right away.
+ * @since Windhawk v1.8
+ * @param threadId The ID of the thread, which must have a message queue.
+ * @param callback The callback.
+ * @param context A value passed to the callback.
+ * @param timeout The maximum time to wait for the thread to start running the
+ *     callback, in milliseconds, or `INFINITE`. Once the callback starts, it's
+ *     always waited for.
+ * @return A boolean value indicating whether the callback was called. If the
+ *     timeout elapses, it won't be called later.
+ */
+inline BOOL Wh_RunOnThread(DWORD threadId,
+                           WH_RUN_ON_THREAD_CALLBACK callback,
+                           void* context,
+                           DWORD timeout) {
+    return WH_INTERNAL_OR(InternalWh_RunOnThread(InternalWhModPtr, threadId,
+                                                 callback, context, timeout),
+                          FALSE);
+}
+
+/**
+ * @brief Opens a block of memory shared by all processes in which the mod is
+ *     loaded, creating it if it doesn't exist yet. Unlike values stored with
+ *     `Wh_SetIntValue` and similar functions, the memory is accessed directly
+ *     and isn't persisted, it exists as long as any process has it open. Each
+ *     mod has its own names, and access from different threads and processes
+ *     must be synchronized by the mod, e.g. with interlocked operations. Open
+ *     shared memories are closed automatically after `Wh_ModUninit` returns.
+ * @since Windhawk v1.8
+ * @param name The name of the shared memory, up to 64 characters, which can't
+ *     contain backslashes.
+ * @param size The size of the shared memory in bytes. Must be the same in all
+ *     processes which open it, opening memory which was created with a smaller
+ *     size fails.
+ * @return The shared memory. When no longer needed, call
+ *     `Wh_CloseSharedMemory` to close it. In case of an error, `NULL` is
+ *     returned.
+ */
+inline const WH_SHARED_MEMORY* Wh_OpenSharedMemory(PCWSTR name, size_t size) {
+    return WH_INTERNAL_OR(
+        InternalWh_OpenSharedMemory(InternalWhModPtr, name, size), NULL);
+}
+
+/**
+ * @brief Closes shared memory opened by `Wh_OpenSharedMemory`. The memory and
+ *     the event can't be used afterwards.
+ * @since Windhawk v1.8
+ * @param sharedMemory The shared memory to close. If `NULL`, the function does
+ *     nothing.
+ * @return None.
+ */
+inline void Wh_CloseSharedMemory(const WH_SHARED_MEMORY* sharedMemory) {
+    WH_INTERNAL(InternalWh_CloseSharedMemory(InternalWhModPtr, sharedMemory));
+}
+
+/**
+ * @brief Registers a callback which is called when a module with the specified
+ *     file name is loaded by the current process. Can be used instead of
+ *     hooking `LoadLibraryExW` and similar functions, and covers all ways in
+ *     which a module can be loaded. The callback isn't called for a module
+ *     which is already loaded, use `GetModuleHandle` after registering to
+ *     handle that case. Registered callbacks are unregistered automatically
+ *     before `Wh_ModBeforeUninit` returns.
+ * @since Windhawk v1.8
+ * @param moduleName The file name of the module, such as `L"comctl32.dll"`,
+ *     without a path. The comparison is case-insensitive.
+ * @param callback The callback. It's called with the loader lock held, after
+ *     the module is mapped and before its entry point runs, so it should do as
+ *     little as possible. For example, it can set hooks, but it shouldn't load
+ *     other modules or wait for other threads.
+ * @param context A value passed to the callback.
+ * @return A registration handle used in a subsequent call to
+ *     `Wh_UnregisterModuleLoadCallback`. In case of an error, the return value
+ *     is `NULL`.
+ */
+inline HANDLE Wh_RegisterModuleLoadCallback(PCWSTR moduleName,
+                                            WH_MODULE_LOAD_CALLBACK callback,
+                                            void* context) {
+    return WH_INTERNAL_OR(
+        InternalWh_RegisterModuleLoadCallback(InternalWhModPtr, moduleName,
+                                              callback, context),
+        NULL);
+}
+
+/**
+ * @brief Unregisters a callback registered by `Wh_RegisterModuleLoadCallback`.
+ * @since Windhawk v1.8
+ * @param registration The registration handle.
+ * @return A boolean value indicating whether the function succeeded.
+ */
+inline BOOL Wh_UnregisterModuleLoadCallback(HANDLE registration) {
+    return WH_INTERNAL_OR(
+        InternalWh_UnregisterModuleLoadCallback(InternalWhModPtr, registration),
+        FALSE);
+}
+
+/**
+ * @brief Creates an arena, a block of memory from which many small objects can
+ *     be allocated quickly and then freed at once. An arena can be used
+ *     instead of `new` or `malloc` for short-lived allocations in hooks, e.g.
+ *     memory which is only needed until the next `Wh_ArenaReset` call. The
+ *     address space is reserved up front and memory is committed as it's
+ *     used. Arenas which the mod doesn't destroy are destroyed after the mod
+ *     is unloaded.
+ * @since Windhawk v1.8
+ * @param maxSize The maximum total size of the allocations, in bytes. Zero for
+ *     the default of one megabyte.
+ * @return A handle of the arena. When no longer needed, call
+ *     `Wh_ArenaDestroy` to destroy it. In case of an error, the return value
+ *     is `NULL`.
+ */
+inline HANDLE Wh_ArenaCreate(size_t maxSize) {
+    return WH_INTERNAL_OR(InternalWh_ArenaCreate(InternalWhModPtr, maxSize),
+                          NULL);
+}
+
+/**
+ * @brief Allocates memory from an arena. Can be called from several threads at
+ *     once. The memory isn't necessarily zero-initialized, and stays valid
+ *     until the arena is reset or destroyed.
+ * @since Windhawk v1.8
+ * @param arena The arena handle, as returned by `Wh_ArenaCreate`.
+ * @param size The size of the allocation, in bytes.
+ * @param alignment The alignment of the allocation, a power of two up to 65536,
+ *     or zero for `MEMORY_ALLOCATION_ALIGNMENT`.
+ * @return A pointer to the allocated memory, or `NULL` if the arena is full.
+ */
+inline void* Wh_ArenaAlloc(HANDLE arena, size_t size, size_t alignment) {
+    return WH_INTERNAL_OR(
+        InternalWh_ArenaAlloc(InternalWhModPtr, arena, size, alignment), NULL);
+}
+
+/**
+ * @brief Frees all allocations of an arena, which can then be used again. Must
+ *     not be called while another thread allocates from the arena or uses
+ *     its memory.
+ * @since Windhawk v1.8
+ * @param arena The arena handle.
+ * @return A boolean value indicating whether the function succeeded.
+ */
+inline BOOL Wh_ArenaReset(HANDLE arena) {
+    return WH_INTERNAL_OR(InternalWh_ArenaReset(InternalWhModPtr, arena),
+                          FALSE);
+}
+
+/**
+ * @brief Destroys an arena created by `Wh_ArenaCreate`, freeing all of its
+ *     allocations.
+ * @since Windhawk v1.8
+ * @param arena The arena handle.
+ * @return A boolean value indicating whether the function succeeded.
+ */
+inline BOOL Wh_ArenaDestroy(HANDLE arena) {
+    return WH_INTERNAL_OR(InternalWh_ArenaDestroy(InternalWhModPtr, arena),
+                          FALSE);
+}
+
+/**
+ * @brief Registers a callback which is called when elements are added to or
+ *     removed from the XAML visual trees of the current process, i.e. of
+ *     Windows.UI.Xaml (system XAML). All mods share a single XAML diagnostics
+ *     connection which Windhawk creates on first use, or once system XAML is
+ *     loaded, so no tree has to be walked by the mod. The callback is called
+ *     on the UI thread of the element. It's also called for the matching
+ *     elements which are already in the trees, from the calling thread before
+ *     the function returns. Callbacks are unregistered automatically before
+ *     `Wh_ModUninit` is called. Note: Connecting loads the Windhawk engine as a
+ *     XAML diagnostics TAP, and the engine stays loaded in the process
+ *     afterwards.
+ * @since Windhawk v1.8
+ * @param options Can be used to only report elements of a specific type or
+ *     name. Can be `NULL` to report all elements.
+ * @param callback The callback.
+ * @param context A value passed to the callback.
+ * @return A handle of the registration. When no longer needed, call
+ *     `Wh_UnsubscribeVisualTreeChanges` to unregister it. In case of an
+ *     error, the return value is `NULL`.
+ */
+inline HANDLE Wh_SubscribeVisualTreeChanges(
+    const WH_VISUAL_TREE_OPTIONS* options,
+    WH_VISUAL_TREE_CALLBACK callback,
+    void* context) {
+    return WH_INTERNAL_OR(
+        InternalWh_SubscribeVisualTreeChanges(InternalWhModPtr, options,
+                                              callback, context),
+        NULL);
+}
+
+/**
+ * @brief Unregisters a callback registered by
+ *     `Wh_SubscribeVisualTreeChanges`.
+ * @since Windhawk v1.8
+ * @param subscription The registration handle.
+ * @return A boolean value indicating whether the function succeeded.
+ */
+inline BOOL Wh_UnsubscribeVisualTreeChanges(HANDLE subscription) {
+    return WH_INTERNAL_OR(
+        InternalWh_UnsubscribeVisualTreeChanges(InternalWhModPtr, subscription),
+        FALSE);
+}
+
 #undef WH_INTERNAL
 #undef WH_INTERNAL_OR
 
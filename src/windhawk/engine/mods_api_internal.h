@@ -14,10 +14,35 @@ typedef struct tagWH_SYMBOL_HOOK {
     void* hookFunction;
     bool optional;
 } WH_SYMBOL_HOOK;
+typedef struct tagWH_HOOK_SYMBOLS_BATCH_ITEM {
+    HMODULE module;
+    const WH_SYMBOL_HOOK* symbolHooks;
+    size_t symbolHooksCount;
+} WH_HOOK_SYMBOLS_BATCH_ITEM;
 typedef struct tagWH_HOOK_SYMBOLS_OPTIONS WH_HOOK_SYMBOLS_OPTIONS;
 typedef struct tagWH_DISASM_RESULT WH_DISASM_RESULT;
+typedef struct tagWH_FIND_PATTERN_OPTIONS WH_FIND_PATTERN_OPTIONS;
 typedef struct tagWH_GET_URL_CONTENT_OPTIONS WH_GET_URL_CONTENT_OPTIONS;
 typedef struct tagWH_URL_CONTENT WH_URL_CONTENT;
+typedef void (*WH_URL_CONTENT_CALLBACK)(const WH_URL_CONTENT* content,
+                                        void* context);
+typedef BOOL (*WH_URL_DATA_CALLBACK)(int statusCode,
+                                     const char* data,
+                                     size_t length,
+                                     void* context);
+typedef struct tagWH_GET_URL_CONTENT_ASYNC_OPTIONS
+    WH_GET_URL_CONTENT_ASYNC_OPTIONS;
+typedef void (*WH_MODULE_LOAD_CALLBACK)(HMODULE module, void* context);
+typedef struct tagWH_SETTINGS WH_SETTINGS;
+typedef void (*WH_THREAD_POOL_CALLBACK)(void* context);
+typedef void (*WH_RUN_ON_THREAD_CALLBACK)(void* context);
+typedef struct tagWH_SHARED_MEMORY WH_SHARED_MEMORY;
+typedef struct tagWH_VISUAL_TREE_ELEMENT WH_VISUAL_TREE_ELEMENT;
+typedef void (*WH_VISUAL_TREE_CALLBACK)(int change,
+                                        const WH_VISUAL_TREE_ELEMENT* element,
+                                        void* context);
+typedef struct tagWH_VISUAL_TREE_OPTIONS WH_VISUAL_TREE_OPTIONS;
+typedef struct tagWH_VALUE WH_VALUE;
 
 // Internal functions, do not call directly.
 #ifdef __cplusplus
@@ -43,6 +68,9 @@ BOOL InternalWh_SetBinaryValue(void* mod,
                                const void* buffer,
                                size_t bufferSize);
 BOOL InternalWh_DeleteValue(void* mod, PCWSTR valueName);
+BOOL InternalWh_SetValues(void* mod,
+                          const WH_VALUE* values,
+                          size_t valuesCount);
 
 size_t InternalWh_GetModStoragePath(void* mod,
                                     PWSTR pathBuffer,
@@ -51,11 +79,21 @@ size_t InternalWh_GetModStoragePath(void* mod,
 int InternalWh_GetIntSetting(void* mod, PCWSTR valueName, va_list args);
 PCWSTR InternalWh_GetStringSetting(void* mod, PCWSTR valueName, va_list args);
 void InternalWh_FreeStringSetting(void* mod, PCWSTR string);
+const WH_SETTINGS* InternalWh_GetSettings(void* mod,
+                                          PCWSTR prefix,
+                                          va_list args);
+void InternalWh_FreeSettings(void* mod, const WH_SETTINGS* settings);
 
 BOOL InternalWh_SetFunctionHook(void* mod,
                                 void* targetFunction,
                                 void* hookFunction,
                                 void** originalFunction);
+BOOL InternalWh_HookImport(void* mod,
+                           HMODULE module,
+                           PCSTR dllName,
+                           PCSTR functionName,
+                           void* hookFunction,
+                           void** originalFunction);
 BOOL InternalWh_RemoveFunctionHook(void* mod, void* targetFunction);
 BOOL InternalWh_ApplyHookOperations(void* mod);
 
@@ -67,20 +105,94 @@ BOOL InternalWh_FindNextSymbol2(void* mod,
                                 HANDLE symSearch,
                                 WH_FIND_SYMBOL* findData);
 void InternalWh_FindCloseSymbol(void* mod, HANDLE symSearch);
+size_t InternalWh_GetSymbolFromAddress(void* mod,
+                                       HMODULE module,
+                                       const void* address,
+                                       PWSTR nameBuffer,
+                                       size_t bufferChars,
+                                       size_t* offset);
 
 BOOL InternalWh_HookSymbols(void* mod,
                             HMODULE module,
                             const WH_SYMBOL_HOOK* symbolHooks,
                             size_t symbolHooksCount,
                             const WH_HOOK_SYMBOLS_OPTIONS* options);
+BOOL InternalWh_HookSymbolsBatch(void* mod,
+                                 const WH_HOOK_SYMBOLS_BATCH_ITEM* items,
+                                 size_t itemsCount,
+                                 const WH_HOOK_SYMBOLS_OPTIONS* options);
 
 BOOL InternalWh_Disasm(void* mod, void* address, WH_DISASM_RESULT* result);
+size_t InternalWh_DisasmRange(void* mod,
+                              void* address,
+                              size_t size,
+                              WH_DISASM_RESULT* results,
+                              size_t resultsCount,
+                              DWORD flags);
+
+void* InternalWh_FindPattern(void* mod,
+                             HMODULE module,
+                             const void* pattern,
+                             const void* mask,
+                             size_t patternSize,
+                             const WH_FIND_PATTERN_OPTIONS* options);
 
 const WH_URL_CONTENT* InternalWh_GetUrlContent(
     void* mod,
     PCWSTR url,
     const WH_GET_URL_CONTENT_OPTIONS* options);
 void InternalWh_FreeUrlContent(void* mod, const WH_URL_CONTENT* content);
+HANDLE InternalWh_GetUrlContentAsync(
+    void* mod,
+    PCWSTR url,
+    const WH_GET_URL_CONTENT_ASYNC_OPTIONS* options,
+    WH_URL_CONTENT_CALLBACK callback,
+    void* context);
+BOOL InternalWh_CancelUrlContentAsync(void* mod, HANDLE request);
+
+HANDLE InternalWh_RegisterModuleLoadCallback(void* mod,
+                                             PCWSTR moduleName,
+                                             WH_MODULE_LOAD_CALLBACK callback,
+                                             void* context);
+BOOL InternalWh_UnregisterModuleLoadCallback(void* mod, HANDLE registration);
+
+BOOL InternalWh_QueueWork(void* mod,
+                          WH_THREAD_POOL_CALLBACK callback,
+                          void* context);
+HANDLE InternalWh_CreateTimer(void* mod,
+                              WH_THREAD_POOL_CALLBACK callback,
+                              void* context,
+                              DWORD dueTime,
+                              DWORD period);
+BOOL InternalWh_SetTimer(void* mod, HANDLE timer, DWORD dueTime, DWORD period);
+BOOL InternalWh_CloseTimer(void* mod, HANDLE timer);
+
+BOOL InternalWh_RunOnThread(void* mod,
+                            DWORD threadId,
+                            WH_RUN_ON_THREAD_CALLBACK callback,
+                            void* context,
+                            DWORD timeout);
+
+const WH_SHARED_MEMORY* InternalWh_OpenSharedMemory(void* mod,
+                                                    PCWSTR name,
+                                                    size_t size);
+void InternalWh_CloseSharedMemory(void* mod,
+                                  const WH_SHARED_MEMORY* sharedMemory);
+
+HANDLE InternalWh_ArenaCreate(void* mod, size_t maxSize);
+void* InternalWh_ArenaAlloc(void* mod,
+                            HANDLE arena,
+                            size_t size,
+                            size_t alignment);
+BOOL InternalWh_ArenaReset(void* mod, HANDLE arena);
+BOOL InternalWh_ArenaDestroy(void* mod, HANDLE arena);
+
+HANDLE InternalWh_SubscribeVisualTreeChanges(
+    void* mod,
+    const WH_VISUAL_TREE_OPTIONS* options,
+    WH_VISUAL_TREE_CALLBACK callback,
+    void* context);
+BOOL InternalWh_UnsubscribeVisualTreeChanges(void* mod, HANDLE subscription);
 
 #ifdef __cplusplus
 }
@@ -89,7 +201,27 @@ void InternalWh_FreeUrlContent(void* mod, const WH_URL_CONTENT* content);
 // Internal definitions for mods.
 #ifdef WH_MOD
 
-inline void* InternalWhModPtr;
+// Defined by the compiler, unless the mod is compiled in compatibility mode,
+// in which case all symbols of the mod are exported. Otherwise, only the
+// symbols which the engine looks up are exported, which keeps the export table
+// small for mods with many template instantiations.
+#ifdef WH_MOD_EXPLICIT_EXPORTS
+#define WH_MOD_EXPORT __declspec(dllexport)
+
+WH_MOD_EXPORT BOOL Wh_ModInit();
+WH_MOD_EXPORT void Wh_ModAfterInit();
+WH_MOD_EXPORT void Wh_ModBeforeUninit();
+WH_MOD_EXPORT void Wh_ModUninit();
+WH_MOD_EXPORT BOOL Wh_ModSettingsChanged(BOOL* bReload,
+                                         const WH_SETTINGS* changedSettings);
+WH_MOD_EXPORT BOOL Wh_ModSettingsChanged(BOOL* bReload);
+WH_MOD_EXPORT void Wh_ModSettingsChanged();
+WH_MOD_EXPORT BOOL Wh_ModReinit();
+#else
+#define WH_MOD_EXPORT
+#endif  // WH_MOD_EXPLICIT_EXPORTS
+
+WH_MOD_EXPORT inline void* InternalWhModPtr;
 
 inline void InternalWh_Log_Wrapper(PCWSTR format, ...) {
     va_list args;
@@ -107,4 +239,12 @@ inline BOOL InternalWh_HookSymbols_Wrapper(
                                   symbolHooksCount, options);
 }
 
+inline BOOL InternalWh_HookSymbolsBatch_Wrapper(
+    const WH_HOOK_SYMBOLS_BATCH_ITEM* items,
+    size_t itemsCount,
+    const WH_HOOK_SYMBOLS_OPTIONS* options) {
+    return InternalWh_HookSymbolsBatch(InternalWhModPtr, items, itemsCount,
+                                       options);
+}
+
 #endif  // WH_MOD
@@ -1,11 +1,62 @@
 #include "stdafx.h"
 
+#include "customization_session.h"
+#include "engine_metrics.h"
+#include "functions.h"
+#include "import_hooks.h"
 #include "logger.h"
+#include "mod_cpu_sampler.h"
+#include "module_load_notifier.h"
 #include "mods_manager.h"
+#include "path_pattern.h"
+#include "process_lists.h"
 #include "storage_manager.h"
+#include "trace_events.h"
 
 namespace {
 
+// When the session manager starts, e.g. at logon, the engine is loaded into
+// hundreds of processes within seconds. During this period, the mods of the
+// shell processes are loaded right away, since their customizations are the
+// most visible, and the mods of the other processes are loaded after a random
+// delay, on background priority, to smooth the peak of CPU and disk usage.
+constexpr ULONGLONG kStartupBurstPeriod = 60 * 1000;
+constexpr DWORD kStaggeredLoadMinDelay = 1000;
+constexpr DWORD kStaggeredLoadMaxDelay = 10 * 1000;
+
+// The bounds of the wait for the threads which are executing mods when the
+// session manager ends all sessions, about 3 seconds at most, which is within
+// the stage timeout of the app.
+constexpr DWORD kShutdownUnloadWaitIterations = 16;
+constexpr DWORD kShutdownUnloadWaitInterval = 200;
+
+// Returns the delay after which the mods of the current process should be
+// loaded, or zero if they should be loaded right away.
+DWORD GetStaggeredLoadDelay() {
+    ULONGLONG sessionManagerAge =
+        wil::filetime::to_int64(wil::filetime::get_system_time()) -
+        wil::filetime::to_int64(
+            CustomizationSession::GetSessionManagerProcessCreationTime());
+    if (sessionManagerAge >=
+        kStartupBurstPeriod * wil::filetime_duration::one_millisecond) {
+        return 0;
+    }
+
+    auto imagePath = wil::GetModuleFileName<std::wstring>();
+    if (PathPattern(ProcessLists::kShellProcesses).Matches(imagePath)) {
+        return 0;
+    }
+
+    // Processes which start together get different delays.
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    ULONGLONG hash =
+        (static_cast<ULONGLONG>(counter.QuadPart) ^ GetCurrentProcessId()) *
+        0x9E3779B97F4A7C15ULL;
+    DWORD range = kStaggeredLoadMaxDelay - kStaggeredLoadMinDelay;
+    return kStaggeredLoadMinDelay + static_cast<DWORD>((hash >> 32) % range);
+}
+
 DWORD GetModuleSizeOfImage(HMODULE module) {
     IMAGE_DOS_HEADER* dosHeader = (IMAGE_DOS_HEADER*)module;
     IMAGE_NT_HEADERS* ntHeader =
@@ -13,121 +64,423 @@ DWORD GetModuleSizeOfImage(HMODULE module) {
     return ntHeader->OptionalHeader.SizeOfImage;
 }
 
+ULONGLONG GetMillisecondsSince(LONGLONG performanceCounter) {
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    return static_cast<ULONGLONG>(counter.QuadPart - performanceCounter) *
+           1000 / frequency.QuadPart;
+}
+
+// The settings reads of mods are counted too, which shows the cost of the
+// settings storage, e.g. of a portable installation on a slow drive.
+void LogSettingsIoCountsSince(PCWSTR operation,
+                              const PortableSettings::IoCounts& start) {
+    auto counts = PortableSettings::GetIoCounts();
+    VERBOSE(L"%s: %I64u settings reads, %I64u settings writes", operation,
+            counts.reads - start.reads, counts.writes - start.writes);
+}
+
+// Enumerates the mods from the config snapshot if available, so that the
+// storage isn't accessed at all. The callback receives the generation in which
+// the mod config last changed, or zero if it's unknown.
+void EnumMods(const ModConfigSnapshot::Snapshot* snapshot,
+              std::function<void(PCWSTR, DWORD)> enumCallback) {
+    if (snapshot) {
+        for (const auto& modConfig : snapshot->mods) {
+            enumCallback(modConfig.name.c_str(), modConfig.generation);
+        }
+
+        return;
+    }
+
+    StorageManager::GetInstance().EnumMods(
+        [&enumCallback](PCWSTR modName) { enumCallback(modName, 0); });
+}
+
+// Loading a mod might take a while, e.g. if it waits for symbols to download,
+// so mods are loaded concurrently to prevent a slow mod from delaying the
+// others. Hooks are only queued while loading, and are applied afterwards on
+// the calling thread in a single pass. In background mode, the loading threads
+// have a low CPU, I/O and memory priority, but the hooks are applied with the
+// normal priority, since the other threads are suspended meanwhile.
+void LoadMods(const std::vector<std::pair<PCWSTR, Mod*>>& mods,
+              bool loadedOnStartup,
+              bool backgroundMode = false) {
+    constexpr size_t kMaxWorkerThreads = 4;
+
+    if (mods.empty()) {
+        return;
+    }
+
+    struct LoadState {
+        const std::vector<std::pair<PCWSTR, Mod*>>& mods;
+        bool loadedOnStartup;
+        bool backgroundMode;
+        std::atomic<size_t> nextMod = 0;
+
+        void Run() {
+            bool backgroundModeSet =
+                backgroundMode &&
+                SetThreadPriority(GetCurrentThread(),
+                                  THREAD_MODE_BACKGROUND_BEGIN);
+            auto backgroundModeReset = wil::scope_exit([backgroundModeSet] {
+                if (backgroundModeSet) {
+                    SetThreadPriority(GetCurrentThread(),
+                                      THREAD_MODE_BACKGROUND_END);
+                }
+            });
+
+            size_t i;
+            while ((i = nextMod++) < mods.size()) {
+                auto [name, mod] = mods[i];
+                try {
+                    mod->Load(loadedOnStartup);
+                } catch (const std::exception& e) {
+                    LOG(L"Mod (%s) loading failed: %S", name, e.what());
+                }
+            }
+        }
+    } loadState{
+        .mods = mods,
+        .loadedOnStartup = loadedOnStartup,
+        .backgroundMode = backgroundMode,
+    };
+
+    std::vector<wil::unique_handle> workerThreads;
+
+    // New threads can't run before the APC returns, and waiting for them would
+    // result in a deadlock. Load the mods one by one in this case.
+    if (!CustomizationSession::IsInitializingFromAPC()) {
+        size_t workerThreadsCount =
+            std::min(mods.size(), kMaxWorkerThreads) - 1;
+        for (size_t i = 0; i < workerThreadsCount; i++) {
+            wil::unique_handle thread(CreateThread(
+                nullptr, 0,
+                [](LPVOID pParameter) -> DWORD {
+                    static_cast<LoadState*>(pParameter)->Run();
+                    return 0;
+                },
+                &loadState, 0, nullptr));
+            if (!thread) {
+                LOG(L"Thread creation failed: %u", GetLastError());
+                break;
+            }
+
+            Functions::SetThreadDescriptionIfAvailable(
+                thread.get(), L"WindhawkModLoadWorker");
+            workerThreads.push_back(std::move(thread));
+        }
+    }
+
+    loadState.Run();
+
+    for (const auto& thread : workerThreads) {
+        WaitForSingleObject(thread.get(), INFINITE);
+    }
+}
+
 }  // namespace
 
 ModsManager::ModsManager() {
-    StorageManager::GetInstance().EnumMods([this](PCWSTR modName) {
+    TraceEvents::ScopedPhase phase("ModsManagerInit");
+
+    auto settingsIoCountsStart = PortableSettings::GetIoCounts();
+
+    m_moduleLoadedEvent.create(wil::EventOptions::None);
+
+    auto snapshot = Mod::GetModConfigSnapshot();
+    if (snapshot) {
+        m_snapshotGeneration = snapshot->generation;
+    }
+
+    EnumMods(snapshot.get(), [this](PCWSTR modName, DWORD generation) {
         try {
+            auto& slot = m_slots[GetOrAddSlot(modName)];
+            if (slot.mod) {
+                throw std::logic_error(
+                    "A mod with that name is already loaded");
+            }
+
             if (Mod::ShouldLoadInRunningProcess(modName)) {
-                auto result = m_mods.emplace(modName, modName);
-                if (!result.second) {
-                    throw std::logic_error(
-                        "A mod with that name is already loaded");
-                }
+                slot.mod = std::make_unique<Mod>(modName);
             }
+
+            slot.appliedGeneration = generation;
         } catch (const std::exception& e) {
             LOG(L"Mod (%s) initializing failed: %S", modName, e.what());
         }
     });
 
-    for (auto& [name, mod] : m_mods) {
+    DWORD staggeredLoadDelay = 0;
+    if (!IsEmpty() && m_moduleLoadedEvent) {
         try {
-            mod.Load(/*loadedOnStartup=*/true);
+            staggeredLoadDelay = GetStaggeredLoadDelay();
         } catch (const std::exception& e) {
-            LOG(L"Mod (%s) loading failed: %S", name.c_str(), e.what());
+            LOG(L"Getting the staggered load delay failed: %S", e.what());
+        }
+    }
+
+    if (staggeredLoadDelay) {
+        m_staggeredLoadTimer.reset(CreateThreadpoolTimer(
+            [](PTP_CALLBACK_INSTANCE instance, PVOID context, PTP_TIMER timer) {
+                SetEvent(static_cast<HANDLE>(context));
+            },
+            m_moduleLoadedEvent.get(), nullptr));
+        if (!m_staggeredLoadTimer) {
+            LOG(L"CreateThreadpoolTimer failed: %u", GetLastError());
+            staggeredLoadDelay = 0;
+        }
+    }
+
+    if (staggeredLoadDelay) {
+        VERBOSE(L"Loading mods in %u ms", staggeredLoadDelay);
+
+        // The mods stay pending until the reload which the timer triggers.
+        // They were never loaded, so they have no library file name, and the
+        // reload loads them.
+        for (auto& slot : m_slots) {
+            slot.appliedGeneration = 0;
+        }
+
+        m_staggeredLoadPending = true;
+
+        // A negative due time is relative.
+        FILETIME dueTime = wil::filetime::from_int64(static_cast<UINT64>(
+            -static_cast<INT64>(staggeredLoadDelay) *
+            wil::filetime_duration::one_millisecond));
+        SetThreadpoolTimer(m_staggeredLoadTimer.get(), &dueTime, 0, 0);
+    } else {
+        std::vector<std::pair<PCWSTR, Mod*>> modsToLoad;
+        for (auto& slot : m_slots) {
+            if (slot.mod) {
+                modsToLoad.emplace_back(slot.name.c_str(), slot.mod.get());
+            }
         }
+
+        LoadMods(modsToLoad, /*loadedOnStartup=*/true);
     }
+
+    UpdateModuleLoadRegistrations();
+
+    // Mods whose initialization was deferred are loaded again by the reload
+    // which the event triggers, once the main loop runs.
+    if (m_moduleLoadedEvent &&
+        std::any_of(m_slots.begin(), m_slots.end(), [](const ModSlot& slot) {
+            return slot.mod && slot.mod->IsInitDeferred();
+        })) {
+        SetEvent(m_moduleLoadedEvent.get());
+    }
+
+    LogSettingsIoCountsSince(L"Mods loaded", settingsIoCountsStart);
 }
 
 ModsManager::~ModsManager() {
+    auto& moduleLoadNotifier = ModuleLoadNotifier::GetInstance();
+    for (UINT64 id : m_moduleLoadRegistrations) {
+        moduleLoadNotifier.Unregister(id);
+    }
+
     std::vector<ThreadCallStackRegionInfo> regions;
 
-    for (auto& [name, mod] : m_mods) {
+    for (auto& slot : m_slots) {
+        if (!slot.mod) {
+            continue;
+        }
+
         try {
-            mod.Uninitialize();
+            slot.mod->Uninitialize();
 
-            if (HMODULE module = mod.GetLoadedModModuleHandle()) {
+            if (HMODULE module = slot.mod->GetLoadedModModuleHandle()) {
                 regions.push_back({
                     .address = reinterpret_cast<DWORD_PTR>(module),
                     .size = GetModuleSizeOfImage(module),
                 });
             }
         } catch (const std::exception& e) {
-            LOG(L"Mod (%s) Uninitialize failed: %S", name.c_str(), e.what());
+            LOG(L"Mod (%s) Uninitialize failed: %S", slot.name.c_str(),
+                e.what());
         }
     }
 
+    // A single wait for the modules of all mods, which returns right away if
+    // no thread is executing any of them. The call stacks are scanned since
+    // the hooks are plain jumps, and there's no counter of the calls which
+    // are in progress, which would require intercepting their return. On
+    // shutdown, the wait is shorter, so that it fits within the stage timeout
+    // of the session manager, which moves on to the shell processes after
+    // that.
     if (!regions.empty()) {
-        ThreadsCallStackWaitForRegions(
-            regions.data(), static_cast<DWORD>(regions.size()), 200, 400);
+        std::lock_guard scanGuard(ModCpuSampler::GetScanMutex());
+        if (m_shutdown) {
+            ThreadsCallStackWaitForRegions(regions.data(),
+                                           static_cast<DWORD>(regions.size()),
+                                           kShutdownUnloadWaitIterations,
+                                           kShutdownUnloadWaitInterval);
+        } else {
+            ThreadsCallStackWaitForRegions(
+                regions.data(), static_cast<DWORD>(regions.size()), 200, 400);
+        }
     }
+
+    // The symbols kept in memory for reloads have the lifetime of the
+    // session, a later session of this process starts with an empty cache.
+    LoadedMod::ClearInMemorySymbolCache();
+}
+
+bool ModsManager::IsEmpty() const {
+    return std::none_of(m_slots.begin(), m_slots.end(),
+                        [](const ModSlot& slot) { return !!slot.mod; });
 }
 
 void ModsManager::AfterInit() {
-    for (auto& [name, mod] : m_mods) {
+    for (auto& slot : m_slots) {
+        if (!slot.mod) {
+            continue;
+        }
+
         try {
-            mod.AfterInit();
+            slot.mod->AfterInit();
         } catch (const std::exception& e) {
-            LOG(L"Mod (%s) AfterInit failed: %S", name.c_str(), e.what());
+            LOG(L"Mod (%s) AfterInit failed: %S", slot.name.c_str(), e.what());
         }
     }
 }
 
 void ModsManager::BeforeUninit() {
-    for (auto& [name, mod] : m_mods) {
+    // The session is ending, abort long operations, such as symbol loading,
+    // before the mods are asked to stop.
+    for (auto& slot : m_slots) {
+        if (slot.mod) {
+            slot.mod->CancelLongOperations();
+        }
+    }
+
+    for (auto& slot : m_slots) {
+        if (!slot.mod) {
+            continue;
+        }
+
         try {
-            mod.BeforeUninit();
+            slot.mod->BeforeUninit();
         } catch (const std::exception& e) {
-            LOG(L"Mod (%s) BeforeUninit failed: %S", name.c_str(), e.what());
+            LOG(L"Mod (%s) BeforeUninit failed: %S", slot.name.c_str(),
+                e.what());
         }
     }
 }
 
 void ModsManager::ReloadModsAndSettings() {
-    std::unordered_set<std::wstring> modsToKeepLoaded;
-    std::unordered_set<std::wstring> modsToKeepUnloaded;
-    std::vector<std::wstring> modsToLoad;
+    EngineMetrics::ScopedTimer metricsTimer(EngineMetrics::Timer::kReload);
+
+    auto settingsIoCountsStart = PortableSettings::GetIoCounts();
+
+    ULONG64 reloadStartCycleTime = 0;
+    QueryThreadCycleTime(GetCurrentThread(), &reloadStartCycleTime);
+
+    LARGE_INTEGER reloadStartCounter;
+    QueryPerformanceCounter(&reloadStartCounter);
+
+    StorageManager::GetInstance().ClearRegistryKeyCache();
 
-    StorageManager::GetInstance().EnumMods([this, &modsToKeepLoaded,
-                                            &modsToKeepUnloaded,
-                                            &modsToLoad](PCWSTR modName) {
+    enum class Action : BYTE {
+        // Not loaded, or loaded but not listed anymore.
+        kUnload,
+        kKeepLoaded,
+        kKeepUnloaded,
+        kLoad,
+    };
+
+    // Indexed by slot, slots which are added while enumerating are added here
+    // as well.
+    std::vector<Action> actions(m_slots.size(), Action::kUnload);
+    std::vector<DWORD> appliedGenerations(m_slots.size(), 0);
+
+    // Mods whose config didn't change since it was last applied are skipped
+    // entirely, only possible with a config snapshot.
+    auto snapshot = Mod::GetModConfigSnapshot();
+
+    EnumMods(snapshot.get(), [this, &actions, &appliedGenerations](
+                                 PCWSTR modName, DWORD generation) {
         try {
+            size_t slotIndex = GetOrAddSlot(modName);
+            if (slotIndex >= actions.size()) {
+                actions.resize(slotIndex + 1, Action::kUnload);
+                appliedGenerations.resize(slotIndex + 1, 0);
+            }
+
+            auto& slot = m_slots[slotIndex];
+            auto& action = actions[slotIndex];
+
+            if (generation && generation == slot.appliedGeneration &&
+                (!slot.mod || (slot.mod->GetWaitingForModules().empty() &&
+                               !slot.mod->IsInitDeferred()))) {
+                if (slot.mod) {
+                    action = Action::kKeepLoaded;
+                }
+
+                appliedGenerations[slotIndex] = generation;
+                return;
+            }
+
             bool shouldBeLoaded = Mod::ShouldLoadInRunningProcess(modName);
             if (!shouldBeLoaded) {
+                // Only recorded if the mod is handled successfully, otherwise
+                // it's handled again on the next reload.
+                appliedGenerations[slotIndex] = generation;
                 return;
             }
 
-            auto it = m_mods.find(modName);
-            if (it != m_mods.end()) {
-                auto& loadedMod = it->second;
-
+            if (slot.mod) {
                 bool reload = false;
-                if (!loadedMod.ApplyChangedSettings(&reload)) {
-                    modsToKeepUnloaded.emplace(modName);
+                if (!slot.mod->ApplyChangedSettings(&reload)) {
+                    action = Action::kKeepUnloaded;
                 } else if (reload) {
-                    modsToLoad.emplace_back(modName);
+                    action = Action::kLoad;
                 } else {
-                    modsToKeepLoaded.emplace(modName);
+                    action = Action::kKeepLoaded;
                 }
             } else {
-                modsToLoad.emplace_back(modName);
+                action = Action::kLoad;
             }
+
+            appliedGenerations[slotIndex] = generation;
         } catch (const std::exception& e) {
             LOG(L"Mod (%s) reloading failed: %S", modName, e.what());
         }
     });
 
-    for (auto& [name, mod] : m_mods) {
-        if (!modsToKeepLoaded.contains(name)) {
+    for (size_t i = 0; i < m_slots.size(); i++) {
+        m_slots[i].appliedGeneration = appliedGenerations[i];
+    }
+
+    // All mods which are going to be unloaded are signaled first, so that a
+    // mod which is loading symbols on its own thread doesn't delay the others.
+    for (size_t i = 0; i < m_slots.size(); i++) {
+        auto& slot = m_slots[i];
+        if (slot.mod && actions[i] != Action::kKeepLoaded) {
+            slot.mod->CancelLongOperations();
+        }
+    }
+
+    for (size_t i = 0; i < m_slots.size(); i++) {
+        auto& slot = m_slots[i];
+        if (slot.mod && actions[i] != Action::kKeepLoaded) {
             try {
-                mod.BeforeUninit();
+                slot.mod->BeforeUninit();
             } catch (const std::exception& e) {
-                LOG(L"Mod (%s) BeforeUninit failed: %S", name.c_str(),
+                LOG(L"Mod (%s) BeforeUninit failed: %S", slot.name.c_str(),
                     e.what());
             }
         }
     }
 
+    // A single transaction for the hooks disabled by the mods which are
+    // unloaded, and the hook operations deferred by the mods which handled a
+    // settings change.
+    ImportHooks::GetInstance().ApplyQueued(ImportHooks::kAllOwners);
+
 #ifdef WH_HOOKING_ENGINE_MINHOOK
     MH_STATUS status = MH_ApplyQueuedEx(MH_ALL_IDENTS);
     if (status != MH_OK) {
@@ -139,69 +492,160 @@ void ModsManager::ReloadModsAndSettings() {
 #error "Unsupported hooking engine"
 #endif  // WH_HOOKING_ENGINE
 
+    for (size_t i = 0; i < m_slots.size(); i++) {
+        auto& slot = m_slots[i];
+        if (slot.mod && actions[i] == Action::kKeepLoaded) {
+            slot.mod->FinishDeferredHookOperations();
+        }
+    }
+
     std::vector<ThreadCallStackRegionInfo> regions;
 
-    for (auto& [name, mod] : m_mods) {
-        if (!modsToKeepLoaded.contains(name)) {
+    for (size_t i = 0; i < m_slots.size(); i++) {
+        auto& slot = m_slots[i];
+        if (slot.mod && actions[i] != Action::kKeepLoaded) {
             try {
-                mod.Uninitialize();
+                slot.mod->Uninitialize();
 
-                if (HMODULE module = mod.GetLoadedModModuleHandle()) {
+                if (HMODULE module = slot.mod->GetLoadedModModuleHandle()) {
                     regions.push_back({
                         .address = reinterpret_cast<DWORD_PTR>(module),
                         .size = GetModuleSizeOfImage(module),
                     });
                 }
             } catch (const std::exception& e) {
-                LOG(L"Mod (%s) Uninitialize failed: %S", name.c_str(),
+                LOG(L"Mod (%s) Uninitialize failed: %S", slot.name.c_str(),
                     e.what());
             }
         }
     }
 
     if (!regions.empty()) {
+        std::lock_guard scanGuard(ModCpuSampler::GetScanMutex());
         ThreadsCallStackWaitForRegions(
             regions.data(), static_cast<DWORD>(regions.size()), 200, 400);
     }
 
-    for (auto it = m_mods.begin(); it != m_mods.end();) {
-        auto& [name, mod] = *it;
-        if (modsToKeepLoaded.contains(name)) {
-            ++it;
-        } else if (modsToKeepUnloaded.contains(name)) {
-            mod.Unload();
-            ++it;
-        } else {
-            it = m_mods.erase(it);
+    std::vector<std::pair<PCWSTR, Mod*>> modsToLoad;
+    // Mods which were loaded and are loaded again, e.g. after being compiled
+    // from the editor.
+    std::vector<Mod*> modsReplaced;
+
+    for (size_t i = 0; i < m_slots.size(); i++) {
+        auto& slot = m_slots[i];
+        switch (actions[i]) {
+            case Action::kKeepLoaded:
+                break;
+
+            case Action::kKeepUnloaded:
+                if (slot.mod) {
+                    slot.mod->Unload();
+                    LoadedMod::ClearInMemorySymbolCache(slot.name.c_str());
+                }
+                break;
+
+            case Action::kUnload:
+                if (slot.mod) {
+                    slot.mod.reset();
+                    LoadedMod::ClearInMemorySymbolCache(slot.name.c_str());
+                }
+                break;
+
+            case Action::kLoad: {
+                bool wasLoaded =
+                    slot.mod && slot.mod->GetLoadedModModuleHandle();
+                slot.mod.reset();
+                try {
+                    slot.mod = std::make_unique<Mod>(slot.name.c_str());
+                    modsToLoad.emplace_back(slot.name.c_str(), slot.mod.get());
+                    if (wasLoaded) {
+                        modsReplaced.push_back(slot.mod.get());
+                    }
+                } catch (const std::exception& e) {
+                    LOG(L"Mod (%s) initializing failed: %S", slot.name.c_str(),
+                        e.what());
+                }
+                break;
+            }
         }
     }
 
-    for (const auto& modName : modsToLoad) {
+    // The staggered startup load counts as loaded on startup, even if a config
+    // change triggered the reload earlier.
+    bool staggeredLoad = std::exchange(m_staggeredLoadPending, false);
+    LoadMods(modsToLoad, /*loadedOnStartup=*/staggeredLoad,
+             /*backgroundMode=*/staggeredLoad);
+
+    ImportHooks::GetInstance().ApplyQueued(ImportHooks::kAllOwners);
+
+#ifdef WH_HOOKING_ENGINE_MINHOOK
+    status = MH_ApplyQueuedEx(MH_ALL_IDENTS);
+    if (status != MH_OK) {
+        LOG(L"MH_ApplyQueuedEx failed with %d", status);
+    }
+#elif WH_HOOKING_ENGINE == WH_HOOKING_ENGINE_NONE
+// For testing without a hooking engine.
+#else
+#error "Unsupported hooking engine"
+#endif  // WH_HOOKING_ENGINE
+
+    for (auto [name, mod] : modsToLoad) {
         try {
-            auto result = m_mods.emplace(modName, modName.c_str());
-            if (!result.second) {
-                throw std::logic_error(
-                    "A mod with that name is already loaded");
-            }
+            mod->AfterInit();
         } catch (const std::exception& e) {
-            LOG(L"Mod (%s) initializing failed: %S", modName.c_str(), e.what());
+            LOG(L"Mod (%s) AfterInit failed: %S", name, e.what());
         }
     }
 
-    for (const auto& modName : modsToLoad) {
-        auto i = m_mods.find(modName);
-        if (i != m_mods.end()) {
-            auto& loadedMod = i->second;
-            try {
-                loadedMod.Load(/*loadedOnStartup=*/false);
-            } catch (const std::exception& e) {
-                LOG(L"Mod (%s) loading failed: %S", modName.c_str(), e.what());
-            }
+    if (!modsReplaced.empty()) {
+        ULONGLONG reloadMs = GetMillisecondsSince(reloadStartCounter.QuadPart);
+        for (Mod* mod : modsReplaced) {
+            mod->LogReloaded(reloadMs);
+        }
+    }
+
+    UpdateModuleLoadRegistrations();
+
+    LogSettingsIoCountsSince(L"Mods reloaded", settingsIoCountsStart);
+
+    if (snapshot && snapshot->generation != m_snapshotGeneration &&
+        snapshot->publishTime) {
+        m_snapshotGeneration = snapshot->generation;
+
+        ULONG64 reloadEndCycleTime = 0;
+        QueryThreadCycleTime(GetCurrentThread(), &reloadEndCycleTime);
+
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        LARGE_INTEGER counter;
+        QueryPerformanceCounter(&counter);
+        ULONGLONG latencyUs =
+            static_cast<ULONGLONG>(counter.QuadPart - snapshot->publishTime) *
+            1000000 / frequency.QuadPart;
+
+        VERBOSE(L"Applied mod config generation %u, %I64u ms after it was "
+                L"published",
+                snapshot->generation, latencyUs / 1000);
+
+        TraceEvents::ConfigChangeApplied(
+            snapshot->generation, latencyUs,
+            reloadEndCycleTime - reloadStartCycleTime,
+            PortableSettings::GetIoCounts().reads -
+                settingsIoCountsStart.reads);
+    }
+}
+
+void ModsManager::SetHooksPaused(bool paused) {
+    for (auto& slot : m_slots) {
+        if (slot.mod) {
+            slot.mod->QueueSetHooksPaused(paused);
         }
     }
 
+    ImportHooks::GetInstance().ApplyQueued(ImportHooks::kAllOwners);
+
 #ifdef WH_HOOKING_ENGINE_MINHOOK
-    status = MH_ApplyQueuedEx(MH_ALL_IDENTS);
+    MH_STATUS status = MH_ApplyQueuedEx(MH_ALL_IDENTS);
     if (status != MH_OK) {
         LOG(L"MH_ApplyQueuedEx failed with %d", status);
     }
@@ -210,16 +654,67 @@ void ModsManager::ReloadModsAndSettings() {
 #else
 #error "Unsupported hooking engine"
 #endif  // WH_HOOKING_ENGINE
+}
 
-    for (const auto& modName : modsToLoad) {
-        auto i = m_mods.find(modName);
-        if (i != m_mods.end()) {
-            auto& loadedMod = i->second;
+void ModsManager::OnSessionManagerChanged() {
+    for (auto& slot : m_slots) {
+        slot.appliedGeneration = 0;
+        if (slot.mod) {
+            slot.mod->OnSessionManagerChanged();
+        }
+    }
+
+    m_snapshotGeneration = 0;
+}
+
+size_t ModsManager::GetOrAddSlot(PCWSTR modName) {
+    auto it = m_slotIndexByName.find(std::wstring_view(modName));
+    if (it != m_slotIndexByName.end()) {
+        return it->second;
+    }
+
+    size_t slotIndex = m_slots.size();
+    m_slots.push_back({.name = modName});
+    m_slotIndexByName.emplace(modName, slotIndex);
+    return slotIndex;
+}
+
+void ModsManager::UpdateModuleLoadRegistrations() {
+    auto& moduleLoadNotifier = ModuleLoadNotifier::GetInstance();
+
+    for (UINT64 id : m_moduleLoadRegistrations) {
+        moduleLoadNotifier.Unregister(id);
+    }
+
+    m_moduleLoadRegistrations.clear();
+
+    if (!m_moduleLoadedEvent) {
+        return;
+    }
+
+    HANDLE moduleLoadedEvent = m_moduleLoadedEvent.get();
+
+    for (const auto& slot : m_slots) {
+        if (!slot.mod) {
+            continue;
+        }
+
+        for (const auto& moduleName : Functions::SplitStringToViews(
+                 slot.mod->GetWaitingForModules(), L'|')) {
             try {
-                loadedMod.AfterInit();
+                m_moduleLoadRegistrations.push_back(
+                    moduleLoadNotifier.Register(
+                        moduleName, [moduleLoadedEvent](HMODULE) {
+                            SetEvent(moduleLoadedEvent);
+                        }));
+
+                // The module might have been loaded before the registration.
+                if (GetModuleHandle(std::wstring(moduleName).c_str())) {
+                    SetEvent(moduleLoadedEvent);
+                }
             } catch (const std::exception& e) {
-                LOG(L"Mod (%s) AfterInit failed: %S", modName.c_str(),
-                    e.what());
+                LOG(L"Mod (%s) module load registration failed: %S",
+                    slot.name.c_str(), e.what());
             }
         }
     }
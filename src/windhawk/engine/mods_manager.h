@@ -13,7 +13,65 @@ class ModsManager {
     void AfterInit();
     void BeforeUninit();
     void ReloadModsAndSettings();
+    // Disables or enables the hooks of all loaded mods in a single
+    // transaction. The mods stay loaded, and aren't notified.
+    void SetHooksPaused(bool paused);
+    // Called after a new session manager took over the session, before the
+    // mods and settings are reloaded. The configs are compared in full on the
+    // next reload, since the snapshot generations of the new session manager
+    // are unrelated to the ones of the previous one.
+    void OnSessionManagerChanged();
+    // Called when the session ends since the session manager ends all
+    // sessions, see SessionShutdown. The mods are then unloaded with a shorter
+    // wait for the threads which are executing them, so that the process is
+    // done within the time the session manager waits for each stage.
+    void PrepareForShutdown() { m_shutdown = true; }
+
+    // True if no mods should be loaded in the current process.
+    bool IsEmpty() const;
+
+    // Signaled when a module which a mod is waiting for is loaded, if the
+    // initialization of a mod was deferred while the process was starting, or
+    // when the staggered load of the mods is due. Mods and settings should be
+    // reloaded in this case.
+    HANDLE GetModuleLoadedEvent() const { return m_moduleLoadedEvent.get(); }
 
    private:
-    std::unordered_map<std::wstring, Mod> m_mods;
+    // A slot is allocated for each mod name the first time it's seen and is
+    // never freed, so that the reload bookkeeping can be done with per-slot
+    // flags instead of sets of names. The amount of slots is bounded by the
+    // amount of installed mods.
+    struct ModSlot {
+        std::wstring name;
+        std::unique_ptr<Mod> mod;
+        // The config snapshot generation which was last applied, zero if
+        // unknown.
+        DWORD appliedGeneration = 0;
+    };
+
+    struct StringHash {
+        using is_transparent = void;
+
+        size_t operator()(std::wstring_view str) const {
+            return std::hash<std::wstring_view>{}(str);
+        }
+    };
+
+    size_t GetOrAddSlot(PCWSTR modName);
+    void UpdateModuleLoadRegistrations();
+
+    std::vector<ModSlot> m_slots;
+    std::unordered_map<std::wstring, size_t, StringHash, std::equal_to<>>
+        m_slotIndexByName;
+    wil::unique_event_nothrow m_moduleLoadedEvent;
+    // Signals m_moduleLoadedEvent when the mods of a process which started
+    // during the startup burst should be loaded. Declared after the event,
+    // so that it's destroyed first.
+    wil::unique_threadpool_timer m_staggeredLoadTimer;
+    bool m_staggeredLoadPending = false;
+    std::vector<UINT64> m_moduleLoadRegistrations;
+    // The generation of the mod config snapshot which was used last, to tell
+    // reloads for config changes apart from other reloads.
+    DWORD m_snapshotGeneration = 0;
+    bool m_shutdown = false;
 };
@@ -0,0 +1,73 @@
+#include "stdafx.h"
+
+#include "functions.h"
+#include "mods_pause.h"
+#include "session_private_namespace.h"
+
+ModsPause::Owner::Owner() {
+    wil::unique_hlocal secDesc;
+    THROW_IF_WIN32_BOOL_FALSE(
+        Functions::GetFullAccessSecurityDescriptor(&secDesc, nullptr));
+
+    SECURITY_ATTRIBUTES secAttr = {sizeof(SECURITY_ATTRIBUTES)};
+    secAttr.lpSecurityDescriptor = secDesc.get();
+    secAttr.bInheritHandle = FALSE;
+
+    m_pausedEvent.reset(
+        CreateEvent(&secAttr, TRUE, FALSE,
+                    MakeEventName(GetCurrentProcessId(), true).c_str()));
+    THROW_LAST_ERROR_IF(!m_pausedEvent ||
+                        GetLastError() == ERROR_ALREADY_EXISTS);
+
+    m_resumedEvent.reset(
+        CreateEvent(&secAttr, TRUE, TRUE,
+                    MakeEventName(GetCurrentProcessId(), false).c_str()));
+    THROW_LAST_ERROR_IF(!m_resumedEvent ||
+                        GetLastError() == ERROR_ALREADY_EXISTS);
+}
+
+void ModsPause::Owner::SetPaused(bool paused) {
+    // The new state is signaled before the old one is reset, so that a
+    // listener never sees neither of them signaled. A listener which sees both
+    // signaled is woken up again once the old one is reset.
+    if (paused) {
+        m_pausedEvent.SetEvent();
+        m_resumedEvent.ResetEvent();
+    } else {
+        m_resumedEvent.SetEvent();
+        m_pausedEvent.ResetEvent();
+    }
+}
+
+ModsPause::Listener::Listener(DWORD sessionManagerProcessId) {
+    m_pausedEvent.reset(OpenEvent(
+        SYNCHRONIZE, FALSE,
+        MakeEventName(sessionManagerProcessId, true).c_str()));
+    THROW_LAST_ERROR_IF_NULL(m_pausedEvent);
+
+    m_resumedEvent.reset(OpenEvent(
+        SYNCHRONIZE, FALSE,
+        MakeEventName(sessionManagerProcessId, false).c_str()));
+    THROW_LAST_ERROR_IF_NULL(m_resumedEvent);
+}
+
+bool ModsPause::Listener::IsPaused() noexcept {
+    m_paused = m_pausedEvent.is_signaled();
+    return m_paused;
+}
+
+HANDLE ModsPause::Listener::GetChangeHandle() const noexcept {
+    return m_paused ? m_resumedEvent.get() : m_pausedEvent.get();
+}
+
+// static
+std::wstring ModsPause::MakeEventName(DWORD sessionManagerProcessId,
+                                      bool paused) {
+    WCHAR szName[SessionPrivateNamespace::kPrivateNamespaceMaxLen +
+                 sizeof("\\ModsResumed")];
+    int namePos =
+        SessionPrivateNamespace::MakeName(szName, sessionManagerProcessId);
+    swprintf_s(szName + namePos, ARRAYSIZE(szName) - namePos,
+               paused ? L"\\ModsPaused" : L"\\ModsResumed");
+    return szName;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+// Whether the mods of all processes are paused, published by the session
+// manager process. While paused, the hooks of the loaded mods are disabled in
+// place, so that resuming is instant: the mods stay loaded, and the symbols
+// they resolved stay in memory. Unlike the emergency stop and the safe mode,
+// no session is ended and nothing is reloaded from storage.
+//
+// The state is kept as a pair of manual-reset events, exactly one of which is
+// signaled, so that each engine waits for the event of the opposite state
+// without having to reset a shared one. An engine which starts while mods are
+// paused pauses them right after loading them.
+class ModsPause {
+   public:
+    ModsPause() = delete;
+
+    // Used by the session manager, the state exists as long as the object
+    // exists. Must be created after the private namespace of the session
+    // manager. Mods aren't paused initially.
+    class Owner {
+       public:
+        Owner();
+
+        Owner(const Owner&) = delete;
+        Owner& operator=(const Owner&) = delete;
+
+        void SetPaused(bool paused);
+
+       private:
+        wil::unique_event_nothrow m_pausedEvent;
+        wil::unique_event_nothrow m_resumedEvent;
+    };
+
+    // Observes the state published by the given session manager. Held by the
+    // main loop of the customization session.
+    class Listener {
+       public:
+        explicit Listener(DWORD sessionManagerProcessId);
+
+        Listener(const Listener&) = delete;
+        Listener& operator=(const Listener&) = delete;
+
+        bool IsPaused() noexcept;
+        // Signaled once the state differs from the one which was last returned
+        // by IsPaused.
+        HANDLE GetChangeHandle() const noexcept;
+
+       private:
+        wil::unique_event_nothrow m_pausedEvent;
+        wil::unique_event_nothrow m_resumedEvent;
+        bool m_paused = false;
+    };
+
+   private:
+    static std::wstring MakeEventName(DWORD sessionManagerProcessId,
+                                      bool paused);
+};
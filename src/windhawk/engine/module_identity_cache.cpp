@@ -0,0 +1,192 @@
+#include "stdafx.h"
+
+#include "module_identity_cache.h"
+
+#include "functions.h"
+#include "logger.h"
+#include "module_load_notifier.h"
+#include "no_destructor.h"
+#include "var_init_once.h"
+
+namespace {
+
+// Checks whether the module is CHPE, ARM64EC or ARM64X.
+bool IsHybridModule(const IMAGE_DOS_HEADER* dosHeader,
+                    const IMAGE_NT_HEADERS* ntHeader) {
+    auto* opt = &ntHeader->OptionalHeader;
+
+    if (opt->NumberOfRvaAndSizes <= IMAGE_DIRECTORY_ENTRY_LOAD_CONFIG ||
+        !opt->DataDirectory[IMAGE_DIRECTORY_ENTRY_LOAD_CONFIG].VirtualAddress) {
+        return false;
+    }
+
+    DWORD directorySize =
+        opt->DataDirectory[IMAGE_DIRECTORY_ENTRY_LOAD_CONFIG].Size;
+
+    auto* cfg =
+        (const IMAGE_LOAD_CONFIG_DIRECTORY*)((const char*)dosHeader +
+                                             opt->DataDirectory
+                                                 [IMAGE_DIRECTORY_ENTRY_LOAD_CONFIG]
+                                                     .VirtualAddress);
+
+    constexpr DWORD kMinSize =
+        offsetof(IMAGE_LOAD_CONFIG_DIRECTORY, CHPEMetadataPointer) +
+        sizeof(IMAGE_LOAD_CONFIG_DIRECTORY::CHPEMetadataPointer);
+
+    if (directorySize < kMinSize || cfg->Size < kMinSize) {
+        return false;
+    }
+
+    return cfg->CHPEMetadataPointer != 0;
+}
+
+std::wstring GetLowercaseFileName(const std::filesystem::path& path) {
+    auto fileName = path.filename().wstring();
+    LCMapStringEx(LOCALE_NAME_USER_DEFAULT, LCMAP_LOWERCASE, &fileName[0],
+                  wil::safe_cast<int>(fileName.length()), &fileName[0],
+                  wil::safe_cast<int>(fileName.length()), nullptr, nullptr, 0);
+    return fileName;
+}
+
+// The module is identified by its PDB if it has one, and by its PE header
+// values otherwise.
+std::wstring GetSymbolCacheKey(
+    const ModuleIdentityCache::Identity& identity) {
+    std::wstring cacheStrKey;
+
+    constexpr WCHAR currentArch[] =
+#if defined(_M_IX86)
+        L"x86";
+#elif defined(_M_X64)
+        L"x86-64";
+#elif defined(_M_ARM64)
+        L"arm64";
+#else
+#error "Unsupported architecture"
+#endif
+
+    if (!identity.pdbIdentifier.empty()) {
+        cacheStrKey = L"pdb_";
+        cacheStrKey += identity.pdbIdentifier;
+        if (identity.isHybrid) {
+            cacheStrKey += L"_hybrid-";
+            cacheStrKey += currentArch;
+        }
+    } else {
+        cacheStrKey = L"pe_";
+        cacheStrKey += currentArch;
+        cacheStrKey += L'_';
+        cacheStrKey += std::to_wstring(identity.timeStamp);
+        cacheStrKey += L'_';
+        cacheStrKey += std::to_wstring(identity.imageSize);
+        cacheStrKey += L'_';
+        cacheStrKey += identity.fileName;
+        if (identity.isHybrid) {
+            cacheStrKey += L"_hybrid";
+        }
+    }
+
+    return cacheStrKey;
+}
+
+}  // namespace
+
+ModuleIdentityCache::ModuleIdentityCache() {
+    m_unloadRegistrationId = ModuleLoadNotifier::GetInstance().RegisterUnload(
+        [this](HMODULE module) { OnModuleUnloaded(module); });
+}
+
+ModuleIdentityCache::~ModuleIdentityCache() {
+    ModuleLoadNotifier::GetInstance().Unregister(m_unloadRegistrationId);
+}
+
+// static
+ModuleIdentityCache& ModuleIdentityCache::GetInstance() {
+    STATIC_INIT_ONCE(NoDestructorIfTerminating<ModuleIdentityCache>, s);
+    return **s;
+}
+
+std::shared_ptr<const ModuleIdentityCache::Identity> ModuleIdentityCache::Get(
+    HMODULE module) {
+    UINT64 unloadCount;
+
+    {
+        std::lock_guard guard(m_mutex);
+
+        auto it = m_identities.find(module);
+        if (it != m_identities.end()) {
+            return it->second;
+        }
+
+        unloadCount = m_unloadCount;
+    }
+
+    // Created without holding the mutex, which is also taken by the unload
+    // notification with the loader lock held, and getting the module path
+    // might need the loader lock.
+    auto identity = Create(module);
+
+    std::lock_guard guard(m_mutex);
+
+    if (m_unloadCount == unloadCount) {
+        m_identities.try_emplace(module, identity);
+    }
+
+    return identity;
+}
+
+// static
+std::shared_ptr<const ModuleIdentityCache::Identity>
+ModuleIdentityCache::Create(HMODULE module) {
+    auto identity = std::make_shared<Identity>();
+
+    identity->path = wil::GetModuleFileName<std::wstring>(module);
+    identity->fileName = GetLowercaseFileName(identity->path);
+
+    auto* dosHeader = reinterpret_cast<const IMAGE_DOS_HEADER*>(module);
+    auto* ntHeader = reinterpret_cast<const IMAGE_NT_HEADERS*>(
+        reinterpret_cast<const BYTE*>(dosHeader) + dosHeader->e_lfanew);
+    identity->timeStamp = ntHeader->FileHeader.TimeDateStamp;
+    identity->imageSize = ntHeader->OptionalHeader.SizeOfImage;
+
+    if (Functions::ModuleGetPDBInfo(module, &identity->pdbGuid,
+                                    &identity->pdbAge)) {
+        constexpr size_t kMaxPdbIdentifierLength =
+            sizeof("AAAAAAAABBBBCCCCDDDDEEEEEEEEEEEE12345678") - 1;
+        WCHAR pdbIdentifier[kMaxPdbIdentifierLength + 1];
+        const GUID& pdbGuid = identity->pdbGuid;
+        swprintf_s(pdbIdentifier,
+                   L"%08X%04X%04X%02X%02X%02X%02X%02X%02X%02X%02X%x",
+                   pdbGuid.Data1, pdbGuid.Data2, pdbGuid.Data3,
+                   pdbGuid.Data4[0], pdbGuid.Data4[1], pdbGuid.Data4[2],
+                   pdbGuid.Data4[3], pdbGuid.Data4[4], pdbGuid.Data4[5],
+                   pdbGuid.Data4[6], pdbGuid.Data4[7], identity->pdbAge);
+        identity->pdbIdentifier = pdbIdentifier;
+    }
+
+    identity->isHybrid = IsHybridModule(dosHeader, ntHeader);
+    identity->cacheKey = GetSymbolCacheKey(*identity);
+
+    return identity;
+}
+
+void ModuleIdentityCache::OnModuleUnloaded(HMODULE module) noexcept {
+    std::shared_ptr<const Identity> identity;
+
+    {
+        std::lock_guard guard(m_mutex);
+
+        m_unloadCount++;
+
+        auto it = m_identities.find(module);
+        if (it != m_identities.end()) {
+            identity = std::move(it->second);
+            m_identities.erase(it);
+        }
+    }
+
+    if (identity) {
+        VERBOSE(L"Dropped the cached identity of %s",
+                identity->fileName.c_str());
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+// Caches the values which identify a loaded module for the symbol caches: its
+// file name, PE header values, PDB identity and whether it's a hybrid module.
+// Reading them means walking the debug directory and the load config of the
+// module, and every symbol or pattern lookup of every mod needs them, so
+// they're computed once per module and shared by all mods of the process. An
+// entry is dropped when its module is unloaded, since another module can be
+// loaded at the same address afterwards.
+class ModuleIdentityCache {
+   public:
+    struct Identity {
+        std::filesystem::path path;
+        // Lowercase.
+        std::wstring fileName;
+        DWORD timeStamp;
+        DWORD imageSize;
+        // Empty if the module has no PDB.
+        std::wstring pdbIdentifier;
+        GUID pdbGuid;
+        DWORD pdbAge;
+        // CHPE, ARM64EC or ARM64X.
+        bool isHybrid;
+        // The key of the symbol cache entries of the module.
+        std::wstring cacheKey;
+    };
+
+    ModuleIdentityCache();
+    ~ModuleIdentityCache();
+
+    ModuleIdentityCache(const ModuleIdentityCache&) = delete;
+    ModuleIdentityCache& operator=(const ModuleIdentityCache&) = delete;
+
+    static ModuleIdentityCache& GetInstance();
+
+    // The module must be loaded, and stay loaded while the call is in
+    // progress. The result stays valid after the module is unloaded.
+    std::shared_ptr<const Identity> Get(HMODULE module);
+
+   private:
+    static std::shared_ptr<const Identity> Create(HMODULE module);
+
+    void OnModuleUnloaded(HMODULE module) noexcept;
+
+    std::mutex m_mutex;
+    std::unordered_map<HMODULE, std::shared_ptr<const Identity>> m_identities;
+    // Incremented on each unload, so that an identity which was created while
+    // its module was being unloaded isn't added.
+    UINT64 m_unloadCount = 0;
+    UINT64 m_unloadRegistrationId = 0;
+};
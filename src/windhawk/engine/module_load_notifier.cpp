@@ -0,0 +1,191 @@
+#include "stdafx.h"
+
+#include "logger.h"
+#include "module_load_notifier.h"
+#include "no_destructor.h"
+#include "var_init_once.h"
+
+namespace {
+
+// https://learn.microsoft.com/en-us/windows/win32/devnotes/ldrdllnotification
+constexpr ULONG kLdrDllNotificationReasonLoaded = 1;
+constexpr ULONG kLdrDllNotificationReasonUnloaded = 2;
+
+struct LDR_UNICODE_STRING {
+    USHORT Length;
+    USHORT MaximumLength;
+    PWSTR Buffer;
+};
+
+// The same layout is used for the unloaded notification data.
+struct LDR_DLL_LOADED_NOTIFICATION_DATA {
+    ULONG Flags;
+    const LDR_UNICODE_STRING* FullDllName;
+    const LDR_UNICODE_STRING* BaseDllName;
+    PVOID DllBase;
+    ULONG SizeOfImage;
+};
+
+using LdrDllNotificationFunction_t = void(NTAPI*)(ULONG notificationReason,
+                                                  const void* notificationData,
+                                                  void* context);
+
+using LdrRegisterDllNotification_t =
+    NTSTATUS(NTAPI*)(ULONG flags,
+                     LdrDllNotificationFunction_t notificationFunction,
+                     void* context,
+                     void** cookie);
+
+using LdrUnregisterDllNotification_t = NTSTATUS(NTAPI*)(void* cookie);
+
+}  // namespace
+
+ModuleLoadNotifier::ModuleLoadNotifier() {
+    GET_PROC_ADDRESS_ONCE(LdrRegisterDllNotification_t,
+                          pLdrRegisterDllNotification, L"ntdll.dll",
+                          "LdrRegisterDllNotification");
+    if (!pLdrRegisterDllNotification) {
+        LOG(L"LdrRegisterDllNotification isn't available");
+        return;
+    }
+
+    NTSTATUS status = pLdrRegisterDllNotification(0, NotificationCallback,
+                                                  this, &m_cookie);
+    if (!SUCCEEDED_NTSTATUS(status)) {
+        LOG(L"LdrRegisterDllNotification failed with status 0x%08X", status);
+        m_cookie = nullptr;
+    }
+}
+
+ModuleLoadNotifier::~ModuleLoadNotifier() {
+    if (!m_cookie) {
+        return;
+    }
+
+    GET_PROC_ADDRESS_ONCE(LdrUnregisterDllNotification_t,
+                          pLdrUnregisterDllNotification, L"ntdll.dll",
+                          "LdrUnregisterDllNotification");
+    if (pLdrUnregisterDllNotification) {
+        pLdrUnregisterDllNotification(m_cookie);
+    }
+}
+
+// static
+ModuleLoadNotifier& ModuleLoadNotifier::GetInstance() {
+    STATIC_INIT_ONCE(NoDestructorIfTerminating<ModuleLoadNotifier>, s);
+    return **s;
+}
+
+UINT64 ModuleLoadNotifier::Register(std::wstring_view moduleName,
+                                    Callback callback) {
+    std::lock_guard guard(m_mutex);
+
+    UINT64 id = m_nextId++;
+    m_registrations[NormalizeModuleName(moduleName)].push_back({
+        .id = id,
+        .callback = std::make_shared<Callback>(std::move(callback)),
+    });
+
+    return id;
+}
+
+UINT64 ModuleLoadNotifier::RegisterUnload(Callback callback) {
+    std::lock_guard guard(m_mutex);
+
+    UINT64 id = m_nextId++;
+    m_unloadRegistrations.push_back({
+        .id = id,
+        .callback = std::make_shared<Callback>(std::move(callback)),
+    });
+
+    return id;
+}
+
+void ModuleLoadNotifier::Unregister(UINT64 id) {
+    std::lock_guard guard(m_mutex);
+
+    if (std::erase_if(m_unloadRegistrations,
+                      [id](const Registration& item) {
+                          return item.id == id;
+                      }) > 0) {
+        return;
+    }
+
+    for (auto it = m_registrations.begin(); it != m_registrations.end();
+         ++it) {
+        auto& registrations = it->second;
+        auto registration = std::find_if(
+            registrations.begin(), registrations.end(),
+            [id](const Registration& item) { return item.id == id; });
+        if (registration != registrations.end()) {
+            registrations.erase(registration);
+            if (registrations.empty()) {
+                m_registrations.erase(it);
+            }
+
+            return;
+        }
+    }
+}
+
+// static
+void NTAPI
+ModuleLoadNotifier::NotificationCallback(ULONG notificationReason,
+                                         const void* notificationData,
+                                         void* context) {
+    if (notificationReason != kLdrDllNotificationReasonLoaded &&
+        notificationReason != kLdrDllNotificationReasonUnloaded) {
+        return;
+    }
+
+    auto* this_ = static_cast<ModuleLoadNotifier*>(context);
+    auto* data =
+        static_cast<const LDR_DLL_LOADED_NOTIFICATION_DATA*>(notificationData);
+
+    // The callbacks are called without holding the mutex, so that they can
+    // unregister themselves.
+    std::vector<std::shared_ptr<Callback>> callbacks;
+
+    try {
+        std::lock_guard guard(this_->m_mutex);
+
+        if (notificationReason == kLdrDllNotificationReasonUnloaded) {
+            for (const auto& registration : this_->m_unloadRegistrations) {
+                callbacks.push_back(registration.callback);
+            }
+        } else {
+            std::wstring_view baseDllName(
+                data->BaseDllName->Buffer,
+                data->BaseDllName->Length / sizeof(WCHAR));
+
+            auto it =
+                this_->m_registrations.find(NormalizeModuleName(baseDllName));
+            if (it == this_->m_registrations.end()) {
+                return;
+            }
+
+            for (const auto& registration : it->second) {
+                callbacks.push_back(registration.callback);
+            }
+        }
+    } catch (const std::exception& e) {
+        LOG(L"Error: %S", e.what());
+        return;
+    }
+
+    for (const auto& callback : callbacks) {
+        try {
+            (*callback)(static_cast<HMODULE>(data->DllBase));
+        } catch (const std::exception& e) {
+            LOG(L"Module notification callback failed: %S", e.what());
+        }
+    }
+}
+
+// static
+std::wstring ModuleLoadNotifier::NormalizeModuleName(
+    std::wstring_view moduleName) {
+    std::wstring result(moduleName);
+    std::transform(result.begin(), result.end(), result.begin(), towlower);
+    return result;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+// Dispatches the DLL load notifications of the current process by module file
+// name, and the DLL unload notifications to all unload callbacks, with a single
+// LdrRegisterDllNotification registration for the whole engine. The callbacks
+// are called with the loader lock held, so they must do as little as possible,
+// e.g. signal an event which another thread waits for.
+class ModuleLoadNotifier {
+   public:
+    using Callback = std::function<void(HMODULE module)>;
+
+    ModuleLoadNotifier();
+    ~ModuleLoadNotifier();
+
+    ModuleLoadNotifier(const ModuleLoadNotifier&) = delete;
+    ModuleLoadNotifier& operator=(const ModuleLoadNotifier&) = delete;
+
+    static ModuleLoadNotifier& GetInstance();
+
+    // moduleName is a file name such as "comctl32.dll", compared
+    // case-insensitively. Returns an ID for Unregister.
+    UINT64 Register(std::wstring_view moduleName, Callback callback);
+    // Called for each module which is unloaded, before it's unmapped. Returns
+    // an ID for Unregister.
+    UINT64 RegisterUnload(Callback callback);
+    void Unregister(UINT64 id);
+
+   private:
+    struct Registration {
+        UINT64 id;
+        std::shared_ptr<Callback> callback;
+    };
+
+    static void NTAPI NotificationCallback(ULONG notificationReason,
+                                           const void* notificationData,
+                                           void* context);
+    static std::wstring NormalizeModuleName(std::wstring_view moduleName);
+
+    std::mutex m_mutex;
+    UINT64 m_nextId = 1;
+    std::unordered_map<std::wstring, std::vector<Registration>>
+        m_registrations;
+    std::vector<Registration> m_unloadRegistrations;
+    void* m_cookie = nullptr;
+};
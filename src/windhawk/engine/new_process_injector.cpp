@@ -2,6 +2,7 @@
 
 #include "dll_inject.h"
 #include "functions.h"
+#include "injection_stats.h"
 #include "logger.h"
 #include "new_process_injector.h"
 #include "process_lists.h"
@@ -45,10 +46,62 @@ HANDLE CreateProcessInitAPCMutex(HANDLE sessionManagerProcess,
     return mutex.release();
 }
 
+// Returns the image path that CreateProcess is going to use, if it can be told
+// from the arguments alone without searching for the file. Only absolute
+// drive-letter paths with an explicit extension are accepted, and paths which
+// might be written differently than the path reported for the new process,
+// such as paths with short (8.3) names or relative components, are rejected.
+std::optional<std::wstring_view> GetImagePathBeforeCreation(
+    LPCWSTR lpApplicationName,
+    LPCWSTR lpCommandLine) {
+    std::wstring_view imagePath;
+
+    if (lpApplicationName) {
+        imagePath = lpApplicationName;
+    } else if (lpCommandLine) {
+        std::wstring_view commandLine = lpCommandLine;
+        if (commandLine.starts_with(L'"')) {
+            size_t end = commandLine.find(L'"', 1);
+            if (end == commandLine.npos) {
+                return std::nullopt;
+            }
+
+            imagePath = commandLine.substr(1, end - 1);
+        } else {
+            // An unquoted path with spaces is ambiguous, CreateProcess tries
+            // each prefix in turn. Such a prefix usually has no extension in
+            // its file name, and is rejected below.
+            imagePath =
+                commandLine.substr(0, commandLine.find_first_of(L" \t"));
+        }
+    } else {
+        return std::nullopt;
+    }
+
+    if (imagePath.length() < 3 || !iswalpha(imagePath[0]) ||
+        imagePath[1] != L':' || imagePath[2] != L'\\') {
+        return std::nullopt;
+    }
+
+    if (imagePath.find_first_of(L"/~") != imagePath.npos ||
+        imagePath.find(L"\\.") != imagePath.npos ||
+        imagePath.find(L"\\\\") != imagePath.npos) {
+        return std::nullopt;
+    }
+
+    size_t fileNameOffset = imagePath.rfind(L'\\') + 1;
+    if (imagePath.find(L'.', fileNameOffset) == imagePath.npos) {
+        return std::nullopt;
+    }
+
+    return imagePath;
+}
+
 }  // namespace
 
 NewProcessInjector::NewProcessInjector(HANDLE hSessionManagerProcess)
-    : m_sessionManagerProcess(hSessionManagerProcess) {
+    : m_sessionManagerProcess(hSessionManagerProcess),
+      m_sessionManagerProcessId(GetProcessId(hSessionManagerProcess)) {
     NewProcessInjector* pNullptr = nullptr;
     if (!m_pThis.compare_exchange_strong(pNullptr, this)) {
         throw std::logic_error(
@@ -110,34 +163,22 @@ NewProcessInjector::NewProcessInjector(HANDLE hSessionManagerProcess)
     }
 
     auto settings = StorageManager::GetInstance().GetAppConfig(L"Settings");
-    m_includePattern = settings->GetString(L"Include").value_or(L"");
-    m_excludePattern = settings->GetString(L"Exclude").value_or(L"");
+    // Compiled once, since they're matched against each new process.
+    m_includePattern =
+        PathPattern(settings->GetString(L"Include").value_or(L""));
+    m_excludePattern =
+        PathPattern(ProcessLists::GetInjectionExcludePattern(*settings));
     m_threadAttachExemptPattern =
-        settings->GetString(L"ThreadAttachExempt").value_or(L"");
-
-    if (!settings->GetInt(L"InjectIntoCriticalProcesses").value_or(0)) {
-        if (!m_excludePattern.empty()) {
-            m_excludePattern += L'|';
-        }
-
-        m_excludePattern += ProcessLists::kCriticalProcesses;
-    }
-
-    if (!settings->GetInt(L"InjectIntoIncompatiblePrograms").value_or(0)) {
-        if (!m_excludePattern.empty()) {
-            m_excludePattern += L'|';
-        }
-
-        m_excludePattern += ProcessLists::kIncompatiblePrograms;
-    }
-
-    if (!settings->GetInt(L"InjectIntoGames").value_or(0)) {
-        if (!m_excludePattern.empty()) {
-            m_excludePattern += L'|';
-        }
-
-        m_excludePattern += ProcessLists::kGames;
-    }
+        PathPattern(settings->GetString(L"ThreadAttachExempt").value_or(L""));
+
+    // Deciding before the process is created avoids creating excluded
+    // processes suspended and querying their image path, which adds up when
+    // many short-lived processes are created, e.g. during a build. It's
+    // optional, since the decision is based on the path as passed by the
+    // caller, which can differ from the actual image, e.g. if an Image File
+    // Execution Options debugger is configured for the executable.
+    m_decideBeforeCreation =
+        settings->GetInt(L"DecideBeforeProcessCreation").value_or(0);
 }
 
 NewProcessInjector::~NewProcessInjector() {
@@ -151,6 +192,12 @@ NewProcessInjector::~NewProcessInjector() {
     }
 }
 
+void NewProcessInjector::SetSessionManagerProcess(
+    HANDLE hSessionManagerProcess) noexcept {
+    m_sessionManagerProcess = hSessionManagerProcess;
+    m_sessionManagerProcessId = GetProcessId(hSessionManagerProcess);
+}
+
 // static
 BOOL WINAPI NewProcessInjector::CreateProcessInternalW_Hook(
     HANDLE hUserToken,
@@ -172,7 +219,14 @@ BOOL WINAPI NewProcessInjector::CreateProcessInternalW_Hook(
     BOOL bRet;
 
     __try {
-        DWORD dwNewCreationFlags = dwCreationFlags | CREATE_SUSPENDED;
+        bool skipBeforeCreation =
+            pThis->m_decideBeforeCreation &&
+            pThis->ShouldSkipBeforeCreation(lpApplicationName, lpCommandLine);
+
+        DWORD dwNewCreationFlags = dwCreationFlags;
+        if (!skipBeforeCreation) {
+            dwNewCreationFlags |= CREATE_SUSPENDED;
+        }
 
         bRet = pThis->m_originalCreateProcessInternalW(
             hUserToken, lpApplicationName, lpCommandLine, lpProcessAttributes,
@@ -183,10 +237,18 @@ BOOL WINAPI NewProcessInjector::CreateProcessInternalW_Hook(
         DWORD dwError = GetLastError();
 
         if (bRet) {
-            pThis->HandleCreatedProcess(lpProcessInformation);
-
-            if (!(dwCreationFlags & CREATE_SUSPENDED)) {
-                ResumeThread(lpProcessInformation->hThread);
+            if (skipBeforeCreation) {
+                VERBOSE(L"Skipped excluded process %u before creation",
+                        lpProcessInformation->dwProcessId);
+                InjectionStats::RecordOutcome(
+                    pThis->m_sessionManagerProcessId,
+                    InjectionStats::Outcome::kSkipped);
+            } else {
+                pThis->HandleCreatedProcess(lpProcessInformation);
+
+                if (!(dwCreationFlags & CREATE_SUSPENDED)) {
+                    ResumeThread(lpProcessInformation->hThread);
+                }
             }
 
             VERBOSE(
@@ -206,20 +268,30 @@ BOOL WINAPI NewProcessInjector::CreateProcessInternalW_Hook(
 
 void NewProcessInjector::HandleCreatedProcess(
     LPPROCESS_INFORMATION lpProcessInformation) {
+    LONGLONG discoveryTime = InjectionStats::Now();
+    ULONG64 discoveryCycleTime = InjectionStats::ThreadCycleTime();
+    LONG statsSlot = -1;
+
+    // Read once for the whole injection, a new session manager might take
+    // over the session meanwhile.
+    HANDLE sessionManagerProcess = m_sessionManagerProcess;
+    DWORD sessionManagerProcessId = m_sessionManagerProcessId;
+
     try {
         auto processImageName = wil::QueryFullProcessImageName<std::wstring>(
             lpProcessInformation->hProcess);
 
-        if (ShouldSkipNewProcess(processImageName)) {
+        auto decision = GetDecision(processImageName);
+        if (decision.skip) {
             VERBOSE(L"Skipping excluded process %u",
                     lpProcessInformation->dwProcessId);
+            InjectionStats::RecordOutcome(sessionManagerProcessId,
+                                          InjectionStats::Outcome::kSkipped);
             return;
         }
 
-        bool threadAttachExempt = ShouldAttachExemptThread(processImageName);
-
         wil::unique_mutex_nothrow mutex(CreateProcessInitAPCMutex(
-            m_sessionManagerProcess, lpProcessInformation->dwProcessId, FALSE));
+            sessionManagerProcess, lpProcessInformation->dwProcessId, FALSE));
         if (GetLastError() == ERROR_ALREADY_EXISTS) {
             // Make sure the main thread doesn't begin execution before the
             // APC is queued.
@@ -229,26 +301,64 @@ void NewProcessInjector::HandleCreatedProcess(
             return;
         }
 
-        DllInject::DllInject(
-            lpProcessInformation->hProcess, lpProcessInformation->hThread,
-            m_sessionManagerProcess, mutex.get(), threadAttachExempt);
+        statsSlot = InjectionStats::BeginInjection(
+            sessionManagerProcessId, lpProcessInformation->dwProcessId,
+            discoveryTime, discoveryCycleTime);
+
+        DllInject::StepTimes stepTimes{};
+        DllInject::DllInject(lpProcessInformation->hProcess,
+                             lpProcessInformation->hThread,
+                             sessionManagerProcess, mutex.get(),
+                             decision.threadAttachExempt, &stepTimes);
         VERBOSE(L"DllInject succeeded for new process %u",
                 lpProcessInformation->dwProcessId);
+
+        InjectionStats::EndInjection(sessionManagerProcessId, statsSlot,
+                                     InjectionStats::Outcome::kInjected,
+                                     &stepTimes);
     } catch (const std::exception& e) {
         LOG(L"Error for new process %u: %S", lpProcessInformation->dwProcessId,
             e.what());
+        InjectionStats::EndInjection(sessionManagerProcessId, statsSlot,
+                                     InjectionStats::Outcome::kFailed);
     }
 }
 
+bool NewProcessInjector::ShouldSkipBeforeCreation(
+    LPCWSTR lpApplicationName,
+    LPCWSTR lpCommandLine) noexcept {
+    try {
+        auto imagePath =
+            GetImagePathBeforeCreation(lpApplicationName, lpCommandLine);
+        if (!imagePath) {
+            return false;
+        }
+
+        return GetDecision(*imagePath).skip;
+    } catch (const std::exception& e) {
+        LOG(L"Error: %S", e.what());
+        return false;
+    }
+}
+
+InjectionDecisionCache::Decision NewProcessInjector::GetDecision(
+    std::wstring_view processImageName) {
+    return m_decisionCache.Get(processImageName, [this, processImageName]() {
+        PathPattern::Path path(processImageName);
+        return InjectionDecisionCache::Decision{
+            .skip = ShouldSkipNewProcess(path),
+            .threadAttachExempt = ShouldAttachExemptThread(path),
+        };
+    });
+}
+
 bool NewProcessInjector::ShouldSkipNewProcess(
-    std::wstring_view processImageName) const {
-    return Functions::DoesPathMatchPattern(processImageName,
-                                           m_excludePattern) &&
-           !Functions::DoesPathMatchPattern(processImageName, m_includePattern);
+    const PathPattern::Path& processImageName) const {
+    return m_excludePattern.Matches(processImageName) &&
+           !m_includePattern.Matches(processImageName);
 }
 
 bool NewProcessInjector::ShouldAttachExemptThread(
-    std::wstring_view processImageName) const {
-    return Functions::DoesPathMatchPattern(processImageName,
-                                           m_threadAttachExemptPattern);
+    const PathPattern::Path& processImageName) const {
+    return m_threadAttachExemptPattern.Matches(processImageName);
 }
@@ -1,5 +1,8 @@
 #pragma once
 
+#include "injection_decision_cache.h"
+#include "path_pattern.h"
+
 class NewProcessInjector {
    public:
     NewProcessInjector(HANDLE hSessionManagerProcess);
@@ -11,6 +14,11 @@ class NewProcessInjector {
     NewProcessInjector& operator=(const NewProcessInjector&) = delete;
     NewProcessInjector& operator=(NewProcessInjector&&) noexcept = delete;
 
+    // Used after a new session manager took over the session. The previous
+    // handle must stay valid, since it might still be in use by a process
+    // creation which is in progress.
+    void SetSessionManagerProcess(HANDLE hSessionManagerProcess) noexcept;
+
    private:
     using CreateProcessInternalW_t =
         BOOL(WINAPI*)(HANDLE hUserToken,
@@ -39,17 +47,25 @@ class NewProcessInjector {
                                 LPSTARTUPINFOW lpStartupInfo,
                                 LPPROCESS_INFORMATION lpProcessInformation,
                                 PHANDLE hRestrictedUserToken);
+    bool ShouldSkipBeforeCreation(LPCWSTR lpApplicationName,
+                                  LPCWSTR lpCommandLine) noexcept;
     void HandleCreatedProcess(LPPROCESS_INFORMATION lpProcessInformation);
-    bool ShouldSkipNewProcess(std::wstring_view processImageName) const;
-    bool ShouldAttachExemptThread(std::wstring_view processImageName) const;
+    InjectionDecisionCache::Decision GetDecision(
+        std::wstring_view processImageName);
+    bool ShouldSkipNewProcess(const PathPattern::Path& processImageName) const;
+    bool ShouldAttachExemptThread(
+        const PathPattern::Path& processImageName) const;
 
     // Limited to a single instance at a time.
     static std::atomic<NewProcessInjector*> m_pThis;
 
-    HANDLE m_sessionManagerProcess;
+    std::atomic<HANDLE> m_sessionManagerProcess;
+    std::atomic<DWORD> m_sessionManagerProcessId;
     CreateProcessInternalW_t m_originalCreateProcessInternalW = nullptr;
     std::atomic<int> m_hookProcCallCounter = 0;
-    std::wstring m_includePattern;
-    std::wstring m_excludePattern;
-    std::wstring m_threadAttachExemptPattern;
+    PathPattern m_includePattern;
+    PathPattern m_excludePattern;
+    PathPattern m_threadAttachExemptPattern;
+    bool m_decideBeforeCreation = false;
+    InjectionDecisionCache m_decisionCache;
 };
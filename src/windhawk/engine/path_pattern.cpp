@@ -0,0 +1,166 @@
+#include "stdafx.h"
+
+#include "functions.h"
+#include "path_pattern.h"
+
+namespace {
+
+void ToUpperInPlace(std::wstring& str) {
+    // A case-insensitive comparison as recommended here:
+    // https://stackoverflow.com/q/410502
+    //
+    // Don't use CharUpperBuff to avoid depending on user32.dll. Use
+    // LCMapStringEx just like it's called internally by CharUpperBuff.
+    LCMapStringEx(LOCALE_NAME_USER_DEFAULT, LCMAP_UPPERCASE, &str[0],
+                  wil::safe_cast<int>(str.length()), &str[0],
+                  wil::safe_cast<int>(str.length()), nullptr, nullptr, 0);
+}
+
+std::wstring NormalizePatternPart(std::wstring_view patternPartView) {
+    auto patternPart = std::wstring{patternPartView};
+
+#ifndef _WIN64
+    BOOL isWow64;
+    if (IsWow64Process(GetCurrentProcess(), &isWow64) && isWow64) {
+        // Get the native Program Files path regardless of the current process
+        // architecture.
+        patternPart = Functions::ReplaceAll(patternPart, L"%ProgramFiles%",
+                                            L"%ProgramW6432%",
+                                            /*ignoreCase=*/true);
+    }
+#endif  // _WIN64
+
+    auto patternPartNormalized =
+        wil::ExpandEnvironmentStrings<std::wstring>(patternPart.c_str());
+    ToUpperInPlace(patternPartNormalized);
+    return patternPartNormalized;
+}
+
+}  // namespace
+
+PathPattern::Path::Path(std::wstring_view path) : m_pathUpper(path) {
+    ToUpperInPlace(m_pathUpper);
+
+    size_t i = m_pathUpper.rfind(L'\\');
+    m_fileNameOffset = i == m_pathUpper.npos ? 0 : i + 1;
+}
+
+PathPattern::PathPattern(std::wstring_view pattern) {
+    if (pattern.empty()) {
+        return;
+    }
+
+    m_empty = false;
+
+    for (const auto& patternPartView :
+         Functions::SplitStringToViews(pattern, L'|')) {
+        auto patternPart = NormalizePatternPart(patternPartView);
+        if (patternPart.find(L'\\') == patternPart.npos) {
+            m_fileNameParts.Add(std::move(patternPart));
+        } else {
+            m_fullPathParts.Add(std::move(patternPart));
+        }
+    }
+}
+
+bool PathPattern::Matches(const Path& path, bool explicitOnly) const {
+    if (m_empty) {
+        return false;
+    }
+
+    return m_fileNameParts.Matches(path.GetFileName(), explicitOnly) ||
+           m_fullPathParts.Matches(path.GetFullPath(), explicitOnly);
+}
+
+bool PathPattern::Matches(std::wstring_view path, bool explicitOnly) const {
+    if (m_empty) {
+        return false;
+    }
+
+    return Matches(Path(path), explicitOnly);
+}
+
+void PathPattern::Parts::Add(std::wstring part) {
+    size_t firstWildcard = part.find_first_of(L"*?");
+    if (firstWildcard == part.npos) {
+        exact.insert(std::move(part));
+        return;
+    }
+
+    size_t lastWildcard = part.find_last_of(L"*?");
+    if (lastWildcard == part.length() - 1 && part.back() == L'*' &&
+        part.length() > 1 && part[part.length() - 2] == L'\\') {
+        if (firstWildcard == lastWildcard) {
+            part.pop_back();
+            folders.insert(std::move(part));
+            return;
+        }
+
+        if (firstWildcard == 0 && part.front() == L'?' &&
+            part.find_first_of(L"*?", 1) == lastWildcard) {
+            part.pop_back();
+            part.erase(0, 1);
+            anyDriveFolders.insert(std::move(part));
+            return;
+        }
+    }
+
+    if (firstWildcard == lastWildcard && part.length() > 1) {
+        if (firstWildcard == part.length() - 1 && part.back() == L'*') {
+            part.pop_back();
+            prefixes.push_back(std::move(part));
+            return;
+        }
+
+        if (firstWildcard == 0 && part.front() == L'*') {
+            part.erase(0, 1);
+            suffixes.push_back(std::move(part));
+            return;
+        }
+    }
+
+    wildcards.push_back(std::move(part));
+}
+
+bool PathPattern::Parts::Matches(std::wstring_view str,
+                                 bool explicitOnly) const {
+    if (!exact.empty() && exact.contains(str)) {
+        return true;
+    }
+
+    if (explicitOnly) {
+        return false;
+    }
+
+    if (!folders.empty() || !anyDriveFolders.empty()) {
+        for (size_t i = str.find(L'\\'); i != str.npos;
+             i = str.find(L'\\', i + 1)) {
+            auto folder = str.substr(0, i + 1);
+            if (folders.contains(folder) ||
+                anyDriveFolders.contains(folder.substr(1))) {
+                return true;
+            }
+        }
+    }
+
+    for (const auto& prefix : prefixes) {
+        if (str.starts_with(prefix)) {
+            return true;
+        }
+    }
+
+    for (const auto& suffix : suffixes) {
+        if (str.ends_with(suffix)) {
+            return true;
+        }
+    }
+
+    for (const auto& wildcard : wildcards) {
+        if (Functions::wcsmatch(wildcard.data(), wildcard.length(), str.data(),
+                                str.length())) {
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+// A compiled list of path patterns separated by '|', as used in the
+// include/exclude settings. Environment variables are expanded and the parts
+// are uppercased once on construction, so that matching only compares strings.
+// Parts without wildcards are looked up in hash sets, and so are folder parts
+// such as "C:\Folder\*" or "?:\Folder\*", for each folder of the path. Other
+// parts with a single leading or trailing '*' are compared as a suffix or a
+// prefix, and the rest are matched with Functions::wcsmatch. Parts without a
+// backslash are matched against the file name only, the rest against the full
+// path.
+class PathPattern {
+   public:
+    // An uppercased path, which can be matched against several patterns.
+    class Path {
+       public:
+        explicit Path(std::wstring_view path);
+
+        std::wstring_view GetFullPath() const { return m_pathUpper; }
+        std::wstring_view GetFileName() const {
+            return std::wstring_view(m_pathUpper).substr(m_fileNameOffset);
+        }
+
+       private:
+        std::wstring m_pathUpper;
+        size_t m_fileNameOffset;
+    };
+
+    PathPattern() = default;
+    explicit PathPattern(std::wstring_view pattern);
+
+    bool IsEmpty() const { return m_empty; }
+
+    // If explicitOnly is true, only parts without wildcards are matched.
+    bool Matches(const Path& path, bool explicitOnly = false) const;
+    bool Matches(std::wstring_view path, bool explicitOnly = false) const;
+
+   private:
+    // Allows looking up string views without creating a string.
+    struct StringHash {
+        using is_transparent = void;
+
+        size_t operator()(std::wstring_view str) const {
+            return std::hash<std::wstring_view>{}(str);
+        }
+    };
+
+    struct Parts {
+        std::unordered_set<std::wstring, StringHash, std::equal_to<>> exact;
+        // Folders with a trailing backslash. The keys of anyDriveFolders
+        // don't include the drive letter.
+        std::unordered_set<std::wstring, StringHash, std::equal_to<>> folders;
+        std::unordered_set<std::wstring, StringHash, std::equal_to<>>
+            anyDriveFolders;
+        std::vector<std::wstring> prefixes;
+        std::vector<std::wstring> suffixes;
+        std::vector<std::wstring> wildcards;
+
+        void Add(std::wstring part);
+        bool Matches(std::wstring_view str, bool explicitOnly) const;
+    };
+
+    bool m_empty = true;
+    Parts m_fullPathParts;
+    Parts m_fileNameParts;
+};
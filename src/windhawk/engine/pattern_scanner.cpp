@@ -0,0 +1,305 @@
+#include "stdafx.h"
+
+#include "pattern_scanner.h"
+#include "var_init_once.h"
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <immintrin.h>
+#elif defined(_M_ARM64)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+struct PatternInfo {
+    const BYTE* pattern;
+    const BYTE* mask;
+    size_t patternSize;
+    // The first and the last fully significant bytes, compared before the
+    // rest of the pattern. Can be the same byte.
+    size_t firstAnchor;
+    size_t lastAnchor;
+};
+
+// Returns false if no byte of the pattern is fully significant, in which case
+// only the scalar search can be used.
+bool GetAnchors(const BYTE* mask,
+                size_t patternSize,
+                size_t* firstAnchor,
+                size_t* lastAnchor) {
+    if (!mask) {
+        *firstAnchor = 0;
+        *lastAnchor = patternSize - 1;
+        return true;
+    }
+
+    bool found = false;
+    for (size_t i = 0; i < patternSize; i++) {
+        if (mask[i] == 0xFF) {
+            if (!found) {
+                *firstAnchor = i;
+                found = true;
+            }
+
+            *lastAnchor = i;
+        }
+    }
+
+    return found;
+}
+
+// All functions below search the first candidateCount positions of data, and
+// the pattern fits at each of them. The SIMD functions only handle whole
+// blocks, and return the number of positions they handled in *processed.
+
+#if defined(_M_IX86) || defined(_M_X64)
+
+bool IsAvx2Supported() {
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+
+    // The OS must save the YMM registers on context switches.
+    __cpuid(info, 1);
+    constexpr int kOsxsave = 1 << 27;
+    constexpr int kAvx = 1 << 28;
+    if ((info[2] & (kOsxsave | kAvx)) != (kOsxsave | kAvx) ||
+        (_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+
+    __cpuidex(info, 7, 0);
+    constexpr int kAvx2 = 1 << 5;
+    return (info[1] & kAvx2) != 0;
+}
+
+const BYTE* FindAvx2(const BYTE* data,
+                     size_t candidateCount,
+                     const PatternInfo& info,
+                     size_t* processed) {
+    constexpr size_t kBlockSize = 32;
+
+    const __m256i first =
+        _mm256_set1_epi8(static_cast<char>(info.pattern[info.firstAnchor]));
+    const __m256i last =
+        _mm256_set1_epi8(static_cast<char>(info.pattern[info.lastAnchor]));
+
+    size_t pos = 0;
+    for (; pos + kBlockSize <= candidateCount; pos += kBlockSize) {
+        __m256i blockFirst = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(data + pos + info.firstAnchor));
+        __m256i blockLast = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(data + pos + info.lastAnchor));
+        auto bits = static_cast<UINT32>(_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(blockFirst, first),
+                             _mm256_cmpeq_epi8(blockLast, last))));
+        while (bits) {
+            const BYTE* candidate = data + pos + std::countr_zero(bits);
+            if (PatternScanner::Matches(candidate, info.pattern, info.mask,
+                                        info.patternSize)) {
+                return candidate;
+            }
+
+            bits &= bits - 1;
+        }
+    }
+
+    *processed = pos;
+    return nullptr;
+}
+
+const BYTE* FindSse2(const BYTE* data,
+                     size_t candidateCount,
+                     const PatternInfo& info,
+                     size_t* processed) {
+    constexpr size_t kBlockSize = 16;
+
+    const __m128i first =
+        _mm_set1_epi8(static_cast<char>(info.pattern[info.firstAnchor]));
+    const __m128i last =
+        _mm_set1_epi8(static_cast<char>(info.pattern[info.lastAnchor]));
+
+    size_t pos = 0;
+    for (; pos + kBlockSize <= candidateCount; pos += kBlockSize) {
+        __m128i blockFirst = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(data + pos + info.firstAnchor));
+        __m128i blockLast = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(data + pos + info.lastAnchor));
+        auto bits = static_cast<UINT32>(
+            _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(blockFirst, first),
+                                            _mm_cmpeq_epi8(blockLast, last))));
+        while (bits) {
+            const BYTE* candidate = data + pos + std::countr_zero(bits);
+            if (PatternScanner::Matches(candidate, info.pattern, info.mask,
+                                        info.patternSize)) {
+                return candidate;
+            }
+
+            bits &= bits - 1;
+        }
+    }
+
+    *processed = pos;
+    return nullptr;
+}
+
+#elif defined(_M_ARM64)
+
+const BYTE* FindNeon(const BYTE* data,
+                     size_t candidateCount,
+                     const PatternInfo& info,
+                     size_t* processed) {
+    constexpr size_t kBlockSize = 16;
+
+    const uint8x16_t first = vdupq_n_u8(info.pattern[info.firstAnchor]);
+    const uint8x16_t last = vdupq_n_u8(info.pattern[info.lastAnchor]);
+
+    size_t pos = 0;
+    for (; pos + kBlockSize <= candidateCount; pos += kBlockSize) {
+        uint8x16_t blockFirst = vld1q_u8(data + pos + info.firstAnchor);
+        uint8x16_t blockLast = vld1q_u8(data + pos + info.lastAnchor);
+        uint8x16_t equal = vandq_u8(vceqq_u8(blockFirst, first),
+                                    vceqq_u8(blockLast, last));
+
+        // Narrow each byte of the comparison result to 4 bits, there's no
+        // movemask instruction. Only the top bit of each nibble is kept, so
+        // that each position is a single bit.
+        UINT64 bits = vget_lane_u64(
+            vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(equal), 4)),
+            0);
+        bits &= 0x8888888888888888ULL;
+        while (bits) {
+            const BYTE* candidate = data + pos + (std::countr_zero(bits) / 4);
+            if (PatternScanner::Matches(candidate, info.pattern, info.mask,
+                                        info.patternSize)) {
+                return candidate;
+            }
+
+            bits &= bits - 1;
+        }
+    }
+
+    *processed = pos;
+    return nullptr;
+}
+
+#else
+#error "Unsupported architecture"
+#endif
+
+const BYTE* FindScalar(const BYTE* data,
+                       size_t candidateCount,
+                       const PatternInfo& info,
+                       bool hasAnchors) {
+    for (size_t pos = 0; pos < candidateCount; pos++) {
+        const BYTE* candidate = data + pos;
+        if (hasAnchors &&
+            (candidate[info.firstAnchor] != info.pattern[info.firstAnchor] ||
+             candidate[info.lastAnchor] != info.pattern[info.lastAnchor])) {
+            continue;
+        }
+
+        if (PatternScanner::Matches(candidate, info.pattern, info.mask,
+                                    info.patternSize)) {
+            return candidate;
+        }
+    }
+
+    return nullptr;
+}
+
+}  // namespace
+
+namespace PatternScanner {
+
+const BYTE* Find(std::span<const BYTE> data,
+                 const BYTE* pattern,
+                 const BYTE* mask,
+                 size_t patternSize) {
+    if (patternSize == 0 || data.size() < patternSize) {
+        return nullptr;
+    }
+
+    PatternInfo info{
+        .pattern = pattern,
+        .mask = mask,
+        .patternSize = patternSize,
+    };
+
+    bool hasAnchors =
+        GetAnchors(mask, patternSize, &info.firstAnchor, &info.lastAnchor);
+
+    const BYTE* p = data.data();
+    size_t candidateCount = data.size() - patternSize + 1;
+
+    if (hasAnchors) {
+        size_t processed = 0;
+        const BYTE* found;
+#if defined(_M_IX86) || defined(_M_X64)
+        STATIC_INIT_ONCE_TRIVIAL(bool, avx2Supported, IsAvx2Supported());
+        found = avx2Supported ? FindAvx2(p, candidateCount, info, &processed)
+                              : FindSse2(p, candidateCount, info, &processed);
+#elif defined(_M_ARM64)
+        found = FindNeon(p, candidateCount, info, &processed);
+#else
+#error "Unsupported architecture"
+#endif
+        if (found) {
+            return found;
+        }
+
+        p += processed;
+        candidateCount -= processed;
+    }
+
+    return FindScalar(p, candidateCount, info, hasAnchors);
+}
+
+bool Matches(const BYTE* data,
+             const BYTE* pattern,
+             const BYTE* mask,
+             size_t patternSize) {
+    if (!mask) {
+        return memcmp(data, pattern, patternSize) == 0;
+    }
+
+    for (size_t i = 0; i < patternSize; i++) {
+        if ((data[i] & mask[i]) != (pattern[i] & mask[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::vector<std::span<const BYTE>> GetExecutableSections(HMODULE module) {
+    auto* base = reinterpret_cast<const BYTE*>(module);
+    auto* dosHeader = reinterpret_cast<const IMAGE_DOS_HEADER*>(base);
+    auto* ntHeader =
+        reinterpret_cast<const IMAGE_NT_HEADERS*>(base + dosHeader->e_lfanew);
+    DWORD imageSize = ntHeader->OptionalHeader.SizeOfImage;
+
+    std::vector<std::span<const BYTE>> sections;
+
+    auto* section = IMAGE_FIRST_SECTION(ntHeader);
+    for (WORD i = 0; i < ntHeader->FileHeader.NumberOfSections;
+         i++, section++) {
+        if (!(section->Characteristics & IMAGE_SCN_MEM_EXECUTE) ||
+            section->VirtualAddress >= imageSize) {
+            continue;
+        }
+
+        DWORD size = section->Misc.VirtualSize ? section->Misc.VirtualSize
+                                               : section->SizeOfRawData;
+        size = std::min(size, imageSize - section->VirtualAddress);
+        if (size) {
+            sections.emplace_back(base + section->VirtualAddress, size);
+        }
+    }
+
+    return sections;
+}
+
+}  // namespace PatternScanner
@@ -0,0 +1,27 @@
+#pragma once
+
+// Finds byte patterns in memory, for mods which locate code in modules without
+// symbols. Candidates are found by comparing two significant bytes of the
+// pattern at once for a whole block of positions with SIMD instructions (AVX2
+// if available, SSE2 otherwise, or NEON on ARM64), and only verified in full
+// where both match.
+namespace PatternScanner {
+
+// Each mask byte selects the bits of the data byte which must be equal to the
+// pattern byte, e.g. 0xFF for an exact match and 0x00 for a wildcard. mask can
+// be nullptr, in which case all bytes must match.
+const BYTE* Find(std::span<const BYTE> data,
+                 const BYTE* pattern,
+                 const BYTE* mask,
+                 size_t patternSize);
+
+bool Matches(const BYTE* data,
+             const BYTE* pattern,
+             const BYTE* mask,
+             size_t patternSize);
+
+// The sections of a loaded module which contain code. Parsed from the headers
+// on each call, which is much cheaper than any scan.
+std::vector<std::span<const BYTE>> GetExecutableSections(HMODULE module);
+
+}  // namespace PatternScanner
@@ -0,0 +1,321 @@
+#include "stdafx.h"
+
+#include "http_client.h"
+#include "logger.h"
+#include "pdb_downloader.h"
+#include "pdb_store.h"
+#include "storage_manager.h"
+
+namespace {
+
+// Progress is reported at most this often, since each report might rewrite a
+// file, such as the mod task metadata.
+constexpr ULONGLONG kProgressInterval = 250;
+
+// An interrupted download is resumed right away, as long as the previous
+// attempt made progress.
+constexpr int kMaxAttempts = 5;
+
+// While another process downloads the same file, its progress is checked this
+// often, and the wait is given up if the file doesn't grow for this long.
+constexpr DWORD kSharedDownloadPollInterval = 250;
+constexpr ULONGLONG kSharedDownloadStallTimeout = 30 * 1000;
+
+// The beginning of the MSF 7.00 header, which all supported PDB files have.
+constexpr char kPdbSignature[] = "Microsoft C/C++ MSF 7.00\r\n\x1a" "DS";
+
+bool IsHttpUrl(PCWSTR url) {
+    // Symbol server paths can also be chains, e.g. "a*b" or "a;b", which are
+    // left to symsrv.
+    return (_wcsnicmp(url, L"http://", sizeof("http://") - 1) == 0 ||
+            _wcsnicmp(url, L"https://", sizeof("https://") - 1) == 0) &&
+           !wcspbrk(url, L"*;");
+}
+
+bool IsPdbFile(HANDLE file) {
+    THROW_IF_WIN32_BOOL_FALSE(SetFilePointerEx(file, {}, nullptr, FILE_BEGIN));
+
+    char header[sizeof(kPdbSignature) - 1];
+    DWORD read = 0;
+    THROW_IF_WIN32_BOOL_FALSE(
+        ReadFile(file, header, sizeof(header), &read, nullptr));
+
+    return read == sizeof(header) &&
+           memcmp(header, kPdbSignature, sizeof(header)) == 0;
+}
+
+void TruncateFile(HANDLE file) {
+    THROW_IF_WIN32_BOOL_FALSE(SetFilePointerEx(file, {}, nullptr, FILE_BEGIN));
+    THROW_IF_WIN32_BOOL_FALSE(SetEndOfFile(file));
+}
+
+// Doesn't open the file, so it works while another process has it open
+// exclusively.
+std::optional<ULONGLONG> GetFileSizeByPath(const std::filesystem::path& path) {
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &data)) {
+        return std::nullopt;
+    }
+
+    return (ULONGLONG{data.nFileSizeHigh} << 32) | data.nFileSizeLow;
+}
+
+// Opens the partial file for downloading into it. If another process is
+// downloading the same file, waits for it instead of downloading the file
+// again, and returns nullptr once the PDB file is available. If the other
+// process stops downloading without completing the download, the download is
+// taken over. Returns nullptr on failure or if canceled.
+wil::unique_hfile OpenPartialFile(const std::filesystem::path& pdbFilePath,
+                                  const std::filesystem::path& partialFilePath,
+                                  const std::function<bool()>& queryCancel) {
+    std::optional<ULONGLONG> lastSize;
+    ULONGLONG lastProgressTime = GetTickCount64();
+
+    while (true) {
+        wil::unique_hfile partialFile(CreateFile(
+            partialFilePath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+            OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+        if (partialFile) {
+            return partialFile;
+        }
+
+        DWORD error = GetLastError();
+        if (error != ERROR_SHARING_VIOLATION) {
+            VERBOSE(L"Couldn't open %s: %u", partialFilePath.c_str(), error);
+            return nullptr;
+        }
+
+        if (!lastSize) {
+            VERBOSE(L"Waiting for another process to download %s",
+                    pdbFilePath.c_str());
+        }
+
+        ULONGLONG now = GetTickCount64();
+        auto size = GetFileSizeByPath(partialFilePath);
+        if (size != lastSize) {
+            lastSize = size;
+            lastProgressTime = now;
+        } else if (now - lastProgressTime >= kSharedDownloadStallTimeout) {
+            VERBOSE(L"The download of the other process stalled");
+            return nullptr;
+        }
+
+        Sleep(kSharedDownloadPollInterval);
+
+        if (queryCancel && queryCancel()) {
+            VERBOSE(L"Download canceled");
+            return nullptr;
+        }
+
+        if (PdbStore::Exists(pdbFilePath)) {
+            return nullptr;
+        }
+    }
+}
+
+std::optional<DWORD> GetMaxBytesPerSecond() {
+    auto settings = StorageManager::GetInstance().GetAppConfig(L"Settings");
+    int maxKBps = settings->GetInt(L"SymbolDownloadMaxKBps").value_or(0);
+    if (maxKBps <= 0) {
+        return std::nullopt;
+    }
+
+    return static_cast<DWORD>(maxKBps) * 1024;
+}
+
+}  // namespace
+
+namespace PdbDownloader {
+
+bool ShouldSkipDownloads() {
+    auto settings = StorageManager::GetInstance().GetAppConfig(L"Settings");
+    if (!settings->GetInt(L"SkipSymbolDownloadsOnMeteredNetwork")
+             .value_or(0)) {
+        return false;
+    }
+
+    return HttpClient::IsNetworkMetered();
+}
+
+bool Download(HMODULE moduleBase,
+              PCWSTR symbolServer,
+              const Callbacks& callbacks) {
+    if (!IsHttpUrl(symbolServer)) {
+        return false;
+    }
+
+    auto pdbFilePath = PdbStore::GetPdbPath(moduleBase);
+    if (!pdbFilePath) {
+        return false;
+    }
+
+    if (PdbStore::Exists(*pdbFilePath)) {
+        return true;
+    }
+
+    auto pdbFolderPath = pdbFilePath->parent_path();
+    auto pdbFileName = pdbFilePath->filename();
+    auto storeIdentifier = pdbFolderPath.filename();
+
+    std::filesystem::create_directories(pdbFolderPath);
+
+    // Kept if the download is interrupted, so that the next attempt, possibly
+    // in another process, can resume it.
+    auto partialFilePath = *pdbFilePath;
+    partialFilePath += L".partial";
+
+    wil::unique_hfile partialFile = OpenPartialFile(
+        *pdbFilePath, partialFilePath, callbacks.queryCancel);
+    if (!partialFile) {
+        return PdbStore::Exists(*pdbFilePath);
+    }
+
+    auto partialFileCleanup = wil::scope_exit([&] {
+        if (!partialFile) {
+            return;
+        }
+
+        LARGE_INTEGER fileSize;
+        bool empty = GetFileSizeEx(partialFile.get(), &fileSize) &&
+                     fileSize.QuadPart == 0;
+        partialFile.reset();
+        if (empty) {
+            DeleteFile(partialFilePath.c_str());
+        }
+    });
+
+    // The other process might have completed the download right before the
+    // file was opened.
+    if (PdbStore::Exists(*pdbFilePath)) {
+        return true;
+    }
+
+    std::wstring url = symbolServer;
+    if (!url.ends_with(L'/')) {
+        url += L'/';
+    }
+
+    url += pdbFileName.native();
+    url += L'/';
+    url += storeIdentifier.native();
+    url += L'/';
+    url += pdbFileName.native();
+
+    int lastPercent = -1;
+    ULONGLONG lastProgressTime = 0;
+
+    std::optional<DWORD> maxBytesPerSecond = GetMaxBytesPerSecond();
+
+    for (int attempt = 1;; attempt++) {
+        LARGE_INTEGER fileSize;
+        THROW_IF_WIN32_BOOL_FALSE(GetFileSizeEx(partialFile.get(), &fileSize));
+        ULONGLONG rangeStart = fileSize.QuadPart;
+
+        THROW_IF_WIN32_BOOL_FALSE(
+            SetFilePointerEx(partialFile.get(), {}, nullptr, FILE_END));
+
+        if (rangeStart > 0) {
+            VERBOSE(L"Resuming download of %s from %I64u bytes", url.c_str(),
+                    rangeStart);
+        } else {
+            VERBOSE(L"Downloading %s", url.c_str());
+        }
+
+        ULONGLONG received = 0;
+
+        HttpClient::RequestOptions options{
+            .rangeStart = rangeStart,
+            .notifyProgress =
+                [&](const HttpClient::Response& response) {
+                    received = response.length;
+
+                    if (!callbacks.notifyProgress || !response.contentLength) {
+                        return;
+                    }
+
+                    ULONGLONG offset =
+                        response.statusCode == 206 ? rangeStart : 0;
+                    ULONGLONG total = offset + *response.contentLength;
+                    if (total == 0) {
+                        return;
+                    }
+
+                    int percent = static_cast<int>(std::min(
+                        (offset + response.length) * 100 / total,
+                        ULONGLONG{100}));
+                    ULONGLONG now = GetTickCount64();
+                    if (percent == lastPercent ||
+                        now - lastProgressTime < kProgressInterval) {
+                        return;
+                    }
+
+                    lastPercent = percent;
+                    lastProgressTime = now;
+                    callbacks.notifyProgress(percent);
+                },
+            .maxBytesPerSecond = maxBytesPerSecond,
+        };
+
+        std::optional<HttpClient::Response> response;
+        try {
+            response = HttpClient::GetInstance().Get(
+                url.c_str(), partialFile.get(), callbacks.queryCancel, options);
+        } catch (const std::exception& e) {
+            if (attempt >= kMaxAttempts || received == 0) {
+                throw;
+            }
+
+            LOG(L"Download of %s was interrupted: %S", url.c_str(), e.what());
+            continue;
+        }
+
+        if (!response) {
+            VERBOSE(L"Download canceled");
+            return false;
+        }
+
+        if (response->statusCode == 416 && attempt < kMaxAttempts) {
+            // The partial file doesn't match the file on the server.
+            VERBOSE(L"Range not satisfiable, starting over");
+            TruncateFile(partialFile.get());
+            continue;
+        }
+
+        if (response->statusCode != 200 && response->statusCode != 206) {
+            VERBOSE(L"Symbol server returned status %u for %s",
+                    response->statusCode, url.c_str());
+            return false;
+        }
+
+        if (response->contentLength &&
+            response->length != *response->contentLength) {
+            if (attempt >= kMaxAttempts || received == 0) {
+                throw std::runtime_error("Incomplete download");
+            }
+
+            LOG(L"Download of %s is incomplete, resuming", url.c_str());
+            continue;
+        }
+
+        break;
+    }
+
+    if (!IsPdbFile(partialFile.get())) {
+        LOG(L"Downloaded file isn't a PDB file: %s", url.c_str());
+        TruncateFile(partialFile.get());
+        return false;
+    }
+
+    partialFile.reset();
+    THROW_IF_WIN32_BOOL_FALSE(MoveFileEx(partialFilePath.c_str(),
+                                         pdbFilePath->c_str(),
+                                         MOVEFILE_REPLACE_EXISTING));
+
+    if (callbacks.notifyProgress && lastPercent != 100) {
+        callbacks.notifyProgress(100);
+    }
+
+    return true;
+}
+
+}  // namespace PdbDownloader
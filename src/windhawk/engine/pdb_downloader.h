@@ -0,0 +1,31 @@
+#pragma once
+
+// Downloads PDB files from a symbol server into the local symbol store, using
+// the same layout as symsrv, so that msdia then finds them locally. Unlike
+// symsrv, interrupted downloads are resumed from where they stopped, the
+// download rate can be limited, and concurrent downloads of the same file by
+// several processes result in a single download. Progress is reported from
+// actual byte counts.
+namespace PdbDownloader {
+
+struct Callbacks {
+    std::function<bool()> queryCancel;
+    std::function<void(int)> notifyProgress;
+};
+
+// Returns whether PDB files shouldn't be downloaded at all, since the
+// connection is metered and the SkipSymbolDownloadsOnMeteredNetwork engine
+// setting is set. In this case, only local symbols are used.
+bool ShouldSkipDownloads();
+
+// Returns whether the PDB file of the module is available locally. If another
+// process is downloading the same file, waits for it. The download rate is
+// limited by the SymbolDownloadMaxKBps engine setting. Returns
+// false if it can't be downloaded this way, e.g. if the symbol server path
+// isn't a plain HTTP URL, in which case symsrv can still be used. Throws on
+// download errors.
+bool Download(HMODULE moduleBase,
+              PCWSTR symbolServer,
+              const Callbacks& callbacks);
+
+}  // namespace PdbDownloader
@@ -0,0 +1,296 @@
+#include "stdafx.h"
+
+#include "pdb_reader.h"
+
+namespace {
+
+// https://llvm.org/docs/PDB/MsfFile.html
+constexpr char kMsfMagic[] = "Microsoft C/C++ MSF 7.00\r\n\x1a"
+                             "DS\0\0";
+
+struct MsfSuperBlock {
+    char magic[32];
+    DWORD blockSize;
+    DWORD freeBlockMapBlock;
+    DWORD blockCount;
+    DWORD directorySize;
+    DWORD unknown;
+    DWORD blockMapAddress;
+};
+static_assert(sizeof(MsfSuperBlock::magic) == sizeof(kMsfMagic));
+
+constexpr DWORD kNilStreamSize = 0xFFFFFFFF;
+
+// https://llvm.org/docs/PDB/DbiStream.html
+constexpr DWORD kDbiStreamIndex = 3;
+
+struct DbiStreamHeader {
+    LONG versionSignature;
+    DWORD versionHeader;
+    DWORD age;
+    WORD globalStreamIndex;
+    WORD buildNumber;
+    WORD publicStreamIndex;
+    WORD pdbDllVersion;
+    WORD symRecordStreamIndex;
+    WORD pdbDllRbld;
+    LONG modInfoSize;
+    LONG sectionContributionSize;
+    LONG sectionMapSize;
+    LONG sourceInfoSize;
+    LONG typeServerMapSize;
+    DWORD mfcTypeServerIndex;
+    LONG optionalDbgHeaderSize;
+    LONG ecSubstreamSize;
+    WORD flags;
+    WORD machine;
+    DWORD padding;
+};
+static_assert(sizeof(DbiStreamHeader) == 64);
+
+// Indexes of the stream numbers in the optional debug header of the DBI
+// stream.
+constexpr size_t kDbgHeaderOmapFromSrc = 4;
+constexpr size_t kDbgHeaderSectionHeaders = 5;
+
+constexpr WORD kNilStreamIndex = 0xFFFF;
+
+// https://llvm.org/docs/PDB/CodeViewSymbols.html
+constexpr WORD kSymPub32 = 0x110E;
+
+// The length and kind, followed by the flags, the offset and the section.
+constexpr DWORD kPub32NameOffset = 14;
+
+template <typename T>
+T ReadValue(const BYTE* data) {
+    T value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+}  // namespace
+
+PdbReader::PdbReader(std::span<const BYTE> content) : m_content(content) {
+    if (content.size() < sizeof(MsfSuperBlock)) {
+        throw std::runtime_error("Invalid PDB file");
+    }
+
+    auto superBlock = ReadValue<MsfSuperBlock>(content.data());
+    if (memcmp(superBlock.magic, kMsfMagic, sizeof(superBlock.magic)) != 0) {
+        throw std::runtime_error("Unsupported PDB format");
+    }
+
+    if (superBlock.blockSize != 512 && superBlock.blockSize != 1024 &&
+        superBlock.blockSize != 2048 && superBlock.blockSize != 4096) {
+        throw std::runtime_error("Unsupported PDB block size");
+    }
+
+    if (superBlock.blockCount > content.size() / superBlock.blockSize) {
+        throw std::runtime_error("Truncated PDB file");
+    }
+
+    m_blockSize = superBlock.blockSize;
+    m_blockCount = superBlock.blockCount;
+
+    // The block numbers of the directory are listed in a single block.
+    DWORD directoryBlockCount =
+        (superBlock.directorySize + m_blockSize - 1) / m_blockSize;
+    if (directoryBlockCount == 0 ||
+        directoryBlockCount > m_blockSize / sizeof(DWORD)) {
+        throw std::runtime_error("Unsupported PDB directory size");
+    }
+
+    const BYTE* blockMap = GetBlock(superBlock.blockMapAddress);
+
+    m_directory.resize((superBlock.directorySize + sizeof(DWORD) - 1) /
+                       sizeof(DWORD));
+    auto* directoryData = reinterpret_cast<BYTE*>(m_directory.data());
+    for (DWORD i = 0; i < directoryBlockCount; i++) {
+        DWORD block = ReadValue<DWORD>(blockMap + i * sizeof(DWORD));
+        DWORD chunkSize =
+            std::min(m_blockSize, superBlock.directorySize - i * m_blockSize);
+        memcpy(directoryData + i * m_blockSize, GetBlock(block), chunkSize);
+    }
+
+    // The stream count, the stream sizes, then the block numbers of each
+    // stream.
+    DWORD streamCount = m_directory[0];
+    if (streamCount > m_directory.size() - 1) {
+        throw std::runtime_error("Invalid PDB directory");
+    }
+
+    size_t blockIndex = 1 + streamCount;
+    m_streams.reserve(streamCount);
+    for (DWORD i = 0; i < streamCount; i++) {
+        DWORD size = m_directory[1 + i];
+        if (size == kNilStreamSize) {
+            size = 0;
+        }
+
+        size_t blockCount =
+            static_cast<size_t>((ULONGLONG{size} + m_blockSize - 1) /
+                                m_blockSize);
+        if (blockCount > m_directory.size() - blockIndex) {
+            throw std::runtime_error("Invalid PDB directory");
+        }
+
+        m_streams.push_back({
+            .size = size,
+            .blocks = std::span<const DWORD>(m_directory.data() + blockIndex,
+                                             blockCount),
+        });
+        blockIndex += blockCount;
+    }
+
+    Stream dbiStream = GetStream(kDbiStreamIndex);
+    auto dbiHeader = ReadValue<DbiStreamHeader>(ReadStream(
+        dbiStream, 0, sizeof(DbiStreamHeader), &m_scratch));
+    if (dbiHeader.versionSignature != -1) {
+        throw std::runtime_error("Unsupported PDB DBI stream version");
+    }
+
+    m_symbolRecords = GetStream(dbiHeader.symRecordStreamIndex);
+
+    // The optional debug header comes after all other substreams.
+    ULONGLONG dbgHeaderOffset = sizeof(DbiStreamHeader);
+    for (LONG substreamSize :
+         {dbiHeader.modInfoSize, dbiHeader.sectionContributionSize,
+          dbiHeader.sectionMapSize, dbiHeader.sourceInfoSize,
+          dbiHeader.typeServerMapSize, dbiHeader.ecSubstreamSize}) {
+        if (substreamSize < 0) {
+            throw std::runtime_error("Invalid PDB DBI stream");
+        }
+
+        dbgHeaderOffset += static_cast<DWORD>(substreamSize);
+    }
+
+    if (dbiHeader.optionalDbgHeaderSize < 0 ||
+        dbgHeaderOffset + static_cast<DWORD>(dbiHeader.optionalDbgHeaderSize) >
+            dbiStream.size) {
+        throw std::runtime_error("Invalid PDB DBI stream");
+    }
+
+    size_t dbgStreamCount =
+        static_cast<DWORD>(dbiHeader.optionalDbgHeaderSize) / sizeof(WORD);
+    auto getDbgStreamIndex = [&](size_t index) {
+        if (index >= dbgStreamCount) {
+            return kNilStreamIndex;
+        }
+
+        return ReadValue<WORD>(ReadStream(
+            dbiStream,
+            static_cast<DWORD>(dbgHeaderOffset + index * sizeof(WORD)),
+            sizeof(WORD), &m_scratch));
+    };
+
+    // The addresses of such files were rearranged after linking, e.g. by
+    // older versions of the Windows build, and have to be mapped back.
+    if (getDbgStreamIndex(kDbgHeaderOmapFromSrc) != kNilStreamIndex) {
+        throw std::runtime_error(
+            "PDB OMAP address translation isn't supported");
+    }
+
+    WORD sectionHeadersStreamIndex =
+        getDbgStreamIndex(kDbgHeaderSectionHeaders);
+    if (sectionHeadersStreamIndex == kNilStreamIndex) {
+        throw std::runtime_error("PDB has no section headers");
+    }
+
+    Stream sectionHeadersStream = GetStream(sectionHeadersStreamIndex);
+    DWORD sectionCount =
+        sectionHeadersStream.size / sizeof(IMAGE_SECTION_HEADER);
+    m_sectionRvas.reserve(sectionCount);
+    for (DWORD i = 0; i < sectionCount; i++) {
+        auto sectionHeader = ReadValue<IMAGE_SECTION_HEADER>(
+            ReadStream(sectionHeadersStream, i * sizeof(IMAGE_SECTION_HEADER),
+                       sizeof(IMAGE_SECTION_HEADER), &m_scratch));
+        m_sectionRvas.push_back(sectionHeader.VirtualAddress);
+    }
+}
+
+std::optional<PdbReader::PublicSymbol> PdbReader::GetNextPublicSymbol() {
+    while (m_symbolRecords.size - m_nextRecordOffset >= sizeof(DWORD)) {
+        DWORD recordOffset = m_nextRecordOffset;
+        const BYTE* recordHeader = ReadStream(m_symbolRecords, recordOffset,
+                                              sizeof(DWORD), &m_scratch);
+        // The length doesn't include the length field itself.
+        DWORD recordSize = sizeof(WORD) + ReadValue<WORD>(recordHeader);
+        WORD recordKind = ReadValue<WORD>(recordHeader + sizeof(WORD));
+
+        if (recordSize > m_symbolRecords.size - recordOffset) {
+            throw std::runtime_error("Invalid PDB symbol record");
+        }
+
+        m_nextRecordOffset += recordSize;
+
+        if (recordKind != kSymPub32) {
+            continue;
+        }
+
+        if (recordSize <= kPub32NameOffset) {
+            throw std::runtime_error("Invalid PDB public symbol record");
+        }
+
+        const BYTE* record =
+            ReadStream(m_symbolRecords, recordOffset, recordSize, &m_scratch);
+        DWORD offset = ReadValue<DWORD>(record + 8);
+        WORD section = ReadValue<WORD>(record + 12);
+        if (section == 0 || section > m_sectionRvas.size()) {
+            continue;
+        }
+
+        auto* name = reinterpret_cast<const char*>(record + kPub32NameOffset);
+        size_t nameLength = strnlen(name, recordSize - kPub32NameOffset);
+
+        return PublicSymbol{
+            .rva = m_sectionRvas[section - 1] + offset,
+            .name = std::string_view(name, nameLength),
+        };
+    }
+
+    return std::nullopt;
+}
+
+PdbReader::Stream PdbReader::GetStream(DWORD index) const {
+    if (index >= m_streams.size()) {
+        throw std::runtime_error("Invalid PDB stream");
+    }
+
+    return m_streams[index];
+}
+
+const BYTE* PdbReader::ReadStream(const Stream& stream,
+                                  DWORD offset,
+                                  DWORD size,
+                                  std::vector<BYTE>* scratch) const {
+    if (size == 0 || offset > stream.size || size > stream.size - offset) {
+        throw std::runtime_error("Invalid PDB stream read");
+    }
+
+    DWORD blockIndex = offset / m_blockSize;
+    DWORD blockOffset = offset % m_blockSize;
+    if (blockOffset + size <= m_blockSize) {
+        return GetBlock(stream.blocks[blockIndex]) + blockOffset;
+    }
+
+    scratch->resize(size);
+    DWORD copied = 0;
+    while (copied < size) {
+        DWORD chunkSize = std::min(m_blockSize - blockOffset, size - copied);
+        memcpy(scratch->data() + copied,
+               GetBlock(stream.blocks[blockIndex]) + blockOffset, chunkSize);
+        copied += chunkSize;
+        blockIndex++;
+        blockOffset = 0;
+    }
+
+    return scratch->data();
+}
+
+const BYTE* PdbReader::GetBlock(DWORD block) const {
+    if (block >= m_blockCount) {
+        throw std::runtime_error("Invalid PDB block");
+    }
+
+    return m_content.data() + static_cast<size_t>(block) * m_blockSize;
+}
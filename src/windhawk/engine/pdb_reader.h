@@ -0,0 +1,53 @@
+#pragma once
+
+// Reads the public symbols of a PDB file directly from its content, without
+// DIA. Only what's needed to map the decorated names of public symbols to
+// RVAs is parsed: the MSF container, the DBI stream, the symbol records stream
+// and the section headers. Records are read in place, and only those which
+// cross a block boundary are copied. Throws if the file isn't a PDB, or if it
+// uses something which isn't supported, such as OMAP address translation, in
+// which case DIA should be used instead.
+class PdbReader {
+   public:
+    struct PublicSymbol {
+        DWORD rva;
+        // UTF-8, valid until the next call to GetNextPublicSymbol.
+        std::string_view name;
+    };
+
+    // The content must stay valid while the object exists.
+    explicit PdbReader(std::span<const BYTE> content);
+
+    PdbReader(const PdbReader&) = delete;
+    PdbReader& operator=(const PdbReader&) = delete;
+
+    std::optional<PublicSymbol> GetNextPublicSymbol();
+
+   private:
+    struct Stream {
+        DWORD size;
+        std::span<const DWORD> blocks;
+    };
+
+    Stream GetStream(DWORD index) const;
+    // Returns size bytes of the stream at the offset, which point into the
+    // content if they're in a single block, or into the scratch buffer
+    // otherwise.
+    const BYTE* ReadStream(const Stream& stream,
+                           DWORD offset,
+                           DWORD size,
+                           std::vector<BYTE>* scratch) const;
+    const BYTE* GetBlock(DWORD block) const;
+
+    std::span<const BYTE> m_content;
+    DWORD m_blockSize;
+    DWORD m_blockCount;
+    // The stream directory, copied since its blocks aren't contiguous.
+    std::vector<DWORD> m_directory;
+    std::vector<Stream> m_streams;
+    Stream m_symbolRecords;
+    // By section number minus one.
+    std::vector<DWORD> m_sectionRvas;
+    DWORD m_nextRecordOffset = 0;
+    std::vector<BYTE> m_scratch;
+};
@@ -0,0 +1,727 @@
+#include "stdafx.h"
+
+#include "functions.h"
+#include "logger.h"
+#include "pdb_store.h"
+#include "storage_manager.h"
+
+namespace {
+
+constexpr WCHAR kCompressedFileSuffix[] = L".whz";
+
+// Folders of the symbols folder which belong to Windhawk and not to the store,
+// such as the symbol index, are prefixed with this.
+constexpr WCHAR kOwnFolderPrefix[] = L"windhawk-";
+
+// The Compression API, available since Windows 8.
+using CreateCompressor_t = BOOL(WINAPI*)(DWORD, PVOID, PHANDLE);
+using Compress_t =
+    BOOL(WINAPI*)(HANDLE, LPCVOID, SIZE_T, PVOID, SIZE_T, PSIZE_T);
+using CloseCompressor_t = BOOL(WINAPI*)(HANDLE);
+using CreateDecompressor_t = BOOL(WINAPI*)(DWORD, PVOID, PHANDLE);
+using Decompress_t =
+    BOOL(WINAPI*)(HANDLE, LPCVOID, SIZE_T, PVOID, SIZE_T, PSIZE_T);
+using CloseDecompressor_t = BOOL(WINAPI*)(HANDLE);
+
+// Fast to decompress, which is done each time symbols are loaded.
+constexpr DWORD kCompressAlgorithmXpressHuff = 4;
+
+struct CompressedFileHeader {
+    static constexpr DWORD kMagic = 0x5A504857;  // "WHPZ"
+    static constexpr DWORD kVersion = 1;
+
+    DWORD magic;
+    DWORD version;
+    DWORD algorithm;
+    DWORD reserved;
+    ULONGLONG uncompressedSize;
+};
+
+struct UnmapViewOfFileDeleter {
+    void operator()(void* view) const { UnmapViewOfFile(view); }
+};
+
+using unique_mapped_view = std::unique_ptr<void, UnmapViewOfFileDeleter>;
+
+struct CompressionApi {
+    CreateCompressor_t pCreateCompressor;
+    Compress_t pCompress;
+    CloseCompressor_t pCloseCompressor;
+    CreateDecompressor_t pCreateDecompressor;
+    Decompress_t pDecompress;
+    CloseDecompressor_t pCloseDecompressor;
+};
+
+// Throws if the API isn't available.
+CompressionApi GetCompressionApi() {
+    LOAD_LIBRARY_GET_PROC_ADDRESS_ONCE(
+        CreateCompressor_t, pCreateCompressor, L"cabinet.dll",
+        LOAD_LIBRARY_SEARCH_SYSTEM32, "CreateCompressor");
+    LOAD_LIBRARY_GET_PROC_ADDRESS_ONCE(Compress_t, pCompress, L"cabinet.dll",
+                                       LOAD_LIBRARY_SEARCH_SYSTEM32,
+                                       "Compress");
+    LOAD_LIBRARY_GET_PROC_ADDRESS_ONCE(
+        CloseCompressor_t, pCloseCompressor, L"cabinet.dll",
+        LOAD_LIBRARY_SEARCH_SYSTEM32, "CloseCompressor");
+    LOAD_LIBRARY_GET_PROC_ADDRESS_ONCE(
+        CreateDecompressor_t, pCreateDecompressor, L"cabinet.dll",
+        LOAD_LIBRARY_SEARCH_SYSTEM32, "CreateDecompressor");
+    LOAD_LIBRARY_GET_PROC_ADDRESS_ONCE(Decompress_t, pDecompress,
+                                       L"cabinet.dll",
+                                       LOAD_LIBRARY_SEARCH_SYSTEM32,
+                                       "Decompress");
+    LOAD_LIBRARY_GET_PROC_ADDRESS_ONCE(
+        CloseDecompressor_t, pCloseDecompressor, L"cabinet.dll",
+        LOAD_LIBRARY_SEARCH_SYSTEM32, "CloseDecompressor");
+
+    if (!pCreateCompressor || !pCompress || !pCloseCompressor ||
+        !pCreateDecompressor || !pDecompress || !pCloseDecompressor) {
+        throw std::runtime_error("The Compression API isn't available");
+    }
+
+    return {
+        .pCreateCompressor = pCreateCompressor,
+        .pCompress = pCompress,
+        .pCloseCompressor = pCloseCompressor,
+        .pCreateDecompressor = pCreateDecompressor,
+        .pDecompress = pDecompress,
+        .pCloseDecompressor = pCloseDecompressor,
+    };
+}
+
+std::filesystem::path GetCompressedPath(const std::filesystem::path& pdbPath) {
+    auto compressedPath = pdbPath;
+    compressedPath += kCompressedFileSuffix;
+    return compressedPath;
+}
+
+std::wstring GetPdbStoreIdentifier(const GUID& pdbGuid, DWORD pdbAge) {
+    constexpr size_t kMaxPdbIdentifierLength =
+        sizeof("AAAAAAAABBBBCCCCDDDDEEEEEEEEEEEE12345678") - 1;
+    WCHAR pdbIdentifier[kMaxPdbIdentifierLength + 1];
+    swprintf_s(pdbIdentifier,
+               L"%08X%04X%04X%02X%02X%02X%02X%02X%02X%02X%02X%X",
+               pdbGuid.Data1, pdbGuid.Data2, pdbGuid.Data3, pdbGuid.Data4[0],
+               pdbGuid.Data4[1], pdbGuid.Data4[2], pdbGuid.Data4[3],
+               pdbGuid.Data4[4], pdbGuid.Data4[5], pdbGuid.Data4[6],
+               pdbGuid.Data4[7], pdbAge);
+
+    return pdbIdentifier;
+}
+
+// A read-only stream over a mapped view, which can be shared by clones.
+class MappedViewStream : public IStream {
+   public:
+    using View = PdbStore::Content;
+
+    MappedViewStream(std::shared_ptr<const View> view)
+        : m_view(std::move(view)) {}
+
+    MappedViewStream(const MappedViewStream&) = delete;
+    MappedViewStream& operator=(const MappedViewStream&) = delete;
+
+    // IUnknown
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid,
+                                             void** ppvObject) override {
+        if (riid == __uuidof(IUnknown) ||
+            riid == __uuidof(ISequentialStream) ||
+            riid == __uuidof(IStream)) {
+            *ppvObject = static_cast<IStream*>(this);
+            AddRef();
+            return S_OK;
+        }
+
+        *ppvObject = nullptr;
+        return E_NOINTERFACE;
+    }
+
+    ULONG STDMETHODCALLTYPE AddRef() override { return ++m_refCount; }
+
+    ULONG STDMETHODCALLTYPE Release() override {
+        ULONG refCount = --m_refCount;
+        if (refCount == 0) {
+            delete this;
+        }
+        return refCount;
+    }
+
+    // ISequentialStream
+    HRESULT STDMETHODCALLTYPE Read(void* pv,
+                                   ULONG cb,
+                                   ULONG* pcbRead) override {
+        ULONG read = 0;
+        if (m_position < m_view->size) {
+            read = static_cast<ULONG>(
+                std::min(ULONGLONG{cb}, m_view->size - m_position));
+            memcpy(pv, m_view->data.get() + m_position, read);
+            m_position += read;
+        }
+
+        if (pcbRead) {
+            *pcbRead = read;
+        }
+
+        return read == cb ? S_OK : S_FALSE;
+    }
+
+    HRESULT STDMETHODCALLTYPE Write(const void* pv,
+                                    ULONG cb,
+                                    ULONG* pcbWritten) override {
+        return STG_E_ACCESSDENIED;
+    }
+
+    // IStream
+    HRESULT STDMETHODCALLTYPE Seek(LARGE_INTEGER dlibMove,
+                                   DWORD dwOrigin,
+                                   ULARGE_INTEGER* plibNewPosition) override {
+        LONGLONG base;
+        switch (dwOrigin) {
+            case STREAM_SEEK_SET:
+                base = 0;
+                break;
+            case STREAM_SEEK_CUR:
+                base = static_cast<LONGLONG>(m_position);
+                break;
+            case STREAM_SEEK_END:
+                base = static_cast<LONGLONG>(m_view->size);
+                break;
+            default:
+                return STG_E_INVALIDFUNCTION;
+        }
+
+        LONGLONG newPosition = base + dlibMove.QuadPart;
+        if (newPosition < 0) {
+            return STG_E_INVALIDFUNCTION;
+        }
+
+        m_position = static_cast<ULONGLONG>(newPosition);
+
+        if (plibNewPosition) {
+            plibNewPosition->QuadPart = m_position;
+        }
+
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE SetSize(ULARGE_INTEGER libNewSize) override {
+        return STG_E_ACCESSDENIED;
+    }
+
+    HRESULT STDMETHODCALLTYPE CopyTo(IStream* pstm,
+                                     ULARGE_INTEGER cb,
+                                     ULARGE_INTEGER* pcbRead,
+                                     ULARGE_INTEGER* pcbWritten) override {
+        return E_NOTIMPL;
+    }
+
+    HRESULT STDMETHODCALLTYPE Commit(DWORD grfCommitFlags) override {
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE Revert() override { return S_OK; }
+
+    HRESULT STDMETHODCALLTYPE LockRegion(ULARGE_INTEGER libOffset,
+                                         ULARGE_INTEGER cb,
+                                         DWORD dwLockType) override {
+        return STG_E_INVALIDFUNCTION;
+    }
+
+    HRESULT STDMETHODCALLTYPE UnlockRegion(ULARGE_INTEGER libOffset,
+                                           ULARGE_INTEGER cb,
+                                           DWORD dwLockType) override {
+        return STG_E_INVALIDFUNCTION;
+    }
+
+    HRESULT STDMETHODCALLTYPE Stat(STATSTG* pstatstg,
+                                   DWORD grfStatFlag) override {
+        *pstatstg = {
+            .type = STGTY_STREAM,
+            .cbSize = {.QuadPart = m_view->size},
+            .grfMode = STGM_READ,
+        };
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE Clone(IStream** ppstm) override {
+        auto* clone = new (std::nothrow) MappedViewStream(m_view);
+        if (!clone) {
+            *ppstm = nullptr;
+            return E_OUTOFMEMORY;
+        }
+
+        clone->m_position = m_position;
+        *ppstm = clone;
+        return S_OK;
+    }
+
+   private:
+    std::atomic<ULONG> m_refCount = 1;
+    std::shared_ptr<const View> m_view;
+    ULONGLONG m_position = 0;
+};
+
+struct StoreFile {
+    std::filesystem::path path;
+    ULONGLONG size;
+    ULONGLONG lastUsedTime;
+};
+
+std::vector<StoreFile> GetStoreFiles(HANDLE stopEvent) {
+    std::vector<StoreFile> files;
+
+    // Only the files in the store layout are collected, <pdb name>\<pdb
+    // identifier>\<file>, including partial downloads.
+    auto symbolsPath = StorageManager::GetInstance().GetSymbolsPath();
+    std::error_code ec;
+    for (const auto& nameEntry :
+         std::filesystem::directory_iterator(symbolsPath, ec)) {
+        if (WaitForSingleObject(stopEvent, 0) == WAIT_OBJECT_0) {
+            break;
+        }
+
+        if (!nameEntry.is_directory(ec) ||
+            nameEntry.path().filename().native().starts_with(
+                kOwnFolderPrefix)) {
+            continue;
+        }
+
+        for (const auto& identifierEntry :
+             std::filesystem::directory_iterator(nameEntry.path(), ec)) {
+            if (!identifierEntry.is_directory(ec)) {
+                continue;
+            }
+
+            for (const auto& fileEntry :
+                 std::filesystem::directory_iterator(identifierEntry.path(),
+                                                     ec)) {
+                WIN32_FILE_ATTRIBUTE_DATA data;
+                if (!fileEntry.is_regular_file(ec) ||
+                    !GetFileAttributesEx(fileEntry.path().c_str(),
+                                         GetFileExInfoStandard, &data)) {
+                    continue;
+                }
+
+                files.push_back({
+                    .path = fileEntry.path(),
+                    .size = (ULONGLONG{data.nFileSizeHigh} << 32) |
+                            data.nFileSizeLow,
+                    .lastUsedTime = static_cast<ULONGLONG>(std::max(
+                        wil::filetime::to_int64(data.ftLastAccessTime),
+                        wil::filetime::to_int64(data.ftLastWriteTime))),
+                });
+            }
+        }
+    }
+
+    return files;
+}
+
+}  // namespace
+
+namespace PdbStore {
+
+std::optional<std::filesystem::path> GetPdbPath(HMODULE moduleBase) {
+    GUID pdbGuid;
+    DWORD pdbAge;
+    std::string pdbPath;
+    if (!Functions::ModuleGetPDBInfo(moduleBase, &pdbGuid, &pdbAge,
+                                     &pdbPath)) {
+        return std::nullopt;
+    }
+
+    std::filesystem::path pdbFileName =
+        std::filesystem::path(reinterpret_cast<const char8_t*>(pdbPath.c_str()))
+            .filename();
+    if (pdbFileName.empty() || pdbFileName == L"." || pdbFileName == L".." ||
+        pdbFileName.native().find_first_of(L"\\/:*?\"<>|") !=
+            std::wstring::npos) {
+        return std::nullopt;
+    }
+
+    return StorageManager::GetInstance().GetSymbolsPath() / pdbFileName /
+           GetPdbStoreIdentifier(pdbGuid, pdbAge) / pdbFileName;
+}
+
+bool Exists(const std::filesystem::path& pdbPath) {
+    std::error_code ec;
+    return std::filesystem::is_regular_file(pdbPath, ec) ||
+           std::filesystem::is_regular_file(GetCompressedPath(pdbPath), ec);
+}
+
+bool CopyFromSharedStore(const std::filesystem::path& pdbPath) {
+    auto settings = StorageManager::GetInstance().GetAppConfig(L"Settings");
+    std::wstring sharedStorePath =
+        settings->GetString(L"SharedSymbolsPath").value_or(L"");
+    if (sharedStorePath.empty() || Exists(pdbPath)) {
+        return false;
+    }
+
+    auto sharedPdbPath =
+        std::filesystem::path(sharedStorePath) /
+        pdbPath.lexically_relative(
+            StorageManager::GetInstance().GetSymbolsPath());
+
+    for (bool compressed : {true, false}) {
+        auto sourcePath =
+            compressed ? GetCompressedPath(sharedPdbPath) : sharedPdbPath;
+        auto targetPath = compressed ? GetCompressedPath(pdbPath) : pdbPath;
+
+        std::error_code ec;
+        if (!std::filesystem::is_regular_file(sourcePath, ec)) {
+            continue;
+        }
+
+        std::filesystem::create_directories(pdbPath.parent_path());
+
+        // Copied under a temporary name, so that other processes never see a
+        // partially copied file.
+        auto tempPath = targetPath;
+        tempPath += L".copy";
+        if (!CopyFile(sourcePath.c_str(), tempPath.c_str(), FALSE)) {
+            DWORD error = GetLastError();
+            DeleteFile(tempPath.c_str());
+            THROW_WIN32(error);
+        }
+
+        if (!MoveFileEx(tempPath.c_str(), targetPath.c_str(), 0)) {
+            // Most likely, another process copied the same file first.
+            VERBOSE(L"Couldn't move %s: %u", tempPath.c_str(),
+                    GetLastError());
+            DeleteFile(tempPath.c_str());
+        }
+
+        VERBOSE(L"Copied %s from the shared symbol store", sourcePath.c_str());
+        return true;
+    }
+
+    return false;
+}
+
+bool IsCompressionEnabled() {
+    auto settings = StorageManager::GetInstance().GetAppConfig(L"Settings");
+    return settings->GetInt(L"CompressSymbols").value_or(0);
+}
+
+void Compress(const std::filesystem::path& pdbPath) {
+    auto compressedPath = GetCompressedPath(pdbPath);
+
+    std::error_code ec;
+    if (std::filesystem::is_regular_file(compressedPath, ec)) {
+        // A previous attempt to delete the uncompressed file might have failed
+        // because it was in use.
+        DeleteFile(pdbPath.c_str());
+        return;
+    }
+
+    wil::unique_hfile pdbFile(CreateFile(pdbPath.c_str(), GENERIC_READ,
+                                         FILE_SHARE_READ, nullptr,
+                                         OPEN_EXISTING, 0, nullptr));
+    if (!pdbFile) {
+        return;
+    }
+
+    auto api = GetCompressionApi();
+
+    LARGE_INTEGER pdbFileSize;
+    THROW_IF_WIN32_BOOL_FALSE(GetFileSizeEx(pdbFile.get(), &pdbFileSize));
+    THROW_HR_IF(E_UNEXPECTED, pdbFileSize.QuadPart == 0);
+    THROW_HR_IF(E_OUTOFMEMORY, static_cast<ULONGLONG>(pdbFileSize.QuadPart) >
+                                   SIZE_MAX);
+
+    wil::unique_handle pdbMapping(CreateFileMapping(
+        pdbFile.get(), nullptr, PAGE_READONLY, 0, 0, nullptr));
+    THROW_LAST_ERROR_IF_NULL(pdbMapping);
+
+    unique_mapped_view pdbView(
+        MapViewOfFile(pdbMapping.get(), FILE_MAP_READ, 0, 0, 0));
+    THROW_LAST_ERROR_IF_NULL(pdbView);
+
+    HANDLE compressorRaw;
+    THROW_IF_WIN32_BOOL_FALSE(api.pCreateCompressor(
+        kCompressAlgorithmXpressHuff, nullptr, &compressorRaw));
+    auto compressorCleanup = wil::scope_exit(
+        [&api, compressorRaw] { api.pCloseCompressor(compressorRaw); });
+
+    SIZE_T pdbSize = static_cast<SIZE_T>(pdbFileSize.QuadPart);
+
+    // Query the maximum compressed size.
+    SIZE_T compressedBufferSize = 0;
+    if (!api.pCompress(compressorRaw, pdbView.get(), pdbSize, nullptr, 0,
+                       &compressedBufferSize)) {
+        DWORD error = GetLastError();
+        THROW_WIN32_IF(error, error != ERROR_INSUFFICIENT_BUFFER);
+    }
+
+    // Written to a temporary file first, so that other processes never see a
+    // partial file.
+    auto tempPath = compressedPath;
+    tempPath += L".tmp";
+
+    wil::unique_hfile tempFile(CreateFile(
+        tempPath.c_str(), GENERIC_READ | GENERIC_WRITE | DELETE, 0, nullptr,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+    THROW_LAST_ERROR_IF(!tempFile);
+
+    auto tempFileCleanup = wil::scope_exit([&tempFile, &tempPath] {
+        tempFile.reset();
+        DeleteFile(tempPath.c_str());
+    });
+
+    ULONGLONG tempFileSize =
+        ULONGLONG{sizeof(CompressedFileHeader)} + compressedBufferSize;
+
+    SIZE_T compressedSize = 0;
+    {
+        wil::unique_handle tempMapping(CreateFileMapping(
+            tempFile.get(), nullptr, PAGE_READWRITE,
+            static_cast<DWORD>(tempFileSize >> 32),
+            static_cast<DWORD>(tempFileSize), nullptr));
+        THROW_LAST_ERROR_IF_NULL(tempMapping);
+
+        unique_mapped_view tempView(
+            MapViewOfFile(tempMapping.get(), FILE_MAP_WRITE, 0, 0, 0));
+        THROW_LAST_ERROR_IF_NULL(tempView);
+
+        auto* header = static_cast<CompressedFileHeader*>(tempView.get());
+        *header = {
+            .magic = CompressedFileHeader::kMagic,
+            .version = CompressedFileHeader::kVersion,
+            .algorithm = kCompressAlgorithmXpressHuff,
+            .uncompressedSize = static_cast<ULONGLONG>(pdbFileSize.QuadPart),
+        };
+
+        THROW_IF_WIN32_BOOL_FALSE(api.pCompress(
+            compressorRaw, pdbView.get(), pdbSize, header + 1,
+            compressedBufferSize, &compressedSize));
+    }
+
+    LARGE_INTEGER finalSize{
+        .QuadPart = static_cast<LONGLONG>(sizeof(CompressedFileHeader) +
+                                          compressedSize),
+    };
+    THROW_IF_WIN32_BOOL_FALSE(
+        SetFilePointerEx(tempFile.get(), finalSize, nullptr, FILE_BEGIN));
+    THROW_IF_WIN32_BOOL_FALSE(SetEndOfFile(tempFile.get()));
+
+    tempFile.reset();
+    THROW_IF_WIN32_BOOL_FALSE(
+        MoveFileEx(tempPath.c_str(), compressedPath.c_str(), 0));
+    tempFileCleanup.release();
+
+    VERBOSE(L"Compressed %s: %I64u -> %I64u bytes", pdbPath.c_str(),
+            pdbFileSize.QuadPart, finalSize.QuadPart);
+
+    pdbView.reset();
+    pdbMapping.reset();
+    pdbFile.reset();
+
+    // Might fail if another process uses the file, it will be retried the
+    // next time.
+    if (!DeleteFile(pdbPath.c_str())) {
+        VERBOSE(L"Couldn't delete %s: %u", pdbPath.c_str(), GetLastError());
+    }
+}
+
+std::shared_ptr<const Content> OpenCompressed(
+    const std::filesystem::path& pdbPath) {
+    auto compressedPath = GetCompressedPath(pdbPath);
+
+    wil::unique_hfile file(CreateFile(
+        compressedPath.c_str(), GENERIC_READ | FILE_WRITE_ATTRIBUTES,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+        OPEN_EXISTING, 0, nullptr));
+    if (!file) {
+        DWORD error = GetLastError();
+        if (error != ERROR_FILE_NOT_FOUND && error != ERROR_PATH_NOT_FOUND) {
+            LOG(L"Couldn't open %s: %u", compressedPath.c_str(), error);
+        }
+        return nullptr;
+    }
+
+    LARGE_INTEGER fileSize;
+    THROW_IF_WIN32_BOOL_FALSE(GetFileSizeEx(file.get(), &fileSize));
+    if (fileSize.QuadPart <=
+        static_cast<LONGLONG>(sizeof(CompressedFileHeader))) {
+        LOG(L"Invalid compressed PDB file %s", compressedPath.c_str());
+        return nullptr;
+    }
+
+    auto api = GetCompressionApi();
+
+    wil::unique_handle mapping(
+        CreateFileMapping(file.get(), nullptr, PAGE_READONLY, 0, 0, nullptr));
+    THROW_LAST_ERROR_IF_NULL(mapping);
+
+    unique_mapped_view view(
+        MapViewOfFile(mapping.get(), FILE_MAP_READ, 0, 0, 0));
+    THROW_LAST_ERROR_IF_NULL(view);
+
+    const auto* header = static_cast<const CompressedFileHeader*>(view.get());
+    if (header->magic != CompressedFileHeader::kMagic ||
+        header->version != CompressedFileHeader::kVersion ||
+        header->uncompressedSize == 0 ||
+        header->uncompressedSize > SIZE_MAX) {
+        LOG(L"Invalid compressed PDB file %s", compressedPath.c_str());
+        return nullptr;
+    }
+
+    // The decompressed content is kept in memory backed by the paging file,
+    // so that nothing is written to the disk.
+    auto decompressed = std::make_shared<Content>();
+    decompressed->size = header->uncompressedSize;
+    decompressed->mapping.reset(CreateFileMapping(
+        INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+        static_cast<DWORD>(decompressed->size >> 32),
+        static_cast<DWORD>(decompressed->size), nullptr));
+    THROW_LAST_ERROR_IF_NULL(decompressed->mapping);
+
+    decompressed->data.reset(static_cast<BYTE*>(
+        MapViewOfFile(decompressed->mapping.get(), FILE_MAP_WRITE, 0, 0, 0)));
+    THROW_LAST_ERROR_IF_NULL(decompressed->data);
+
+    HANDLE decompressorRaw;
+    THROW_IF_WIN32_BOOL_FALSE(api.pCreateDecompressor(
+        header->algorithm, nullptr, &decompressorRaw));
+    auto decompressorCleanup = wil::scope_exit(
+        [&api, decompressorRaw] { api.pCloseDecompressor(decompressorRaw); });
+
+    SIZE_T decompressedSize = 0;
+    THROW_IF_WIN32_BOOL_FALSE(api.pDecompress(
+        decompressorRaw, header + 1,
+        static_cast<SIZE_T>(fileSize.QuadPart - sizeof(CompressedFileHeader)),
+        decompressed->data.get(), static_cast<SIZE_T>(decompressed->size),
+        &decompressedSize));
+    THROW_HR_IF(E_UNEXPECTED, decompressedSize != decompressed->size);
+
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    SetFileTime(file.get(), nullptr, &now, nullptr);
+
+    return decompressed;
+}
+
+std::shared_ptr<const Content> OpenMapped(
+    const std::filesystem::path& pdbPath) {
+    wil::unique_hfile file(CreateFile(
+        pdbPath.c_str(), GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+        OPEN_EXISTING, 0, nullptr));
+    if (!file) {
+        DWORD error = GetLastError();
+        if (error != ERROR_FILE_NOT_FOUND && error != ERROR_PATH_NOT_FOUND) {
+            LOG(L"Couldn't open %s: %u", pdbPath.c_str(), error);
+        }
+        return nullptr;
+    }
+
+    LARGE_INTEGER fileSize;
+    THROW_IF_WIN32_BOOL_FALSE(GetFileSizeEx(file.get(), &fileSize));
+    if (fileSize.QuadPart == 0) {
+        LOG(L"Empty PDB file %s", pdbPath.c_str());
+        return nullptr;
+    }
+
+#ifndef _WIN64
+    // Large PDB files, e.g. of Windows.UI.Xaml.dll, might not fit in the
+    // address space of a 32-bit process, fall back to reading them.
+    constexpr LONGLONG kMaxMappedSize = 256 * 1024 * 1024;
+    if (fileSize.QuadPart > kMaxMappedSize) {
+        return nullptr;
+    }
+#endif  // _WIN64
+
+    auto content = std::make_shared<Content>();
+    content->size = static_cast<ULONGLONG>(fileSize.QuadPart);
+    content->mapping.reset(
+        CreateFileMapping(file.get(), nullptr, PAGE_READONLY, 0, 0, nullptr));
+    THROW_LAST_ERROR_IF_NULL(content->mapping);
+
+    content->data.reset(static_cast<BYTE*>(
+        MapViewOfFile(content->mapping.get(), FILE_MAP_READ, 0, 0, 0)));
+    THROW_LAST_ERROR_IF_NULL(content->data);
+
+    return content;
+}
+
+wil::com_ptr<IStream> CreateStream(std::shared_ptr<const Content> content) {
+    wil::com_ptr<IStream> stream;
+    stream.attach(new MappedViewStream(std::move(content)));
+    return stream;
+}
+
+void MarkUsed(const std::filesystem::path& pdbPath) {
+    // Last access times aren't always updated by the file system, so the
+    // time is set explicitly.
+    wil::unique_hfile file(CreateFile(
+        pdbPath.c_str(), FILE_WRITE_ATTRIBUTES,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+        OPEN_EXISTING, 0, nullptr));
+    if (!file) {
+        return;
+    }
+
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    SetFileTime(file.get(), nullptr, &now, nullptr);
+}
+
+void EvictUnused(HANDLE stopEvent) {
+    auto settings = StorageManager::GetInstance().GetAppConfig(L"Settings");
+    int maxSizeMb = settings->GetInt(L"SymbolsMaxSizeMB").value_or(0);
+    int maxAgeDays = settings->GetInt(L"SymbolsMaxAgeDays").value_or(0);
+    if (maxSizeMb <= 0 && maxAgeDays <= 0) {
+        return;
+    }
+
+    auto files = GetStoreFiles(stopEvent);
+
+    std::sort(files.begin(), files.end(), [](const auto& a, const auto& b) {
+        return a.lastUsedTime < b.lastUsedTime;
+    });
+
+    ULONGLONG totalSize = 0;
+    for (const auto& file : files) {
+        totalSize += file.size;
+    }
+
+    ULONGLONG maxSize =
+        maxSizeMb > 0 ? static_cast<ULONGLONG>(maxSizeMb) << 20 : ULLONG_MAX;
+
+    ULONGLONG oldestAllowedTime = 0;
+    if (maxAgeDays > 0) {
+        oldestAllowedTime = static_cast<ULONGLONG>(
+            wil::filetime::to_int64(wil::filetime::get_system_time()) -
+            wil::filetime_duration::one_hour * 24 * maxAgeDays);
+    }
+
+    VERBOSE(L"Symbol store size: %I64u bytes in %zu files", totalSize,
+            files.size());
+
+    for (const auto& file : files) {
+        if (totalSize <= maxSize && file.lastUsedTime >= oldestAllowedTime) {
+            break;
+        }
+
+        if (WaitForSingleObject(stopEvent, 0) == WAIT_OBJECT_0) {
+            return;
+        }
+
+        // Fails for files which are in use, which are kept.
+        if (!DeleteFile(file.path.c_str())) {
+            VERBOSE(L"Couldn't delete %s: %u", file.path.c_str(),
+                    GetLastError());
+            continue;
+        }
+
+        VERBOSE(L"Evicted %s", file.path.c_str());
+        totalSize -= file.size;
+
+        // Fails unless the folders are empty.
+        auto identifierFolder = file.path.parent_path();
+        if (RemoveDirectory(identifierFolder.c_str())) {
+            RemoveDirectory(identifierFolder.parent_path().c_str());
+        }
+    }
+}
+
+}  // namespace PdbStore
@@ -0,0 +1,62 @@
+#pragma once
+
+// Manages the PDB files in the local symbol store, which uses the symsrv
+// layout: <pdb name>\<pdb identifier>\<pdb name>. Optionally, PDB files are
+// kept compressed, and are decompressed into memory when they're loaded. Files
+// which weren't used for a while are evicted in the background service.
+namespace PdbStore {
+
+// Returns the path of the module's PDB file in the local store, whether or not
+// it exists, or std::nullopt if the module has no PDB information.
+std::optional<std::filesystem::path> GetPdbPath(HMODULE moduleBase);
+
+// Returns whether the PDB file exists, either compressed or not.
+bool Exists(const std::filesystem::path& pdbPath);
+
+// Copies the PDB file from the shared store of the engine settings into the
+// local store, unless it's already there. The shared store uses the same
+// layout, and is usually a read-only network folder which an administrator
+// populates, so that not every computer downloads the same PDB files. Both
+// compressed and uncompressed files are used. Returns whether the file was
+// copied.
+bool CopyFromSharedStore(const std::filesystem::path& pdbPath);
+
+// Returns whether newly stored PDB files should be compressed, per the engine
+// settings.
+bool IsCompressionEnabled();
+
+// Replaces the PDB file with a compressed copy. Does nothing if there's no
+// uncompressed file.
+void Compress(const std::filesystem::path& pdbPath);
+
+// The content of a PDB file, mapped into memory, either from the file itself
+// or from the memory it was decompressed into.
+struct Content {
+    wil::unique_handle mapping;
+    wil::unique_mapview_ptr<BYTE> data;
+    ULONGLONG size;
+};
+
+// Returns the decompressed content of the PDB file, or nullptr if there's no
+// compressed file.
+std::shared_ptr<const Content> OpenCompressed(
+    const std::filesystem::path& pdbPath);
+
+// Returns a read-only mapping of the uncompressed PDB file, or nullptr if
+// there's no uncompressed file. Unlike reading the file, the pages are shared
+// by all processes which load the same PDB file at the same time.
+std::shared_ptr<const Content> OpenMapped(const std::filesystem::path& pdbPath);
+
+// Returns a read-only stream over the content, e.g. for DIA, which keeps it
+// mapped.
+wil::com_ptr<IStream> CreateStream(std::shared_ptr<const Content> content);
+
+// Records that the PDB file was used, which is the order of eviction.
+void MarkUsed(const std::filesystem::path& pdbPath);
+
+// Deletes the least recently used PDB files which exceed the total size budget
+// or the maximum age from the engine settings. Returns early if the stop event
+// is signaled.
+void EvictUnused(HANDLE stopEvent);
+
+}  // namespace PdbStore
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "portable_settings.h"
+
 namespace ProcessLists {
 
 // Based on:
@@ -58,6 +60,16 @@ inline constexpr WCHAR kCriticalProcessesForMods[] =
     LR"(%systemroot%\syswow64\werfault.exe|)"
     LR"(%systemroot%\system32\winlogon.exe)";
 
+// Shell processes, which are customized by most users and whose
+// customizations are the most visible.
+inline constexpr WCHAR kShellProcesses[] =
+    L"explorer.exe|"
+    L"ShellExperienceHost.exe|"
+    L"StartMenuExperienceHost.exe|"
+    L"SearchHost.exe|"
+    L"SearchApp.exe|"
+    L"TextInputHost.exe";
+
 inline constexpr WCHAR kIncompatiblePrograms[] =
     LR"(%ProgramFiles%\Oracle\VirtualBox\*|)"
     LR"(%ProgramFiles(X86)%\Oracle\VirtualBox\*)";
@@ -100,4 +112,33 @@ inline constexpr WCHAR kGames[] =
 
 #undef ALL_PROGRAM_FILES
 
+// Returns the Exclude setting of the app, together with the lists above which
+// the settings don't allow injecting into. Processes which match it, and don't
+// match the Include setting, aren't injected into.
+inline std::wstring GetInjectionExcludePattern(PortableSettings& settings) {
+    auto excludePattern = settings.GetString(L"Exclude").value_or(L"");
+
+    auto append = [&excludePattern](PCWSTR pattern) {
+        if (!excludePattern.empty()) {
+            excludePattern += L'|';
+        }
+
+        excludePattern += pattern;
+    };
+
+    if (!settings.GetInt(L"InjectIntoCriticalProcesses").value_or(0)) {
+        append(kCriticalProcesses);
+    }
+
+    if (!settings.GetInt(L"InjectIntoIncompatiblePrograms").value_or(0)) {
+        append(kIncompatiblePrograms);
+    }
+
+    if (!settings.GetInt(L"InjectIntoGames").value_or(0)) {
+        append(kGames);
+    }
+
+    return excludePattern;
+}
+
 }  // namespace ProcessLists
@@ -0,0 +1,258 @@
+#include "stdafx.h"
+
+#include "session_shutdown.h"
+
+#include "functions.h"
+#include "logger.h"
+#include "path_pattern.h"
+#include "process_lists.h"
+#include "session_private_namespace.h"
+
+namespace {
+
+// The table is scanned again at least this often while waiting, to notice the
+// processes which were terminated without ending their session.
+constexpr DWORD kScanInterval = 500;
+
+constexpr PCWSTR kStageNames[SessionShutdown::kStageCount] = {
+    L"regular",
+    L"shell",
+};
+
+ULONGLONG GetProcessCreationTime(HANDLE process) noexcept {
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetProcessTimes(process, &creationTime, &exitTime, &kernelTime,
+                         &userTime)) {
+        return 0;
+    }
+
+    return wil::filetime::to_int64(creationTime);
+}
+
+// If the state of the process can't be queried, it's assumed to be running.
+bool IsProcessRunning(DWORD processId, ULONGLONG processCreationTime) noexcept {
+    wil::unique_process_handle process(OpenProcess(
+        PROCESS_QUERY_LIMITED_INFORMATION | SYNCHRONIZE, FALSE, processId));
+    if (!process) {
+        return GetLastError() != ERROR_INVALID_PARAMETER;
+    }
+
+    if (WaitForSingleObject(process.get(), 0) == WAIT_OBJECT_0) {
+        return false;
+    }
+
+    // A different process with a reused process ID.
+    ULONGLONG creationTime = GetProcessCreationTime(process.get());
+    return !creationTime || !processCreationTime ||
+           creationTime == processCreationTime;
+}
+
+}  // namespace
+
+SessionShutdown::Owner::Owner() {
+    wil::unique_hlocal secDesc;
+    THROW_IF_WIN32_BOOL_FALSE(
+        Functions::GetFullAccessSecurityDescriptor(&secDesc, nullptr));
+
+    SECURITY_ATTRIBUTES secAttr = {sizeof(SECURITY_ATTRIBUTES)};
+    secAttr.lpSecurityDescriptor = secDesc.get();
+    secAttr.bInheritHandle = FALSE;
+
+    DWORD currentProcessId = GetCurrentProcessId();
+
+    m_mapping.reset(CreateFileMapping(
+        INVALID_HANDLE_VALUE, &secAttr, PAGE_READWRITE, 0, sizeof(SharedData),
+        MakeObjectName(currentProcessId, L"ShutdownSessions").c_str()));
+    THROW_LAST_ERROR_IF(!m_mapping || GetLastError() == ERROR_ALREADY_EXISTS);
+
+    m_view.reset(MapViewOfFile(m_mapping.get(), FILE_MAP_WRITE, 0, 0,
+                               sizeof(SharedData)));
+    THROW_LAST_ERROR_IF(!m_view);
+
+    // The rest of the memory is zero-initialized.
+    static_cast<SharedData*>(m_view.get())->version = kVersion;
+
+    for (size_t i = 0; i < kStageCount; i++) {
+        m_stageEvents[i].reset(CreateEvent(
+            &secAttr, TRUE, FALSE,
+            MakeStageEventName(currentProcessId, static_cast<Stage>(i))
+                .c_str()));
+        THROW_LAST_ERROR_IF(!m_stageEvents[i] ||
+                            GetLastError() == ERROR_ALREADY_EXISTS);
+    }
+
+    m_sessionEndedEvent.reset(CreateEvent(
+        &secAttr, FALSE, FALSE,
+        MakeObjectName(currentProcessId, L"ShutdownSessionEnded").c_str()));
+    THROW_LAST_ERROR_IF(!m_sessionEndedEvent ||
+                        GetLastError() == ERROR_ALREADY_EXISTS);
+}
+
+bool SessionShutdown::Owner::Run(DWORD stageTimeout) noexcept {
+    bool allEnded = true;
+
+    for (size_t i = 0; i < kStageCount; i++) {
+        Stage stage = static_cast<Stage>(i);
+        PCWSTR stageName = kStageNames[i];
+
+        ULONGLONG startTime = GetTickCount64();
+        m_stageEvents[i].SetEvent();
+
+        LONG lastCount = -1;
+        while (true) {
+            LONG count = CountRunningSessions(stage);
+            if (count == 0) {
+                LOG(L"Shutdown of %s processes done in %llu ms", stageName,
+                    GetTickCount64() - startTime);
+                break;
+            }
+
+            ULONGLONG elapsed = GetTickCount64() - startTime;
+            if (elapsed >= stageTimeout) {
+                LOG(L"Shutdown of %s processes timed out, %d left", stageName,
+                    count);
+                allEnded = false;
+                break;
+            }
+
+            if (count != lastCount) {
+                VERBOSE(L"Shutdown of %s processes: %d left", stageName, count);
+                lastCount = count;
+            }
+
+            DWORD waitTime = static_cast<DWORD>(
+                std::min<ULONGLONG>(stageTimeout - elapsed, kScanInterval));
+            WaitForSingleObject(m_sessionEndedEvent.get(), waitTime);
+        }
+    }
+
+    return allEnded;
+}
+
+LONG SessionShutdown::Owner::CountRunningSessions(Stage stage) noexcept {
+    auto* data = static_cast<SharedData*>(m_view.get());
+    Slot* slots = data->slots[static_cast<size_t>(stage)];
+
+    LONG count = 0;
+    for (size_t i = 0; i < kSlotCount; i++) {
+        Slot& slot = slots[i];
+
+        LONG processId = InterlockedCompareExchange(&slot.processId, 0, 0);
+        if (!processId) {
+            continue;
+        }
+
+        ULONGLONG processCreationTime = InterlockedCompareExchange64(
+            reinterpret_cast<LONG64*>(&slot.processCreationTime), 0, 0);
+        if (!IsProcessRunning(processId, processCreationTime)) {
+            VERBOSE(L"Freeing the shutdown slot of exited process %d",
+                    processId);
+            InterlockedCompareExchange(&slot.processId, 0, processId);
+            continue;
+        }
+
+        count++;
+    }
+
+    return count;
+}
+
+SessionShutdown::Session::Session(DWORD sessionManagerProcessId) noexcept {
+    try {
+        m_mapping.reset(OpenFileMapping(
+            FILE_MAP_READ | FILE_MAP_WRITE, FALSE,
+            MakeObjectName(sessionManagerProcessId, L"ShutdownSessions")
+                .c_str()));
+        THROW_LAST_ERROR_IF(!m_mapping);
+
+        m_view.reset(MapViewOfFile(m_mapping.get(),
+                                   FILE_MAP_READ | FILE_MAP_WRITE, 0, 0,
+                                   sizeof(SharedData)));
+        THROW_LAST_ERROR_IF(!m_view);
+
+        auto* data = static_cast<SharedData*>(m_view.get());
+        if (data->version != kVersion) {
+            throw std::runtime_error("Unsupported shutdown table version");
+        }
+
+        m_sessionEndedEvent.reset(OpenEvent(
+            EVENT_MODIFY_STATE, FALSE,
+            MakeObjectName(sessionManagerProcessId, L"ShutdownSessionEnded")
+                .c_str()));
+        THROW_LAST_ERROR_IF(!m_sessionEndedEvent);
+
+        Slot* slots =
+            data->slots[static_cast<size_t>(GetCurrentProcessStage())];
+        LONG processId = static_cast<LONG>(GetCurrentProcessId());
+        for (size_t i = 0; i < kSlotCount; i++) {
+            if (InterlockedCompareExchange(&slots[i].processId, processId,
+                                           0) == 0) {
+                InterlockedExchange64(
+                    reinterpret_cast<LONG64*>(&slots[i].processCreationTime),
+                    GetProcessCreationTime(GetCurrentProcess()));
+                m_slotProcessId = &slots[i].processId;
+                break;
+            }
+        }
+
+        if (!m_slotProcessId) {
+            throw std::runtime_error("The shutdown table is full");
+        }
+    } catch (const std::exception& e) {
+        VERBOSE(L"Shutdown session registration failed: %S", e.what());
+        m_view.reset();
+        m_mapping.reset();
+        m_sessionEndedEvent.reset();
+    }
+}
+
+SessionShutdown::Session::~Session() {
+    if (!m_slotProcessId) {
+        return;
+    }
+
+    Slot* slot = CONTAINING_RECORD(m_slotProcessId, Slot, processId);
+    InterlockedExchange64(reinterpret_cast<LONG64*>(&slot->processCreationTime),
+                          0);
+    InterlockedExchange(m_slotProcessId, 0);
+
+    m_sessionEndedEvent.SetEvent();
+}
+
+SessionShutdown::Listener::Listener(DWORD sessionManagerProcessId) {
+    m_stageEvent.reset(OpenEvent(
+        SYNCHRONIZE, FALSE,
+        MakeStageEventName(sessionManagerProcessId, GetCurrentProcessStage())
+            .c_str()));
+    THROW_LAST_ERROR_IF_NULL(m_stageEvent);
+}
+
+// static
+SessionShutdown::Stage SessionShutdown::GetCurrentProcessStage() {
+    auto imagePath = wil::GetModuleFileName<std::wstring>();
+    if (PathPattern(ProcessLists::kShellProcesses).Matches(imagePath)) {
+        return Stage::kShell;
+    }
+
+    return Stage::kRegular;
+}
+
+// static
+std::wstring SessionShutdown::MakeObjectName(DWORD sessionManagerProcessId,
+                                             PCWSTR suffix) {
+    WCHAR szName[SessionPrivateNamespace::kPrivateNamespaceMaxLen +
+                 sizeof("\\ShutdownSessionEnded")];
+    int namePos =
+        SessionPrivateNamespace::MakeName(szName, sessionManagerProcessId);
+    swprintf_s(szName + namePos, ARRAYSIZE(szName) - namePos, L"\\%s",
+               suffix);
+    return szName;
+}
+
+// static
+std::wstring SessionShutdown::MakeStageEventName(DWORD sessionManagerProcessId,
+                                                 Stage stage) {
+    WCHAR suffix[sizeof("ShutdownStage0")];
+    swprintf_s(suffix, L"ShutdownStage%d", static_cast<int>(stage));
+    return MakeObjectName(sessionManagerProcessId, suffix);
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+// The coordinated end of all sessions when the app exits, run by the session
+// manager process. Without it, each engine notices the exit of the session
+// manager on its own, and keeps its mods loaded while waiting for a new
+// session manager to take over, see CustomizationSession::WaitForHandover.
+// With it, all sessions end right away, in parallel, in two stages: the
+// processes of the shell, whose customizations are the most visible, end
+// last, once the other processes are done, so that the desktop doesn't change
+// while the rest is still being unloaded.
+//
+// Each stage has a manual-reset event, which a session waits for in its main
+// loop, and a table in shared memory with a slot per running session, which
+// the session manager waits to become empty. Sessions of processes which were
+// terminated leave their slot behind, these are detected and freed by the
+// session manager.
+class SessionShutdown {
+   public:
+    SessionShutdown() = delete;
+
+    // In the order in which the stages end.
+    enum class Stage {
+        kRegular,
+        kShell,
+    };
+
+    static constexpr size_t kStageCount = 2;
+
+    // Used by the session manager, the state exists as long as the object
+    // exists. Must be created after the private namespace of the session
+    // manager.
+    class Owner {
+       public:
+        Owner();
+
+        Owner(const Owner&) = delete;
+        Owner& operator=(const Owner&) = delete;
+
+        // Signals the stages one after the other, each once the sessions of
+        // the previous one ended or after stageTimeout, and logs the progress.
+        // Returns true if all sessions ended in time.
+        bool Run(DWORD stageTimeout) noexcept;
+
+       private:
+        // Returns the amount of sessions of the stage which are still
+        // running, freeing the slots of processes which no longer exist.
+        LONG CountRunningSessions(Stage stage) noexcept;
+
+        wil::unique_handle m_mapping;
+        wil::unique_mapview_ptr<void> m_view;
+        wil::unique_event_nothrow m_stageEvents[kStageCount];
+        wil::unique_event_nothrow m_sessionEndedEvent;
+    };
+
+    // Held by the customization session, takes a slot in the table of the
+    // given session manager for as long as it exists. Must be destroyed after
+    // the mods are unloaded. Never throws, if the table isn't available or is
+    // full, the session isn't waited for.
+    class Session {
+       public:
+        explicit Session(DWORD sessionManagerProcessId) noexcept;
+        ~Session();
+
+        Session(const Session&) = delete;
+        Session& operator=(const Session&) = delete;
+
+       private:
+        wil::unique_handle m_mapping;
+        wil::unique_mapview_ptr<void> m_view;
+        wil::unique_event_nothrow m_sessionEndedEvent;
+        // The process ID field of the slot which was taken.
+        LONG* m_slotProcessId = nullptr;
+    };
+
+    // Observes the stage of the current process. Held by the main loop of the
+    // customization session.
+    class Listener {
+       public:
+        explicit Listener(DWORD sessionManagerProcessId);
+
+        Listener(const Listener&) = delete;
+        Listener& operator=(const Listener&) = delete;
+
+        // Signaled once the session should end.
+        HANDLE GetHandle() const noexcept { return m_stageEvent.get(); }
+
+       private:
+        wil::unique_event_nothrow m_stageEvent;
+    };
+
+   private:
+    static constexpr DWORD kVersion = 1;
+    static constexpr size_t kSlotCount = 2048;
+
+    // The layout must be the same for 32-bit and 64-bit processes.
+    struct Slot {
+        // Zero if the slot is free.
+        LONG processId;
+        DWORD reserved;
+        // Zero until set by the session right after taking the slot.
+        ULONGLONG processCreationTime;
+    };
+
+    struct SharedData {
+        DWORD version;
+        DWORD reserved;
+        Slot slots[kStageCount][kSlotCount];
+    };
+
+    static Stage GetCurrentProcessStage();
+    static std::wstring MakeObjectName(DWORD sessionManagerProcessId,
+                                       PCWSTR suffix);
+    static std::wstring MakeStageEventName(DWORD sessionManagerProcessId,
+                                           Stage stage);
+};
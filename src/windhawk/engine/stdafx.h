@@ -9,27 +9,37 @@
 #define NOMINMAX
 #include <windows.h>
 
+#include <aclapi.h>
 #include <dbghelp.h>
 #include <ntsecapi.h>
+#include <psapi.h>
 #include <sddl.h>
 #include <shlobj.h>
 #include <tlhelp32.h>
+#include <TraceLoggingProvider.h>
 #include <winhttp.h>
+#include <winmeta.h>
+#include <xamlom.h>
 
 // STL
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <condition_variable>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <exception>
 #include <filesystem>
 #include <functional>
+#include <list>
 #include <memory>
 #include <mutex>
 #include <new>
 #include <optional>
 #include <ranges>
+#include <span>
 #include <stdexcept>
 #include <string>
 #include <tuple>
@@ -64,14 +74,6 @@ using namespace std::string_view_literals;
 #include <wow64pp/wow64pp.hpp>
 #endif
 
-// Disasm engine
-
-#if defined(_M_IX86) || defined(_M_X64)
-#include <Zydis/Zydis.h>
-#elif defined(_M_ARM64)
-#include <binaryninja-arm64-disassembler/decompose_and_disassemble.h>
-#endif
-
 // Hooking engine
 
 #if 0
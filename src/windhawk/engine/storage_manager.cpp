@@ -95,14 +95,28 @@ std::filesystem::path PathFromStorage(
     return (baseFolderPath / expandedPath).lexically_normal();
 }
 
+std::mutex g_startupValuesMutex;
+std::optional<StorageManager::StartupValues> g_startupValues;
+
 }  // namespace
 
+// static
+void StorageManager::SetStartupValues(StartupValues values) {
+    std::lock_guard guard(g_startupValuesMutex);
+    g_startupValues = std::move(values);
+}
+
 // static
 StorageManager& StorageManager::GetInstance() {
     STATIC_INIT_ONCE(NoDestructorIfTerminating<StorageManager>, s);
     return **s;
 }
 
+const StorageManager::StartupValues*
+StorageManager::GetShareableStartupValues() const {
+    return shareableStartupValues ? &*shareableStartupValues : nullptr;
+}
+
 std::unique_ptr<PortableSettings> StorageManager::GetAppConfig(PCWSTR section) {
     if (portableStorage) {
         const auto& iniFileSettingsPath = std::get<IniFilePath>(settingsPath);
@@ -133,8 +147,7 @@ std::unique_ptr<PortableSettings> StorageManager::GetModConfig(PCWSTR modName,
             subKey += section;
         }
 
-        return std::make_unique<RegistrySettings>(registrySettingsPath.hKey,
-                                                  subKey.c_str(), false);
+        return GetCachedRegistrySettings(subKey, false);
     }
 }
 
@@ -164,8 +177,7 @@ std::unique_ptr<PortableSettings> StorageManager::GetModWritableConfig(
             subKey += section;
         }
 
-        return std::make_unique<RegistrySettings>(registrySettingsPath.hKey,
-                                                  subKey.c_str(), write);
+        return GetCachedRegistrySettings(subKey, write);
     }
 }
 
@@ -177,6 +189,13 @@ void StorageManager::EnumMods(std::function<void(PCWSTR)> enumCallback) {
     }
 }
 
+void StorageManager::ClearRegistryKeyCache() {
+    std::lock_guard guard(registryKeyCacheMutex);
+
+    registryKeyCache.clear();
+    registryWritableKeyCache.clear();
+}
+
 std::filesystem::path StorageManager::GetModStoragePath(PCWSTR modName) {
     auto modStoragePath =
         appDataPath / L"ModsWritable" / L"mod-storage" / modName;
@@ -189,41 +208,16 @@ std::filesystem::path StorageManager::GetModStoragePath(PCWSTR modName) {
     return modStoragePath;
 }
 
-std::filesystem::path StorageManager::GetModMetadataPath(
-    PCWSTR metadataCategory) {
-    return appDataPath / L"ModsWritable" / metadataCategory;
-}
-
-wil::unique_hfile StorageManager::CreateModMetadataFile(PCWSTR metadataCategory,
-                                                        PCWSTR modInstanceId) {
-    auto metadataCategoryPath = GetModMetadataPath(metadataCategory);
+std::filesystem::path StorageManager::GetModUrlCachePath(PCWSTR modName) {
+    auto modUrlCachePath =
+        appDataPath / L"ModsWritable" / L"url-cache" / modName;
 
-    if (!std::filesystem::is_directory(metadataCategoryPath)) {
+    if (!std::filesystem::is_directory(modUrlCachePath)) {
         std::error_code ec;
-        std::filesystem::create_directories(metadataCategoryPath, ec);
+        std::filesystem::create_directories(modUrlCachePath, ec);
     }
 
-    auto metadataFilePath = metadataCategoryPath / modInstanceId;
-
-    wil::unique_hfile file(CreateFile(
-        metadataFilePath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr,
-        CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE,
-        nullptr));
-    THROW_LAST_ERROR_IF(!file);
-
-    return file;
-}
-
-void StorageManager::SetModMetadataValue(wil::unique_hfile& file,
-                                         PCWSTR value) {
-    THROW_LAST_ERROR_IF(SetFilePointer(file.get(), 0, nullptr, FILE_BEGIN) ==
-                        INVALID_SET_FILE_POINTER);
-    THROW_IF_WIN32_BOOL_FALSE(SetEndOfFile(file.get()));
-
-    DWORD dwNumberOfBytesWritten;
-    THROW_IF_WIN32_BOOL_FALSE(WriteFile(
-        file.get(), value, wil::safe_cast<DWORD>(wcslen(value) * sizeof(WCHAR)),
-        &dwNumberOfBytesWritten, nullptr));
+    return modUrlCachePath;
 }
 
 std::filesystem::path StorageManager::GetEnginePath(USHORT machine) {
@@ -305,7 +299,29 @@ std::filesystem::path StorageManager::GetSymbolsPath() {
     return appDataPath / L"Symbols";
 }
 
+std::filesystem::path StorageManager::GetLogsPath() {
+    return appDataPath / L"Logs";
+}
+
+std::filesystem::path StorageManager::GetModMatchHintsPath() {
+    return appDataPath / L"ModMatchHints.dat";
+}
+
 StorageManager::StorageManager() {
+    std::optional<StartupValues> startupValues;
+    {
+        std::lock_guard guard(g_startupValuesMutex);
+        startupValues = std::exchange(g_startupValues, std::nullopt);
+    }
+
+    if (startupValues) {
+        // Passed by the session manager, which already created the app data
+        // folder.
+        Initialize(*startupValues);
+        shareableStartupValues = std::move(startupValues);
+        return;
+    }
+
     std::filesystem::path dllPath =
         wil::GetModuleFileName<std::wstring>(g_hDllInst);
 
@@ -318,49 +334,95 @@ StorageManager::StorageManager() {
 
     auto storage = IniFileSettings(iniFilePath.c_str(), L"Storage", false);
 
-    appDataPath = PathFromStorage(storage, L"AppDataPath", iniFileFolder);
+    StartupValues values{
+        .portable = storage.GetInt(L"Portable").value_or(0) != 0,
+        .appDataPath =
+            PathFromStorage(storage, L"AppDataPath", iniFileFolder).native(),
+    };
+
+    if (!values.portable) {
+        values.registryKey = storage.GetString(L"RegistryKey").value_or(L"");
+    }
+
+    Initialize(values);
 
     if (!std::filesystem::is_directory(appDataPath)) {
         std::error_code ec;
         std::filesystem::create_directories(appDataPath, ec);
     }
 
-    portableStorage = storage.GetInt(L"Portable").value_or(0);
+    if (!Functions::HasUserSpecificEnvironmentVariables(
+            storage.GetString(L"AppDataPath").value_or(L""))) {
+        shareableStartupValues = std::move(values);
+    }
+}
+
+StorageManager::~StorageManager() = default;
+
+void StorageManager::Initialize(const StartupValues& values) {
+    appDataPath = values.appDataPath;
+
+    portableStorage = values.portable;
     if (portableStorage) {
         settingsPath = IniFilePath{appDataPath / L"settings.ini"};
+        return;
+    }
+
+    const std::wstring& registryKey = values.registryKey;
+    if (registryKey.empty()) {
+        throw std::runtime_error("Missing RegistryKey value");
+    }
+
+    auto firstBackslash = registryKey.find(L'\\');
+    if (firstBackslash == registryKey.npos) {
+        throw std::runtime_error("Invalid RegistryKey value");
+    }
+
+    HKEY hkey;
+
+    std::wstring baseKey = registryKey.substr(0, firstBackslash);
+    if (baseKey == L"HKEY_CURRENT_USER" || baseKey == L"HKCU") {
+        hkey = HKEY_CURRENT_USER;
+    } else if (baseKey == L"HKEY_USERS" || baseKey == L"HKU") {
+        hkey = HKEY_USERS;
+    } else if (baseKey == L"HKEY_LOCAL_MACHINE" || baseKey == L"HKLM") {
+        hkey = HKEY_LOCAL_MACHINE;
     } else {
-        std::wstring registryKey =
-            storage.GetString(L"RegistryKey").value_or(L"");
-        if (registryKey.empty()) {
-            throw std::runtime_error("Missing RegistryKey value");
-        }
+        throw std::runtime_error("Unsupported RegistryKey value");
+    }
 
-        auto firstBackslash = registryKey.find(L'\\');
-        if (firstBackslash == registryKey.npos) {
-            throw std::runtime_error("Invalid RegistryKey value");
-        }
+    std::wstring subKey = registryKey.substr(firstBackslash + 1);
+
+    settingsPath = RegistryPath{hkey, std::move(subKey)};
+}
+
+std::unique_ptr<PortableSettings> StorageManager::GetCachedRegistrySettings(
+    const std::wstring& subKey,
+    bool write) {
+    auto& cache = write ? registryWritableKeyCache : registryKeyCache;
 
-        HKEY hkey;
-
-        std::wstring baseKey = registryKey.substr(0, firstBackslash);
-        if (baseKey == L"HKEY_CURRENT_USER" || baseKey == L"HKCU") {
-            hkey = HKEY_CURRENT_USER;
-        } else if (baseKey == L"HKEY_USERS" || baseKey == L"HKU") {
-            hkey = HKEY_USERS;
-        } else if (baseKey == L"HKEY_LOCAL_MACHINE" || baseKey == L"HKLM") {
-            hkey = HKEY_LOCAL_MACHINE;
-        } else {
-            throw std::runtime_error("Unsupported RegistryKey value");
+    {
+        std::lock_guard guard(registryKeyCacheMutex);
+
+        auto it = cache.find(subKey);
+        if (it != cache.end()) {
+            return std::make_unique<RegistrySettings>(it->second);
         }
+    }
+
+    const auto& registrySettingsPath = std::get<RegistryPath>(settingsPath);
+    wil::shared_hkey key(RegistrySettings::OpenKey(registrySettingsPath.hKey,
+                                                   subKey.c_str(), write));
 
-        std::wstring subKey = registryKey.substr(firstBackslash + 1);
+    {
+        std::lock_guard guard(registryKeyCacheMutex);
 
-        settingsPath = RegistryPath{hkey, std::move(subKey)};
+        // Another thread might have opened the same key in the meantime.
+        auto [it, inserted] = cache.try_emplace(subKey, std::move(key));
+        return std::make_unique<RegistrySettings>(it->second);
     }
 }
 
-StorageManager::~StorageManager() = default;
-
 void StorageManager::RegistryEnumMods(
     std::function<void(PCWSTR)> enumCallback) {
     const auto& registrySettingsPath = std::get<RegistryPath>(settingsPath);
@@ -489,6 +551,9 @@ HANDLE StorageManager::ModConfigChangeNotification::GetHandle() {
 void StorageManager::ModConfigChangeNotification::ContinueMonitoring() {
     auto& storageManager = GetInstance();
 
+    // The mod configs changed, and the cached keys might have been deleted.
+    storageManager.ClearRegistryKeyCache();
+
     if (storageManager.portableStorage) {
         THROW_IF_WIN32_BOOL_FALSE(FindNextChangeNotification(
             std::get<IniFileState>(monitoringState).handle.get()));
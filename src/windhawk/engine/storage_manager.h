@@ -10,8 +10,27 @@ class StorageManager {
     StorageManager& operator=(const StorageManager&) = delete;
     StorageManager& operator=(StorageManager&&) = delete;
 
+    // The values which are otherwise read from engine.ini on initialization.
+    struct StartupValues {
+        bool portable;
+        // Expanded, with an absolute path.
+        std::wstring appDataPath;
+        // Empty for portable storage.
+        std::wstring registryKey;
+    };
+
+    // Makes the instance use the given values instead of reading engine.ini,
+    // used with the values passed by the session manager on injection. Must
+    // be called before the first GetInstance call.
+    static void SetStartupValues(StartupValues values);
+
     static StorageManager& GetInstance();
 
+    // Returns the values to pass to an engine which is injected into another
+    // process, or nullptr if they might be different there, e.g. if the app
+    // data path depends on the user.
+    const StartupValues* GetShareableStartupValues() const;
+
     std::unique_ptr<PortableSettings> GetAppConfig(PCWSTR section);
     std::unique_ptr<PortableSettings> GetModConfig(PCWSTR modName,
                                                    PCWSTR section);
@@ -20,18 +39,22 @@ class StorageManager {
                                                            bool write);
     void EnumMods(std::function<void(PCWSTR)> enumCallback);
 
-    std::filesystem::path GetModStoragePath(PCWSTR modName);
+    // Closes the cached registry keys of the mod configs. Should be called
+    // when the mod configs change, since a key of a removed mod stays
+    // deleted even if the mod is installed again.
+    void ClearRegistryKeyCache();
 
-    std::filesystem::path GetModMetadataPath(PCWSTR metadataCategory);
-    wil::unique_hfile CreateModMetadataFile(PCWSTR metadataCategory,
-                                            PCWSTR modInstanceId);
-    void SetModMetadataValue(wil::unique_hfile& file, PCWSTR value);
+    std::filesystem::path GetModStoragePath(PCWSTR modName);
+    // Kept apart from the mod storage folder, which belongs to the mod.
+    std::filesystem::path GetModUrlCachePath(PCWSTR modName);
 
     std::filesystem::path GetEnginePath(
         USHORT machine = IMAGE_FILE_MACHINE_UNKNOWN);
     std::filesystem::path GetModsPath(
         USHORT machine = IMAGE_FILE_MACHINE_UNKNOWN);
     std::filesystem::path GetSymbolsPath();
+    std::filesystem::path GetLogsPath();
+    std::filesystem::path GetModMatchHintsPath();
 
     class ModConfigChangeNotification {
        public:
@@ -62,7 +85,11 @@ class StorageManager {
     StorageManager();
     ~StorageManager();
 
+    void Initialize(const StartupValues& values);
     void RegistryEnumMods(std::function<void(PCWSTR)> enumCallback);
+    std::unique_ptr<PortableSettings> GetCachedRegistrySettings(
+        const std::wstring& subKey,
+        bool write);
     void IniFilesEnumMods(std::function<void(PCWSTR)> enumCallback);
 
     struct RegistryPath {
@@ -77,4 +104,10 @@ class StorageManager {
     bool portableStorage;
     std::filesystem::path appDataPath;
     std::variant<std::monostate, RegistryPath, IniFilePath> settingsPath;
+    std::optional<StartupValues> shareableStartupValues;
+
+    // Opened registry keys by subkey, one map for each access level.
+    std::mutex registryKeyCacheMutex;
+    std::unordered_map<std::wstring, wil::shared_hkey> registryKeyCache;
+    std::unordered_map<std::wstring, wil::shared_hkey> registryWritableKeyCache;
 };
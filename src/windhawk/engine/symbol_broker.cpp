@@ -0,0 +1,436 @@
+#include "stdafx.h"
+
+#include "logger.h"
+#include "symbol_broker.h"
+#include "symbol_prefetch.h"
+
+namespace {
+
+constexpr WCHAR kPipeName[] = L"\\\\.\\pipe\\WindhawkSymbolBroker";
+
+constexpr DWORD kProtocolVersion = 1;
+
+// How long the server waits for a client to send its request or to receive the
+// response.
+constexpr DWORD kServerIoTimeout = 5000;
+
+// How long the server waits before retrying after the pipe couldn't be created
+// or connected, e.g. if another process holds the name.
+constexpr DWORD kServerRetryDelay = 5000;
+
+// How often cancellation is checked while waiting for the server.
+constexpr DWORD kClientPollInterval = 1000;
+
+struct Request {
+    DWORD version;
+    WCHAR pdbKey[64];
+    WCHAR modulePath[MAX_PATH];
+};
+
+struct Response {
+    DWORD version;
+    BOOL indexAvailable;
+};
+
+// Waits for a pending overlapped operation to complete. The operation is
+// canceled if the stop event is signaled, if queryCancel returns true, or if
+// the timeout elapses. Returns whether the operation completed successfully.
+bool WaitForOverlappedIo(HANDLE file,
+                         OVERLAPPED* overlapped,
+                         DWORD* transferred,
+                         HANDLE stopEvent,
+                         const std::function<bool()>& queryCancel,
+                         DWORD timeout) {
+    ULONGLONG startTime = GetTickCount64();
+
+    while (true) {
+        HANDLE handles[] = {overlapped->hEvent, stopEvent};
+        DWORD handlesCount = stopEvent ? 2 : 1;
+        DWORD waitResult = WaitForMultipleObjects(
+            handlesCount, handles, FALSE,
+            queryCancel ? kClientPollInterval : timeout);
+        if (waitResult == WAIT_OBJECT_0) {
+            break;
+        }
+
+        if (waitResult == WAIT_TIMEOUT && queryCancel && !queryCancel() &&
+            (timeout == INFINITE || GetTickCount64() - startTime < timeout)) {
+            continue;
+        }
+
+        CancelIoEx(file, overlapped);
+        GetOverlappedResult(file, overlapped, transferred, TRUE);
+        return false;
+    }
+
+    return GetOverlappedResult(file, overlapped, transferred, FALSE);
+}
+
+bool PathStartsWithFolder(std::wstring_view path, std::wstring_view folder) {
+    return path.length() > folder.length() &&
+           path[folder.length()] == L'\\' &&
+           _wcsnicmp(path.data(), folder.data(), folder.length()) == 0;
+}
+
+// The files of Windows and of installed programs are owned by TrustedInstaller
+// or SYSTEM. The folders alone aren't enough, since some of the folders under
+// them are writable by regular users, e.g. the Windows temp folder.
+bool IsOwnedByTrustedInstallerOrSystem(HANDLE file) {
+    PSID owner;
+    PSECURITY_DESCRIPTOR secDescRaw;
+    if (GetSecurityInfo(file, SE_FILE_OBJECT, OWNER_SECURITY_INFORMATION,
+                        &owner, nullptr, nullptr, nullptr,
+                        &secDescRaw) != ERROR_SUCCESS) {
+        return false;
+    }
+
+    wil::unique_hlocal secDesc(secDescRaw);
+
+    if (IsWellKnownSid(owner, WinLocalSystemSid)) {
+        return true;
+    }
+
+    // NT SERVICE\TrustedInstaller.
+    PSID trustedInstallerSidRaw;
+    THROW_IF_WIN32_BOOL_FALSE(ConvertStringSidToSid(
+        L"S-1-5-80-956008885-3418522649-1831038044-1853292631-2271478464",
+        &trustedInstallerSidRaw));
+    wil::unique_hlocal trustedInstallerSid(trustedInstallerSidRaw);
+
+    return EqualSid(owner, trustedInstallerSid.get());
+}
+
+struct AllowedModule {
+    std::filesystem::path path;
+    // Kept open without write or delete sharing while the module is handled,
+    // so that it can't be replaced after it was checked.
+    wil::unique_hfile file;
+};
+
+// The server runs with high privileges, so it only handles modules in the
+// Windows and Program Files folders which are owned by TrustedInstaller or
+// SYSTEM, and are reached without following reparse points. Returns the path
+// to use in the server process, or std::nullopt if the module isn't allowed.
+std::optional<AllowedModule> GetAllowedModule(std::wstring_view modulePath) {
+    if (modulePath.find(L"..") != modulePath.npos ||
+        modulePath.find(L'/') != modulePath.npos) {
+        return std::nullopt;
+    }
+
+    auto windowsFolder = wil::GetWindowsDirectory<std::wstring>();
+    auto systemFolder = wil::GetSystemDirectory<std::wstring>();
+
+    std::optional<std::filesystem::path> allowedPath;
+
+    // For a 32-bit server on a 64-bit system, System32 is redirected, and the
+    // native one is available as Sysnative. Clients of other architectures are
+    // caught by the PDB key check.
+    BOOL isWow64;
+    if (PathStartsWithFolder(modulePath, systemFolder) &&
+        IsWow64Process(GetCurrentProcess(), &isWow64) && isWow64) {
+        allowedPath = std::filesystem::path(windowsFolder) / L"Sysnative" /
+                      modulePath.substr(systemFolder.length() + 1);
+    } else if (PathStartsWithFolder(modulePath, windowsFolder)) {
+        allowedPath = modulePath;
+    } else {
+        // ProgramW6432 is the native folder, also for a 32-bit process.
+        for (PCWSTR variableName :
+             {L"ProgramFiles", L"ProgramFiles(x86)", L"ProgramW6432"}) {
+            auto folder =
+                wil::TryGetEnvironmentVariableW<std::wstring>(variableName);
+            if (!folder.empty() && PathStartsWithFolder(modulePath, folder)) {
+                allowedPath = modulePath;
+                break;
+            }
+        }
+    }
+
+    if (!allowedPath) {
+        return std::nullopt;
+    }
+
+    // A reparse point as the file itself isn't followed.
+    wil::unique_hfile file(CreateFile(
+        allowedPath->c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_FLAG_OPEN_REPARSE_POINT, nullptr));
+    if (!file) {
+        VERBOSE(L"Couldn't open %s: %u", allowedPath->c_str(),
+                GetLastError());
+        return std::nullopt;
+    }
+
+    FILE_ATTRIBUTE_TAG_INFO attributeTagInfo;
+    if (!GetFileInformationByHandleEx(file.get(), FileAttributeTagInfo,
+                                      &attributeTagInfo,
+                                      sizeof(attributeTagInfo)) ||
+        (attributeTagInfo.FileAttributes &
+         (FILE_ATTRIBUTE_REPARSE_POINT | FILE_ATTRIBUTE_DIRECTORY))) {
+        return std::nullopt;
+    }
+
+    // A reparse point in one of the folders, e.g. a junction, is followed by
+    // CreateFile, but then the final path differs from the requested one.
+    // Sysnative isn't part of the final path, so the requested path is
+    // compared.
+    WCHAR finalPath[MAX_PATH + 4];
+    DWORD finalPathLength = GetFinalPathNameByHandle(
+        file.get(), finalPath, ARRAYSIZE(finalPath),
+        FILE_NAME_NORMALIZED | VOLUME_NAME_DOS);
+    if (finalPathLength == 0 || finalPathLength >= ARRAYSIZE(finalPath)) {
+        return std::nullopt;
+    }
+
+    std::wstring_view finalPathView(finalPath, finalPathLength);
+    if (finalPathView.starts_with(L"\\\\?\\")) {
+        finalPathView.remove_prefix(sizeof("\\\\?\\") - 1);
+    }
+
+    if (finalPathView.length() != modulePath.length() ||
+        _wcsnicmp(finalPathView.data(), modulePath.data(),
+                  modulePath.length()) != 0) {
+        VERBOSE(L"Module path resolves to %s", finalPath);
+        return std::nullopt;
+    }
+
+    if (!IsOwnedByTrustedInstallerOrSystem(file.get())) {
+        VERBOSE(L"Module isn't owned by TrustedInstaller or SYSTEM");
+        return std::nullopt;
+    }
+
+    return AllowedModule{
+        .path = std::move(*allowedPath),
+        .file = std::move(file),
+    };
+}
+
+void HandleClient(HANDLE pipe,
+                  HANDLE ioEvent,
+                  SymbolPrefetcher& symbolPrefetcher,
+                  HANDLE stopEvent) {
+    Request request;
+    DWORD transferred = 0;
+    OVERLAPPED overlapped{.hEvent = ioEvent};
+    if ((!ReadFile(pipe, &request, sizeof(request), nullptr, &overlapped) &&
+         GetLastError() != ERROR_IO_PENDING) ||
+        !WaitForOverlappedIo(pipe, &overlapped, &transferred, stopEvent,
+                             nullptr, kServerIoTimeout)) {
+        VERBOSE(L"Couldn't read symbol broker request: %u", GetLastError());
+        return;
+    }
+
+    if (transferred != sizeof(request) || request.version != kProtocolVersion) {
+        VERBOSE(L"Invalid symbol broker request");
+        return;
+    }
+
+    request.pdbKey[ARRAYSIZE(request.pdbKey) - 1] = L'\0';
+    request.modulePath[ARRAYSIZE(request.modulePath) - 1] = L'\0';
+
+    VERBOSE(L"Symbol broker request: %s (%s)", request.modulePath,
+            request.pdbKey);
+
+    Response response{
+        .version = kProtocolVersion,
+        .indexAvailable = FALSE,
+    };
+
+    std::optional<AllowedModule> allowedModule;
+    try {
+        allowedModule = GetAllowedModule(request.modulePath);
+    } catch (const std::exception& e) {
+        LOG(L"Checking module %s failed: %S", request.modulePath, e.what());
+    }
+
+    if (allowedModule) {
+        // The client supplies both the path and the PDB key, so the key check
+        // only makes sure that the client and the server agree on the module.
+        // The PDB itself is only taken from the symbol store.
+        try {
+            response.indexAvailable = symbolPrefetcher.IndexModule(
+                allowedModule->path, request.pdbKey, stopEvent);
+        } catch (const std::exception& e) {
+            LOG(L"Indexing symbols for %s failed: %S",
+                allowedModule->path.c_str(), e.what());
+        }
+    } else {
+        VERBOSE(L"Module isn't allowed: %s", request.modulePath);
+    }
+
+    overlapped = {.hEvent = ioEvent};
+    if ((!WriteFile(pipe, &response, sizeof(response), nullptr, &overlapped) &&
+         GetLastError() != ERROR_IO_PENDING) ||
+        !WaitForOverlappedIo(pipe, &overlapped, &transferred, stopEvent,
+                             nullptr, kServerIoTimeout)) {
+        VERBOSE(L"Couldn't write symbol broker response: %u", GetLastError());
+    }
+}
+
+}  // namespace
+
+namespace SymbolBroker {
+
+void RunServer(HANDLE stopEvent) {
+    // Allow SYSTEM full access, and allow everyone at medium integrity or
+    // higher to read and write, but not to create pipe instances:
+    // FILE_READ_DATA | FILE_WRITE_DATA | FILE_READ_ATTRIBUTES |
+    // FILE_WRITE_ATTRIBUTES | SYNCHRONIZE (0x00100183).
+    PCWSTR pszStringSecurityDescriptor =
+        L"D:(A;;GA;;;SY)(A;;0x00100183;;;WD)S:(ML;;NW;;;ME)";
+
+    wil::unique_hlocal secDesc;
+    THROW_IF_WIN32_BOOL_FALSE(
+        ConvertStringSecurityDescriptorToSecurityDescriptor(
+            pszStringSecurityDescriptor, SDDL_REVISION_1, &secDesc, nullptr));
+
+    SECURITY_ATTRIBUTES secAttr = {sizeof(SECURITY_ATTRIBUTES)};
+    secAttr.lpSecurityDescriptor = secDesc.get();
+    secAttr.bInheritHandle = FALSE;
+
+    wil::unique_event ioEvent(wil::EventOptions::ManualReset);
+    SymbolPrefetcher symbolPrefetcher;
+
+    // A single instance is used, so requests are handled one at a time, and
+    // other clients wait until the pipe is available. The instance is kept
+    // across clients, so that there's no gap in which another process could
+    // create an instance with the same name.
+    wil::unique_hfile pipe;
+
+    while (WaitForSingleObject(stopEvent, 0) != WAIT_OBJECT_0) {
+        if (!pipe) {
+            pipe.reset(CreateNamedPipe(
+                kPipeName,
+                PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED |
+                    FILE_FLAG_FIRST_PIPE_INSTANCE,
+                PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT |
+                    PIPE_REJECT_REMOTE_CLIENTS,
+                1, sizeof(Response), sizeof(Request), 0, &secAttr));
+            if (!pipe) {
+                LOG(L"Creating the symbol broker pipe failed: %u",
+                    GetLastError());
+                WaitForSingleObject(stopEvent, kServerRetryDelay);
+                continue;
+            }
+        }
+
+        OVERLAPPED overlapped{.hEvent = ioEvent.get()};
+        if (!ConnectNamedPipe(pipe.get(), &overlapped)) {
+            DWORD error = GetLastError();
+            DWORD transferred;
+            if (error == ERROR_IO_PENDING) {
+                if (!WaitForOverlappedIo(pipe.get(), &overlapped, &transferred,
+                                         stopEvent, nullptr, INFINITE)) {
+                    DisconnectNamedPipe(pipe.get());
+                    continue;
+                }
+            } else if (error == ERROR_NO_DATA) {
+                // The client already closed its end.
+                DisconnectNamedPipe(pipe.get());
+                continue;
+            } else if (error != ERROR_PIPE_CONNECTED) {
+                LOG(L"Connecting the symbol broker pipe failed: %u", error);
+                pipe.reset();
+                WaitForSingleObject(stopEvent, kServerRetryDelay);
+                continue;
+            }
+        }
+
+        try {
+            HandleClient(pipe.get(), ioEvent.get(), symbolPrefetcher,
+                         stopEvent);
+        } catch (const std::exception& e) {
+            LOG(L"Handling symbol broker client failed: %S", e.what());
+        }
+
+        if (!DisconnectNamedPipe(pipe.get())) {
+            LOG(L"Disconnecting the symbol broker pipe failed: %u",
+                GetLastError());
+            pipe.reset();
+        }
+    }
+}
+
+RequestResult RequestSymbolIndex(PCWSTR modulePath,
+                                 std::wstring_view pdbKey,
+                                 const std::function<bool()>& queryCancel) {
+    Request request{
+        .version = kProtocolVersion,
+    };
+
+    size_t modulePathLength = wcslen(modulePath);
+    if (pdbKey.length() >= ARRAYSIZE(request.pdbKey) ||
+        modulePathLength >= ARRAYSIZE(request.modulePath)) {
+        return RequestResult::kNotIndexed;
+    }
+
+    std::copy(pdbKey.begin(), pdbKey.end(), request.pdbKey);
+    std::copy(modulePath, modulePath + modulePathLength, request.modulePath);
+
+    wil::unique_hfile pipe;
+
+    while (true) {
+        // Only the access rights granted by the server.
+        pipe.reset(CreateFile(
+            kPipeName,
+            FILE_READ_DATA | FILE_WRITE_DATA | FILE_WRITE_ATTRIBUTES |
+                SYNCHRONIZE,
+            0, nullptr, OPEN_EXISTING,
+            FILE_FLAG_OVERLAPPED | SECURITY_SQOS_PRESENT |
+                SECURITY_IDENTIFICATION,
+            nullptr));
+        if (pipe) {
+            break;
+        }
+
+        DWORD error = GetLastError();
+        if (error != ERROR_PIPE_BUSY) {
+            VERBOSE(L"Symbol broker isn't available: %u", error);
+            return RequestResult::kUnavailable;
+        }
+
+        // The server is handling another request.
+        if (queryCancel && queryCancel()) {
+            return RequestResult::kNotIndexed;
+        }
+
+        WaitNamedPipe(kPipeName, kClientPollInterval);
+    }
+
+    DWORD mode = PIPE_READMODE_MESSAGE;
+    THROW_IF_WIN32_BOOL_FALSE(
+        SetNamedPipeHandleState(pipe.get(), &mode, nullptr, nullptr));
+
+    wil::unique_event ioEvent(wil::EventOptions::ManualReset);
+    DWORD transferred = 0;
+
+    OVERLAPPED overlapped{.hEvent = ioEvent.get()};
+    if ((!WriteFile(pipe.get(), &request, sizeof(request), nullptr,
+                    &overlapped) &&
+         GetLastError() != ERROR_IO_PENDING) ||
+        !WaitForOverlappedIo(pipe.get(), &overlapped, &transferred, nullptr,
+                             queryCancel, INFINITE)) {
+        VERBOSE(L"Couldn't write symbol broker request: %u", GetLastError());
+        return RequestResult::kNotIndexed;
+    }
+
+    // The response is sent once the symbols are indexed, which might include
+    // downloading them.
+    Response response;
+    overlapped = {.hEvent = ioEvent.get()};
+    if ((!ReadFile(pipe.get(), &response, sizeof(response), nullptr,
+                   &overlapped) &&
+         GetLastError() != ERROR_IO_PENDING) ||
+        !WaitForOverlappedIo(pipe.get(), &overlapped, &transferred, nullptr,
+                             queryCancel, INFINITE)) {
+        VERBOSE(L"Couldn't read symbol broker response: %u", GetLastError());
+        return RequestResult::kNotIndexed;
+    }
+
+    if (transferred != sizeof(response) ||
+        response.version != kProtocolVersion || !response.indexAvailable) {
+        return RequestResult::kNotIndexed;
+    }
+
+    return RequestResult::kIndexed;
+}
+
+}  // namespace SymbolBroker
@@ -0,0 +1,28 @@
+#pragma once
+
+// Builds symbol indexes on behalf of target processes. The server runs in the
+// background service, so that target processes don't have to load msdia and
+// the PDB, which can take hundreds of megabytes of memory. Requests are handled
+// one at a time, so concurrent requests for the same PDB result in a single
+// download, and the requests which follow it are answered from the index.
+namespace SymbolBroker {
+
+// Returns when the stop event is signaled.
+void RunServer(HANDLE stopEvent);
+
+enum class RequestResult {
+    kIndexed,
+    // The server handled the request but couldn't index the symbols, or the
+    // request failed or was canceled.
+    kNotIndexed,
+    // The server isn't running.
+    kUnavailable,
+};
+
+// Asks the server to index the symbols of the given module, which must match
+// the given PDB key.
+RequestResult RequestSymbolIndex(PCWSTR modulePath,
+                                 std::wstring_view pdbKey,
+                                 const std::function<bool()>& queryCancel);
+
+}  // namespace SymbolBroker
@@ -0,0 +1,123 @@
+#include "stdafx.h"
+
+#include "functions.h"
+#include "symbol_cache.h"
+#include "symbol_index.h"
+
+static_assert(sizeof(SymbolCacheData::Entry) == 16,
+              "The entry is stored in the cache, its size must not change");
+
+// static
+std::optional<SymbolCacheData> SymbolCacheData::Parse(
+    std::span<const BYTE> buffer) {
+    Header header;
+    if (buffer.size() < sizeof(header)) {
+        return std::nullopt;
+    }
+
+    memcpy(&header, buffer.data(), sizeof(header));
+    if (header.magic != kMagic || header.version != kVersion) {
+        return std::nullopt;
+    }
+
+    ULONGLONG expectedSize =
+        sizeof(header) +
+        static_cast<ULONGLONG>(header.moduleNameLength) * sizeof(WCHAR) +
+        static_cast<ULONGLONG>(header.entriesCount) * sizeof(Entry);
+    if (buffer.size() != expectedSize) {
+        return std::nullopt;
+    }
+
+    size_t moduleNameSize = header.moduleNameLength * sizeof(WCHAR);
+    size_t entriesSize = header.entriesCount * sizeof(Entry);
+
+    SymbolCacheData data;
+    data.timeStamp = header.timeStamp;
+    data.imageSize = header.imageSize;
+
+    const BYTE* p = buffer.data() + sizeof(header);
+
+    // The data isn't necessarily aligned, so it's copied rather than accessed
+    // in place.
+    data.moduleName.resize(header.moduleNameLength);
+    memcpy(data.moduleName.data(), p, moduleNameSize);
+    p += moduleNameSize;
+
+    data.entries.resize(header.entriesCount);
+    memcpy(data.entries.data(), p, entriesSize);
+
+    return data;
+}
+
+// static
+std::optional<SymbolCacheData> SymbolCacheData::ParseString(
+    std::wstring_view cacheStr) {
+    if (cacheStr.length() < 2 || cacheStr[0] != L'1' ||
+        (cacheStr[1] != L'#' && cacheStr[1] != L';')) {
+        return std::nullopt;
+    }
+
+    WCHAR separator = cacheStr[1];
+    auto cacheParts = Functions::SplitStringToViews(cacheStr, separator);
+    if (cacheParts.size() < 3) {
+        return std::nullopt;
+    }
+
+    SymbolCacheData data;
+    data.moduleName = Functions::ReplaceAll(cacheParts[1], L"%sep%",
+                                            std::wstring_view(&separator, 1));
+
+    std::wstring version(cacheParts[2]);
+    PWSTR versionEnd;
+    data.timeStamp = std::wcstoul(version.c_str(), &versionEnd, 10);
+    if (*versionEnd == L'-') {
+        data.imageSize = std::wcstoul(versionEnd + 1, nullptr, 10);
+    }
+
+    for (size_t i = 3; i + 1 < cacheParts.size(); i += 2) {
+        const auto& symbol = cacheParts[i];
+        const auto& address = cacheParts[i + 1];
+        if (address.length() == 0) {
+            data.entries.push_back({
+                .nameHash = SymbolIndex::HashName(symbol),
+                .flags = kEntryFlagNoAddress,
+            });
+            continue;
+        }
+
+        data.entries.push_back({
+            .nameHash = SymbolIndex::HashName(symbol),
+            .rva = static_cast<DWORD>(
+                std::wcstoull(std::wstring(address).c_str(), nullptr, 10)),
+        });
+    }
+
+    return data;
+}
+
+std::vector<BYTE> SymbolCacheData::Serialize() const {
+    Header header{
+        .magic = kMagic,
+        .version = kVersion,
+        .timeStamp = timeStamp,
+        .imageSize = imageSize,
+        .moduleNameLength = wil::safe_cast<DWORD>(moduleName.length()),
+        .entriesCount = wil::safe_cast<DWORD>(entries.size()),
+    };
+
+    size_t moduleNameSize = moduleName.length() * sizeof(WCHAR);
+    size_t entriesSize = entries.size() * sizeof(Entry);
+
+    std::vector<BYTE> buffer(sizeof(header) + moduleNameSize + entriesSize);
+    BYTE* p = buffer.data();
+
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+
+    memcpy(p, moduleName.data(), moduleNameSize);
+    p += moduleNameSize;
+
+    memcpy(p, entries.data(), entriesSize);
+
+    return buffer;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+// The symbols that a mod resolved in a module, as stored in the mod's symbol
+// cache. Names are stored as hashes (see SymbolIndex::HashName) in the order in
+// which they were resolved, so that loading the cache doesn't involve parsing
+// or comparing names, and the stored value stays small even for long C++
+// symbol names.
+struct SymbolCacheData {
+    // The entry of a symbol which wasn't found, used for optional symbols.
+    static constexpr DWORD kEntryFlagNoAddress = 0x01;
+
+    struct Entry {
+        ULONGLONG nameHash;
+        DWORD rva;
+        DWORD flags;
+    };
+
+    // Informational, for the module the cache was created for.
+    std::wstring moduleName;
+    DWORD timeStamp = 0;
+    DWORD imageSize = 0;
+
+    std::vector<Entry> entries;
+
+    static std::optional<SymbolCacheData> Parse(std::span<const BYTE> buffer);
+
+    // Parses the string format, used by the online cache:
+    // 1#module#timestamp-size#symbol#address#...
+    // For hybrid modules, ';' is used as a separator instead of '#'.
+    static std::optional<SymbolCacheData> ParseString(
+        std::wstring_view cacheStr);
+
+    std::vector<BYTE> Serialize() const;
+
+   private:
+    static constexpr DWORD kMagic = 0x43534857;  // "WHSC"
+
+    // Version 1 is the '#'-separated string format, which is still used by the
+    // online cache and by caches created by older versions.
+    static constexpr DWORD kVersion = 2;
+
+    struct Header {
+        DWORD magic;
+        DWORD version;
+        DWORD timeStamp;
+        DWORD imageSize;
+        DWORD moduleNameLength;
+        DWORD entriesCount;
+    };
+};
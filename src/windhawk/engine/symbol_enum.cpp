@@ -2,10 +2,16 @@
 
 #include "functions.h"
 #include "logger.h"
+#include "no_destructor.h"
+#include "pdb_downloader.h"
+#include "pdb_reader.h"
+#include "pdb_store.h"
 #include "storage_manager.h"
 #include "symbol_enum.h"
 #include "var_init_once.h"
 
+extern HINSTANCE g_hDllInst;
+
 void MySysFreeString(BSTR bstrString) {
     // Avoid having oleaut32.dll in the import table, since it might not be
     // available in all cases, e.g. sandboxed processes.
@@ -25,38 +31,42 @@ void MySysFreeString(BSTR bstrString) {
 
 namespace {
 
+constexpr WCHAR kDefaultSymbolServer[] =
+    L"https://msdl.microsoft.com/download/symbols";
+
 ThreadLocal<SymbolEnum::Callbacks*> g_symbolServerCallbacks;
 
-std::wstring GetSymbolsSearchPath(PCWSTR symbolServer) {
-    PCWSTR defaultSymbolServer = L"https://msdl.microsoft.com/download/symbols";
+// The symbol server of the engine settings, e.g. a mirror in the local
+// network, replaces the default server for the mods which don't specify their
+// own. An empty value means that only local symbols are used.
+std::wstring GetDefaultSymbolServer() {
+    auto settings = StorageManager::GetInstance().GetAppConfig(L"Settings");
+    return settings->GetString(L"SymbolServer").value_or(kDefaultSymbolServer);
+}
 
+std::wstring GetSymbolsSearchPath(PCWSTR symbolServer) {
     std::wstring symSearchPath = L"srv*";
     symSearchPath += StorageManager::GetInstance().GetSymbolsPath();
     symSearchPath += L'*';
-    symSearchPath += symbolServer ? symbolServer : defaultSymbolServer;
+    symSearchPath += symbolServer;
 
     return symSearchPath;
 }
 
-void LogSymbolServerEvent(PCSTR msg) {
-    // Trim leading and trailing whitespace and control characters (mainly \b
-    // which is used for console output).
-
+// Returns the message without leading and trailing whitespace and control
+// characters (mainly \b which is used for console output).
+std::string_view TrimSymbolServerEvent(PCSTR msg) {
     PCSTR p = msg;
     while (*p != '\0' && (isspace(*p) || iscntrl(*p))) {
         p++;
     }
 
-    if (*p == '\0') {
-        return;
-    }
-
     size_t len = strlen(p);
     while (len > 0 && (isspace(p[len - 1]) || iscntrl(p[len - 1]))) {
         len--;
     }
 
-    VERBOSE(L"%.*S", wil::safe_cast<int>(len), p);
+    return std::string_view(p, len);
 }
 
 int PercentFromSymbolServerEvent(PCSTR msg) {
@@ -123,7 +133,14 @@ BOOL CALLBACK SymbolServerCallback(UINT_PTR action,
 
         case SSRVACTION_EVENT: {
             IMAGEHLP_CBA_EVENT* evt = (IMAGEHLP_CBA_EVENT*)data;
-            LogSymbolServerEvent(evt->desc);
+            std::string_view msg = TrimSymbolServerEvent(evt->desc);
+            if (!msg.empty()) {
+                VERBOSE(L"%.*S", wil::safe_cast<int>(msg.length()),
+                        msg.data());
+                if (callbacks->notifyEvent) {
+                    callbacks->notifyEvent(msg);
+                }
+            }
             int percent = PercentFromSymbolServerEvent(evt->desc);
             if (percent >= 0 && callbacks->notifyProgress) {
                 callbacks->notifyProgress(percent);
@@ -248,6 +265,137 @@ HMODULE WINAPI MsdiaLoadLibraryExWHook(LPCWSTR lpLibFileName,
     }
 }
 
+// msdia is shared by all symbol enumerations in the process. It's kept loaded
+// while any enumeration uses it, and for a grace period afterwards, so that
+// mods which resolve symbols one after another don't load and patch it each
+// time. Once the grace period elapses without a new enumeration, msdia is
+// unloaded together with the symsrv copy which it loaded. While msdia is
+// loaded, a reference to the engine is held, since msdia calls into the
+// engine through the patched import, and the unload timer runs engine code.
+class MsdiaLibrary {
+   public:
+    static MsdiaLibrary& GetInstance() {
+        STATIC_INIT_ONCE(NoDestructorIfTerminating<MsdiaLibrary>, s);
+        return **s;
+    }
+
+    // Must be paired with a call to Release.
+    HMODULE Acquire() {
+        std::lock_guard<std::mutex> guard(m_mutex);
+
+        if (!m_msdiaModule) {
+            Load();
+        } else if (m_unloadTimer) {
+            SetThreadpoolTimer(m_unloadTimer, nullptr, 0, 0);
+        }
+
+        m_userCount++;
+        return m_msdiaModule;
+    }
+
+    void Release() noexcept {
+        std::lock_guard<std::mutex> guard(m_mutex);
+
+        if (--m_userCount > 0) {
+            return;
+        }
+
+        if (!m_unloadTimer) {
+            m_unloadTimer =
+                CreateThreadpoolTimer(UnloadTimerCallback, this, nullptr);
+            if (!m_unloadTimer) {
+                LOG(L"CreateThreadpoolTimer failed: %u", GetLastError());
+                return;
+            }
+        }
+
+        FILETIME dueTime = wil::filetime::from_int64(static_cast<UINT64>(
+            -static_cast<INT64>(kUnloadDelayMs) *
+            wil::filetime_duration::one_millisecond));
+        SetThreadpoolTimer(m_unloadTimer, &dueTime, 0, 0);
+    }
+
+   private:
+    static constexpr DWORD kUnloadDelayMs = 30000;
+
+    void Load() {
+        auto enginePath = StorageManager::GetInstance().GetEnginePath();
+        auto msdiaPath = enginePath / L"msdia140_windhawk.dll";
+
+        wil::unique_hmodule engineModule;
+        THROW_IF_WIN32_BOOL_FALSE(GetModuleHandleEx(
+            GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS,
+            reinterpret_cast<PCWSTR>(g_hDllInst), &engineModule));
+
+        wil::unique_hmodule msdiaModule(LoadLibraryEx(
+            msdiaPath.c_str(), nullptr, LOAD_WITH_ALTERED_SEARCH_PATH));
+        THROW_LAST_ERROR_IF_NULL(msdiaModule);
+
+        // msdia loads symsrv.dll by using the following call:
+        // LoadLibraryExW(L"SYMSRV.DLL");
+        // This is problematic for the following reasons:
+        // * If another file named symsrv.dll is already loaded,
+        //   it will be used instead.
+        // * If not, the library loading search path doesn't include our
+        //   folder by default.
+        // Especially due to the first point, we patch msdia in memory to use
+        // the full path to our copy of symsrv.dll.
+        // Also, to prevent from other msdia instances to load our version of
+        // symsrv, we name it differently.
+
+        void** msdiaLoadLibraryExWPtr = Functions::FindImportPtr(
+            msdiaModule.get(), "kernel32.dll", "LoadLibraryExW");
+
+        DWORD dwOldProtect;
+        THROW_IF_WIN32_BOOL_FALSE(VirtualProtect(
+            msdiaLoadLibraryExWPtr, sizeof(*msdiaLoadLibraryExWPtr),
+            PAGE_READWRITE, &dwOldProtect));
+        *msdiaLoadLibraryExWPtr = MsdiaLoadLibraryExWHook;
+        THROW_IF_WIN32_BOOL_FALSE(VirtualProtect(
+            msdiaLoadLibraryExWPtr, sizeof(*msdiaLoadLibraryExWPtr),
+            dwOldProtect, &dwOldProtect));
+
+        m_msdiaModule = msdiaModule.release();
+        engineModule.release();
+    }
+
+    static void CALLBACK UnloadTimerCallback(PTP_CALLBACK_INSTANCE instance,
+                                             PVOID context,
+                                             PTP_TIMER timer) {
+        auto* this_ = static_cast<MsdiaLibrary*>(context);
+
+        std::lock_guard<std::mutex> guard(this_->m_mutex);
+
+        // Acquired again after the timer was due.
+        if (this_->m_userCount > 0 || !this_->m_msdiaModule) {
+            return;
+        }
+
+        FreeLibrary(this_->m_msdiaModule);
+        this_->m_msdiaModule = nullptr;
+
+        // msdia doesn't necessarily free symsrv when it's unloaded. Only
+        // msdia loads our copy, so a remaining reference is the one it left.
+        if (HMODULE symsrvModule = GetModuleHandle(L"symsrv_windhawk.dll")) {
+            FreeLibrary(symsrvModule);
+        }
+
+        VERBOSE(L"Unloaded msdia after the symbols were resolved");
+
+        // A new timer is created if msdia is loaded again. The callback is
+        // allowed to close its own timer.
+        CloseThreadpoolTimer(this_->m_unloadTimer);
+        this_->m_unloadTimer = nullptr;
+
+        FreeLibraryWhenCallbackReturns(instance, g_hDllInst);
+    }
+
+    std::mutex m_mutex;
+    HMODULE m_msdiaModule = nullptr;
+    size_t m_userCount = 0;
+    PTP_TIMER m_unloadTimer = nullptr;
+};
+
 template <typename IMAGE_NT_HEADERS_T, typename IMAGE_LOAD_CONFIG_DIRECTORY_T>
 std::optional<std::span<const SymbolEnum::IMAGE_CHPE_RANGE_ENTRY>>
 GetChpeRanges(const IMAGE_DOS_HEADER* dosHeader,
@@ -294,6 +442,38 @@ GetChpeRanges(const IMAGE_DOS_HEADER* dosHeader,
     return std::span(codeMap, codeMapCount);
 }
 
+// `*` matches any sequence of characters, `?` matches any single character.
+// After a mismatch, only the last `*` needs to be retried, which keeps the
+// matching linear for typical patterns.
+bool WildcardMatch(std::wstring_view pattern, std::wstring_view str) {
+    size_t p = 0;
+    size_t s = 0;
+    size_t starP = pattern.npos;
+    size_t starS = 0;
+
+    while (s < str.length()) {
+        if (p < pattern.length() && pattern[p] == L'*') {
+            starP = p++;
+            starS = s;
+        } else if (p < pattern.length() &&
+                   (pattern[p] == L'?' || pattern[p] == str[s])) {
+            p++;
+            s++;
+        } else if (starP != pattern.npos) {
+            p = starP + 1;
+            s = ++starS;
+        } else {
+            return false;
+        }
+    }
+
+    while (p < pattern.length() && pattern[p] == L'*') {
+        p++;
+    }
+
+    return p == pattern.length();
+}
+
 }  // namespace
 
 SymbolEnum::SymbolEnum(HMODULE moduleBase,
@@ -314,10 +494,117 @@ SymbolEnum::SymbolEnum(PCWSTR modulePath,
                        HMODULE moduleBase,
                        PCWSTR symbolServer,
                        UndecorateMode undecorateMode,
-                       Callbacks callbacks)
+                       Callbacks callbacks,
+                       bool symbolStoreOnly)
     : m_moduleBase(moduleBase), m_undecorateMode(undecorateMode) {
     InitModuleInfo(moduleBase);
 
+    std::wstring defaultSymbolServer;
+    if (!symbolServer) {
+        defaultSymbolServer = GetDefaultSymbolServer();
+        symbolServer = defaultSymbolServer.c_str();
+    }
+
+    // The shared store is consulted first, and isn't written to.
+    bool copiedFromSharedStore = false;
+    try {
+        auto pdbPath = PdbStore::GetPdbPath(moduleBase);
+        copiedFromSharedStore =
+            pdbPath && PdbStore::CopyFromSharedStore(*pdbPath);
+    } catch (const std::exception& e) {
+        LOG(L"Copying symbols from the shared store failed: %S", e.what());
+    }
+
+    if (!copiedFromSharedStore && *symbolServer &&
+        PdbDownloader::ShouldSkipDownloads()) {
+        VERBOSE(L"Not downloading symbols on a metered connection");
+        symbolServer = L"";
+    }
+
+    // An empty symbol server means that only local symbols are used.
+    if (!copiedFromSharedStore && *symbolServer) {
+        // Download the PDB file into the local store, if needed, with resume
+        // support. On failure, symsrv is used to get it instead.
+        try {
+            PdbDownloader::Download(moduleBase, symbolServer,
+                                    {
+                                        .queryCancel = callbacks.queryCancel,
+                                        .notifyProgress =
+                                            callbacks.notifyProgress,
+                                    });
+        } catch (const std::exception& e) {
+            LOG(L"Downloading symbols failed: %S", e.what());
+        }
+    }
+
+    std::optional<std::filesystem::path> storePdbPath;
+    std::shared_ptr<const PdbStore::Content> storePdbContent;
+    try {
+        storePdbPath = PdbStore::GetPdbPath(moduleBase);
+        if (storePdbPath) {
+            if (PdbStore::IsCompressionEnabled()) {
+                PdbStore::Compress(*storePdbPath);
+            }
+
+            storePdbContent = PdbStore::OpenCompressed(*storePdbPath);
+        }
+    } catch (const std::exception& e) {
+        LOG(L"Using compressed symbols failed: %S", e.what());
+    }
+
+    bool storePdbMapped = false;
+    if (!storePdbContent && storePdbPath) {
+        try {
+            storePdbContent = PdbStore::OpenMapped(*storePdbPath);
+            storePdbMapped = !!storePdbContent;
+        } catch (const std::exception& e) {
+            LOG(L"Mapping symbols failed: %S", e.what());
+        }
+    }
+
+    if (callbacks.notifyEvent) {
+        callbacks.notifyEvent(!storePdbContent ? "PDB not in the local store"
+                              : storePdbMapped ? "PDB in the local store"
+                                               : "PDB in the local store, "
+                                                 "compressed");
+    }
+
+    if (storePdbContent) {
+        if (storePdbMapped) {
+            PdbStore::MarkUsed(*storePdbPath);
+        }
+
+        // Without undecorated names, public symbols can be read directly from
+        // the PDB. DIA is only loaded if other symbols turn out to be needed.
+        if (m_undecorateMode == UndecorateMode::None) {
+            try {
+                m_pdbReader.emplace(std::span(
+                    storePdbContent->data.get(),
+                    static_cast<size_t>(storePdbContent->size)));
+                m_pdbContent = std::move(storePdbContent);
+                return;
+            } catch (const std::exception& e) {
+                VERBOSE(L"Reading the PDB directly failed: %S", e.what());
+                m_pdbReader.reset();
+            }
+        }
+
+        wil::com_ptr<IDiaDataSource> diaSource = LoadMsdia();
+
+        // The store path matches the PDB identity of the module, so the PDB
+        // doesn't need to be validated against it.
+        THROW_IF_FAILED(diaSource->loadDataFromIStream(
+            PdbStore::CreateStream(std::move(storePdbContent)).get()));
+
+        OpenDiaSession(diaSource.get());
+        return;
+    }
+
+    // symsrv and loadDataForExe would also look at the embedded path.
+    if (symbolStoreOnly) {
+        throw std::runtime_error("The PDB isn't in the symbol store");
+    }
+
     wil::com_ptr<IDiaDataSource> diaSource = LoadMsdia();
 
     std::wstring symSearchPath = GetSymbolsSearchPath(symbolServer);
@@ -327,38 +614,111 @@ SymbolEnum::SymbolEnum(PCWSTR modulePath,
         wil::scope_exit([] { g_symbolServerCallbacks = nullptr; });
 
     DiaLoadCallback diaLoadCallback;
-    THROW_IF_FAILED(diaSource->loadDataForExe(modulePath, symSearchPath.c_str(),
-                                              &diaLoadCallback));
+    THROW_IF_FAILED(diaSource->loadDataForExe(
+        modulePath, symSearchPath.c_str(), &diaLoadCallback));
 
-    wil::com_ptr<IDiaSession> diaSession;
-    THROW_IF_FAILED(diaSource->openSession(&diaSession));
+    if (storePdbPath) {
+        PdbStore::MarkUsed(*storePdbPath);
+    }
 
-    THROW_IF_FAILED(diaSession->get_globalScope(&m_diaGlobal));
+    OpenDiaSession(diaSource.get());
+}
+
+void SymbolEnum::SetNameIdentifiers(std::vector<std::wstring> identifiers) {
+    m_nameIdentifiers = std::move(identifiers);
+    m_nameIdentifierIndex = 0;
+
+    // DIA filters the symbols by name.
+    if (m_pdbReader) {
+        SwitchToDia();
+        return;
+    }
+
+    FindSymbolsForCurrentTag();
+}
 
-    THROW_IF_FAILED(
-        m_diaGlobal->findChildren(kSymTags[0], nullptr, nsNone, &m_diaSymbols));
+void SymbolEnum::SetNameFilter(NameFilterType type, std::wstring filter) {
+    m_nameFilterType = type;
+    m_nameFilter = std::move(filter);
+}
+
+void SymbolEnum::SetPublicSymbolsOnly() {
+    m_symTagsCount = 1;
+}
+
+bool SymbolEnum::IsHybridModule() const {
+    return m_moduleInfo.isHybrid;
 }
 
 std::optional<SymbolEnum::Symbol> SymbolEnum::GetNextSymbol() {
+    while (auto symbol = GetNextSymbolUnfiltered()) {
+        if (!m_nameFilter || MatchesNameFilter(*symbol)) {
+            return symbol;
+        }
+    }
+
+    return std::nullopt;
+}
+
+std::optional<SymbolEnum::Symbol> SymbolEnum::GetNextSymbolUnfiltered() {
+    if (m_pdbReader) {
+        if (m_symTagsCount == 1) {
+            return GetNextPublicSymbolFromPdb();
+        }
+
+        SwitchToDia();
+    }
+
     while (true) {
-        wil::com_ptr<IDiaSymbol> diaSymbol;
-        ULONG count = 0;
-        HRESULT hr = m_diaSymbols->Next(1, &diaSymbol, &count);
-        THROW_IF_FAILED(hr);
+        if (m_symbolBatchIndex == m_symbolBatchCount) {
+            if (m_symTagIndex >= m_symTagsCount) {
+                return std::nullopt;
+            }
 
-        if (hr == S_FALSE || count == 0) {
-            m_symTagIndex++;
-            if (m_symTagIndex < ARRAYSIZE(kSymTags)) {
-                THROW_IF_FAILED(m_diaGlobal->findChildren(
-                    kSymTags[m_symTagIndex], nullptr, nsNone, &m_diaSymbols));
-                continue;
+            IDiaSymbol* symbolBatch[kSymbolBatchSize];
+            ULONG count = 0;
+            HRESULT hr =
+                m_diaSymbols->Next(kSymbolBatchSize, symbolBatch, &count);
+            THROW_IF_FAILED(hr);
+
+            // S_FALSE means that fewer symbols than requested were retrieved,
+            // the enumeration is done only when no symbols are left.
+            count = std::min(count, kSymbolBatchSize);
+            for (ULONG i = 0; i < count; i++) {
+                m_symbolBatch[i].attach(symbolBatch[i]);
             }
 
-            return std::nullopt;
+            m_symbolBatchIndex = 0;
+            m_symbolBatchCount = count;
+
+            if (count == 0) {
+                // With name identifiers, each tag is queried once for each
+                // identifier.
+                if (!m_nameIdentifiers.empty()) {
+                    m_nameIdentifierIndex++;
+                    if (m_nameIdentifierIndex < m_nameIdentifiers.size()) {
+                        FindSymbolsForCurrentTag();
+                        continue;
+                    }
+
+                    m_nameIdentifierIndex = 0;
+                }
+
+                m_symTagIndex++;
+                if (m_symTagIndex < m_symTagsCount) {
+                    FindSymbolsForCurrentTag();
+                    continue;
+                }
+
+                return std::nullopt;
+            }
         }
 
+        wil::com_ptr<IDiaSymbol> diaSymbol =
+            std::move(m_symbolBatch[m_symbolBatchIndex++]);
+
         DWORD currentSymbolRva;
-        hr = diaSymbol->get_relativeVirtualAddress(&currentSymbolRva);
+        HRESULT hr = diaSymbol->get_relativeVirtualAddress(&currentSymbolRva);
         THROW_IF_FAILED(hr);
         if (hr == S_FALSE) {
             continue;  // no RVA
@@ -370,6 +730,12 @@ std::optional<SymbolEnum::Symbol> SymbolEnum::GetNextSymbol() {
             m_currentSymbolName.reset();  // no name
         }
 
+        // A symbol which matches several identifiers was already returned by
+        // the query for the first of them.
+        if (MatchesEarlierNameIdentifier(m_currentSymbolName.get())) {
+            continue;
+        }
+
         PCWSTR currentSymbolNameUndecoratedPrefix1 = L"";
         PCWSTR currentSymbolNameUndecoratedPrefix2 = L"";
 
@@ -396,52 +762,44 @@ std::optional<SymbolEnum::Symbol> SymbolEnum::GetNextSymbol() {
             m_currentSymbolNameUndecorated.reset();  // no name
         } else if (m_currentSymbolNameUndecorated) {
             // For hybrid binaries, add an arch=x\ prefix.
+            const ChpeRange* range = nullptr;
             if (m_moduleInfo.isHybrid) {
+                range = FindChpeRange(currentSymbolRva);
+            }
+
+            if (range) {
                 bool is32Bit =
                     m_moduleInfo.magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC;
-                for (const auto& range : m_moduleInfo.chpeRanges) {
-                    ULONG start = is32Bit ? (range.StartOffset & ~1)
-                                          : (range.StartOffset & ~3);
-                    if (currentSymbolRva < start ||
-                        currentSymbolRva >= start + range.Length) {
-                        continue;
-                    }
-
-                    if (is32Bit) {
-                        constexpr PCWSTR prefixes[] = {
+                if (is32Bit) {
+                    constexpr PCWSTR prefixes[] = {
 #if defined(_M_IX86)
-                            L"",
+                        L"",
 #else
-                            L"arch=x86\\",
+                        L"arch=x86\\",
 #endif
 #if defined(_M_ARM64)
-                            L"",
+                        L"",
 #else
-                            L"arch=ARM64\\",
+                        L"arch=ARM64\\",
 #endif
-                        };
-                        currentSymbolNameUndecoratedPrefix1 =
-                            prefixes[range.StartOffset & 1];
-                    } else {
-                        constexpr PCWSTR prefixes[] = {
+                    };
+                    currentSymbolNameUndecoratedPrefix1 = prefixes[range->arch];
+                } else {
+                    constexpr PCWSTR prefixes[] = {
 #if defined(_M_ARM64)
-                            L"",
+                        L"",
 #else
-                            L"arch=ARM64\\",
+                        L"arch=ARM64\\",
 #endif
-                            L"arch=ARM64EC\\",
+                        L"arch=ARM64EC\\",
 #if defined(_M_X64)
-                            L"",
+                        L"",
 #else
-                            L"arch=x64\\",
+                        L"arch=x64\\",
 #endif
-                            L"arch=3\\",
-                        };
-                        currentSymbolNameUndecoratedPrefix1 =
-                            prefixes[range.StartOffset & 3];
-                    }
-
-                    break;
+                        L"arch=3\\",
+                    };
+                    currentSymbolNameUndecoratedPrefix1 = prefixes[range->arch];
                 }
             }
 
@@ -502,6 +860,23 @@ std::optional<SymbolEnum::Symbol> SymbolEnum::GetNextSymbol() {
     }
 }
 
+bool SymbolEnum::IsEnumerationComplete() const {
+    // An enumeration filtered by name identifiers, by a name filter or by
+    // tags doesn't include all symbols.
+    return m_nameIdentifiers.empty() && !m_nameFilter &&
+           m_symTagsCount == ARRAYSIZE(kSymTags) &&
+           m_symTagIndex >= m_symTagsCount;
+}
+
+void SymbolEnum::EnumRemainingSymbols(
+    const std::function<bool(const Symbol& symbol)>& callback) {
+    while (auto symbol = GetNextSymbol()) {
+        if (!callback(*symbol)) {
+            break;
+        }
+    }
+}
+
 void SymbolEnum::InitModuleInfo(HMODULE module) {
     auto* dosHeader = (const IMAGE_DOS_HEADER*)module;
     auto* ntHeader =
@@ -527,49 +902,189 @@ void SymbolEnum::InitModuleInfo(HMODULE module) {
 
     if (chpeRanges) {
         m_moduleInfo.isHybrid = true;
-        m_moduleInfo.chpeRanges.assign(chpeRanges->begin(), chpeRanges->end());
+
+        // The low bits of the start offset are the architecture of the range.
+        ULONG archMask = magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC ? 1 : 3;
+
+        m_moduleInfo.chpeRanges.clear();
+        m_moduleInfo.chpeRanges.reserve(chpeRanges->size());
+        for (const auto& entry : *chpeRanges) {
+            ULONG start = entry.StartOffset & ~archMask;
+            m_moduleInfo.chpeRanges.push_back({
+                .start = start,
+                .end = start + entry.Length,
+                .arch = entry.StartOffset & archMask,
+            });
+        }
+
+        // Sort once, so that lookups for each symbol are a binary search
+        // instead of a scan of the whole table.
+        std::sort(m_moduleInfo.chpeRanges.begin(),
+                  m_moduleInfo.chpeRanges.end(),
+                  [](const ChpeRange& a, const ChpeRange& b) {
+                      return a.start < b.start;
+                  });
     } else {
         m_moduleInfo.isHybrid = false;
     }
 }
 
+void SymbolEnum::OpenDiaSession(IDiaDataSource* diaSource) {
+    wil::com_ptr<IDiaSession> diaSession;
+    THROW_IF_FAILED(diaSource->openSession(&diaSession));
+
+    THROW_IF_FAILED(diaSession->get_globalScope(&m_diaGlobal));
+
+    FindSymbolsForCurrentTag();
+}
+
+void SymbolEnum::SwitchToDia() {
+    if (!m_pdbReader) {
+        return;
+    }
+
+    VERBOSE(L"Loading DIA, not only public symbols are needed");
+
+    m_pdbReader.reset();
+
+    wil::com_ptr<IDiaDataSource> diaSource = LoadMsdia();
+    THROW_IF_FAILED(diaSource->loadDataFromIStream(
+        PdbStore::CreateStream(std::move(m_pdbContent)).get()));
+
+    OpenDiaSession(diaSource.get());
+}
+
+std::optional<SymbolEnum::Symbol> SymbolEnum::GetNextPublicSymbolFromPdb() {
+    auto symbol = m_pdbReader->GetNextPublicSymbol();
+    if (!symbol) {
+        return std::nullopt;
+    }
+
+    int nameLength = wil::safe_cast<int>(symbol->name.size());
+    m_currentPublicSymbolName.resize(nameLength);
+    if (nameLength > 0) {
+        nameLength = MultiByteToWideChar(
+            CP_UTF8, 0, symbol->name.data(), nameLength,
+            m_currentPublicSymbolName.data(), nameLength);
+        THROW_LAST_ERROR_IF(nameLength == 0);
+        m_currentPublicSymbolName.resize(nameLength);
+    }
+
+    return SymbolEnum::Symbol{
+        reinterpret_cast<void*>(reinterpret_cast<BYTE*>(m_moduleBase) +
+                                symbol->rva),
+        m_currentPublicSymbolName.c_str(), nullptr};
+}
+
+void SymbolEnum::FindSymbolsForCurrentTag() {
+    m_diaSymbols.reset();
+    m_symbolBatchIndex = 0;
+    m_symbolBatchCount = 0;
+
+    if (m_nameIdentifiers.empty()) {
+        THROW_IF_FAILED(m_diaGlobal->findChildren(
+            kSymTags[m_symTagIndex], nullptr, nsNone, &m_diaSymbols));
+        return;
+    }
+
+    // The identifiers contain no wildcard characters, so a "*identifier*"
+    // mask finds all symbols which contain the identifier. For public
+    // symbols, this is matched against the decorated name, and for other
+    // symbols, against the qualified name, both of which contain the
+    // identifier verbatim.
+    std::wstring mask = L"*";
+    mask += m_nameIdentifiers[m_nameIdentifierIndex];
+    mask += L'*';
+
+    THROW_IF_FAILED(m_diaGlobal->findChildren(kSymTags[m_symTagIndex],
+                                              mask.c_str(), nsRegularExpression,
+                                              &m_diaSymbols));
+}
+
+bool SymbolEnum::MatchesEarlierNameIdentifier(PCWSTR name) const {
+    if (!name) {
+        return false;
+    }
+
+    for (size_t i = 0; i < m_nameIdentifierIndex; i++) {
+        if (wcsstr(name, m_nameIdentifiers[i].c_str())) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool SymbolEnum::MatchesNameFilter(const Symbol& symbol) const {
+    PCWSTR name = m_undecorateMode == UndecorateMode::None
+                      ? symbol.name
+                      : symbol.nameUndecorated;
+    if (!name) {
+        return false;
+    }
+
+    std::wstring_view nameView(name);
+    const std::wstring& filter = *m_nameFilter;
+
+    switch (m_nameFilterType) {
+        case NameFilterType::kPrefix:
+            return nameView.starts_with(filter);
+
+        case NameFilterType::kSubstring:
+            return nameView.find(filter) != nameView.npos;
+
+        case NameFilterType::kWildcard:
+            return WildcardMatch(filter, nameView);
+    }
+
+    return false;
+}
+
+const SymbolEnum::ChpeRange* SymbolEnum::FindChpeRange(DWORD rva) {
+    const auto& ranges = m_moduleInfo.chpeRanges;
+
+    // Symbols are mostly enumerated in address order, so consecutive symbols
+    // usually fall in the same range.
+    if (m_lastChpeRangeIndex < ranges.size()) {
+        const auto& range = ranges[m_lastChpeRangeIndex];
+        if (rva >= range.start && rva < range.end) {
+            return &range;
+        }
+    }
+
+    auto it = std::upper_bound(ranges.begin(), ranges.end(), rva,
+                               [](DWORD value, const ChpeRange& range) {
+                                   return value < range.start;
+                               });
+    if (it == ranges.begin()) {
+        return nullptr;
+    }
+
+    --it;
+    if (rva >= it->end) {
+        return nullptr;
+    }
+
+    m_lastChpeRangeIndex = it - ranges.begin();
+    return &*it;
+}
+
+void ReleaseMsdiaModule(HMODULE module) {
+    MsdiaLibrary::GetInstance().Release();
+}
+
 wil::com_ptr<IDiaDataSource> SymbolEnum::LoadMsdia() {
     auto enginePath = StorageManager::GetInstance().GetEnginePath();
     auto msdiaPath = enginePath / L"msdia140_windhawk.dll";
 
-    m_msdiaModule.reset(LoadLibraryEx(msdiaPath.c_str(), nullptr,
-                                      LOAD_WITH_ALTERED_SEARCH_PATH));
-    THROW_LAST_ERROR_IF_NULL(m_msdiaModule);
-
-    // msdia loads symsrv.dll by using the following call:
-    // LoadLibraryExW(L"SYMSRV.DLL");
-    // This is problematic for the following reasons:
-    // * If another file named symsrv.dll is already loaded,
-    //   it will be used instead.
-    // * If not, the library loading search path doesn't include our folder
-    //   by default.
-    // Especially due to the first point, we patch msdia in memory to use
-    // the full path to our copy of symsrv.dll.
-    // Also, to prevent from other msdia instances to load our version of
-    // symsrv, we name it differently.
-
-    void** msdiaLoadLibraryExWPtr = Functions::FindImportPtr(
-        m_msdiaModule.get(), "kernel32.dll", "LoadLibraryExW");
-
-    DWORD dwOldProtect;
-    THROW_IF_WIN32_BOOL_FALSE(VirtualProtect(msdiaLoadLibraryExWPtr,
-                                             sizeof(*msdiaLoadLibraryExWPtr),
-                                             PAGE_READWRITE, &dwOldProtect));
-    *msdiaLoadLibraryExWPtr = MsdiaLoadLibraryExWHook;
-    THROW_IF_WIN32_BOOL_FALSE(VirtualProtect(msdiaLoadLibraryExWPtr,
-                                             sizeof(*msdiaLoadLibraryExWPtr),
-                                             dwOldProtect, &dwOldProtect));
+    m_msdiaModule.reset(MsdiaLibrary::GetInstance().Acquire());
 
     wil::com_ptr<IDiaDataSource> diaSource;
     THROW_IF_FAILED(NoRegCoCreate(msdiaPath.c_str(), CLSID_DiaSource,
                                   IID_PPV_ARGS(&diaSource)));
 
-    // Decrements the reference count incremented by NoRegCoCreate.
+    // Decrements the reference count incremented by NoRegCoCreate, the
+    // module is kept loaded by MsdiaLibrary.
     FreeLibrary(m_msdiaModule.get());
 
     return diaSource;
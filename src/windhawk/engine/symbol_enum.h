@@ -1,10 +1,20 @@
 #pragma once
 
+#include "pdb_reader.h"
+#include "pdb_store.h"
+
 void MySysFreeString(BSTR bstrString);
 
 using my_unique_bstr =
     wil::unique_any<BSTR, decltype(&MySysFreeString), MySysFreeString>;
 
+// Releases a reference to the msdia module, which is shared by all symbol
+// enumerations, and is unloaded a while after the last one is done.
+void ReleaseMsdiaModule(HMODULE module);
+
+using unique_msdia_module =
+    wil::unique_any<HMODULE, decltype(&ReleaseMsdiaModule), ReleaseMsdiaModule>;
+
 class SymbolEnum {
    public:
     enum class UndecorateMode {
@@ -16,17 +26,27 @@ class SymbolEnum {
     struct Callbacks {
         std::function<bool()> queryCancel;
         std::function<void(int)> notifyProgress;
+        // Called with messages about where the symbols are loaded from,
+        // including each message of the symbol server, such as the paths
+        // which it tries.
+        std::function<void(std::string_view)> notifyEvent;
     };
 
     SymbolEnum(HMODULE moduleBase,
                PCWSTR symbolServer,
                UndecorateMode undecorateMode,
                Callbacks callbacks = {});
+    // If symbolStoreOnly is set, the PDB is only taken from the symbol store,
+    // after downloading it from the symbol server if needed, and never from the
+    // path which is embedded in the module. Used for modules which aren't
+    // trusted, e.g. by the service on behalf of other processes, since the
+    // embedded path might point to a network share or to a crafted file.
     SymbolEnum(PCWSTR modulePath,
                HMODULE moduleBase,
                PCWSTR symbolServer,
                UndecorateMode undecorateMode,
-               Callbacks callbacks = {});
+               Callbacks callbacks = {},
+               bool symbolStoreOnly = false);
 
     struct Symbol {
         void* address;
@@ -34,7 +54,40 @@ class SymbolEnum {
         PCWSTR nameUndecorated;
     };
 
+    enum class NameFilterType {
+        kPrefix,
+        kSubstring,
+        kWildcard,
+    };
+
+    // If set, only symbols whose name contains one of the given identifiers
+    // are enumerated, which lets DIA skip most symbols of a large module. Must
+    // be called before enumerating symbols. The identifiers must consist of
+    // alphanumeric characters and underscores only.
+    void SetNameIdentifiers(std::vector<std::wstring> identifiers);
+
+    // If set, only symbols whose name matches the filter are returned. The
+    // undecorated name is matched, or the decorated name if undecorating is
+    // disabled. Applied on top of the other filters, and can be combined with
+    // SetNameIdentifiers to let DIA skip most of the non-matching symbols.
+    void SetNameFilter(NameFilterType type, std::wstring filter);
+
+    // If set, only public symbols are enumerated. These are the only symbols
+    // with decorated names, and for modules with private symbols, skipping
+    // the other tags avoids enumerating each function twice. Must be called
+    // before enumerating symbols.
+    void SetPublicSymbolsOnly();
+
+    // Whether the module is CHPE, ARM64EC or ARM64X.
+    bool IsHybridModule() const;
+
     std::optional<Symbol> GetNextSymbol();
+    bool IsEnumerationComplete() const;
+
+    // Calls the callback for each of the remaining symbols, until it returns
+    // false or there are no more symbols.
+    void EnumRemainingSymbols(
+        const std::function<bool(const Symbol& symbol)>& callback);
 
     // https://ntdoc.m417z.com/image_chpe_range_entry
     typedef struct _IMAGE_CHPE_RANGE_ENTRY {
@@ -52,26 +105,64 @@ class SymbolEnum {
    private:
     void InitModuleInfo(HMODULE module);
     wil::com_ptr<IDiaDataSource> LoadMsdia();
+    void OpenDiaSession(IDiaDataSource* diaSource);
+    // Replaces the direct PDB reader with DIA, if it's used.
+    void SwitchToDia();
+    std::optional<Symbol> GetNextSymbolUnfiltered();
+    std::optional<Symbol> GetNextPublicSymbolFromPdb();
+    void FindSymbolsForCurrentTag();
+    bool MatchesEarlierNameIdentifier(PCWSTR name) const;
+    bool MatchesNameFilter(const Symbol& symbol) const;
+
+    // Symbols are retrieved from DIA in batches to reduce the per-symbol COM
+    // call overhead.
+    static constexpr ULONG kSymbolBatchSize = 256;
 
     static constexpr enum SymTagEnum kSymTags[] = {
         SymTagPublicSymbol,
         SymTagFunction,
         SymTagData,
     };
+    static_assert(kSymTags[0] == SymTagPublicSymbol,
+                  "Public symbols must come first, see SetPublicSymbolsOnly");
+
+    struct ChpeRange {
+        ULONG start;
+        ULONG end;
+        // The architecture bits of the range entry.
+        ULONG arch;
+    };
 
     struct ModuleInfo {
         WORD magic;
         bool isHybrid;
-        std::vector<IMAGE_CHPE_RANGE_ENTRY> chpeRanges;
+        // Sorted by start offset.
+        std::vector<ChpeRange> chpeRanges;
     };
 
+    const ChpeRange* FindChpeRange(DWORD rva);
+
     HMODULE m_moduleBase;
     UndecorateMode m_undecorateMode;
     ModuleInfo m_moduleInfo;
-    wil::unique_hmodule m_msdiaModule;
+    size_t m_lastChpeRangeIndex = 0;
+    unique_msdia_module m_msdiaModule;
     wil::com_ptr<IDiaSymbol> m_diaGlobal;
     wil::com_ptr<IDiaEnumSymbols> m_diaSymbols;
     size_t m_symTagIndex = 0;
+    size_t m_symTagsCount = ARRAYSIZE(kSymTags);
+    std::vector<std::wstring> m_nameIdentifiers;
+    size_t m_nameIdentifierIndex = 0;
+    std::optional<std::wstring> m_nameFilter;
+    NameFilterType m_nameFilterType = NameFilterType::kPrefix;
+    std::array<wil::com_ptr<IDiaSymbol>, kSymbolBatchSize> m_symbolBatch;
+    ULONG m_symbolBatchIndex = 0;
+    ULONG m_symbolBatchCount = 0;
+    // Set while public symbols are read directly from the PDB, without DIA,
+    // which is possible if undecorated names aren't needed.
+    std::optional<PdbReader> m_pdbReader;
+    std::shared_ptr<const PdbStore::Content> m_pdbContent;
+    std::wstring m_currentPublicSymbolName;
     my_unique_bstr m_currentSymbolName;
     my_unique_bstr m_currentSymbolNameUndecorated;
     std::wstring m_currentSymbolNameUndecoratedWithPrefixes;
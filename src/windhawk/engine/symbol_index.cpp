@@ -0,0 +1,361 @@
+#include "stdafx.h"
+
+#include "logger.h"
+#include "storage_manager.h"
+#include "symbol_index.h"
+
+static_assert(sizeof(SymbolIndex::Entry) == 24,
+              "The entry is written to disk, its size must not change");
+static_assert(sizeof(SymbolIndex::AddressEntry) == 8,
+              "The entry is written to disk, its size must not change");
+
+// static
+std::filesystem::path SymbolIndex::GetPath(std::wstring_view indexKey) {
+    return StorageManager::GetInstance().GetSymbolsPath() /
+           L"windhawk-symbol-index" / (std::wstring(indexKey) + L".idx");
+}
+
+// static
+std::optional<SymbolIndex> SymbolIndex::Open(
+    const std::filesystem::path& path) {
+    SymbolIndex index;
+
+    index.m_file.reset(CreateFile(
+        path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+    if (!index.m_file) {
+        DWORD error = GetLastError();
+        if (error != ERROR_FILE_NOT_FOUND && error != ERROR_PATH_NOT_FOUND) {
+            LOG(L"Couldn't open symbol index %s: %u", path.c_str(), error);
+        }
+        return std::nullopt;
+    }
+
+    LARGE_INTEGER fileSize;
+    THROW_IF_WIN32_BOOL_FALSE(GetFileSizeEx(index.m_file.get(), &fileSize));
+    if (fileSize.QuadPart < static_cast<LONGLONG>(sizeof(Header))) {
+        LOG(L"Invalid symbol index %s: file is too small", path.c_str());
+        return std::nullopt;
+    }
+
+    index.m_fileMapping.reset(CreateFileMapping(
+        index.m_file.get(), nullptr, PAGE_READONLY, 0, 0, nullptr));
+    THROW_LAST_ERROR_IF_NULL(index.m_fileMapping);
+
+    index.m_view.reset(
+        MapViewOfFile(index.m_fileMapping.get(), FILE_MAP_READ, 0, 0, 0));
+    THROW_LAST_ERROR_IF_NULL(index.m_view);
+
+    const auto* header = static_cast<const Header*>(index.m_view.get());
+    if (header->magic != kMagic || header->version != kVersion) {
+        LOG(L"Invalid symbol index %s: unsupported format", path.c_str());
+        return std::nullopt;
+    }
+
+    // The names follow the tables and take the rest of the file.
+    ULONGLONG tablesSize =
+        sizeof(Header) +
+        (static_cast<ULONGLONG>(header->decoratedCount) +
+         header->undecoratedCount) *
+            sizeof(Entry) +
+        static_cast<ULONGLONG>(header->addressCount) * sizeof(AddressEntry);
+    if (static_cast<ULONGLONG>(fileSize.QuadPart) < tablesSize ||
+        (fileSize.QuadPart - tablesSize) % sizeof(WCHAR) != 0) {
+        LOG(L"Invalid symbol index %s: unexpected file size", path.c_str());
+        return std::nullopt;
+    }
+
+    const auto* entries = reinterpret_cast<const Entry*>(header + 1);
+    const auto* addressEntries = reinterpret_cast<const AddressEntry*>(
+        entries + header->decoratedCount + header->undecoratedCount);
+    const auto* names =
+        reinterpret_cast<PCWSTR>(addressEntries + header->addressCount);
+
+    index.m_header = header;
+    index.m_decorated = std::span(entries, header->decoratedCount);
+    index.m_undecorated = std::span(entries + header->decoratedCount,
+                                    header->undecoratedCount);
+    index.m_addresses = std::span(addressEntries, header->addressCount);
+    index.m_names = std::wstring_view(
+        names, static_cast<size_t>(fileSize.QuadPart - tablesSize) /
+                   sizeof(WCHAR));
+
+    return index;
+}
+
+bool SymbolIndex::HasTable(Table table) const {
+    switch (table) {
+        case Table::kDecorated:
+            return true;
+
+        case Table::kUndecorated:
+            return m_header->flags & kFlagHasUndecorated;
+    }
+
+    return false;
+}
+
+const SymbolIndex::Entry* SymbolIndex::Find(Table table,
+                                            std::wstring_view name) const {
+    auto entries = GetTable(table);
+    ULONGLONG nameHash = HashName(name);
+
+    auto it = std::lower_bound(entries.begin(), entries.end(), nameHash,
+                               [](const Entry& entry, ULONGLONG hash) {
+                                   return entry.nameHash < hash;
+                               });
+    for (; it != entries.end() && it->nameHash == nameHash; ++it) {
+        if (GetName(it->nameOffset) == name) {
+            return &*it;
+        }
+    }
+
+    return nullptr;
+}
+
+std::optional<SymbolIndex::Symbol> SymbolIndex::FindByAddress(
+    DWORD rva) const {
+    auto it = std::upper_bound(m_addresses.begin(), m_addresses.end(), rva,
+                               [](DWORD value, const AddressEntry& entry) {
+                                   return value < entry.rva;
+                               });
+    if (it == m_addresses.begin()) {
+        return std::nullopt;
+    }
+
+    --it;
+
+    std::wstring_view name = GetName(it->nameOffset);
+    if (name.empty()) {
+        return std::nullopt;
+    }
+
+    return Symbol{
+        .name = name,
+        .rva = it->rva,
+    };
+}
+
+// static
+ULONGLONG SymbolIndex::HashName(std::wstring_view name) {
+    // FNV-1a. The length is mixed in as well, so that names which only differ
+    // by trailing null characters don't collide.
+    ULONGLONG hash = 14695981039346656037ULL;
+    for (WCHAR c : name) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+
+    hash ^= name.length();
+    hash *= 1099511628211ULL;
+
+    return hash;
+}
+
+SymbolIndex::Builder::Builder(bool withUndecorated)
+    : m_withUndecorated(withUndecorated) {}
+
+void SymbolIndex::Builder::Add(PCWSTR name,
+                               PCWSTR nameUndecorated,
+                               DWORD rva) {
+    DWORD ordinal = m_nextOrdinal++;
+
+    auto addName = [this](PCWSTR name) {
+        DWORD nameOffset = wil::safe_cast<DWORD>(m_names.length());
+        m_names += name;
+        m_names += L'\0';
+        return nameOffset;
+    };
+
+    DWORD nameOffset = 0;
+    if (name) {
+        nameOffset = addName(name);
+        m_decorated.push_back({
+            .nameHash = HashName(name),
+            .rva = rva,
+            .ordinal = ordinal,
+            .nameOffset = nameOffset,
+        });
+    }
+
+    // Names of C symbols are often the same both ways, and are stored once.
+    DWORD nameUndecoratedOffset = 0;
+    if (nameUndecorated) {
+        nameUndecoratedOffset = name && wcscmp(name, nameUndecorated) == 0
+                                    ? nameOffset
+                                    : addName(nameUndecorated);
+    }
+
+    if (m_withUndecorated && nameUndecorated) {
+        m_undecorated.push_back({
+            .nameHash = HashName(nameUndecorated),
+            .rva = rva,
+            .ordinal = ordinal,
+            .nameOffset = nameUndecoratedOffset,
+        });
+    }
+
+    // The undecorated name is the readable one, if there is one.
+    if (nameUndecorated) {
+        m_addresses.push_back({rva, nameUndecoratedOffset});
+    } else if (name) {
+        m_addresses.push_back({rva, nameOffset});
+    }
+}
+
+bool SymbolIndex::Builder::Write(const std::filesystem::path& path) {
+    auto getName = [this](DWORD nameOffset) {
+        return std::wstring_view(m_names.c_str() + nameOffset);
+    };
+
+    // Sort by hash and then by name while keeping the enumeration order for
+    // equal names, then keep only the first occurrence of each name, which is
+    // the one an enumeration would have found first. Names which only share
+    // the hash are all kept.
+    auto sortAndDedupe = [&getName](std::vector<Entry>& entries) {
+        std::stable_sort(entries.begin(), entries.end(),
+                         [&getName](const Entry& a, const Entry& b) {
+                             if (a.nameHash != b.nameHash) {
+                                 return a.nameHash < b.nameHash;
+                             }
+
+                             return getName(a.nameOffset) <
+                                    getName(b.nameOffset);
+                         });
+        auto last = std::unique(entries.begin(), entries.end(),
+                                [&getName](const Entry& a, const Entry& b) {
+                                    return a.nameHash == b.nameHash &&
+                                           getName(a.nameOffset) ==
+                                               getName(b.nameOffset);
+                                });
+        entries.erase(last, entries.end());
+    };
+
+    sortAndDedupe(m_decorated);
+    sortAndDedupe(m_undecorated);
+
+    // Sort by RVA, keeping the first symbol which was enumerated for each
+    // RVA.
+    std::stable_sort(m_addresses.begin(), m_addresses.end(),
+                     [](const AddressEntry& a, const AddressEntry& b) {
+                         return a.rva < b.rva;
+                     });
+    m_addresses.erase(
+        std::unique(m_addresses.begin(), m_addresses.end(),
+                    [](const AddressEntry& a, const AddressEntry& b) {
+                        return a.rva == b.rva;
+                    }),
+        m_addresses.end());
+
+    // Write only the names which are still referenced, each of them once.
+    std::wstring names;
+    std::unordered_map<DWORD, DWORD> newNameOffsets;
+    auto updateNameOffset = [&](DWORD& nameOffset) {
+        auto [it, inserted] = newNameOffsets.try_emplace(
+            nameOffset, wil::safe_cast<DWORD>(names.length()));
+        if (inserted) {
+            names += getName(nameOffset);
+            names += L'\0';
+        }
+
+        nameOffset = it->second;
+    };
+
+    for (auto& entry : m_decorated) {
+        updateNameOffset(entry.nameOffset);
+    }
+
+    for (auto& entry : m_undecorated) {
+        updateNameOffset(entry.nameOffset);
+    }
+
+    for (auto& entry : m_addresses) {
+        updateNameOffset(entry.nameOffset);
+    }
+
+    Header header{
+        .magic = kMagic,
+        .version = kVersion,
+        .flags = m_withUndecorated ? kFlagHasUndecorated : 0,
+        .decoratedCount = wil::safe_cast<DWORD>(m_decorated.size()),
+        .undecoratedCount = wil::safe_cast<DWORD>(m_undecorated.size()),
+        .addressCount = wil::safe_cast<DWORD>(m_addresses.size()),
+    };
+
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+
+    // Write to a temporary file first and then move it into place, so that
+    // other processes never see a partially written index.
+    std::filesystem::path tempPath = path;
+    tempPath += L".tmp" + std::to_wstring(GetCurrentProcessId()) + L"_" +
+                std::to_wstring(GetCurrentThreadId());
+
+    {
+        wil::unique_hfile file(CreateFile(tempPath.c_str(), GENERIC_WRITE, 0,
+                                          nullptr, CREATE_ALWAYS,
+                                          FILE_ATTRIBUTE_NORMAL, nullptr));
+        if (!file) {
+            LOG(L"Couldn't create symbol index %s: %u", tempPath.c_str(),
+                GetLastError());
+            return false;
+        }
+
+        auto writeData = [&file](const void* data, size_t size) {
+            DWORD written;
+            return WriteFile(file.get(), data, wil::safe_cast<DWORD>(size),
+                             &written, nullptr) &&
+                   written == size;
+        };
+
+        if (!writeData(&header, sizeof(header)) ||
+            !writeData(m_decorated.data(),
+                       m_decorated.size() * sizeof(Entry)) ||
+            !writeData(m_undecorated.data(),
+                       m_undecorated.size() * sizeof(Entry)) ||
+            !writeData(m_addresses.data(),
+                       m_addresses.size() * sizeof(AddressEntry)) ||
+            !writeData(names.data(), names.length() * sizeof(WCHAR))) {
+            LOG(L"Couldn't write symbol index %s: %u", tempPath.c_str(),
+                GetLastError());
+            file.reset();
+            DeleteFile(tempPath.c_str());
+            return false;
+        }
+    }
+
+    if (!MoveFileEx(tempPath.c_str(), path.c_str(),
+                    MOVEFILE_REPLACE_EXISTING)) {
+        // Most likely, another process wrote the index first, or has it mapped
+        // for a lookup.
+        VERBOSE(L"Couldn't move symbol index into place: %u", GetLastError());
+        DeleteFile(tempPath.c_str());
+        return false;
+    }
+
+    VERBOSE(L"Symbol index written: %zu decorated, %zu undecorated, %zu "
+            L"addresses",
+            m_decorated.size(), m_undecorated.size(), m_addresses.size());
+    return true;
+}
+
+std::span<const SymbolIndex::Entry> SymbolIndex::GetTable(Table table) const {
+    switch (table) {
+        case Table::kDecorated:
+            return m_decorated;
+
+        case Table::kUndecorated:
+            return m_undecorated;
+    }
+
+    return {};
+}
+
+std::wstring_view SymbolIndex::GetName(DWORD nameOffset) const {
+    if (nameOffset >= m_names.length()) {
+        return {};
+    }
+
+    std::wstring_view name = m_names.substr(nameOffset);
+    return name.substr(0, name.find(L'\0'));
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+// A persistent, memory-mapped index of all symbols of a module, built once per
+// PDB and shared by all mods. The tables for decorated and undecorated names
+// are sorted by a 64-bit hash of the name for the lookup, and each entry points
+// to the full name, which is compared as well, so that a hash collision can't
+// resolve a symbol to the wrong address. Each entry also keeps the symbol's
+// ordinal in the original enumeration order, so that lookups can reproduce the
+// enumeration's "first match wins" behavior. An address table, sorted by RVA
+// and pointing to the names, allows mapping an address back to the symbol
+// which contains it.
+class SymbolIndex {
+   public:
+    enum class Table {
+        kDecorated,
+        kUndecorated,
+    };
+
+    // The name offset is in characters, into the names which follow the
+    // tables.
+    struct Entry {
+        ULONGLONG nameHash;
+        DWORD rva;
+        DWORD ordinal;
+        DWORD nameOffset;
+        DWORD reserved;
+    };
+
+    struct Symbol {
+        std::wstring_view name;
+        DWORD rva;
+    };
+
+    SymbolIndex(const SymbolIndex&) = delete;
+    SymbolIndex& operator=(const SymbolIndex&) = delete;
+    SymbolIndex(SymbolIndex&&) = default;
+    SymbolIndex& operator=(SymbolIndex&&) = default;
+
+    static std::filesystem::path GetPath(std::wstring_view indexKey);
+    // The index stays mapped for as long as the object exists, and while it's
+    // mapped, the file can't be replaced by a newer index. Keep the object only
+    // for the duration of a lookup.
+    static std::optional<SymbolIndex> Open(const std::filesystem::path& path);
+
+    bool HasTable(Table table) const;
+    const Entry* Find(Table table, std::wstring_view name) const;
+    // Returns the symbol with the highest RVA which isn't above the given one.
+    // The index doesn't have symbol sizes, so the returned symbol might not
+    // actually contain the address.
+    std::optional<Symbol> FindByAddress(DWORD rva) const;
+
+    static ULONGLONG HashName(std::wstring_view name);
+
+    struct AddressEntry {
+        DWORD rva;
+        DWORD nameOffset;
+    };
+
+    class Builder {
+       public:
+        explicit Builder(bool withUndecorated);
+
+        void Add(PCWSTR name, PCWSTR nameUndecorated, DWORD rva);
+        bool Write(const std::filesystem::path& path);
+
+       private:
+        bool m_withUndecorated;
+        DWORD m_nextOrdinal = 0;
+        std::vector<Entry> m_decorated;
+        std::vector<Entry> m_undecorated;
+        std::vector<AddressEntry> m_addresses;
+        // The null-terminated names of all entries.
+        std::wstring m_names;
+    };
+
+   private:
+    static constexpr DWORD kMagic = 0x49534857;  // "WHSI"
+    static constexpr DWORD kVersion = 3;
+    static constexpr DWORD kFlagHasUndecorated = 0x01;
+
+    struct Header {
+        DWORD magic;
+        DWORD version;
+        DWORD flags;
+        DWORD decoratedCount;
+        DWORD undecoratedCount;
+        DWORD addressCount;
+    };
+
+    SymbolIndex() = default;
+
+    std::span<const Entry> GetTable(Table table) const;
+    // Returns an empty name if the offset is invalid.
+    std::wstring_view GetName(DWORD nameOffset) const;
+
+    wil::unique_handle m_file;
+    wil::unique_handle m_fileMapping;
+    wil::unique_mapview_ptr<void> m_view;
+    const Header* m_header = nullptr;
+    std::span<const Entry> m_decorated;
+    std::span<const Entry> m_undecorated;
+    std::span<const AddressEntry> m_addresses;
+    std::wstring_view m_names;
+};
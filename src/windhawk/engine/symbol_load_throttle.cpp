@@ -0,0 +1,135 @@
+#include "stdafx.h"
+
+#include "customization_session.h"
+#include "logger.h"
+#include "storage_manager.h"
+#include "symbol_load_throttle.h"
+
+namespace {
+
+constexpr DWORD kVersion = 1;
+
+constexpr ULONGLONG kInitialThrottleTime = wil::filetime_duration::one_minute;
+
+struct FailureRecord {
+    DWORD version;
+    DWORD failureCount;
+    ULONGLONG lastFailureTime;
+    ULONGLONG sessionManagerProcessCreationTime;
+    DWORD sessionManagerProcessId;
+    DWORD reserved;
+};
+
+std::filesystem::path GetRecordPath(std::wstring_view pdbKey) {
+    return StorageManager::GetInstance().GetSymbolsPath() /
+           L"windhawk-symbol-failures" / (std::wstring(pdbKey) + L".dat");
+}
+
+// Returns the record if it exists and belongs to the current session manager
+// process.
+std::optional<FailureRecord> ReadRecord(const std::filesystem::path& path) {
+    wil::unique_hfile file(CreateFile(
+        path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+    if (!file) {
+        return std::nullopt;
+    }
+
+    FailureRecord record;
+    DWORD read;
+    if (!ReadFile(file.get(), &record, sizeof(record), &read, nullptr) ||
+        read != sizeof(record) || record.version != kVersion) {
+        return std::nullopt;
+    }
+
+    if (record.sessionManagerProcessId !=
+            CustomizationSession::GetSessionManagerProcessId() ||
+        record.sessionManagerProcessCreationTime !=
+            wil::filetime::to_int64(
+                CustomizationSession::GetSessionManagerProcessCreationTime())) {
+        return std::nullopt;
+    }
+
+    return record;
+}
+
+}  // namespace
+
+namespace SymbolLoadThrottle {
+
+bool IsThrottled(std::wstring_view pdbKey, ULONGLONG maxThrottleTime) {
+    auto record = ReadRecord(GetRecordPath(pdbKey));
+    if (!record) {
+        return false;
+    }
+
+    ULONGLONG throttleTime = kInitialThrottleTime;
+    for (DWORD i = 1; i < record->failureCount; i++) {
+        if (throttleTime >= maxThrottleTime) {
+            break;
+        }
+
+        throttleTime *= 2;
+    }
+
+    throttleTime = std::min(throttleTime, maxThrottleTime);
+
+    ULONGLONG currentTime =
+        wil::filetime::to_int64(wil::filetime::get_system_time());
+    if (currentTime < record->lastFailureTime ||
+        currentTime - record->lastFailureTime > throttleTime) {
+        return false;
+    }
+
+    VERBOSE(L"Symbol loading is throttled after %u failures",
+            record->failureCount);
+    return true;
+}
+
+void OnFailure(std::wstring_view pdbKey) {
+    auto path = GetRecordPath(pdbKey);
+
+    FailureRecord record{
+        .version = kVersion,
+        .failureCount = 1,
+        .lastFailureTime =
+            wil::filetime::to_int64(wil::filetime::get_system_time()),
+        .sessionManagerProcessCreationTime = wil::filetime::to_int64(
+            CustomizationSession::GetSessionManagerProcessCreationTime()),
+        .sessionManagerProcessId =
+            CustomizationSession::GetSessionManagerProcessId(),
+    };
+
+    if (auto previousRecord = ReadRecord(path)) {
+        record.failureCount = previousRecord->failureCount + 1;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+
+    wil::unique_hfile file(CreateFile(path.c_str(), GENERIC_WRITE,
+                                      FILE_SHARE_READ | FILE_SHARE_DELETE,
+                                      nullptr, CREATE_ALWAYS,
+                                      FILE_ATTRIBUTE_NORMAL, nullptr));
+    if (!file) {
+        VERBOSE(L"Couldn't create symbol failure record: %u", GetLastError());
+        return;
+    }
+
+    DWORD written;
+    if (!WriteFile(file.get(), &record, sizeof(record), &written, nullptr)) {
+        VERBOSE(L"Couldn't write symbol failure record: %u", GetLastError());
+    }
+}
+
+void OnSuccess(std::wstring_view pdbKey) {
+    auto path = GetRecordPath(pdbKey);
+    if (!DeleteFile(path.c_str())) {
+        DWORD error = GetLastError();
+        if (error != ERROR_FILE_NOT_FOUND && error != ERROR_PATH_NOT_FOUND) {
+            VERBOSE(L"Couldn't delete symbol failure record: %u", error);
+        }
+    }
+}
+
+}  // namespace SymbolLoadThrottle
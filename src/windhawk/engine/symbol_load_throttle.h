@@ -0,0 +1,18 @@
+#pragma once
+
+// Tracks failures to load the symbols of a module, keyed by its PDB identity
+// and shared by all mods and processes. If, for example, the symbol server is
+// unreachable, a single failure suppresses further attempts for a while
+// instead of each mod retrying in each new process. The throttle time doubles
+// with each consecutive failure, and the state is reset when the session
+// manager process restarts.
+namespace SymbolLoadThrottle {
+
+// Returns whether loading the symbols should be skipped. maxThrottleTime caps
+// the throttle time, in FILETIME units.
+bool IsThrottled(std::wstring_view pdbKey, ULONGLONG maxThrottleTime);
+
+void OnFailure(std::wstring_view pdbKey);
+void OnSuccess(std::wstring_view pdbKey);
+
+}  // namespace SymbolLoadThrottle
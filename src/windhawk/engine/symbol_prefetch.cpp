@@ -0,0 +1,488 @@
+#include "stdafx.h"
+
+#include "functions.h"
+#include "logger.h"
+#include "pdb_store.h"
+#include "storage_manager.h"
+#include "symbol_cache.h"
+#include "symbol_enum.h"
+#include "symbol_index.h"
+#include "symbol_prefetch.h"
+
+namespace {
+
+bool IsStopEventSignaled(HANDLE stopEvent) {
+    return WaitForSingleObject(stopEvent, 0) == WAIT_OBJECT_0;
+}
+
+std::wstring GetPdbKey(const GUID& pdbGuid, DWORD pdbAge) {
+    constexpr size_t kMaxPdbIdentifierLength =
+        sizeof("AAAAAAAABBBBCCCCDDDDEEEEEEEEEEEE12345678") - 1;
+    WCHAR pdbIdentifier[kMaxPdbIdentifierLength + 1];
+    swprintf_s(pdbIdentifier,
+               L"%08X%04X%04X%02X%02X%02X%02X%02X%02X%02X%02X%x",
+               pdbGuid.Data1, pdbGuid.Data2, pdbGuid.Data3, pdbGuid.Data4[0],
+               pdbGuid.Data4[1], pdbGuid.Data4[2], pdbGuid.Data4[3],
+               pdbGuid.Data4[4], pdbGuid.Data4[5], pdbGuid.Data4[6],
+               pdbGuid.Data4[7], pdbAge);
+
+    return std::wstring(L"pdb_") + pdbIdentifier;
+}
+
+// Entries of errors are only used for throttling for a few hours, see
+// LoadedMod::HookSymbolsWithTrace.
+constexpr ULONGLONG kErrorCacheEntryMaxAge =
+    24 * wil::filetime_duration::one_hour;
+
+constexpr std::wstring_view kErrorCachePrefix = L"error:";
+constexpr std::wstring_view kPatternCacheKeyPrefix = L"pattern_";
+constexpr std::wstring_view kPdbCacheKeyPrefix = L"pdb_";
+constexpr std::wstring_view kPeCacheKeyPrefix = L"pe_";
+
+// Throttled errors are stored as:
+// error:1#sessionManagerPid#sessionManagerCreationTime#errorTime#...
+bool IsErrorCacheEntryExpired(std::wstring_view value, ULONGLONG currentTime) {
+    auto parts = Functions::SplitStringToViews(
+        value.substr(kErrorCachePrefix.size()), L'#');
+    if (parts.size() < 4) {
+        return true;
+    }
+
+    ULONGLONG errorTime =
+        std::wcstoull(std::wstring(parts[3]).c_str(), nullptr, 10);
+    return errorTime + kErrorCacheEntryMaxAge < currentTime;
+}
+
+// The values of a module file which its symbol cache keys are made of.
+struct ModuleFileIdentity {
+    // Empty if the module has no PDB.
+    std::wstring pdbKey;
+    DWORD timeStamp;
+    DWORD imageSize;
+};
+
+std::optional<ModuleFileIdentity> GetModuleFileIdentity(
+    const std::filesystem::path& modulePath) {
+    wil::unique_hmodule moduleMapping(LoadLibraryEx(
+        modulePath.c_str(), nullptr, LOAD_LIBRARY_AS_IMAGE_RESOURCE));
+    if (!moduleMapping) {
+        return std::nullopt;
+    }
+
+    HMODULE module = reinterpret_cast<HMODULE>(
+        reinterpret_cast<ULONG_PTR>(moduleMapping.get()) & ~ULONG_PTR{3});
+
+    // The offsets of these fields are the same for 32-bit and 64-bit modules.
+    auto* dosHeader = reinterpret_cast<const IMAGE_DOS_HEADER*>(module);
+    auto* ntHeader = reinterpret_cast<const IMAGE_NT_HEADERS*>(
+        reinterpret_cast<const BYTE*>(dosHeader) + dosHeader->e_lfanew);
+
+    ModuleFileIdentity identity{
+        .timeStamp = ntHeader->FileHeader.TimeDateStamp,
+        .imageSize = ntHeader->OptionalHeader.SizeOfImage,
+    };
+
+    GUID pdbGuid;
+    DWORD pdbAge;
+    if (Functions::ModuleGetPDBInfo(module, &pdbGuid, &pdbAge)) {
+        identity.pdbKey = GetPdbKey(pdbGuid, pdbAge);
+    }
+
+    return identity;
+}
+
+// The keys are created by GetSymbolCacheKey in module_identity_cache.cpp:
+// pdb_<pdbIdentifier>[_hybrid-<arch>] or
+// pe_<arch>_<timeStamp>_<imageSize>_<fileName>[_hybrid], with the pattern
+// cache prefix for pattern scan results. Keys of an unknown format are
+// considered to match.
+bool CacheKeyMatchesModuleFile(std::wstring_view key,
+                               const ModuleFileIdentity& identity) {
+    if (key.starts_with(kPatternCacheKeyPrefix)) {
+        key.remove_prefix(kPatternCacheKeyPrefix.size());
+    }
+
+    if (key.starts_with(kPdbCacheKeyPrefix)) {
+        return key.substr(0, key.find(L'_', kPdbCacheKeyPrefix.size())) ==
+               identity.pdbKey;
+    }
+
+    if (key.starts_with(kPeCacheKeyPrefix)) {
+        auto parts = Functions::SplitStringToViews(
+            key.substr(kPeCacheKeyPrefix.size()), L'_');
+        if (parts.size() < 4) {
+            return true;
+        }
+
+        return parts[1] == std::to_wstring(identity.timeStamp) &&
+               parts[2] == std::to_wstring(identity.imageSize);
+    }
+
+    return true;
+}
+
+void AddModuleName(std::vector<std::wstring>& moduleNames,
+                   std::wstring moduleName) {
+    if (!moduleName.empty() &&
+        std::find(moduleNames.begin(), moduleNames.end(), moduleName) ==
+            moduleNames.end()) {
+        moduleNames.push_back(std::move(moduleName));
+    }
+}
+
+}  // namespace
+
+SymbolPrefetcher::SymbolPrefetcher() {
+    try {
+        m_modsChangeNotification.emplace();
+
+        // The service creates the prefetcher on its main thread, but waits
+        // for the changes and calls ContinueMonitoring on the prefetch
+        // thread. Without cross thread monitoring, only the periodic runs
+        // remain.
+        if (!m_modsChangeNotification->CanMonitorAcrossThreads()) {
+            m_modsChangeNotification.reset();
+        }
+    } catch (const std::exception& e) {
+        LOG(L"Monitoring the mod configs failed: %S", e.what());
+    }
+}
+
+void SymbolPrefetcher::Run(HANDLE stopEvent) {
+    auto moduleNames = GetModuleNames();
+
+    VERBOSE(L"Prefetching symbols for %zu modules", moduleNames.size());
+
+    for (const auto& moduleName : moduleNames) {
+        for (const auto& modulePath : FindModuleFiles(moduleName)) {
+            if (IsStopEventSignaled(stopEvent)) {
+                return;
+            }
+
+            try {
+                IndexModule(modulePath, {}, stopEvent);
+            } catch (const std::exception& e) {
+                LOG(L"Prefetching symbols for %s failed: %S",
+                    modulePath.c_str(), e.what());
+            }
+        }
+    }
+
+    if (!m_symbolCachesCollected) {
+        CollectSymbolCacheGarbage(stopEvent);
+        m_symbolCachesCollected = !IsStopEventSignaled(stopEvent);
+    }
+
+    try {
+        PdbStore::EvictUnused(stopEvent);
+    } catch (const std::exception& e) {
+        LOG(L"Evicting unused symbols failed: %S", e.what());
+    }
+}
+
+HANDLE SymbolPrefetcher::GetModsChangeEvent() {
+    return m_modsChangeNotification ? m_modsChangeNotification->GetHandle()
+                                    : nullptr;
+}
+
+void SymbolPrefetcher::ContinueMonitoring() {
+    if (!m_modsChangeNotification) {
+        return;
+    }
+
+    try {
+        m_modsChangeNotification->ContinueMonitoring();
+    } catch (const std::exception& e) {
+        LOG(L"Monitoring the mod configs failed: %S", e.what());
+        m_modsChangeNotification.reset();
+    }
+}
+
+std::vector<std::wstring> SymbolPrefetcher::GetModuleNames() {
+    std::vector<std::wstring> moduleNames;
+
+    StorageManager::GetInstance().EnumMods([&moduleNames](PCWSTR modName) {
+        try {
+            auto settings =
+                StorageManager::GetInstance().GetModConfig(modName, nullptr);
+            if (settings->GetInt(L"Disabled").value_or(0)) {
+                return;
+            }
+
+            // Target modules of a mod which didn't resolve any symbols yet,
+            // e.g. because it was just installed.
+            auto symbolModules =
+                settings->GetString(L"SymbolModules").value_or(L"");
+            for (auto moduleName :
+                 Functions::SplitStringToViews(symbolModules, L'|')) {
+                if (moduleName.find_first_of(L"\\/:") == moduleName.npos) {
+                    AddModuleName(moduleNames, std::wstring(moduleName));
+                }
+            }
+
+            auto symbolCache =
+                StorageManager::GetInstance().GetModWritableConfig(
+                    modName, L"SymbolCache", false);
+            for (auto it = symbolCache->EnumStringValues(); it; ++it) {
+                const auto& [valueName, value] = *it;
+                if (value.starts_with(L"error:")) {
+                    continue;
+                }
+
+                // Caches created by older versions are stored as strings.
+                auto cacheData = SymbolCacheData::ParseString(value);
+                if (!cacheData) {
+                    auto cacheBinary =
+                        symbolCache->GetBinary(valueName.c_str());
+                    if (cacheBinary) {
+                        cacheData = SymbolCacheData::Parse(*cacheBinary);
+                    }
+                }
+
+                if (cacheData) {
+                    AddModuleName(moduleNames,
+                                  std::move(cacheData->moduleName));
+                }
+            }
+        } catch (const std::exception& e) {
+            LOG(L"Reading the symbol cache of %s failed: %S", modName,
+                e.what());
+        }
+    });
+
+    return moduleNames;
+}
+
+std::vector<std::filesystem::path> SymbolPrefetcher::FindModuleFiles(
+    std::wstring_view moduleName) {
+    // The full path of the module isn't stored in the symbol cache. Most
+    // modules which mods hook are system modules, so only the system folders
+    // are searched.
+    auto windowsFolder =
+        std::filesystem::path(wil::GetWindowsDirectory<std::wstring>());
+
+    std::vector<std::filesystem::path> folders = {
+        windowsFolder,
+        wil::GetSystemDirectory<std::wstring>(),
+    };
+
+    // For a 32-bit process on a 64-bit system, System32 is redirected to the
+    // 32-bit system folder, and the native one is available as Sysnative.
+    BOOL isWow64;
+    if (IsWow64Process(GetCurrentProcess(), &isWow64) && isWow64) {
+        folders.push_back(windowsFolder / L"Sysnative");
+    }
+
+    WCHAR wow64Folder[MAX_PATH];
+    UINT wow64FolderLength =
+        GetSystemWow64Directory(wow64Folder, ARRAYSIZE(wow64Folder));
+    if (wow64FolderLength > 0 && wow64FolderLength < ARRAYSIZE(wow64Folder)) {
+        folders.push_back(wow64Folder);
+    }
+
+    std::vector<std::filesystem::path> modulePaths;
+
+    for (const auto& folder : folders) {
+        auto modulePath = folder / moduleName;
+        std::error_code ec;
+        if (std::filesystem::is_regular_file(modulePath, ec)) {
+            modulePaths.push_back(std::move(modulePath));
+        }
+    }
+
+    return modulePaths;
+}
+
+void SymbolPrefetcher::CollectSymbolCacheGarbage(HANDLE stopEvent) {
+    ULONGLONG currentTime =
+        wil::filetime::to_int64(wil::filetime::get_system_time());
+
+    // By module name, empty if the module isn't found in the system folders.
+    std::unordered_map<std::wstring, std::vector<ModuleFileIdentity>>
+        moduleFiles;
+    auto getModuleFiles = [this, &moduleFiles](const std::wstring& moduleName)
+        -> const std::vector<ModuleFileIdentity>& {
+        auto [it, inserted] = moduleFiles.try_emplace(moduleName);
+        if (inserted) {
+            for (const auto& modulePath : FindModuleFiles(moduleName)) {
+                if (auto identity = GetModuleFileIdentity(modulePath)) {
+                    it->second.push_back(std::move(*identity));
+                }
+            }
+        }
+
+        return it->second;
+    };
+
+    size_t removedCount = 0;
+
+    StorageManager::GetInstance().EnumMods([&](PCWSTR modName) {
+        if (IsStopEventSignaled(stopEvent)) {
+            return;
+        }
+
+        try {
+            auto symbolCache =
+                StorageManager::GetInstance().GetModWritableConfig(
+                    modName, L"SymbolCache", false);
+
+            struct Entry {
+                std::wstring key;
+                std::wstring moduleName;
+            };
+
+            std::vector<std::wstring> staleKeys;
+            std::vector<Entry> mismatchingEntries;
+            std::unordered_set<std::wstring> currentModuleNames;
+
+            for (auto it = symbolCache->EnumStringValues(); it; ++it) {
+                const auto& [valueName, value] = *it;
+                if (value.starts_with(kErrorCachePrefix)) {
+                    if (IsErrorCacheEntryExpired(value, currentTime)) {
+                        staleKeys.push_back(valueName);
+                    }
+                    continue;
+                }
+
+                auto cacheData = SymbolCacheData::ParseString(value);
+                if (!cacheData) {
+                    auto cacheBinary =
+                        symbolCache->GetBinary(valueName.c_str());
+                    if (cacheBinary) {
+                        cacheData = SymbolCacheData::Parse(*cacheBinary);
+                    }
+                }
+
+                if (!cacheData || cacheData->moduleName.empty()) {
+                    continue;
+                }
+
+                const auto& files = getModuleFiles(cacheData->moduleName);
+                if (files.empty()) {
+                    continue;
+                }
+
+                bool matches = std::any_of(
+                    files.begin(), files.end(),
+                    [&valueName](const ModuleFileIdentity& identity) {
+                        return CacheKeyMatchesModuleFile(valueName, identity);
+                    });
+                if (matches) {
+                    currentModuleNames.insert(std::move(cacheData->moduleName));
+                } else {
+                    mismatchingEntries.push_back({
+                        .key = valueName,
+                        .moduleName = std::move(cacheData->moduleName),
+                    });
+                }
+            }
+
+            for (auto& entry : mismatchingEntries) {
+                if (currentModuleNames.contains(entry.moduleName)) {
+                    staleKeys.push_back(std::move(entry.key));
+                }
+            }
+
+            if (staleKeys.empty()) {
+                return;
+            }
+
+            auto symbolCacheWritable =
+                StorageManager::GetInstance().GetModWritableConfig(
+                    modName, L"SymbolCache", true);
+            for (const auto& key : staleKeys) {
+                VERBOSE(L"Removing symbol cache entry %s of %s", key.c_str(),
+                        modName);
+                symbolCacheWritable->Remove(key.c_str());
+            }
+
+            removedCount += staleKeys.size();
+        } catch (const std::exception& e) {
+            LOG(L"Collecting the symbol cache of %s failed: %S", modName,
+                e.what());
+        }
+    });
+
+    VERBOSE(L"Removed %zu stale symbol cache entries", removedCount);
+}
+
+bool SymbolPrefetcher::IndexModule(const std::filesystem::path& modulePath,
+                                   std::wstring_view expectedPdbKey,
+                                   HANDLE stopEvent) {
+    // Map the module as an image without running any of its code, so that RVAs
+    // can be used as is, as with a loaded module.
+    wil::unique_hmodule moduleMapping(LoadLibraryEx(
+        modulePath.c_str(), nullptr, LOAD_LIBRARY_AS_IMAGE_RESOURCE));
+    THROW_LAST_ERROR_IF_NULL(moduleMapping);
+
+    // The low bits of the handle mark it as a resource mapping.
+    HMODULE module = reinterpret_cast<HMODULE>(
+        reinterpret_cast<ULONG_PTR>(moduleMapping.get()) & ~ULONG_PTR{3});
+
+    GUID pdbGuid;
+    DWORD pdbAge;
+    if (!Functions::ModuleGetPDBInfo(module, &pdbGuid, &pdbAge)) {
+        return false;
+    }
+
+    std::wstring pdbKey = GetPdbKey(pdbGuid, pdbAge);
+    if (!expectedPdbKey.empty() && pdbKey != expectedPdbKey) {
+        VERBOSE(L"Unexpected PDB for %s: %s", modulePath.c_str(),
+                pdbKey.c_str());
+        return false;
+    }
+
+    auto symbolIndexPath = SymbolIndex::GetPath(pdbKey);
+    std::error_code ec;
+    if (std::filesystem::exists(symbolIndexPath, ec)) {
+        m_handledPdbKeys.insert(std::move(pdbKey));
+        return true;
+    }
+
+    // Indexing failed before, or the module is hybrid.
+    if (m_handledPdbKeys.contains(pdbKey)) {
+        return false;
+    }
+
+    VERBOSE(L"Prefetching symbols for %s", modulePath.c_str());
+
+    SymbolEnum::Callbacks callbacks{
+        .queryCancel = [stopEvent]() { return IsStopEventSignaled(stopEvent); },
+    };
+
+    // Runs in the service, possibly on behalf of another process, so the
+    // embedded PDB path isn't used.
+    SymbolEnum symbolEnum(modulePath.c_str(), module, nullptr,
+                          SymbolEnum::UndecorateMode::Default,
+                          std::move(callbacks), /*symbolStoreOnly=*/true);
+
+    // Undecorated names of hybrid modules depend on the architecture of the
+    // process which loads them, so only their symbols are downloaded. These are
+    // indexed by the first process which needs them.
+    if (symbolEnum.IsHybridModule()) {
+        m_handledPdbKeys.insert(std::move(pdbKey));
+        return false;
+    }
+
+    SymbolIndex::Builder symbolIndexBuilder(/*withUndecorated=*/true);
+
+    while (auto symbol = symbolEnum.GetNextSymbol()) {
+        if (IsStopEventSignaled(stopEvent)) {
+            return false;
+        }
+
+        symbolIndexBuilder.Add(
+            symbol->name && *symbol->name ? symbol->name : nullptr,
+            symbol->nameUndecorated && *symbol->nameUndecorated
+                ? symbol->nameUndecorated
+                : nullptr,
+            static_cast<DWORD>(reinterpret_cast<ULONG_PTR>(symbol->address) -
+                               reinterpret_cast<ULONG_PTR>(module)));
+    }
+
+    bool written = symbolIndexBuilder.Write(symbolIndexPath);
+    m_handledPdbKeys.insert(std::move(pdbKey));
+
+    // The index might have been written by another process in the meantime.
+    return written || std::filesystem::exists(symbolIndexPath, ec);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "storage_manager.h"
+
+// Downloads and indexes the symbols of the modules that enabled mods resolved
+// symbols in, or that the mods are expected to resolve symbols in according to
+// their SymbolModules config value, which is extracted from the mod source
+// when the mod is installed. Meant to run in the background service, so that
+// after a module or a mod is updated, its symbols are already available
+// locally by the time mods load in the target processes.
+class SymbolPrefetcher {
+   public:
+    SymbolPrefetcher();
+
+    SymbolPrefetcher(const SymbolPrefetcher&) = delete;
+    SymbolPrefetcher& operator=(const SymbolPrefetcher&) = delete;
+
+    // Returns early if the stop event is signaled.
+    void Run(HANDLE stopEvent);
+
+    // Downloads the symbols of the module and indexes them, unless they're
+    // already indexed. If expectedPdbKey isn't empty, the module is only
+    // handled if its PDB matches. Returns whether the index exists.
+    bool IndexModule(const std::filesystem::path& modulePath,
+                     std::wstring_view expectedPdbKey,
+                     HANDLE stopEvent);
+
+    // Signaled when the mod configs change, e.g. when a mod is installed or
+    // updated, so that the symbols of its modules can be prefetched without
+    // waiting for the next periodic run. Returns nullptr if the changes can't
+    // be monitored. ContinueMonitoring must be called after each change.
+    HANDLE GetModsChangeEvent();
+    void ContinueMonitoring();
+
+   private:
+    std::vector<std::wstring> GetModuleNames();
+    std::vector<std::filesystem::path> FindModuleFiles(
+        std::wstring_view moduleName);
+
+    // Each Windows update adds symbol cache entries for the updated modules,
+    // and the entries of the replaced versions are never used again. Removes
+    // the entries of a mod for a module which don't match any of its files
+    // in the system folders, if the mod also has an entry which matches. The
+    // latter condition keeps the entries of modules which are loaded from
+    // elsewhere, e.g. side-by-side assemblies with the name of a system
+    // module. Entries of throttled errors are removed once expired.
+    void CollectSymbolCacheGarbage(HANDLE stopEvent);
+
+    // Modules which were already handled, either indexed or skipped, keyed by
+    // their PDB identity.
+    std::unordered_set<std::wstring> m_handledPdbKeys;
+    // Modules are only replaced by updates which require a restart, so the
+    // symbol caches are only collected by the first run after the service
+    // starts.
+    bool m_symbolCachesCollected = false;
+    std::optional<StorageManager::ModConfigChangeNotification>
+        m_modsChangeNotification;
+};
@@ -0,0 +1,285 @@
+#include "stdafx.h"
+
+#include "symbol_resolution_trace.h"
+
+#include "functions.h"
+#include "logger.h"
+#include "storage_manager.h"
+#include "var_init_once.h"
+
+namespace {
+
+bool IsEnabledInConfig() {
+    try {
+        auto settings = StorageManager::GetInstance().GetAppConfig(L"Settings");
+        return settings->GetInt(L"SymbolResolutionTrace").value_or(0) != 0;
+    } catch (const std::exception& e) {
+        LOG(L"Reading the SymbolResolutionTrace setting failed: %S",
+            e.what());
+        return false;
+    }
+}
+
+void AppendJsonString(std::wstring* json, std::wstring_view value) {
+    *json += L'"';
+    for (WCHAR c : value) {
+        if (c == L'"' || c == L'\\') {
+            *json += L'\\';
+            *json += c;
+        } else if (c < 0x20) {
+            WCHAR escaped[sizeof("\\u0000")];
+            swprintf_s(escaped, L"\\u%04X", c);
+            *json += escaped;
+        } else {
+            *json += c;
+        }
+    }
+    *json += L'"';
+}
+
+void AppendJsonMember(std::wstring* json,
+                      PCWSTR name,
+                      std::wstring_view value) {
+    if (!json->empty()) {
+        *json += L',';
+    }
+
+    AppendJsonString(json, name);
+    *json += L':';
+    AppendJsonString(json, value);
+}
+
+void AppendJsonMember(std::wstring* json, PCWSTR name, ULONGLONG value) {
+    if (!json->empty()) {
+        *json += L',';
+    }
+
+    AppendJsonString(json, name);
+    *json += L':';
+    *json += std::to_wstring(value);
+}
+
+void AppendJsonMember(std::wstring* json, PCWSTR name, bool value) {
+    if (!json->empty()) {
+        *json += L',';
+    }
+
+    AppendJsonString(json, name);
+    *json += value ? L":true" : L":false";
+}
+
+std::wstring ToWide(std::string_view value, UINT codePage) {
+    std::wstring result;
+    if (value.empty()) {
+        return result;
+    }
+
+    int length = MultiByteToWideChar(codePage, 0, value.data(),
+                                     wil::safe_cast<int>(value.length()),
+                                     nullptr, 0);
+    THROW_LAST_ERROR_IF(length == 0);
+
+    result.resize(length);
+    MultiByteToWideChar(codePage, 0, value.data(),
+                        wil::safe_cast<int>(value.length()), result.data(),
+                        length);
+    return result;
+}
+
+std::string ToUtf8(std::wstring_view value) {
+    std::string result;
+    if (value.empty()) {
+        return result;
+    }
+
+    int length = WideCharToMultiByte(CP_UTF8, 0, value.data(),
+                                     wil::safe_cast<int>(value.length()),
+                                     nullptr, 0, nullptr, nullptr);
+    THROW_LAST_ERROR_IF(length == 0);
+
+    result.resize(length);
+    WideCharToMultiByte(CP_UTF8, 0, value.data(),
+                        wil::safe_cast<int>(value.length()), result.data(),
+                        length, nullptr, nullptr);
+    return result;
+}
+
+}  // namespace
+
+// static
+bool SymbolResolutionTrace::IsEnabled() {
+    STATIC_INIT_ONCE_TRIVIAL(bool, enabled, IsEnabledInConfig());
+    return enabled;
+}
+
+SymbolResolutionTrace::SymbolResolutionTrace(PCWSTR modName, HMODULE module)
+    : m_modName(modName), m_startTickCount(GetTickCount64()) {
+    GetSystemTimeAsFileTime(&m_startTime);
+
+    AppendJsonMember(&m_header, L"version", ULONGLONG{1});
+    AppendJsonMember(&m_header, L"mod", m_modName);
+    AppendJsonMember(&m_header, L"processId",
+                     ULONGLONG{GetCurrentProcessId()});
+    AppendJsonMember(&m_header, L"processPath",
+                     wil::GetModuleFileName<std::wstring>(nullptr));
+    AppendJsonMember(&m_header, L"startTime",
+                     wil::filetime::to_int64(m_startTime));
+
+    if (!module) {
+        return;
+    }
+
+    // The same values which the symbol server uses to find the PDB, and
+    // which the symbol cache is keyed by. See also the cache key.
+    auto* dosHeader = reinterpret_cast<IMAGE_DOS_HEADER*>(module);
+    auto* ntHeader = reinterpret_cast<IMAGE_NT_HEADERS*>(
+        reinterpret_cast<BYTE*>(dosHeader) + dosHeader->e_lfanew);
+
+    AppendJsonMember(&m_header, L"modulePath",
+                     wil::GetModuleFileName<std::wstring>(module));
+    AppendJsonMember(
+        &m_header, L"moduleVersion",
+        ToWide(Functions::GetModuleVersion(module), CP_ACP));
+    AppendJsonMember(&m_header, L"moduleTimeStamp",
+                     ULONGLONG{ntHeader->FileHeader.TimeDateStamp});
+    AppendJsonMember(&m_header, L"moduleImageSize",
+                     ULONGLONG{ntHeader->OptionalHeader.SizeOfImage});
+    AppendJsonMember(&m_header, L"moduleMachine",
+                     ULONGLONG{ntHeader->FileHeader.Machine});
+}
+
+void SymbolResolutionTrace::SetOptions(const WH_HOOK_SYMBOLS_OPTIONS& options,
+                                       bool compatDemangling) {
+    if (options.symbolServer) {
+        AppendJsonMember(&m_header, L"symbolServer", options.symbolServer);
+    }
+
+    if (options.onlineCacheUrl) {
+        AppendJsonMember(&m_header, L"onlineCacheUrl", options.onlineCacheUrl);
+    }
+
+    AppendJsonMember(&m_header, L"noUndecoratedSymbols",
+                     !!options.noUndecoratedSymbols);
+    AppendJsonMember(&m_header, L"publicSymbolsOnly",
+                     !!options.publicSymbolsOnly);
+    AppendJsonMember(&m_header, L"stopAtRequiredSymbols",
+                     !!options.stopAtRequiredSymbols);
+    AppendJsonMember(&m_header, L"compatDemangling", compatDemangling);
+}
+
+void SymbolResolutionTrace::SetCacheKey(std::wstring_view cacheKey) {
+    AppendJsonMember(&m_header, L"cacheKey", cacheKey);
+}
+
+void SymbolResolutionTrace::AddHook(const WH_SYMBOL_HOOK& hook) {
+    if (!m_hooks.empty()) {
+        m_hooks += L',';
+    }
+
+    m_hooks += L"{\"names\":[";
+    for (size_t i = 0; i < hook.symbolsCount; i++) {
+        if (i > 0) {
+            m_hooks += L',';
+        }
+
+        AppendJsonString(&m_hooks, std::wstring_view(hook.symbols[i].string,
+                                                     hook.symbols[i].length));
+    }
+    m_hooks += hook.optional ? L"],\"optional\":true}" : L"]}";
+}
+
+void SymbolResolutionTrace::AddEvent(PCSTR event, std::wstring_view detail) {
+    std::wstring json;
+    AppendJsonMember(&json, L"ms", ULONGLONG{GetElapsedMs()});
+    AppendJsonMember(&json, L"event", ToWide(event, CP_ACP));
+    if (!detail.empty()) {
+        AppendJsonMember(&json, L"detail", detail);
+    }
+
+    std::lock_guard guard(m_eventsMutex);
+
+    if (m_eventCount == kMaxEventCount) {
+        m_droppedEventCount++;
+        return;
+    }
+
+    if (m_eventCount++ > 0) {
+        m_events += L',';
+    }
+
+    m_events += L'{';
+    m_events += json;
+    m_events += L'}';
+}
+
+void SymbolResolutionTrace::AddEvent(PCSTR event, std::string_view detail) {
+    AddEvent(event, ToWide(detail, CP_ACP));
+}
+
+void SymbolResolutionTrace::AddPhaseDuration(PCSTR phase,
+                                             ULONGLONG durationMs) {
+    AppendJsonMember(&m_phases, ToWide(phase, CP_ACP).c_str(), durationMs);
+}
+
+void SymbolResolutionTrace::Write(bool succeeded) noexcept {
+    try {
+        std::wstring json = L"{";
+        json += m_header;
+        json += L",\"hooks\":[";
+        json += m_hooks;
+        json += L"],\"events\":[";
+        {
+            std::lock_guard guard(m_eventsMutex);
+            json += m_events;
+            json += L']';
+            AppendJsonMember(&json, L"droppedEvents",
+                             ULONGLONG{m_droppedEventCount});
+        }
+        json += L",\"phasesMs\":{";
+        json += m_phases;
+        json += L'}';
+        AppendJsonMember(&json, L"durationMs", ULONGLONG{GetElapsedMs()});
+        AppendJsonMember(&json, L"succeeded", succeeded);
+        json += L"}\n";
+
+        auto folderPath =
+            StorageManager::GetInstance().GetLogsPath() / L"SymbolTraces";
+        std::filesystem::create_directories(folderPath);
+
+        auto fileCount = std::distance(
+            std::filesystem::directory_iterator(folderPath),
+            std::filesystem::directory_iterator{});
+        if (static_cast<size_t>(fileCount) >= kMaxFileCount) {
+            VERBOSE(L"Not writing the symbol resolution trace, the folder is "
+                    L"full: %s",
+                    folderPath.c_str());
+            return;
+        }
+
+        WCHAR fileName[256];
+        swprintf_s(fileName, L"%s_%u_%u_%016I64X.json", m_modName.c_str(),
+                   GetCurrentProcessId(), GetCurrentThreadId(),
+                   wil::filetime::to_int64(m_startTime));
+        auto filePath = folderPath / fileName;
+
+        wil::unique_hfile file(CreateFile(filePath.c_str(), GENERIC_WRITE, 0,
+                                          nullptr, CREATE_NEW,
+                                          FILE_ATTRIBUTE_NORMAL, nullptr));
+        THROW_LAST_ERROR_IF(!file);
+
+        std::string jsonUtf8 = ToUtf8(json);
+        DWORD written;
+        THROW_IF_WIN32_BOOL_FALSE(
+            WriteFile(file.get(), jsonUtf8.data(),
+                      wil::safe_cast<DWORD>(jsonUtf8.size()), &written,
+                      nullptr));
+
+        VERBOSE(L"Wrote the symbol resolution trace %s", filePath.c_str());
+    } catch (const std::exception& e) {
+        LOG(L"Writing the symbol resolution trace failed: %S", e.what());
+    }
+}
+
+DWORD SymbolResolutionTrace::GetElapsedMs() const {
+    return static_cast<DWORD>(GetTickCount64() - m_startTickCount);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "mods_api.h"
+
+// Records a single symbol resolution of a mod, i.e. a HookSymbols call, into
+// a self-contained JSON file, enabled with the SymbolResolutionTrace engine
+// setting. The file has what's needed to reproduce a slow resolution without
+// the environment in which it happened: the identity of the target module and
+// its PDB, the options and the requested hooks, and a timeline of the phases,
+// the cache lookups, the downloads and the symbol server events, followed by
+// the duration of each phase and the result.
+//
+// The files are written to the "SymbolTraces" folder of the logs folder. Only
+// a limited amount of files is written, older files have to be removed for
+// new ones to be written.
+class SymbolResolutionTrace {
+   public:
+    static bool IsEnabled();
+
+    SymbolResolutionTrace(PCWSTR modName, HMODULE module);
+
+    SymbolResolutionTrace(const SymbolResolutionTrace&) = delete;
+    SymbolResolutionTrace& operator=(const SymbolResolutionTrace&) = delete;
+
+    void SetOptions(const WH_HOOK_SYMBOLS_OPTIONS& options,
+                    bool compatDemangling);
+    void SetCacheKey(std::wstring_view cacheKey);
+    void AddHook(const WH_SYMBOL_HOOK& hook);
+
+    // Events can be added from any thread, e.g. from download progress
+    // callbacks.
+    void AddEvent(PCSTR event, std::wstring_view detail = {});
+    void AddEvent(PCSTR event, std::string_view detail);
+    void AddPhaseDuration(PCSTR phase, ULONGLONG durationMs);
+
+    // Writes the file. Errors are logged.
+    void Write(bool succeeded) noexcept;
+
+   private:
+    static constexpr size_t kMaxFileCount = 100;
+    // Symbol server events are repeated for each retry and progress update,
+    // so cap their amount in case of a long download.
+    static constexpr size_t kMaxEventCount = 4096;
+
+    DWORD GetElapsedMs() const;
+
+    std::wstring m_modName;
+    ULONGLONG m_startTickCount;
+    FILETIME m_startTime;
+    // The JSON members which are known upfront, without the braces.
+    std::wstring m_header;
+    std::wstring m_hooks;
+    std::mutex m_eventsMutex;
+    std::wstring m_events;
+    size_t m_eventCount = 0;
+    size_t m_droppedEventCount = 0;
+    std::wstring m_phases;
+};
@@ -0,0 +1,31 @@
+#include "stdafx.h"
+
+#include "targeting_dry_run.h"
+
+#include "dll_inject.h"
+#include "process_lists.h"
+#include "storage_manager.h"
+
+TargetingDryRun::TargetingDryRun() {
+    auto settings = StorageManager::GetInstance().GetAppConfig(L"Settings");
+
+    m_includePattern =
+        PathPattern(settings->GetString(L"Include").value_or(L""));
+    m_excludePattern =
+        PathPattern(ProcessLists::GetInjectionExcludePattern(*settings));
+}
+
+TargetingDryRun::Result TargetingDryRun::Evaluate(HANDLE process) const {
+    PathPattern::Path processPath(
+        wil::QueryFullProcessImageName<std::wstring>(process));
+    USHORT processMachine = DllInject::GetProcessArch(process);
+
+    // The same check as ShouldSkipNewProcess of the injectors.
+    bool excluded = m_excludePattern.Matches(processPath) &&
+                    !m_includePattern.Matches(processPath);
+
+    return {
+        .excluded = excluded,
+        .modNames = m_modTargets.GetMatchingMods(processPath, processMachine),
+    };
+}
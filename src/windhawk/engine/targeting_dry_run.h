@@ -0,0 +1,34 @@
+#pragma once
+
+#include "mod_targets.h"
+
+// Evaluates the injection settings and the targeting of all enabled mods for a
+// running process, without injecting into it, e.g. to find out how many
+// processes a mod with broad Include patterns would be loaded into before
+// rolling it out. The checks are the ones of the injectors and of ModTargets,
+// so a mod which might be loaded in a process, e.g. since its patterns have
+// user-specific environment variables, is reported as loaded. The settings are
+// read once on construction.
+class TargetingDryRun {
+   public:
+    TargetingDryRun();
+
+    TargetingDryRun(const TargetingDryRun&) = delete;
+    TargetingDryRun& operator=(const TargetingDryRun&) = delete;
+
+    struct Result {
+        // Whether the engine isn't injected into the process, in which case
+        // the mods are listed but aren't loaded.
+        bool excluded;
+        std::vector<std::wstring> modNames;
+    };
+
+    // The process handle must have the PROCESS_QUERY_LIMITED_INFORMATION
+    // access right.
+    Result Evaluate(HANDLE process) const;
+
+   private:
+    PathPattern m_includePattern;
+    PathPattern m_excludePattern;
+    ModTargets m_modTargets;
+};
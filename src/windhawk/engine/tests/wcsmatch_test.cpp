@@ -0,0 +1,181 @@
+// A differential test of Functions::wcsmatch against the recursive matcher
+// which it replaced. Random patterns and strings are matched with both, and
+// any difference is reported. Patterns include runs of '*' and '?', and
+// literals which don't appear in the string, which cover the shortcuts of the
+// iterative matcher. The time of both matchers is also printed for a pattern
+// which is a worst case for the recursive one.
+//
+// Not part of the engine project. To build and run it, from a developer
+// command prompt in this folder:
+//
+//   cl /std:c++20 /EHsc /O2 /I.. /I..\libraries /I..\..\shared
+//      /I..\..\shared\libraries wcsmatch_test.cpp ..\functions.cpp
+//      ..\path_pattern.cpp ntdll.lib version.lib
+//   wcsmatch_test.exe [iterations] [seed]
+
+#include "stdafx.h"
+
+#include "functions.h"
+
+#include <chrono>
+#include <random>
+
+namespace {
+
+// The recursive matcher which was used before, for reference.
+bool wcsmatchRecursive(PCWSTR pat, size_t plen, PCWSTR str, size_t slen) {
+    while (plen > 0) {
+        if (pat[0] == L'*') {
+            if (plen == 1)
+                return true;
+            if (pat[1] == L'*') {
+                pat++;
+                plen--;
+                continue;
+            }
+            if (wcsmatchRecursive(pat + 1, plen - 1, str, slen))
+                return true;
+            if (slen == 0)
+                return false;
+            str++;
+            slen--;
+            continue;
+        }
+        if (slen == 0)
+            return false;
+        if (pat[0] != L'?' && str[0] != pat[0])
+            return false;
+        pat++;
+        plen--;
+        str++;
+        slen--;
+    }
+    return slen == 0 && plen == 0;
+}
+
+class RandomInput {
+   public:
+    explicit RandomInput(unsigned int seed) : m_engine(seed) {}
+
+    // Strings use a small alphabet, so that literals of the pattern are often
+    // found, and sometimes not.
+    std::wstring MakeString() {
+        std::wstring result(Uniform(0, 24), L'\0');
+        for (auto& c : result) {
+            c = static_cast<WCHAR>(L'a' + Uniform(0, 2));
+        }
+        return result;
+    }
+
+    // Patterns also contain 'd', which never appears in the strings.
+    std::wstring MakePattern() {
+        std::wstring result;
+        size_t parts = Uniform(0, 8);
+        for (size_t i = 0; i < parts; i++) {
+            switch (Uniform(0, 5)) {
+                case 0:
+                case 1:
+                    result.append(Uniform(1, 3), L'*');
+                    break;
+
+                case 2:
+                    result.append(Uniform(1, 3), L'?');
+                    break;
+
+                case 3:
+                    result += L'd';
+                    break;
+
+                default:
+                    for (size_t j = Uniform(1, 3); j > 0; j--) {
+                        result += static_cast<WCHAR>(L'a' + Uniform(0, 2));
+                    }
+                    break;
+            }
+        }
+        return result;
+    }
+
+   private:
+    size_t Uniform(size_t min, size_t max) {
+        return std::uniform_int_distribution<size_t>(min, max)(m_engine);
+    }
+
+    std::mt19937 m_engine;
+};
+
+bool RunCase(const std::wstring& pattern, const std::wstring& string) {
+    bool expected = wcsmatchRecursive(pattern.data(), pattern.length(),
+                                      string.data(), string.length());
+    bool actual = Functions::wcsmatch(pattern.data(), pattern.length(),
+                                      string.data(), string.length());
+    if (actual != expected) {
+        wprintf(L"Mismatch: pattern \"%s\", string \"%s\": expected %d, got "
+                L"%d\n",
+                pattern.c_str(), string.c_str(), expected, actual);
+        return false;
+    }
+
+    return true;
+}
+
+template <typename Matcher>
+double MeasureMilliseconds(Matcher matcher,
+                           const std::wstring& pattern,
+                           const std::wstring& string) {
+    auto start = std::chrono::steady_clock::now();
+    bool matched = matcher(pattern.data(), pattern.length(), string.data(),
+                           string.length());
+    auto end = std::chrono::steady_clock::now();
+
+    // Keep the result used, so that the call isn't optimized away.
+    if (matched) {
+        wprintf(L"Unexpected match\n");
+    }
+
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+}  // namespace
+
+int wmain(int argc, PWSTR argv[]) {
+    size_t iterations = argc > 1 ? wcstoul(argv[1], nullptr, 10) : 1000000;
+    unsigned int seed = argc > 2 ? wcstoul(argv[2], nullptr, 10) : 1;
+
+    size_t failures = 0;
+
+    const std::pair<PCWSTR, PCWSTR> fixedCases[] = {
+        {L"", L""},         {L"*", L""},          {L"**", L""},
+        {L"?", L""},        {L"*?", L""},         {L"", L"a"},
+        {L"a", L"a"},       {L"a*", L"a"},        {L"*a", L"ba"},
+        {L"*a*", L"bcb"},   {L"*a*b", L"aab"},    {L"*ab", L"aaab"},
+        {L"a**b", L"acb"},  {L"*?*?", L"a"},      {L"*?*?", L"ab"},
+        {L"*a?", L"aa"},    {L"*ab*ab", L"abab"}, {L"*d", L"abc"},
+        {L"a*d*", L"abc"},  {L"?*?", L"ab"},      {L"*b*c", L"abbbc"},
+        {L"*b", L"bbbba"},  {L"*aa", L"abaa"},    {L"***?a", L"ba"},
+    };
+    for (const auto& [pattern, string] : fixedCases) {
+        if (!RunCase(pattern, string)) {
+            failures++;
+        }
+    }
+
+    RandomInput randomInput(seed);
+    for (size_t i = 0; i < iterations; i++) {
+        if (!RunCase(randomInput.MakePattern(), randomInput.MakeString())) {
+            failures++;
+        }
+    }
+
+    // A pattern which doesn't match, and makes the recursive matcher retry
+    // each '*' at each position.
+    std::wstring slowPattern = L"*a*a*a*a*a*a*a*b";
+    std::wstring slowString(40, L'a');
+    wprintf(L"Worst case: recursive %.3f ms, iterative %.3f ms\n",
+            MeasureMilliseconds(wcsmatchRecursive, slowPattern, slowString),
+            MeasureMilliseconds(Functions::wcsmatch, slowPattern, slowString));
+
+    wprintf(L"%zu cases, %zu failures (seed %u)\n",
+            ARRAYSIZE(fixedCases) + iterations, failures, seed);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,179 @@
+#include "stdafx.h"
+
+#include "thread_call.h"
+
+namespace {
+
+// Avoid having user32.dll in the import table.
+using SetWindowsHookExW_t = decltype(&SetWindowsHookExW);
+using UnhookWindowsHookEx_t = decltype(&UnhookWindowsHookEx);
+using CallNextHookEx_t = decltype(&CallNextHookEx);
+using PostThreadMessageW_t = decltype(&PostThreadMessageW);
+using RegisterWindowMessageW_t = decltype(&RegisterWindowMessageW);
+using MsgWaitForMultipleObjects_t = decltype(&MsgWaitForMultipleObjects);
+using PeekMessageW_t = decltype(&PeekMessageW);
+
+// Set before the first hook is installed, used by the hook procedure.
+constinit std::atomic<CallNextHookEx_t> g_pCallNextHookEx = nullptr;
+constinit std::atomic<UINT> g_message = 0;
+
+}  // namespace
+
+struct ThreadCall::Request {
+    enum class State {
+        kPending,
+        kRunning,
+        kDone,
+        kCanceled,
+    };
+
+    Callback callback;
+    void* context;
+    std::atomic<State> state = State::kPending;
+    // Held by the caller and by the posted message. The message might never
+    // be retrieved if the call times out, in which case the request is
+    // leaked, since it can't be known whether the message is still queued.
+    std::atomic<int> refCount = 2;
+    wil::unique_event doneEvent{wil::EventOptions::ManualReset};
+
+    void Release() {
+        if (--refCount == 0) {
+            delete this;
+        }
+    }
+};
+
+// static
+bool ThreadCall::Run(DWORD threadId,
+                     Callback callback,
+                     void* context,
+                     DWORD timeout) {
+    if (threadId == GetCurrentThreadId()) {
+        callback(context);
+        return true;
+    }
+
+    HMODULE user32 = GetModuleHandle(L"user32.dll");
+    if (!user32) {
+        throw std::runtime_error(
+            "user32.dll isn't loaded, the process has no UI threads");
+    }
+
+    auto getProc = [user32](auto* ptr, PCSTR name) {
+        *ptr = reinterpret_cast<std::remove_pointer_t<decltype(ptr)>>(
+            GetProcAddress(user32, name));
+        THROW_LAST_ERROR_IF_NULL(*ptr);
+    };
+
+    SetWindowsHookExW_t pSetWindowsHookExW;
+    UnhookWindowsHookEx_t pUnhookWindowsHookEx;
+    CallNextHookEx_t pCallNextHookEx;
+    PostThreadMessageW_t pPostThreadMessageW;
+    RegisterWindowMessageW_t pRegisterWindowMessageW;
+    MsgWaitForMultipleObjects_t pMsgWaitForMultipleObjects;
+    PeekMessageW_t pPeekMessageW;
+    getProc(&pSetWindowsHookExW, "SetWindowsHookExW");
+    getProc(&pUnhookWindowsHookEx, "UnhookWindowsHookEx");
+    getProc(&pCallNextHookEx, "CallNextHookEx");
+    getProc(&pPostThreadMessageW, "PostThreadMessageW");
+    getProc(&pRegisterWindowMessageW, "RegisterWindowMessageW");
+    getProc(&pMsgWaitForMultipleObjects, "MsgWaitForMultipleObjects");
+    getProc(&pPeekMessageW, "PeekMessageW");
+
+    UINT message = g_message;
+    if (!message) {
+        message = pRegisterWindowMessageW(L"Windhawk_ThreadCall");
+        THROW_LAST_ERROR_IF(!message);
+        g_message = message;
+    }
+
+    g_pCallNextHookEx = pCallNextHookEx;
+
+    HHOOK hook = pSetWindowsHookExW(WH_GETMESSAGE, GetMessageHookProc,
+                                    nullptr, threadId);
+    THROW_LAST_ERROR_IF_NULL(hook);
+
+    auto hookCleanup = wil::scope_exit(
+        [pUnhookWindowsHookEx, hook] { pUnhookWindowsHookEx(hook); });
+
+    auto* request = new Request{
+        .callback = callback,
+        .context = context,
+    };
+
+    auto requestRelease = wil::scope_exit([request] { request->Release(); });
+
+    if (!pPostThreadMessageW(threadId, message, kMessageCookie,
+                             reinterpret_cast<LPARAM>(request))) {
+        DWORD error = GetLastError();
+        request->Release();
+        THROW_WIN32(error);
+    }
+
+    HANDLE doneEvent = request->doneEvent.get();
+    ULONGLONG startTime = GetTickCount64();
+
+    while (true) {
+        DWORD waitTime = INFINITE;
+        if (timeout != INFINITE) {
+            ULONGLONG elapsed = GetTickCount64() - startTime;
+            waitTime =
+                elapsed < timeout ? static_cast<DWORD>(timeout - elapsed) : 0;
+        }
+
+        DWORD waitResult = pMsgWaitForMultipleObjects(
+            1, &doneEvent, FALSE, waitTime, QS_SENDMESSAGE);
+        if (waitResult == WAIT_OBJECT_0) {
+            return true;
+        }
+
+        if (waitResult == WAIT_OBJECT_0 + 1) {
+            // Dispatches the sent messages without removing posted ones.
+            MSG msg;
+            pPeekMessageW(&msg, nullptr, 0, 0, PM_NOREMOVE | PM_QS_SENDMESSAGE);
+            continue;
+        }
+
+        THROW_LAST_ERROR_IF(waitResult != WAIT_TIMEOUT);
+
+        auto expected = Request::State::kPending;
+        if (request->state.compare_exchange_strong(expected,
+                                                   Request::State::kCanceled)) {
+            return false;
+        }
+
+        // The callback already started, and might use the context, so it's
+        // waited for regardless of the timeout.
+        timeout = INFINITE;
+    }
+}
+
+// static
+LRESULT CALLBACK ThreadCall::GetMessageHookProc(int code,
+                                                WPARAM wParam,
+                                                LPARAM lParam) {
+    UINT message = g_message;
+    if (code == HC_ACTION && wParam == PM_REMOVE && message) {
+        auto* msg = reinterpret_cast<MSG*>(lParam);
+        if (!msg->hwnd && msg->message == message &&
+            msg->wParam == kMessageCookie) {
+            auto* request = reinterpret_cast<Request*>(msg->lParam);
+
+            // Hidden from the other hooks, such as those of other pending
+            // calls, and from the message loop of the thread.
+            msg->message = WM_NULL;
+
+            auto expected = Request::State::kPending;
+            if (request->state.compare_exchange_strong(
+                    expected, Request::State::kRunning)) {
+                request->callback(request->context);
+                request->state = Request::State::kDone;
+                request->doneEvent.SetEvent();
+            }
+
+            request->Release();
+        }
+    }
+
+    return g_pCallNextHookEx.load()(nullptr, code, wParam, lParam);
+}
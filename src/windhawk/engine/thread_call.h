@@ -0,0 +1,39 @@
+#pragma once
+
+// Runs a callback on another thread of the current process, from the message
+// loop of that thread, e.g. to update a window from the thread which owns it.
+// A WH_GETMESSAGE hook is installed on the thread only while a call is
+// pending, and a thread message is posted for it, so that no window is needed
+// and no hook stays in the chain of the thread. Each mod which does it on its
+// own usually keeps a hidden window or a hook per thread instead.
+//
+// The thread must have a message queue, and the callback only runs once the
+// thread retrieves a message. user32.dll is used dynamically, since the engine
+// doesn't depend on it, and a process without UI threads might not load it.
+class ThreadCall {
+   public:
+    using Callback = void (*)(void* context);
+
+    ThreadCall() = delete;
+
+    // Waits for the callback to return. Returns false if the timeout elapsed
+    // before the thread retrieved the message, in which case the callback
+    // isn't called. Messages sent to the calling thread are processed while
+    // waiting, to avoid a deadlock if the thread sends one meanwhile. Throws
+    // on errors.
+    static bool Run(DWORD threadId,
+                    Callback callback,
+                    void* context,
+                    DWORD timeout);
+
+   private:
+    struct Request;
+
+    // The posted message is a registered message, with this value as wParam
+    // and the request as lParam.
+    static constexpr WPARAM kMessageCookie = 0x57484354;  // "WHCT"
+
+    static LRESULT CALLBACK GetMessageHookProc(int code,
+                                               WPARAM wParam,
+                                               LPARAM lParam);
+};
@@ -0,0 +1,153 @@
+#include "stdafx.h"
+
+#include "trace_events.h"
+
+TRACELOGGING_DEFINE_PROVIDER(
+    g_traceEventsProvider,
+    "Windhawk.Engine",
+    // {0438a5b9-81ba-548c-e672-82a8f97c75e1}, derived from the name.
+    (0x0438a5b9,
+     0x81ba,
+     0x548c,
+     0xe6,
+     0x72,
+     0x82,
+     0xa8,
+     0xf9,
+     0x7c,
+     0x75,
+     0xe1));
+
+namespace {
+
+LONGLONG GetPerformanceCounter() {
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart;
+}
+
+ULONGLONG CounterToMicroseconds(LONGLONG counter) {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    return static_cast<ULONGLONG>(counter) * 1000000 / frequency.QuadPart;
+}
+
+PCSTR GetHookingEngineName() {
+#if defined(WH_HOOKING_ENGINE_MINHOOK_DETOURS)
+    return "MinHook-Detours";
+#elif defined(WH_HOOKING_ENGINE_MINHOOK)
+    return "MinHook";
+#else
+    return "Unknown";
+#endif
+}
+
+UINT CountProcessThreads() {
+    wil::unique_handle snapshot(CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0));
+    if (!snapshot) {
+        return 0;
+    }
+
+    DWORD processId = GetCurrentProcessId();
+    UINT count = 0;
+
+    THREADENTRY32 entry = {sizeof(entry)};
+    for (BOOL found = Thread32First(snapshot.get(), &entry); found;
+         found = Thread32Next(snapshot.get(), &entry)) {
+        if (entry.th32OwnerProcessID == processId) {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+}  // namespace
+
+namespace TraceEvents {
+
+void Register() noexcept {
+    TraceLoggingRegister(g_traceEventsProvider);
+}
+
+void Unregister() noexcept {
+    // Must be done before the engine is unloaded, ETW keeps a pointer to the
+    // provider.
+    TraceLoggingUnregister(g_traceEventsProvider);
+}
+
+ScopedPhase::ScopedPhase(PCSTR phaseName, PCWSTR modName) noexcept
+    : m_phaseName(phaseName), m_modName(modName ? modName : L"") {
+    if (!TraceLoggingProviderEnabled(g_traceEventsProvider,
+                                     WINEVENT_LEVEL_INFO, 0)) {
+        return;
+    }
+
+    TraceLoggingWrite(g_traceEventsProvider, "PhaseStart",
+                      TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+                      TraceLoggingOpcode(WINEVENT_OPCODE_START),
+                      TraceLoggingString(m_phaseName, "Phase"),
+                      TraceLoggingWideString(m_modName, "Mod"));
+
+    m_startCounter = GetPerformanceCounter();
+}
+
+ScopedPhase::~ScopedPhase() {
+    if (!m_startCounter) {
+        return;
+    }
+
+    ULONGLONG durationUs =
+        CounterToMicroseconds(GetPerformanceCounter() - m_startCounter);
+
+    TraceLoggingWrite(g_traceEventsProvider, "PhaseStop",
+                      TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+                      TraceLoggingOpcode(WINEVENT_OPCODE_STOP),
+                      TraceLoggingString(m_phaseName, "Phase"),
+                      TraceLoggingWideString(m_modName, "Mod"),
+                      TraceLoggingUInt64(durationUs, "DurationUs"));
+}
+
+void ConfigChangeApplied(DWORD generation,
+                         ULONGLONG latencyUs,
+                         ULONG64 cpuCycles,
+                         ULONGLONG settingsReads) noexcept {
+    TraceLoggingWrite(g_traceEventsProvider, "ConfigChangeApplied",
+                      TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+                      TraceLoggingUInt32(generation, "Generation"),
+                      TraceLoggingUInt64(latencyUs, "LatencyUs"),
+                      TraceLoggingUInt64(cpuCycles, "CpuCycles"),
+                      TraceLoggingUInt64(settingsReads, "SettingsReads"));
+}
+
+ScopedHookApply::ScopedHookApply(UINT modCount) noexcept
+    : m_modCount(modCount) {
+    if (!TraceLoggingProviderEnabled(g_traceEventsProvider,
+                                     WINEVENT_LEVEL_INFO, 0)) {
+        return;
+    }
+
+    // Counted before the threads are frozen, so that it doesn't add to the
+    // measured duration.
+    m_threadCount = CountProcessThreads();
+
+    m_startCounter = GetPerformanceCounter();
+}
+
+ScopedHookApply::~ScopedHookApply() {
+    if (!m_startCounter) {
+        return;
+    }
+
+    ULONGLONG durationUs =
+        CounterToMicroseconds(GetPerformanceCounter() - m_startCounter);
+
+    TraceLoggingWrite(g_traceEventsProvider, "HookApply",
+                      TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+                      TraceLoggingString(GetHookingEngineName(), "Engine"),
+                      TraceLoggingUInt32(m_modCount, "ModCount"),
+                      TraceLoggingUInt32(m_threadCount, "ThreadCount"),
+                      TraceLoggingUInt64(durationUs, "DurationUs"));
+}
+
+}  // namespace TraceEvents
@@ -0,0 +1,65 @@
+#pragma once
+
+// Structured trace events of the engine, written with TraceLogging to the
+// "Windhawk.Engine" ETW provider, {0438a5b9-81ba-548c-e672-82a8f97c75e1}. The
+// lifecycle phases of the engine, such as loading and initializing mods,
+// resolving symbols and applying hooks, are written as start and stop events,
+// which WPA shows as regions. The process and thread IDs are part of each
+// event. Events are only formatted while a trace session listens to the
+// provider.
+namespace TraceEvents {
+
+// Must be called from DllMain, so that the provider is registered for the
+// whole time the engine is loaded.
+void Register() noexcept;
+void Unregister() noexcept;
+
+// Writes a start event on construction, and a stop event with the duration
+// of the phase on destruction. The strings must outlive the object.
+class ScopedPhase {
+   public:
+    explicit ScopedPhase(PCSTR phaseName, PCWSTR modName = nullptr) noexcept;
+    ~ScopedPhase();
+
+    ScopedPhase(const ScopedPhase&) = delete;
+    ScopedPhase& operator=(const ScopedPhase&) = delete;
+
+   private:
+    PCSTR m_phaseName;
+    PCWSTR m_modName;
+    // Zero if the provider wasn't enabled on construction.
+    LONGLONG m_startCounter = 0;
+};
+
+// Writes an event once the mods are reloaded for a published mod config
+// snapshot, with the time since it was published and the CPU time and
+// settings reads of the reload. Together with the events of the other
+// processes, it shows how long a config change takes to reach all engines and
+// how much it costs in total.
+void ConfigChangeApplied(DWORD generation,
+                         ULONGLONG latencyUs,
+                         ULONG64 cpuCycles,
+                         ULONGLONG settingsReads) noexcept;
+
+// Writes an event on destruction with the duration of applying the queued
+// hook operations of one or more mods, which is about as long as the threads
+// of the process stay frozen. The hooking engine and the amount of threads in
+// the process are part of the event, so that traces of both hooking engines
+// can be compared.
+class ScopedHookApply {
+   public:
+    // A mod count of zero means all mods.
+    explicit ScopedHookApply(UINT modCount) noexcept;
+    ~ScopedHookApply();
+
+    ScopedHookApply(const ScopedHookApply&) = delete;
+    ScopedHookApply& operator=(const ScopedHookApply&) = delete;
+
+   private:
+    UINT m_modCount;
+    UINT m_threadCount = 0;
+    // Zero if the provider wasn't enabled on construction.
+    LONGLONG m_startCounter = 0;
+};
+
+}  // namespace TraceEvents
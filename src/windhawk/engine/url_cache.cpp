@@ -0,0 +1,343 @@
+#include "stdafx.h"
+
+#include "url_cache.h"
+
+#include "functions.h"
+#include "logger.h"
+#include "storage_manager.h"
+
+namespace {
+
+constexpr DWORD kMagic = 0x43554857;  // "WHUC"
+constexpr DWORD kVersion = 1;
+
+// Larger contents, e.g. downloads of big files, aren't cached.
+constexpr size_t kMaxCachedContentSize = 16 * 1024 * 1024;
+
+constexpr DWORD kNoMaxAge = 0xFFFFFFFF;
+
+constexpr DWORD kFlagNoCache = 0x01;
+
+// Followed by the URL, the ETag and the Last-Modified value, all UTF-16, and
+// the content.
+struct Header {
+    DWORD magic;
+    DWORD version;
+    // When the content was received or last revalidated, as a FILETIME.
+    ULONGLONG storedTime;
+    // In seconds, from the Cache-Control max-age directive.
+    DWORD serverMaxAge;
+    DWORD flags;
+    DWORD urlLength;
+    DWORD etagLength;
+    DWORD lastModifiedLength;
+    DWORD reserved;
+    ULONGLONG dataLength;
+};
+
+struct Entry {
+    ULONGLONG storedTime;
+    DWORD serverMaxAge;
+    DWORD flags;
+    std::wstring etag;
+    std::wstring lastModified;
+    std::string data;
+};
+
+struct CacheControl {
+    bool noStore = false;
+    bool noCache = false;
+    DWORD maxAge = kNoMaxAge;
+};
+
+CacheControl ParseCacheControl(std::wstring_view value) {
+    CacheControl result;
+
+    for (auto directive : Functions::SplitStringToViews(value, L',')) {
+        while (!directive.empty() && iswspace(directive.front())) {
+            directive.remove_prefix(1);
+        }
+
+        while (!directive.empty() && iswspace(directive.back())) {
+            directive.remove_suffix(1);
+        }
+
+        auto startsWith = [directive](std::wstring_view prefix) {
+            return directive.length() >= prefix.length() &&
+                   _wcsnicmp(directive.data(), prefix.data(),
+                             prefix.length()) == 0;
+        };
+
+        constexpr std::wstring_view kMaxAgePrefix = L"max-age=";
+
+        if (startsWith(L"no-store")) {
+            result.noStore = true;
+        } else if (startsWith(L"no-cache")) {
+            // The qualified form, which only applies to the listed headers,
+            // is treated as the unqualified one.
+            result.noCache = true;
+        } else if (startsWith(kMaxAgePrefix)) {
+            std::wstring maxAge(directive.substr(kMaxAgePrefix.length()));
+            ULONGLONG maxAgeValue = wcstoull(maxAge.c_str(), nullptr, 10);
+            result.maxAge = static_cast<DWORD>(
+                std::min(maxAgeValue, ULONGLONG{kNoMaxAge - 1}));
+        }
+    }
+
+    return result;
+}
+
+std::filesystem::path GetEntryPath(PCWSTR modName, std::wstring_view url) {
+    // FNV-1a, the same as SymbolIndex::HashName. The URL is stored in the
+    // entry, so that collisions are detected.
+    ULONGLONG hash = 14695981039346656037ULL;
+    for (WCHAR c : url) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+
+    WCHAR fileName[sizeof("0123456789abcdef.cache")];
+    swprintf_s(fileName, L"%016I64x.cache", hash);
+
+    return StorageManager::GetInstance().GetModUrlCachePath(modName) /
+           fileName;
+}
+
+std::optional<Entry> ReadEntry(const std::filesystem::path& path,
+                               std::wstring_view url) {
+    wil::unique_hfile file(CreateFile(
+        path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+    if (!file) {
+        return std::nullopt;
+    }
+
+    LARGE_INTEGER fileSize;
+    THROW_IF_WIN32_BOOL_FALSE(GetFileSizeEx(file.get(), &fileSize));
+    if (fileSize.QuadPart < static_cast<LONGLONG>(sizeof(Header)) ||
+        fileSize.QuadPart > static_cast<LONGLONG>(kMaxCachedContentSize * 2)) {
+        return std::nullopt;
+    }
+
+    std::vector<BYTE> buffer(static_cast<size_t>(fileSize.QuadPart));
+    DWORD read;
+    THROW_IF_WIN32_BOOL_FALSE(ReadFile(file.get(), buffer.data(),
+                                       static_cast<DWORD>(buffer.size()), &read,
+                                       nullptr));
+    if (read != buffer.size()) {
+        return std::nullopt;
+    }
+
+    Header header;
+    memcpy(&header, buffer.data(), sizeof(header));
+    if (header.magic != kMagic || header.version != kVersion) {
+        return std::nullopt;
+    }
+
+    ULONGLONG stringsSize = (ULONGLONG{header.urlLength} + header.etagLength +
+                             header.lastModifiedLength) *
+                            sizeof(WCHAR);
+    if (sizeof(Header) + stringsSize + header.dataLength != buffer.size()) {
+        return std::nullopt;
+    }
+
+    const BYTE* p = buffer.data() + sizeof(Header);
+    auto readString = [&p](DWORD length) {
+        std::wstring value(length, L'\0');
+        memcpy(value.data(), p, length * sizeof(WCHAR));
+        p += length * sizeof(WCHAR);
+        return value;
+    };
+
+    if (readString(header.urlLength) != url) {
+        return std::nullopt;
+    }
+
+    Entry entry{
+        .storedTime = header.storedTime,
+        .serverMaxAge = header.serverMaxAge,
+        .flags = header.flags,
+    };
+    entry.etag = readString(header.etagLength);
+    entry.lastModified = readString(header.lastModifiedLength);
+    entry.data.assign(reinterpret_cast<const char*>(p),
+                      static_cast<size_t>(header.dataLength));
+
+    return entry;
+}
+
+void WriteEntry(const std::filesystem::path& path,
+                std::wstring_view url,
+                const Entry& entry) {
+    Header header{
+        .magic = kMagic,
+        .version = kVersion,
+        .storedTime = entry.storedTime,
+        .serverMaxAge = entry.serverMaxAge,
+        .flags = entry.flags,
+        .urlLength = wil::safe_cast<DWORD>(url.length()),
+        .etagLength = wil::safe_cast<DWORD>(entry.etag.length()),
+        .lastModifiedLength =
+            wil::safe_cast<DWORD>(entry.lastModified.length()),
+        .dataLength = entry.data.size(),
+    };
+
+    // Write to a temporary file first and then move it into place, so that
+    // other processes never see a partially written entry.
+    std::filesystem::path tempPath = path;
+    tempPath += L".tmp" + std::to_wstring(GetCurrentProcessId()) + L"_" +
+                std::to_wstring(GetCurrentThreadId());
+
+    {
+        wil::unique_hfile file(CreateFile(tempPath.c_str(), GENERIC_WRITE, 0,
+                                          nullptr, CREATE_ALWAYS,
+                                          FILE_ATTRIBUTE_NORMAL, nullptr));
+        if (!file) {
+            VERBOSE(L"Couldn't create URL cache entry %s: %u",
+                    tempPath.c_str(), GetLastError());
+            return;
+        }
+
+        auto writeData = [&file](const void* data, size_t size) {
+            DWORD written;
+            return WriteFile(file.get(), data, wil::safe_cast<DWORD>(size),
+                             &written, nullptr) &&
+                   written == size;
+        };
+
+        if (!writeData(&header, sizeof(header)) ||
+            !writeData(url.data(), url.length() * sizeof(WCHAR)) ||
+            !writeData(entry.etag.data(),
+                       entry.etag.length() * sizeof(WCHAR)) ||
+            !writeData(entry.lastModified.data(),
+                       entry.lastModified.length() * sizeof(WCHAR)) ||
+            !writeData(entry.data.data(), entry.data.size())) {
+            VERBOSE(L"Couldn't write URL cache entry %s: %u",
+                    tempPath.c_str(), GetLastError());
+            file.reset();
+            DeleteFile(tempPath.c_str());
+            return;
+        }
+    }
+
+    if (!MoveFileEx(tempPath.c_str(), path.c_str(),
+                    MOVEFILE_REPLACE_EXISTING)) {
+        // Most likely, another process is writing or reading the entry.
+        VERBOSE(L"Couldn't move URL cache entry into place: %u",
+                GetLastError());
+        DeleteFile(tempPath.c_str());
+    }
+}
+
+HttpClient::Response MakeResponse(DWORD statusCode,
+                                  std::string data,
+                                  HANDLE targetFile) {
+    HttpClient::Response response{
+        .statusCode = statusCode,
+        .length = data.size(),
+    };
+
+    if (targetFile) {
+        DWORD written = 0;
+        THROW_IF_WIN32_BOOL_FALSE(
+            WriteFile(targetFile, data.data(),
+                      wil::safe_cast<DWORD>(data.size()), &written, nullptr));
+        THROW_WIN32_IF(ERROR_WRITE_FAULT, written != data.size());
+    } else {
+        response.data = std::move(data);
+    }
+
+    return response;
+}
+
+}  // namespace
+
+namespace UrlCache {
+
+HttpClient::Response Get(PCWSTR modName,
+                         PCWSTR url,
+                         DWORD maxAge,
+                         HANDLE targetFile) {
+    auto entryPath = GetEntryPath(modName, url);
+    ULONGLONG currentTime =
+        wil::filetime::to_int64(wil::filetime::get_system_time());
+
+    std::optional<Entry> entry;
+    try {
+        entry = ReadEntry(entryPath, url);
+    } catch (const std::exception& e) {
+        VERBOSE(L"Reading URL cache entry %s failed: %S", entryPath.c_str(),
+                e.what());
+    }
+
+    if (entry) {
+        ULONGLONG age =
+            currentTime > entry->storedTime
+                ? (currentTime - entry->storedTime) /
+                      wil::filetime_duration::one_second
+                : 0;
+        if (!(entry->flags & kFlagNoCache) && age <= maxAge &&
+            age <= entry->serverMaxAge) {
+            VERBOSE(L"Using cached content, %I64u seconds old", age);
+            return MakeResponse(200, std::move(entry->data), targetFile);
+        }
+    }
+
+    HttpClient::RequestOptions options;
+    if (entry) {
+        options.ifNoneMatch = entry->etag;
+        options.ifModifiedSince = entry->lastModified;
+    }
+
+    // Received into memory rather than into the target file, so that it can
+    // be cached. Without a cancellation callback, a response is always
+    // returned.
+    auto response =
+        *HttpClient::GetInstance().Get(url, nullptr, nullptr, options);
+
+    if (response.statusCode == 304 && entry) {
+        VERBOSE(L"Cached content is still valid");
+
+        // The 304 response may update the caching headers.
+        if (!response.cacheControl.empty()) {
+            auto cacheControl = ParseCacheControl(response.cacheControl);
+            entry->serverMaxAge = cacheControl.maxAge;
+            entry->flags = cacheControl.noCache ? kFlagNoCache : 0;
+        }
+
+        if (!response.etag.empty()) {
+            entry->etag = std::move(response.etag);
+        }
+
+        entry->storedTime = currentTime;
+        WriteEntry(entryPath, url, *entry);
+
+        return MakeResponse(200, std::move(entry->data), targetFile);
+    }
+
+    if (response.statusCode == 200) {
+        auto cacheControl = ParseCacheControl(response.cacheControl);
+        if (!cacheControl.noStore &&
+            response.data.size() <= kMaxCachedContentSize) {
+            Entry newEntry{
+                .storedTime = currentTime,
+                .serverMaxAge = cacheControl.maxAge,
+                .flags = cacheControl.noCache ? kFlagNoCache : 0,
+                .etag = std::move(response.etag),
+                .lastModified = std::move(response.lastModified),
+                .data = std::move(response.data),
+            };
+            WriteEntry(entryPath, url, newEntry);
+            return MakeResponse(200, std::move(newEntry.data), targetFile);
+        }
+
+        if (entry) {
+            DeleteFile(entryPath.c_str());
+        }
+    }
+
+    return MakeResponse(response.statusCode, std::move(response.data),
+                        targetFile);
+}
+
+}  // namespace UrlCache
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "http_client.h"
+
+// A cache of URL contents for Wh_GetUrlContent, with a file per URL in a
+// folder of the mod next to its storage folder, so that it's shared by all
+// processes which the mod is loaded in. Only successful responses are cached.
+// The Cache-Control response header is honored: no-store responses aren't
+// cached, no-cache responses are always revalidated, and a cached copy isn't
+// used for longer than its max-age. Stale copies are revalidated with the
+// ETag and Last-Modified headers, in which case the content isn't downloaded
+// again if it didn't change.
+namespace UrlCache {
+
+// Returns the content of the URL, from the cache if it's at most maxAge
+// seconds old. Otherwise, it's requested and the cache is updated. If
+// targetFile isn't null, the content is written to it instead of being
+// returned in the response data. Throws on errors.
+HttpClient::Response Get(PCWSTR modName,
+                         PCWSTR url,
+                         DWORD maxAge,
+                         HANDLE targetFile);
+
+}  // namespace UrlCache
@@ -4,14 +4,38 @@
 // thread-safe manner while avoiding TLS, which is what MSVC uses for static
 // variables.
 
+// Like std::once_flag with std::call_once, but once the initialization is done,
+// a call is a single acquire load. std::call_once goes through
+// InitOnceBeginInitialize on every call, which adds up for accessors which are
+// called for each logged line. Constant-initialized, so it can be used for a
+// static variable without a guard.
+class StaticInitOnceFlag {
+   public:
+    template <typename F>
+    void Call(F&& f) {
+        if (m_done.load(std::memory_order_acquire)) {
+            return;
+        }
+
+        std::call_once(m_flag, [this, &f]() {
+            f();
+            m_done.store(true, std::memory_order_release);
+        });
+    }
+
+   private:
+    std::once_flag m_flag;
+    std::atomic<bool> m_done = false;
+};
+
 // Similar to:
 // static T var_name(...);
 #define STATIC_INIT_ONCE(T, var_name, ...)                                 \
     T* var_name;                                                           \
     do {                                                                   \
         static alignas(T) char static_init_once_storage_[sizeof(T)];       \
-        static std::once_flag static_init_once_flag_;                      \
-        std::call_once(static_init_once_flag_, []() {                      \
+        static StaticInitOnceFlag static_init_once_flag_;                  \
+        static_init_once_flag_.Call([]() {                                 \
             new (static_init_once_storage_) T(__VA_ARGS__);                \
             if constexpr (!std::is_trivially_destructible_v<T>) {          \
                 std::atexit([]() {                                         \
@@ -24,13 +48,12 @@
 
 // Similar to:
 // static T var_name = initializer;
-#define STATIC_INIT_ONCE_TRIVIAL(T, var_name, initializer)  \
-    static constinit T var_name;                            \
-    do {                                                    \
-        static_assert(std::is_trivially_destructible_v<T>); \
-        static std::once_flag static_init_once_flag_;       \
-        std::call_once(static_init_once_flag_,              \
-                       []() { var_name = initializer; });   \
+#define STATIC_INIT_ONCE_TRIVIAL(T, var_name, initializer)             \
+    static constinit T var_name;                                       \
+    do {                                                               \
+        static_assert(std::is_trivially_destructible_v<T>);            \
+        static StaticInitOnceFlag static_init_once_flag_;              \
+        static_init_once_flag_.Call([]() { var_name = initializer; }); \
     } while (0)
 
 // Similar to:
@@ -39,8 +62,8 @@
     static T ptr;                                                      \
     do {                                                               \
         static_assert(std::is_trivially_destructible_v<T>);            \
-        static std::once_flag get_proc_address_once_flag_;             \
-        std::call_once(get_proc_address_once_flag_, []() {             \
+        static StaticInitOnceFlag get_proc_address_once_flag_;         \
+        get_proc_address_once_flag_.Call([]() {                        \
             HMODULE get_proc_address_once_module_ =                    \
                 GetModuleHandle(module_name);                          \
             if (get_proc_address_once_module_) {                       \
@@ -58,8 +81,8 @@
     static T ptr;                                                              \
     do {                                                                       \
         static_assert(std::is_trivially_destructible_v<T>);                    \
-        static std::once_flag get_proc_address_once_flag_;                     \
-        std::call_once(get_proc_address_once_flag_, []() {                     \
+        static StaticInitOnceFlag get_proc_address_once_flag_;                 \
+        get_proc_address_once_flag_.Call([]() {                                \
             static HMODULE get_proc_address_once_module_ =                     \
                 LoadLibraryEx(module_name, nullptr, flags);                    \
             if (get_proc_address_once_module_) {                               \
@@ -0,0 +1,505 @@
+#include "stdafx.h"
+
+#include "logger.h"
+#include "module_load_notifier.h"
+#include "no_destructor.h"
+#include "var_init_once.h"
+#include "visual_tree_notifier.h"
+
+extern HINSTANCE g_hDllInst;
+
+namespace {
+
+constexpr WCHAR kXamlModuleName[] = L"Windows.UI.Xaml.dll";
+
+// Names which are in use fail with ERROR_NOT_FOUND, e.g. if a mod connected on
+// its own with the same name.
+constexpr int kMaxConnectionAttempts = 10000;
+
+using InitializeXamlDiagnosticsEx_t =
+    HRESULT(WINAPI*)(PCWSTR endPointName,
+                     DWORD pid,
+                     PCWSTR wszDllXamlDiagnostics,
+                     PCWSTR wszTAPDllName,
+                     CLSID tapClsid,
+                     PCWSTR wszInitializationData);
+
+}  // namespace
+
+// Implements both the TAP, which XAML diagnostics creates and passes its site
+// to, and the sink of the visual tree changes.
+class VisualTreeNotifier::Tap : public IObjectWithSite,
+                                public IVisualTreeServiceCallback2 {
+   public:
+    Tap() = default;
+
+    Tap(const Tap&) = delete;
+    Tap& operator=(const Tap&) = delete;
+
+    // IUnknown
+    IFACEMETHODIMP QueryInterface(REFIID riid, void** ppvObject) override {
+        if (!ppvObject) {
+            return E_POINTER;
+        }
+
+        if (riid == __uuidof(IUnknown) || riid == __uuidof(IObjectWithSite)) {
+            *ppvObject = static_cast<IObjectWithSite*>(this);
+        } else if (riid == __uuidof(IVisualTreeServiceCallback) ||
+                   riid == __uuidof(IVisualTreeServiceCallback2)) {
+            *ppvObject = static_cast<IVisualTreeServiceCallback2*>(this);
+        } else {
+            *ppvObject = nullptr;
+            return E_NOINTERFACE;
+        }
+
+        AddRef();
+        return S_OK;
+    }
+
+    IFACEMETHODIMP_(ULONG) AddRef() override { return ++m_refCount; }
+
+    IFACEMETHODIMP_(ULONG) Release() override {
+        ULONG refCount = --m_refCount;
+        if (refCount == 0) {
+            delete this;
+        }
+
+        return refCount;
+    }
+
+    // IObjectWithSite
+    IFACEMETHODIMP SetSite(IUnknown* pUnkSite) override {
+        m_site = pUnkSite;
+
+        try {
+            VisualTreeNotifier::GetInstance().SetSite(this, pUnkSite);
+        } catch (const std::exception& e) {
+            LOG(L"Error: %S", e.what());
+            return E_FAIL;
+        }
+
+        return S_OK;
+    }
+
+    IFACEMETHODIMP GetSite(REFIID riid, void** ppvSite) override {
+        if (!ppvSite) {
+            return E_POINTER;
+        }
+
+        if (!m_site) {
+            *ppvSite = nullptr;
+            return E_FAIL;
+        }
+
+        return m_site->QueryInterface(riid, ppvSite);
+    }
+
+    // IVisualTreeServiceCallback
+    IFACEMETHODIMP OnVisualTreeChange(
+        ParentChildRelation relation,
+        VisualElement element,
+        VisualMutationType mutationType) override {
+        try {
+            VisualTreeNotifier::GetInstance().OnVisualTreeChange(
+                relation, element, mutationType);
+        } catch (const std::exception& e) {
+            LOG(L"Error: %S", e.what());
+        }
+
+        return S_OK;
+    }
+
+    // IVisualTreeServiceCallback2
+    IFACEMETHODIMP OnElementStateChanged(InstanceHandle element,
+                                         VisualElementState elementState,
+                                         PCWSTR context) override {
+        return S_OK;
+    }
+
+   private:
+    std::atomic<ULONG> m_refCount = 1;
+    wil::com_ptr<IUnknown> m_site;
+};
+
+// A single static instance, which isn't reference counted.
+class VisualTreeNotifier::TapClassFactory : public IClassFactory {
+   public:
+    // IUnknown
+    IFACEMETHODIMP QueryInterface(REFIID riid, void** ppvObject) override {
+        if (!ppvObject) {
+            return E_POINTER;
+        }
+
+        if (riid != __uuidof(IUnknown) && riid != __uuidof(IClassFactory)) {
+            *ppvObject = nullptr;
+            return E_NOINTERFACE;
+        }
+
+        *ppvObject = static_cast<IClassFactory*>(this);
+        return S_OK;
+    }
+
+    IFACEMETHODIMP_(ULONG) AddRef() override { return 2; }
+    IFACEMETHODIMP_(ULONG) Release() override { return 1; }
+
+    // IClassFactory
+    IFACEMETHODIMP CreateInstance(IUnknown* pUnkOuter,
+                                  REFIID riid,
+                                  void** ppvObject) override {
+        if (!ppvObject) {
+            return E_POINTER;
+        }
+
+        *ppvObject = nullptr;
+
+        if (pUnkOuter) {
+            return CLASS_E_NOAGGREGATION;
+        }
+
+        Tap* tap = new (std::nothrow) Tap();
+        if (!tap) {
+            return E_OUTOFMEMORY;
+        }
+
+        HRESULT hr = tap->QueryInterface(riid, ppvObject);
+        tap->Release();
+        return hr;
+    }
+
+    IFACEMETHODIMP LockServer(BOOL fLock) override { return S_OK; }
+};
+
+VisualTreeNotifier::VisualTreeNotifier() = default;
+
+VisualTreeNotifier::~VisualTreeNotifier() {
+    if (m_moduleLoadRegistrationId) {
+        ModuleLoadNotifier::GetInstance().Unregister(
+            m_moduleLoadRegistrationId);
+    }
+
+    if (m_xamlDiagnostics && m_tap) {
+        if (auto visualTreeService =
+                m_xamlDiagnostics.try_query<IVisualTreeService3>()) {
+            visualTreeService->UnadviseVisualTreeChange(m_tap.get());
+        }
+    }
+}
+
+// static
+VisualTreeNotifier& VisualTreeNotifier::GetInstance() {
+    STATIC_INIT_ONCE(NoDestructorIfTerminating<VisualTreeNotifier>, s);
+    return **s;
+}
+
+UINT64 VisualTreeNotifier::Register(Filter filter, Callback callback) {
+    UINT64 id;
+
+    {
+        std::lock_guard guard(m_mutex);
+
+        id = m_nextId++;
+        m_registrations.push_back({
+            .id = id,
+            .filter = std::move(filter),
+            .callback = std::make_shared<Callback>(std::move(callback)),
+        });
+
+        if (!m_connectStarted) {
+            m_connectStarted = true;
+            m_moduleLoadRegistrationId =
+                ModuleLoadNotifier::GetInstance().Register(
+                    kXamlModuleName,
+                    [this](HMODULE module) { QueueConnect(); });
+        }
+    }
+
+    if (!m_connected) {
+        QueueConnect();
+    }
+
+    return id;
+}
+
+void VisualTreeNotifier::ReportExistingElements(UINT64 id) {
+    struct ExistingElement {
+        InstanceHandle handle;
+        InstanceHandle parentHandle;
+        std::wstring typeName;
+        std::wstring name;
+    };
+
+    std::vector<ExistingElement> existingElements;
+    std::shared_ptr<Callback> callback;
+
+    {
+        std::lock_guard guard(m_mutex);
+
+        auto registration = std::ranges::find(m_registrations, id,
+                                              &Registration::id);
+        if (registration == m_registrations.end()) {
+            return;
+        }
+
+        callback = registration->callback;
+
+        for (const auto& [handle, element] : m_elements) {
+            if (FilterMatches(registration->filter, element.typeName.c_str(),
+                              element.name.c_str())) {
+                existingElements.push_back({
+                    .handle = handle,
+                    .parentHandle = element.parentHandle,
+                    .typeName = element.typeName,
+                    .name = element.name,
+                });
+            }
+        }
+    }
+
+    for (const auto& element : existingElements) {
+        CallCallbacks(/*added=*/true, element.handle, element.parentHandle,
+                      element.typeName.c_str(), element.name.c_str(),
+                      {callback});
+    }
+}
+
+void VisualTreeNotifier::Unregister(UINT64 id) {
+    std::lock_guard guard(m_mutex);
+
+    std::erase_if(m_registrations, [id](const Registration& registration) {
+        return registration.id == id;
+    });
+}
+
+// static
+HRESULT VisualTreeNotifier::GetClassObject(REFCLSID rclsid,
+                                           REFIID riid,
+                                           void** ppv) {
+    if (!ppv) {
+        return E_POINTER;
+    }
+
+    *ppv = nullptr;
+
+    if (rclsid != kTapClsid) {
+        return CLASS_E_CLASSNOTAVAILABLE;
+    }
+
+    static TapClassFactory tapClassFactory;
+    return tapClassFactory.QueryInterface(riid, ppv);
+}
+
+// static
+void CALLBACK
+VisualTreeNotifier::ConnectCallback(PTP_CALLBACK_INSTANCE instance,
+                                    PVOID context) {
+    try {
+        static_cast<VisualTreeNotifier*>(context)->Connect();
+    } catch (const std::exception& e) {
+        LOG(L"Connecting to XAML diagnostics failed: %S", e.what());
+    }
+}
+
+// static
+bool VisualTreeNotifier::FilterMatches(const Filter& filter,
+                                       PCWSTR typeName,
+                                       PCWSTR name) {
+    return (filter.typeName.empty() || filter.typeName == typeName) &&
+           (filter.name.empty() || filter.name == name);
+}
+
+void VisualTreeNotifier::QueueConnect() {
+    // Connecting blocks until XAML diagnostics sets the site, which might
+    // require the thread of the caller, e.g. if it's a UI thread, and might
+    // be requested with the loader lock held.
+    if (!TrySubmitThreadpoolCallback(ConnectCallback, this, nullptr)) {
+        LOG(L"TrySubmitThreadpoolCallback failed with error %u",
+            GetLastError());
+    }
+}
+
+void VisualTreeNotifier::Connect() {
+    std::lock_guard guard(m_connectMutex);
+
+    if (m_connected) {
+        return;
+    }
+
+    // Connected once the module is loaded.
+    HMODULE xamlModule = GetModuleHandle(kXamlModuleName);
+    if (!xamlModule) {
+        return;
+    }
+
+    auto pInitializeXamlDiagnosticsEx =
+        reinterpret_cast<InitializeXamlDiagnosticsEx_t>(
+            GetProcAddress(xamlModule, "InitializeXamlDiagnosticsEx"));
+    THROW_LAST_ERROR_IF_NULL(pInitializeXamlDiagnosticsEx);
+
+    auto tapDllPath = wil::GetModuleFileNameW<std::wstring>(g_hDllInst);
+
+    HRESULT hr;
+    for (int i = 1; i <= kMaxConnectionAttempts; i++) {
+        std::wstring connectionName =
+            L"VisualDiagConnection" + std::to_wstring(i);
+        hr = pInitializeXamlDiagnosticsEx(connectionName.c_str(),
+                                          GetCurrentProcessId(), L"",
+                                          tapDllPath.c_str(), kTapClsid,
+                                          nullptr);
+        if (hr != HRESULT_FROM_WIN32(ERROR_NOT_FOUND)) {
+            break;
+        }
+    }
+
+    THROW_IF_FAILED(hr);
+
+    m_connected = true;
+
+    UINT64 moduleLoadRegistrationId;
+    {
+        std::lock_guard guard(m_mutex);
+        moduleLoadRegistrationId = m_moduleLoadRegistrationId;
+        m_moduleLoadRegistrationId = 0;
+    }
+
+    if (moduleLoadRegistrationId) {
+        ModuleLoadNotifier::GetInstance().Unregister(moduleLoadRegistrationId);
+    }
+}
+
+void VisualTreeNotifier::SetSite(Tap* tap, IUnknown* site) {
+    if (!site) {
+        std::lock_guard guard(m_mutex);
+        m_xamlDiagnostics.reset();
+        m_tap.reset();
+        m_elements.clear();
+        return;
+    }
+
+    auto xamlDiagnostics = wil::com_query<IXamlDiagnostics>(site);
+
+    {
+        std::lock_guard guard(m_mutex);
+        m_xamlDiagnostics = std::move(xamlDiagnostics);
+        m_tap = tap;
+    }
+
+    // Advising synchronously from SetSite deadlocks, since it waits for the
+    // tree of the thread which calls SetSite to be reported.
+    if (!TrySubmitThreadpoolCallback(
+            [](PTP_CALLBACK_INSTANCE instance, PVOID context) {
+                try {
+                    static_cast<VisualTreeNotifier*>(context)
+                        ->AdviseVisualTreeChange();
+                } catch (const std::exception& e) {
+                    LOG(L"AdviseVisualTreeChange failed: %S", e.what());
+                }
+            },
+            this, nullptr)) {
+        THROW_LAST_ERROR();
+    }
+}
+
+void VisualTreeNotifier::AdviseVisualTreeChange() {
+    wil::com_ptr<IVisualTreeService3> visualTreeService;
+    wil::com_ptr<Tap> tap;
+
+    {
+        std::lock_guard guard(m_mutex);
+        if (!m_xamlDiagnostics || !m_tap) {
+            return;
+        }
+
+        visualTreeService = m_xamlDiagnostics.query<IVisualTreeService3>();
+        tap = m_tap;
+    }
+
+    // The elements which already exist are reported right away.
+    THROW_IF_FAILED(visualTreeService->AdviseVisualTreeChange(tap.get()));
+}
+
+void VisualTreeNotifier::OnVisualTreeChange(const ParentChildRelation& relation,
+                                            const VisualElement& element,
+                                            VisualMutationType mutationType) {
+    bool added = mutationType == Add;
+    PCWSTR typeName = element.Type ? element.Type : L"";
+    PCWSTR name = element.Name ? element.Name : L"";
+
+    std::vector<std::shared_ptr<Callback>> callbacks;
+
+    {
+        std::lock_guard guard(m_mutex);
+
+        if (added) {
+            m_elements.insert_or_assign(element.Handle,
+                                        TrackedElement{
+                                            .parentHandle = relation.Parent,
+                                            .typeName = typeName,
+                                            .name = name,
+                                        });
+        } else {
+            m_elements.erase(element.Handle);
+        }
+
+        for (const auto& registration : m_registrations) {
+            if (FilterMatches(registration.filter, typeName, name)) {
+                callbacks.push_back(registration.callback);
+            }
+        }
+    }
+
+    if (!callbacks.empty()) {
+        CallCallbacks(added, element.Handle, relation.Parent, typeName, name,
+                      callbacks);
+    }
+}
+
+void VisualTreeNotifier::CallCallbacks(
+    bool added,
+    InstanceHandle handle,
+    InstanceHandle parentHandle,
+    PCWSTR typeName,
+    PCWSTR name,
+    const std::vector<std::shared_ptr<Callback>>& callbacks) {
+    wil::com_ptr<IXamlDiagnostics> xamlDiagnostics;
+    {
+        std::lock_guard guard(m_mutex);
+        xamlDiagnostics = m_xamlDiagnostics;
+    }
+
+    if (!xamlDiagnostics) {
+        return;
+    }
+
+    // Either can fail, e.g. for an element which is being removed.
+    wil::com_ptr<IInspectable> elementObject;
+    xamlDiagnostics->GetIInspectableFromHandle(handle, &elementObject);
+
+    wil::com_ptr<IInspectable> parentObject;
+    if (parentHandle) {
+        xamlDiagnostics->GetIInspectableFromHandle(parentHandle,
+                                                   &parentObject);
+    }
+
+    // A removed element is reported even if it's no longer available, so
+    // that the callback can forget it by its handle.
+    if (!elementObject && added) {
+        return;
+    }
+
+    Element info{
+        .element = elementObject.get(),
+        .parent = parentObject.get(),
+        .typeName = typeName,
+        .name = name,
+        .handle = handle,
+        .parentHandle = parentHandle,
+    };
+
+    for (const auto& callback : callbacks) {
+        try {
+            (*callback)(added, info);
+        } catch (const std::exception& e) {
+            LOG(L"Visual tree callback failed: %S", e.what());
+        }
+    }
+}
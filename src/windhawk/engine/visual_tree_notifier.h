@@ -0,0 +1,112 @@
+#pragma once
+
+// Dispatches the changes of the XAML visual trees of the current process, with
+// a single XAML diagnostics connection for the whole engine, so that each mod
+// doesn't have to connect and walk the trees on its own. The connection is
+// made once the first callback is registered, or once Windows.UI.Xaml.dll is
+// loaded if it isn't loaded yet, by passing the engine as the TAP DLL to
+// InitializeXamlDiagnosticsEx. XAML diagnostics keeps its own reference to the
+// engine DLL, so once connected, the engine stays loaded in the process.
+//
+// The elements which are in the trees are tracked, so that a callback which is
+// registered late can also be called for the elements which were added before.
+// Callbacks are called on the UI thread of the element, except for those
+// existing elements, which are reported from the thread which asks for them.
+class VisualTreeNotifier {
+   public:
+    // The TAP class, created by XAML diagnostics through DllGetClassObject.
+    static constexpr CLSID kTapClsid = {
+        0x9f4e6a1c,
+        0x3b57,
+        0x4d2e,
+        {0xa8, 0x61, 0x0c, 0x7d, 0x52, 0xe9, 0x14, 0xb3}};
+
+    struct Element {
+        // Can be NULL for a removed element which is no longer available.
+        IInspectable* element;
+        // NULL for the root of a tree.
+        IInspectable* parent;
+        PCWSTR typeName;
+        PCWSTR name;
+        UINT64 handle;
+        UINT64 parentHandle;
+    };
+
+    struct Filter {
+        // The full type name, e.g. "Windows.UI.Xaml.Controls.Grid". Empty to
+        // match all types.
+        std::wstring typeName;
+        // The x:Name of the element. Empty to match all names.
+        std::wstring name;
+    };
+
+    using Callback = std::function<void(bool added, const Element& element)>;
+
+    VisualTreeNotifier();
+    ~VisualTreeNotifier();
+
+    VisualTreeNotifier(const VisualTreeNotifier&) = delete;
+    VisualTreeNotifier& operator=(const VisualTreeNotifier&) = delete;
+
+    static VisualTreeNotifier& GetInstance();
+
+    // Returns an ID for Unregister. The callback can be called right away, on
+    // the UI threads.
+    UINT64 Register(Filter filter, Callback callback);
+    // Calls the callback of the registration for the matching elements which
+    // were added before it was registered, from the current thread.
+    void ReportExistingElements(UINT64 id);
+    void Unregister(UINT64 id);
+
+    // Implements DllGetClassObject for kTapClsid.
+    static HRESULT GetClassObject(REFCLSID rclsid, REFIID riid, void** ppv);
+
+   private:
+    class Tap;
+    class TapClassFactory;
+
+    struct Registration {
+        UINT64 id;
+        Filter filter;
+        std::shared_ptr<Callback> callback;
+    };
+
+    struct TrackedElement {
+        InstanceHandle parentHandle;
+        std::wstring typeName;
+        std::wstring name;
+    };
+
+    static void CALLBACK ConnectCallback(PTP_CALLBACK_INSTANCE instance,
+                                         PVOID context);
+    static bool FilterMatches(const Filter& filter,
+                              PCWSTR typeName,
+                              PCWSTR name);
+
+    void QueueConnect();
+    void Connect();
+    void SetSite(Tap* tap, IUnknown* site);
+    void AdviseVisualTreeChange();
+    void OnVisualTreeChange(const ParentChildRelation& relation,
+                            const VisualElement& element,
+                            VisualMutationType mutationType);
+    void CallCallbacks(bool added,
+                       InstanceHandle handle,
+                       InstanceHandle parentHandle,
+                       PCWSTR typeName,
+                       PCWSTR name,
+                       const std::vector<std::shared_ptr<Callback>>& callbacks);
+
+    std::mutex m_mutex;
+    UINT64 m_nextId = 1;
+    std::vector<Registration> m_registrations;
+    std::unordered_map<InstanceHandle, TrackedElement> m_elements;
+    wil::com_ptr<IXamlDiagnostics> m_xamlDiagnostics;
+    wil::com_ptr<Tap> m_tap;
+    bool m_connectStarted = false;
+    UINT64 m_moduleLoadRegistrationId = 0;
+
+    // Serializes connection attempts.
+    std::mutex m_connectMutex;
+    std::atomic<bool> m_connected = false;
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+// The format of the log files which the session manager writes for the log
+// lines of all processes, see LogFileSink of the engine. A file starts with a
+// header, followed by records. Each record is a header followed by the text
+// of the line as UTF-16, without a terminating null. Records are never split
+// between files, but the last record of a file might be incomplete if the
+// writer terminated, in which case it should be ignored.
+namespace LogFileFormat {
+
+inline constexpr DWORD kMagic = 0x474C4857;  // "WHLG"
+inline constexpr DWORD kVersion = 1;
+
+// The file which is currently written, older files are renamed to
+// "windhawk-log.1.bin", "windhawk-log.2.bin", and so on.
+inline constexpr WCHAR kFileNamePrefix[] = L"windhawk-log";
+inline constexpr WCHAR kFileNameExtension[] = L".bin";
+
+#pragma pack(push, 1)
+
+struct FileHeader {
+    DWORD magic;
+    DWORD version;
+};
+
+struct RecordHeader {
+    // As a FILETIME value.
+    ULONGLONG timestamp;
+    DWORD processId;
+    DWORD threadId;
+    // The length of the text in characters.
+    DWORD textLength;
+};
+
+#pragma pack(pop)
+
+}  // namespace LogFileFormat
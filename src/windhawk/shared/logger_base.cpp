@@ -6,11 +6,12 @@ LoggerBase::LoggerBase(Verbosity initialVerbosity)
     : m_verbosity(initialVerbosity) {}
 
 void LoggerBase::SetVerbosity(Verbosity verbosity) {
-    m_verbosity = verbosity;
+    m_verbosity.store(verbosity, std::memory_order_relaxed);
 }
 
 LoggerBase::Verbosity LoggerBase::GetVerbosity() {
-    return m_verbosity;
+    // Only the value matters, it's not used to order other memory accesses.
+    return m_verbosity.load(std::memory_order_relaxed);
 }
 
 void LoggerBase::VLogLine(PCWSTR format, va_list args) {
@@ -30,7 +31,7 @@ void LoggerBase::VLogLine(PCWSTR format, va_list args) {
         buffer[len + 2] = L'\0';
     }
 
-    OutputDebugString(buffer);
+    Output(buffer);
 }
 
 void LoggerBase::LogLine(PCWSTR format, ...) {
@@ -39,3 +40,7 @@ void LoggerBase::LogLine(PCWSTR format, ...) {
     VLogLine(format, args);
     va_end(args);
 }
+
+void LoggerBase::Output(PCWSTR line) {
+    OutputDebugString(line);
+}
@@ -14,9 +14,13 @@ class LoggerBase {
 
     void SetVerbosity(Verbosity verbosity);
     Verbosity GetVerbosity();
-    void VLogLine(PCWSTR format, va_list args);
+    virtual void VLogLine(PCWSTR format, va_list args);
     void LogLine(PCWSTR format, ...);
 
+   protected:
+    // Called with each formatted line, which ends with a newline.
+    virtual void Output(PCWSTR line);
+
    private:
     std::atomic<Verbosity> m_verbosity = kDefaultVerbosity;
 };
@@ -10,6 +10,32 @@
     throw PortableSettingsException(error)
 #endif
 
+////////////////////////////////////////////////////////////////////////////////
+// IoCounts
+
+namespace {
+
+std::atomic<ULONGLONG> g_ioReadCount;
+std::atomic<ULONGLONG> g_ioWriteCount;
+
+void CountIoRead() {
+    g_ioReadCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CountIoWrite() {
+    g_ioWriteCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+}  // namespace
+
+// static
+PortableSettings::IoCounts PortableSettings::GetIoCounts() {
+    return {
+        .reads = g_ioReadCount.load(std::memory_order_relaxed),
+        .writes = g_ioWriteCount.load(std::memory_order_relaxed),
+    };
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // EnumIteratorImpl
 
@@ -202,6 +228,7 @@ class EnumIteratorRegistryBase : public EnumIteratorImpl<Type> {
             dwValueNameSize = dwMaxValueNameLen + 1;
             data.resize((dwMaxValueLen + sizeof(WCHAR) - 1) / sizeof(WCHAR));
             dwDataSize = wil::safe_cast<DWORD>(data.length() * sizeof(WCHAR));
+            CountIoRead();
             error = RegEnumValue(
                 hKey, dwIndex, &valueName[0], &dwValueNameSize, nullptr,
                 &dwType, reinterpret_cast<BYTE*>(&data[0]), &dwDataSize);
@@ -289,15 +316,11 @@ class EnumIteratorRegistryString
 ////////////////////////////////////////////////////////////////////////////////
 // RegistrySettings
 
-RegistrySettings::RegistrySettings(HKEY hKey, PCWSTR subKey, bool write) {
-    LSTATUS error =
-        RegCreateKeyEx(hKey, subKey, 0, nullptr, 0,
-                       KEY_READ | (write ? KEY_WRITE : 0) | KEY_WOW64_64KEY,
-                       nullptr, &this->hKey, nullptr);
-    if (error != ERROR_SUCCESS) {
-        PORTABLE_SETTINGS_THROW_WIN32(error);
-    }
-}
+RegistrySettings::RegistrySettings(HKEY hKey, PCWSTR subKey, bool write)
+    : hKey(OpenKey(hKey, subKey, write)) {}
+
+RegistrySettings::RegistrySettings(wil::shared_hkey hKey)
+    : hKey(std::move(hKey)) {}
 
 std::optional<std::wstring> RegistrySettings::GetString(
     PCWSTR valueName) const {
@@ -311,6 +334,7 @@ std::optional<std::wstring> RegistrySettings::GetString(
 }
 
 void RegistrySettings::SetString(PCWSTR valueName, PCWSTR string) {
+    CountIoWrite();
     LSTATUS error = RegSetValueEx(
         hKey.get(), valueName, 0, REG_SZ, reinterpret_cast<const BYTE*>(string),
         wil::safe_cast<DWORD>((wcslen(string) + 1) * sizeof(WCHAR)));
@@ -332,6 +356,7 @@ std::optional<int> RegistrySettings::GetInt(PCWSTR valueName) const {
 void RegistrySettings::SetInt(PCWSTR valueName, int value) {
     DWORD dwValue = static_cast<DWORD>(value);
 
+    CountIoWrite();
     LSTATUS error =
         RegSetValueEx(hKey.get(), valueName, 0, REG_DWORD,
                       reinterpret_cast<const BYTE*>(&dwValue), sizeof(DWORD));
@@ -354,6 +379,7 @@ std::optional<std::vector<BYTE>> RegistrySettings::GetBinary(
 void RegistrySettings::SetBinary(PCWSTR valueName,
                                  const BYTE* buffer,
                                  size_t bufferSize) {
+    CountIoWrite();
     LSTATUS error = RegSetValueEx(hKey.get(), valueName, 0, REG_BINARY, buffer,
                                   wil::safe_cast<DWORD>(bufferSize));
     if (error != ERROR_SUCCESS) {
@@ -362,6 +388,7 @@ void RegistrySettings::SetBinary(PCWSTR valueName,
 }
 
 void RegistrySettings::Remove(PCWSTR valueName) {
+    CountIoWrite();
     LSTATUS error = RegDeleteValue(hKey.get(), valueName);
     if (error != ERROR_SUCCESS && error != ERROR_FILE_NOT_FOUND &&
         error != ERROR_PATH_NOT_FOUND) {
@@ -380,6 +407,75 @@ RegistrySettings::EnumStringValues() const {
         std::make_unique<EnumIteratorRegistryString>(hKey.get()));
 }
 
+RegistrySettings::Values RegistrySettings::ReadAll() const {
+    Values values;
+
+    DWORD dwMaxValueNameLen = 0;
+    DWORD dwMaxValueLen = 0;
+    bool queryInfo = true;
+
+    for (DWORD dwIndex = 0;;) {
+        if (queryInfo) {
+            LSTATUS error = RegQueryInfoKey(
+                hKey.get(), nullptr, nullptr, nullptr, nullptr, nullptr,
+                nullptr, nullptr, &dwMaxValueNameLen, &dwMaxValueLen, nullptr,
+                nullptr);
+            if (error != ERROR_SUCCESS) {
+                PORTABLE_SETTINGS_THROW_WIN32(error);
+            }
+
+            queryInfo = false;
+        }
+
+        std::wstring valueName(
+            wil::safe_cast<size_t>(dwMaxValueNameLen) + 1, L'\0');
+        DWORD dwValueNameSize = dwMaxValueNameLen + 1;
+        std::wstring data((dwMaxValueLen + sizeof(WCHAR) - 1) / sizeof(WCHAR),
+                          L'\0');
+        DWORD dwDataSize = wil::safe_cast<DWORD>(data.length() * sizeof(WCHAR));
+        DWORD dwType;
+        CountIoRead();
+        LSTATUS error = RegEnumValue(
+            hKey.get(), dwIndex, &valueName[0], &dwValueNameSize, nullptr,
+            &dwType, reinterpret_cast<BYTE*>(&data[0]), &dwDataSize);
+        if (error == ERROR_NO_MORE_ITEMS) {
+            break;
+        }
+
+        if (error == ERROR_MORE_DATA) {
+            queryInfo = true;
+            continue;  // perhaps value was updated, try again
+        }
+
+        if (error != ERROR_SUCCESS) {
+            PORTABLE_SETTINGS_THROW_WIN32(error);
+        }
+
+        valueName.resize(dwValueNameSize);
+        values.items.push_back({std::move(valueName), std::move(data),
+                                dwDataSize, dwType});
+        dwIndex++;
+    }
+
+    return values;
+}
+
+// static
+wil::unique_hkey RegistrySettings::OpenKey(HKEY hKey,
+                                           PCWSTR subKey,
+                                           bool write) {
+    wil::unique_hkey key;
+    LSTATUS error =
+        RegCreateKeyEx(hKey, subKey, 0, nullptr, 0,
+                       KEY_READ | (write ? KEY_WRITE : 0) | KEY_WOW64_64KEY,
+                       nullptr, &key, nullptr);
+    if (error != ERROR_SUCCESS) {
+        PORTABLE_SETTINGS_THROW_WIN32(error);
+    }
+
+    return key;
+}
+
 // static
 void RegistrySettings::RemoveSection(HKEY hKey, PCWSTR subKey) {
     /*
@@ -418,6 +514,7 @@ std::optional<RegistrySettings::RawData> RegistrySettings::GetRaw(
     LSTATUS error;
 
     while (true) {
+        CountIoRead();
         error = RegQueryValueEx(hKey.get(), valueName, nullptr, &dataType,
                                 nullptr, &dataSize);
         if (error == ERROR_FILE_NOT_FOUND || error == ERROR_PATH_NOT_FOUND) {
@@ -467,60 +564,349 @@ int HexDigitValue(WCHAR hexDigit) {
     throw std::invalid_argument("invalid hex digit");
 }
 
-}  // namespace IniFileSettingsHelperFunctions
-}  // namespace
+std::vector<BYTE> HexStringToBuffer(const std::wstring& data) {
+    // Adapted from https://stackoverflow.com/a/3382894
+    const auto len = data.length();
+    if (len % 2 != 0) {
+        throw std::invalid_argument("odd length");
+    }
 
-////////////////////////////////////////////////////////////////////////////////
-// EnumIterator - IniFileSettings
+    std::vector<BYTE> result;
+    result.reserve(len / 2);
+    for (auto it = data.begin(); it != data.end();) {
+        int hi = HexDigitValue(*it++);
+        int lo = HexDigitValue(*it++);
+        result.push_back(hi << 4 | lo);
+    }
 
-template <typename Type>
-class EnumIteratorIniFileBase : public EnumIteratorImpl<Type> {
+    return result;
+}
+
+int StringToInt(const std::wstring& data) {
+    long longValue = std::stol(data, nullptr, 0);
+    if (longValue > INT_MAX) {
+        return INT_MAX;
+    } else if (longValue < INT_MIN) {
+        return INT_MIN;
+    }
+
+    return wil::safe_cast<int>(longValue);
+}
+
+bool EqualsIgnoreCase(std::wstring_view a, std::wstring_view b) {
+    return CompareStringOrdinal(a.data(), wil::safe_cast<int>(a.length()),
+                                b.data(), wil::safe_cast<int>(b.length()),
+                                TRUE) == CSTR_EQUAL;
+}
+
+std::wstring_view TrimWhitespace(std::wstring_view str) {
+    size_t start = str.find_first_not_of(L" \t");
+    if (start == str.npos) {
+        return {};
+    }
+
+    size_t end = str.find_last_not_of(L" \t");
+    return str.substr(start, end - start + 1);
+}
+
+// The parsed content of an ini file, following the rules of
+// GetPrivateProfileString: names are case-insensitive, the first occurrence of
+// a section or a key is used, and values are trimmed and unquoted.
+struct IniFileContent {
+    struct Section {
+        std::wstring name;
+        std::vector<std::pair<std::wstring, std::wstring>> values;
+    };
+
+    std::vector<Section> sections;
+
+    const Section* FindSection(std::wstring_view name) const {
+        for (const auto& section : sections) {
+            if (EqualsIgnoreCase(section.name, name)) {
+                return &section;
+            }
+        }
+
+        return nullptr;
+    }
+
+    const std::wstring* FindValue(std::wstring_view sectionName,
+                                  std::wstring_view valueName) const {
+        const Section* section = FindSection(sectionName);
+        if (!section) {
+            return nullptr;
+        }
+
+        for (const auto& [name, value] : section->values) {
+            if (EqualsIgnoreCase(name, valueName)) {
+                return &value;
+            }
+        }
+
+        return nullptr;
+    }
+};
+
+std::wstring DecodeIniFile(const std::vector<BYTE>& data) {
+    if (data.size() >= 2 && data[0] == 0xFF && data[1] == 0xFE) {
+        return std::wstring(reinterpret_cast<const WCHAR*>(data.data() + 2),
+                            (data.size() - 2) / sizeof(WCHAR));
+    }
+
+    UINT codePage = CP_ACP;
+    size_t offset = 0;
+    if (data.size() >= 3 && data[0] == 0xEF && data[1] == 0xBB &&
+        data[2] == 0xBF) {
+        codePage = CP_UTF8;
+        offset = 3;
+    }
+
+    if (data.size() == offset) {
+        return std::wstring();
+    }
+
+    auto source = reinterpret_cast<const char*>(data.data() + offset);
+    int sourceSize = wil::safe_cast<int>(data.size() - offset);
+
+    int size = MultiByteToWideChar(codePage, 0, source, sourceSize, nullptr, 0);
+    if (size == 0) {
+        PORTABLE_SETTINGS_THROW_WIN32(GetLastError());
+    }
+
+    std::wstring result(size, L'\0');
+    MultiByteToWideChar(codePage, 0, source, sourceSize, result.data(), size);
+    return result;
+}
+
+IniFileContent ParseIniFile(std::wstring_view text) {
+    IniFileContent content;
+    IniFileContent::Section* currentSection = nullptr;
+
+    while (!text.empty()) {
+        size_t lineEnd = text.find_first_of(L"\r\n");
+        std::wstring_view line = TrimWhitespace(text.substr(0, lineEnd));
+        text.remove_prefix(lineEnd == text.npos ? text.length() : lineEnd + 1);
+
+        if (line.empty() || line.front() == L';') {
+            continue;
+        }
+
+        if (line.front() == L'[') {
+            line.remove_prefix(1);
+            line = TrimWhitespace(line.substr(0, line.find(L']')));
+
+            if (content.FindSection(line)) {
+                // Later occurrences of a section are ignored.
+                currentSection = nullptr;
+            } else {
+                content.sections.push_back({std::wstring(line), {}});
+                currentSection = &content.sections.back();
+            }
+
+            continue;
+        }
+
+        size_t equalsPos = line.find(L'=');
+        if (!currentSection || equalsPos == line.npos) {
+            continue;
+        }
+
+        std::wstring_view name = TrimWhitespace(line.substr(0, equalsPos));
+        std::wstring_view value = TrimWhitespace(line.substr(equalsPos + 1));
+
+        if (value.length() >= 2 && value.front() == value.back() &&
+            (value.front() == L'"' || value.front() == L'\'')) {
+            value = value.substr(1, value.length() - 2);
+        }
+
+        bool exists = false;
+        for (const auto& [existingName, existingValue] :
+             currentSection->values) {
+            if (EqualsIgnoreCase(existingName, name)) {
+                exists = true;
+                break;
+            }
+        }
+
+        if (!exists) {
+            currentSection->values.emplace_back(name, value);
+        }
+    }
+
+    return content;
+}
+
+// Keeps the parsed content of the ini files used by the process without
+// parsing a file again until it's modified, which is checked by its last write
+// time and size. GetPrivateProfileString parses the whole file on every call.
+class IniFileCache {
    public:
-    EnumIteratorIniFileBase(const IniFileSettings* settings)
-        : settings(settings) {
-        for (DWORD size = 256;; size += 256) {
-            SetLastError(0);
+    static IniFileCache& GetInstance() {
+        // Never destroyed, it might be used until the process terminates.
+        static IniFileCache* instance = new IniFileCache();
+        return *instance;
+    }
 
-            valueNames.resize(size);
-            UINT returnedSize = GetPrivateProfileString(
-                settings->sectionName.c_str(), nullptr, nullptr, &valueNames[0],
-                size, settings->filename.c_str());
+    // Returns nullptr if the file doesn't exist.
+    std::shared_ptr<const IniFileContent> Get(const std::wstring& filename) {
+        CountIoRead();
+        WIN32_FILE_ATTRIBUTE_DATA fileAttributes;
+        if (!GetFileAttributesEx(filename.c_str(), GetFileExInfoStandard,
+                                 &fileAttributes)) {
+            DWORD error = GetLastError();
+            if (error == ERROR_FILE_NOT_FOUND ||
+                error == ERROR_PATH_NOT_FOUND) {
+                Invalidate(filename);
+                return nullptr;
+            }
+
+            PORTABLE_SETTINGS_THROW_WIN32(error);
+        }
+
+        {
+            std::lock_guard guard(mutex);
+
+            Entry* entry = FindEntry(filename);
+            if (entry && entry->IsUpToDate(fileAttributes)) {
+                return entry->content;
+            }
+        }
 
+        CountIoRead();
+        wil::unique_hfile file(CreateFile(
+            filename.c_str(), GENERIC_READ,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+        if (!file) {
             DWORD error = GetLastError();
-            if (error == ERROR_MORE_DATA) {
-                continue;  // try with a larger buffer
-            } else if (error != ERROR_SUCCESS) {
-                PORTABLE_SETTINGS_THROW_WIN32(error);
+            if (error == ERROR_FILE_NOT_FOUND ||
+                error == ERROR_PATH_NOT_FOUND) {
+                Invalidate(filename);
+                return nullptr;
             }
 
-            valueNames.resize(returnedSize);
-            break;
+            PORTABLE_SETTINGS_THROW_WIN32(error);
         }
+
+        // Query the attributes of the opened file, so that they match the
+        // content which is read.
+        BY_HANDLE_FILE_INFORMATION fileInformation;
+        if (!GetFileInformationByHandle(file.get(), &fileInformation)) {
+            PORTABLE_SETTINGS_THROW_WIN32(GetLastError());
+        }
+
+        ULONGLONG fileSize =
+            (static_cast<ULONGLONG>(fileInformation.nFileSizeHigh) << 32) |
+            fileInformation.nFileSizeLow;
+        std::vector<BYTE> data(wil::safe_cast<size_t>(fileSize));
+
+        DWORD offset = 0;
+        DWORD dataSize = wil::safe_cast<DWORD>(data.size());
+        while (offset < dataSize) {
+            DWORD bytesRead;
+            if (!ReadFile(file.get(), data.data() + offset, dataSize - offset,
+                          &bytesRead, nullptr)) {
+                PORTABLE_SETTINGS_THROW_WIN32(GetLastError());
+            }
+
+            if (bytesRead == 0) {
+                data.resize(offset);
+                break;
+            }
+
+            offset += bytesRead;
+        }
+
+        auto content =
+            std::make_shared<IniFileContent>(ParseIniFile(DecodeIniFile(data)));
+
+        std::lock_guard guard(mutex);
+
+        Entry* entry = FindEntry(filename);
+        if (!entry) {
+            entries.push_back({.filename = filename});
+            entry = &entries.back();
+        }
+
+        entry->lastWriteTime = fileInformation.ftLastWriteTime;
+        entry->fileSize = fileSize;
+        entry->content = content;
+
+        return content;
     }
 
-   protected:
-    std::optional<std::wstring> get_next_value_name() {
-        size_t nextValueNameLen = wcslen(valueNames.c_str());
-        if (nextValueNameLen == 0) {
-            return std::nullopt;
+    void Invalidate(const std::wstring& filename) {
+        std::lock_guard guard(mutex);
+
+        Entry* entry = FindEntry(filename);
+        if (entry) {
+            entry->content.reset();
+        }
+    }
+
+   private:
+    struct Entry {
+        std::wstring filename;
+        FILETIME lastWriteTime{};
+        ULONGLONG fileSize = 0;
+        std::shared_ptr<const IniFileContent> content;
+
+        bool IsUpToDate(const WIN32_FILE_ATTRIBUTE_DATA& fileAttributes) const {
+            ULONGLONG currentFileSize =
+                (static_cast<ULONGLONG>(fileAttributes.nFileSizeHigh) << 32) |
+                fileAttributes.nFileSizeLow;
+            return content &&
+                   CompareFileTime(&lastWriteTime,
+                                   &fileAttributes.ftLastWriteTime) == 0 &&
+                   fileSize == currentFileSize;
         }
+    };
 
-        std::wstring nextValueName = valueNames.substr(0, nextValueNameLen);
-        valueNames.erase(0, nextValueNameLen + 1);
+    Entry* FindEntry(const std::wstring& filename) {
+        for (auto& entry : entries) {
+            if (EqualsIgnoreCase(entry.filename, filename)) {
+                return &entry;
+            }
+        }
 
-        return nextValueName;
+        return nullptr;
     }
 
-    std::optional<std::wstring> get_string(PCWSTR valueName) const {
-        return settings->GetString(valueName);
+    std::mutex mutex;
+    std::vector<Entry> entries;
+};
+
+}  // namespace IniFileSettingsHelperFunctions
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+// EnumIterator - IniFileSettings
+
+template <typename Type>
+class EnumIteratorIniFileBase : public EnumIteratorImpl<Type> {
+   public:
+    EnumIteratorIniFileBase(const IniFileSettings* settings)
+        : content(IniFileSettingsHelperFunctions::IniFileCache::GetInstance()
+                      .Get(settings->filename)) {
+        if (content) {
+            section = content->FindSection(settings->sectionName);
+        }
     }
 
-    std::optional<int> get_int(PCWSTR valueName) const {
-        return settings->GetInt(valueName);
+   protected:
+    const std::pair<std::wstring, std::wstring>* get_next_value() {
+        if (!section || index >= section->values.size()) {
+            return nullptr;
+        }
+
+        return &section->values[index++];
     }
 
-    const IniFileSettings* settings;
-    std::wstring valueNames;
+    std::shared_ptr<const IniFileSettingsHelperFunctions::IniFileContent>
+        content;
+    const IniFileSettingsHelperFunctions::IniFileContent::Section* section =
+        nullptr;
+    size_t index = 0;
 };
 
 class EnumIteratorIniFileInt : public EnumIteratorIniFileBase<int> {
@@ -531,19 +917,14 @@ class EnumIteratorIniFileInt : public EnumIteratorIniFileBase<int> {
     }
 
     void next() override {
-        auto valueName = get_next_value_name();
-        if (!valueName) {
+        auto value = get_next_value();
+        if (!value) {
             done = true;
             return;
         }
 
-        auto itemValue = get_int(valueName->c_str());
-        if (!itemValue) {
-            done = true;
-            return;
-        }
-
-        item = {std::move(*valueName), *itemValue};
+        item = {value->first,
+                IniFileSettingsHelperFunctions::StringToInt(value->second)};
     }
 
     std::unique_ptr<EnumIteratorImpl> clone() const override {
@@ -559,19 +940,13 @@ class EnumIteratorIniFileString : public EnumIteratorIniFileBase<std::wstring> {
     }
 
     void next() override {
-        auto valueName = get_next_value_name();
-        if (!valueName) {
+        auto value = get_next_value();
+        if (!value) {
             done = true;
             return;
         }
 
-        auto itemValue = get_string(valueName->c_str());
-        if (!itemValue) {
-            done = true;
-            return;
-        }
-
-        item = {std::move(*valueName), std::move(*itemValue)};
+        item = *value;
     }
 
     std::unique_ptr<EnumIteratorImpl> clone() const override {
@@ -600,31 +975,19 @@ IniFileSettings::IniFileSettings(PCWSTR filename,
 }
 
 std::optional<std::wstring> IniFileSettings::GetString(PCWSTR valueName) const {
-    std::wstring itemValue;
-
-    for (DWORD size = 256;; size += 256) {
-        SetLastError(0);
-
-        itemValue.resize(size);
-        UINT returnedSize =
-            GetPrivateProfileString(sectionName.c_str(), valueName, nullptr,
-                                    &itemValue[0], size, filename.c_str());
-
-        DWORD error = GetLastError();
-        if (error == ERROR_MORE_DATA) {
-            continue;  // try with a larger buffer
-        } else if (error == ERROR_FILE_NOT_FOUND ||
-                   error == ERROR_PATH_NOT_FOUND) {
-            return std::nullopt;
-        } else if (error != ERROR_SUCCESS) {
-            PORTABLE_SETTINGS_THROW_WIN32(error);
-        }
+    auto content =
+        IniFileSettingsHelperFunctions::IniFileCache::GetInstance().Get(
+            filename);
+    if (!content) {
+        return std::nullopt;
+    }
 
-        itemValue.resize(returnedSize);
-        break;
+    const std::wstring* value = content->FindValue(sectionName, valueName);
+    if (!value) {
+        return std::nullopt;
     }
 
-    return itemValue;
+    return *value;
 }
 
 void IniFileSettings::SetString(PCWSTR valueName, PCWSTR string) {
@@ -675,12 +1038,18 @@ void IniFileSettings::SetString(PCWSTR valueName, PCWSTR string) {
         stringPtr = stringEscaped.c_str();
     }
 
+    CountIoWrite();
     SetLastError(0);
 
     WritePrivateProfileString(sectionName.c_str(), valueName, stringPtr,
                               filename.c_str());
 
     DWORD error = GetLastError();
+
+    // The file's attributes might not change, e.g. if a value is replaced
+    // with one of the same length within the timestamp granularity.
+    IniFileSettingsHelperFunctions::IniFileCache::GetInstance().Invalidate(
+        filename);
     if (error != ERROR_SUCCESS) {
         PORTABLE_SETTINGS_THROW_WIN32(error);
     }
@@ -692,14 +1061,7 @@ std::optional<int> IniFileSettings::GetInt(PCWSTR valueName) const {
         return std::nullopt;
     }
 
-    long longValue = std::stol(*data, nullptr, 0);
-    if (longValue > INT_MAX) {
-        return INT_MAX;
-    } else if (longValue < INT_MIN) {
-        return INT_MIN;
-    }
-
-    return wil::safe_cast<int>(longValue);
+    return IniFileSettingsHelperFunctions::StringToInt(*data);
 }
 
 void IniFileSettings::SetInt(PCWSTR valueName, int value) {
@@ -713,21 +1075,7 @@ std::optional<std::vector<BYTE>> IniFileSettings::GetBinary(
         return std::nullopt;
     }
 
-    // Adapted from https://stackoverflow.com/a/3382894
-    const auto len = data->length();
-    if (len % 2 != 0) {
-        throw std::invalid_argument("odd length");
-    }
-
-    std::vector<BYTE> result;
-    result.reserve(len / 2);
-    for (auto it = data->begin(); it != data->end();) {
-        int hi = IniFileSettingsHelperFunctions::HexDigitValue(*it++);
-        int lo = IniFileSettingsHelperFunctions::HexDigitValue(*it++);
-        result.push_back(hi << 4 | lo);
-    }
-
-    return result;
+    return IniFileSettingsHelperFunctions::HexStringToBuffer(*data);
 }
 
 void IniFileSettings::SetBinary(PCWSTR valueName,
@@ -748,12 +1096,16 @@ void IniFileSettings::SetBinary(PCWSTR valueName,
 }
 
 void IniFileSettings::Remove(PCWSTR valueName) {
+    CountIoWrite();
     SetLastError(0);
 
     WritePrivateProfileString(sectionName.c_str(), valueName, nullptr,
                               filename.c_str());
 
     DWORD error = GetLastError();
+
+    IniFileSettingsHelperFunctions::IniFileCache::GetInstance().Invalidate(
+        filename);
     if (error != ERROR_SUCCESS && error != ERROR_FILE_NOT_FOUND &&
         error != ERROR_PATH_NOT_FOUND) {
         PORTABLE_SETTINGS_THROW_WIN32(error);
@@ -771,15 +1123,102 @@ IniFileSettings::EnumIterator<std::wstring> IniFileSettings::EnumStringValues()
         std::make_unique<EnumIteratorIniFileString>(this));
 }
 
+IniFileSettings::Values IniFileSettings::ReadAll() const {
+    Values values;
+    values.iniFile = true;
+
+    auto content =
+        IniFileSettingsHelperFunctions::IniFileCache::GetInstance().Get(
+            filename);
+    if (!content) {
+        return values;
+    }
+
+    auto section = content->FindSection(sectionName);
+    if (!section) {
+        return values;
+    }
+
+    values.items.reserve(section->values.size());
+    for (const auto& [name, value] : section->values) {
+        values.items.push_back({name, value, 0, REG_SZ});
+    }
+
+    return values;
+}
+
 // static
 void IniFileSettings::RemoveSection(PCWSTR filename, PCWSTR sectionName) {
+    CountIoWrite();
     SetLastError(0);
 
     WritePrivateProfileString(sectionName, nullptr, nullptr, filename);
 
     DWORD error = GetLastError();
+
+    IniFileSettingsHelperFunctions::IniFileCache::GetInstance().Invalidate(
+        filename);
     if (error != ERROR_SUCCESS && error != ERROR_FILE_NOT_FOUND &&
         error != ERROR_PATH_NOT_FOUND) {
         PORTABLE_SETTINGS_THROW_WIN32(error);
     }
 }
+
+////////////////////////////////////////////////////////////////////////////////
+// PortableSettings::Values
+
+std::optional<std::wstring> PortableSettings::Values::GetString(
+    PCWSTR valueName) const {
+    const Item* item = Find(valueName);
+    if (!item) {
+        return std::nullopt;
+    }
+
+    if (iniFile) {
+        return item->data;
+    }
+
+    return RegistrySettingsHelperFunctions::RawItemToString(
+        item->data, item->dataSize, item->dataType);
+}
+
+std::optional<int> PortableSettings::Values::GetInt(PCWSTR valueName) const {
+    const Item* item = Find(valueName);
+    if (!item) {
+        return std::nullopt;
+    }
+
+    if (iniFile) {
+        return IniFileSettingsHelperFunctions::StringToInt(item->data);
+    }
+
+    return RegistrySettingsHelperFunctions::RawItemToInt(
+        item->data, item->dataSize, item->dataType);
+}
+
+std::optional<std::vector<BYTE>> PortableSettings::Values::GetBinary(
+    PCWSTR valueName) const {
+    const Item* item = Find(valueName);
+    if (!item) {
+        return std::nullopt;
+    }
+
+    if (iniFile) {
+        return IniFileSettingsHelperFunctions::HexStringToBuffer(item->data);
+    }
+
+    return RegistrySettingsHelperFunctions::RawItemToBuffer(
+        item->data, item->dataSize, item->dataType);
+}
+
+const PortableSettings::Values::Item* PortableSettings::Values::Find(
+    PCWSTR valueName) const {
+    for (const auto& item : items) {
+        if (IniFileSettingsHelperFunctions::EqualsIgnoreCase(item.name,
+                                                             valueName)) {
+            return &item;
+        }
+    }
+
+    return nullptr;
+}
@@ -45,6 +45,32 @@ class PortableSettings {
         std::unique_ptr<EnumIteratorImpl<Type>> impl;
     };
 
+    // All values of a section, read in a single pass by ReadAll. The getters
+    // convert the values in the same way as the getters of the storage which
+    // the values were read from.
+    class Values {
+       public:
+        std::optional<std::wstring> GetString(PCWSTR valueName) const;
+        std::optional<int> GetInt(PCWSTR valueName) const;
+        std::optional<std::vector<BYTE>> GetBinary(PCWSTR valueName) const;
+
+       private:
+        friend class RegistrySettings;
+        friend class IniFileSettings;
+
+        struct Item {
+            std::wstring name;
+            std::wstring data;
+            DWORD dataSize;
+            DWORD dataType;
+        };
+
+        const Item* Find(PCWSTR valueName) const;
+
+        bool iniFile = false;
+        std::vector<Item> items;
+    };
+
     PortableSettings(const PortableSettings&) = delete;
     PortableSettings(PortableSettings&&) = delete;
     PortableSettings& operator=(const PortableSettings&) = delete;
@@ -62,6 +88,18 @@ class PortableSettings {
     virtual void Remove(PCWSTR valueName) = 0;
     virtual EnumIterator<int> EnumIntValues() const = 0;
     virtual EnumIterator<std::wstring> EnumStringValues() const = 0;
+    virtual Values ReadAll() const = 0;
+
+    // The amount of calls which reached the registry or an ini file in the
+    // current process, for all instances. Reads which are answered from the
+    // cache of parsed ini files aren't counted, but checking whether a cached
+    // file is up to date is.
+    struct IoCounts {
+        ULONGLONG reads;
+        ULONGLONG writes;
+    };
+
+    static IoCounts GetIoCounts();
 
    protected:
     PortableSettings() = default;
@@ -70,6 +108,8 @@ class PortableSettings {
 class RegistrySettings : public PortableSettings {
    public:
     RegistrySettings(HKEY hKey, PCWSTR subKey, bool write);
+    // Uses an already opened key, e.g. a cached one.
+    explicit RegistrySettings(wil::shared_hkey hKey);
 
     std::optional<std::wstring> GetString(PCWSTR valueName) const override;
     void SetString(PCWSTR valueName, PCWSTR string) override;
@@ -82,8 +122,11 @@ class RegistrySettings : public PortableSettings {
     void Remove(PCWSTR valueName) override;
     EnumIterator<int> EnumIntValues() const override;
     EnumIterator<std::wstring> EnumStringValues() const override;
+    Values ReadAll() const override;
 
     static void RemoveSection(HKEY hKey, PCWSTR subKey);
+    // Creates the key if it doesn't exist.
+    static wil::unique_hkey OpenKey(HKEY hKey, PCWSTR subKey, bool write);
 
    private:
     struct RawData {
@@ -94,7 +137,7 @@ class RegistrySettings : public PortableSettings {
 
     std::optional<RawData> GetRaw(PCWSTR valueName) const;
 
-    wil::unique_hkey hKey;
+    wil::shared_hkey hKey;
 };
 
 class IniFileSettings : public PortableSettings {
@@ -112,6 +155,7 @@ class IniFileSettings : public PortableSettings {
     void Remove(PCWSTR valueName) override;
     EnumIterator<int> EnumIntValues() const override;
     EnumIterator<std::wstring> EnumStringValues() const override;
+    Values ReadAll() const override;
 
     static void RemoveSection(PCWSTR filename, PCWSTR sectionName);
 